@@ -232,7 +232,8 @@ configure_zone(const char *vclass, const char *view,
 	cfg_map_get(zoptions, "database", &dbobj);
 	if (dbobj != NULL &&
 	    strcmp("rbt", cfg_obj_asstring(dbobj)) != 0 &&
-	    strcmp("rbt64", cfg_obj_asstring(dbobj)) != 0)
+	    strcmp("rbt64", cfg_obj_asstring(dbobj)) != 0 &&
+	    strcmp("qp", cfg_obj_asstring(dbobj)) != 0)
 		return (ISC_R_SUCCESS);
 
 	cfg_map_get(zoptions, "dlz", &dlzobj);
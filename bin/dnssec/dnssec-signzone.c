@@ -24,6 +24,7 @@
 
 #include <config.h>
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
@@ -111,11 +112,31 @@ static int nsec_datatype = dns_rdatatype_nsec;
 #define SOA_SERIAL_UNIXTIME	2
 #define SOA_SERIAL_DATE		3
 
+/*%
+ * The number of consecutive names handed to a worker at a time.
+ */
+#define CHUNKSIZE 1024
+
+/*%
+ * A contiguous range of names to be signed by one worker.  The worker
+ * writes the signed names to 'fp', a temporary file, and the master
+ * copies the chunks to the output file in order of 'seq'.
+ */
+typedef struct signer_chunk signer_chunk_t;
+struct signer_chunk {
+	unsigned int		seq;
+	unsigned int		count;
+	dns_fixedname_t		names[CHUNKSIZE];
+	dns_dbnode_t *		nodes[CHUNKSIZE];
+	isc_boolean_t		signit[CHUNKSIZE];
+	FILE *			fp;
+	ISC_LINK(signer_chunk_t) link;
+};
+
 typedef struct signer_event sevent_t;
 struct signer_event {
 	ISC_EVENT_COMMON(sevent_t);
-	dns_fixedname_t *fname;
-	dns_dbnode_t *node;
+	signer_chunk_t *chunk;
 };
 
 static dns_dnsseckeylist_t keylist;
@@ -189,7 +210,7 @@ static void
 sign(isc_task_t *task, isc_event_t *event);
 
 static void
-dumpnode(dns_name_t *name, dns_dbnode_t *node) {
+dumpnode(dns_name_t *name, dns_dbnode_t *node, FILE *fp) {
 	dns_rdataset_t rds;
 	dns_rdatasetiter_t *iter = NULL;
 	isc_buffer_t *buffer = NULL;
@@ -202,7 +223,7 @@ dumpnode(dns_name_t *name, dns_dbnode_t *node) {
 
 	if (!output_dnssec_only) {
 		result = dns_master_dumpnodetostream(mctx, gdb, gversion, node,
-						     name, masterstyle, outfp);
+						     name, masterstyle, fp);
 		check_result(result, "dns_master_dumpnodetostream");
 		return;
 	}
@@ -244,7 +265,7 @@ dumpnode(dns_name_t *name, dns_dbnode_t *node) {
 		check_result(result, "dns_master_rdatasettotext");
 
 		isc_buffer_usedregion(buffer, &r);
-		result = isc_stdio_write(r.base, 1, r.length, outfp, NULL);
+		result = isc_stdio_write(r.base, 1, r.length, fp, NULL);
 		check_result(result, "isc_stdio_write");
 		isc_buffer_clear(buffer);
 
@@ -1410,7 +1431,7 @@ signapex(void) {
 	result = dns_dbiterator_current(gdbiter, &node, name);
 	check_dns_dbiterator_current(result);
 	signname(node, name);
-	dumpnode(name, node);
+	dumpnode(name, node, outfp);
 	cleannode(gdb, gversion, node);
 	dns_db_detachnode(gdb, &node);
 	result = dns_dbiterator_first(gdbiter);
@@ -1422,12 +1443,12 @@ signapex(void) {
 }
 
 /*%
- * Assigns a node to a worker thread.  This is protected by the master task's
- * lock.
+ * Assigns the next range of nodes to a worker thread.  This is protected
+ * by the master task's lock.
  */
 static void
 assignwork(isc_task_t *task, isc_task_t *worker) {
-	dns_fixedname_t *fname;
+	signer_chunk_t *chunk;
 	dns_name_t *name;
 	dns_dbnode_t *node;
 	sevent_t *sevent;
@@ -1437,6 +1458,7 @@ assignwork(isc_task_t *task, isc_task_t *worker) {
 	static dns_name_t *zonecut = NULL;	/* Protected by namelock. */
 	static dns_fixedname_t fzonecut;	/* Protected by namelock. */
 	static unsigned int ended = 0;		/* Protected by namelock. */
+	static unsigned int nextseq = 0;	/* Protected by namelock. */
 
 	if (shuttingdown)
 		return;
@@ -1451,14 +1473,17 @@ assignwork(isc_task_t *task, isc_task_t *worker) {
 		goto unlock;
 	}
 
-	fname = isc_mem_get(mctx, sizeof(dns_fixedname_t));
-	if (fname == NULL)
+	chunk = isc_mem_get(mctx, sizeof(*chunk));
+	if (chunk == NULL)
 		fatal("out of memory");
-	dns_fixedname_init(fname);
-	name = dns_fixedname_name(fname);
-	node = NULL;
-	found = ISC_FALSE;
-	while (!found) {
+	chunk->count = 0;
+	chunk->fp = NULL;
+	ISC_LINK_INIT(chunk, link);
+	while (chunk->count < CHUNKSIZE) {
+		dns_fixedname_init(&chunk->names[chunk->count]);
+		name = dns_fixedname_name(&chunk->names[chunk->count]);
+		node = NULL;
+		found = ISC_FALSE;
 		result = dns_dbiterator_current(gdbiter, &node, name);
 		check_dns_dbiterator_current(result);
 		/*
@@ -1474,7 +1499,7 @@ assignwork(isc_task_t *task, isc_task_t *worker) {
 		 * For NSEC3 zones the NSEC3 nodes are zone data but
 		 * outside of the zone name space.  For the rest we need
 		 * to track the bottom of zone cuts.
-		 * Nodes which don't need to be signed are dumped here.
+		 * Nodes which don't need to be signed are only dumped.
 		 */
 		dns_rdataset_init(&nsec);
 		result = dns_db_findrdataset(gdb, node, gversion,
@@ -1500,10 +1525,9 @@ assignwork(isc_task_t *task, isc_task_t *worker) {
 			}
 		}
 
-		if (!found) {
-			dumpnode(name, node);
-			dns_db_detachnode(gdb, &node);
-		}
+		chunk->nodes[chunk->count] = node;
+		chunk->signit[chunk->count] = found;
+		chunk->count++;
 
  next:
 		result = dns_dbiterator_next(gdbiter);
@@ -1514,23 +1538,24 @@ assignwork(isc_task_t *task, isc_task_t *worker) {
 			fatal("failure iterating database: %s",
 			      isc_result_totext(result));
 	}
-	if (!found) {
+	if (chunk->count == 0) {
 		ended++;
 		if (ended == ntasks) {
 			isc_task_detach(&task);
 			isc_app_shutdown();
 		}
-		isc_mem_put(mctx, fname, sizeof(dns_fixedname_t));
+		isc_mem_put(mctx, chunk, sizeof(*chunk));
 		goto unlock;
 	}
+	chunk->seq = nextseq++;
+
 	sevent = (sevent_t *)
 		 isc_event_allocate(mctx, task, SIGNER_EVENT_WORK,
 				    sign, NULL, sizeof(sevent_t));
 	if (sevent == NULL)
 		fatal("failed to allocate event\n");
 
-	sevent->node = node;
-	sevent->fname = fname;
+	sevent->chunk = chunk;
 	isc_task_send(worker, ISC_EVENT_PTR(&sevent));
  unlock:
 	UNLOCK(&namelock);
@@ -1549,44 +1574,110 @@ startworker(isc_task_t *task, isc_event_t *event) {
 }
 
 /*%
- * Write a node to the output file, and restart the worker task.
+ * Copy a signed chunk to the output file and free it.
+ */
+static void
+flushchunk(signer_chunk_t *chunk) {
+	char buf[BUFSIZE * 8];
+	isc_result_t result;
+	size_t n;
+
+	if (chunk->fp != NULL) {
+		result = isc_stdio_seek(chunk->fp, 0, SEEK_SET);
+		check_result(result, "isc_stdio_seek");
+		do {
+			result = isc_stdio_read(buf, 1, sizeof(buf),
+						chunk->fp, &n);
+			if (result != ISC_R_SUCCESS && result != ISC_R_EOF)
+				fatal("failed to read temporary file: %s",
+				      isc_result_totext(result));
+			if (n > 0) {
+				isc_result_t wresult;
+
+				wresult = isc_stdio_write(buf, 1, n, outfp,
+							  NULL);
+				check_result(wresult, "isc_stdio_write");
+			}
+		} while (result == ISC_R_SUCCESS);
+		(void)isc_stdio_close(chunk->fp);
+	}
+	isc_mem_put(mctx, chunk, sizeof(*chunk));
+}
+
+/*%
+ * Write out the chunks that are now in sequence, and restart the
+ * worker task.  Chunks that finish early wait in 'pending' until the
+ * chunks before them have been written, so the output is in the
+ * order of the database.
  */
 static void
-writenode(isc_task_t *task, isc_event_t *event) {
+writechunk(isc_task_t *task, isc_event_t *event) {
 	isc_task_t *worker;
 	sevent_t *sevent = (sevent_t *)event;
+	signer_chunk_t *chunk, *prev;
+	static ISC_LIST(signer_chunk_t) pending = { NULL, NULL };
+	static unsigned int nextwrite = 0;
 
 	worker = (isc_task_t *)event->ev_sender;
-	dumpnode(dns_fixedname_name(sevent->fname), sevent->node);
-	cleannode(gdb, gversion, sevent->node);
-	dns_db_detachnode(gdb, &sevent->node);
-	isc_mem_put(mctx, sevent->fname, sizeof(dns_fixedname_t));
-	assignwork(task, worker);
+	chunk = sevent->chunk;
 	isc_event_free(&event);
+
+	prev = ISC_LIST_TAIL(pending);
+	while (prev != NULL && prev->seq > chunk->seq)
+		prev = ISC_LIST_PREV(prev, link);
+	if (prev == NULL)
+		ISC_LIST_PREPEND(pending, chunk, link);
+	else
+		ISC_LIST_INSERTAFTER(pending, prev, chunk, link);
+
+	while ((chunk = ISC_LIST_HEAD(pending)) != NULL &&
+	       chunk->seq == nextwrite)
+	{
+		ISC_LIST_UNLINK(pending, chunk, link);
+		flushchunk(chunk);
+		nextwrite++;
+	}
+
+	assignwork(task, worker);
 }
 
 /*%
- *  Sign a database node.
+ *  Sign a range of database nodes, writing them to a temporary file
+ *  for the master to copy to the output.
  */
 static void
 sign(isc_task_t *task, isc_event_t *event) {
-	dns_fixedname_t *fname;
-	dns_dbnode_t *node;
+	signer_chunk_t *chunk;
+	dns_name_t *name;
 	sevent_t *sevent, *wevent;
+	unsigned int i;
 
 	sevent = (sevent_t *)event;
-	node = sevent->node;
-	fname = sevent->fname;
+	chunk = sevent->chunk;
 	isc_event_free(&event);
 
-	signname(node, dns_fixedname_name(fname));
+	if (outputformat == dns_masterformat_text) {
+		chunk->fp = tmpfile();
+		if (chunk->fp == NULL)
+			fatal("failed to create temporary file");
+	}
+
+	for (i = 0; i < chunk->count; i++) {
+		name = dns_fixedname_name(&chunk->names[i]);
+		if (chunk->signit[i])
+			signname(chunk->nodes[i], name);
+		dumpnode(name, chunk->nodes[i], chunk->fp);
+		if (chunk->signit[i])
+			cleannode(gdb, gversion, chunk->nodes[i]);
+		dns_db_detachnode(gdb, &chunk->nodes[i]);
+	}
+
 	wevent = (sevent_t *)
 		 isc_event_allocate(mctx, task, SIGNER_EVENT_WRITE,
-				    writenode, NULL, sizeof(sevent_t));
+				    writechunk, NULL, sizeof(sevent_t));
 	if (wevent == NULL)
 		fatal("failed to allocate event\n");
-	wevent->node = node;
-	wevent->fname = fname;
+	wevent->chunk = chunk;
 	isc_task_send(master, ISC_EVENT_PTR(&wevent));
 }
 
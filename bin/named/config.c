@@ -96,6 +96,7 @@ options {\n\
 	request-nsid false;\n\
 	reserved-sockets 512;\n\
 	resolver-query-timeout 10;\n\
+	reuseport no;\n\
 	secroots-file \"named.secroots\";\n\
 	send-cookie true;\n\
 #	serial-queries <obsolete>;\n\
@@ -103,7 +104,8 @@ options {\n\
 	server-id none;\n\
 	session-keyalg hmac-sha256;\n\
 #	session-keyfile \"" NAMED_LOCALSTATEDIR "/run/named/session.key\";\n\
-	session-keyname local-ddns;\n"
+	session-keyname local-ddns;\n\
+	sig-signing-threads 0;\n"
 #ifndef WIN32
 "	stacksize default;\n"
 #endif
@@ -116,6 +118,7 @@ options {\n\
 	tcp-initial-timeout 300;\n\
 	tcp-keepalive-timeout 300;\n\
 	tcp-listen-queue 10;\n\
+	tcp-pipeline-limit 32;\n\
 #	tkey-dhkey <none>\n\
 #	tkey-domain <none>\n\
 #	tkey-gssapi-credential <none>\n\
@@ -125,6 +128,7 @@ options {\n\
 	transfers-per-ns 2;\n\
 #	treat-cr-as-space <obsolete>;\n\
 	trust-anchor-telemetry yes;\n\
+	udp-batch 16;\n\
 #	use-id-pool <obsolete>;\n\
 #	use-ixfr <obsolete>;\n\
 \n\
@@ -191,6 +195,7 @@ options {\n\
 	require-server-cookie no;\n\
 	resolver-nonbackoff-tries 3;\n\
 	resolver-retry-interval 800; /* in milliseconds */\n\
+	response-cache-size 0;\n\
 #	rfc2308-type1 <obsolete>;\n\
 	servfail-ttl 1;\n\
 #	sortlist <none>\n\
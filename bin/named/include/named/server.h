@@ -58,6 +58,7 @@ struct named_server {
 	/* Server data structures. */
 	dns_loadmgr_t *		loadmgr;
 	dns_zonemgr_t *		zonemgr;
+	dns_verifypool_t *	verifypool;	/*%< Checks RRSIGs */
 	dns_viewlist_t		viewlist;
 	ns_interfacemgr_t *	interfacemgr;
 	dns_db_t *		in_roothints;
@@ -79,6 +80,8 @@ struct named_server {
 	isc_stats_t *		zonestats;	/*% Zone management stats */
 	isc_stats_t  *		resolverstats;	/*% Resolver stats */
 	isc_stats_t *		sockstats;	/*%< Socket stats */
+	isc_stats_t *		dnssecstats;	/*%< DNSSEC stats */
+	dns_sigcache_t *	sigcache;	/*%< Good signatures */
 
 	named_controls_t *	controls;	/*%< Control channels */
 	unsigned int		dispatchgen;
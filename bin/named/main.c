@@ -826,8 +826,12 @@ create_managers(void) {
 		return (ISC_R_UNEXPECTED);
 	}
 
-	result = isc_socketmgr_create2(named_g_mctx, &named_g_socketmgr,
-				       maxsocks);
+	/*
+	 * One watcher thread per UDP listener, so that each listener's
+	 * socket is polled on a CPU of its own.
+	 */
+	result = isc_socketmgr_create3(named_g_mctx, &named_g_socketmgr,
+				       maxsocks, named_g_udpdisp);
 	if (result != ISC_R_SUCCESS) {
 		UNEXPECTED_ERROR(__FILE__, __LINE__,
 				 "isc_socketmgr_create() failed: %s",
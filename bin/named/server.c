@@ -62,6 +62,7 @@
 #include <dns/dlz.h>
 #include <dns/dnsrps.h>
 #include <dns/dns64.h>
+#include <dns/dnssec.h>
 #include <dns/dyndb.h>
 #include <dns/events.h>
 #include <dns/forward.h>
@@ -83,14 +84,17 @@
 #include <dns/rdataset.h>
 #include <dns/rdatastruct.h>
 #include <dns/resolver.h>
+#include <dns/respcache.h>
 #include <dns/rootns.h>
 #include <dns/rriterator.h>
 #include <dns/secalg.h>
+#include <dns/sigcache.h>
 #include <dns/soa.h>
 #include <dns/stats.h>
 #include <dns/tkey.h>
 #include <dns/tsig.h>
 #include <dns/ttl.h>
+#include <dns/verifypool.h>
 #include <dns/view.h>
 #include <dns/zone.h>
 #include <dns/zt.h>
@@ -101,6 +105,7 @@
 #include <ns/client.h>
 #include <ns/listenlist.h>
 #include <ns/interfacemgr.h>
+#include <ns/xfrout.h>
 
 #include <named/config.h>
 #include <named/control.h>
@@ -148,10 +153,12 @@
 #define RESOLVER_NTASKS 523
 #define UDPBUFFERS 32768
 #define EXCLBUFFERS 32768
+#define SIGCACHE_SIZE 262144
 #else
 #define RESOLVER_NTASKS 31
 #define UDPBUFFERS 1000
 #define EXCLBUFFERS 4096
+#define SIGCACHE_SIZE 65536
 #endif /* TUNE_LARGE */
 
 #define MAX_TCP_TIMEOUT 65535
@@ -3658,7 +3665,7 @@ configure_view(dns_view_t *view, dns_viewlist_t *viewlist,
 	size_t max_cache_size;
 	isc_uint32_t max_cache_size_percent = 0;
 	size_t max_adb_size;
-	isc_uint32_t lame_ttl, fail_ttl;
+	isc_uint32_t lame_ttl, fail_ttl, respcache_size;
 	isc_uint32_t max_stale_ttl;
 	dns_tsig_keyring_t *ring = NULL;
 	dns_view_t *pview = NULL;	/* Production view */
@@ -4270,13 +4277,15 @@ configure_view(dns_view_t *view, dns_viewlist_t *viewlist,
 	}
 
 	if (resstats == NULL) {
-		CHECK(isc_stats_create(mctx, &resstats,
-				       dns_resstatscounter_max));
+		CHECK(isc_stats_create2(mctx, &resstats,
+					dns_resstatscounter_max,
+					ISC_STATSCREATE_SHARDED));
 	}
 	dns_view_setresstats(view, resstats);
 	if (resquerystats == NULL)
 		CHECK(dns_rdatatypestats_create(mctx, &resquerystats));
 	dns_view_setresquerystats(view, resquerystats);
+	dns_view_setverifypool(view, named_g_server->verifypool);
 
 	ndisp = 4 * ISC_MIN(named_g_udpdisp, MAX_UDP_DISPATCH);
 	CHECK(dns_view_createresolver(view, named_g_taskmgr, RESOLVER_NTASKS,
@@ -5297,6 +5306,17 @@ configure_view(dns_view_t *view, dns_viewlist_t *viewlist,
 		fail_ttl = 30;
 	dns_view_setfailttl(view, fail_ttl);
 
+	/*
+	 * Set up the response cache.
+	 */
+	obj = NULL;
+	result = named_config_get(maps, "response-cache-size", &obj);
+	INSIST(result == ISC_R_SUCCESS);
+	respcache_size = cfg_obj_asuint32(obj);
+	if (respcache_size > 0 && view->respcache == NULL)
+		CHECK(dns_respcache_create(mctx, respcache_size,
+					   &view->respcache));
+
 	/*
 	 * Name space to look up redirect information in.
 	 */
@@ -8135,6 +8155,33 @@ load_configuration(const char *filename, named_server_t *server,
 	server->sctx->transfer_tcp_message_size =
 		(isc_uint16_t) transfer_message_size;
 
+	/* Set the number of queries worked on at once per TCP connection */
+	obj = NULL;
+	result = named_config_get(maps, "tcp-pipeline-limit", &obj);
+	INSIST(result == ISC_R_SUCCESS);
+	server->sctx->tcppipelinelimit = cfg_obj_asuint32(obj);
+	if (server->sctx->tcppipelinelimit == 0)
+		server->sctx->tcppipelinelimit = 1;
+
+	/*
+	 * Set how many datagrams UDP listeners move per system call.
+	 * This only takes effect on listeners opened from now on.
+	 */
+	obj = NULL;
+	result = named_config_get(maps, "udp-batch", &obj);
+	INSIST(result == ISC_R_SUCCESS);
+	server->sctx->udpbatch = cfg_obj_asuint32(obj);
+
+	/*
+	 * Likewise, decide whether UDP listeners opened from now on get
+	 * a SO_REUSEPORT socket each.
+	 */
+	obj = NULL;
+	result = named_config_get(maps, "reuseport", &obj);
+	INSIST(result == ISC_R_SUCCESS);
+	ns_server_setoption(server->sctx, NS_SERVER_REUSEPORT,
+			    cfg_obj_asboolean(obj));
+
 	/*
 	 * Configure the zone manager.
 	 */
@@ -8164,6 +8211,21 @@ load_configuration(const char *filename, named_server_t *server,
 	INSIST(result == ISC_R_SUCCESS);
 	dns_zonemgr_setserialqueryrate(server->zonemgr, cfg_obj_asuint32(obj));
 
+	obj = NULL;
+	result = named_config_get(maps, "sig-signing-threads", &obj);
+	INSIST(result == ISC_R_SUCCESS);
+	result = dns_zonemgr_setsigningthreads(server->zonemgr,
+					       cfg_obj_asuint32(obj));
+	if (result == ISC_R_NOTIMPLEMENTED) {
+		cfg_obj_log(obj, named_g_lctx, ISC_LOG_WARNING,
+			    "sig-signing-threads requires threads; ignored");
+	} else if (result != ISC_R_SUCCESS) {
+		cfg_obj_log(obj, named_g_lctx, ISC_LOG_ERROR,
+			    "could not set sig-signing-threads: %s",
+			    isc_result_totext(result));
+		goto cleanup;
+	}
+
 	/*
 	 * Determine which port to use for listening for incoming connections.
 	 */
@@ -9317,6 +9379,7 @@ shutdown_server(isc_task_t *task, isc_event_t *event) {
 
 	ns_interfacemgr_shutdown(server->interfacemgr);
 	ns_interfacemgr_detach(&server->interfacemgr);
+	ns_xfrcache_shutdown(server->sctx->xfrcache);
 
 	dns_dispatchmgr_destroy(&named_g_dispatchmgr);
 
@@ -9491,6 +9554,21 @@ named_server_create(isc_mem_t *mctx, named_server_t **serverp) {
 		   "dns_zonemgr_create");
 	CHECKFATAL(dns_zonemgr_setsize(server->zonemgr, 1000),
 		   "dns_zonemgr_setsize");
+	/*
+	 * Read (and write) as many zone files at a time as there are
+	 * worker threads, so that zones are loaded in parallel.
+	 */
+	dns_zonemgr_setiolimit(server->zonemgr, named_g_cpus);
+
+	/*
+	 * Validators check signatures on threads of their own, so that
+	 * a response with many signatures does not hold up the other
+	 * fetches on its task.
+	 */
+	server->verifypool = NULL;
+	CHECKFATAL(dns_verifypool_create(named_g_mctx, named_g_cpus,
+					 &server->verifypool),
+		   "dns_verifypool_create");
 
 	server->statsfile = isc_mem_strdup(server->mctx, "named.stats");
 	CHECKFATAL(server->statsfile == NULL ? ISC_R_NOMEMORY : ISC_R_SUCCESS,
@@ -9522,8 +9600,9 @@ named_server_create(isc_mem_t *mctx, named_server_t **serverp) {
 	server->zonestats = NULL;
 	server->resolverstats = NULL;
 	server->sockstats = NULL;
-	CHECKFATAL(isc_stats_create(server->mctx, &server->sockstats,
-				    isc_sockstatscounter_max),
+	CHECKFATAL(isc_stats_create2(server->mctx, &server->sockstats,
+				     isc_sockstatscounter_max,
+				     ISC_STATSCREATE_SHARDED),
 		   "isc_stats_create");
 	isc_socketmgr_setstats(named_g_socketmgr, server->sockstats);
 
@@ -9531,10 +9610,24 @@ named_server_create(isc_mem_t *mctx, named_server_t **serverp) {
 				    dns_zonestatscounter_max),
 		   "dns_stats_create (zone)");
 
-	CHECKFATAL(isc_stats_create(named_g_mctx, &server->resolverstats,
-				    dns_resstatscounter_max),
+	CHECKFATAL(isc_stats_create2(named_g_mctx, &server->resolverstats,
+				     dns_resstatscounter_max,
+				     ISC_STATSCREATE_SHARDED),
 		   "dns_stats_create (resolver)");
 
+	server->dnssecstats = NULL;
+	CHECKFATAL(isc_stats_create2(named_g_mctx, &server->dnssecstats,
+				     dns_dnssecstats_max,
+				     ISC_STATSCREATE_SHARDED),
+		   "dns_stats_create (dnssec)");
+	dns_dnssec_stats = server->dnssecstats;
+
+	server->sigcache = NULL;
+	CHECKFATAL(dns_sigcache_create(named_g_mctx, SIGCACHE_SIZE,
+				       &server->sigcache),
+		   "dns_sigcache_create");
+	dns_dnssec_sigcache = server->sigcache;
+
 	server->flushonshutdown = ISC_FALSE;
 
 	server->controls = NULL;
@@ -9580,6 +9673,8 @@ named_server_destroy(named_server_t **serverp) {
 	isc_stats_detach(&server->zonestats);
 	isc_stats_detach(&server->sockstats);
 	isc_stats_detach(&server->resolverstats);
+	dns_dnssec_stats = NULL;
+	isc_stats_detach(&server->dnssecstats);
 
 	if (server->sctx != NULL)
 		ns_server_detach(&server->sctx);
@@ -9600,6 +9695,12 @@ named_server_destroy(named_server_t **serverp) {
 	if (server->zonemgr != NULL)
 		dns_zonemgr_detach(&server->zonemgr);
 
+	if (server->verifypool != NULL)
+		dns_verifypool_detach(&server->verifypool);
+
+	dns_dnssec_sigcache = NULL;
+	dns_sigcache_destroy(&server->sigcache);
+
 	dst_lib_destroy();
 
 	isc_event_free(&server->reload_event);
@@ -13334,6 +13435,9 @@ named_server_delzone(named_server_t *server, isc_lex_t *lex,
 	else
 		CHECK(dns_zt_unmount(view->zonetable, zone));
 
+	/* Drop any IXFR responses cached for it */
+	ns_xfrcache_flush(server->sctx->xfrcache, zone);
+
 	/* Send cleanup event */
 	dz = isc_mem_get(named_g_mctx, sizeof(*dz));
 	if (dz == NULL)
@@ -13649,6 +13753,7 @@ named_server_signing(named_server_t *server, isc_lex_t *lex,
 	dns_dbversion_t *version = NULL;
 	dns_rdatatype_t privatetype;
 	dns_rdataset_t privset;
+	dns_signingstats_t stats;
 	isc_boolean_t first = ISC_TRUE;
 	isc_boolean_t list = ISC_FALSE, clear = ISC_FALSE;
 	isc_boolean_t chain = ISC_FALSE;
@@ -13776,14 +13881,12 @@ named_server_signing(named_server_t *server, isc_lex_t *lex,
 		result = dns_db_findrdataset(db, node, version, privatetype,
 					     dns_rdatatype_none, 0,
 					     &privset, NULL);
-		if (result == ISC_R_NOTFOUND) {
-			(void) putstr(text, "No signing records found");
-			(void) putnull(text);
-			result = ISC_R_SUCCESS;
-			goto cleanup;
-		}
+		if (result == ISC_R_SUCCESS)
+			result = dns_rdataset_first(&privset);
+		else if (result == ISC_R_NOTFOUND)
+			result = ISC_R_NOMORE;
 
-		for (result = dns_rdataset_first(&privset);
+		for (;
 		     result == ISC_R_SUCCESS;
 		     result = dns_rdataset_next(&privset))
 		{
@@ -13800,11 +13903,46 @@ named_server_signing(named_server_t *server, isc_lex_t *lex,
 			CHECK(putstr(text, output));
 			first = ISC_FALSE;
 		}
-		if (!first)
-			CHECK(putnull(text));
+		if (result != ISC_R_NOMORE)
+			goto cleanup;
 
-		if (result == ISC_R_NOMORE)
-			result = ISC_R_SUCCESS;
+		/*
+		 * Report how far the current signing run has got, or
+		 * how the last one went.
+		 */
+		dns_zone_getsigningstats(zone, &stats);
+		if (stats.active || stats.nodes != 0) {
+			char output[BUFSIZ];
+			char threads[sizeof(", 4294967295 threads")];
+
+			if (stats.threads != 0)
+				snprintf(threads, sizeof(threads),
+					 ", %u threads", stats.threads);
+			else
+				threads[0] = '\0';
+			snprintf(output, sizeof(output),
+				 "%s: %" ISC_PRINT_QUADFORMAT "u names, "
+				 "%" ISC_PRINT_QUADFORMAT "u signatures in "
+				 "%" ISC_PRINT_QUADFORMAT "u.%03u seconds "
+				 "(%.0f signatures/second%s)",
+				 stats.active ? "Signing in progress"
+					      : "Last signing run",
+				 stats.nodes, stats.signatures,
+				 stats.usec / 1000000,
+				 (unsigned int)(stats.usec % 1000000) / 1000,
+				 stats.usec == 0 ? 0.0 :
+				 stats.signatures * 1000000.0 / stats.usec,
+				 threads);
+			if (!first)
+				CHECK(putstr(text, "\n"));
+			CHECK(putstr(text, output));
+			first = ISC_FALSE;
+		}
+
+		if (first)
+			CHECK(putstr(text, "No signing records found"));
+		CHECK(putnull(text));
+		result = ISC_R_SUCCESS;
 	}
 
  cleanup:
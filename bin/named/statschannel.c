@@ -308,6 +308,8 @@ init_desc(void) {
 		       "QryUsedStale");
 	SET_NSSTATDESC(prefetch, "queries triggered prefetch", "Prefetch");
 	SET_NSSTATDESC(keytagopt, "Keytag option received", "KeyTagOpt");
+	SET_NSSTATDESC(respcachehit, "queries answered from response cache",
+		       "QryRespCacheHit");
 	INSIST(i == ns_statscounter_max);
 
 	/* Initialize resolver statistics */
@@ -598,6 +600,10 @@ init_desc(void) {
 	SET_DNSSECSTATDESC(wildcard, "dnssec validation of wildcard signature",
 			   "DNSSECwild");
 	SET_DNSSECSTATDESC(fail, "dnssec validation failures", "DNSSECfail");
+	SET_DNSSECSTATDESC(cachehit, "dnssec signatures found in the cache",
+			   "SigCacheHit");
+	SET_DNSSECSTATDESC(cachemiss, "dnssec signatures not in the cache",
+			   "SigCacheMiss");
 	INSIST(i == dns_dnssecstats_max);
 
 	/* Initialize dnstap statistics */
@@ -1593,6 +1599,7 @@ generatexml(named_server_t *server, isc_uint32_t flags,
 	isc_uint64_t adbstat_values[dns_adbstats_max];
 	isc_uint64_t zonestat_values[dns_zonestatscounter_max];
 	isc_uint64_t sockstat_values[isc_sockstatscounter_max];
+	isc_uint64_t dnssecstat_values[dns_dnssecstats_max];
 	isc_uint64_t udpinsizestat_values[dns_sizecounter_in_max];
 	isc_uint64_t udpoutsizestat_values[dns_sizecounter_out_max];
 	isc_uint64_t tcpinsizestat_values[dns_sizecounter_in_max];
@@ -1720,6 +1727,19 @@ generatexml(named_server_t *server, isc_uint32_t flags,
 			goto error;
 		TRY0(xmlTextWriterEndElement(writer)); /* resstat */
 
+		TRY0(xmlTextWriterStartElement(writer, ISC_XMLCHAR "counters"));
+		TRY0(xmlTextWriterWriteAttribute(writer, ISC_XMLCHAR "type",
+						 ISC_XMLCHAR "dnssec"));
+		result = dump_counters(server->dnssecstats,
+				       isc_statsformat_xml, writer,
+				       NULL, dnssecstats_xmldesc,
+				       dns_dnssecstats_max,
+				       dnssecstats_index, dnssecstat_values,
+				       0);
+		if (result != ISC_R_SUCCESS)
+			goto error;
+		TRY0(xmlTextWriterEndElement(writer)); /* dnssec */
+
 #if HAVE_DNSTAP
 		if (server->dtenv != NULL) {
 			isc_stats_t *dnstapstats = NULL;
@@ -2388,6 +2408,7 @@ generatejson(named_server_t *server, size_t *msglen,
 	isc_uint64_t adbstat_values[dns_adbstats_max];
 	isc_uint64_t zonestat_values[dns_zonestatscounter_max];
 	isc_uint64_t sockstat_values[isc_sockstatscounter_max];
+	isc_uint64_t dnssecstat_values[dns_dnssecstats_max];
 	isc_uint64_t udpinsizestat_values[dns_sizecounter_in_max];
 	isc_uint64_t udpoutsizestat_values[dns_sizecounter_out_max];
 	isc_uint64_t tcpinsizestat_values[dns_sizecounter_in_max];
@@ -2559,6 +2580,28 @@ generatejson(named_server_t *server, size_t *msglen,
 		else
 			json_object_put(counters);
 
+		/* dnssec stat counters */
+		counters = json_object_new_object();
+
+		dumparg.result = ISC_R_SUCCESS;
+		dumparg.arg = counters;
+
+		result = dump_counters(server->dnssecstats,
+				       isc_statsformat_json, counters, NULL,
+				       dnssecstats_xmldesc,
+				       dns_dnssecstats_max,
+				       dnssecstats_index, dnssecstat_values,
+				       0);
+		if (result != ISC_R_SUCCESS) {
+			json_object_put(counters);
+			goto error;
+		}
+
+		if (json_object_get_object(counters)->count != 0)
+			json_object_object_add(bindstats, "dnssec", counters);
+		else
+			json_object_put(counters);
+
 #if HAVE_DNSTAP
 		/* dnstap stat counters */
 		if (named_g_server->dtenv != NULL) {
@@ -3549,6 +3592,7 @@ named_stats_dump(named_server_t *server, FILE *fp) {
 	isc_uint64_t adbstat_values[dns_adbstats_max];
 	isc_uint64_t zonestat_values[dns_zonestatscounter_max];
 	isc_uint64_t sockstat_values[isc_sockstatscounter_max];
+	isc_uint64_t dnssecstat_values[dns_dnssecstats_max];
 	isc_uint64_t gluecachestats_values[dns_gluecachestatscounter_max];
 
 	RUNTIME_CHECK(isc_once_do(&once, init_desc) == ISC_R_SUCCESS);
@@ -3617,6 +3661,11 @@ named_stats_dump(named_server_t *server, FILE *fp) {
 				     resstat_values, 0);
 	}
 
+	fprintf(fp, "++ DNSSEC Validation Statistics ++\n");
+	(void) dump_counters(server->dnssecstats, isc_statsformat_file, fp,
+			     NULL, dnssecstats_desc, dns_dnssecstats_max,
+			     dnssecstats_index, dnssecstat_values, 0);
+
 	fprintf(fp, "++ Cache Statistics ++\n");
 	for (view = ISC_LIST_HEAD(server->viewlist);
 	     view != NULL;
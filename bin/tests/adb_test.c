@@ -18,11 +18,15 @@
 
 #include <isc/app.h>
 #include <isc/buffer.h>
+#include <isc/commandline.h>
+#include <isc/condition.h>
 #include <isc/entropy.h>
 #include <isc/hash.h>
+#include <isc/net.h>
 #include <isc/print.h>
 #include <isc/socket.h>
 #include <isc/task.h>
+#include <isc/time.h>
 #include <isc/timer.h>
 #include <isc/util.h>
 
@@ -216,6 +220,8 @@ create_view(void) {
 						      dispatchmgr,
 						      disp4, disp6) ==
 		      ISC_R_SUCCESS);
+		dns_dispatch_detach(&disp4);
+		dns_dispatch_detach(&disp6);
 	}
 
 	rootdb = NULL;
@@ -275,13 +281,170 @@ lookup(const char *target) {
 	}
 }
 
+/*
+ * Benchmark: add 'bench_count' addresses to the ADB from 'bench_ntasks'
+ * tasks, timing each lookup from the end of the previous one in the same
+ * task.  Any time a task spends unable to run while the ADB's hash
+ * tables grow shows up in the tail of the distribution.
+ */
+#define BENCH_BATCH	100		/*%< lookups per event */
+
+typedef struct bench {
+	isc_task_t *		task;
+	unsigned int		next;
+	unsigned int		last;
+	isc_uint32_t *		samples;	/*%< nanoseconds */
+	unsigned int		nsamples;
+	isc_time_t		prev;
+} bench_t;
+
+static unsigned int bench_count = 0;
+static unsigned int bench_ntasks = 4;
+static unsigned int bench_running;
+static isc_condition_t bench_cond;
+
+static isc_uint32_t
+nsecdiff(const isc_time_t *t1, const isc_time_t *t2) {
+	isc_uint64_t nsec;
+
+	nsec = (isc_uint64_t)(isc_time_seconds(t1) - isc_time_seconds(t2)) *
+		1000000000;
+	nsec += isc_time_nanoseconds(t1);
+	nsec -= isc_time_nanoseconds(t2);
+	return (nsec > 0xffffffffU ? 0xffffffffU : (isc_uint32_t)nsec);
+}
+
+static void
+bench_lookups(isc_task_t *task, isc_event_t *ev) {
+	bench_t *b = ev->ev_arg;
+	dns_adbaddrinfo_t *addr;
+	struct in_addr ina;
+	isc_sockaddr_t sa;
+	isc_result_t result;
+	isc_time_t t;
+	unsigned int i;
+
+	for (i = 0; i < BENCH_BATCH && b->next < b->last; i++, b->next++) {
+		ina.s_addr = htonl(0x0a000000 | b->next);	/* 10/8 */
+		isc_sockaddr_fromin(&sa, &ina, 53);
+		addr = NULL;
+		result = dns_adb_findaddrinfo(adb, &sa, &addr, now);
+		check_result(result, "dns_adb_findaddrinfo");
+		dns_adb_freeaddrinfo(adb, &addr);
+
+		TIME_NOW(&t);
+		b->samples[b->nsamples++] = nsecdiff(&t, &b->prev);
+		b->prev = t;
+	}
+
+	if (b->next < b->last) {
+		isc_task_send(task, &ev);
+		return;
+	}
+
+	isc_event_free(&ev);
+	CLOCK();
+	if (--bench_running == 0)
+		SIGNAL(&bench_cond);
+	CUNLOCK();
+}
+
+static int
+cmp_samples(const void *a, const void *b) {
+	isc_uint32_t x = *(const isc_uint32_t *)a;
+	isc_uint32_t y = *(const isc_uint32_t *)b;
+
+	return (x < y ? -1 : x > y ? 1 : 0);
+}
+
+static void
+bench(void) {
+	static const double pct[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+	bench_t *benches;
+	isc_uint32_t *all;
+	isc_event_t *ev;
+	isc_time_t start, finish;
+	isc_result_t result;
+	unsigned int i, j, n, slow;
+
+	benches = malloc(bench_ntasks * sizeof(*benches));
+	all = malloc(bench_count * sizeof(*all));
+	RUNTIME_CHECK(benches != NULL && all != NULL);
+	RUNTIME_CHECK(isc_condition_init(&bench_cond) == ISC_R_SUCCESS);
+
+	TIME_NOW(&start);
+	CLOCK();
+	bench_running = bench_ntasks;
+	for (i = 0; i < bench_ntasks; i++) {
+		benches[i].task = NULL;
+		result = isc_task_create(taskmgr, 0, &benches[i].task);
+		check_result(result, "isc_task_create");
+		benches[i].next = bench_count / bench_ntasks * i;
+		benches[i].last = (i + 1 == bench_ntasks) ? bench_count :
+				  benches[i].next + bench_count / bench_ntasks;
+		benches[i].samples = all + benches[i].next;
+		benches[i].nsamples = 0;
+		benches[i].prev = start;
+		ev = isc_event_allocate(mctx, NULL, 1,
+					bench_lookups, &benches[i],
+					sizeof(*ev));
+		RUNTIME_CHECK(ev != NULL);
+		isc_task_send(benches[i].task, &ev);
+	}
+	while (bench_running > 0)
+		WAIT(&bench_cond, &client_lock);
+	CUNLOCK();
+	TIME_NOW(&finish);
+
+	n = 0;
+	for (i = 0; i < bench_ntasks; i++) {
+		n += benches[i].nsamples;
+		isc_task_detach(&benches[i].task);
+	}
+	INSIST(n == bench_count);
+	qsort(all, n, sizeof(*all), cmp_samples);
+	for (slow = 0, j = 0; j < n; j++)
+		if (all[j] >= 1000000)
+			slow++;
+
+	printf("%u lookups from %u tasks in %.3f seconds\n", n,
+	       bench_ntasks, isc_time_microdiff(&finish, &start) / 1e6);
+	for (i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+		printf("  p%-6g %10.1f usec\n", pct[i],
+		       all[(unsigned int)(n * pct[i] / 100.0)] / 1000.0);
+	printf("  max     %10.1f usec\n", all[n - 1] / 1000.0);
+	printf("  %u lookups waited 1 msec or more\n", slow);
+
+	(void)isc_condition_destroy(&bench_cond);
+	free(all);
+	free(benches);
+}
+
 int
 main(int argc, char **argv) {
 	isc_result_t result;
 	isc_logdestination_t destination;
-
-	UNUSED(argc);
-	UNUSED(argv);
+	int ch;
+
+	while ((ch = isc_commandline_parse(argc, argv, "b:t:")) != -1) {
+		switch (ch) {
+		case 'b':
+			bench_count = atoi(isc_commandline_argument);
+			break;
+		case 't':
+			bench_ntasks = atoi(isc_commandline_argument);
+			break;
+		default:
+			fprintf(stderr, "usage: adb_test [-b count "
+					"[-t tasks]]\n");
+			exit(1);
+		}
+	}
+	if (bench_count != 0 &&
+	    (bench_ntasks == 0 || bench_count < bench_ntasks)) {
+		fprintf(stderr, "adb_test: -b must be at least -t\n");
+		exit(1);
+	}
 
 	dns_result_register();
 	result = isc_app_start();
@@ -332,13 +495,14 @@ main(int argc, char **argv) {
 	/*
 	 * Set the initial debug level.
 	 */
-	isc_log_setdebuglevel(lctx, 2);
+	isc_log_setdebuglevel(lctx, bench_count != 0 ? 0 : 2);
 
 	create_managers();
 
 	t1 = NULL;
 	result = isc_task_create(taskmgr, 0, &t1);
 	check_result(result, "isc_task_create t1");
+	isc_taskmgr_setexcltask(taskmgr, t1);
 	t2 = NULL;
 	result = isc_task_create(taskmgr, 0, &t2);
 	check_result(result, "isc_task_create t2");
@@ -350,6 +514,13 @@ main(int argc, char **argv) {
 
 	adb = view->adb;
 
+	if (bench_count != 0) {
+		bench();
+		isc_task_detach(&t1);
+		isc_task_detach(&t2);
+		goto shutdown;
+	}
+
 	/*
 	 * Lock the entire client list here.  This will cause all events
 	 * for found names to block as well.
@@ -404,9 +575,12 @@ main(int argc, char **argv) {
 
 	dns_adb_dump(adb, stderr);
 
+ shutdown:
 	dns_view_detach(&view);
 	adb = NULL;
 
+	fprintf(stderr, "Destroying dispatch manager\n");
+	dns_dispatchmgr_destroy(&dispatchmgr);
 	fprintf(stderr, "Destroying socket manager\n");
 	isc_socketmgr_destroy(&socketmgr);
 	fprintf(stderr, "Destroying timer manager\n");
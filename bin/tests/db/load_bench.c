@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Compare the time taken to load a zone from each of the master file
+ * formats.  The zone is read from a text file once and written out in
+ * raw and map format next to it.  Each of the three files is then
+ * loaded into a fresh database a number of times, and the SOA record
+ * looked up, as a server would before answering for the zone.  Use a
+ * large zone: the differences only show with hundreds of thousands of
+ * names.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <isc/commandline.h>
+#include <isc/file.h>
+#include <isc/mem.h>
+#include <isc/print.h>
+#include <isc/time.h>
+#include <isc/util.h>
+
+#include <dns/db.h>
+#include <dns/fixedname.h>
+#include <dns/name.h>
+#include <dns/rdataset.h>
+#include <dns/result.h>
+
+static isc_mem_t *mctx = NULL;
+static dns_fixedname_t forigin;
+static dns_name_t *origin;
+static const char *dbtype = "rbt";
+
+static isc_result_t
+load(const char *filename, dns_masterformat_t format, dns_db_t **dbp) {
+	isc_result_t result;
+	dns_db_t *db = NULL;
+
+	result = dns_db_create(mctx, dbtype, origin, dns_dbtype_zone,
+			       dns_rdataclass_in, 0, NULL, &db);
+	if (result != ISC_R_SUCCESS)
+		return (result);
+	result = dns_db_load3(db, filename, format, 0);
+	if (result != ISC_R_SUCCESS && result != DNS_R_SEENINCLUDE) {
+		dns_db_detach(&db);
+		return (result);
+	}
+	*dbp = db;
+	return (ISC_R_SUCCESS);
+}
+
+static void
+findsoa(dns_db_t *db) {
+	dns_rdataset_t rdataset;
+	dns_fixedname_t ffound;
+
+	dns_rdataset_init(&rdataset);
+	dns_fixedname_init(&ffound);
+	RUNTIME_CHECK(dns_db_find(db, origin, NULL, dns_rdatatype_soa, 0, 0,
+				  NULL, dns_fixedname_name(&ffound),
+				  &rdataset, NULL) == ISC_R_SUCCESS);
+	dns_rdataset_disassociate(&rdataset);
+}
+
+static void
+bench(const char *what, const char *filename, dns_masterformat_t format,
+      unsigned int iterations)
+{
+	isc_time_t start, loaded, answered, freed;
+	isc_uint64_t loadusec = 0, findusec = 0, freeusec = 0;
+	isc_result_t result;
+	dns_db_t *db;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		db = NULL;
+		TIME_NOW(&start);
+		result = load(filename, format, &db);
+		if (result != ISC_R_SUCCESS) {
+			fprintf(stderr, "loading %s: %s\n", filename,
+				isc_result_totext(result));
+			exit(1);
+		}
+		TIME_NOW(&loaded);
+		findsoa(db);
+		TIME_NOW(&answered);
+		dns_db_detach(&db);
+		TIME_NOW(&freed);
+
+		loadusec += isc_time_microdiff(&loaded, &start);
+		findusec += isc_time_microdiff(&answered, &loaded);
+		freeusec += isc_time_microdiff(&freed, &answered);
+	}
+
+	printf("%-6s %12.1f %12.1f %12.1f\n", what,
+	       (double)loadusec / iterations / 1000.0,
+	       (double)findusec / iterations / 1000.0,
+	       (double)freeusec / iterations / 1000.0);
+}
+
+static void
+usage(const char *progname) {
+	fprintf(stderr, "usage: %s [-d dbtype] [-n iterations] "
+		"origin zonefile\n", progname);
+	exit(1);
+}
+
+int
+main(int argc, char **argv) {
+	char rawfile[PATH_MAX], mapfile[PATH_MAX];
+	const char *progname = argv[0];
+	const char *zonefile;
+	unsigned int iterations = 3;
+	dns_db_t *db = NULL;
+	isc_result_t result;
+	int ch;
+
+	while ((ch = isc_commandline_parse(argc, argv, "d:n:")) != -1) {
+		switch (ch) {
+		case 'd':
+			dbtype = isc_commandline_argument;
+			break;
+		case 'n':
+			iterations = atoi(isc_commandline_argument);
+			break;
+		default:
+			usage(progname);
+		}
+	}
+	argc -= isc_commandline_index;
+	argv += isc_commandline_index;
+	if (argc != 2 || iterations == 0)
+		usage(progname);
+
+	RUNTIME_CHECK(isc_mem_create(0, 0, &mctx) == ISC_R_SUCCESS);
+	dns_result_register();
+
+	dns_fixedname_init(&forigin);
+	origin = dns_fixedname_name(&forigin);
+	result = dns_name_fromstring(origin, argv[0], 0, NULL);
+	if (result != ISC_R_SUCCESS) {
+		fprintf(stderr, "%s: %s\n", argv[0],
+			isc_result_totext(result));
+		exit(1);
+	}
+
+	zonefile = argv[1];
+	snprintf(rawfile, sizeof(rawfile), "%s.raw", zonefile);
+	snprintf(mapfile, sizeof(mapfile), "%s.map", zonefile);
+
+	result = load(zonefile, dns_masterformat_text, &db);
+	if (result != ISC_R_SUCCESS) {
+		fprintf(stderr, "loading %s: %s\n", zonefile,
+			isc_result_totext(result));
+		exit(1);
+	}
+	RUNTIME_CHECK(dns_db_dump2(db, NULL, rawfile,
+				   dns_masterformat_raw) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(dns_db_dump2(db, NULL, mapfile,
+				   dns_masterformat_map) == ISC_R_SUCCESS);
+	dns_db_detach(&db);
+
+	printf("%u iterations, milliseconds per iteration\n", iterations);
+	printf("%-6s %12s %12s %12s\n", "format", "load", "first find",
+	       "free");
+	bench("text", zonefile, dns_masterformat_text, iterations);
+	bench("raw", rawfile, dns_masterformat_raw, iterations);
+	bench("map", mapfile, dns_masterformat_map, iterations);
+
+	(void)isc_file_remove(rawfile);
+	(void)isc_file_remove(mapfile);
+	isc_mem_destroy(&mctx);
+
+	return (0);
+}
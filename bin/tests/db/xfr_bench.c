@@ -0,0 +1,474 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Measure how fast a server sends a zone by AXFR.  -c transfers of the
+ * zone given on the command line are started at once from the server
+ * at -a (127.0.0.1) port -p (53), over TCP and without TSIG, and the
+ * number of records each receives per second is reported, along with
+ * the total for all of them.  With -r, each connection asks for the
+ * zone that many times in turn.  With -i, IXFR from the given serial
+ * is asked for instead, as slaves do when the zone has changed.
+ *
+ * The responses are only split into records and counted, so that as
+ * little as possible of the time is spent here rather than in the
+ * server.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <isc/buffer.h>
+#include <isc/commandline.h>
+#include <isc/condition.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/net.h>
+#include <isc/print.h>
+#include <isc/sockaddr.h>
+#include <isc/socket.h>
+#include <isc/task.h>
+#include <isc/time.h>
+#include <isc/util.h>
+
+#include <dns/fixedname.h>
+#include <dns/name.h>
+#include <dns/rdatatype.h>
+#include <dns/result.h>
+
+#define RECVBUFSIZE	(256 * 1024)
+
+typedef struct transfer {
+	isc_task_t *		task;
+	isc_socket_t *		sock;
+	unsigned int		id;
+	unsigned int		round;
+	unsigned char		query[512];
+	unsigned int		querylen;
+	unsigned char *		buf;
+	unsigned int		used;
+	unsigned int		nrrs;		/* records this round */
+	isc_uint32_t		serial;		/* of the first SOA */
+	unsigned int		nsoas;		/* SOAs with that serial */
+	unsigned int		wantsoas;
+	isc_uint64_t		records;
+	isc_uint64_t		messages;
+	isc_uint64_t		bytes;
+	isc_uint64_t		usec;
+	isc_time_t		start;
+	isc_result_t		result;
+} transfer_t;
+
+static isc_mem_t *mctx = NULL;
+static isc_taskmgr_t *taskmgr = NULL;
+static isc_socketmgr_t *socketmgr = NULL;
+static isc_sockaddr_t server;
+static unsigned int rounds = 1;
+static isc_boolean_t ixfr = ISC_FALSE;
+static isc_uint32_t ixfrserial = 0;
+
+static isc_mutex_t lock;
+static isc_condition_t cv;
+static unsigned int running;
+
+static void
+usage(const char *progname) {
+	fprintf(stderr, "usage: %s [-a address] [-p port] [-c transfers] "
+		"[-r rounds] [-i serial] zone\n", progname);
+	exit(1);
+}
+
+static void
+check_result(isc_result_t result, const char *what) {
+	if (result == ISC_R_SUCCESS)
+		return;
+	fprintf(stderr, "%s: %s\n", what, isc_result_totext(result));
+	exit(1);
+}
+
+static void
+recvdone(isc_task_t *task, isc_event_t *event);
+
+static void
+senddone(isc_task_t *task, isc_event_t *event);
+
+static void
+finish(transfer_t *xfr, isc_result_t result) {
+	xfr->result = result;
+	isc_socket_detach(&xfr->sock);
+	LOCK(&lock);
+	running--;
+	SIGNAL(&cv);
+	UNLOCK(&lock);
+}
+
+static void
+startround(transfer_t *xfr) {
+	isc_region_t r;
+	isc_result_t result;
+
+	xfr->nrrs = 0;
+	xfr->nsoas = 0;
+	xfr->wantsoas = 2;
+	xfr->used = 0;
+	xfr->query[2] = (xfr->id + xfr->round) >> 8;
+	xfr->query[3] = (xfr->id + xfr->round) & 0xff;
+	TIME_NOW(&xfr->start);
+
+	r.base = xfr->query;
+	r.length = xfr->querylen;
+	result = isc_socket_send(xfr->sock, &r, xfr->task, senddone, xfr);
+	if (result != ISC_R_SUCCESS)
+		finish(xfr, result);
+}
+
+static void
+startrecv(transfer_t *xfr) {
+	isc_region_t r;
+	isc_result_t result;
+
+	r.base = xfr->buf + xfr->used;
+	r.length = RECVBUFSIZE - xfr->used;
+	result = isc_socket_recv(xfr->sock, &r, 1, xfr->task, recvdone, xfr);
+	if (result != ISC_R_SUCCESS)
+		finish(xfr, result);
+}
+
+static void
+connected(isc_task_t *task, isc_event_t *event) {
+	transfer_t *xfr = event->ev_arg;
+	isc_result_t result = ((isc_socketevent_t *)event)->result;
+
+	UNUSED(task);
+
+	isc_event_free(&event);
+	if (result != ISC_R_SUCCESS) {
+		finish(xfr, result);
+		return;
+	}
+	startround(xfr);
+}
+
+static void
+senddone(isc_task_t *task, isc_event_t *event) {
+	transfer_t *xfr = event->ev_arg;
+	isc_result_t result = ((isc_socketevent_t *)event)->result;
+
+	UNUSED(task);
+
+	isc_event_free(&event);
+	if (result != ISC_R_SUCCESS) {
+		finish(xfr, result);
+		return;
+	}
+	startrecv(xfr);
+}
+
+/*
+ * Skip the name at 'p', returning a pointer past it or NULL if it runs
+ * past 'end'.
+ */
+static const unsigned char *
+skipname(const unsigned char *p, const unsigned char *end) {
+	while (p < end) {
+		if (*p == 0)
+			return (p + 1);
+		if ((*p & 0xc0) == 0xc0)
+			return (p + 2 <= end ? p + 2 : NULL);
+		p += *p + 1;
+	}
+	return (NULL);
+}
+
+/*
+ * Count the records in one response message, and the SOA records with
+ * the serial of the first one.  An AXFR, or an IXFR that the server
+ * sends as a whole zone, ends with the second of these; an IXFR with
+ * the third, unless it only has the one saying the slave is up to date.
+ */
+static isc_result_t
+parse(transfer_t *xfr, const unsigned char *msg, unsigned int len) {
+	const unsigned char *p, *q, *end = msg + len;
+	unsigned int qdcount, ancount, type, rdlen, i;
+	isc_uint32_t serial;
+
+	if (len < 12)
+		return (DNS_R_FORMERR);
+	if ((msg[3] & 0x0f) != 0)
+		return (DNS_R_SERVFAIL);
+	qdcount = (msg[4] << 8) | msg[5];
+	ancount = (msg[6] << 8) | msg[7];
+
+	p = msg + 12;
+	for (i = 0; i < qdcount; i++) {
+		p = skipname(p, end);
+		if (p == NULL || p + 4 > end)
+			return (DNS_R_FORMERR);
+		p += 4;
+	}
+	for (i = 0; i < ancount; i++) {
+		p = skipname(p, end);
+		if (p == NULL || p + 10 > end)
+			return (DNS_R_FORMERR);
+		type = (p[0] << 8) | p[1];
+		rdlen = (p[8] << 8) | p[9];
+		p += 10 + rdlen;
+		if (p > end)
+			return (DNS_R_FORMERR);
+		if (ixfr && xfr->nrrs == 1 && type == dns_rdatatype_soa)
+			xfr->wantsoas = 3;
+		xfr->nrrs++;
+		if (type != dns_rdatatype_soa)
+			continue;
+		q = skipname(p - rdlen, p);
+		q = (q == NULL) ? NULL : skipname(q, p);
+		if (q == NULL || q + 4 > p)
+			return (DNS_R_FORMERR);
+		serial = (q[0] << 24) | (q[1] << 16) | (q[2] << 8) | q[3];
+		if (xfr->nrrs == 1) {
+			xfr->serial = serial;
+			if (ixfr && serial == ixfrserial)
+				xfr->wantsoas = 1;
+		}
+		if (serial == xfr->serial)
+			xfr->nsoas++;
+	}
+	xfr->records += ancount;
+	xfr->messages++;
+	xfr->bytes += len + 2;
+	return (ISC_R_SUCCESS);
+}
+
+static void
+recvdone(isc_task_t *task, isc_event_t *event) {
+	isc_socketevent_t *sev = (isc_socketevent_t *)event;
+	transfer_t *xfr = event->ev_arg;
+	isc_result_t result = sev->result;
+	unsigned int consumed = 0, len;
+	isc_time_t now;
+
+	UNUSED(task);
+
+	if (result == ISC_R_SUCCESS)
+		xfr->used += sev->n;
+	isc_event_free(&event);
+	if (result != ISC_R_SUCCESS) {
+		finish(xfr, result);
+		return;
+	}
+
+	while (xfr->used - consumed >= 2) {
+		len = (xfr->buf[consumed] << 8) | xfr->buf[consumed + 1];
+		if (xfr->used - consumed - 2 < len)
+			break;
+		result = parse(xfr, xfr->buf + consumed + 2, len);
+		if (result != ISC_R_SUCCESS) {
+			finish(xfr, result);
+			return;
+		}
+		consumed += 2 + len;
+	}
+	memmove(xfr->buf, xfr->buf + consumed, xfr->used - consumed);
+	xfr->used -= consumed;
+
+	if (xfr->nsoas < xfr->wantsoas) {
+		startrecv(xfr);
+		return;
+	}
+
+	TIME_NOW(&now);
+	xfr->usec += isc_time_microdiff(&now, &xfr->start);
+	if (++xfr->round < rounds) {
+		startround(xfr);
+		return;
+	}
+	finish(xfr, ISC_R_SUCCESS);
+}
+
+int
+main(int argc, char **argv) {
+	const char *address = "127.0.0.1";
+	unsigned int port = 53;
+	unsigned int ntransfers = 1;
+	struct in_addr in4;
+	struct in6_addr in6;
+	dns_fixedname_t fname;
+	dns_name_t *zone;
+	transfer_t *xfrs;
+	isc_buffer_t b;
+	isc_region_t r;
+	isc_time_t start, end;
+	isc_uint64_t usec, records = 0, messages = 0, bytes = 0, xfrusec = 0;
+	unsigned int i, failed = 0;
+	isc_result_t result;
+	int ch;
+
+	while ((ch = isc_commandline_parse(argc, argv, "a:c:i:p:r:")) != -1) {
+		switch (ch) {
+		case 'a':
+			address = isc_commandline_argument;
+			break;
+		case 'c':
+			ntransfers = atoi(isc_commandline_argument);
+			break;
+		case 'i':
+			ixfr = ISC_TRUE;
+			ixfrserial = strtoul(isc_commandline_argument,
+					     NULL, 10);
+			break;
+		case 'p':
+			port = atoi(isc_commandline_argument);
+			break;
+		case 'r':
+			rounds = atoi(isc_commandline_argument);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (isc_commandline_index != argc - 1 || ntransfers == 0 ||
+	    rounds == 0 || port == 0 || port > 65535)
+		usage(argv[0]);
+
+	if (inet_pton(AF_INET6, address, &in6) == 1)
+		isc_sockaddr_fromin6(&server, &in6, port);
+	else if (inet_pton(AF_INET, address, &in4) == 1)
+		isc_sockaddr_fromin(&server, &in4, port);
+	else
+		usage(argv[0]);
+
+	dns_result_register();
+	dns_fixedname_init(&fname);
+	zone = dns_fixedname_name(&fname);
+	isc_buffer_constinit(&b, argv[isc_commandline_index],
+			     strlen(argv[isc_commandline_index]));
+	isc_buffer_add(&b, strlen(argv[isc_commandline_index]));
+	result = dns_name_fromtext(zone, &b, dns_rootname, 0, NULL);
+	check_result(result, "dns_name_fromtext");
+
+	RUNTIME_CHECK(isc_mem_create(0, 0, &mctx) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_mutex_init(&lock) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_condition_init(&cv) == ISC_R_SUCCESS);
+	check_result(isc_taskmgr_create(mctx, 1, 0, &taskmgr),
+		     "isc_taskmgr_create");
+	check_result(isc_socketmgr_create(mctx, &socketmgr),
+		     "isc_socketmgr_create");
+
+	xfrs = isc_mem_get(mctx, ntransfers * sizeof(*xfrs));
+	RUNTIME_CHECK(xfrs != NULL);
+
+	for (i = 0; i < ntransfers; i++) {
+		transfer_t *xfr = &xfrs[i];
+
+		memset(xfr, 0, sizeof(*xfr));
+		xfr->id = i * rounds;
+		xfr->buf = isc_mem_get(mctx, RECVBUFSIZE);
+		RUNTIME_CHECK(xfr->buf != NULL);
+		result = isc_task_create(taskmgr, 0, &xfr->task);
+		check_result(result, "isc_task_create");
+
+		/*
+		 * Length, header, question and, for IXFR, an SOA record
+		 * with the slave's serial in the authority section.
+		 */
+		isc_buffer_init(&b, xfr->query, sizeof(xfr->query));
+		isc_buffer_putuint16(&b, 12 + zone->length + 4 +
+				     (ixfr ? 2 + 10 + 22 : 0));
+		isc_buffer_putuint16(&b, 0);		/* ID */
+		isc_buffer_putuint16(&b, 0);		/* flags */
+		isc_buffer_putuint16(&b, 1);		/* QDCOUNT */
+		isc_buffer_putuint16(&b, 0);
+		isc_buffer_putuint16(&b, ixfr ? 1 : 0);	/* NSCOUNT */
+		isc_buffer_putuint16(&b, 0);
+		dns_name_toregion(zone, &r);
+		isc_buffer_putmem(&b, r.base, r.length);
+		isc_buffer_putuint16(&b, ixfr ? dns_rdatatype_ixfr :
+						dns_rdatatype_axfr);
+		isc_buffer_putuint16(&b, dns_rdataclass_in);
+		if (ixfr) {
+			isc_buffer_putuint16(&b, 0xc00c); /* zone name */
+			isc_buffer_putuint16(&b, dns_rdatatype_soa);
+			isc_buffer_putuint16(&b, dns_rdataclass_in);
+			isc_buffer_putuint32(&b, 0);
+			isc_buffer_putuint16(&b, 22);
+			isc_buffer_putuint8(&b, 0);	/* "." */
+			isc_buffer_putuint8(&b, 0);	/* "." */
+			isc_buffer_putuint32(&b, ixfrserial);
+			isc_buffer_putuint32(&b, 0);
+			isc_buffer_putuint32(&b, 0);
+			isc_buffer_putuint32(&b, 0);
+			isc_buffer_putuint32(&b, 0);
+		}
+		xfr->querylen = isc_buffer_usedlength(&b);
+	}
+
+	LOCK(&lock);
+	running = ntransfers;
+	TIME_NOW(&start);
+	for (i = 0; i < ntransfers; i++) {
+		transfer_t *xfr = &xfrs[i];
+
+		result = isc_socket_create(socketmgr, isc_sockaddr_pf(&server),
+					   isc_sockettype_tcp, &xfr->sock);
+		check_result(result, "isc_socket_create");
+		result = isc_socket_connect(xfr->sock, &server, xfr->task,
+					    connected, xfr);
+		check_result(result, "isc_socket_connect");
+	}
+	while (running > 0)
+		WAIT(&cv, &lock);
+	TIME_NOW(&end);
+	UNLOCK(&lock);
+	usec = isc_time_microdiff(&end, &start);
+
+	for (i = 0; i < ntransfers; i++) {
+		transfer_t *xfr = &xfrs[i];
+
+		if (xfr->result != ISC_R_SUCCESS) {
+			fprintf(stderr, "transfer %u: %s\n", i,
+				isc_result_totext(xfr->result));
+			failed++;
+		} else {
+			records += xfr->records;
+			messages += xfr->messages;
+			bytes += xfr->bytes;
+			xfrusec += xfr->usec;
+		}
+		isc_task_detach(&xfr->task);
+		isc_mem_put(mctx, xfr->buf, RECVBUFSIZE);
+	}
+	isc_mem_put(mctx, xfrs, ntransfers * sizeof(*xfrs));
+
+	printf("%u transfers of %u rounds, %u failed\n",
+	       ntransfers, rounds, failed);
+	if (failed < ntransfers) {
+		unsigned int n = (ntransfers - failed) * rounds;
+
+		printf("%" ISC_PRINT_QUADFORMAT "u records in %"
+		       ISC_PRINT_QUADFORMAT "u messages, %"
+		       ISC_PRINT_QUADFORMAT "u bytes per transfer\n",
+		       records / n, messages / n, bytes / n);
+		printf("%.3f sec per transfer, %.0f records/sec per "
+		       "transfer\n", (double)xfrusec / n / 1000000.0,
+		       xfrusec == 0 ? 0.0 : records * 1000000.0 / xfrusec);
+		printf("total: %.3f sec, %.0f records/sec\n",
+		       usec / 1000000.0,
+		       usec == 0 ? 0.0 : records * 1000000.0 / usec);
+	}
+
+	isc_socketmgr_destroy(&socketmgr);
+	isc_taskmgr_destroy(&taskmgr);
+	(void)isc_condition_destroy(&cv);
+	DESTROYLOCK(&lock);
+	isc_mem_destroy(&mctx);
+
+	return (failed == 0 ? 0 : 1);
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Measure the cost of scheduling zone maintenance with many zones.
+ * A zone manager is given -n master zones (try a million).  The process
+ * is then left idle for -i seconds, and the CPU time it used is
+ * reported along with the number of times the zone manager woke up.
+ * After that, -r rounds of -k randomly chosen zones are made due for
+ * maintenance at once (by asking them to send notifies), -w
+ * milliseconds apart, and the scheduling statistics of the zone manager
+ * are reported: how often it woke up and how late, on average, zones
+ * were handed to their tasks.
+ *
+ * The zones have no view, so zone maintenance itself returns at once;
+ * it is only the scheduling that is being measured.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <isc/commandline.h>
+#include <isc/mem.h>
+#include <isc/os.h>
+#include <isc/print.h>
+#include <isc/random.h>
+#include <isc/socket.h>
+#include <isc/task.h>
+#include <isc/time.h>
+#include <isc/timer.h>
+#include <isc/util.h>
+
+#include <dns/fixedname.h>
+#include <dns/name.h>
+#include <dns/result.h>
+#include <dns/zone.h>
+
+static isc_mem_t *mctx = NULL;
+static isc_taskmgr_t *taskmgr = NULL;
+static isc_timermgr_t *timermgr = NULL;
+static isc_socketmgr_t *socketmgr = NULL;
+static dns_zonemgr_t *zonemgr = NULL;
+
+static void
+usage(const char *progname) {
+	fprintf(stderr, "usage: %s [-n zones] [-i idle seconds] "
+		"[-r rounds] [-k zones per round] [-w msec]\n", progname);
+	exit(1);
+}
+
+static void
+check_result(isc_result_t result, const char *what) {
+	if (result == ISC_R_SUCCESS)
+		return;
+	fprintf(stderr, "%s: %s\n", what, isc_result_totext(result));
+	exit(1);
+}
+
+static isc_uint64_t
+cpuusec(void) {
+	struct rusage ru;
+
+	RUNTIME_CHECK(getrusage(RUSAGE_SELF, &ru) == 0);
+	return ((isc_uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) *
+		1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+}
+
+static dns_zone_t *
+createzone(unsigned int i) {
+	dns_fixedname_t fname;
+	dns_name_t *name;
+	dns_zone_t *zone = NULL;
+	char text[sizeof("z4294967295.example.")];
+	isc_buffer_t b;
+	isc_result_t result;
+
+	snprintf(text, sizeof(text), "z%u.example.", i);
+	isc_buffer_constinit(&b, text, strlen(text));
+	isc_buffer_add(&b, strlen(text));
+	dns_fixedname_init(&fname);
+	name = dns_fixedname_name(&fname);
+	result = dns_name_fromtext(name, &b, dns_rootname, 0, NULL);
+	check_result(result, "dns_name_fromtext");
+
+	result = dns_zonemgr_createzone(zonemgr, &zone);
+	check_result(result, "dns_zonemgr_createzone");
+	result = dns_zone_setorigin(zone, name);
+	check_result(result, "dns_zone_setorigin");
+	dns_zone_settype(zone, dns_zone_master);
+	dns_zone_setclass(zone, dns_rdataclass_in);
+	result = dns_zonemgr_managezone(zonemgr, zone);
+	check_result(result, "dns_zonemgr_managezone");
+
+	return (zone);
+}
+
+int
+main(int argc, char **argv) {
+	unsigned int nzones = 100000;
+	unsigned int idle = 5;
+	unsigned int rounds = 100;
+	unsigned int perround = 1000;
+	unsigned int wait = 10;
+	isc_uint64_t wakeups0, dispatched0, late0;
+	isc_uint64_t wakeups, dispatched, late;
+	isc_uint64_t cpu, usec;
+	isc_time_t start, end;
+	dns_zone_t **zones;
+	isc_uint32_t r;
+	unsigned int i, j;
+	isc_result_t result;
+	int ch;
+
+	while ((ch = isc_commandline_parse(argc, argv, "i:k:n:r:w:")) != -1) {
+		switch (ch) {
+		case 'i':
+			idle = atoi(isc_commandline_argument);
+			break;
+		case 'k':
+			perround = atoi(isc_commandline_argument);
+			break;
+		case 'n':
+			nzones = atoi(isc_commandline_argument);
+			break;
+		case 'r':
+			rounds = atoi(isc_commandline_argument);
+			break;
+		case 'w':
+			wait = atoi(isc_commandline_argument);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nzones == 0 || nzones > 10000000)
+		usage(argv[0]);
+
+	dns_result_register();
+	RUNTIME_CHECK(isc_mem_create(0, 0, &mctx) == ISC_R_SUCCESS);
+	check_result(isc_taskmgr_create(mctx, isc_os_ncpus(), 0, &taskmgr),
+		     "isc_taskmgr_create");
+	check_result(isc_timermgr_create(mctx, &timermgr),
+		     "isc_timermgr_create");
+	check_result(isc_socketmgr_create(mctx, &socketmgr),
+		     "isc_socketmgr_create");
+	result = dns_zonemgr_create(mctx, taskmgr, timermgr, socketmgr,
+				    &zonemgr);
+	check_result(result, "dns_zonemgr_create");
+	check_result(dns_zonemgr_setsize(zonemgr, nzones),
+		     "dns_zonemgr_setsize");
+
+	zones = malloc(nzones * sizeof(*zones));
+	RUNTIME_CHECK(zones != NULL);
+
+	TIME_NOW(&start);
+	for (i = 0; i < nzones; i++)
+		zones[i] = createzone(i);
+	TIME_NOW(&end);
+	usec = isc_time_microdiff(&end, &start);
+	printf("%u zones managed in %.3f sec\n", nzones, usec / 1000000.0);
+
+	/*
+	 * Idle: nothing is due.
+	 */
+	dns_zonemgr_getschedstats(zonemgr, &wakeups0, &dispatched0, &late0);
+	cpu = cpuusec();
+	sleep(idle);
+	cpu = cpuusec() - cpu;
+	dns_zonemgr_getschedstats(zonemgr, &wakeups, &dispatched, &late);
+	printf("idle %u sec: %.3f msec cpu, %" ISC_PRINT_QUADFORMAT
+	       "u wakeups\n", idle, cpu / 1000.0, wakeups - wakeups0);
+
+	/*
+	 * Make zones due in rounds.
+	 */
+	wakeups0 = wakeups;
+	dispatched0 = dispatched;
+	late0 = late;
+	cpu = cpuusec();
+	TIME_NOW(&start);
+	for (i = 0; i < rounds; i++) {
+		for (j = 0; j < perround; j++) {
+			isc_random_get(&r);
+			dns_zone_notify(zones[r % nzones]);
+		}
+		usleep(wait * 1000);
+	}
+	/* Let the last round drain. */
+	usleep(100000);
+	TIME_NOW(&end);
+	cpu = cpuusec() - cpu;
+	usec = isc_time_microdiff(&end, &start);
+	dns_zonemgr_getschedstats(zonemgr, &wakeups, &dispatched, &late);
+	wakeups -= wakeups0;
+	dispatched -= dispatched0;
+	late -= late0;
+
+	printf("%u rounds of %u zones: %" ISC_PRINT_QUADFORMAT
+	       "u zones dispatched, %" ISC_PRINT_QUADFORMAT "u wakeups\n",
+	       rounds, perround, dispatched, wakeups);
+	printf("%.1f zones per wakeup, %.1f usec average lateness\n",
+	       wakeups == 0 ? 0.0 : (double)dispatched / wakeups,
+	       dispatched == 0 ? 0.0 : (double)late / dispatched);
+	printf("%.3f msec cpu in %.3f sec\n", cpu / 1000.0, usec / 1000000.0);
+
+	for (i = 0; i < nzones; i++)
+		dns_zone_detach(&zones[i]);
+	free(zones);
+
+	dns_zonemgr_shutdown(zonemgr);
+	dns_zonemgr_detach(&zonemgr);
+	isc_socketmgr_destroy(&socketmgr);
+	isc_taskmgr_destroy(&taskmgr);
+	isc_timermgr_destroy(&timermgr);
+	isc_mem_destroy(&mctx);
+
+	return (0);
+}
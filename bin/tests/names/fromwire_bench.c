@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Measure how fast names are read from wire format messages.  Each
+ * file holds one message in the format read by wire_test: hex digits
+ * with '#' comments, or raw binary data with -d.  With -t a file holds
+ * any number of messages each preceded by a two byte length, as they
+ * are sent over TCP, which is the easiest way to feed in responses
+ * captured from a live server.
+ *
+ * The owner names of the questions and records are decompressed with
+ * dns_name_fromwire() over and over, then the messages are parsed with
+ * dns_message_parse(), which also reads the names in the rdata.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <isc/buffer.h>
+#include <isc/commandline.h>
+#include <isc/mem.h>
+#include <isc/print.h>
+#include <isc/time.h>
+#include <isc/util.h>
+
+#include <dns/compress.h>
+#include <dns/fixedname.h>
+#include <dns/message.h>
+#include <dns/name.h>
+#include <dns/result.h>
+
+#define MAXMESSAGES	10000
+#define MAXNAMES	200000
+
+static isc_mem_t *mctx = NULL;
+
+static struct {
+	unsigned char *	data;
+	unsigned int	length;
+} messages[MAXMESSAGES];
+static unsigned int nmessages;
+
+/*%
+ * Where each owner name starts.
+ */
+static struct {
+	unsigned int	message;
+	unsigned int	offset;
+} names[MAXNAMES];
+static unsigned int nnames;
+
+static void
+usage(const char *progname) {
+	fprintf(stderr, "usage: %s [-d] [-l] [-t] [-n iterations] file...\n",
+		progname);
+	exit(1);
+}
+
+static int
+fromhex(char c) {
+	if (c >= '0' && c <= '9')
+		return (c - '0');
+	else if (c >= 'a' && c <= 'f')
+		return (c - 'a' + 10);
+	else if (c >= 'A' && c <= 'F')
+		return (c - 'A' + 10);
+
+	fprintf(stderr, "bad input format: %02x\n", c);
+	exit(1);
+}
+
+static void
+readfile(const char *filename, isc_boolean_t rawdata, isc_buffer_t **input) {
+	char s[BUFSIZ];
+	char *rp, *wp;
+	FILE *f;
+	int c;
+
+	f = fopen(filename, rawdata ? "rb" : "r");
+	if (f == NULL) {
+		fprintf(stderr, "%s: fopen failed\n", filename);
+		exit(1);
+	}
+
+	if (rawdata) {
+		while ((c = getc(f)) != EOF) {
+			RUNTIME_CHECK(isc_buffer_reserve(input, 1) ==
+				      ISC_R_SUCCESS);
+			isc_buffer_putuint8(*input, (isc_uint8_t)c);
+		}
+	} else {
+		while (fgets(s, sizeof(s), f) != NULL) {
+			for (rp = wp = s; *rp != '\0' && *rp != '#'; rp++)
+				if (*rp != ' ' && *rp != '\t' &&
+				    *rp != '\r' && *rp != '\n')
+					*wp++ = *rp;
+			if ((wp - s) % 2 != 0) {
+				fprintf(stderr, "%s: bad input format\n",
+					filename);
+				exit(1);
+			}
+			for (rp = s; rp < wp; rp += 2) {
+				c = fromhex(rp[0]) * 16 + fromhex(rp[1]);
+				RUNTIME_CHECK(isc_buffer_reserve(input, 1) ==
+					      ISC_R_SUCCESS);
+				isc_buffer_putuint8(*input, (isc_uint8_t)c);
+			}
+		}
+	}
+
+	fclose(f);
+}
+
+static void
+addmessage(const unsigned char *data, unsigned int length) {
+	if (nmessages == MAXMESSAGES) {
+		fprintf(stderr, "too many messages\n");
+		exit(1);
+	}
+	messages[nmessages].data = isc_mem_get(mctx, length);
+	RUNTIME_CHECK(messages[nmessages].data != NULL);
+	memmove(messages[nmessages].data, data, length);
+	messages[nmessages].length = length;
+	nmessages++;
+}
+
+/*
+ * Record where the owner name of each question and record in message
+ * 'i' starts.  A message which cannot be walked is left out of the
+ * owner name test.
+ */
+static void
+findnames(unsigned int i) {
+	isc_buffer_t source, target;
+	unsigned char buf[DNS_NAME_MAXWIRE];
+	dns_decompress_t dctx;
+	dns_fixedname_t fname;
+	unsigned char *rdlen;
+	unsigned int qdcount, count, offset, skip, j;
+	unsigned int first = nnames;
+
+	if (messages[i].length < 12)
+		return;
+	isc_buffer_init(&source, messages[i].data, messages[i].length);
+	isc_buffer_add(&source, messages[i].length);
+	isc_buffer_setactive(&source, messages[i].length);
+	isc_buffer_forward(&source, 4);
+	qdcount = isc_buffer_getuint16(&source);
+	count = qdcount;
+	for (j = 0; j < 3; j++)
+		count += isc_buffer_getuint16(&source);
+
+	dns_decompress_init(&dctx, -1, DNS_DECOMPRESS_ANY);
+	dns_decompress_setmethods(&dctx, DNS_COMPRESS_GLOBAL14);
+	for (j = 0; j < count; j++) {
+		offset = source.current;
+		dns_fixedname_init(&fname);
+		isc_buffer_init(&target, buf, sizeof(buf));
+		if (dns_name_fromwire(dns_fixedname_name(&fname), &source,
+				      &dctx, 0, &target) != ISC_R_SUCCESS)
+			break;
+		/* Type and class, and for records TTL and rdata. */
+		skip = 4;
+		if (j >= qdcount) {
+			if (isc_buffer_remaininglength(&source) < 10)
+				break;
+			rdlen = messages[i].data + source.current + 8;
+			skip = 10 + (rdlen[0] << 8 | rdlen[1]);
+		}
+		if (isc_buffer_remaininglength(&source) < skip)
+			break;
+		isc_buffer_forward(&source, skip);
+
+		if (nnames == MAXNAMES) {
+			fprintf(stderr, "too many names\n");
+			exit(1);
+		}
+		names[nnames].message = i;
+		names[nnames].offset = offset;
+		nnames++;
+	}
+	dns_decompress_invalidate(&dctx);
+
+	if (j != count)
+		nnames = first;
+}
+
+static isc_uint64_t
+bench_names(unsigned int options, unsigned int iterations,
+	    isc_uint32_t *digestp)
+{
+	isc_buffer_t source, target;
+	unsigned char buf[DNS_NAME_MAXWIRE];
+	dns_decompress_t dctx;
+	dns_fixedname_t fname;
+	dns_name_t *name;
+	isc_time_t start, finish;
+	isc_uint32_t digest = 0;
+	unsigned int i, j, k;
+
+	dns_fixedname_init(&fname);
+	name = dns_fixedname_name(&fname);
+	dns_decompress_init(&dctx, -1, DNS_DECOMPRESS_ANY);
+	dns_decompress_setmethods(&dctx, DNS_COMPRESS_GLOBAL14);
+
+	TIME_NOW(&start);
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < nnames; j++) {
+			k = names[j].message;
+			isc_buffer_init(&source, messages[k].data,
+					messages[k].length);
+			isc_buffer_add(&source, messages[k].length);
+			isc_buffer_setactive(&source, messages[k].length);
+			isc_buffer_forward(&source, names[j].offset);
+			isc_buffer_init(&target, buf, sizeof(buf));
+			RUNTIME_CHECK(dns_name_fromwire(name, &source, &dctx,
+							options, &target) ==
+				      ISC_R_SUCCESS);
+		}
+	}
+	TIME_NOW(&finish);
+
+	/*
+	 * A digest of the names read, so that changes to the code can
+	 * be checked for identical output.
+	 */
+	for (j = 0; j < nnames; j++) {
+		k = names[j].message;
+		isc_buffer_init(&source, messages[k].data, messages[k].length);
+		isc_buffer_add(&source, messages[k].length);
+		isc_buffer_setactive(&source, messages[k].length);
+		isc_buffer_forward(&source, names[j].offset);
+		isc_buffer_init(&target, buf, sizeof(buf));
+		RUNTIME_CHECK(dns_name_fromwire(name, &source, &dctx,
+						options, &target) ==
+			      ISC_R_SUCCESS);
+		for (k = 0; k < name->length; k++)
+			digest = digest * 31 + name->ndata[k];
+	}
+	dns_decompress_invalidate(&dctx);
+	*digestp = digest;
+
+	return (isc_time_microdiff(&finish, &start));
+}
+
+static isc_uint64_t
+bench_messages(unsigned int iterations, unsigned int *parsedp) {
+	isc_buffer_t source;
+	dns_message_t *msg = NULL;
+	isc_time_t start, finish;
+	unsigned int i, j, parsed = 0;
+
+	RUNTIME_CHECK(dns_message_create(mctx, DNS_MESSAGE_INTENTPARSE,
+					 &msg) == ISC_R_SUCCESS);
+
+	TIME_NOW(&start);
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < nmessages; j++) {
+			isc_buffer_init(&source, messages[j].data,
+					messages[j].length);
+			isc_buffer_add(&source, messages[j].length);
+			if (dns_message_parse(msg, &source, 0) ==
+			    ISC_R_SUCCESS)
+				parsed++;
+			dns_message_reset(msg, DNS_MESSAGE_INTENTPARSE);
+		}
+	}
+	TIME_NOW(&finish);
+
+	dns_message_destroy(&msg);
+	*parsedp = parsed / iterations;
+
+	return (isc_time_microdiff(&finish, &start));
+}
+
+int
+main(int argc, char **argv) {
+	isc_boolean_t rawdata = ISC_FALSE, tcp = ISC_FALSE;
+	unsigned int options = 0;
+	unsigned int iterations = 100000;
+	unsigned int length, parsed, i;
+	isc_buffer_t *input = NULL;
+	isc_uint64_t usec;
+	isc_uint32_t digest;
+	int ch;
+
+	while ((ch = isc_commandline_parse(argc, argv, "dln:t")) != -1) {
+		switch (ch) {
+		case 'd':
+			rawdata = ISC_TRUE;
+			break;
+		case 'l':
+			options |= DNS_NAME_DOWNCASE;
+			break;
+		case 'n':
+			iterations = atoi(isc_commandline_argument);
+			break;
+		case 't':
+			tcp = ISC_TRUE;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	argc -= isc_commandline_index;
+	argv += isc_commandline_index;
+	if (argc == 0 || iterations == 0)
+		usage(argv[0]);
+
+	RUNTIME_CHECK(isc_mem_create(0, 0, &mctx) == ISC_R_SUCCESS);
+	dns_result_register();
+
+	for (i = 0; i < (unsigned int)argc; i++) {
+		RUNTIME_CHECK(isc_buffer_allocate(mctx, &input, 64 * 1024) ==
+			      ISC_R_SUCCESS);
+		readfile(argv[i], rawdata, &input);
+		if (!tcp) {
+			addmessage(isc_buffer_base(input),
+				   isc_buffer_usedlength(input));
+		} else {
+			while (isc_buffer_remaininglength(input) >= 2) {
+				length = isc_buffer_getuint16(input);
+				if (isc_buffer_remaininglength(input) <
+				    length)
+					break;
+				addmessage(isc_buffer_current(input), length);
+				isc_buffer_forward(input, length);
+			}
+		}
+		isc_buffer_free(&input);
+	}
+	for (i = 0; i < nmessages; i++)
+		findnames(i);
+	if (nnames == 0) {
+		fprintf(stderr, "no names found\n");
+		exit(1);
+	}
+
+	printf("%u messages, %u owner names, %u iterations%s\n", nmessages,
+	       nnames, iterations,
+	       (options & DNS_NAME_DOWNCASE) != 0 ? ", downcasing" : "");
+
+	usec = bench_names(options, iterations, &digest);
+	printf("owner names:  %12" ISC_PRINT_QUADFORMAT "u usec "
+	       "%14.0f names/sec   digest %08x\n", usec,
+	       usec == 0 ? 0.0 : (double)nnames * iterations * 1000000.0 /
+	       usec, digest);
+
+	usec = bench_messages(iterations, &parsed);
+	printf("messages:     %12" ISC_PRINT_QUADFORMAT "u usec "
+	       "%14.0f messages/sec (%u of %u parsed)\n", usec,
+	       usec == 0 ? 0.0 : (double)nmessages * iterations * 1000000.0 /
+	       usec, parsed, nmessages);
+
+	for (i = 0; i < nmessages; i++)
+		isc_mem_put(mctx, messages[i].data, messages[i].length);
+	isc_mem_destroy(&mctx);
+
+	return (0);
+}
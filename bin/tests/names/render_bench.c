@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Measure how fast typical responses are rendered to wire format with
+ * name compression.  Each response is built once and then rendered
+ * repeatedly with dns_message_rendersection().
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <isc/buffer.h>
+#include <isc/commandline.h>
+#include <isc/mem.h>
+#include <isc/print.h>
+#include <isc/time.h>
+#include <isc/util.h>
+
+#include <dns/compress.h>
+#include <dns/fixedname.h>
+#include <dns/message.h>
+#include <dns/name.h>
+#include <dns/rdata.h>
+#include <dns/rdatalist.h>
+#include <dns/rdataset.h>
+#include <dns/result.h>
+
+static isc_mem_t *mctx = NULL;
+
+/*
+ * Storage for rdata; it must outlive the messages built on it.
+ */
+static unsigned char arena[1024 * 1024];
+static isc_buffer_t arenabuf;
+
+static void
+usage(const char *progname) {
+	fprintf(stderr, "usage: %s [-c] [-n renders]\n", progname);
+	exit(1);
+}
+
+static dns_name_t *
+newname(dns_message_t *msg, const char *text) {
+	dns_name_t *name = NULL;
+
+	RUNTIME_CHECK(dns_message_gettempname(msg, &name) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(dns_name_fromstring(name, text, 0, mctx) ==
+		      ISC_R_SUCCESS);
+	return (name);
+}
+
+static void
+addquestion(dns_message_t *msg, const char *owner, dns_rdatatype_t type) {
+	dns_name_t *name;
+	dns_rdataset_t *rdataset = NULL;
+
+	name = newname(msg, owner);
+	RUNTIME_CHECK(dns_message_gettemprdataset(msg, &rdataset) ==
+		      ISC_R_SUCCESS);
+	dns_rdataset_makequestion(rdataset, dns_rdataclass_in, type);
+	ISC_LIST_APPEND(name->list, rdataset, link);
+	dns_message_addname(msg, name, DNS_SECTION_QUESTION);
+}
+
+/*
+ * Add an RRset of 'count' records to 'section'.  Record 'i' is made
+ * from the printf format 'target' applied to 'i': an address for A
+ * and AAAA, a domain name (preceded by a preference for MX) otherwise.
+ */
+static void
+addrrset(dns_message_t *msg, dns_section_t section, const char *owner,
+	 dns_rdatatype_t type, unsigned int count, const char *target)
+{
+	dns_name_t *name;
+	dns_rdatalist_t *rdatalist = NULL;
+	dns_rdataset_t *rdataset = NULL;
+	dns_rdata_t *rdata;
+	dns_fixedname_t fixed;
+	isc_region_t r;
+	char text[256];
+	unsigned int i;
+
+	name = newname(msg, owner);
+	RUNTIME_CHECK(dns_message_gettemprdatalist(msg, &rdatalist) ==
+		      ISC_R_SUCCESS);
+	rdatalist->rdclass = dns_rdataclass_in;
+	rdatalist->type = type;
+	rdatalist->ttl = 86400;
+
+	for (i = 0; i < count; i++) {
+		rdata = NULL;
+		RUNTIME_CHECK(dns_message_gettemprdata(msg, &rdata) ==
+			      ISC_R_SUCCESS);
+		snprintf(text, sizeof(text), target, i);
+		isc_buffer_availableregion(&arenabuf, &r);
+		switch (type) {
+		case dns_rdatatype_a:
+			RUNTIME_CHECK(r.length >= 4);
+			r.base[0] = 192;
+			r.base[1] = 0;
+			r.base[2] = 2;
+			r.base[3] = i & 0xff;
+			r.length = 4;
+			break;
+		case dns_rdatatype_aaaa:
+			RUNTIME_CHECK(r.length >= 16);
+			memset(r.base, 0, 16);
+			r.base[0] = 0x20;
+			r.base[1] = 0x01;
+			r.base[2] = 0x0d;
+			r.base[3] = 0xb8;
+			r.base[15] = i & 0xff;
+			r.length = 16;
+			break;
+		case dns_rdatatype_mx:
+			dns_fixedname_init(&fixed);
+			RUNTIME_CHECK(dns_name_fromstring(
+					      dns_fixedname_name(&fixed),
+					      text, 0, NULL) == ISC_R_SUCCESS);
+			RUNTIME_CHECK(r.length >= 2 +
+				      dns_fixedname_name(&fixed)->length);
+			r.base[0] = 0;
+			r.base[1] = 10 * (i + 1);
+			memmove(r.base + 2, dns_fixedname_name(&fixed)->ndata,
+				dns_fixedname_name(&fixed)->length);
+			r.length = 2 + dns_fixedname_name(&fixed)->length;
+			break;
+		default:
+			dns_fixedname_init(&fixed);
+			RUNTIME_CHECK(dns_name_fromstring(
+					      dns_fixedname_name(&fixed),
+					      text, 0, NULL) == ISC_R_SUCCESS);
+			RUNTIME_CHECK(r.length >=
+				      dns_fixedname_name(&fixed)->length);
+			memmove(r.base, dns_fixedname_name(&fixed)->ndata,
+				dns_fixedname_name(&fixed)->length);
+			r.length = dns_fixedname_name(&fixed)->length;
+			break;
+		}
+		isc_buffer_add(&arenabuf, r.length);
+		dns_rdata_fromregion(rdata, dns_rdataclass_in, type, &r);
+		ISC_LIST_APPEND(rdatalist->rdata, rdata, link);
+	}
+
+	RUNTIME_CHECK(dns_message_gettemprdataset(msg, &rdataset) ==
+		      ISC_R_SUCCESS);
+	RUNTIME_CHECK(dns_rdatalist_tordataset(rdatalist, rdataset) ==
+		      ISC_R_SUCCESS);
+	ISC_LIST_APPEND(name->list, rdataset, link);
+	dns_message_addname(msg, name, section);
+}
+
+/*
+ * A TLD style referral: 13 name servers with A and AAAA glue.
+ */
+static void
+build_referral(dns_message_t *msg) {
+	char owner[256];
+	unsigned int i;
+
+	addquestion(msg, "www.example.com.", dns_rdatatype_a);
+	addrrset(msg, DNS_SECTION_AUTHORITY, "com.", dns_rdatatype_ns, 13,
+		 "ns%u.gtld-servers.net.");
+	for (i = 0; i < 13; i++) {
+		snprintf(owner, sizeof(owner), "ns%u.gtld-servers.net.", i);
+		addrrset(msg, DNS_SECTION_ADDITIONAL, owner,
+			 dns_rdatatype_a, 1, "");
+		addrrset(msg, DNS_SECTION_ADDITIONAL, owner,
+			 dns_rdatatype_aaaa, 1, "");
+	}
+}
+
+/*
+ * An ANY style answer: several RRsets at the apex, and addresses for
+ * every name they refer to.
+ */
+static void
+build_any(dns_message_t *msg) {
+	char owner[256];
+	unsigned int i;
+
+	addquestion(msg, "example.org.", dns_rdatatype_any);
+	addrrset(msg, DNS_SECTION_ANSWER, "example.org.", dns_rdatatype_ns,
+		 4, "ns%u.example.org.");
+	addrrset(msg, DNS_SECTION_ANSWER, "example.org.", dns_rdatatype_mx,
+		 10, "mail%u.mx.example.org.");
+	addrrset(msg, DNS_SECTION_ANSWER, "example.org.", dns_rdatatype_a,
+		 4, "");
+	addrrset(msg, DNS_SECTION_ANSWER, "example.org.", dns_rdatatype_aaaa,
+		 4, "");
+	for (i = 0; i < 4; i++) {
+		snprintf(owner, sizeof(owner), "ns%u.example.org.", i);
+		addrrset(msg, DNS_SECTION_ADDITIONAL, owner,
+			 dns_rdatatype_a, 1, "");
+		addrrset(msg, DNS_SECTION_ADDITIONAL, owner,
+			 dns_rdatatype_aaaa, 1, "");
+	}
+	for (i = 0; i < 10; i++) {
+		snprintf(owner, sizeof(owner), "mail%u.mx.example.org.", i);
+		addrrset(msg, DNS_SECTION_ADDITIONAL, owner,
+			 dns_rdatatype_a, 1, "");
+	}
+}
+
+/*
+ * A large response with many distinct owner names, of the kind sent
+ * over TCP.
+ */
+static void
+build_owners(dns_message_t *msg) {
+	char owner[256];
+	unsigned int i;
+
+	addquestion(msg, "hosts.example.net.", dns_rdatatype_ptr);
+	addrrset(msg, DNS_SECTION_ANSWER, "hosts.example.net.",
+		 dns_rdatatype_ptr, 300, "host%u.hosts.example.net.");
+	for (i = 0; i < 300; i++) {
+		snprintf(owner, sizeof(owner), "host%u.hosts.example.net.",
+			 i);
+		addrrset(msg, DNS_SECTION_ADDITIONAL, owner,
+			 dns_rdatatype_a, 1, "");
+	}
+}
+
+static const struct {
+	const char	*name;
+	void		(*build)(dns_message_t *);
+	unsigned int	size;
+} profiles[] = {
+	{ "referral",	build_referral,	4096 },
+	{ "any",	build_any,	4096 },
+	{ "owners",	build_owners,	65535 },
+	{ NULL,		NULL,		0 }
+};
+
+static isc_uint64_t
+bench(dns_message_t *msg, isc_buffer_t *buffer, isc_boolean_t sensitive,
+      unsigned int renders)
+{
+	dns_compress_t cctx;
+	isc_time_t start, finish;
+	unsigned int i;
+
+	TIME_NOW(&start);
+	for (i = 0; i < renders; i++) {
+		RUNTIME_CHECK(dns_compress_init(&cctx, -1, mctx) ==
+			      ISC_R_SUCCESS);
+		dns_compress_setsensitive(&cctx, sensitive);
+		RUNTIME_CHECK(dns_message_renderbegin(msg, &cctx, buffer) ==
+			      ISC_R_SUCCESS);
+		RUNTIME_CHECK(dns_message_rendersection(msg,
+				DNS_SECTION_QUESTION, 0) == ISC_R_SUCCESS);
+		RUNTIME_CHECK(dns_message_rendersection(msg,
+				DNS_SECTION_ANSWER, 0) == ISC_R_SUCCESS);
+		RUNTIME_CHECK(dns_message_rendersection(msg,
+				DNS_SECTION_AUTHORITY, 0) == ISC_R_SUCCESS);
+		RUNTIME_CHECK(dns_message_rendersection(msg,
+				DNS_SECTION_ADDITIONAL, 0) == ISC_R_SUCCESS);
+		RUNTIME_CHECK(dns_message_renderend(msg) == ISC_R_SUCCESS);
+		dns_compress_invalidate(&cctx);
+		if (i + 1 < renders)
+			dns_message_renderreset(msg);
+	}
+	TIME_NOW(&finish);
+
+	return (isc_time_microdiff(&finish, &start));
+}
+
+int
+main(int argc, char **argv) {
+	isc_boolean_t sensitive = ISC_FALSE;
+	unsigned int renders = 100000;
+	dns_message_t *msg;
+	isc_buffer_t buffer;
+	unsigned char *data;
+	isc_uint64_t usec;
+	isc_uint32_t digest;
+	unsigned int i, j;
+	int ch;
+
+	while ((ch = isc_commandline_parse(argc, argv, "cn:")) != -1) {
+		switch (ch) {
+		case 'c':
+			sensitive = ISC_TRUE;
+			break;
+		case 'n':
+			renders = atoi(isc_commandline_argument);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (renders == 0)
+		usage(argv[0]);
+
+	RUNTIME_CHECK(isc_mem_create(0, 0, &mctx) == ISC_R_SUCCESS);
+	dns_result_register();
+	isc_buffer_init(&arenabuf, arena, sizeof(arena));
+	data = isc_mem_get(mctx, 65535);
+	RUNTIME_CHECK(data != NULL);
+
+	printf("%u renders per profile, %s compression\n", renders,
+	       sensitive ? "case sensitive" : "case insensitive");
+	printf("%-10s %8s %10s %12s %14s\n", "profile", "bytes", "digest",
+	       "usec", "renders/sec");
+	for (i = 0; profiles[i].name != NULL; i++) {
+		msg = NULL;
+		RUNTIME_CHECK(dns_message_create(mctx,
+						 DNS_MESSAGE_INTENTRENDER,
+						 &msg) == ISC_R_SUCCESS);
+		profiles[i].build(msg);
+		isc_buffer_init(&buffer, data, profiles[i].size);
+
+		usec = bench(msg, &buffer, sensitive, renders);
+
+		/*
+		 * A digest of the last rendering, so that changes to the
+		 * compression code can be checked for identical output.
+		 */
+		digest = 0;
+		for (j = 0; j < isc_buffer_usedlength(&buffer); j++)
+			digest = digest * 31 + data[j];
+
+		printf("%-10s %8u   %08x %12" ISC_PRINT_QUADFORMAT "u "
+		       "%14.0f\n", profiles[i].name,
+		       isc_buffer_usedlength(&buffer), digest, usec,
+		       usec == 0 ? 0.0 : (double)renders * 1000000.0 / usec);
+
+		dns_message_destroy(&msg);
+	}
+
+	isc_mem_put(mctx, data, 65535);
+	isc_mem_destroy(&mctx);
+
+	return (0);
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Compare the red-black tree of trees with the qp-trie: the time taken
+ * to insert a set of names, to look each of them up again, and to find
+ * the DNSSEC predecessor of names which are not present, and the memory
+ * used per name.  Realistic comparisons need large trees; try
+ * "-n 10000000" on a machine with a few gigabytes to spare.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <isc/commandline.h>
+#include <isc/mem.h>
+#include <isc/print.h>
+#include <isc/time.h>
+#include <isc/util.h>
+
+#include <dns/fixedname.h>
+#include <dns/name.h>
+#include <dns/qp.h>
+#include <dns/rbt.h>
+#include <dns/result.h>
+
+static dns_fixedname_t *names;
+static unsigned int count = 100000;
+
+static void
+usage(const char *progname) {
+	fprintf(stderr, "usage: %s [-n names]\n", progname);
+	exit(1);
+}
+
+/*
+ * Make 'count' names which are spread over a few thousand zones of two
+ * or three labels, as in a large cache or a hosting server.  If 'miss'
+ * is set, make names which sort between those names but are not among
+ * them.
+ */
+static void
+makenames(isc_boolean_t miss) {
+	char text[DNS_NAME_FORMATSIZE];
+	isc_uint32_t seed = 1;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		seed = seed * 1103515245 + 12345;
+		snprintf(text, sizeof(text), "%s%u.host%u.zone%u.%s.",
+			 miss ? "m" : "", i, (seed >> 8) % 64,
+			 (seed >> 14) % 4096,
+			 (seed & 1) != 0 ? "com" : "example.net");
+		dns_fixedname_init(&names[i]);
+		RUNTIME_CHECK(dns_name_fromstring(
+				      dns_fixedname_name(&names[i]), text, 0,
+				      NULL) == ISC_R_SUCCESS);
+	}
+}
+
+static void
+report(const char *what, isc_time_t *start) {
+	isc_time_t finish;
+	isc_uint64_t usec;
+
+	TIME_NOW(&finish);
+	usec = isc_time_microdiff(&finish, start);
+	printf("  %-12s %12" ISC_PRINT_QUADFORMAT "u usec %10.1f nsec/name\n",
+	       what, usec, (double)usec * 1000.0 / count);
+}
+
+static void
+bench_rbt(void) {
+	isc_mem_t *mctx = NULL;
+	dns_rbt_t *rbt = NULL;
+	dns_rbtnode_t *node;
+	dns_rbtnodechain_t chain;
+	isc_time_t start;
+	isc_result_t result;
+	size_t inuse;
+	unsigned int i;
+
+	RUNTIME_CHECK(isc_mem_create(0, 0, &mctx) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(dns_rbt_create(mctx, NULL, NULL, &rbt) ==
+		      ISC_R_SUCCESS);
+	printf("rbt:\n");
+
+	makenames(ISC_FALSE);
+	TIME_NOW(&start);
+	for (i = 0; i < count; i++) {
+		node = NULL;
+		result = dns_rbt_addnode(rbt, dns_fixedname_name(&names[i]),
+					 &node);
+		RUNTIME_CHECK(result == ISC_R_SUCCESS);
+		node->data = &names[i];
+	}
+	report("insert", &start);
+	inuse = isc_mem_inuse(mctx);
+
+	TIME_NOW(&start);
+	for (i = 0; i < count; i++) {
+		node = NULL;
+		result = dns_rbt_findnode(rbt, dns_fixedname_name(&names[i]),
+					  NULL, &node, NULL, 0, NULL, NULL);
+		RUNTIME_CHECK(result == ISC_R_SUCCESS);
+	}
+	report("find", &start);
+
+	makenames(ISC_TRUE);
+	dns_rbtnodechain_init(&chain, mctx);
+	TIME_NOW(&start);
+	for (i = 0; i < count; i++) {
+		node = NULL;
+		dns_rbtnodechain_reset(&chain);
+		result = dns_rbt_findnode(rbt, dns_fixedname_name(&names[i]),
+					  NULL, &node, &chain, 0, NULL, NULL);
+		RUNTIME_CHECK(result == DNS_R_PARTIALMATCH ||
+			      result == ISC_R_NOTFOUND);
+	}
+	report("predecessor", &start);
+	dns_rbtnodechain_invalidate(&chain);
+
+	printf("  %-12s %12lu bytes %9.1f bytes/name\n", "memory",
+	       (unsigned long)inuse, (double)inuse / count);
+
+	dns_rbt_destroy(&rbt);
+	isc_mem_destroy(&mctx);
+}
+
+static void
+bench_qp(void) {
+	isc_mem_t *mctx = NULL;
+	dns_qp_t *qp = NULL;
+	dns_rbtnode_t *node;
+	dns_qpchain_t chain;
+	isc_time_t start;
+	isc_result_t result;
+	size_t inuse;
+	unsigned int i;
+
+	RUNTIME_CHECK(isc_mem_create(0, 0, &mctx) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(dns_qp_create(mctx, NULL, NULL, &qp) == ISC_R_SUCCESS);
+	printf("qp:\n");
+
+	makenames(ISC_FALSE);
+	TIME_NOW(&start);
+	for (i = 0; i < count; i++) {
+		node = NULL;
+		result = dns_qp_addnode(qp, dns_fixedname_name(&names[i]),
+					&node);
+		RUNTIME_CHECK(result == ISC_R_SUCCESS);
+		node->data = &names[i];
+	}
+	report("insert", &start);
+	inuse = isc_mem_inuse(mctx);
+
+	TIME_NOW(&start);
+	for (i = 0; i < count; i++) {
+		node = NULL;
+		result = dns_qp_findnode(qp, dns_fixedname_name(&names[i]),
+					 NULL, &node, NULL, 0, NULL, NULL);
+		RUNTIME_CHECK(result == ISC_R_SUCCESS);
+	}
+	report("find", &start);
+
+	makenames(ISC_TRUE);
+	dns_qpchain_init(&chain, mctx);
+	TIME_NOW(&start);
+	for (i = 0; i < count; i++) {
+		node = NULL;
+		dns_qpchain_reset(&chain);
+		result = dns_qp_findnode(qp, dns_fixedname_name(&names[i]),
+					 NULL, &node, &chain, 0, NULL, NULL);
+		RUNTIME_CHECK(result == DNS_R_PARTIALMATCH ||
+			      result == ISC_R_NOTFOUND);
+	}
+	report("predecessor", &start);
+	dns_qpchain_invalidate(&chain);
+
+	printf("  %-12s %12lu bytes %9.1f bytes/name\n", "memory",
+	       (unsigned long)inuse, (double)inuse / count);
+
+	dns_qp_destroy(&qp);
+	isc_mem_destroy(&mctx);
+}
+
+int
+main(int argc, char **argv) {
+	int ch;
+
+	while ((ch = isc_commandline_parse(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			count = atoi(isc_commandline_argument);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (count == 0)
+		usage(argv[0]);
+
+	dns_result_register();
+	names = malloc(count * sizeof(*names));
+	RUNTIME_CHECK(names != NULL);
+
+	printf("%u names\n", count);
+	bench_rbt();
+	bench_qp();
+
+	free(names);
+	return (0);
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Measure how fast responses can be added to and removed from a UDP
+ * dispatch by many tasks at once.  Each of -t tasks keeps -o responses
+ * outstanding to destinations picked from -d loopback addresses,
+ * removing the oldest each time a new one is added, as the resolver
+ * does when queries are answered or time out.  Nothing is sent.
+ *
+ * Each response is added by an event of its own, so that the dispatch
+ * can close sockets in between as it would in the resolver.
+ *
+ * With -x the dispatch is exclusive and each response gets a socket of
+ * its own on a random port, so the socket and port tables are exercised
+ * too.  An exclusive dispatch cancels its oldest response once too many
+ * sockets are open; those are counted separately.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <isc/commandline.h>
+#include <isc/condition.h>
+#include <isc/entropy.h>
+#include <isc/event.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/net.h>
+#include <isc/os.h>
+#include <isc/print.h>
+#include <isc/sockaddr.h>
+#include <isc/socket.h>
+#include <isc/task.h>
+#include <isc/time.h>
+#include <isc/util.h>
+
+#include <dns/dispatch.h>
+#include <dns/result.h>
+
+typedef struct slot {
+	dns_dispentry_t *	resp;
+	struct worker *		worker;
+} slot_t;
+
+typedef struct worker {
+	isc_task_t *		task;
+	unsigned int		first;		/*%< first destination */
+	unsigned int		done;		/*%< responses added */
+	slot_t *		slots;
+	unsigned int		nfailed;
+	unsigned int		ncanceled;
+	isc_uint64_t		addusec;
+	isc_uint64_t		removeusec;
+} worker_t;
+
+static isc_mem_t *mctx = NULL;
+static isc_entropy_t *ectx = NULL;
+static isc_taskmgr_t *taskmgr = NULL;
+static isc_socketmgr_t *socketmgr = NULL;
+static dns_dispatchmgr_t *dispatchmgr = NULL;
+static dns_dispatch_t *dispatch = NULL;
+
+static isc_sockaddr_t *dests = NULL;
+static unsigned int ndests = 1000;
+static unsigned int maxoutstanding = 1000;
+static unsigned int nresponses = 1000000;
+static isc_boolean_t exclusive = ISC_FALSE;
+
+static isc_mutex_t lock;
+static isc_condition_t cv;
+static unsigned int running;
+
+static void
+usage(const char *progname) {
+	fprintf(stderr, "usage: %s [-x] [-b buckets] [-d destinations] "
+		"[-n responses] [-o outstanding] [-t tasks]\n", progname);
+	exit(1);
+}
+
+static void
+check_result(isc_result_t result, const char *what) {
+	if (result == ISC_R_SUCCESS)
+		return;
+	fprintf(stderr, "%s: %s\n", what, isc_result_totext(result));
+	exit(1);
+}
+
+/*
+ * Nothing is sent, so the only events are for responses canceled by an
+ * exclusive dispatch.
+ */
+static void
+response(isc_task_t *task, isc_event_t *event) {
+	dns_dispatchevent_t *devent = (dns_dispatchevent_t *)event;
+	slot_t *slot = event->ev_arg;
+	worker_t *worker = slot->worker;
+
+	UNUSED(task);
+	INSIST(devent->result == ISC_R_CANCELED);
+	INSIST(slot->resp == event->ev_sender);
+
+	dns_dispatch_removeresponse(&slot->resp, &devent);
+	worker->ncanceled++;
+}
+
+static void
+run(isc_task_t *task, isc_event_t *event) {
+	worker_t *worker = event->ev_arg;
+	isc_time_t start, end;
+	isc_result_t result;
+	isc_uint16_t id;
+	slot_t *slot;
+	unsigned int i;
+
+	slot = &worker->slots[worker->done % maxoutstanding];
+	if (slot->resp != NULL) {
+		TIME_NOW(&start);
+		dns_dispatch_removeresponse(&slot->resp, NULL);
+		TIME_NOW(&end);
+		worker->removeusec += isc_time_microdiff(&end, &start);
+	}
+
+	TIME_NOW(&start);
+	result = dns_dispatch_addresponse3(dispatch, 0,
+					   &dests[(worker->first +
+						   worker->done) % ndests],
+					   task, response, slot, &id,
+					   &slot->resp, socketmgr);
+	TIME_NOW(&end);
+	worker->addusec += isc_time_microdiff(&end, &start);
+	if (result != ISC_R_SUCCESS)
+		worker->nfailed++;
+	worker->done++;
+
+	if (worker->done < nresponses) {
+		isc_task_send(task, &event);
+		return;
+	}
+
+	for (i = 0; i < maxoutstanding; i++) {
+		slot = &worker->slots[i];
+		if (slot->resp != NULL)
+			dns_dispatch_removeresponse(&slot->resp, NULL);
+	}
+	isc_event_free(&event);
+
+	LOCK(&lock);
+	running--;
+	SIGNAL(&cv);
+	UNLOCK(&lock);
+}
+
+int
+main(int argc, char **argv) {
+	unsigned int buckets = 16411;
+	unsigned int nworkers = isc_os_ncpus();
+	isc_sockaddr_t any4;
+	struct in_addr ina;
+	worker_t *workers;
+	isc_event_t *event;
+	isc_time_t start, end;
+	isc_uint64_t usec, addusec = 0, removeusec = 0, total;
+	unsigned int i, j, attrs, nfailed = 0, ncanceled = 0;
+	isc_result_t result;
+	int ch;
+
+	while ((ch = isc_commandline_parse(argc, argv, "b:d:n:o:t:x")) != -1) {
+		switch (ch) {
+		case 'b':
+			buckets = atoi(isc_commandline_argument);
+			break;
+		case 'd':
+			ndests = atoi(isc_commandline_argument);
+			break;
+		case 'n':
+			nresponses = atoi(isc_commandline_argument);
+			break;
+		case 'o':
+			maxoutstanding = atoi(isc_commandline_argument);
+			break;
+		case 't':
+			nworkers = atoi(isc_commandline_argument);
+			break;
+		case 'x':
+			exclusive = ISC_TRUE;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (buckets == 0 || buckets >= 2097169 || ndests == 0 ||
+	    ndests > 65535 || nworkers == 0 || maxoutstanding == 0 ||
+	    nresponses < nworkers)
+		usage(argv[0]);
+	nresponses /= nworkers;
+
+	dns_result_register();
+	RUNTIME_CHECK(isc_mem_create(0, 0, &mctx) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_mutex_init(&lock) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_condition_init(&cv) == ISC_R_SUCCESS);
+	check_result(isc_entropy_create(mctx, &ectx), "isc_entropy_create");
+	check_result(isc_taskmgr_create(mctx, isc_os_ncpus(), 0, &taskmgr),
+		     "isc_taskmgr_create");
+	check_result(isc_socketmgr_create2(mctx, &socketmgr, 65536),
+		     "isc_socketmgr_create2");
+	check_result(dns_dispatchmgr_create(mctx, ectx, &dispatchmgr),
+		     "dns_dispatchmgr_create");
+
+	isc_sockaddr_any(&any4);
+	attrs = DNS_DISPATCHATTR_IPV4 | DNS_DISPATCHATTR_UDP;
+	if (exclusive)
+		attrs |= DNS_DISPATCHATTR_EXCLUSIVE;
+	result = dns_dispatch_getudp(dispatchmgr, socketmgr, taskmgr, &any4,
+				     4096, 32768, 65535, buckets,
+				     buckets < 16433 ? 16433 : buckets + 1,
+				     attrs, attrs, &dispatch);
+	check_result(result, "dns_dispatch_getudp");
+
+	dests = isc_mem_get(mctx, ndests * sizeof(*dests));
+	RUNTIME_CHECK(dests != NULL);
+	ina.s_addr = htonl(INADDR_LOOPBACK);
+	for (i = 0; i < ndests; i++)
+		isc_sockaddr_fromin(&dests[i], &ina, 1 + i);
+
+	workers = isc_mem_get(mctx, nworkers * sizeof(*workers));
+	RUNTIME_CHECK(workers != NULL);
+
+	printf("%u tasks, %u buckets, %u destinations, "
+	       "%u outstanding per task%s\n",
+	       nworkers, buckets, ndests, maxoutstanding,
+	       exclusive ? ", exclusive" : "");
+
+	for (i = 0; i < nworkers; i++) {
+		worker_t *worker = &workers[i];
+
+		worker->task = NULL;
+		result = isc_task_create(taskmgr, 0, &worker->task);
+		check_result(result, "isc_task_create");
+		worker->first = i * (ndests / nworkers);
+		worker->done = 0;
+		worker->nfailed = 0;
+		worker->ncanceled = 0;
+		worker->addusec = 0;
+		worker->removeusec = 0;
+		worker->slots = isc_mem_get(mctx, maxoutstanding *
+					    sizeof(worker->slots[0]));
+		RUNTIME_CHECK(worker->slots != NULL);
+		for (j = 0; j < maxoutstanding; j++) {
+			worker->slots[j].resp = NULL;
+			worker->slots[j].worker = worker;
+		}
+	}
+
+	LOCK(&lock);
+	running = nworkers;
+	TIME_NOW(&start);
+	for (i = 0; i < nworkers; i++) {
+		event = isc_event_allocate(mctx, NULL, 1, run, &workers[i],
+					   sizeof(*event));
+		RUNTIME_CHECK(event != NULL);
+		isc_task_send(workers[i].task, &event);
+	}
+	while (running > 0)
+		WAIT(&cv, &lock);
+	TIME_NOW(&end);
+	UNLOCK(&lock);
+	usec = isc_time_microdiff(&end, &start);
+	total = (isc_uint64_t)nresponses * nworkers;
+
+	for (i = 0; i < nworkers; i++) {
+		worker_t *worker = &workers[i];
+
+		addusec += worker->addusec;
+		removeusec += worker->removeusec;
+		nfailed += worker->nfailed;
+		ncanceled += worker->ncanceled;
+		isc_task_detach(&worker->task);
+		isc_mem_put(mctx, worker->slots,
+			    maxoutstanding * sizeof(worker->slots[0]));
+	}
+
+	printf("%" ISC_PRINT_QUADFORMAT "u responses, %u failed, "
+	       "%u canceled\n", total, nfailed, ncanceled);
+	printf("addresponse: %.2f usec per call\n", (double)addusec / total);
+	printf("removeresponse: %.2f usec per call\n",
+	       (double)removeusec / total);
+	printf("total: %" ISC_PRINT_QUADFORMAT "u usec, "
+	       "%.0f responses/sec\n", usec,
+	       usec == 0 ? 0.0 : (double)total * 1000000.0 / usec);
+
+	isc_mem_put(mctx, workers, nworkers * sizeof(*workers));
+	isc_mem_put(mctx, dests, ndests * sizeof(*dests));
+
+	dns_dispatch_detach(&dispatch);
+	dns_dispatchmgr_destroy(&dispatchmgr);
+	isc_socketmgr_destroy(&socketmgr);
+	isc_taskmgr_destroy(&taskmgr);
+	isc_entropy_detach(&ectx);
+	(void)isc_condition_destroy(&cv);
+	DESTROYLOCK(&lock);
+	isc_mem_destroy(&mctx);
+
+	return (0);
+}
@@ -0,0 +1,466 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Measure how fast dns_resolver_createfetch() can be called from many
+ * threads at once.  A view forwards everything to a stub authoritative
+ * server run by this program on 127.0.0.1, which answers each A query
+ * with 10.0.0.1 straight away.  Each thread keeps up to -o fetches
+ * outstanding for names picked from -u unique ones, so that fetches
+ * for the same name join the same fetch context as they do under load.
+ *
+ * The time spent in dns_resolver_createfetch() and the total time for
+ * all fetches to complete are reported.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+
+#include <isc/buffer.h>
+#include <isc/commandline.h>
+#include <isc/condition.h>
+#include <isc/entropy.h>
+#include <isc/hash.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/net.h>
+#include <isc/os.h>
+#include <isc/print.h>
+#include <isc/sockaddr.h>
+#include <isc/socket.h>
+#include <isc/task.h>
+#include <isc/thread.h>
+#include <isc/time.h>
+#include <isc/timer.h>
+#include <isc/util.h>
+
+#include <dns/cache.h>
+#include <dns/dispatch.h>
+#include <dns/events.h>
+#include <dns/fixedname.h>
+#include <dns/forward.h>
+#include <dns/name.h>
+#include <dns/rdataset.h>
+#include <dns/resolver.h>
+#include <dns/result.h>
+#include <dns/rootns.h>
+#include <dns/view.h>
+
+typedef struct request {
+	dns_rdataset_t		rdataset;
+	dns_rdataset_t		sigrdataset;
+	struct worker *		worker;
+} request_t;
+
+typedef struct worker {
+	isc_thread_t		thread;
+	isc_task_t *		task;
+	unsigned int		first;		/*%< first name number */
+	unsigned int		nfetches;
+	isc_mutex_t		lock;
+	isc_condition_t		cv;
+	unsigned int		outstanding;
+	isc_uint64_t		usec;		/*%< in createfetch */
+} worker_t;
+
+static isc_mem_t *mctx = NULL;
+static isc_entropy_t *ectx = NULL;
+static isc_taskmgr_t *taskmgr = NULL;
+static isc_socketmgr_t *socketmgr = NULL;
+static isc_timermgr_t *timermgr = NULL;
+static dns_dispatchmgr_t *dispatchmgr = NULL;
+static dns_view_t *view = NULL;
+
+static unsigned int nunique = 1000;
+static unsigned int maxoutstanding = 64;
+
+static isc_mutex_t countlock;
+static unsigned int nsuccess, nfailure;
+
+static int stubfd = -1;
+static volatile isc_boolean_t stubdone = ISC_FALSE;
+
+static void
+usage(const char *progname) {
+	fprintf(stderr, "usage: %s [-b buckets] [-n fetches] [-o outstanding] "
+		"[-t threads] [-u names]\n", progname);
+	exit(1);
+}
+
+static void
+check_result(isc_result_t result, const char *what) {
+	if (result == ISC_R_SUCCESS)
+		return;
+	fprintf(stderr, "%s: %s\n", what, isc_result_totext(result));
+	exit(1);
+}
+
+/*
+ * The stub authoritative server: the question is echoed back with a
+ * single A record for it, or none if another type was asked for.
+ */
+static isc_threadresult_t
+stub(isc_threadarg_t arg) {
+	unsigned char buf[512 + 16];
+	struct sockaddr_in from;
+	socklen_t fromlen;
+	struct pollfd pfd;
+	ssize_t n;
+	size_t len;
+	unsigned int qtype;
+	static const unsigned char answer[] = {
+		0xc0, 0x0c,		/* the question name */
+		0x00, 0x01, 0x00, 0x01,	/* A IN */
+		0x00, 0x00, 0x01, 0x2c,	/* TTL 300 */
+		0x00, 0x04, 10, 0, 0, 1
+	};
+
+	UNUSED(arg);
+
+	pfd.fd = stubfd;
+	pfd.events = POLLIN;
+	while (!stubdone) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		fromlen = sizeof(from);
+		n = recvfrom(stubfd, buf, 512, 0, (struct sockaddr *)&from,
+			     &fromlen);
+		if (n < 12 || buf[4] != 0 || buf[5] != 1)
+			continue;
+
+		/* Skip the question name. */
+		len = 12;
+		while (len < (size_t)n && buf[len] != 0)
+			len += buf[len] + 1;
+		len += 5;
+		if (len > (size_t)n)
+			continue;
+		qtype = buf[len - 4] << 8 | buf[len - 3];
+
+		buf[2] = 0x84 | (buf[2] & 0x01);	/* QR, AA, RD */
+		buf[3] = 0x80;				/* RA */
+		buf[6] = 0;
+		buf[7] = 0;
+		memset(buf + 8, 0, 4);
+		if (qtype == 1) {
+			buf[7] = 1;
+			memmove(buf + len, answer, sizeof(answer));
+			len += sizeof(answer);
+		}
+		(void)sendto(stubfd, buf, len, 0, (struct sockaddr *)&from,
+			     fromlen);
+	}
+
+	return ((isc_threadresult_t)0);
+}
+
+static void
+start_stub(isc_sockaddr_t *addr) {
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	isc_thread_t thread;
+	struct in_addr ina;
+
+	stubfd = socket(AF_INET, SOCK_DGRAM, 0);
+	RUNTIME_CHECK(stubfd >= 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	RUNTIME_CHECK(bind(stubfd, (struct sockaddr *)&sin, len) == 0);
+	RUNTIME_CHECK(getsockname(stubfd, (struct sockaddr *)&sin,
+				  &len) == 0);
+
+	ina.s_addr = htonl(INADDR_LOOPBACK);
+	isc_sockaddr_fromin(addr, &ina, ntohs(sin.sin_port));
+
+	RUNTIME_CHECK(isc_thread_create(stub, NULL, &thread) ==
+		      ISC_R_SUCCESS);
+}
+
+static void
+create_view(unsigned int buckets, isc_sockaddr_t *server) {
+	dns_cache_t *cache = NULL;
+	dns_db_t *rootdb = NULL;
+	dns_dispatch_t *disp4 = NULL;
+	isc_sockaddr_t any4;
+	isc_sockaddrlist_t addrs;
+	unsigned int attrs;
+	isc_result_t result;
+
+	result = dns_view_create(mctx, dns_rdataclass_in, "_default", &view);
+	check_result(result, "dns_view_create");
+
+	result = dns_cache_create(mctx, taskmgr, timermgr, dns_rdataclass_in,
+				  "rbt", 0, NULL, &cache);
+	check_result(result, "dns_cache_create");
+	dns_view_setcache(view, cache);
+	dns_cache_detach(&cache);
+
+	/* Without trust anchors nothing is found to be secure. */
+	result = dns_view_initsecroots(view, mctx);
+	check_result(result, "dns_view_initsecroots");
+
+	isc_sockaddr_any(&any4);
+	attrs = DNS_DISPATCHATTR_IPV4 | DNS_DISPATCHATTR_UDP;
+	result = dns_dispatch_getudp(dispatchmgr, socketmgr, taskmgr, &any4,
+				     4096, 32768, 32768, 16411, 16433,
+				     attrs, attrs, &disp4);
+	check_result(result, "dns_dispatch_getudp");
+
+	result = dns_view_createresolver(view, taskmgr, buckets, 4,
+					 socketmgr, timermgr, 0,
+					 dispatchmgr, disp4, NULL);
+	check_result(result, "dns_view_createresolver");
+	dns_dispatch_detach(&disp4);
+
+	/*
+	 * Clients beyond clients-per-query would be dropped, which is not
+	 * what is being measured.
+	 */
+	dns_resolver_setclientsperquery(view->resolver, 0, 0);
+
+	result = dns_rootns_create(mctx, dns_rdataclass_in, NULL, &rootdb);
+	check_result(result, "dns_rootns_create");
+	dns_view_sethints(view, rootdb);
+	dns_db_detach(&rootdb);
+
+	ISC_LIST_INIT(addrs);
+	ISC_LIST_APPEND(addrs, server, link);
+	result = dns_fwdtable_add(view->fwdtable, dns_rootname, &addrs,
+				  dns_fwdpolicy_only);
+	check_result(result, "dns_fwdtable_add");
+
+	dns_view_freeze(view);
+}
+
+static void
+done(isc_task_t *task, isc_event_t *event) {
+	dns_fetchevent_t *fevent = (dns_fetchevent_t *)event;
+	request_t *req = event->ev_arg;
+	worker_t *worker = req->worker;
+
+	UNUSED(task);
+	INSIST(event->ev_type == DNS_EVENT_FETCHDONE);
+
+	LOCK(&countlock);
+	if (fevent->result == ISC_R_SUCCESS)
+		nsuccess++;
+	else
+		nfailure++;
+	UNLOCK(&countlock);
+
+	if (fevent->node != NULL)
+		dns_db_detachnode(fevent->db, &fevent->node);
+	if (fevent->db != NULL)
+		dns_db_detach(&fevent->db);
+	if (dns_rdataset_isassociated(&req->rdataset))
+		dns_rdataset_disassociate(&req->rdataset);
+	if (dns_rdataset_isassociated(&req->sigrdataset))
+		dns_rdataset_disassociate(&req->sigrdataset);
+	dns_resolver_destroyfetch(&fevent->fetch);
+	isc_event_free(&event);
+	isc_mem_put(mctx, req, sizeof(*req));
+
+	LOCK(&worker->lock);
+	worker->outstanding--;
+	SIGNAL(&worker->cv);
+	UNLOCK(&worker->lock);
+}
+
+static isc_threadresult_t
+run(isc_threadarg_t arg) {
+	worker_t *worker = arg;
+	dns_fixedname_t fname;
+	dns_name_t *name;
+	request_t *req;
+	dns_fetch_t *fetch;
+	isc_time_t start, end;
+	isc_result_t result;
+	char text[64];
+	unsigned int i;
+
+	dns_fixedname_init(&fname);
+	name = dns_fixedname_name(&fname);
+
+	for (i = 0; i < worker->nfetches; i++) {
+		snprintf(text, sizeof(text), "h%u.bench.",
+			 (worker->first + i) % nunique);
+		result = dns_name_fromstring(name, text, 0, NULL);
+		RUNTIME_CHECK(result == ISC_R_SUCCESS);
+
+		LOCK(&worker->lock);
+		while (worker->outstanding >= maxoutstanding)
+			WAIT(&worker->cv, &worker->lock);
+		worker->outstanding++;
+		UNLOCK(&worker->lock);
+
+		req = isc_mem_get(mctx, sizeof(*req));
+		RUNTIME_CHECK(req != NULL);
+		req->worker = worker;
+		dns_rdataset_init(&req->rdataset);
+		dns_rdataset_init(&req->sigrdataset);
+
+		/*
+		 * The fetch may be done, and 'req' freed, before this
+		 * returns.
+		 */
+		fetch = NULL;
+		TIME_NOW(&start);
+		result = dns_resolver_createfetch(view->resolver, name,
+						  dns_rdatatype_a, NULL, NULL,
+						  NULL, 0, worker->task,
+						  done, req, &req->rdataset,
+						  &req->sigrdataset, &fetch);
+		TIME_NOW(&end);
+		worker->usec += isc_time_microdiff(&end, &start);
+		if (result != ISC_R_SUCCESS) {
+			isc_mem_put(mctx, req, sizeof(*req));
+			LOCK(&countlock);
+			nfailure++;
+			UNLOCK(&countlock);
+			LOCK(&worker->lock);
+			worker->outstanding--;
+			UNLOCK(&worker->lock);
+		}
+	}
+
+	LOCK(&worker->lock);
+	while (worker->outstanding > 0)
+		WAIT(&worker->cv, &worker->lock);
+	UNLOCK(&worker->lock);
+
+	return ((isc_threadresult_t)0);
+}
+
+int
+main(int argc, char **argv) {
+	unsigned int buckets = 31;
+	unsigned int fetches = 200000;
+	unsigned int nthreads = isc_os_ncpus();
+	isc_sockaddr_t server;
+	worker_t *workers;
+	isc_time_t start, end;
+	isc_uint64_t usec, createusec = 0;
+	isc_result_t result;
+	unsigned int i;
+	int ch;
+
+	while ((ch = isc_commandline_parse(argc, argv, "b:n:o:t:u:")) != -1) {
+		switch (ch) {
+		case 'b':
+			buckets = atoi(isc_commandline_argument);
+			break;
+		case 'n':
+			fetches = atoi(isc_commandline_argument);
+			break;
+		case 'o':
+			maxoutstanding = atoi(isc_commandline_argument);
+			break;
+		case 't':
+			nthreads = atoi(isc_commandline_argument);
+			break;
+		case 'u':
+			nunique = atoi(isc_commandline_argument);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (buckets == 0 || nthreads == 0 || maxoutstanding == 0 ||
+	    nunique == 0 || fetches < nthreads)
+		usage(argv[0]);
+
+	dns_result_register();
+	RUNTIME_CHECK(isc_mem_create(0, 0, &mctx) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_mutex_init(&countlock) == ISC_R_SUCCESS);
+	check_result(isc_entropy_create(mctx, &ectx), "isc_entropy_create");
+	check_result(isc_hash_create(mctx, ectx, DNS_NAME_MAXWIRE),
+		     "isc_hash_create");
+	check_result(isc_taskmgr_create(mctx, isc_os_ncpus(), 0, &taskmgr),
+		     "isc_taskmgr_create");
+	check_result(isc_timermgr_create(mctx, &timermgr),
+		     "isc_timermgr_create");
+	check_result(isc_socketmgr_create(mctx, &socketmgr),
+		     "isc_socketmgr_create");
+	check_result(dns_dispatchmgr_create(mctx, ectx, &dispatchmgr),
+		     "dns_dispatchmgr_create");
+
+	start_stub(&server);
+	create_view(buckets, &server);
+
+	workers = isc_mem_get(mctx, nthreads * sizeof(*workers));
+	RUNTIME_CHECK(workers != NULL);
+
+	printf("%u threads, %u buckets, %u fetches for %u names, "
+	       "%u outstanding per thread\n",
+	       nthreads, buckets, fetches, nunique, maxoutstanding);
+
+	TIME_NOW(&start);
+	for (i = 0; i < nthreads; i++) {
+		worker_t *worker = &workers[i];
+
+		worker->task = NULL;
+		result = isc_task_create(taskmgr, 0, &worker->task);
+		check_result(result, "isc_task_create");
+		worker->first = i * (fetches / nthreads);
+		worker->nfetches = fetches / nthreads;
+		worker->outstanding = 0;
+		worker->usec = 0;
+		RUNTIME_CHECK(isc_mutex_init(&worker->lock) == ISC_R_SUCCESS);
+		RUNTIME_CHECK(isc_condition_init(&worker->cv) ==
+			      ISC_R_SUCCESS);
+		RUNTIME_CHECK(isc_thread_create(run, worker,
+						&worker->thread) ==
+			      ISC_R_SUCCESS);
+	}
+	for (i = 0; i < nthreads; i++) {
+		worker_t *worker = &workers[i];
+
+		RUNTIME_CHECK(isc_thread_join(worker->thread, NULL) ==
+			      ISC_R_SUCCESS);
+		createusec += worker->usec;
+		isc_task_detach(&worker->task);
+		(void)isc_condition_destroy(&worker->cv);
+		DESTROYLOCK(&worker->lock);
+	}
+	TIME_NOW(&end);
+	usec = isc_time_microdiff(&end, &start);
+
+	printf("%u succeeded, %u failed\n", nsuccess, nfailure);
+	printf("createfetch: %.2f usec per call\n",
+	       (double)createusec / (fetches - fetches % nthreads));
+	printf("total: %" ISC_PRINT_QUADFORMAT "u usec, %.0f fetches/sec\n",
+	       usec, usec == 0 ? 0.0 :
+	       (double)(fetches - fetches % nthreads) * 1000000.0 / usec);
+
+	isc_mem_put(mctx, workers, nthreads * sizeof(*workers));
+
+	stubdone = ISC_TRUE;
+	dns_view_detach(&view);
+	dns_dispatchmgr_destroy(&dispatchmgr);
+	isc_socketmgr_destroy(&socketmgr);
+	isc_timermgr_destroy(&timermgr);
+	isc_taskmgr_destroy(&taskmgr);
+	isc_hash_destroy();
+	isc_entropy_detach(&ectx);
+	DESTROYLOCK(&countlock);
+	isc_mem_destroy(&mctx);
+
+	return (0);
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Measure task manager event throughput as the number of worker
+ * threads grows.  A number of event "chains" are started; each event
+ * is passed on to the next task in turn until the chain's share of the
+ * total event count has been delivered.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <isc/commandline.h>
+#include <isc/condition.h>
+#include <isc/event.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/os.h>
+#include <isc/print.h>
+#include <isc/task.h>
+#include <isc/time.h>
+#include <isc/util.h>
+
+typedef struct chain {
+	unsigned int	remaining;
+	unsigned int	next;
+} chain_t;
+
+static isc_mem_t *mctx = NULL;
+static isc_task_t **tasks = NULL;
+static unsigned int ntasks = 64;
+static chain_t *chains = NULL;
+static unsigned int nchains = 256;
+
+static isc_mutex_t lock;
+static isc_condition_t cv;
+static unsigned int running;
+
+static void
+forward(isc_task_t *task, isc_event_t *event) {
+	chain_t *chain = event->ev_arg;
+
+	UNUSED(task);
+
+	if (--chain->remaining == 0) {
+		isc_event_free(&event);
+		LOCK(&lock);
+		if (--running == 0)
+			SIGNAL(&cv);
+		UNLOCK(&lock);
+		return;
+	}
+
+	chain->next = (chain->next + 1) % ntasks;
+	isc_task_send(tasks[chain->next], &event);
+}
+
+static void
+usage(const char *progname) {
+	fprintf(stderr, "usage: %s [-c chains] [-e events] [-q quantum] "
+			"[-t tasks] [-w maxworkers]\n", progname);
+	exit(1);
+}
+
+static isc_uint64_t
+bench(unsigned int workers, unsigned int quantum, unsigned int events) {
+	isc_taskmgr_t *taskmgr = NULL;
+	isc_event_t *event;
+	isc_time_t start, finish;
+	unsigned int i;
+
+	RUNTIME_CHECK(isc_taskmgr_create(mctx, workers, quantum,
+					 &taskmgr) == ISC_R_SUCCESS);
+	for (i = 0; i < ntasks; i++) {
+		tasks[i] = NULL;
+		RUNTIME_CHECK(isc_task_create(taskmgr, 0, &tasks[i]) ==
+			      ISC_R_SUCCESS);
+	}
+
+	running = nchains;
+	TIME_NOW(&start);
+
+	LOCK(&lock);
+	for (i = 0; i < nchains; i++) {
+		chains[i].remaining = events / nchains;
+		chains[i].next = i % ntasks;
+		event = isc_event_allocate(mctx, NULL, 1, forward, &chains[i],
+					   sizeof(*event));
+		RUNTIME_CHECK(event != NULL);
+		isc_task_send(tasks[chains[i].next], &event);
+	}
+	while (running > 0)
+		WAIT(&cv, &lock);
+	UNLOCK(&lock);
+
+	TIME_NOW(&finish);
+
+	for (i = 0; i < ntasks; i++)
+		isc_task_detach(&tasks[i]);
+	isc_taskmgr_destroy(&taskmgr);
+
+	return (isc_time_microdiff(&finish, &start));
+}
+
+int
+main(int argc, char **argv) {
+	unsigned int events = 2000000;
+	unsigned int maxworkers = isc_os_ncpus() * 2;
+	unsigned int quantum = 0;
+	unsigned int workers;
+	isc_uint64_t usec;
+	int ch;
+
+	while ((ch = isc_commandline_parse(argc, argv, "c:e:q:t:w:")) != -1) {
+		switch (ch) {
+		case 'c':
+			nchains = atoi(isc_commandline_argument);
+			break;
+		case 'e':
+			events = atoi(isc_commandline_argument);
+			break;
+		case 'q':
+			quantum = atoi(isc_commandline_argument);
+			break;
+		case 't':
+			ntasks = atoi(isc_commandline_argument);
+			break;
+		case 'w':
+			maxworkers = atoi(isc_commandline_argument);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nchains == 0 || ntasks == 0 || maxworkers == 0 ||
+	    events < nchains)
+		usage(argv[0]);
+
+	RUNTIME_CHECK(isc_mem_create(0, 0, &mctx) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_mutex_init(&lock) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_condition_init(&cv) == ISC_R_SUCCESS);
+	tasks = isc_mem_get(mctx, ntasks * sizeof(*tasks));
+	chains = isc_mem_get(mctx, nchains * sizeof(*chains));
+	RUNTIME_CHECK(tasks != NULL && chains != NULL);
+
+	/* Round the event count down to a multiple of the chain count. */
+	events -= events % nchains;
+
+	printf("%u tasks, %u chains, %u events\n", ntasks, nchains, events);
+	printf("%8s %12s %14s\n", "workers", "usec", "events/sec");
+	workers = 1;
+	for (;;) {
+		usec = bench(workers, quantum, events);
+		printf("%8u %12" ISC_PRINT_QUADFORMAT "u %14.0f\n",
+		       workers, usec,
+		       usec == 0 ? 0.0 : (double)events * 1000000.0 / usec);
+		if (workers == maxworkers)
+			break;
+		workers *= 2;
+		if (workers > maxworkers)
+			workers = maxworkers;
+	}
+
+	isc_mem_put(mctx, chains, nchains * sizeof(*chains));
+	isc_mem_put(mctx, tasks, ntasks * sizeof(*tasks));
+	(void)isc_condition_destroy(&cv);
+	DESTROYLOCK(&lock);
+	isc_mem_destroy(&mctx);
+
+	return (0);
+}
@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Measure the cost of timer operations as the number of threads using
+ * them grows.  Each thread creates its share of the timers as 'once'
+ * timers one to two minutes out, much as the resolver does for
+ * fetches, resets each of them a number of times, cancels them by
+ * making them inactive and finally detaches them.  No timer is meant
+ * to fire while the benchmark runs.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <isc/commandline.h>
+#include <isc/condition.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/os.h>
+#include <isc/print.h>
+#include <isc/task.h>
+#include <isc/thread.h>
+#include <isc/time.h>
+#include <isc/timer.h>
+#include <isc/util.h>
+
+typedef struct worker {
+	isc_thread_t		thread;
+	isc_timer_t **		timers;
+	unsigned int		ntimers;
+	isc_uint32_t		seed;
+} worker_t;
+
+/*%
+ * Phases of the benchmark.  The threads run each phase over all of
+ * their timers, then wait for the others before starting the next.
+ */
+enum { CREATE, RESET, CANCEL, DETACH, NPHASES };
+
+static const char *phasenames[NPHASES] = {
+	"create", "reset", "cancel", "detach"
+};
+
+static isc_mem_t *mctx = NULL;
+static isc_timermgr_t *timermgr = NULL;
+static isc_task_t *task = NULL;
+static unsigned int resets = 4;
+
+static isc_mutex_t lock;
+static isc_condition_t cv;
+static unsigned int phase;
+static unsigned int waiting;
+static unsigned int nthreads;
+static isc_time_t phasestart[NPHASES + 2];
+
+static void
+fired(isc_task_t *t, isc_event_t *event) {
+	UNUSED(t);
+
+	fprintf(stderr, "unexpected timer event\n");
+	isc_event_free(&event);
+}
+
+/*
+ * Wait until every thread has finished the current phase.  The last
+ * one to arrive starts the next phase.
+ */
+static void
+barrier(void) {
+	unsigned int p;
+
+	LOCK(&lock);
+	p = phase;
+	if (++waiting == nthreads) {
+		waiting = 0;
+		TIME_NOW(&phasestart[++phase]);
+		BROADCAST(&cv);
+	} else {
+		while (phase == p)
+			WAIT(&cv, &lock);
+	}
+	UNLOCK(&lock);
+}
+
+static isc_threadresult_t
+#ifdef _WIN32
+WINAPI
+#endif
+run(void *arg) {
+	worker_t *w = arg;
+	isc_interval_t interval;
+	unsigned int i, j;
+
+	barrier();
+
+	for (i = 0; i < w->ntimers; i++) {
+		w->seed = w->seed * 1103515245 + 12345;
+		isc_interval_set(&interval, 60 + (w->seed >> 8) % 60, 0);
+		w->timers[i] = NULL;
+		RUNTIME_CHECK(isc_timer_create(timermgr, isc_timertype_once,
+					       NULL, &interval, task, fired,
+					       NULL, &w->timers[i]) ==
+			      ISC_R_SUCCESS);
+	}
+	barrier();
+
+	for (j = 0; j < resets; j++) {
+		for (i = 0; i < w->ntimers; i++) {
+			w->seed = w->seed * 1103515245 + 12345;
+			isc_interval_set(&interval, 60 + (w->seed >> 8) % 60,
+					 (w->seed >> 4) % 1000000000);
+			RUNTIME_CHECK(isc_timer_reset(w->timers[i],
+						      isc_timertype_once,
+						      NULL, &interval,
+						      ISC_FALSE) ==
+				      ISC_R_SUCCESS);
+		}
+	}
+	barrier();
+
+	for (i = 0; i < w->ntimers; i++)
+		RUNTIME_CHECK(isc_timer_reset(w->timers[i],
+					      isc_timertype_inactive,
+					      NULL, NULL, ISC_TRUE) ==
+			      ISC_R_SUCCESS);
+	barrier();
+
+	for (i = 0; i < w->ntimers; i++)
+		isc_timer_detach(&w->timers[i]);
+	barrier();
+
+	return ((isc_threadresult_t)0);
+}
+
+static void
+bench(unsigned int threads, unsigned int count) {
+	worker_t *workers;
+	isc_timer_t **timers;
+	isc_uint64_t usec;
+	unsigned int i, ops;
+
+	workers = isc_mem_get(mctx, threads * sizeof(*workers));
+	timers = isc_mem_get(mctx, count * sizeof(*timers));
+	RUNTIME_CHECK(workers != NULL && timers != NULL);
+
+	nthreads = threads + 1;
+	phase = 0;
+	waiting = 0;
+	for (i = 0; i < threads; i++) {
+		workers[i].timers = timers + count / threads * i;
+		workers[i].ntimers = count / threads;
+		workers[i].seed = i + 1;
+		RUNTIME_CHECK(isc_thread_create(run, &workers[i],
+						&workers[i].thread) ==
+			      ISC_R_SUCCESS);
+	}
+
+	/*
+	 * Run the barriers along with the workers, so that the phase
+	 * times are taken by the last thread to finish each phase.
+	 */
+	for (i = 0; i <= NPHASES; i++)
+		barrier();
+
+	for (i = 0; i < threads; i++)
+		RUNTIME_CHECK(isc_thread_join(workers[i].thread, NULL) ==
+			      ISC_R_SUCCESS);
+
+	printf("%8u", threads);
+	for (i = 0; i < NPHASES; i++) {
+		usec = isc_time_microdiff(&phasestart[i + 2],
+					  &phasestart[i + 1]);
+		ops = (count / threads) * threads;
+		if (i == RESET)
+			ops *= resets;
+		printf(" %12.0f", usec == 0 ? 0.0 : ops * 1000000.0 / usec);
+	}
+	printf("\n");
+
+	isc_mem_put(mctx, timers, count * sizeof(*timers));
+	isc_mem_put(mctx, workers, threads * sizeof(*workers));
+}
+
+static void
+usage(const char *progname) {
+	fprintf(stderr, "usage: %s [-n timers] [-r resets] [-w maxthreads]\n",
+		progname);
+	exit(1);
+}
+
+int
+main(int argc, char **argv) {
+	isc_taskmgr_t *taskmgr = NULL;
+	unsigned int count = 1000000;
+	unsigned int maxthreads = isc_os_ncpus() * 2;
+	unsigned int threads, i;
+	int ch;
+
+	while ((ch = isc_commandline_parse(argc, argv, "n:r:w:")) != -1) {
+		switch (ch) {
+		case 'n':
+			count = atoi(isc_commandline_argument);
+			break;
+		case 'r':
+			resets = atoi(isc_commandline_argument);
+			break;
+		case 'w':
+			maxthreads = atoi(isc_commandline_argument);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (maxthreads == 0 || count < maxthreads)
+		usage(argv[0]);
+
+	RUNTIME_CHECK(isc_mem_create(0, 0, &mctx) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_mutex_init(&lock) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_condition_init(&cv) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_taskmgr_create(mctx, 1, 0, &taskmgr) ==
+		      ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_timermgr_create(mctx, &timermgr) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_task_create(taskmgr, 0, &task) == ISC_R_SUCCESS);
+
+	printf("%u timers, %u resets each\n", count, resets);
+	printf("%8s", "threads");
+	for (i = 0; i < NPHASES; i++)
+		printf(" %12s", phasenames[i]);
+	printf("   (operations/sec)\n");
+	threads = 1;
+	for (;;) {
+		bench(threads, count);
+		if (threads == maxthreads)
+			break;
+		threads *= 2;
+		if (threads > maxthreads)
+			threads = maxthreads;
+	}
+
+	isc_task_detach(&task);
+	isc_timermgr_destroy(&timermgr);
+	isc_taskmgr_destroy(&taskmgr);
+	(void)isc_condition_destroy(&cv);
+	DESTROYLOCK(&lock);
+	isc_mem_destroy(&mctx);
+
+	return (0);
+}
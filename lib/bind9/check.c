@@ -2490,7 +2490,7 @@ check_zoneconf(const cfg_obj_t *zconfig, const cfg_obj_t *voptions,
 		result = tresult;
 
 	/*
-	 * If the zone type is rbt/rbt64 then master/hint zones
+	 * If the zone type is rbt/rbt64/qp then master/hint zones
 	 * require file clauses.
 	 * If inline signing is used, then slave zones require a
 	 * file clause as well
@@ -2512,7 +2512,8 @@ check_zoneconf(const cfg_obj_t *zconfig, const cfg_obj_t *voptions,
 	    (tresult == ISC_R_NOTFOUND ||
 	    (tresult == ISC_R_SUCCESS &&
 	     (strcmp("rbt", cfg_obj_asstring(obj)) == 0 ||
-	      strcmp("rbt64", cfg_obj_asstring(obj)) == 0))))
+	      strcmp("rbt64", cfg_obj_asstring(obj)) == 0 ||
+	      strcmp("qp", cfg_obj_asstring(obj)) == 0))))
 	{
 		isc_result_t res1;
 		const cfg_obj_t *fileobj = NULL;
@@ -19,7 +19,6 @@
 
 #include <limits.h>
 
-#include <isc/mutexblock.h>
 #include <isc/netaddr.h>
 #include <isc/print.h>
 #include <isc/random.h>
@@ -89,6 +88,44 @@ typedef ISC_LIST(dns_adbentry_t) dns_adbentrylist_t;
 typedef struct dns_adbfetch dns_adbfetch_t;
 typedef struct dns_adbfetch6 dns_adbfetch6_t;
 
+/*%
+ * Names and entries are kept in hash tables of buckets, each with its
+ * own lock.  The tables grow one bucket at a time (linear hashing): the
+ * objects in bucket 'n - 2^k' whose hash has bit k set move to a new
+ * bucket 'n', where 2^k <= n < 2^(k+1), so only two bucket locks are
+ * ever needed to grow a table.  Buckets live in segments which are
+ * never moved: segment 0 holds the first ADB_MINBUCKETS buckets and
+ * segment k > 0 the buckets from 2^(k-1) * ADB_MINBUCKETS up to twice
+ * that.
+ */
+#define ADB_SEGSHIFT		10
+#define ADB_MINBUCKETS		(1U << ADB_SEGSHIFT)
+#define ADB_MAXBUCKETS		(1U << 28)
+#define ADB_MAXSEGS		(28 - ADB_SEGSHIFT + 1)
+
+/*%
+ * Buckets are split by the growing task GROW_BATCH at a time, and
+ * GROW_LOOKUP at a time by lookups while growth is pending.
+ */
+#define GROW_BATCH		64
+#define GROW_LOOKUP		2
+
+typedef struct adbnamebucket {
+	isc_mutex_t			lock;
+	dns_adbnamelist_t		names;
+	dns_adbnamelist_t		deadnames;
+	isc_boolean_t			sd;	/*%< shutting down */
+	unsigned int			refcnt;
+} adbnamebucket_t;
+
+typedef struct adbentrybucket {
+	isc_mutex_t			lock;
+	dns_adbentrylist_t		entries;
+	dns_adbentrylist_t		deadentries;
+	isc_boolean_t			sd;	/*%< shutting down */
+	unsigned int			refcnt;
+} adbentrybucket_t;
+
 /*% dns adb structure */
 struct dns_adb {
 	unsigned int                    magic;
@@ -101,7 +138,6 @@ struct dns_adb {
 
 	isc_taskmgr_t                  *taskmgr;
 	isc_task_t                     *task;
-	isc_task_t                     *excl;
 
 	isc_interval_t                  tick_interval;
 	int                             next_cleanbucket;
@@ -119,32 +155,21 @@ struct dns_adb {
 	isc_mempool_t                  *afmp;   /*%< dns_adbfetch_t */
 
 	/*!
-	 * Bucketized locks and lists for names.
-	 *
-	 * XXXRTH  Have a per-bucket structure that contains all of these?
+	 * Bucketized locks and lists for names.  'nnames' only changes
+	 * while holding 'lock' and the locks of the buckets involved.
 	 */
 	unsigned int			nnames;
 	isc_mutex_t                     namescntlock;
 	unsigned int			namescnt;
-	dns_adbnamelist_t               *names;
-	dns_adbnamelist_t               *deadnames;
-	isc_mutex_t                     *namelocks;
-	isc_boolean_t                   *name_sd;
-	unsigned int                    *name_refcnt;
+	adbnamebucket_t			*namesegs[ADB_MAXSEGS];
 
 	/*!
-	 * Bucketized locks and lists for entries.
-	 *
-	 * XXXRTH  Have a per-bucket structure that contains all of these?
+	 * Bucketized locks and lists for entries, as for names.
 	 */
 	unsigned int			nentries;
 	isc_mutex_t                     entriescntlock;
 	unsigned int			entriescnt;
-	dns_adbentrylist_t              *entries;
-	dns_adbentrylist_t              *deadentries;
-	isc_mutex_t                     *entrylocks;
-	isc_boolean_t                   *entry_sd; /*%< shutting down */
-	unsigned int                    *entry_refcnt;
+	adbentrybucket_t		*entrysegs[ADB_MAXSEGS];
 
 	isc_event_t                     cevent;
 	isc_boolean_t                   cevent_out;
@@ -535,330 +560,470 @@ ttlclamp(dns_ttl_t ttl) {
 	return (ttl);
 }
 
-/*
- * Hashing is most efficient if the number of buckets is prime.
- * The sequence below is the closest previous primes to 2^n and
- * 1.5 * 2^n, for values of n from 10 to 28.  (The tables will
- * no longer grow beyond 2^28 entries.)
+/*%
+ * The number of the highest bit set in 'n', which must not be zero.
  */
-static const unsigned nbuckets[] = { 1021, 1531, 2039, 3067, 4093, 6143,
-				     8191, 12281, 16381, 24571, 32749,
-				     49193, 65521, 98299, 131071, 199603,
-				     262139, 393209, 524287, 768431, 1048573,
-				     1572853, 2097143, 3145721, 4194301,
-				     6291449, 8388593, 12582893, 16777213,
-				     25165813, 33554393, 50331599, 67108859,
-				     100663291, 134217689, 201326557,
-				     268535431, 0 };
+static inline unsigned int
+ilog2(unsigned int n) {
+#ifdef HAVE_BUILTIN_CLZ
+	return (sizeof(n) * 8 - 1 - __builtin_clz(n));
+#else
+	unsigned int bit = 0;
+
+	while ((n >>= 1) != 0)
+		bit++;
+	return (bit);
+#endif
+}
 
-static void
-grow_entries(isc_task_t *task, isc_event_t *ev) {
-	dns_adb_t *adb;
-	dns_adbentry_t *e;
-	dns_adbentrylist_t *newdeadentries = NULL;
-	dns_adbentrylist_t *newentries = NULL;
-	isc_boolean_t *newentry_sd = NULL;
-	isc_mutex_t *newentrylocks = NULL;
-	isc_result_t result;
-	unsigned int *newentry_refcnt = NULL;
-	unsigned int i, n, bucket;
+/*%
+ * The segment holding 'bucket', the first bucket of segment 'seg' and
+ * the number of buckets in it.
+ */
+static inline unsigned int
+bucketseg(unsigned int bucket) {
+	if (bucket < ADB_MINBUCKETS)
+		return (0);
+	return (ilog2(bucket) - ADB_SEGSHIFT + 1);
+}
 
-	adb = ev->ev_arg;
-	INSIST(DNS_ADB_VALID(adb));
+static inline unsigned int
+segstart(unsigned int seg) {
+	return (seg == 0 ? 0 : ADB_MINBUCKETS << (seg - 1));
+}
 
-	isc_event_free(&ev);
+static inline unsigned int
+segsize(unsigned int seg) {
+	return (seg == 0 ? ADB_MINBUCKETS : ADB_MINBUCKETS << (seg - 1));
+}
 
-	result = isc_task_beginexclusive(task);
-	if (result != ISC_R_SUCCESS)
-		goto check_exit;
+static inline adbnamebucket_t *
+namebucket(dns_adb_t *adb, unsigned int bucket) {
+	unsigned int seg = bucketseg(bucket);
 
-	i = 0;
-	while (nbuckets[i] != 0 && adb->nentries >= nbuckets[i])
-		i++;
-	if (nbuckets[i] != 0)
-		n = nbuckets[i];
-	else
-		goto done;
+	return (&adb->namesegs[seg][bucket - segstart(seg)]);
+}
 
-	DP(ISC_LOG_INFO, "adb: grow_entries to %u starting", n);
+static inline adbentrybucket_t *
+entrybucket(dns_adb_t *adb, unsigned int bucket) {
+	unsigned int seg = bucketseg(bucket);
 
-	/*
-	 * Are we shutting down?
-	 */
-	for (i = 0; i < adb->nentries; i++)
-		if (adb->entry_sd[i])
-			goto cleanup;
+	return (&adb->entrysegs[seg][bucket - segstart(seg)]);
+}
 
-	/*
-	 * Grab all the resources we need.
-	 */
-	newentries = isc_mem_get(adb->mctx, sizeof(*newentries) * n);
-	newdeadentries = isc_mem_get(adb->mctx, sizeof(*newdeadentries) * n);
-	newentrylocks = isc_mem_get(adb->mctx, sizeof(*newentrylocks) * n);
-	newentry_sd = isc_mem_get(adb->mctx, sizeof(*newentry_sd) * n);
-	newentry_refcnt = isc_mem_get(adb->mctx, sizeof(*newentry_refcnt) * n);
-	if (newentries == NULL || newdeadentries == NULL ||
-	    newentrylocks == NULL || newentry_sd == NULL ||
-	    newentry_refcnt == NULL)
-		goto cleanup;
+/*%
+ * The bucket that objects with 'hash' are in when a table has 'n'
+ * buckets.
+ */
+static inline unsigned int
+hashbucket(unsigned int hash, unsigned int n) {
+	unsigned int low = 1U << ilog2(n);
+	unsigned int bucket;
 
-	/*
-	 * Initialise the new resources.
-	 */
-	result = isc_mutexblock_init(newentrylocks, n);
-	if (result != ISC_R_SUCCESS)
-		goto cleanup;
+	bucket = hash & (2 * low - 1);
+	if (bucket >= n)
+		bucket = hash & (low - 1);
+	return (bucket);
+}
+
+static inline unsigned int
+namehash(const dns_name_t *name) {
+	return (dns_name_fullhash(name, ISC_FALSE));
+}
+
+static inline unsigned int
+entryhash(const isc_sockaddr_t *addr) {
+	return (isc_sockaddr_hash(addr, ISC_TRUE));
+}
 
+static isc_result_t
+new_namesegment(dns_adb_t *adb, unsigned int seg) {
+	adbnamebucket_t *buckets;
+	isc_result_t result;
+	unsigned int i, n = segsize(seg);
+
+	buckets = isc_mem_get(adb->mctx, sizeof(*buckets) * n);
+	if (buckets == NULL)
+		return (ISC_R_NOMEMORY);
 	for (i = 0; i < n; i++) {
-		ISC_LIST_INIT(newentries[i]);
-		ISC_LIST_INIT(newdeadentries[i]);
-		newentry_sd[i] = ISC_FALSE;
-		newentry_refcnt[i] = 0;
-		adb->irefcnt++;
+		result = isc_mutex_init(&buckets[i].lock);
+		if (result != ISC_R_SUCCESS) {
+			while (i-- > 0)
+				DESTROYLOCK(&buckets[i].lock);
+			isc_mem_put(adb->mctx, buckets, sizeof(*buckets) * n);
+			return (result);
+		}
+		ISC_LIST_INIT(buckets[i].names);
+		ISC_LIST_INIT(buckets[i].deadnames);
+		buckets[i].sd = ISC_FALSE;
+		buckets[i].refcnt = 0;
 	}
+	adb->namesegs[seg] = buckets;
+	return (ISC_R_SUCCESS);
+}
 
-	/*
-	 * Move entries to new arrays.
-	 */
-	for (i = 0; i < adb->nentries; i++) {
-		e = ISC_LIST_HEAD(adb->entries[i]);
-		while (e != NULL) {
-			ISC_LIST_UNLINK(adb->entries[i], e, plink);
-			bucket = isc_sockaddr_hash(&e->sockaddr, ISC_TRUE) % n;
-			e->lock_bucket = bucket;
-			ISC_LIST_APPEND(newentries[bucket], e, plink);
-			INSIST(adb->entry_refcnt[i] > 0);
-			adb->entry_refcnt[i]--;
-			newentry_refcnt[bucket]++;
-			e = ISC_LIST_HEAD(adb->entries[i]);
+static isc_result_t
+new_entrysegment(dns_adb_t *adb, unsigned int seg) {
+	adbentrybucket_t *buckets;
+	isc_result_t result;
+	unsigned int i, n = segsize(seg);
+
+	buckets = isc_mem_get(adb->mctx, sizeof(*buckets) * n);
+	if (buckets == NULL)
+		return (ISC_R_NOMEMORY);
+	for (i = 0; i < n; i++) {
+		result = isc_mutex_init(&buckets[i].lock);
+		if (result != ISC_R_SUCCESS) {
+			while (i-- > 0)
+				DESTROYLOCK(&buckets[i].lock);
+			isc_mem_put(adb->mctx, buckets, sizeof(*buckets) * n);
+			return (result);
+		}
+		ISC_LIST_INIT(buckets[i].entries);
+		ISC_LIST_INIT(buckets[i].deadentries);
+		buckets[i].sd = ISC_FALSE;
+		buckets[i].refcnt = 0;
+	}
+	adb->entrysegs[seg] = buckets;
+	return (ISC_R_SUCCESS);
+}
+
+static void
+free_segments(dns_adb_t *adb) {
+	unsigned int i, seg;
+
+	for (seg = 0; seg < ADB_MAXSEGS; seg++) {
+		if (adb->namesegs[seg] != NULL) {
+			for (i = 0; i < segsize(seg); i++)
+				DESTROYLOCK(&adb->namesegs[seg][i].lock);
+			isc_mem_put(adb->mctx, adb->namesegs[seg],
+				    sizeof(adbnamebucket_t) * segsize(seg));
+			adb->namesegs[seg] = NULL;
 		}
-		e = ISC_LIST_HEAD(adb->deadentries[i]);
-		while (e != NULL) {
-			ISC_LIST_UNLINK(adb->deadentries[i], e, plink);
-			bucket = isc_sockaddr_hash(&e->sockaddr, ISC_TRUE) % n;
-			e->lock_bucket = bucket;
-			ISC_LIST_APPEND(newdeadentries[bucket], e, plink);
-			INSIST(adb->entry_refcnt[i] > 0);
-			adb->entry_refcnt[i]--;
-			newentry_refcnt[bucket]++;
-			e = ISC_LIST_HEAD(adb->deadentries[i]);
+		if (adb->entrysegs[seg] != NULL) {
+			for (i = 0; i < segsize(seg); i++)
+				DESTROYLOCK(&adb->entrysegs[seg][i].lock);
+			isc_mem_put(adb->mctx, adb->entrysegs[seg],
+				    sizeof(adbentrybucket_t) * segsize(seg));
+			adb->entrysegs[seg] = NULL;
 		}
-		INSIST(adb->entry_refcnt[i] == 0);
-		adb->irefcnt--;
 	}
+}
 
-	/*
-	 * Cleanup old resources.
-	 */
-	DESTROYMUTEXBLOCK(adb->entrylocks, adb->nentries);
-	isc_mem_put(adb->mctx, adb->entries,
-		    sizeof(*adb->entries) * adb->nentries);
-	isc_mem_put(adb->mctx, adb->deadentries,
-		    sizeof(*adb->deadentries) * adb->nentries);
-	isc_mem_put(adb->mctx, adb->entrylocks,
-		    sizeof(*adb->entrylocks) * adb->nentries);
-	isc_mem_put(adb->mctx, adb->entry_sd,
-		    sizeof(*adb->entry_sd) * adb->nentries);
-	isc_mem_put(adb->mctx, adb->entry_refcnt,
-		    sizeof(*adb->entry_refcnt) * adb->nentries);
+/*%
+ * Add one bucket to the entry table, moving into it the entries of the
+ * bucket it is split from whose hash has the new bit set.  List order,
+ * and so LRU order, is preserved.
+ *
+ * Requires that adb->lock be held, which keeps other splits, shutdown
+ * and dumps away; lookups only need the two bucket locks.
+ */
+static isc_result_t
+split_entries(dns_adb_t *adb) {
+	adbentrybucket_t *from, *to;
+	dns_adbentry_t *e, *next;
+	isc_result_t result;
+	unsigned int n = adb->nentries, low, seg;
 
-	/*
-	 * Install new resources.
-	 */
-	adb->entries = newentries;
-	adb->deadentries = newdeadentries;
-	adb->entrylocks = newentrylocks;
-	adb->entry_sd = newentry_sd;
-	adb->entry_refcnt = newentry_refcnt;
-	adb->nentries = n;
+	if (n >= ADB_MAXBUCKETS)
+		return (ISC_R_NOSPACE);
+	seg = bucketseg(n);
+	if (adb->entrysegs[seg] == NULL) {
+		result = new_entrysegment(adb, seg);
+		if (result != ISC_R_SUCCESS)
+			return (result);
+	}
 
-	set_adbstat(adb, adb->nentries, dns_adbstats_nentries);
+	low = 1U << ilog2(n);
+	from = entrybucket(adb, n - low);
+	to = entrybucket(adb, n);
 
-	/*
-	 * Only on success do we set adb->growentries_sent to ISC_FALSE.
-	 * This will prevent us being continuously being called on error.
-	 */
-	adb->growentries_sent = ISC_FALSE;
-	goto done;
+	LOCK(&from->lock);
+	if (from->sd) {
+		UNLOCK(&from->lock);
+		return (ISC_R_SHUTTINGDOWN);
+	}
+	LOCK(&to->lock);
+	for (e = ISC_LIST_HEAD(from->entries); e != NULL; e = next) {
+		next = ISC_LIST_NEXT(e, plink);
+		if ((entryhash(&e->sockaddr) & low) == 0)
+			continue;
+		ISC_LIST_UNLINK(from->entries, e, plink);
+		ISC_LIST_APPEND(to->entries, e, plink);
+		e->lock_bucket = n;
+		INSIST(from->refcnt > 0);
+		from->refcnt--;
+		to->refcnt++;
+	}
+	for (e = ISC_LIST_HEAD(from->deadentries); e != NULL; e = next) {
+		next = ISC_LIST_NEXT(e, plink);
+		if ((entryhash(&e->sockaddr) & low) == 0)
+			continue;
+		ISC_LIST_UNLINK(from->deadentries, e, plink);
+		ISC_LIST_APPEND(to->deadentries, e, plink);
+		e->lock_bucket = n;
+		INSIST(from->refcnt > 0);
+		from->refcnt--;
+		to->refcnt++;
+	}
+	inc_adb_irefcnt(adb);
+	adb->nentries = n + 1;
+	UNLOCK(&to->lock);
+	UNLOCK(&from->lock);
 
- cleanup:
-	if (newentries != NULL)
-		isc_mem_put(adb->mctx, newentries,
-			    sizeof(*newentries) * n);
-	if (newdeadentries != NULL)
-		isc_mem_put(adb->mctx, newdeadentries,
-			    sizeof(*newdeadentries) * n);
-	if (newentrylocks != NULL)
-		isc_mem_put(adb->mctx, newentrylocks,
-			    sizeof(*newentrylocks) * n);
-	if (newentry_sd != NULL)
-		isc_mem_put(adb->mctx, newentry_sd,
-			    sizeof(*newentry_sd) * n);
-	if (newentry_refcnt != NULL)
-		isc_mem_put(adb->mctx, newentry_refcnt,
-			     sizeof(*newentry_refcnt) * n);
- done:
-	isc_task_endexclusive(task);
-
- check_exit:
-	LOCK(&adb->lock);
-	if (dec_adb_irefcnt(adb))
-		check_exit(adb);
-	UNLOCK(&adb->lock);
-	DP(ISC_LOG_INFO, "adb: grow_entries finished");
+	return (ISC_R_SUCCESS);
 }
 
+/*%
+ * Record that 'name', and so the finds waiting on it, are now in
+ * 'bucket'.  Requires the old and new buckets be locked.
+ */
 static void
-grow_names(isc_task_t *task, isc_event_t *ev) {
-	dns_adb_t *adb;
-	dns_adbname_t *name;
-	dns_adbnamelist_t *newdeadnames = NULL;
-	dns_adbnamelist_t *newnames = NULL;
-	isc_boolean_t *newname_sd = NULL;
-	isc_mutex_t *newnamelocks = NULL;
-	isc_result_t result;
-	unsigned int *newname_refcnt = NULL;
-	unsigned int i, n, bucket;
-
-	adb = ev->ev_arg;
-	INSIST(DNS_ADB_VALID(adb));
+move_finds(dns_adbname_t *name, int bucket) {
+	dns_adbfind_t *find;
 
-	isc_event_free(&ev);
+	name->lock_bucket = bucket;
+	for (find = ISC_LIST_HEAD(name->finds);
+	     find != NULL;
+	     find = ISC_LIST_NEXT(find, plink))
+	{
+		LOCK(&find->lock);
+		find->name_bucket = bucket;
+		UNLOCK(&find->lock);
+	}
+}
 
-	result = isc_task_beginexclusive(task);
-	if (result != ISC_R_SUCCESS)
-		goto check_exit;
+static isc_result_t
+split_names(dns_adb_t *adb) {
+	adbnamebucket_t *from, *to;
+	dns_adbname_t *name, *next;
+	isc_result_t result;
+	unsigned int n = adb->nnames, low, seg;
 
-	i = 0;
-	while (nbuckets[i] != 0 && adb->nnames >= nbuckets[i])
-		i++;
-	if (nbuckets[i] != 0)
-		n = nbuckets[i];
-	else
-		goto done;
+	if (n >= ADB_MAXBUCKETS)
+		return (ISC_R_NOSPACE);
+	seg = bucketseg(n);
+	if (adb->namesegs[seg] == NULL) {
+		result = new_namesegment(adb, seg);
+		if (result != ISC_R_SUCCESS)
+			return (result);
+	}
 
-	DP(ISC_LOG_INFO, "adb: grow_names to %u starting", n);
+	low = 1U << ilog2(n);
+	from = namebucket(adb, n - low);
+	to = namebucket(adb, n);
 
-	/*
-	 * Are we shutting down?
-	 */
-	for (i = 0; i < adb->nnames; i++)
-		if (adb->name_sd[i])
-			goto cleanup;
+	LOCK(&from->lock);
+	if (from->sd) {
+		UNLOCK(&from->lock);
+		return (ISC_R_SHUTTINGDOWN);
+	}
+	LOCK(&to->lock);
+	for (name = ISC_LIST_HEAD(from->names); name != NULL; name = next) {
+		next = ISC_LIST_NEXT(name, plink);
+		if ((namehash(&name->name) & low) == 0)
+			continue;
+		ISC_LIST_UNLINK(from->names, name, plink);
+		ISC_LIST_APPEND(to->names, name, plink);
+		move_finds(name, n);
+		INSIST(from->refcnt > 0);
+		from->refcnt--;
+		to->refcnt++;
+	}
+	for (name = ISC_LIST_HEAD(from->deadnames);
+	     name != NULL;
+	     name = next)
+	{
+		next = ISC_LIST_NEXT(name, plink);
+		if ((namehash(&name->name) & low) == 0)
+			continue;
+		ISC_LIST_UNLINK(from->deadnames, name, plink);
+		ISC_LIST_APPEND(to->deadnames, name, plink);
+		move_finds(name, n);
+		INSIST(from->refcnt > 0);
+		from->refcnt--;
+		to->refcnt++;
+	}
+	inc_adb_irefcnt(adb);
+	adb->nnames = n + 1;
+	UNLOCK(&to->lock);
+	UNLOCK(&from->lock);
 
-	/*
-	 * Grab all the resources we need.
-	 */
-	newnames = isc_mem_get(adb->mctx, sizeof(*newnames) * n);
-	newdeadnames = isc_mem_get(adb->mctx, sizeof(*newdeadnames) * n);
-	newnamelocks = isc_mem_get(adb->mctx, sizeof(*newnamelocks) * n);
-	newname_sd = isc_mem_get(adb->mctx, sizeof(*newname_sd) * n);
-	newname_refcnt = isc_mem_get(adb->mctx, sizeof(*newname_refcnt) * n);
-	if (newnames == NULL || newdeadnames == NULL ||
-	    newnamelocks == NULL || newname_sd == NULL ||
-	    newname_refcnt == NULL)
-		goto cleanup;
+	return (ISC_R_SUCCESS);
+}
 
-	/*
-	 * Initialise the new resources.
-	 */
-	result = isc_mutexblock_init(newnamelocks, n);
-	if (result != ISC_R_SUCCESS)
-		goto cleanup;
+/*%
+ * Split up to 'count' entry buckets.  Returns ISC_R_SUCCESS once the
+ * table is large enough, DNS_R_CONTINUE if it needs to grow further,
+ * or the reason it cannot grow.
+ *
+ * Requires that adb->lock be held.
+ */
+static isc_result_t
+grow_entries_step(dns_adb_t *adb, unsigned int count) {
+	isc_result_t result = ISC_R_SUCCESS;
+	unsigned int i;
 
-	for (i = 0; i < n; i++) {
-		ISC_LIST_INIT(newnames[i]);
-		ISC_LIST_INIT(newdeadnames[i]);
-		newname_sd[i] = ISC_FALSE;
-		newname_refcnt[i] = 0;
-		adb->irefcnt++;
+	for (i = 0; i < count; i++) {
+		if (adb->shutting_down) {
+			result = ISC_R_SHUTTINGDOWN;
+			break;
+		}
+		if (adb->entriescnt <= adb->nentries * 4) {
+			result = ISC_R_SUCCESS;
+			break;
+		}
+		result = split_entries(adb);
+		if (result != ISC_R_SUCCESS)
+			break;
+		result = DNS_R_CONTINUE;
 	}
+	set_adbstat(adb, adb->nentries, dns_adbstats_nentries);
 
-	/*
-	 * Move names to new arrays.
-	 */
-	for (i = 0; i < adb->nnames; i++) {
-		name = ISC_LIST_HEAD(adb->names[i]);
-		while (name != NULL) {
-			ISC_LIST_UNLINK(adb->names[i], name, plink);
-			bucket = dns_name_fullhash(&name->name, ISC_TRUE) % n;
-			name->lock_bucket = bucket;
-			ISC_LIST_APPEND(newnames[bucket], name, plink);
-			INSIST(adb->name_refcnt[i] > 0);
-			adb->name_refcnt[i]--;
-			newname_refcnt[bucket]++;
-			name = ISC_LIST_HEAD(adb->names[i]);
+	return (result);
+}
+
+static isc_result_t
+grow_names_step(dns_adb_t *adb, unsigned int count) {
+	isc_result_t result = ISC_R_SUCCESS;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (adb->shutting_down) {
+			result = ISC_R_SHUTTINGDOWN;
+			break;
 		}
-		name = ISC_LIST_HEAD(adb->deadnames[i]);
-		while (name != NULL) {
-			ISC_LIST_UNLINK(adb->deadnames[i], name, plink);
-			bucket = dns_name_fullhash(&name->name, ISC_TRUE) % n;
-			name->lock_bucket = bucket;
-			ISC_LIST_APPEND(newdeadnames[bucket], name, plink);
-			INSIST(adb->name_refcnt[i] > 0);
-			adb->name_refcnt[i]--;
-			newname_refcnt[bucket]++;
-			name = ISC_LIST_HEAD(adb->deadnames[i]);
+		if (adb->namescnt <= adb->nnames * 4) {
+			result = ISC_R_SUCCESS;
+			break;
 		}
-		INSIST(adb->name_refcnt[i] == 0);
-		adb->irefcnt--;
+		result = split_names(adb);
+		if (result != ISC_R_SUCCESS)
+			break;
+		result = DNS_R_CONTINUE;
 	}
+	set_adbstat(adb, adb->nnames, dns_adbstats_nnames);
 
-	/*
-	 * Cleanup old resources.
-	 */
-	DESTROYMUTEXBLOCK(adb->namelocks, adb->nnames);
-	isc_mem_put(adb->mctx, adb->names,
-		    sizeof(*adb->names) * adb->nnames);
-	isc_mem_put(adb->mctx, adb->deadnames,
-		    sizeof(*adb->deadnames) * adb->nnames);
-	isc_mem_put(adb->mctx, adb->namelocks,
-		    sizeof(*adb->namelocks) * adb->nnames);
-	isc_mem_put(adb->mctx, adb->name_sd,
-		    sizeof(*adb->name_sd) * adb->nnames);
-	isc_mem_put(adb->mctx, adb->name_refcnt,
-		    sizeof(*adb->name_refcnt) * adb->nnames);
+	return (result);
+}
+
+/*%
+ * Grow the entry table a batch of buckets at a time, re-sending the
+ * event to ourselves so that other events on adb->task, and lookups,
+ * are not held up while a large table grows.
+ */
+static void
+grow_entries(isc_task_t *task, isc_event_t *ev) {
+	dns_adb_t *adb;
+	isc_result_t result;
+
+	adb = ev->ev_arg;
+	INSIST(DNS_ADB_VALID(adb));
+
+	LOCK(&adb->lock);
+	result = grow_entries_step(adb, GROW_BATCH);
+	if (result == DNS_R_CONTINUE) {
+		UNLOCK(&adb->lock);
+		isc_task_send(task, &ev);
+		return;
+	}
 
 	/*
-	 * Install new resources.
+	 * Only on success do we set adb->growentries_sent to ISC_FALSE.
+	 * This will prevent us being continuously being called on error.
 	 */
-	adb->names = newnames;
-	adb->deadnames = newdeadnames;
-	adb->namelocks = newnamelocks;
-	adb->name_sd = newname_sd;
-	adb->name_refcnt = newname_refcnt;
-	adb->nnames = n;
+	if (result == ISC_R_SUCCESS) {
+		LOCK(&adb->entriescntlock);
+		adb->growentries_sent = ISC_FALSE;
+		UNLOCK(&adb->entriescntlock);
+	}
+	if (dec_adb_irefcnt(adb))
+		check_exit(adb);
+	UNLOCK(&adb->lock);
+	DP(ISC_LOG_INFO, "adb: grow_entries finished: %s",
+	   isc_result_totext(result));
+}
 
-	set_adbstat(adb, adb->nnames, dns_adbstats_nnames);
+static void
+grow_names(isc_task_t *task, isc_event_t *ev) {
+	dns_adb_t *adb;
+	isc_result_t result;
+
+	adb = ev->ev_arg;
+	INSIST(DNS_ADB_VALID(adb));
+
+	LOCK(&adb->lock);
+	result = grow_names_step(adb, GROW_BATCH);
+	if (result == DNS_R_CONTINUE) {
+		UNLOCK(&adb->lock);
+		isc_task_send(task, &ev);
+		return;
+	}
 
 	/*
 	 * Only on success do we set adb->grownames_sent to ISC_FALSE.
 	 * This will prevent us being continuously being called on error.
 	 */
-	adb->grownames_sent = ISC_FALSE;
-	goto done;
-
- cleanup:
-	if (newnames != NULL)
-		isc_mem_put(adb->mctx, newnames, sizeof(*newnames) * n);
-	if (newdeadnames != NULL)
-		isc_mem_put(adb->mctx, newdeadnames, sizeof(*newdeadnames) * n);
-	if (newnamelocks != NULL)
-		isc_mem_put(adb->mctx, newnamelocks, sizeof(*newnamelocks) * n);
-	if (newname_sd != NULL)
-		isc_mem_put(adb->mctx, newname_sd, sizeof(*newname_sd) * n);
-	if (newname_refcnt != NULL)
-		isc_mem_put(adb->mctx, newname_refcnt,
-			     sizeof(*newname_refcnt) * n);
- done:
-	isc_task_endexclusive(task);
-
- check_exit:
-	LOCK(&adb->lock);
+	if (result == ISC_R_SUCCESS) {
+		LOCK(&adb->namescntlock);
+		adb->grownames_sent = ISC_FALSE;
+		UNLOCK(&adb->namescntlock);
+	}
 	if (dec_adb_irefcnt(adb))
 		check_exit(adb);
 	UNLOCK(&adb->lock);
-	DP(ISC_LOG_INFO, "adb: grow_names finished");
+	DP(ISC_LOG_INFO, "adb: grow_names finished: %s",
+	   isc_result_totext(result));
+}
+
+/*%
+ * While a table is growing, have lookups split a few buckets too, so
+ * that growth keeps up with a busy server.  This is skipped if someone
+ * else holds adb->lock.
+ */
+static inline void
+grow_help(dns_adb_t *adb) {
+	if (!adb->growentries_sent && !adb->grownames_sent)
+		return;
+	if (isc_mutex_trylock(&adb->lock) != ISC_R_SUCCESS)
+		return;
+	if (adb->growentries_sent)
+		(void)grow_entries_step(adb, GROW_LOOKUP);
+	if (adb->grownames_sent)
+		(void)grow_names_step(adb, GROW_LOOKUP);
+	UNLOCK(&adb->lock);
+}
+
+/*%
+ * Lock the bucket 'name' or 'entry' is in and return its number.  It
+ * cannot change while the bucket is locked.
+ */
+static inline int
+lock_namebucket(dns_adb_t *adb, dns_adbname_t *name) {
+	int bucket;
+
+	for (;;) {
+		bucket = name->lock_bucket;
+		INSIST(bucket != DNS_ADB_INVALIDBUCKET);
+		LOCK(&namebucket(adb, bucket)->lock);
+		if (name->lock_bucket == bucket)
+			return (bucket);
+		UNLOCK(&namebucket(adb, bucket)->lock);
+	}
+}
+
+static inline int
+lock_entrybucket(dns_adb_t *adb, dns_adbentry_t *entry) {
+	int bucket;
+
+	for (;;) {
+		bucket = entry->lock_bucket;
+		INSIST(bucket != DNS_ADB_INVALIDBUCKET);
+		LOCK(&entrybucket(adb, bucket)->lock);
+		if (entry->lock_bucket == bucket)
+			return (bucket);
+		UNLOCK(&entrybucket(adb, bucket)->lock);
+	}
 }
 
 /*
@@ -969,7 +1134,7 @@ import_rdataset(dns_adbname_t *adbname, dns_rdataset_t *rdataset,
 		free_adbnamehook(adb, &nh);
 
 	if (addr_bucket != DNS_ADB_INVALIDBUCKET)
-		UNLOCK(&adb->entrylocks[addr_bucket]);
+		UNLOCK(&entrybucket(adb, addr_bucket)->lock);
 
 	if (rdataset->trust == dns_trust_glue ||
 	    rdataset->trust == dns_trust_additional)
@@ -1012,7 +1177,7 @@ kill_name(dns_adbname_t **n, isc_eventtype_t ev) {
 	dns_adbname_t *name;
 	isc_boolean_t result = ISC_FALSE;
 	isc_boolean_t result4, result6;
-	int bucket;
+	adbnamebucket_t *nb;
 	dns_adb_t *adb;
 
 	INSIST(n != NULL);
@@ -1059,9 +1224,9 @@ kill_name(dns_adbname_t **n, isc_eventtype_t ev) {
 	} else {
 		cancel_fetches_at_name(name);
 		if (!NAME_DEAD(name)) {
-			bucket = name->lock_bucket;
-			ISC_LIST_UNLINK(adb->names[bucket], name, plink);
-			ISC_LIST_APPEND(adb->deadnames[bucket], name, plink);
+			nb = namebucket(adb, name->lock_bucket);
+			ISC_LIST_UNLINK(nb->names, name, plink);
+			ISC_LIST_APPEND(nb->deadnames, name, plink);
 			name->flags |= NAME_IS_DEAD;
 		}
 	}
@@ -1124,9 +1289,9 @@ static inline void
 link_name(dns_adb_t *adb, int bucket, dns_adbname_t *name) {
 	INSIST(name->lock_bucket == DNS_ADB_INVALIDBUCKET);
 
-	ISC_LIST_PREPEND(adb->names[bucket], name, plink);
+	ISC_LIST_PREPEND(namebucket(adb, bucket)->names, name, plink);
 	name->lock_bucket = bucket;
-	adb->name_refcnt[bucket]++;
+	namebucket(adb, bucket)->refcnt++;
 }
 
 /*
@@ -1134,20 +1299,20 @@ link_name(dns_adb_t *adb, int bucket, dns_adbname_t *name) {
  */
 static inline isc_boolean_t
 unlink_name(dns_adb_t *adb, dns_adbname_t *name) {
-	int bucket;
+	adbnamebucket_t *nb;
 	isc_boolean_t result = ISC_FALSE;
 
-	bucket = name->lock_bucket;
-	INSIST(bucket != DNS_ADB_INVALIDBUCKET);
+	INSIST(name->lock_bucket != DNS_ADB_INVALIDBUCKET);
+	nb = namebucket(adb, name->lock_bucket);
 
 	if (NAME_DEAD(name))
-		ISC_LIST_UNLINK(adb->deadnames[bucket], name, plink);
+		ISC_LIST_UNLINK(nb->deadnames, name, plink);
 	else
-		ISC_LIST_UNLINK(adb->names[bucket], name, plink);
+		ISC_LIST_UNLINK(nb->names, name, plink);
 	name->lock_bucket = DNS_ADB_INVALIDBUCKET;
-	INSIST(adb->name_refcnt[bucket] > 0);
-	adb->name_refcnt[bucket]--;
-	if (adb->name_sd[bucket] && adb->name_refcnt[bucket] == 0)
+	INSIST(nb->refcnt > 0);
+	nb->refcnt--;
+	if (nb->sd && nb->refcnt == 0)
 		result = ISC_TRUE;
 	return (result);
 }
@@ -1157,12 +1322,13 @@ unlink_name(dns_adb_t *adb, dns_adbname_t *name) {
  */
 static inline void
 link_entry(dns_adb_t *adb, int bucket, dns_adbentry_t *entry) {
+	adbentrybucket_t *eb = entrybucket(adb, bucket);
 	int i;
 	dns_adbentry_t *e;
 
 	if (isc_mem_isovermem(adb->mctx)) {
 		for (i = 0; i < 2; i++) {
-			e = ISC_LIST_TAIL(adb->entries[bucket]);
+			e = ISC_LIST_TAIL(eb->entries);
 			if (e == NULL)
 				break;
 			if (e->refcnt == 0) {
@@ -1172,14 +1338,14 @@ link_entry(dns_adb_t *adb, int bucket, dns_adbentry_t *entry) {
 			}
 			INSIST((e->flags & ENTRY_IS_DEAD) == 0);
 			e->flags |= ENTRY_IS_DEAD;
-			ISC_LIST_UNLINK(adb->entries[bucket], e, plink);
-			ISC_LIST_PREPEND(adb->deadentries[bucket], e, plink);
+			ISC_LIST_UNLINK(eb->entries, e, plink);
+			ISC_LIST_PREPEND(eb->deadentries, e, plink);
 		}
 	}
 
-	ISC_LIST_PREPEND(adb->entries[bucket], entry, plink);
+	ISC_LIST_PREPEND(eb->entries, entry, plink);
 	entry->lock_bucket = bucket;
-	adb->entry_refcnt[bucket]++;
+	eb->refcnt++;
 }
 
 /*
@@ -1187,20 +1353,20 @@ link_entry(dns_adb_t *adb, int bucket, dns_adbentry_t *entry) {
  */
 static inline isc_boolean_t
 unlink_entry(dns_adb_t *adb, dns_adbentry_t *entry) {
-	int bucket;
+	adbentrybucket_t *eb;
 	isc_boolean_t result = ISC_FALSE;
 
-	bucket = entry->lock_bucket;
-	INSIST(bucket != DNS_ADB_INVALIDBUCKET);
+	INSIST(entry->lock_bucket != DNS_ADB_INVALIDBUCKET);
+	eb = entrybucket(adb, entry->lock_bucket);
 
 	if ((entry->flags & ENTRY_IS_DEAD) != 0)
-		ISC_LIST_UNLINK(adb->deadentries[bucket], entry, plink);
+		ISC_LIST_UNLINK(eb->deadentries, entry, plink);
 	else
-		ISC_LIST_UNLINK(adb->entries[bucket], entry, plink);
+		ISC_LIST_UNLINK(eb->entries, entry, plink);
 	entry->lock_bucket = DNS_ADB_INVALIDBUCKET;
-	INSIST(adb->entry_refcnt[bucket] > 0);
-	adb->entry_refcnt[bucket]--;
-	if (adb->entry_sd[bucket] && adb->entry_refcnt[bucket] == 0)
+	INSIST(eb->refcnt > 0);
+	eb->refcnt--;
+	if (eb->sd && eb->refcnt == 0)
 		result = ISC_TRUE;
 	return (result);
 }
@@ -1226,10 +1392,10 @@ shutdown_names(dns_adb_t *adb) {
 	dns_adbname_t *next_name;
 
 	for (bucket = 0; bucket < adb->nnames; bucket++) {
-		LOCK(&adb->namelocks[bucket]);
-		adb->name_sd[bucket] = ISC_TRUE;
+		LOCK(&namebucket(adb, bucket)->lock);
+		namebucket(adb, bucket)->sd = ISC_TRUE;
 
-		name = ISC_LIST_HEAD(adb->names[bucket]);
+		name = ISC_LIST_HEAD(namebucket(adb, bucket)->names);
 		if (name == NULL) {
 			/*
 			 * This bucket has no names.  We must decrement the
@@ -1254,7 +1420,7 @@ shutdown_names(dns_adb_t *adb) {
 			}
 		}
 
-		UNLOCK(&adb->namelocks[bucket]);
+		UNLOCK(&namebucket(adb, bucket)->lock);
 	}
 	return (result);
 }
@@ -1271,11 +1437,11 @@ shutdown_entries(dns_adb_t *adb) {
 	dns_adbentry_t *next_entry;
 
 	for (bucket = 0; bucket < adb->nentries; bucket++) {
-		LOCK(&adb->entrylocks[bucket]);
-		adb->entry_sd[bucket] = ISC_TRUE;
+		LOCK(&entrybucket(adb, bucket)->lock);
+		entrybucket(adb, bucket)->sd = ISC_TRUE;
 
-		entry = ISC_LIST_HEAD(adb->entries[bucket]);
-		if (adb->entry_refcnt[bucket] == 0) {
+		entry = ISC_LIST_HEAD(entrybucket(adb, bucket)->entries);
+		if (entrybucket(adb, bucket)->refcnt == 0) {
 			/*
 			 * This bucket has no entries.  We must decrement the
 			 * irefcnt ourselves, since it will not be
@@ -1300,7 +1466,7 @@ shutdown_entries(dns_adb_t *adb) {
 			}
 		}
 
-		UNLOCK(&adb->entrylocks[bucket]);
+		UNLOCK(&entrybucket(adb, bucket)->lock);
 	}
 	return (result);
 }
@@ -1340,13 +1506,13 @@ clean_namehooks(dns_adb_t *adb, dns_adbnamehooklist_t *namehooks) {
 		if (entry != NULL) {
 			INSIST(DNS_ADBENTRY_VALID(entry));
 
-			if (addr_bucket != entry->lock_bucket) {
-				if (addr_bucket != DNS_ADB_INVALIDBUCKET)
-					UNLOCK(&adb->entrylocks[addr_bucket]);
-				addr_bucket = entry->lock_bucket;
-				INSIST(addr_bucket != DNS_ADB_INVALIDBUCKET);
-				LOCK(&adb->entrylocks[addr_bucket]);
+			if (addr_bucket != DNS_ADB_INVALIDBUCKET &&
+			    addr_bucket != entry->lock_bucket) {
+				UNLOCK(&entrybucket(adb, addr_bucket)->lock);
+				addr_bucket = DNS_ADB_INVALIDBUCKET;
 			}
+			if (addr_bucket == DNS_ADB_INVALIDBUCKET)
+				addr_bucket = lock_entrybucket(adb, entry);
 
 			entry->nh--;
 			result = dec_entry_refcnt(adb, overmem, entry,
@@ -1364,7 +1530,7 @@ clean_namehooks(dns_adb_t *adb, dns_adbnamehooklist_t *namehooks) {
 	}
 
 	if (addr_bucket != DNS_ADB_INVALIDBUCKET)
-		UNLOCK(&adb->entrylocks[addr_bucket]);
+		UNLOCK(&entrybucket(adb, addr_bucket)->lock);
 	return (result);
 }
 
@@ -1614,15 +1780,15 @@ static inline void
 inc_entry_refcnt(dns_adb_t *adb, dns_adbentry_t *entry, isc_boolean_t lock) {
 	int bucket;
 
-	bucket = entry->lock_bucket;
-
 	if (lock)
-		LOCK(&adb->entrylocks[bucket]);
+		bucket = lock_entrybucket(adb, entry);
+	else
+		bucket = entry->lock_bucket;
 
 	entry->refcnt++;
 
 	if (lock)
-		UNLOCK(&adb->entrylocks[bucket]);
+		UNLOCK(&entrybucket(adb, bucket)->lock);
 }
 
 static inline isc_boolean_t
@@ -1633,24 +1799,24 @@ dec_entry_refcnt(dns_adb_t *adb, isc_boolean_t overmem, dns_adbentry_t *entry,
 	isc_boolean_t destroy_entry;
 	isc_boolean_t result = ISC_FALSE;
 
-	bucket = entry->lock_bucket;
-
 	if (lock)
-		LOCK(&adb->entrylocks[bucket]);
+		bucket = lock_entrybucket(adb, entry);
+	else
+		bucket = entry->lock_bucket;
 
 	INSIST(entry->refcnt > 0);
 	entry->refcnt--;
 
 	destroy_entry = ISC_FALSE;
 	if (entry->refcnt == 0 &&
-	    (adb->entry_sd[bucket] || entry->expires == 0 || overmem ||
+	    (entrybucket(adb, bucket)->sd || entry->expires == 0 || overmem ||
 	     (entry->flags & ENTRY_IS_DEAD) != 0)) {
 		destroy_entry = ISC_TRUE;
 		result = unlink_entry(adb, entry);
 	}
 
 	if (lock)
-		UNLOCK(&adb->entrylocks[bucket]);
+		UNLOCK(&entrybucket(adb, bucket)->lock);
 
 	if (!destroy_entry)
 		return (result);
@@ -1699,12 +1865,12 @@ new_adbname(dns_adb_t *adb, const dns_name_t *dnsname) {
 	LOCK(&adb->namescntlock);
 	adb->namescnt++;
 	inc_adbstats(adb, dns_adbstats_namescnt);
-	if (!adb->grownames_sent && adb->excl != NULL &&
-	    adb->namescnt > (adb->nnames * 8))
-	{
+	if (!adb->grownames_sent && adb->namescnt > (adb->nnames * 8)) {
 		isc_event_t *event = &adb->grownames;
+		DP(ISC_LOG_INFO, "adb: grow_names from %u starting",
+		   adb->nnames);
 		inc_adb_irefcnt(adb);
-		isc_task_send(adb->excl, &event);
+		isc_task_send(adb->task, &event);
 		adb->grownames_sent = ISC_TRUE;
 	}
 	UNLOCK(&adb->namescntlock);
@@ -1847,12 +2013,12 @@ new_adbentry(dns_adb_t *adb) {
 	LOCK(&adb->entriescntlock);
 	adb->entriescnt++;
 	inc_adbstats(adb, dns_adbstats_entriescnt);
-	if (!adb->growentries_sent && adb->excl != NULL &&
-	    adb->entriescnt > (adb->nentries * 8))
-	{
+	if (!adb->growentries_sent && adb->entriescnt > (adb->nentries * 8)) {
 		isc_event_t *event = &adb->growentries;
+		DP(ISC_LOG_INFO, "adb: grow_entries from %u starting",
+		   adb->nentries);
 		inc_adb_irefcnt(adb);
-		isc_task_send(adb->excl, &event);
+		isc_task_send(adb->task, &event);
 		adb->growentries_sent = ISC_TRUE;
 	}
 	UNLOCK(&adb->entriescntlock);
@@ -2042,20 +2208,25 @@ find_name_and_lock(dns_adb_t *adb, const dns_name_t *name,
 		   unsigned int options, int *bucketp)
 {
 	dns_adbname_t *adbname;
+	unsigned int hash;
 	int bucket;
 
-	bucket = dns_name_fullhash(name, ISC_FALSE) % adb->nnames;
-
-	if (*bucketp == DNS_ADB_INVALIDBUCKET) {
-		LOCK(&adb->namelocks[bucket]);
-		*bucketp = bucket;
-	} else if (*bucketp != bucket) {
-		UNLOCK(&adb->namelocks[*bucketp]);
-		LOCK(&adb->namelocks[bucket]);
+	/*
+	 * The table may grow until the bucket is locked, moving the name
+	 * out of the bucket we first pick.
+	 */
+	hash = namehash(name);
+	for (;;) {
+		bucket = hashbucket(hash, adb->nnames);
+		if (*bucketp == bucket)
+			break;
+		if (*bucketp != DNS_ADB_INVALIDBUCKET)
+			UNLOCK(&namebucket(adb, *bucketp)->lock);
+		LOCK(&namebucket(adb, bucket)->lock);
 		*bucketp = bucket;
 	}
 
-	adbname = ISC_LIST_HEAD(adb->names[bucket]);
+	adbname = ISC_LIST_HEAD(namebucket(adb, bucket)->names);
 	while (adbname != NULL) {
 		if (!NAME_DEAD(adbname)) {
 			if (dns_name_equal(name, &adbname->name)
@@ -2084,21 +2255,27 @@ find_entry_and_lock(dns_adb_t *adb, const isc_sockaddr_t *addr, int *bucketp,
 	isc_stdtime_t now)
 {
 	dns_adbentry_t *entry, *entry_next;
+	adbentrybucket_t *eb;
+	unsigned int hash;
 	int bucket;
 
-	bucket = isc_sockaddr_hash(addr, ISC_TRUE) % adb->nentries;
-
-	if (*bucketp == DNS_ADB_INVALIDBUCKET) {
-		LOCK(&adb->entrylocks[bucket]);
-		*bucketp = bucket;
-	} else if (*bucketp != bucket) {
-		UNLOCK(&adb->entrylocks[*bucketp]);
-		LOCK(&adb->entrylocks[bucket]);
+	/*
+	 * As in find_name_and_lock(), check that the bucket is still
+	 * the right one once it is locked.
+	 */
+	hash = entryhash(addr);
+	for (;;) {
+		bucket = hashbucket(hash, adb->nentries);
+		if (*bucketp == bucket)
+			break;
+		if (*bucketp != DNS_ADB_INVALIDBUCKET)
+			UNLOCK(&entrybucket(adb, *bucketp)->lock);
+		LOCK(&entrybucket(adb, bucket)->lock);
 		*bucketp = bucket;
 	}
 
 	/* Search the list, while cleaning up expired entries. */
-	for (entry = ISC_LIST_HEAD(adb->entries[bucket]);
+	for (entry = ISC_LIST_HEAD(entrybucket(adb, bucket)->entries);
 	     entry != NULL;
 	     entry = entry_next) {
 		entry_next = ISC_LIST_NEXT(entry, plink);
@@ -2106,8 +2283,9 @@ find_entry_and_lock(dns_adb_t *adb, const isc_sockaddr_t *addr, int *bucketp,
 		if (entry != NULL &&
 		    (entry->expires == 0 || entry->expires > now) &&
 		    isc_sockaddr_equal(addr, &entry->sockaddr)) {
-			ISC_LIST_UNLINK(adb->entries[bucket], entry, plink);
-			ISC_LIST_PREPEND(adb->entries[bucket], entry, plink);
+			eb = entrybucket(adb, bucket);
+			ISC_LIST_UNLINK(eb->entries, entry, plink);
+			ISC_LIST_PREPEND(eb->entries, entry, plink);
 			return (entry);
 		}
 	}
@@ -2192,9 +2370,7 @@ copy_namehook_lists(dns_adb_t *adb, dns_adbfind_t *find,
 		namehook = ISC_LIST_HEAD(name->v4);
 		while (namehook != NULL) {
 			entry = namehook->entry;
-			bucket = entry->lock_bucket;
-			INSIST(bucket != DNS_ADB_INVALIDBUCKET);
-			LOCK(&adb->entrylocks[bucket]);
+			bucket = lock_entrybucket(adb, entry);
 
 			if (entry->quota != 0 &&
 			    entry->active >= entry->quota)
@@ -2222,7 +2398,7 @@ copy_namehook_lists(dns_adb_t *adb, dns_adbfind_t *find,
 			ISC_LIST_APPEND(find->list, addrinfo, publink);
 			addrinfo = NULL;
 		nextv4:
-			UNLOCK(&adb->entrylocks[bucket]);
+			UNLOCK(&entrybucket(adb, bucket)->lock);
 			bucket = DNS_ADB_INVALIDBUCKET;
 			namehook = ISC_LIST_NEXT(namehook, plink);
 		}
@@ -2232,9 +2408,7 @@ copy_namehook_lists(dns_adb_t *adb, dns_adbfind_t *find,
 		namehook = ISC_LIST_HEAD(name->v6);
 		while (namehook != NULL) {
 			entry = namehook->entry;
-			bucket = entry->lock_bucket;
-			INSIST(bucket != DNS_ADB_INVALIDBUCKET);
-			LOCK(&adb->entrylocks[bucket]);
+			bucket = lock_entrybucket(adb, entry);
 
 			if (entry->quota != 0 &&
 			    entry->active >= entry->quota)
@@ -2262,7 +2436,7 @@ copy_namehook_lists(dns_adb_t *adb, dns_adbfind_t *find,
 			ISC_LIST_APPEND(find->list, addrinfo, publink);
 			addrinfo = NULL;
 		nextv6:
-			UNLOCK(&adb->entrylocks[bucket]);
+			UNLOCK(&entrybucket(adb, bucket)->lock);
 			bucket = DNS_ADB_INVALIDBUCKET;
 			namehook = ISC_LIST_NEXT(namehook, plink);
 		}
@@ -2270,7 +2444,7 @@ copy_namehook_lists(dns_adb_t *adb, dns_adbfind_t *find,
 
  out:
 	if (bucket != DNS_ADB_INVALIDBUCKET)
-		UNLOCK(&adb->entrylocks[bucket]);
+		UNLOCK(&entrybucket(adb, bucket)->lock);
 }
 
 static void
@@ -2354,7 +2528,7 @@ check_stale_name(dns_adb_t *adb, int bucket, isc_stdtime_t now) {
 	 * tail entries that have fetches (this should be rare, but could
 	 * happen).
 	 */
-	victim = ISC_LIST_TAIL(adb->names[bucket]);
+	victim = ISC_LIST_TAIL(namebucket(adb, bucket)->names);
 	for (victims = 0;
 	     victim != NULL && victims < max_victims && scans < 10;
 	     victim = next_victim) {
@@ -2423,13 +2597,13 @@ cleanup_names(dns_adb_t *adb, int bucket, isc_stdtime_t now) {
 
 	DP(CLEAN_LEVEL, "cleaning name bucket %d", bucket);
 
-	LOCK(&adb->namelocks[bucket]);
-	if (adb->name_sd[bucket]) {
-		UNLOCK(&adb->namelocks[bucket]);
+	LOCK(&namebucket(adb, bucket)->lock);
+	if (namebucket(adb, bucket)->sd) {
+		UNLOCK(&namebucket(adb, bucket)->lock);
 		return (result);
 	}
 
-	name = ISC_LIST_HEAD(adb->names[bucket]);
+	name = ISC_LIST_HEAD(namebucket(adb, bucket)->names);
 	while (name != NULL) {
 		next_name = ISC_LIST_NEXT(name, plink);
 		INSIST(result == ISC_FALSE);
@@ -2438,7 +2612,7 @@ cleanup_names(dns_adb_t *adb, int bucket, isc_stdtime_t now) {
 			result = check_expire_name(&name, now);
 		name = next_name;
 	}
-	UNLOCK(&adb->namelocks[bucket]);
+	UNLOCK(&namebucket(adb, bucket)->lock);
 	return (result);
 }
 
@@ -2452,15 +2626,15 @@ cleanup_entries(dns_adb_t *adb, int bucket, isc_stdtime_t now) {
 
 	DP(CLEAN_LEVEL, "cleaning entry bucket %d", bucket);
 
-	LOCK(&adb->entrylocks[bucket]);
-	entry = ISC_LIST_HEAD(adb->entries[bucket]);
+	LOCK(&entrybucket(adb, bucket)->lock);
+	entry = ISC_LIST_HEAD(entrybucket(adb, bucket)->entries);
 	while (entry != NULL) {
 		next_entry = ISC_LIST_NEXT(entry, plink);
 		INSIST(result == ISC_FALSE);
 		result = check_expire_entry(adb, &entry, now);
 		entry = next_entry;
 	}
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 	return (result);
 }
 
@@ -2469,8 +2643,6 @@ destroy(dns_adb_t *adb) {
 	adb->magic = 0;
 
 	isc_task_detach(&adb->task);
-	if (adb->excl != NULL)
-		isc_task_detach(&adb->excl);
 
 	isc_mempool_destroy(&adb->nmp);
 	isc_mempool_destroy(&adb->nhmp);
@@ -2480,29 +2652,7 @@ destroy(dns_adb_t *adb) {
 	isc_mempool_destroy(&adb->aimp);
 	isc_mempool_destroy(&adb->afmp);
 
-	DESTROYMUTEXBLOCK(adb->entrylocks, adb->nentries);
-	isc_mem_put(adb->mctx, adb->entries,
-		    sizeof(*adb->entries) * adb->nentries);
-	isc_mem_put(adb->mctx, adb->deadentries,
-		    sizeof(*adb->deadentries) * adb->nentries);
-	isc_mem_put(adb->mctx, adb->entrylocks,
-		    sizeof(*adb->entrylocks) * adb->nentries);
-	isc_mem_put(adb->mctx, adb->entry_sd,
-		    sizeof(*adb->entry_sd) * adb->nentries);
-	isc_mem_put(adb->mctx, adb->entry_refcnt,
-		    sizeof(*adb->entry_refcnt) * adb->nentries);
-
-	DESTROYMUTEXBLOCK(adb->namelocks, adb->nnames);
-	isc_mem_put(adb->mctx, adb->names,
-		    sizeof(*adb->names) * adb->nnames);
-	isc_mem_put(adb->mctx, adb->deadnames,
-		    sizeof(*adb->deadnames) * adb->nnames);
-	isc_mem_put(adb->mctx, adb->namelocks,
-		    sizeof(*adb->namelocks) * adb->nnames);
-	isc_mem_put(adb->mctx, adb->name_sd,
-		    sizeof(*adb->name_sd) * adb->nnames);
-	isc_mem_put(adb->mctx, adb->name_refcnt,
-		    sizeof(*adb->name_refcnt) * adb->nnames);
+	free_segments(adb);
 
 	DESTROYLOCK(&adb->reflock);
 	DESTROYLOCK(&adb->lock);
@@ -2525,7 +2675,6 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 {
 	dns_adb_t *adb;
 	isc_result_t result;
-	unsigned int i;
 
 	REQUIRE(mem != NULL);
 	REQUIRE(view != NULL);
@@ -2554,7 +2703,6 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	adb->aimp = NULL;
 	adb->afmp = NULL;
 	adb->task = NULL;
-	adb->excl = NULL;
 	adb->mctx = NULL;
 	adb->view = view;
 	adb->taskmgr = taskmgr;
@@ -2565,13 +2713,9 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	adb->shutting_down = ISC_FALSE;
 	ISC_LIST_INIT(adb->whenshutdown);
 
-	adb->nentries = nbuckets[0];
+	adb->nentries = ADB_MINBUCKETS;
 	adb->entriescnt = 0;
-	adb->entries = NULL;
-	adb->deadentries = NULL;
-	adb->entry_sd = NULL;
-	adb->entry_refcnt = NULL;
-	adb->entrylocks = NULL;
+	memset(adb->entrysegs, 0, sizeof(adb->entrysegs));
 	ISC_EVENT_INIT(&adb->growentries, sizeof(adb->growentries), 0, NULL,
 		       DNS_EVENT_ADBGROWENTRIES, grow_entries, adb,
 		       adb, NULL, NULL);
@@ -2583,27 +2727,14 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	adb->atr_high = 0.0;
 	adb->atr_discount = 0.0;
 
-	adb->nnames = nbuckets[0];
+	adb->nnames = ADB_MINBUCKETS;
 	adb->namescnt = 0;
-	adb->names = NULL;
-	adb->deadnames = NULL;
-	adb->name_sd = NULL;
-	adb->name_refcnt = NULL;
-	adb->namelocks = NULL;
+	memset(adb->namesegs, 0, sizeof(adb->namesegs));
 	ISC_EVENT_INIT(&adb->grownames, sizeof(adb->grownames), 0, NULL,
 		       DNS_EVENT_ADBGROWNAMES, grow_names, adb,
 		       adb, NULL, NULL);
 	adb->grownames_sent = ISC_FALSE;
 
-	result = isc_taskmgr_excltask(adb->taskmgr, &adb->excl);
-	if (result != ISC_R_SUCCESS) {
-		DP(DEF_LEVEL, "adb: task-exclusive mode unavailable, "
-			      "intializing table sizes to %u\n",
-			      nbuckets[11]);
-		adb->nentries = nbuckets[11];
-		adb->nnames = nbuckets[11];
-	}
-
 	isc_mem_attach(mem, &adb->mctx);
 
 	result = isc_mutex_init(&adb->lock);
@@ -2630,62 +2761,17 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	if (result != ISC_R_SUCCESS)
 		goto fail0g;
 
-#define ALLOCENTRY(adb, el) \
-	do { \
-		(adb)->el = isc_mem_get((adb)->mctx, \
-				     sizeof(*(adb)->el) * (adb)->nentries); \
-		if ((adb)->el == NULL) { \
-			result = ISC_R_NOMEMORY; \
-			goto fail1; \
-		}\
-	} while (0)
-	ALLOCENTRY(adb, entries);
-	ALLOCENTRY(adb, deadentries);
-	ALLOCENTRY(adb, entrylocks);
-	ALLOCENTRY(adb, entry_sd);
-	ALLOCENTRY(adb, entry_refcnt);
-#undef ALLOCENTRY
-
-#define ALLOCNAME(adb, el) \
-	do { \
-		(adb)->el = isc_mem_get((adb)->mctx, \
-				     sizeof(*(adb)->el) * (adb)->nnames); \
-		if ((adb)->el == NULL) { \
-			result = ISC_R_NOMEMORY; \
-			goto fail1; \
-		}\
-	} while (0)
-	ALLOCNAME(adb, names);
-	ALLOCNAME(adb, deadnames);
-	ALLOCNAME(adb, namelocks);
-	ALLOCNAME(adb, name_sd);
-	ALLOCNAME(adb, name_refcnt);
-#undef ALLOCNAME
-
 	/*
-	 * Initialize the bucket locks for names and elements.
-	 * May as well initialize the list heads, too.
+	 * Allocate the first segment of buckets for names and entries;
+	 * the tables grow from there.
 	 */
-	result = isc_mutexblock_init(adb->namelocks, adb->nnames);
+	result = new_namesegment(adb, 0);
 	if (result != ISC_R_SUCCESS)
 		goto fail1;
-	for (i = 0; i < adb->nnames; i++) {
-		ISC_LIST_INIT(adb->names[i]);
-		ISC_LIST_INIT(adb->deadnames[i]);
-		adb->name_sd[i] = ISC_FALSE;
-		adb->name_refcnt[i] = 0;
-		adb->irefcnt++;
-	}
-	for (i = 0; i < adb->nentries; i++) {
-		ISC_LIST_INIT(adb->entries[i]);
-		ISC_LIST_INIT(adb->deadentries[i]);
-		adb->entry_sd[i] = ISC_FALSE;
-		adb->entry_refcnt[i] = 0;
-		adb->irefcnt++;
-	}
-	result = isc_mutexblock_init(adb->entrylocks, adb->nentries);
+	result = new_entrysegment(adb, 0);
 	if (result != ISC_R_SUCCESS)
-		goto fail2;
+		goto fail1;
+	adb->irefcnt += adb->nnames + adb->nentries;
 
 	/*
 	 * Memory pools
@@ -2737,43 +2823,8 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
 	if (adb->task != NULL)
 		isc_task_detach(&adb->task);
 
-	/* clean up entrylocks */
-	DESTROYMUTEXBLOCK(adb->entrylocks, adb->nentries);
-
- fail2: /* clean up namelocks */
-	DESTROYMUTEXBLOCK(adb->namelocks, adb->nnames);
-
  fail1: /* clean up only allocated memory */
-	if (adb->entries != NULL)
-		isc_mem_put(adb->mctx, adb->entries,
-			    sizeof(*adb->entries) * adb->nentries);
-	if (adb->deadentries != NULL)
-		isc_mem_put(adb->mctx, adb->deadentries,
-			    sizeof(*adb->deadentries) * adb->nentries);
-	if (adb->entrylocks != NULL)
-		isc_mem_put(adb->mctx, adb->entrylocks,
-			    sizeof(*adb->entrylocks) * adb->nentries);
-	if (adb->entry_sd != NULL)
-		isc_mem_put(adb->mctx, adb->entry_sd,
-			    sizeof(*adb->entry_sd) * adb->nentries);
-	if (adb->entry_refcnt != NULL)
-		isc_mem_put(adb->mctx, adb->entry_refcnt,
-			    sizeof(*adb->entry_refcnt) * adb->nentries);
-	if (adb->names != NULL)
-		isc_mem_put(adb->mctx, adb->names,
-			    sizeof(*adb->names) * adb->nnames);
-	if (adb->deadnames != NULL)
-		isc_mem_put(adb->mctx, adb->deadnames,
-			    sizeof(*adb->deadnames) * adb->nnames);
-	if (adb->namelocks != NULL)
-		isc_mem_put(adb->mctx, adb->namelocks,
-			    sizeof(*adb->namelocks) * adb->nnames);
-	if (adb->name_sd != NULL)
-		isc_mem_put(adb->mctx, adb->name_sd,
-			    sizeof(*adb->name_sd) * adb->nnames);
-	if (adb->name_refcnt != NULL)
-		isc_mem_put(adb->mctx, adb->name_refcnt,
-			    sizeof(*adb->name_refcnt) * adb->nnames);
+	free_segments(adb);
 	if (adb->nmp != NULL)
 		isc_mempool_destroy(&adb->nmp);
 	if (adb->nhmp != NULL)
@@ -2801,8 +2852,6 @@ dns_adb_create(isc_mem_t *mem, dns_view_t *view, isc_timermgr_t *timermgr,
  fail0c:
 	DESTROYLOCK(&adb->lock);
  fail0b:
-	if (adb->excl != NULL)
-		isc_task_detach(&adb->excl);
 	isc_mem_putanddetach(&adb->mctx, adb, sizeof(dns_adb_t));
 
 	return (result);
@@ -2982,6 +3031,8 @@ dns_adb_createfind2(dns_adb_t *adb, isc_task_t *task, isc_taskaction_t action,
 	if (now == 0)
 		isc_stdtime_get(&now);
 
+	grow_help(adb);
+
 	/*
 	 * XXXMLG  Move this comment somewhere else!
 	 *
@@ -3029,7 +3080,7 @@ dns_adb_createfind2(dns_adb_t *adb, isc_task_t *task, isc_taskaction_t action,
 	bucket = DNS_ADB_INVALIDBUCKET;
 	adbname = find_name_and_lock(adb, name, find->options, &bucket);
 	INSIST(bucket != DNS_ADB_INVALIDBUCKET);
-	if (adb->name_sd[bucket]) {
+	if (namebucket(adb, bucket)->sd) {
 		DP(DEF_LEVEL,
 		   "dns_adb_createfind: returning ISC_R_SHUTTINGDOWN");
 		RUNTIME_CHECK(free_adbfind(adb, &find) == ISC_FALSE);
@@ -3062,8 +3113,10 @@ dns_adb_createfind2(dns_adb_t *adb, isc_task_t *task, isc_taskaction_t action,
 			adbname->flags |= NAME_STARTATZONE;
 	} else {
 		/* Move this name forward in the LRU list */
-		ISC_LIST_UNLINK(adb->names[bucket], adbname, plink);
-		ISC_LIST_PREPEND(adb->names[bucket], adbname, plink);
+		ISC_LIST_UNLINK(namebucket(adb, bucket)->names, adbname,
+				plink);
+		ISC_LIST_PREPEND(namebucket(adb, bucket)->names, adbname,
+				 plink);
 	}
 	adbname->last_used = now;
 
@@ -3284,7 +3337,7 @@ dns_adb_createfind2(dns_adb_t *adb, isc_task_t *task, isc_taskaction_t action,
 		}
 	}
 
-	UNLOCK(&adb->namelocks[bucket]);
+	UNLOCK(&namebucket(adb, bucket)->lock);
 
 	return (result);
 }
@@ -3370,17 +3423,24 @@ dns_adb_cancelfind(dns_adbfind_t *find) {
 		goto cleanup;
 
 	/*
-	 * We need to get the adbname's lock to unlink the find.
+	 * We need to get the adbname's lock to unlink the find.  The
+	 * name may move to another bucket while the find is unlocked.
 	 */
-	unlock_bucket = bucket;
-	violate_locking_hierarchy(&find->lock, &adb->namelocks[unlock_bucket]);
-	bucket = find->name_bucket;
+	for (;;) {
+		unlock_bucket = bucket;
+		violate_locking_hierarchy(&find->lock,
+				&namebucket(adb, unlock_bucket)->lock);
+		bucket = find->name_bucket;
+		if (bucket == DNS_ADB_INVALIDBUCKET || bucket == unlock_bucket)
+			break;
+		UNLOCK(&namebucket(adb, unlock_bucket)->lock);
+	}
 	if (bucket != DNS_ADB_INVALIDBUCKET) {
 		ISC_LIST_UNLINK(find->adbname->finds, find, plink);
 		find->adbname = NULL;
 		find->name_bucket = DNS_ADB_INVALIDBUCKET;
 	}
-	UNLOCK(&adb->namelocks[unlock_bucket]);
+	UNLOCK(&namebucket(adb, unlock_bucket)->lock);
 	bucket = DNS_ADB_INVALIDBUCKET;
 	POST(bucket);
 
@@ -3455,15 +3515,15 @@ dump_adb(dns_adb_t *adb, FILE *f, isc_boolean_t debug, isc_stdtime_t now) {
 			isc_mempool_getallocated(adb->nhmp));
 
 	for (i = 0; i < adb->nnames; i++)
-		LOCK(&adb->namelocks[i]);
+		LOCK(&namebucket(adb, i)->lock);
 	for (i = 0; i < adb->nentries; i++)
-		LOCK(&adb->entrylocks[i]);
+		LOCK(&entrybucket(adb, i)->lock);
 
 	/*
 	 * Dump the names
 	 */
 	for (i = 0; i < adb->nnames; i++) {
-		name = ISC_LIST_HEAD(adb->names[i]);
+		name = ISC_LIST_HEAD(namebucket(adb, i)->names);
 		if (name == NULL)
 			continue;
 		if (debug)
@@ -3508,7 +3568,7 @@ dump_adb(dns_adb_t *adb, FILE *f, isc_boolean_t debug, isc_stdtime_t now) {
 	fprintf(f, ";\n; Unassociated entries\n;\n");
 
 	for (i = 0; i < adb->nentries; i++) {
-		entry = ISC_LIST_HEAD(adb->entries[i]);
+		entry = ISC_LIST_HEAD(entrybucket(adb, i)->entries);
 		while (entry != NULL) {
 			if (entry->nh == 0)
 				dump_entry(f, adb, entry, debug, now);
@@ -3520,9 +3580,9 @@ dump_adb(dns_adb_t *adb, FILE *f, isc_boolean_t debug, isc_stdtime_t now) {
 	 * Unlock everything
 	 */
 	for (i = 0; i < adb->nentries; i++)
-		UNLOCK(&adb->entrylocks[i]);
+		UNLOCK(&entrybucket(adb, i)->lock);
 	for (i = 0; i < adb->nnames; i++)
-		UNLOCK(&adb->namelocks[i]);
+		UNLOCK(&namebucket(adb, i)->lock);
 }
 
 static void
@@ -3844,8 +3904,7 @@ fetch_callback(isc_task_t *task, isc_event_t *ev) {
 	adb = name->adb;
 	INSIST(DNS_ADB_VALID(adb));
 
-	bucket = name->lock_bucket;
-	LOCK(&adb->namelocks[bucket]);
+	bucket = lock_namebucket(adb, name);
 
 	INSIST(NAME_FETCH_A(name) || NAME_FETCH_AAAA(name));
 	address_type = 0;
@@ -3886,7 +3945,7 @@ fetch_callback(isc_task_t *task, isc_event_t *ev) {
 
 		want_check_exit = kill_name(&name, DNS_EVENT_ADBCANCELED);
 
-		UNLOCK(&adb->namelocks[bucket]);
+		UNLOCK(&namebucket(adb, bucket)->lock);
 
 		if (want_check_exit) {
 			LOCK(&adb->lock);
@@ -4000,7 +4059,7 @@ fetch_callback(isc_task_t *task, isc_event_t *ev) {
 
 	clean_finds_at_name(name, ev_status, address_type);
 
-	UNLOCK(&adb->namelocks[bucket]);
+	UNLOCK(&namebucket(adb, bucket)->lock);
 }
 
 static isc_result_t
@@ -4096,8 +4155,7 @@ dns_adb_marklame(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
 	REQUIRE(qname != NULL);
 
-	bucket = addr->entry->lock_bucket;
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 	li = ISC_LIST_HEAD(addr->entry->lameinfo);
 	while (li != NULL &&
 	       (li->qtype != qtype || !dns_name_equal(qname, &li->qname)))
@@ -4117,7 +4175,7 @@ dns_adb_marklame(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
 
 	ISC_LIST_PREPEND(addr->entry->lameinfo, li, plink);
  unlock:
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 
 	return (result);
 }
@@ -4133,14 +4191,13 @@ dns_adb_adjustsrtt(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
 	REQUIRE(factor <= 10);
 
-	bucket = addr->entry->lock_bucket;
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 
 	if (addr->entry->expires == 0 || factor == DNS_ADB_RTTADJAGE)
 		isc_stdtime_get(&now);
 	adjustsrtt(addr, rtt, factor, now);
 
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 }
 
 void
@@ -4150,12 +4207,11 @@ dns_adb_agesrtt(dns_adb_t *adb, dns_adbaddrinfo_t *addr, isc_stdtime_t now) {
 	REQUIRE(DNS_ADB_VALID(adb));
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
 
-	bucket = addr->entry->lock_bucket;
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 
 	adjustsrtt(addr, 0, DNS_ADB_RTTADJAGE, now);
 
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 }
 
 static void
@@ -4197,8 +4253,7 @@ dns_adb_changeflags(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
 	REQUIRE((bits & ENTRY_IS_DEAD) == 0);
 	REQUIRE((mask & ENTRY_IS_DEAD) == 0);
 
-	bucket = addr->entry->lock_bucket;
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 
 	addr->entry->flags = (addr->entry->flags & ~mask) | (bits & mask);
 	if (addr->entry->expires == 0) {
@@ -4212,7 +4267,7 @@ dns_adb_changeflags(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
 	 */
 	addr->flags = (addr->flags & ~mask) | (bits & mask);
 
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 }
 
 /*
@@ -4296,8 +4351,7 @@ dns_adb_noedns(dns_adb_t *adb, dns_adbaddrinfo_t *addr) {
 	REQUIRE(DNS_ADB_VALID(adb));
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
 
-	bucket = addr->entry->lock_bucket;
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 
 	if (addr->entry->edns == 0U &&
 	    (addr->entry->plain > EDNSTOS || addr->entry->to4096 > EDNSTOS)) {
@@ -4319,7 +4373,7 @@ dns_adb_noedns(dns_adb_t *adb, dns_adbaddrinfo_t *addr) {
 			}
 		 }
 	}
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 	return (noedns);
 }
 
@@ -4330,8 +4384,7 @@ dns_adb_plainresponse(dns_adb_t *adb, dns_adbaddrinfo_t *addr) {
 	REQUIRE(DNS_ADB_VALID(adb));
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
 
-	bucket = addr->entry->lock_bucket;
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 
 	maybe_adjust_quota(adb, addr, ISC_FALSE);
 
@@ -4345,7 +4398,7 @@ dns_adb_plainresponse(dns_adb_t *adb, dns_adbaddrinfo_t *addr) {
 		addr->entry->plain >>= 1;
 		addr->entry->plainto >>= 1;
 	}
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 }
 
 void
@@ -4355,8 +4408,7 @@ dns_adb_timeout(dns_adb_t *adb, dns_adbaddrinfo_t *addr) {
 	REQUIRE(DNS_ADB_VALID(adb));
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
 
-	bucket = addr->entry->lock_bucket;
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 
 	maybe_adjust_quota(adb, addr, ISC_TRUE);
 
@@ -4382,7 +4434,7 @@ dns_adb_timeout(dns_adb_t *adb, dns_adbaddrinfo_t *addr) {
 		addr->entry->plain >>= 1;
 		addr->entry->plainto >>= 1;
 	}
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 }
 
 void
@@ -4392,8 +4444,7 @@ dns_adb_ednsto(dns_adb_t *adb, dns_adbaddrinfo_t *addr, unsigned int size) {
 	REQUIRE(DNS_ADB_VALID(adb));
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
 
-	bucket = addr->entry->lock_bucket;
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 
 	maybe_adjust_quota(adb, addr, ISC_TRUE);
 
@@ -4429,7 +4480,7 @@ dns_adb_ednsto(dns_adb_t *adb, dns_adbaddrinfo_t *addr, unsigned int size) {
 		addr->entry->plain >>= 1;
 		addr->entry->plainto >>= 1;
 	}
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 }
 
 void
@@ -4439,8 +4490,7 @@ dns_adb_setudpsize(dns_adb_t *adb, dns_adbaddrinfo_t *addr, unsigned int size) {
 	REQUIRE(DNS_ADB_VALID(adb));
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
 
-	bucket = addr->entry->lock_bucket;
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 	if (size < 512U)
 		size = 512U;
 	if (size > addr->entry->udpsize)
@@ -4458,7 +4508,7 @@ dns_adb_setudpsize(dns_adb_t *adb, dns_adbaddrinfo_t *addr, unsigned int size) {
 		addr->entry->plain >>= 1;
 		addr->entry->plainto >>= 1;
 	}
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 }
 
 unsigned int
@@ -4469,10 +4519,9 @@ dns_adb_getudpsize(dns_adb_t *adb, dns_adbaddrinfo_t *addr) {
 	REQUIRE(DNS_ADB_VALID(adb));
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
 
-	bucket = addr->entry->lock_bucket;
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 	size = addr->entry->udpsize;
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 
 	return (size);
 }
@@ -4490,8 +4539,7 @@ dns_adb_probesize2(dns_adb_t *adb, dns_adbaddrinfo_t *addr, int lookups) {
 	REQUIRE(DNS_ADB_VALID(adb));
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
 
-	bucket = addr->entry->lock_bucket;
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 	if (addr->entry->to1232 > EDNSTOS || lookups >= 2)
 		size = 512;
 	else if (addr->entry->to1432 > EDNSTOS || lookups >= 1)
@@ -4507,7 +4555,7 @@ dns_adb_probesize2(dns_adb_t *adb, dns_adbaddrinfo_t *addr, int lookups) {
 	if (lookups > 0 &&
 	    size < addr->entry->udpsize && addr->entry->udpsize < 4096)
 		size = addr->entry->udpsize;
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 
 	return (size);
 }
@@ -4521,8 +4569,7 @@ dns_adb_setcookie(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
 	REQUIRE(DNS_ADB_VALID(adb));
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
 
-	bucket = addr->entry->lock_bucket;
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 
 	if (addr->entry->cookie != NULL &&
 	    (cookie == NULL || len != addr->entry->cookielen)) {
@@ -4540,7 +4587,7 @@ dns_adb_setcookie(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
 
 	if (addr->entry->cookie != NULL)
 		memmove(addr->entry->cookie, cookie, len);
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 }
 
 size_t
@@ -4552,8 +4599,7 @@ dns_adb_getcookie(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
 	REQUIRE(DNS_ADB_VALID(adb));
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
 
-	bucket = addr->entry->lock_bucket;
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 	if (cookie != NULL && addr->entry->cookie != NULL &&
 	    len >= addr->entry->cookielen)
 	{
@@ -4561,7 +4607,7 @@ dns_adb_getcookie(dns_adb_t *adb, dns_adbaddrinfo_t *addr,
 		len = addr->entry->cookielen;
 	} else
 		len = 0;
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 
 	return (len);
 }
@@ -4581,11 +4627,13 @@ dns_adb_findaddrinfo(dns_adb_t *adb, const isc_sockaddr_t *sa,
 
 	UNUSED(now);
 
+	grow_help(adb);
+
 	result = ISC_R_SUCCESS;
 	bucket = DNS_ADB_INVALIDBUCKET;
 	entry = find_entry_and_lock(adb, sa, &bucket, now);
 	INSIST(bucket != DNS_ADB_INVALIDBUCKET);
-	if (adb->entry_sd[bucket]) {
+	if (entrybucket(adb, bucket)->sd) {
 		result = ISC_R_SHUTTINGDOWN;
 		goto unlock;
 	}
@@ -4614,7 +4662,7 @@ dns_adb_findaddrinfo(dns_adb_t *adb, const isc_sockaddr_t *sa,
 	}
 
  unlock:
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 
 	return (result);
 }
@@ -4638,8 +4686,7 @@ dns_adb_freeaddrinfo(dns_adb_t *adb, dns_adbaddrinfo_t **addrp) {
 	*addrp = NULL;
 	overmem = isc_mem_isovermem(adb->mctx);
 
-	bucket = addr->entry->lock_bucket;
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 
 	if (entry->expires == 0) {
 		isc_stdtime_get(&now);
@@ -4648,7 +4695,7 @@ dns_adb_freeaddrinfo(dns_adb_t *adb, dns_adbaddrinfo_t **addrp) {
 
 	want_check_exit = dec_entry_refcnt(adb, overmem, entry, ISC_FALSE);
 
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 
 	addr->entry = NULL;
 	free_adbaddrinfo(adb, &addr);
@@ -4693,9 +4740,9 @@ dns_adb_flushname(dns_adb_t *adb, const dns_name_t *name) {
 	REQUIRE(name != NULL);
 
 	LOCK(&adb->lock);
-	bucket = dns_name_hash(name, ISC_FALSE) % adb->nnames;
-	LOCK(&adb->namelocks[bucket]);
-	adbname = ISC_LIST_HEAD(adb->names[bucket]);
+	bucket = hashbucket(namehash(name), adb->nnames);
+	LOCK(&namebucket(adb, bucket)->lock);
+	adbname = ISC_LIST_HEAD(namebucket(adb, bucket)->names);
 	while (adbname != NULL) {
 		nextname = ISC_LIST_NEXT(adbname, plink);
 		if (!NAME_DEAD(adbname) &&
@@ -4706,7 +4753,7 @@ dns_adb_flushname(dns_adb_t *adb, const dns_name_t *name) {
 		}
 		adbname = nextname;
 	}
-	UNLOCK(&adb->namelocks[bucket]);
+	UNLOCK(&namebucket(adb, bucket)->lock);
 	UNLOCK(&adb->lock);
 }
 
@@ -4720,8 +4767,8 @@ dns_adb_flushnames(dns_adb_t *adb, const dns_name_t *name) {
 
 	LOCK(&adb->lock);
 	for (i = 0; i < adb->nnames; i++) {
-		LOCK(&adb->namelocks[i]);
-		adbname = ISC_LIST_HEAD(adb->names[i]);
+		LOCK(&namebucket(adb, i)->lock);
+		adbname = ISC_LIST_HEAD(namebucket(adb, i)->names);
 		while (adbname != NULL) {
 			isc_boolean_t ret;
 			nextname = ISC_LIST_NEXT(adbname, plink);
@@ -4734,7 +4781,7 @@ dns_adb_flushnames(dns_adb_t *adb, const dns_name_t *name) {
 			}
 			adbname = nextname;
 		}
-		UNLOCK(&adb->namelocks[i]);
+		UNLOCK(&namebucket(adb, i)->lock);
 	}
 	UNLOCK(&adb->lock);
 }
@@ -4804,11 +4851,9 @@ dns_adb_beginudpfetch(dns_adb_t *adb, dns_adbaddrinfo_t *addr) {
 	REQUIRE(DNS_ADB_VALID(adb));
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
 
-	bucket = addr->entry->lock_bucket;
-
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 	addr->entry->active++;
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 }
 
 void
@@ -4818,10 +4863,8 @@ dns_adb_endudpfetch(dns_adb_t *adb, dns_adbaddrinfo_t *addr) {
 	REQUIRE(DNS_ADB_VALID(adb));
 	REQUIRE(DNS_ADBADDRINFO_VALID(addr));
 
-	bucket = addr->entry->lock_bucket;
-
-	LOCK(&adb->entrylocks[bucket]);
+	bucket = lock_entrybucket(adb, addr->entry);
 	if (addr->entry->active > 0)
 		addr->entry->active--;
-	UNLOCK(&adb->entrylocks[bucket]);
+	UNLOCK(&entrybucket(adb, bucket)->lock);
 }
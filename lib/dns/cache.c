@@ -161,6 +161,16 @@ cleaner_shutdown_action(isc_task_t *task, isc_event_t *event);
 static void
 overmem_cleaning_action(isc_task_t *task, isc_event_t *event);
 
+/*
+ * Cache databases of these types are built on rbtdb.c, which takes a heap
+ * memory context argument and cleans itself.
+ */
+static inline isc_boolean_t
+rbtdb_type(const char *db_type) {
+	return (ISC_TF(strcmp(db_type, "rbt") == 0 ||
+		       strcmp(db_type, "qp") == 0));
+}
+
 static inline isc_result_t
 cache_create_db(dns_cache_t *cache, dns_db_t **db) {
 	isc_result_t result;
@@ -241,8 +251,9 @@ dns_cache_create3(isc_mem_t *cmctx, isc_mem_t *hmctx, isc_taskmgr_t *taskmgr,
 	cache->serve_stale_ttl = 0;
 
 	cache->stats = NULL;
-	result = isc_stats_create(cmctx, &cache->stats,
-				  dns_cachestatscounter_max);
+	result = isc_stats_create2(cmctx, &cache->stats,
+				   dns_cachestatscounter_max,
+				   ISC_STATSCREATE_SHARDED);
 	if (result != ISC_R_SUCCESS)
 		goto cleanup_filelock;
 
@@ -253,11 +264,12 @@ dns_cache_create3(isc_mem_t *cmctx, isc_mem_t *hmctx, isc_taskmgr_t *taskmgr,
 	}
 
 	/*
-	 * For databases of type "rbt" we pass hmctx to dns_db_create()
-	 * via cache->db_argv, followed by the rest of the arguments in
-	 * db_argv (of which there really shouldn't be any).
+	 * For databases of type "rbt" (or "qp", which shares its code) we
+	 * pass hmctx to dns_db_create() via cache->db_argv, followed by the
+	 * rest of the arguments in db_argv (of which there really shouldn't
+	 * be any).
 	 */
-	if (strcmp(cache->db_type, "rbt") == 0)
+	if (rbtdb_type(cache->db_type))
 		extra = 1;
 
 	cache->db_argc = db_argc + extra;
@@ -311,7 +323,7 @@ dns_cache_create3(isc_mem_t *cmctx, isc_mem_t *hmctx, isc_taskmgr_t *taskmgr,
 	 * RBT-type cache DB has its own mechanism of cache cleaning and doesn't
 	 * need the control of the generic cleaner.
 	 */
-	if (strcmp(db_type, "rbt") == 0)
+	if (rbtdb_type(db_type))
 		result = cache_cleaner_init(cache, NULL, NULL, &cache->cleaner);
 	else {
 		result = cache_cleaner_init(cache, taskmgr, timermgr,
@@ -390,7 +402,7 @@ cache_free(dns_cache_t *cache) {
 		 * as it's a pointer to hmctx
 		 */
 		int extra = 0;
-		if (strcmp(cache->db_type, "rbt") == 0)
+		if (rbtdb_type(cache->db_type))
 			extra = 1;
 		for (i = extra; i < cache->db_argc; i++)
 			if (cache->db_argv[i] != NULL)
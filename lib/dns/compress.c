@@ -62,80 +62,17 @@ static unsigned char maptolower[] = {
 	0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
 };
 
-/*
- * The tableindex array below is of size 256, one entry for each
- * unsigned char value. The tableindex array elements are dependent on
- * DNS_COMPRESS_TABLESIZE. The table was created using the following
- * function.
- *
- * static void
- * gentable(unsigned char *table) {
- *         unsigned int i;
- *         const unsigned int left = DNS_COMPRESS_TABLESIZE - 38;
- *         long r;
- *
- *         for (i = 0; i < 26; i++) {
- *                 table['A' + i] = i;
- *                 table['a' + i] = i;
- *         }
- *
- *         for (i = 0; i <= 9; i++)
- *                 table['0' + i] = i + 26;
- *
- *         table['-'] = 36;
- *         table['_'] = 37;
- *
- *         for (i = 0; i < 256; i++) {
- *                 if ((i >= 'a' && i <= 'z') ||
- *                     (i >= 'A' && i <= 'Z') ||
- *                     (i >= '0' && i <= '9') ||
- *                     (i == '-') ||
- *                     (i == '_'))
- *                         continue;
- *                 r = random() % left;
- *                 table[i] = 38 + r;
- *         }
- * }
- */
-static unsigned char tableindex[256] = {
-	0x3e, 0x3e, 0x33, 0x2d, 0x30, 0x38, 0x31, 0x3c,
-	0x2b, 0x33, 0x30, 0x3f, 0x2d, 0x3c, 0x36, 0x3a,
-	0x28, 0x2c, 0x2a, 0x37, 0x3d, 0x34, 0x35, 0x2d,
-	0x39, 0x2b, 0x2f, 0x2c, 0x3b, 0x32, 0x2b, 0x39,
-	0x30, 0x38, 0x28, 0x3c, 0x32, 0x33, 0x39, 0x38,
-	0x27, 0x2b, 0x39, 0x30, 0x27, 0x24, 0x2f, 0x2b,
-	0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21,
-	0x22, 0x3a, 0x29, 0x36, 0x31, 0x3c, 0x35, 0x26,
-	0x31, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
-	0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
-	0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
-	0x17, 0x18, 0x19, 0x3e, 0x3b, 0x39, 0x2f, 0x25,
-	0x27, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
-	0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
-	0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
-	0x17, 0x18, 0x19, 0x36, 0x3b, 0x2f, 0x2f, 0x2e,
-	0x29, 0x33, 0x2a, 0x36, 0x28, 0x3f, 0x2e, 0x29,
-	0x2c, 0x29, 0x36, 0x2d, 0x32, 0x3d, 0x33, 0x2a,
-	0x2e, 0x2f, 0x3b, 0x30, 0x3d, 0x39, 0x2b, 0x36,
-	0x2a, 0x2f, 0x2c, 0x26, 0x3a, 0x37, 0x30, 0x3d,
-	0x2a, 0x36, 0x33, 0x2c, 0x38, 0x3d, 0x32, 0x3e,
-	0x26, 0x2a, 0x2c, 0x35, 0x27, 0x39, 0x3b, 0x31,
-	0x2a, 0x37, 0x3c, 0x27, 0x32, 0x29, 0x39, 0x37,
-	0x34, 0x3f, 0x39, 0x2e, 0x38, 0x2b, 0x2c, 0x3e,
-	0x3b, 0x3b, 0x2d, 0x33, 0x3b, 0x3b, 0x32, 0x3d,
-	0x3f, 0x3a, 0x34, 0x26, 0x35, 0x30, 0x31, 0x39,
-	0x27, 0x2f, 0x3d, 0x35, 0x35, 0x36, 0x2e, 0x29,
-	0x38, 0x27, 0x34, 0x32, 0x2c, 0x3c, 0x31, 0x28,
-	0x37, 0x38, 0x37, 0x34, 0x33, 0x29, 0x32, 0x34,
-	0x3f, 0x26, 0x34, 0x34, 0x32, 0x27, 0x30, 0x33,
-	0x33, 0x2d, 0x2b, 0x28, 0x3f, 0x33, 0x2b, 0x39,
-	0x37, 0x39, 0x2c, 0x3d, 0x35, 0x39, 0x27, 0x2f
-};
-
 /***
  ***	Compression
  ***/
 
+/*
+ * Hash values for at most this many suffixes of a name are needed
+ * at a time: dns_compress_findglobal() only looks up the name and its
+ * first suffix, and dns_compress_add() adds no more than two of them.
+ */
+#define MAXSUFFIXES	2
+
 isc_result_t
 dns_compress_init(dns_compress_t *cctx, int edns, isc_mem_t *mctx) {
 	REQUIRE(cctx != NULL);
@@ -146,7 +83,11 @@ dns_compress_init(dns_compress_t *cctx, int edns, isc_mem_t *mctx) {
 	cctx->count = 0;
 	cctx->allowed = DNS_COMPRESS_ENABLED;
 
-	memset(&cctx->table[0], 0, sizeof(cctx->table));
+	memset(&cctx->initialtable[0], 0, sizeof(cctx->initialtable));
+	cctx->table = cctx->initialtable;
+	cctx->tablesize = DNS_COMPRESS_TABLESIZE;
+	cctx->nodes = cctx->initialnodes;
+	cctx->nodesize = DNS_COMPRESS_INITIALNODES;
 
 	cctx->magic = CCTX_MAGIC;
 
@@ -160,19 +101,21 @@ dns_compress_invalidate(dns_compress_t *cctx) {
 
 	REQUIRE(VALID_CCTX(cctx));
 
-	for (i = 0; i < DNS_COMPRESS_TABLESIZE; i++) {
-		while (cctx->table[i] != NULL) {
-			node = cctx->table[i];
-			cctx->table[i] = cctx->table[i]->next;
-			if ((node->offset & 0x8000) != 0)
-				isc_mem_put(cctx->mctx, node->r.base,
-					    node->r.length);
-			if (node->count < DNS_COMPRESS_INITIALNODES)
-				continue;
-			isc_mem_put(cctx->mctx, node, sizeof(*node));
-		}
+	for (i = 0; i < cctx->count; i++) {
+		node = &cctx->nodes[i];
+		if ((node->offset & 0x8000) != 0)
+			isc_mem_put(cctx->mctx, node->r.base, node->r.length);
 	}
-
+	if (cctx->nodes != cctx->initialnodes)
+		isc_mem_put(cctx->mctx, cctx->nodes,
+			    cctx->nodesize * sizeof(*cctx->nodes));
+	if (cctx->table != cctx->initialtable)
+		isc_mem_put(cctx->mctx, cctx->table,
+			    cctx->tablesize * sizeof(*cctx->table));
+
+	cctx->nodes = NULL;
+	cctx->table = NULL;
+	cctx->count = 0;
 	cctx->magic = 0;
 	cctx->allowed = 0;
 	cctx->edns = -1;
@@ -221,6 +164,148 @@ dns_compress_getedns(dns_compress_t *cctx) {
 	return (cctx->edns);
 }
 
+/*
+ * Compute the hashes of the first 'n' suffixes of 'name': hashes[0] is
+ * the hash of the whole name, hashes[1] that of the name without its
+ * first label, and so on.  The offset of each suffix within the name is
+ * stored in starts[].  Hashing runs from the end of the name towards
+ * its start, so a single pass yields the hash of every suffix.
+ *
+ * Label lengths are never altered by maptolower[], so names which are
+ * equal when case is ignored hash to the same value.
+ */
+static inline void
+suffix_hashes(const dns_name_t *name, unsigned int n, unsigned int *starts,
+	      isc_uint32_t *hashes)
+{
+	const unsigned char *ndata = name->ndata;
+	unsigned int i, k;
+	isc_uint32_t h;
+
+	starts[0] = 0;
+	for (k = 1; k < n; k++)
+		starts[k] = starts[k - 1] + ndata[starts[k - 1]] + 1;
+
+	h = 2166136261U;
+	i = name->length;
+	while (n-- > 0) {
+		while (i > starts[n]) {
+			h ^= maptolower[ndata[--i]];
+			h *= 16777619U;
+		}
+		hashes[n] = h ^ (h >> 16);
+	}
+}
+
+/*
+ * Lower case eight octets at once: set the 0x20 bit of every octet
+ * between 'A' and 'Z'.  Working on the low seven bits of each octet
+ * keeps the additions from carrying into the next octet.
+ */
+static inline isc_uint64_t
+tolower64(isc_uint64_t x) {
+	isc_uint64_t heptets = x & 0x7f7f7f7f7f7f7f7fULL;
+	isc_uint64_t ge_a = heptets + 0x3f3f3f3f3f3f3f3fULL;
+	isc_uint64_t gt_z = heptets + 0x2525252525252525ULL;
+	isc_uint64_t upper = ge_a & ~gt_z & ~x & 0x8080808080808080ULL;
+
+	return (x | (upper >> 2));
+}
+
+/*
+ * Compare two wire format names of the same 'length', ignoring case.
+ *
+ * The names are compared eight octets at a time rather than label by
+ * label.  This is safe because label lengths (at most 63) are not
+ * letters: if every octet matches when case is ignored, then every
+ * label length matches exactly and the names have the same labels.
+ */
+static inline isc_boolean_t
+equal_nocase(const unsigned char *a, const unsigned char *b,
+	     unsigned int length)
+{
+	isc_uint64_t x, y;
+
+	while (length >= 8) {
+		memmove(&x, a, 8);
+		memmove(&y, b, 8);
+		if (x != y && tolower64(x) != tolower64(y))
+			return (ISC_FALSE);
+		a += 8;
+		b += 8;
+		length -= 8;
+	}
+	while (length-- > 0) {
+		if (maptolower[*a++] != maptolower[*b++])
+			return (ISC_FALSE);
+	}
+	return (ISC_TRUE);
+}
+
+/*
+ * Put the node with index 'index' into the table, using linear probing.
+ */
+static inline void
+table_insert(dns_compress_t *cctx, unsigned int index) {
+	dns_compressnode_t *node = &cctx->nodes[index];
+	unsigned int mask = cctx->tablesize - 1;
+	unsigned int i;
+
+	i = node->hash & mask;
+	while (cctx->table[i].node != 0)
+		i = (i + 1) & mask;
+
+	cctx->table[i].hash = node->hash;
+	cctx->table[i].length = (isc_uint16_t)node->r.length;
+	cctx->table[i].node = (isc_uint16_t)(index + 1);
+	node->slot = i;
+}
+
+/*
+ * Make room for one more node, growing the node array or the table
+ * as needed.  When the table grows, nodes are reinserted in the order
+ * they were added, which dns_compress_rollback() relies on.
+ */
+static isc_boolean_t
+reserve_node(dns_compress_t *cctx) {
+	dns_compressnode_t *nodes;
+	dns_compressslot_t *table;
+	unsigned int size, i;
+
+	if (ISC_UNLIKELY(cctx->count == 0xffff))
+		return (ISC_FALSE);
+
+	if (ISC_UNLIKELY(cctx->count == cctx->nodesize)) {
+		size = cctx->nodesize * 2;
+		nodes = isc_mem_get(cctx->mctx, size * sizeof(*nodes));
+		if (nodes == NULL)
+			return (ISC_FALSE);
+		memmove(nodes, cctx->nodes, cctx->count * sizeof(*nodes));
+		if (cctx->nodes != cctx->initialnodes)
+			isc_mem_put(cctx->mctx, cctx->nodes,
+				    cctx->nodesize * sizeof(*nodes));
+		cctx->nodes = nodes;
+		cctx->nodesize = size;
+	}
+
+	if (ISC_UNLIKELY((cctx->count + 1U) * 4 > cctx->tablesize * 3)) {
+		size = cctx->tablesize * 2;
+		table = isc_mem_get(cctx->mctx, size * sizeof(*table));
+		if (table == NULL)
+			return (ISC_FALSE);
+		memset(table, 0, size * sizeof(*table));
+		if (cctx->table != cctx->initialtable)
+			isc_mem_put(cctx->mctx, cctx->table,
+				    cctx->tablesize * sizeof(*table));
+		cctx->table = table;
+		cctx->tablesize = size;
+		for (i = 0; i < cctx->count; i++)
+			table_insert(cctx, i);
+	}
+
+	return (ISC_TRUE);
+}
+
 /*
  * Find the longest match of name in the table.
  * If match is found return ISC_TRUE. prefix, suffix and offset are updated.
@@ -230,11 +315,13 @@ isc_boolean_t
 dns_compress_findglobal(dns_compress_t *cctx, const dns_name_t *name,
 			dns_name_t *prefix, isc_uint16_t *offset)
 {
-	dns_name_t tname;
 	dns_compressnode_t *node = NULL;
-	unsigned int labels, i, n;
+	dns_compressslot_t *slot;
+	unsigned int starts[MAXSUFFIXES];
+	isc_uint32_t hashes[MAXSUFFIXES];
+	unsigned int labels, i, n, mask;
 	unsigned int numlabels;
-	unsigned char *p;
+	isc_boolean_t sensitive;
 
 	REQUIRE(VALID_CCTX(cctx));
 	REQUIRE(dns_name_isabsolute(name) == ISC_TRUE);
@@ -249,108 +336,41 @@ dns_compress_findglobal(dns_compress_t *cctx, const dns_name_t *name,
 	labels = dns_name_countlabels(name);
 	INSIST(labels > 0);
 
-	dns_name_init(&tname, NULL);
-
 	numlabels = labels > 3U ? 3U : labels;
-	p = name->ndata;
+	if (numlabels < 2)
+		return (ISC_FALSE);
 
-	for (n = 0; n < numlabels - 1; n++) {
-		unsigned char ch, llen;
-		unsigned int firstoffset, length;
+	suffix_hashes(name, numlabels - 1, starts, hashes);
+	sensitive = ISC_TF((cctx->allowed & DNS_COMPRESS_CASESENSITIVE) != 0);
+	mask = cctx->tablesize - 1;
 
-		firstoffset = (unsigned int)(p - name->ndata);
-		length = name->length - firstoffset;
+	for (n = 0; n < numlabels - 1; n++) {
+		const unsigned char *p = name->ndata + starts[n];
+		unsigned int length = name->length - starts[n];
 
-		/*
-		 * We calculate the table index using the first
-		 * character in the first label of the suffix name.
-		 */
-		ch = p[1];
-		i = tableindex[ch];
-		if (ISC_LIKELY((cctx->allowed &
-				DNS_COMPRESS_CASESENSITIVE) != 0))
+		for (i = hashes[n] & mask;
+		     (slot = &cctx->table[i])->node != 0;
+		     i = (i + 1) & mask)
 		{
-			for (node = cctx->table[i];
-			     node != NULL;
-			     node = node->next)
-			{
-				if (ISC_UNLIKELY(node->name.length != length))
-					continue;
-
-				if (ISC_LIKELY(memcmp(node->name.ndata,
-						      p, length) == 0))
-					goto found;
-			}
-		} else {
-			for (node = cctx->table[i];
-			     node != NULL;
-			     node = node->next)
-			{
-				unsigned int l, count;
-				unsigned char c;
-				unsigned char *label1, *label2;
-
-				if (ISC_UNLIKELY(node->name.length != length))
-					continue;
-
-				l = labels - n;
-				if (ISC_UNLIKELY(node->name.labels != l))
-					continue;
-
-				label1 = node->name.ndata;
-				label2 = p;
-				while (ISC_LIKELY(l-- > 0)) {
-					count = *label1++;
-					if (count != *label2++)
-						goto cont1;
-
-					/* no bitstring support */
-					INSIST(count <= 63);
-
-					/* Loop unrolled for performance */
-					while (ISC_LIKELY(count > 3)) {
-						c = maptolower[label1[0]];
-						if (c != maptolower[label2[0]])
-							goto cont1;
-						c = maptolower[label1[1]];
-						if (c != maptolower[label2[1]])
-							goto cont1;
-						c = maptolower[label1[2]];
-						if (c != maptolower[label2[2]])
-							goto cont1;
-						c = maptolower[label1[3]];
-						if (c != maptolower[label2[3]])
-							goto cont1;
-						count -= 4;
-						label1 += 4;
-						label2 += 4;
-					}
-					while (ISC_LIKELY(count-- > 0)) {
-						c = maptolower[*label1++];
-						if (c != maptolower[*label2++])
-							goto cont1;
-					}
-				}
-				break;
- cont1:
+			if (slot->hash != hashes[n] || slot->length != length)
 				continue;
-			}
-		}
-
-		if (node != NULL)
-			break;
 
-		llen = *p;
-		p += llen + 1;
+			node = &cctx->nodes[slot->node - 1];
+			if (ISC_LIKELY(sensitive)) {
+				if (ISC_LIKELY(memcmp(node->r.base, p,
+						      length) == 0))
+					goto found;
+			} else if (equal_nocase(node->r.base, p, length))
+				goto found;
+		}
 	}
 
- found:
 	/*
-	 * If node == NULL, we found no match at all.
+	 * We found no match at all.
 	 */
-	if (node == NULL)
-		return (ISC_FALSE);
+	return (ISC_FALSE);
 
+ found:
 	if (n == 0)
 		dns_name_reset(prefix);
 	else
@@ -360,25 +380,17 @@ dns_compress_findglobal(dns_compress_t *cctx, const dns_name_t *name,
 	return (ISC_TRUE);
 }
 
-static inline unsigned int
-name_length(const dns_name_t *name) {
-	isc_region_t r;
-	dns_name_toregion(name, &r);
-	return (r.length);
-}
-
 void
 dns_compress_add(dns_compress_t *cctx, const dns_name_t *name,
 		 const dns_name_t *prefix, isc_uint16_t offset)
 {
-	dns_name_t tname, xname;
+	dns_name_t xname;
 	unsigned int start;
-	unsigned int n;
 	unsigned int count;
-	unsigned int i;
 	dns_compressnode_t *node;
 	unsigned int length;
-	unsigned int tlength;
+	unsigned int starts[MAXSUFFIXES];
+	isc_uint32_t hashes[MAXSUFFIXES];
 	isc_uint16_t toffset;
 	unsigned char *tmp;
 	isc_region_t r;
@@ -391,16 +403,13 @@ dns_compress_add(dns_compress_t *cctx, const dns_name_t *name,
 
 	if (offset >= 0x4000)
 		return;
-	dns_name_init(&tname, NULL);
 	dns_name_init(&xname, NULL);
 
-	n = dns_name_countlabels(name);
 	count = dns_name_countlabels(prefix);
 	if (dns_name_isabsolute(prefix))
 		count--;
 	if (count == 0)
 		return;
-	start = 0;
 	dns_name_toregion(name, &r);
 	length = r.length;
 	tmp = isc_mem_get(cctx->mctx, length);
@@ -413,53 +422,30 @@ dns_compress_add(dns_compress_t *cctx, const dns_name_t *name,
 	r.base = tmp;
 	dns_name_fromregion(&xname, &r);
 
-	if (count > 2U)
-		count = 2U;
+	if (count > MAXSUFFIXES)
+		count = MAXSUFFIXES;
 
-	while (count > 0) {
-		unsigned char ch;
+	suffix_hashes(&xname, count, starts, hashes);
 
-		dns_name_getlabelsequence(&xname, start, n, &tname);
-		/*
-		 * We calculate the table index using the first
-		 * character in the first label of tname.
-		 */
-		ch = tname.ndata[1];
-		i = tableindex[ch];
-		tlength = name_length(&tname);
-		toffset = (isc_uint16_t)(offset + (length - tlength));
+	for (start = 0; start < count; start++) {
+		toffset = (isc_uint16_t)(offset + starts[start]);
 		if (toffset >= 0x4000)
 			break;
-		/*
-		 * Create a new node and add it.
-		 */
-		if (cctx->count < DNS_COMPRESS_INITIALNODES)
-			node = &cctx->initialnodes[cctx->count];
-		else {
-			node = isc_mem_get(cctx->mctx,
-					   sizeof(dns_compressnode_t));
-			if (node == NULL)
-				break;
-		}
-		node->count = cctx->count++;
+		if (!reserve_node(cctx))
+			break;
 		/*
 		 * 'node->r.base' becomes 'tmp' when start == 0.
 		 * Record this by setting 0x8000 so it can be freed later.
 		 */
 		if (start == 0)
 			toffset |= 0x8000;
+		node = &cctx->nodes[cctx->count];
 		node->offset = toffset;
-		dns_name_toregion(&tname, &node->r);
-		dns_name_init(&node->name, NULL);
-		node->name.length = node->r.length;
-		node->name.ndata = node->r.base;
-		node->name.labels = tname.labels;
-		node->name.attributes = DNS_NAMEATTR_ABSOLUTE;
-		node->next = cctx->table[i];
-		cctx->table[i] = node;
-		start++;
-		n--;
-		count--;
+		node->r.base = tmp + starts[start];
+		node->r.length = length - starts[start];
+		node->hash = hashes[start];
+		table_insert(cctx, cctx->count);
+		cctx->count++;
 	}
 
 	if (start == 0)
@@ -468,7 +454,6 @@ dns_compress_add(dns_compress_t *cctx, const dns_name_t *name,
 
 void
 dns_compress_rollback(dns_compress_t *cctx, isc_uint16_t offset) {
-	unsigned int i;
 	dns_compressnode_t *node;
 
 	REQUIRE(VALID_CCTX(cctx));
@@ -476,24 +461,21 @@ dns_compress_rollback(dns_compress_t *cctx, isc_uint16_t offset) {
 	if (ISC_UNLIKELY((cctx->allowed & DNS_COMPRESS_ENABLED) == 0))
 		return;
 
-	for (i = 0; i < DNS_COMPRESS_TABLESIZE; i++) {
-		node = cctx->table[i];
-		/*
-		 * This relies on nodes with greater offsets being
-		 * closer to the beginning of the list, and the
-		 * items with the greatest offsets being at the end
-		 * of the initialnodes[] array.
-		 */
-		while (node != NULL && (node->offset & 0x7fff) >= offset) {
-			cctx->table[i] = node->next;
-			if ((node->offset & 0x8000) != 0)
-				isc_mem_put(cctx->mctx, node->r.base,
-					    node->r.length);
-			if (node->count >= DNS_COMPRESS_INITIALNODES)
-				isc_mem_put(cctx->mctx, node, sizeof(*node));
-			cctx->count--;
-			node = cctx->table[i];
-		}
+	/*
+	 * Nodes are added with increasing offsets, so the ones to
+	 * remove are the most recently added.  Removing them in the
+	 * reverse of the order they were inserted leaves the table
+	 * exactly as it was before they were added, so no other entry
+	 * needs to move.
+	 */
+	while (cctx->count > 0) {
+		node = &cctx->nodes[cctx->count - 1];
+		if ((node->offset & 0x7fff) < offset)
+			break;
+		cctx->table[node->slot].node = 0;
+		if ((node->offset & 0x8000) != 0)
+			isc_mem_put(cctx->mctx, node->r.base, node->r.length);
+		cctx->count--;
 	}
 }
 
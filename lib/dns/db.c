@@ -16,6 +16,7 @@
 
 #include <isc/buffer.h>
 #include <isc/mem.h>
+#include <isc/mutex.h>
 #include <isc/once.h>
 #include <isc/rwlock.h>
 #include <isc/string.h>
@@ -54,13 +55,19 @@ struct dns_dbimplementation {
 
 #include "rbtdb.h"
 #include "rbtdb64.h"
+#include "qpdb.h"
 
 static ISC_LIST(dns_dbimplementation_t) implementations;
 static isc_rwlock_t implock;
 static isc_once_t once = ISC_ONCE_INIT;
 
+static isc_once_t generation_once = ISC_ONCE_INIT;
+static isc_mutex_t generation_lock;
+static isc_uint64_t generation = 0;
+
 static dns_dbimplementation_t rbtimp;
 static dns_dbimplementation_t rbt64imp;
+static dns_dbimplementation_t qpimp;
 
 static void
 initialize(void) {
@@ -78,9 +85,16 @@ initialize(void) {
 	rbt64imp.driverarg = NULL;
 	ISC_LINK_INIT(&rbt64imp, link);
 
+	qpimp.name = "qp";
+	qpimp.create = dns_qpdb_create;
+	qpimp.mctx = NULL;
+	qpimp.driverarg = NULL;
+	ISC_LINK_INIT(&qpimp, link);
+
 	ISC_LIST_INIT(implementations);
 	ISC_LIST_APPEND(implementations, &rbtimp, link);
 	ISC_LIST_APPEND(implementations, &rbt64imp, link);
+	ISC_LIST_APPEND(implementations, &qpimp, link);
 }
 
 static inline dns_dbimplementation_t *
@@ -1151,3 +1165,37 @@ dns_db_setgluecachestats(dns_db_t *db, isc_stats_t *stats) {
 
 	return (ISC_R_NOTIMPLEMENTED);
 }
+
+isc_result_t
+dns_db_getgeneration(dns_db_t *db, dns_dbversion_t *version,
+		     isc_uint64_t *generationp)
+{
+	REQUIRE(dns_db_iszone(db));
+	REQUIRE(generationp != NULL);
+
+	if (db->methods->getgeneration != NULL) {
+		return ((db->methods->getgeneration)(db, version,
+						     generationp));
+	}
+
+	return (ISC_R_NOTIMPLEMENTED);
+}
+
+static void
+generation_initialize(void) {
+	RUNTIME_CHECK(isc_mutex_init(&generation_lock) == ISC_R_SUCCESS);
+}
+
+isc_uint64_t
+dns_db_newgeneration(void) {
+	isc_uint64_t gen;
+
+	RUNTIME_CHECK(isc_once_do(&generation_once,
+				  generation_initialize) == ISC_R_SUCCESS);
+
+	LOCK(&generation_lock);
+	gen = ++generation;
+	UNLOCK(&generation_lock);
+
+	return (gen);
+}
@@ -38,21 +38,52 @@
 #include <dns/tcpmsg.h>
 #include <dns/types.h>
 
-typedef ISC_LIST(dns_dispentry_t)	dns_displist_t;
-
 typedef struct dispsocket		dispsocket_t;
-typedef ISC_LIST(dispsocket_t)		dispsocketlist_t;
 
 typedef struct dispportentry		dispportentry_t;
 typedef ISC_LIST(dispportentry_t)	dispportlist_t;
 
+/*%
+ * A hash table of responses or dispatch sockets, open addressed with
+ * linear probing.  Each slot keeps the hash of its item, so that items
+ * can be moved when the table grows or an item is removed without
+ * being looked at.
+ */
+typedef struct qidslot {
+	isc_uint32_t	hash;
+	void		*item;
+} qidslot_t;
+
+typedef struct qidtable {
+	unsigned int	count;		/*%< items in the table */
+	unsigned int	size;		/*%< slots, a power of two */
+	qidslot_t	*slots;
+} qidtable_t;
+
+/*%
+ * Responses are found by destination, local port and ID, and dispatch
+ * sockets by destination and local port.  The tables are split into
+ * stripes by hash, each with its own lock, and each stripe's tables
+ * grow on their own.
+ */
+typedef struct qidstripe {
+	isc_mutex_t	lock;
+	qidtable_t	responses;
+	qidtable_t	sockets;
+} qidstripe_t;
+
+#define QID_MAXSTRIPES		64
+#define QID_STRIPESHIFT		6	/*%< log2(QID_MAXSTRIPES) */
+#define QID_MINSLOTS		8
+
 typedef struct dns_qid {
 	unsigned int	magic;
-	unsigned int	qid_nbuckets;	/*%< hash table size */
+	isc_mem_t	*mctx;
+	unsigned int	qid_nstripes;	/*%< a power of two */
 	unsigned int	qid_increment;	/*%< id increment on collision */
-	isc_mutex_t	lock;
-	dns_displist_t	*qid_table;	/*%< the table itself */
-	dispsocketlist_t *sock_table;	/*%< socket table */
+	isc_boolean_t	qid_socktable;	/*%< dispatch sockets are tracked */
+	isc_mutex_t	lock;		/*%< for the port buffers */
+	qidstripe_t	*qid_stripes;
 } dns_qid_t;
 
 struct dns_dispatchmgr {
@@ -123,7 +154,7 @@ struct dns_dispentry {
 	dns_dispatch_t		       *disp;
 	dns_messageid_t			id;
 	in_port_t			port;
-	unsigned int			bucket;
+	isc_uint32_t			hash;
 	isc_sockaddr_t			host;
 	isc_task_t		       *task;
 	isc_taskaction_t		action;
@@ -131,7 +162,6 @@ struct dns_dispentry {
 	isc_boolean_t			item_out;
 	dispsocket_t			*dispsocket;
 	ISC_LIST(dns_dispatchevent_t)	items;
-	ISC_LINK(dns_dispentry_t)	link;
 };
 
 /*%
@@ -160,13 +190,13 @@ struct dispsocket {
 	isc_socket_t			*socket;
 	dns_dispatch_t			*disp;
 	isc_sockaddr_t			host;
-	in_port_t			localport; /* XXX: should be removed later */
+	in_port_t			localport;
 	dispportentry_t			*portentry;
 	dns_dispentry_t			*resp;
 	isc_task_t			*task;
 	ISC_LINK(dispsocket_t)		link;
-	unsigned int			bucket;
-	ISC_LINK(dispsocket_t)		blink;
+	isc_uint32_t			hash;
+	isc_boolean_t			hashed;	/*%< in the qid socket table */
 };
 
 /*%
@@ -184,7 +214,10 @@ struct dispportentry {
 #define DNS_DISPATCH_PORTTABLESIZE	1024
 #endif
 
-#define INVALID_BUCKET		(0xffffdead)
+/*%
+ * Words in a bitmap of all port numbers.
+ */
+#define PORTBITMAPWORDS		(65536 / 32)
 
 /*%
  * Number of tasks for each dispatch that use separate sockets for different
@@ -239,6 +272,7 @@ struct dns_dispatch {
 	dns_qid_t		*qid;
 	isc_rng_t		*rngctx;	/*%< for QID/UDP port num */
 	dispportlist_t		*port_table;	/*%< hold ports 'owned' by us */
+	isc_uint32_t		*port_bitmap;	/*%< ports in port_table */
 	isc_mempool_t		*portpool;	/*%< port table entries  */
 };
 
@@ -275,8 +309,9 @@ struct dns_dispatch {
 /*
  * Statics.
  */
-static dns_dispentry_t *entry_search(dns_qid_t *, const isc_sockaddr_t *,
-				     dns_messageid_t, in_port_t, unsigned int);
+static dns_dispentry_t *entry_search(qidstripe_t *, isc_uint32_t,
+				     const isc_sockaddr_t *, dns_messageid_t,
+				     in_port_t);
 static isc_boolean_t destroy_disp_ok(dns_dispatch_t *);
 static void destroy_disp(isc_task_t *task, isc_event_t *event);
 static void destroy_dispsocket(dns_dispatch_t *, dispsocket_t **);
@@ -286,21 +321,19 @@ static void udp_shrecv(isc_task_t *, isc_event_t *);
 static void udp_recv(isc_event_t *, dns_dispatch_t *, dispsocket_t *);
 static void tcp_recv(isc_task_t *, isc_event_t *);
 static isc_result_t startrecv(dns_dispatch_t *, dispsocket_t *);
-static isc_uint32_t dns_hash(dns_qid_t *, const isc_sockaddr_t *,
-			     dns_messageid_t, in_port_t);
+static isc_uint32_t dns_hash(const isc_sockaddr_t *, dns_messageid_t,
+			     in_port_t);
 static void free_buffer(dns_dispatch_t *disp, void *buf, unsigned int len);
 static void *allocate_udp_buffer(dns_dispatch_t *disp);
 static inline void free_devent(dns_dispatch_t *disp, dns_dispatchevent_t *ev);
 static inline dns_dispatchevent_t *allocate_devent(dns_dispatch_t *disp);
 static void do_cancel(dns_dispatch_t *disp);
-static dns_dispentry_t *linear_first(dns_qid_t *disp);
-static dns_dispentry_t *linear_next(dns_qid_t *disp,
-				    dns_dispentry_t *resp);
 static void dispatch_free(dns_dispatch_t **dispp);
 static isc_result_t get_udpsocket(dns_dispatchmgr_t *mgr,
 				  dns_dispatch_t *disp,
 				  isc_socketmgr_t *sockmgr,
 				  const isc_sockaddr_t *localaddr,
+				  unsigned int attributes,
 				  isc_socket_t **sockp,
 				  isc_socket_t *dup_socket);
 static isc_result_t dispatch_createudp(dns_dispatchmgr_t *mgr,
@@ -415,66 +448,146 @@ request_log(dns_dispatch_t *disp, dns_dispentry_t *resp,
 }
 
 /*
- * Return a hash of the destination and message id.
+ * Return a hash of the destination, message id and local port.  The
+ * bits are mixed so that the low ones, which pick the stripe, and the
+ * ones above them, which pick the slot, depend on all of the input.
  */
 static isc_uint32_t
-dns_hash(dns_qid_t *qid, const isc_sockaddr_t *dest, dns_messageid_t id,
-	 in_port_t port)
-{
+dns_hash(const isc_sockaddr_t *dest, dns_messageid_t id, in_port_t port) {
 	isc_uint32_t ret;
 
 	ret = isc_sockaddr_hash(dest, ISC_TRUE);
 	ret ^= ((isc_uint32_t)id << 16) | port;
-	ret %= qid->qid_nbuckets;
 
-	INSIST(ret < qid->qid_nbuckets);
+	ret ^= ret >> 16;
+	ret *= 0x85ebca6bU;
+	ret ^= ret >> 13;
+	ret *= 0xc2b2ae35U;
+	ret ^= ret >> 16;
 
 	return (ret);
 }
 
+static inline qidstripe_t *
+qid_stripe(dns_qid_t *qid, isc_uint32_t hash) {
+	return (&qid->qid_stripes[hash & (qid->qid_nstripes - 1)]);
+}
+
 /*
- * Find the first entry in 'qid'.  Returns NULL if there are no entries.
+ * The first slot to look at for 'hash' in 'table'.
  */
-static dns_dispentry_t *
-linear_first(dns_qid_t *qid) {
-	dns_dispentry_t *ret;
-	unsigned int bucket;
+static inline unsigned int
+qidtable_home(qidtable_t *table, isc_uint32_t hash) {
+	return ((hash >> QID_STRIPESHIFT) & (table->size - 1));
+}
 
-	bucket = 0;
+static isc_result_t
+qidtable_init(isc_mem_t *mctx, qidtable_t *table, unsigned int size) {
+	table->slots = isc_mem_get(mctx, size * sizeof(qidslot_t));
+	if (table->slots == NULL)
+		return (ISC_R_NOMEMORY);
+	memset(table->slots, 0, size * sizeof(qidslot_t));
+	table->size = size;
+	table->count = 0;
+	return (ISC_R_SUCCESS);
+}
 
-	while (bucket < qid->qid_nbuckets) {
-		ret = ISC_LIST_HEAD(qid->qid_table[bucket]);
-		if (ret != NULL)
-			return (ret);
-		bucket++;
+static void
+qidtable_free(isc_mem_t *mctx, qidtable_t *table) {
+	if (table->slots != NULL) {
+		isc_mem_put(mctx, table->slots,
+			    table->size * sizeof(qidslot_t));
+		table->slots = NULL;
 	}
+}
 
-	return (NULL);
+/*
+ * Double the size of 'table'.  The stripe must be locked.
+ */
+static isc_result_t
+qidtable_grow(isc_mem_t *mctx, qidtable_t *table) {
+	qidslot_t *old = table->slots;
+	unsigned int oldsize = table->size;
+	unsigned int i, j;
+	isc_result_t result;
+
+	result = qidtable_init(mctx, table, oldsize * 2);
+	if (result != ISC_R_SUCCESS) {
+		table->slots = old;
+		table->size = oldsize;
+		return (result);
+	}
+	for (i = 0; i < oldsize; i++) {
+		if (old[i].item == NULL)
+			continue;
+		j = qidtable_home(table, old[i].hash);
+		while (table->slots[j].item != NULL)
+			j = (j + 1) & (table->size - 1);
+		table->slots[j] = old[i];
+		table->count++;
+	}
+	isc_mem_put(mctx, old, oldsize * sizeof(qidslot_t));
+
+	return (ISC_R_SUCCESS);
 }
 
 /*
- * Find the next entry after 'resp' in 'qid'.  Return NULL if there are
- * no more entries.
+ * Add 'item' with 'hash' to 'table', growing it once it is half full.
+ * The stripe must be locked.
  */
-static dns_dispentry_t *
-linear_next(dns_qid_t *qid, dns_dispentry_t *resp) {
-	dns_dispentry_t *ret;
-	unsigned int bucket;
+static isc_result_t
+qidtable_add(isc_mem_t *mctx, qidtable_t *table, isc_uint32_t hash,
+	     void *item)
+{
+	unsigned int i;
 
-	ret = ISC_LIST_NEXT(resp, link);
-	if (ret != NULL)
-		return (ret);
+	if ((table->count + 1) * 2 > table->size &&
+	    qidtable_grow(mctx, table) != ISC_R_SUCCESS &&
+	    table->count + 1 >= table->size)
+		return (ISC_R_NOMEMORY);
 
-	bucket = resp->bucket;
-	bucket++;
-	while (bucket < qid->qid_nbuckets) {
-		ret = ISC_LIST_HEAD(qid->qid_table[bucket]);
-		if (ret != NULL)
-			return (ret);
-		bucket++;
+	i = qidtable_home(table, hash);
+	while (table->slots[i].item != NULL)
+		i = (i + 1) & (table->size - 1);
+	table->slots[i].hash = hash;
+	table->slots[i].item = item;
+	table->count++;
+
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Remove 'item', which must be in 'table' with 'hash'.  Later items in
+ * the same run of slots are moved back, so that lookups never need to
+ * step over deleted slots.  The stripe must be locked.
+ */
+static void
+qidtable_remove(qidtable_t *table, isc_uint32_t hash, void *item) {
+	unsigned int mask = table->size - 1;
+	unsigned int i, j, home;
+
+	i = qidtable_home(table, hash);
+	while (table->slots[i].item != item) {
+		INSIST(table->slots[i].item != NULL);
+		i = (i + 1) & mask;
 	}
 
-	return (NULL);
+	for (j = (i + 1) & mask;
+	     table->slots[j].item != NULL;
+	     j = (j + 1) & mask)
+	{
+		/*
+		 * The item in slot 'j' may fill the hole in slot 'i' unless
+		 * its home slot is cyclically after 'i'.
+		 */
+		home = qidtable_home(table, table->slots[j].hash);
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			table->slots[i] = table->slots[j];
+			i = j;
+		}
+	}
+	table->slots[i].item = NULL;
+	table->count--;
 }
 
 /*
@@ -552,13 +665,22 @@ destroy_disp(isc_task_t *task, isc_event_t *event) {
 /*%
  * Manipulate port table per dispatch: find an entry for a given port number,
  * create a new entry, and decrement a given entry with possible clean-up.
+ * The bitmap of ports in the table saves searching it for ports not in use,
+ * which most randomly chosen ports are.  The dispatch must be locked.
  */
+#define PORTBIT(port)		(1U << ((port) % 32))
+#define PORTINUSE(disp, port)	\
+	(((disp)->port_bitmap[(port) / 32] & PORTBIT(port)) != 0)
+
 static dispportentry_t *
 port_search(dns_dispatch_t *disp, in_port_t port) {
 	dispportentry_t *portentry;
 
 	REQUIRE(disp->port_table != NULL);
 
+	if (!PORTINUSE(disp, port))
+		return (NULL);
+
 	portentry = ISC_LIST_HEAD(disp->port_table[port %
 						   DNS_DISPATCH_PORTTABLESIZE]);
 	while (portentry != NULL) {
@@ -573,7 +695,6 @@ port_search(dns_dispatch_t *disp, in_port_t port) {
 static dispportentry_t *
 new_portentry(dns_dispatch_t *disp, in_port_t port) {
 	dispportentry_t *portentry;
-	dns_qid_t *qid;
 
 	REQUIRE(disp->port_table != NULL);
 
@@ -584,72 +705,78 @@ new_portentry(dns_dispatch_t *disp, in_port_t port) {
 	portentry->port = port;
 	portentry->refs = 1;
 	ISC_LINK_INIT(portentry, link);
-	qid = DNS_QID(disp);
-	LOCK(&qid->lock);
 	ISC_LIST_APPEND(disp->port_table[port % DNS_DISPATCH_PORTTABLESIZE],
 			portentry, link);
-	UNLOCK(&qid->lock);
+	disp->port_bitmap[port / 32] |= PORTBIT(port);
 
 	return (portentry);
 }
 
-/*%
- * The caller must not hold the qid->lock.
- */
 static void
 deref_portentry(dns_dispatch_t *disp, dispportentry_t **portentryp) {
 	dispportentry_t *portentry = *portentryp;
-	dns_qid_t *qid;
 
 	REQUIRE(disp->port_table != NULL);
 	REQUIRE(portentry != NULL && portentry->refs > 0);
 
-	qid = DNS_QID(disp);
-	LOCK(&qid->lock);
 	portentry->refs--;
 
 	if (portentry->refs == 0) {
 		ISC_LIST_UNLINK(disp->port_table[portentry->port %
 						 DNS_DISPATCH_PORTTABLESIZE],
 				portentry, link);
+		disp->port_bitmap[portentry->port / 32] &=
+			~PORTBIT(portentry->port);
 		isc_mempool_put(disp->portpool, portentry);
 	}
 
-	/*
-	 * Set '*portentryp' to NULL inside the lock so that
-	 * dispsock->portentry does not change in socket_search.
-	 */
 	*portentryp = NULL;
-
-	UNLOCK(&qid->lock);
 }
 
 /*%
- * Find a dispsocket for socket address 'dest', and port number 'port'.
- * Return NULL if no such entry exists.  Requires qid->lock to be held.
+ * Find a dispsocket for socket address 'dest', and port number 'port',
+ * whose hash is 'hash'.  Return NULL if no such entry exists.  Requires
+ * the stripe lock to be held.
  */
 static dispsocket_t *
-socket_search(dns_qid_t *qid, const isc_sockaddr_t *dest, in_port_t port,
-	      unsigned int bucket)
+socket_search(qidstripe_t *stripe, isc_uint32_t hash,
+	      const isc_sockaddr_t *dest, in_port_t port)
 {
+	qidtable_t *table = &stripe->sockets;
 	dispsocket_t *dispsock;
+	unsigned int i;
 
-	REQUIRE(VALID_QID(qid));
-	REQUIRE(bucket < qid->qid_nbuckets);
-
-	dispsock = ISC_LIST_HEAD(qid->sock_table[bucket]);
-
-	while (dispsock != NULL) {
-		if (dispsock->portentry != NULL &&
-		    dispsock->portentry->port == port &&
+	for (i = qidtable_home(table, hash);
+	     table->slots[i].item != NULL;
+	     i = (i + 1) & (table->size - 1))
+	{
+		if (table->slots[i].hash != hash)
+			continue;
+		dispsock = table->slots[i].item;
+		if (dispsock->localport == port &&
 		    isc_sockaddr_equal(dest, &dispsock->host))
 			return (dispsock);
-		dispsock = ISC_LIST_NEXT(dispsock, blink);
 	}
 
 	return (NULL);
 }
 
+/*%
+ * Take 'dispsock' out of the qid socket table if it is in it.
+ */
+static void
+socket_unhash(dns_qid_t *qid, dispsocket_t *dispsock) {
+	qidstripe_t *stripe;
+
+	if (!dispsock->hashed)
+		return;
+	stripe = qid_stripe(qid, dispsock->hash);
+	LOCK(&stripe->lock);
+	qidtable_remove(&stripe->sockets, dispsock->hash, dispsock);
+	UNLOCK(&stripe->lock);
+	dispsock->hashed = ISC_FALSE;
+}
+
 /*%
  * Make a new socket for a single dispatch with a random port number.
  * The caller must hold the disp->lock
@@ -666,7 +793,8 @@ get_dispsocket(dns_dispatch_t *disp, const isc_sockaddr_t *dest,
 	isc_result_t result = ISC_R_FAILURE;
 	in_port_t port;
 	isc_sockaddr_t localaddr;
-	unsigned int bucket = 0;
+	isc_uint32_t hash = 0;
+	qidstripe_t *stripe;
 	dispsocket_t *dispsock;
 	unsigned int nports;
 	in_port_t *ports;
@@ -703,7 +831,7 @@ get_dispsocket(dns_dispatch_t *disp, const isc_sockaddr_t *dest,
 		dispsock->task = NULL;
 		isc_task_attach(disp->task[r % disp->ntasks], &dispsock->task);
 		ISC_LINK_INIT(dispsock, link);
-		ISC_LINK_INIT(dispsock, blink);
+		dispsock->hashed = ISC_FALSE;
 		dispsock->magic = DISPSOCK_MAGIC;
 	}
 
@@ -719,13 +847,14 @@ get_dispsocket(dns_dispatch_t *disp, const isc_sockaddr_t *dest,
 		port = ports[isc_rng_uniformrandom(DISP_RNGCTX(disp), nports)];
 		isc_sockaddr_setport(&localaddr, port);
 
-		LOCK(&qid->lock);
-		bucket = dns_hash(qid, dest, 0, port);
-		if (socket_search(qid, dest, port, bucket) != NULL) {
-			UNLOCK(&qid->lock);
+		hash = dns_hash(dest, 0, port);
+		stripe = qid_stripe(qid, hash);
+		LOCK(&stripe->lock);
+		if (socket_search(stripe, hash, dest, port) != NULL) {
+			UNLOCK(&stripe->lock);
 			continue;
 		}
-		UNLOCK(&qid->lock);
+		UNLOCK(&stripe->lock);
 		bindoptions = 0;
 		portentry = port_search(disp, port);
 
@@ -740,11 +869,8 @@ get_dispsocket(dns_dispatch_t *disp, const isc_sockaddr_t *dest,
 					result = ISC_R_NOMEMORY;
 					break;
 				}
-			} else {
-				LOCK(&qid->lock);
+			} else
 				portentry->refs++;
-				UNLOCK(&qid->lock);
-			}
 			break;
 		} else if (result == ISC_R_NOPERM) {
 			char buf[ISC_SOCKADDR_FORMATSIZE];
@@ -759,11 +885,21 @@ get_dispsocket(dns_dispatch_t *disp, const isc_sockaddr_t *dest,
 	if (result == ISC_R_SUCCESS) {
 		dispsock->socket = sock;
 		dispsock->host = *dest;
+		dispsock->localport = port;
 		dispsock->portentry = portentry;
-		dispsock->bucket = bucket;
-		LOCK(&qid->lock);
-		ISC_LIST_APPEND(qid->sock_table[bucket], dispsock, blink);
-		UNLOCK(&qid->lock);
+		dispsock->hash = hash;
+		stripe = qid_stripe(qid, hash);
+		LOCK(&stripe->lock);
+		result = qidtable_add(qid->mctx, &stripe->sockets, hash,
+				      dispsock);
+		UNLOCK(&stripe->lock);
+		if (result == ISC_R_SUCCESS)
+			dispsock->hashed = ISC_TRUE;
+		else
+			sock = NULL;	/* destroyed with dispsock */
+	}
+
+	if (result == ISC_R_SUCCESS) {
 		*dispsockp = dispsock;
 		*portp = port;
 	} else {
@@ -802,13 +938,8 @@ destroy_dispsocket(dns_dispatch_t *disp, dispsocket_t **dispsockp) {
 		deref_portentry(disp, &dispsock->portentry);
 	if (dispsock->socket != NULL)
 		isc_socket_detach(&dispsock->socket);
-	if (ISC_LINK_LINKED(dispsock, blink)) {
-		qid = DNS_QID(disp);
-		LOCK(&qid->lock);
-		ISC_LIST_UNLINK(qid->sock_table[dispsock->bucket], dispsock,
-				blink);
-		UNLOCK(&qid->lock);
-	}
+	qid = DNS_QID(disp);
+	socket_unhash(qid, dispsock);
 	if (dispsock->task != NULL)
 		isc_task_detach(&dispsock->task);
 	isc_mempool_put(disp->mgr->spool, dispsock);
@@ -843,10 +974,7 @@ deactivate_dispsocket(dns_dispatch_t *disp, dispsocket_t *dispsock) {
 		result = isc_socket_close(dispsock->socket);
 
 		qid = DNS_QID(disp);
-		LOCK(&qid->lock);
-		ISC_LIST_UNLINK(qid->sock_table[dispsock->bucket], dispsock,
-				blink);
-		UNLOCK(&qid->lock);
+		socket_unhash(qid, dispsock);
 
 		if (result == ISC_R_SUCCESS)
 			ISC_LIST_APPEND(disp->inactivesockets, dispsock, link);
@@ -864,26 +992,28 @@ deactivate_dispsocket(dns_dispatch_t *disp, dispsocket_t *dispsock) {
 
 /*
  * Find an entry for query ID 'id', socket address 'dest', and port number
- * 'port'.
- * Return NULL if no such entry exists.
+ * 'port', whose hash is 'hash'.
+ * Return NULL if no such entry exists.  Requires the stripe lock to be held.
  */
 static dns_dispentry_t *
-entry_search(dns_qid_t *qid, const isc_sockaddr_t *dest, dns_messageid_t id,
-	     in_port_t port, unsigned int bucket)
+entry_search(qidstripe_t *stripe, isc_uint32_t hash,
+	     const isc_sockaddr_t *dest, dns_messageid_t id, in_port_t port)
 {
+	qidtable_t *table = &stripe->responses;
 	dns_dispentry_t *res;
+	unsigned int i;
 
-	REQUIRE(VALID_QID(qid));
-	REQUIRE(bucket < qid->qid_nbuckets);
-
-	res = ISC_LIST_HEAD(qid->qid_table[bucket]);
-
-	while (res != NULL) {
+	for (i = qidtable_home(table, hash);
+	     table->slots[i].item != NULL;
+	     i = (i + 1) & (table->size - 1))
+	{
+		if (table->slots[i].hash != hash)
+			continue;
+		res = table->slots[i].item;
 		if (res->id == id && isc_sockaddr_equal(dest, &res->host) &&
 		    res->port == port) {
 			return (res);
 		}
-		res = ISC_LIST_NEXT(res, link);
 	}
 
 	return (NULL);
@@ -1038,7 +1168,8 @@ udp_recv(isc_event_t *ev_in, dns_dispatch_t *disp, dispsocket_t *dispsock) {
 	unsigned int flags;
 	dns_dispentry_t *resp = NULL;
 	dns_dispatchevent_t *rev;
-	unsigned int bucket;
+	isc_uint32_t hash;
+	qidstripe_t *stripe = NULL;
 	isc_boolean_t killit;
 	isc_boolean_t queue_response;
 	dns_dispatchmgr_t *mgr;
@@ -1046,7 +1177,6 @@ udp_recv(isc_event_t *ev_in, dns_dispatch_t *disp, dispsocket_t *dispsock) {
 	isc_netaddr_t netaddr;
 	int match;
 	int result;
-	isc_boolean_t qidlocked = ISC_FALSE;
 
 	LOCK(&disp->lock);
 
@@ -1183,14 +1313,14 @@ udp_recv(isc_event_t *ev_in, dns_dispatch_t *disp, dispsocket_t *dispsock) {
 	 * the ID and the address must match the expected ones.
 	 */
 	if (resp == NULL) {
-		bucket = dns_hash(qid, &ev->address, id, disp->localport);
-		LOCK(&qid->lock);
-		qidlocked = ISC_TRUE;
-		resp = entry_search(qid, &ev->address, id, disp->localport,
-				    bucket);
+		hash = dns_hash(&ev->address, id, disp->localport);
+		stripe = qid_stripe(qid, hash);
+		LOCK(&stripe->lock);
+		resp = entry_search(stripe, hash, &ev->address, id,
+				    disp->localport);
 		dispatch_log(disp, LVL(90),
-			     "search for response in bucket %d: %s",
-			     bucket, (resp == NULL ? "not found" : "found"));
+			     "search for response with hash %08x: %s",
+			     hash, (resp == NULL ? "not found" : "found"));
 
 		if (resp == NULL) {
 			inc_stats(mgr, dns_resstatscounter_mismatch);
@@ -1284,8 +1414,8 @@ udp_recv(isc_event_t *ev_in, dns_dispatch_t *disp, dispsocket_t *dispsock) {
 		isc_task_send(resp->task, ISC_EVENT_PTR(&rev));
 	}
  unlock:
-	if (qidlocked)
-		UNLOCK(&qid->lock);
+	if (stripe != NULL)
+		UNLOCK(&stripe->lock);
 
 	/*
 	 * Restart recv() to get the next packet.
@@ -1329,7 +1459,8 @@ tcp_recv(isc_task_t *task, isc_event_t *ev_in) {
 	unsigned int flags;
 	dns_dispentry_t *resp;
 	dns_dispatchevent_t *rev;
-	unsigned int bucket;
+	isc_uint32_t hash;
+	qidstripe_t *stripe;
 	isc_boolean_t killit;
 	isc_boolean_t queue_response;
 	dns_qid_t *qid;
@@ -1439,12 +1570,14 @@ tcp_recv(isc_task_t *task, isc_event_t *ev_in) {
 	/*
 	 * Response.
 	 */
-	bucket = dns_hash(qid, &tcpmsg->address, id, disp->localport);
-	LOCK(&qid->lock);
-	resp = entry_search(qid, &tcpmsg->address, id, disp->localport, bucket);
+	hash = dns_hash(&tcpmsg->address, id, disp->localport);
+	stripe = qid_stripe(qid, hash);
+	LOCK(&stripe->lock);
+	resp = entry_search(stripe, hash, &tcpmsg->address, id,
+			    disp->localport);
 	dispatch_log(disp, LVL(90),
-		     "search for response in bucket %d: %s",
-		     bucket, (resp == NULL ? "not found" : "found"));
+		     "search for response with hash %08x: %s",
+		     hash, (resp == NULL ? "not found" : "found"));
 
 	if (resp == NULL)
 		goto unlock;
@@ -1476,7 +1609,7 @@ tcp_recv(isc_task_t *task, isc_event_t *ev_in) {
 		isc_task_send(resp->task, ISC_EVENT_PTR(&rev));
 	}
  unlock:
-	UNLOCK(&qid->lock);
+	UNLOCK(&stripe->lock);
 
 	/*
 	 * Restart recv() to get the next packet.
@@ -2276,13 +2409,33 @@ dispatch_find(dns_dispatchmgr_t *mgr, const isc_sockaddr_t *local,
 	return (result);
 }
 
+static void
+qid_freestripes(dns_qid_t *qid, unsigned int nstripes) {
+	unsigned int i;
+
+	for (i = 0; i < nstripes; i++) {
+		qidtable_free(qid->mctx, &qid->qid_stripes[i].responses);
+		qidtable_free(qid->mctx, &qid->qid_stripes[i].sockets);
+		DESTROYLOCK(&qid->qid_stripes[i].lock);
+	}
+	isc_mem_put(qid->mctx, qid->qid_stripes,
+		    qid->qid_nstripes * sizeof(qidstripe_t));
+}
+
+/*
+ * 'buckets' is the number of outstanding responses (and dispatch sockets)
+ * expected.  The tables start out with room for about that many, in up to
+ * QID_MAXSTRIPES stripes of at least QID_MINSLOTS slots, and grow as
+ * needed.
+ */
 static isc_result_t
 qid_allocate(dns_dispatchmgr_t *mgr, unsigned int buckets,
 	     unsigned int increment, dns_qid_t **qidp,
 	     isc_boolean_t needsocktable)
 {
 	dns_qid_t *qid;
-	unsigned int i;
+	qidstripe_t *stripe;
+	unsigned int i, nstripes, nslots;
 	isc_result_t result;
 
 	REQUIRE(VALID_DISPATCHMGR(mgr));
@@ -2293,49 +2446,62 @@ qid_allocate(dns_dispatchmgr_t *mgr, unsigned int buckets,
 	qid = isc_mem_get(mgr->mctx, sizeof(*qid));
 	if (qid == NULL)
 		return (ISC_R_NOMEMORY);
+	qid->mctx = mgr->mctx;
 
-	qid->qid_table = isc_mem_get(mgr->mctx,
-				     buckets * sizeof(dns_displist_t));
-	if (qid->qid_table == NULL) {
+	/*
+	 * Small tables, such as those of TCP dispatches, have a single
+	 * stripe.
+	 */
+	nstripes = 1;
+	while (nstripes < QID_MAXSTRIPES && nstripes * 64 * 2 <= buckets)
+		nstripes *= 2;
+	nslots = QID_MINSLOTS;
+	while (nslots * nstripes < buckets)
+		nslots *= 2;
+
+	qid->qid_nstripes = nstripes;
+	qid->qid_stripes = isc_mem_get(mgr->mctx,
+				       nstripes * sizeof(qidstripe_t));
+	if (qid->qid_stripes == NULL) {
 		isc_mem_put(mgr->mctx, qid, sizeof(*qid));
 		return (ISC_R_NOMEMORY);
 	}
 
-	qid->sock_table = NULL;
-	if (needsocktable) {
-		qid->sock_table = isc_mem_get(mgr->mctx, buckets *
-					      sizeof(dispsocketlist_t));
-		if (qid->sock_table == NULL) {
-			isc_mem_put(mgr->mctx, qid->qid_table,
-				    buckets * sizeof(dns_displist_t));
-			isc_mem_put(mgr->mctx, qid, sizeof(*qid));
-			return (ISC_R_NOMEMORY);
+	for (i = 0; i < nstripes; i++) {
+		stripe = &qid->qid_stripes[i];
+		stripe->sockets.slots = NULL;
+		result = isc_mutex_init(&stripe->lock);
+		if (result != ISC_R_SUCCESS)
+			goto cleanup;
+		result = qidtable_init(mgr->mctx, &stripe->responses, nslots);
+		if (result != ISC_R_SUCCESS) {
+			DESTROYLOCK(&stripe->lock);
+			goto cleanup;
 		}
-	}
-
-	result = isc_mutex_init(&qid->lock);
-	if (result != ISC_R_SUCCESS) {
-		if (qid->sock_table != NULL) {
-			isc_mem_put(mgr->mctx, qid->sock_table,
-				    buckets * sizeof(dispsocketlist_t));
+		if (needsocktable)
+			result = qidtable_init(mgr->mctx, &stripe->sockets,
+					       nslots);
+		if (result != ISC_R_SUCCESS) {
+			qidtable_free(mgr->mctx, &stripe->responses);
+			DESTROYLOCK(&stripe->lock);
+			goto cleanup;
 		}
-		isc_mem_put(mgr->mctx, qid->qid_table,
-			    buckets * sizeof(dns_displist_t));
-		isc_mem_put(mgr->mctx, qid, sizeof(*qid));
-		return (result);
 	}
 
-	for (i = 0; i < buckets; i++) {
-		ISC_LIST_INIT(qid->qid_table[i]);
-		if (qid->sock_table != NULL)
-			ISC_LIST_INIT(qid->sock_table[i]);
-	}
+	result = isc_mutex_init(&qid->lock);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup;
 
-	qid->qid_nbuckets = buckets;
+	qid->qid_socktable = needsocktable;
 	qid->qid_increment = increment;
 	qid->magic = QID_MAGIC;
 	*qidp = qid;
 	return (ISC_R_SUCCESS);
+
+ cleanup:
+	qid_freestripes(qid, i);
+	isc_mem_put(mgr->mctx, qid, sizeof(*qid));
+	return (result);
 }
 
 static void
@@ -2346,15 +2512,11 @@ qid_destroy(isc_mem_t *mctx, dns_qid_t **qidp) {
 	qid = *qidp;
 
 	REQUIRE(VALID_QID(qid));
+	REQUIRE(qid->mctx == mctx);
 
 	*qidp = NULL;
 	qid->magic = 0;
-	isc_mem_put(mctx, qid->qid_table,
-		    qid->qid_nbuckets * sizeof(dns_displist_t));
-	if (qid->sock_table != NULL) {
-		isc_mem_put(mctx, qid->sock_table,
-			    qid->qid_nbuckets * sizeof(dispsocketlist_t));
-	}
+	qid_freestripes(qid, qid->qid_nstripes);
 	DESTROYLOCK(&qid->lock);
 	isc_mem_put(mctx, qid, sizeof(*qid));
 }
@@ -2405,6 +2567,7 @@ dispatch_allocate(dns_dispatchmgr_t *mgr, unsigned int maxrequests,
 	disp->rngctx = NULL;
 	isc_rng_attach(mgr->rngctx, &disp->rngctx);
 	disp->port_table = NULL;
+	disp->port_bitmap = NULL;
 	disp->portpool = NULL;
 	disp->dscp = -1;
 
@@ -2478,6 +2641,11 @@ dispatch_free(dns_dispatch_t **dispp) {
 			    DNS_DISPATCH_PORTTABLESIZE);
 	}
 
+	if (disp->port_bitmap != NULL) {
+		isc_mem_put(mgr->mctx, disp->port_bitmap,
+			    sizeof(disp->port_bitmap[0]) * PORTBITMAPWORDS);
+	}
+
 	if (disp->portpool != NULL)
 		isc_mempool_destroy(&disp->portpool);
 
@@ -2779,9 +2947,12 @@ dns_dispatch_getudp_dup(dns_dispatchmgr_t *mgr, isc_socketmgr_t *sockmgr,
 	}
 
 	/*
-	 * See if we have a dispatcher that matches.
+	 * See if we have a dispatcher that matches.  A dispatcher with
+	 * its own SO_REUSEPORT socket is never shared.
 	 */
-	if (dup_dispatch == NULL) {
+	if (dup_dispatch == NULL &&
+	    (attributes & DNS_DISPATCHATTR_REUSEPORT) == 0)
+	{
 		result = dispatch_find(mgr, localaddr, attributes, mask, &disp);
 		if (result == ISC_R_SUCCESS) {
 			disp->refcount++;
@@ -2855,7 +3026,8 @@ dns_dispatch_getudp(dns_dispatchmgr_t *mgr, isc_socketmgr_t *sockmgr,
 static isc_result_t
 get_udpsocket(dns_dispatchmgr_t *mgr, dns_dispatch_t *disp,
 	      isc_socketmgr_t *sockmgr, const isc_sockaddr_t *localaddr,
-	      isc_socket_t **sockp, isc_socket_t *dup_socket)
+	      unsigned int attributes, isc_socket_t **sockp,
+	      isc_socket_t *dup_socket)
 {
 	unsigned int i, j;
 	isc_socket_t *held[DNS_DISPATCH_HELD];
@@ -2912,9 +3084,12 @@ get_udpsocket(dns_dispatchmgr_t *mgr, dns_dispatch_t *disp,
 		 * choosing one.
 		 */
 	} else {
+		unsigned int options = ISC_SOCKET_REUSEADDRESS;
+
 		/* Allow to reuse address for non-random ports. */
-		result = open_socket(sockmgr, localaddr,
-				     ISC_SOCKET_REUSEADDRESS, &sock,
+		if ((attributes & DNS_DISPATCHATTR_REUSEPORT) != 0)
+			options |= ISC_SOCKET_REUSEPORT;
+		result = open_socket(sockmgr, localaddr, options, &sock,
 				     dup_socket);
 
 		if (result == ISC_R_SUCCESS)
@@ -2983,8 +3158,8 @@ dispatch_createudp(dns_dispatchmgr_t *mgr, isc_socketmgr_t *sockmgr,
 	disp->socktype = isc_sockettype_udp;
 
 	if ((attributes & DNS_DISPATCHATTR_EXCLUSIVE) == 0) {
-		result = get_udpsocket(mgr, disp, sockmgr, localaddr, &sock,
-				       dup_socket);
+		result = get_udpsocket(mgr, disp, sockmgr, localaddr,
+				       attributes, &sock, dup_socket);
 		if (result != ISC_R_SUCCESS)
 			goto deallocate_dispatch;
 
@@ -3024,6 +3199,14 @@ dispatch_createudp(dns_dispatchmgr_t *mgr, isc_socketmgr_t *sockmgr,
 		for (i = 0; i < DNS_DISPATCH_PORTTABLESIZE; i++)
 			ISC_LIST_INIT(disp->port_table[i]);
 
+		disp->port_bitmap = isc_mem_get(mgr->mctx,
+						sizeof(disp->port_bitmap[0]) *
+						PORTBITMAPWORDS);
+		if (disp->port_bitmap == NULL)
+			goto deallocate_dispatch;
+		memset(disp->port_bitmap, 0,
+		       sizeof(disp->port_bitmap[0]) * PORTBITMAPWORDS);
+
 		result = isc_mempool_create(mgr->mctx, sizeof(dispportentry_t),
 					    &disp->portpool);
 		if (result != ISC_R_SUCCESS)
@@ -3188,7 +3371,8 @@ dns_dispatch_addresponse3(dns_dispatch_t *disp, unsigned int options,
 			  isc_socketmgr_t *sockmgr)
 {
 	dns_dispentry_t *res;
-	unsigned int bucket;
+	isc_uint32_t hash;
+	qidstripe_t *stripe;
 	in_port_t localport = 0;
 	dns_messageid_t id;
 	int i;
@@ -3273,65 +3457,72 @@ dns_dispatch_addresponse3(dns_dispatch_t *disp, unsigned int options,
 		localport = disp->localport;
 	}
 
+	res = isc_mempool_get(disp->mgr->rpool);
+	if (res == NULL) {
+		if (dispsocket != NULL)
+			destroy_dispsocket(disp, &dispsocket);
+		UNLOCK(&disp->lock);
+		return (ISC_R_NOMEMORY);
+	}
+	res->task = NULL;
+	isc_task_attach(task, &res->task);
+	res->disp = disp;
+	res->port = localport;
+	res->host = *dest;
+	res->action = action;
+	res->arg = arg;
+	res->dispsocket = dispsocket;
+	res->item_out = ISC_FALSE;
+	ISC_LIST_INIT(res->items);
+	res->magic = RESPONSE_MAGIC;
+
 	/*
 	 * Try somewhat hard to find an unique ID unless FIXEDID is set
-	 * in which case we use the id passed in via *idp.
+	 * in which case we use the id passed in via *idp.  The entry is
+	 * added in the same stripe lock as the search, so that no other
+	 * entry can take the ID in between.
 	 */
-	LOCK(&qid->lock);
 	if ((options & DNS_DISPATCHOPT_FIXEDID) != 0)
 		id = *idp;
 	else
 		isc_rng_randombytes(DISP_RNGCTX(disp), &id, sizeof(id));
 	ok = ISC_FALSE;
+	result = ISC_R_NOMORE;
 	i = 0;
 	do {
-		bucket = dns_hash(qid, dest, id, localport);
-		if (entry_search(qid, dest, id, localport, bucket) == NULL) {
-			ok = ISC_TRUE;
+		hash = dns_hash(dest, id, localport);
+		stripe = qid_stripe(qid, hash);
+		LOCK(&stripe->lock);
+		if (entry_search(stripe, hash, dest, id, localport) == NULL) {
+			res->id = id;
+			res->hash = hash;
+			result = qidtable_add(qid->mctx, &stripe->responses,
+					      hash, res);
+			ok = ISC_TF(result == ISC_R_SUCCESS);
+			UNLOCK(&stripe->lock);
 			break;
 		}
+		UNLOCK(&stripe->lock);
 		if ((disp->attributes & DNS_DISPATCHATTR_FIXEDID) != 0)
 			break;
 		id += qid->qid_increment;
 		id &= 0x0000ffff;
 	} while (i++ < 64);
-	UNLOCK(&qid->lock);
 
 	if (!ok) {
-		UNLOCK(&disp->lock);
-		return (ISC_R_NOMORE);
-	}
-
-	res = isc_mempool_get(disp->mgr->rpool);
-	if (res == NULL) {
+		res->magic = 0;
+		isc_task_detach(&res->task);
+		isc_mempool_put(disp->mgr->rpool, res);
 		if (dispsocket != NULL)
 			destroy_dispsocket(disp, &dispsocket);
 		UNLOCK(&disp->lock);
-		return (ISC_R_NOMEMORY);
+		return (result);
 	}
 
 	disp->refcount++;
 	disp->requests++;
-	res->task = NULL;
-	isc_task_attach(task, &res->task);
-	res->disp = disp;
-	res->id = id;
-	res->port = localport;
-	res->bucket = bucket;
-	res->host = *dest;
-	res->action = action;
-	res->arg = arg;
-	res->dispsocket = dispsocket;
 	if (dispsocket != NULL)
 		dispsocket->resp = res;
-	res->item_out = ISC_FALSE;
-	ISC_LIST_INIT(res->items);
-	ISC_LINK_INIT(res, link);
-	res->magic = RESPONSE_MAGIC;
-
-	LOCK(&qid->lock);
-	ISC_LIST_APPEND(qid->qid_table[bucket], res, link);
-	UNLOCK(&qid->lock);
 
 	inc_stats(disp->mgr, (qid == disp->mgr->qid) ?
 			     dns_resstatscounter_disprequdp :
@@ -3344,9 +3535,9 @@ dns_dispatch_addresponse3(dns_dispatch_t *disp, unsigned int options,
 	    ((disp->attributes & DNS_DISPATCHATTR_CONNECTED) != 0)) {
 		result = startrecv(disp, dispsocket);
 		if (result != ISC_R_SUCCESS) {
-			LOCK(&qid->lock);
-			ISC_LIST_UNLINK(qid->qid_table[bucket], res, link);
-			UNLOCK(&qid->lock);
+			LOCK(&stripe->lock);
+			qidtable_remove(&stripe->responses, hash, res);
+			UNLOCK(&stripe->lock);
 
 			if (dispsocket != NULL)
 				destroy_dispsocket(disp, &dispsocket);
@@ -3457,7 +3648,7 @@ dns_dispatch_removeresponse(dns_dispentry_t **resp,
 	dns_dispentry_t *res;
 	dispsocket_t *dispsock;
 	dns_dispatchevent_t *ev;
-	unsigned int bucket;
+	qidstripe_t *stripe;
 	isc_boolean_t killit;
 	unsigned int n;
 	isc_eventlist_t events;
@@ -3506,11 +3697,10 @@ dns_dispatch_removeresponse(dns_dispentry_t **resp,
 		disp->shutting_down = 1;
 	}
 
-	bucket = res->bucket;
-
-	LOCK(&qid->lock);
-	ISC_LIST_UNLINK(qid->qid_table[bucket], res, link);
-	UNLOCK(&qid->lock);
+	stripe = qid_stripe(qid, res->hash);
+	LOCK(&stripe->lock);
+	qidtable_remove(&stripe->responses, res->hash, res);
+	UNLOCK(&stripe->lock);
 
 	if (ev == NULL && res->item_out) {
 		/*
@@ -3571,8 +3761,11 @@ dns_dispatch_removeresponse(dns_dispentry_t **resp,
 static void
 do_cancel(dns_dispatch_t *disp) {
 	dns_dispatchevent_t *ev;
-	dns_dispentry_t *resp;
+	dns_dispentry_t *resp = NULL;
 	dns_qid_t *qid;
+	qidstripe_t *stripe = NULL;
+	qidtable_t *table;
+	unsigned int i, j;
 
 	if (disp->shutdown_out == 1)
 		return;
@@ -3581,19 +3774,28 @@ do_cancel(dns_dispatch_t *disp) {
 
 	/*
 	 * Search for the first response handler without packets outstanding
-	 * unless a specific hander is given.
+	 * unless a specific hander is given.  The stripe it is found in is
+	 * left locked.
 	 */
-	LOCK(&qid->lock);
-	for (resp = linear_first(qid);
-	     resp != NULL && resp->item_out;
-	     /* Empty. */)
-		resp = linear_next(qid, resp);
+	for (i = 0; i < qid->qid_nstripes && resp == NULL; i++) {
+		stripe = &qid->qid_stripes[i];
+		table = &stripe->responses;
+		LOCK(&stripe->lock);
+		for (j = 0; j < table->size; j++) {
+			resp = table->slots[j].item;
+			if (resp != NULL && !resp->item_out)
+				break;
+			resp = NULL;
+		}
+		if (resp == NULL)
+			UNLOCK(&stripe->lock);
+	}
 
 	/*
 	 * No one to send the cancel event to, so nothing to do.
 	 */
 	if (resp == NULL)
-		goto unlock;
+		return;
 
 	/*
 	 * Send the shutdown failsafe event to this resp.
@@ -3610,8 +3812,7 @@ do_cancel(dns_dispatch_t *disp) {
 		    ev, resp->task);
 	resp->item_out = ISC_TRUE;
 	isc_task_send(resp->task, ISC_EVENT_PTR(&ev));
- unlock:
-	UNLOCK(&qid->lock);
+	UNLOCK(&stripe->lock);
 }
 
 isc_socket_t *
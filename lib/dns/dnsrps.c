@@ -959,7 +959,8 @@ static dns_dbmethods_t rpsdb_db_methods = {
 	NULL,			/* getsize */
 	NULL,			/* setservestalettl */
 	NULL,			/* getservestalettl */
-	NULL			/* setgluecachestats */
+	NULL,			/* setgluecachestats */
+	NULL			/* getgeneration */
 };
 
 static dns_rdatasetmethods_t rpsdb_rdataset_methods = {
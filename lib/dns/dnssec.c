@@ -17,6 +17,7 @@
 #include <isc/mem.h>
 #include <isc/print.h>
 #include <isc/serial.h>
+#include <isc/sha2.h>
 #include <isc/string.h>
 #include <isc/util.h>
 
@@ -34,12 +35,14 @@
 #include <dns/rdataset.h>
 #include <dns/rdatastruct.h>
 #include <dns/result.h>
+#include <dns/sigcache.h>
 #include <dns/stats.h>
 #include <dns/tsig.h>		/* for DNS_TSIG_FUDGE */
 
 #include <dst/result.h>
 
 LIBDNS_EXTERNAL_DATA isc_stats_t *dns_dnssec_stats;
+LIBDNS_EXTERNAL_DATA dns_sigcache_t *dns_dnssec_sigcache;
 
 #define is_response(msg) (msg->flags & DNS_MESSAGEFLAG_QR)
 
@@ -359,6 +362,73 @@ cleanup_signature:
 	return (ret);
 }
 
+static isc_result_t
+sigcache_callback(void *arg, isc_region_t *data) {
+	isc_sha256_t *sha = arg;
+
+	isc_sha256_update(sha, data->base, data->length);
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Compute the digest under which a good signature is kept in the
+ * signature cache: that of the whole RRSIG rdata, the DNSKEY rdata of
+ * 'key', 'maxbits' and the data the signature covers, that is the
+ * envelope 'env' and the canonical form of each of the 'nrdatas'
+ * sorted 'rdatas'.  Everything of variable length is preceded by its
+ * length, so that different tuples cannot run together into the same
+ * input.
+ */
+static isc_result_t
+sigcache_digest(dst_key_t *key, unsigned int maxbits, dns_rdata_t *sigrdata,
+		isc_region_t *env, dns_rdata_t *rdatas, int nrdatas,
+		unsigned char *digest)
+{
+	isc_sha256_t sha;
+	isc_buffer_t b;
+	isc_region_t r;
+	unsigned char keydata[DST_KEY_MAXSIZE];
+	unsigned char lendata[4];
+	isc_result_t ret;
+	int i;
+
+	isc_buffer_init(&b, keydata, sizeof(keydata));
+	ret = dst_key_todns(key, &b);
+	if (ret != ISC_R_SUCCESS)
+		return (ret);
+	isc_buffer_usedregion(&b, &r);
+
+	isc_sha256_init(&sha);
+
+	isc_buffer_init(&b, lendata, sizeof(lendata));
+	isc_buffer_putuint32(&b, maxbits);
+	isc_sha256_update(&sha, lendata, 4);
+
+	isc_buffer_init(&b, lendata, sizeof(lendata));
+	isc_buffer_putuint16(&b, (isc_uint16_t)r.length);
+	isc_sha256_update(&sha, lendata, 2);
+	isc_sha256_update(&sha, r.base, r.length);
+
+	dns_rdata_toregion(sigrdata, &r);
+	isc_buffer_init(&b, lendata, sizeof(lendata));
+	isc_buffer_putuint16(&b, (isc_uint16_t)r.length);
+	isc_sha256_update(&sha, lendata, 2);
+	isc_sha256_update(&sha, r.base, r.length);
+
+	isc_sha256_update(&sha, env->base, env->length);
+	for (i = 0; i < nrdatas; i++) {
+		if (i > 0 && dns_rdata_compare(&rdatas[i], &rdatas[i-1]) == 0)
+			continue;
+		isc_buffer_init(&b, lendata, sizeof(lendata));
+		isc_buffer_putuint16(&b, (isc_uint16_t)rdatas[i].length);
+		isc_sha256_update(&sha, lendata, 2);
+		(void)dns_rdata_digest(&rdatas[i], sigcache_callback, &sha);
+	}
+
+	isc_sha256_final(digest, &sha);
+	return (ISC_R_SUCCESS);
+}
+
 isc_result_t
 dns_dnssec_verify2(const dns_name_t *name, dns_rdataset_t *set, dst_key_t *key,
 		   isc_boolean_t ignoretime, isc_mem_t *mctx,
@@ -375,17 +445,19 @@ dns_dnssec_verify3(const dns_name_t *name, dns_rdataset_t *set, dst_key_t *key,
 {
 	dns_rdata_rrsig_t sig;
 	dns_fixedname_t fnewname;
-	isc_region_t r;
+	isc_region_t r, sigr;
 	isc_buffer_t envbuf;
 	dns_rdata_t *rdatas;
 	int nrdatas, i;
 	isc_stdtime_t now;
 	isc_result_t ret;
 	unsigned char data[300];
+	unsigned char digest[DNS_SIGCACHE_DIGESTLENGTH];
 	dst_context_t *ctx = NULL;
 	int labels = 0;
 	isc_uint32_t flags;
 	isc_boolean_t downcase = ISC_FALSE;
+	isc_boolean_t cache = ISC_FALSE;
 
 	REQUIRE(name != NULL);
 	REQUIRE(set != NULL);
@@ -460,19 +532,6 @@ dns_dnssec_verify3(const dns_name_t *name, dns_rdataset_t *set, dst_key_t *key,
 		return (DNS_R_KEYUNAUTHORIZED);
 	}
 
- again:
-	ret = dst_context_create4(key, mctx, DNS_LOGCATEGORY_DNSSEC,
-				  ISC_FALSE, maxbits, &ctx);
-	if (ret != ISC_R_SUCCESS)
-		goto cleanup_struct;
-
-	/*
-	 * Digest the SIG rdata (not including the signature).
-	 */
-	ret = digest_sig(ctx, downcase, sigrdata, &sig);
-	if (ret != ISC_R_SUCCESS)
-		goto cleanup_context;
-
 	/*
 	 * If the name is an expanded wildcard, use the wildcard name.
 	 */
@@ -504,10 +563,39 @@ dns_dnssec_verify3(const dns_name_t *name, dns_rdataset_t *set, dst_key_t *key,
 
 	ret = rdataset_to_sortedarray(set, mctx, &rdatas, &nrdatas);
 	if (ret != ISC_R_SUCCESS)
-		goto cleanup_context;
+		goto cleanup_struct;
 
 	isc_buffer_usedregion(&envbuf, &r);
 
+	/*
+	 * Has this signature been found good before?
+	 */
+	if (dns_dnssec_sigcache != NULL &&
+	    sigcache_digest(key, maxbits, sigrdata, &r, rdatas, nrdatas,
+			    digest) == ISC_R_SUCCESS)
+	{
+		if (dns_sigcache_find(dns_dnssec_sigcache, digest)) {
+			inc_stat(dns_dnssecstats_cachehit);
+			ret = ISC_R_SUCCESS;
+			goto cleanup_array;
+		}
+		inc_stat(dns_dnssecstats_cachemiss);
+		cache = ISC_TRUE;
+	}
+
+ again:
+	ret = dst_context_create4(key, mctx, DNS_LOGCATEGORY_DNSSEC,
+				  ISC_FALSE, maxbits, &ctx);
+	if (ret != ISC_R_SUCCESS)
+		goto cleanup_array;
+
+	/*
+	 * Digest the SIG rdata (not including the signature).
+	 */
+	ret = digest_sig(ctx, downcase, sigrdata, &sig);
+	if (ret != ISC_R_SUCCESS)
+		goto cleanup_context;
+
 	for (i = 0; i < nrdatas; i++) {
 		isc_uint16_t len;
 		isc_buffer_t lenbuf;
@@ -524,7 +612,7 @@ dns_dnssec_verify3(const dns_name_t *name, dns_rdataset_t *set, dst_key_t *key,
 		 */
 		ret = dst_context_adddata(ctx, &r);
 		if (ret != ISC_R_SUCCESS)
-			goto cleanup_array;
+			goto cleanup_context;
 
 		/*
 		 * Digest the rdata length.
@@ -539,15 +627,15 @@ dns_dnssec_verify3(const dns_name_t *name, dns_rdataset_t *set, dst_key_t *key,
 		 */
 		ret = dst_context_adddata(ctx, &lenr);
 		if (ret != ISC_R_SUCCESS)
-			goto cleanup_array;
+			goto cleanup_context;
 		ret = dns_rdata_digest(&rdatas[i], digest_callback, ctx);
 		if (ret != ISC_R_SUCCESS)
-			goto cleanup_array;
+			goto cleanup_context;
 	}
 
-	r.base = sig.signature;
-	r.length = sig.siglen;
-	ret = dst_context_verify2(ctx, maxbits, &r);
+	sigr.base = sig.signature;
+	sigr.length = sig.siglen;
+	ret = dst_context_verify2(ctx, maxbits, &sigr);
 	if (ret == ISC_R_SUCCESS && downcase) {
 		char namebuf[DNS_NAME_FORMATSIZE];
 		dns_name_format(&sig.signer, namebuf, sizeof(namebuf));
@@ -558,15 +646,17 @@ dns_dnssec_verify3(const dns_name_t *name, dns_rdataset_t *set, dst_key_t *key,
 		inc_stat(dns_dnssecstats_downcase);
 	} else if (ret == ISC_R_SUCCESS)
 		inc_stat(dns_dnssecstats_asis);
+	if (ret == ISC_R_SUCCESS && cache)
+		dns_sigcache_add(dns_dnssec_sigcache, digest);
 
-cleanup_array:
-	isc_mem_put(mctx, rdatas, nrdatas * sizeof(dns_rdata_t));
 cleanup_context:
 	dst_context_destroy(&ctx);
 	if (ret == DST_R_VERIFYFAILURE && !downcase) {
 		downcase = ISC_TRUE;
 		goto again;
 	}
+cleanup_array:
+	isc_mem_put(mctx, rdatas, nrdatas * sizeof(dns_rdata_t));
 cleanup_struct:
 	dns_rdata_freestruct(&sig);
 
@@ -584,7 +584,8 @@ static dns_dbmethods_t ecdb_methods = {
 	NULL,			/* getsize */
 	NULL,			/* setservestalettl */
 	NULL,			/* getservestalettl */
-	NULL			/* setgluecachestats */
+	NULL,			/* setgluecachestats */
+	NULL			/* getgeneration */
 };
 
 static isc_result_t
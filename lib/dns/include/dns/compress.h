@@ -39,22 +39,31 @@ ISC_LANG_BEGINDECLS
 #define DNS_COMPRESS_ENABLED		0x04
 
 /*
- * DNS_COMPRESS_TABLESIZE must be a power of 2. The compress code
- * utilizes this assumption.
+ * The global compression table is open addressed.  It starts with
+ * DNS_COMPRESS_TABLESIZE slots held in the context, and is doubled
+ * whenever it becomes more than three quarters full, so that it grows
+ * with the number of names in the message.  DNS_COMPRESS_TABLESIZE
+ * must be a power of 2.
  */
 #define DNS_COMPRESS_TABLEBITS 6
 #define DNS_COMPRESS_TABLESIZE (1U << DNS_COMPRESS_TABLEBITS)
 #define DNS_COMPRESS_TABLEMASK (DNS_COMPRESS_TABLESIZE - 1)
-#define DNS_COMPRESS_INITIALNODES 16
+#define DNS_COMPRESS_INITIALNODES 32
 
 typedef struct dns_compressnode dns_compressnode_t;
+typedef struct dns_compressslot dns_compressslot_t;
 
 struct dns_compressnode {
-	dns_compressnode_t	*next;
+	isc_region_t            r;		/*%< Suffix name data. */
+	isc_uint32_t		hash;		/*%< Hash of the suffix. */
+	isc_uint32_t		slot;		/*%< Table slot in use. */
 	isc_uint16_t		offset;
-	isc_uint16_t		count;
-	isc_region_t            r;
-	dns_name_t              name;
+};
+
+struct dns_compressslot {
+	isc_uint32_t		hash;		/*%< Copy of node->hash. */
+	isc_uint16_t		length;		/*%< Length of the suffix. */
+	isc_uint16_t		node;		/*%< Node index + 1, or 0. */
 };
 
 struct dns_compress {
@@ -62,11 +71,16 @@ struct dns_compress {
 	unsigned int		allowed;	/*%< Allowed methods. */
 	int			edns;		/*%< Edns version or -1. */
 	/*% Global compression table. */
-	dns_compressnode_t	*table[DNS_COMPRESS_TABLESIZE];
-	/*% Preallocated nodes for the table. */
-	dns_compressnode_t	initialnodes[DNS_COMPRESS_INITIALNODES];
+	dns_compressslot_t	*table;
+	unsigned int		tablesize;	/*%< Slots in 'table'. */
+	/*% Nodes in the order they were added. */
+	dns_compressnode_t	*nodes;
+	unsigned int		nodesize;	/*%< Capacity of 'nodes'. */
 	isc_uint16_t		count;		/*%< Number of nodes. */
 	isc_mem_t		*mctx;		/*%< Memory context. */
+	/*% Initial table and nodes, used until they fill up. */
+	dns_compressslot_t	initialtable[DNS_COMPRESS_TABLESIZE];
+	dns_compressnode_t	initialnodes[DNS_COMPRESS_INITIALNODES];
 };
 
 typedef enum {
@@ -190,6 +190,9 @@ typedef struct dns_dbmethods {
 	isc_result_t	(*setservestalettl)(dns_db_t *db, dns_ttl_t ttl);
 	isc_result_t	(*getservestalettl)(dns_db_t *db, dns_ttl_t *ttl);
 	isc_result_t	(*setgluecachestats)(dns_db_t *db, isc_stats_t *stats);
+	isc_result_t	(*getgeneration)(dns_db_t *db,
+					 dns_dbversion_t *version,
+					 isc_uint64_t *generationp);
 } dns_dbmethods_t;
 
 typedef isc_result_t
@@ -1716,6 +1719,36 @@ dns_db_setgluecachestats(dns_db_t *db, isc_stats_t *stats);
  *	dns_rdatasetstats_create(); otherwise NULL.
  */
 
+isc_result_t
+dns_db_getgeneration(dns_db_t *db, dns_dbversion_t *version,
+		     isc_uint64_t *generationp);
+/*%<
+ * Get the generation number of 'version' of zone database 'db', or of
+ * the current version if 'version' is NULL.
+ *
+ * A generation number identifies the contents of a database version:
+ * it is unique among all the versions of all the databases in the
+ * process, and it is never reused, so it can be stored and later
+ * compared with the generation of the current version to learn whether
+ * the zone has changed in the meantime.
+ *
+ * Requires:
+ *
+ * \li	'db' is a valid zone database.
+ * \li	'generationp' is not NULL.
+ *
+ * Returns:
+ * \li	#ISC_R_SUCCESS
+ * \li	#ISC_R_NOTIMPLEMENTED - Not supported by this DB implementation.
+ */
+
+isc_uint64_t
+dns_db_newgeneration(void);
+/*%<
+ * Return a new, never before returned, generation number.  For use by
+ * database implementations.
+ */
+
 ISC_LANG_ENDDECLS
 
 #endif /* DNS_DB_H */
@@ -26,6 +26,12 @@ ISC_LANG_BEGINDECLS
 
 LIBDNS_EXTERNAL_DATA extern isc_stats_t *dns_dnssec_stats;
 
+/*%
+ * If not NULL, signatures found good by dns_dnssec_verify*() are kept
+ * here and not checked again.  Set once at startup.
+ */
+LIBDNS_EXTERNAL_DATA extern dns_sigcache_t *dns_dnssec_sigcache;
+
 /*%< Maximum number of keys supported in a zone. */
 #define DNS_MAXZONEKEYS 32
 
@@ -136,6 +142,11 @@ dns_dnssec_verify3(const dns_name_t *name, dns_rdataset_t *set, dst_key_t *key,
  *
  *	'maxbits' specifies the maximum number of rsa exponent bits accepted.
  *
+ *	If #dns_dnssec_sigcache is set it is consulted once the validity
+ *	period, signer and key flags have been checked, and a signature
+ *	found there is accepted without the public key operation.  Good
+ *	signatures are added to it.
+ *
  *	Requires:
  *\li		'name' (the owner name of the record) is a valid name
  *\li		'set' is a valid rdataset
@@ -77,6 +77,11 @@
 #define DNS_EVENT_CATZDELZONE			(ISC_EVENTCLASS_DNS + 56)
 #define DNS_EVENT_RPZUPDATED			(ISC_EVENTCLASS_DNS + 57)
 #define DNS_EVENT_STARTUPDATE			(ISC_EVENTCLASS_DNS + 58)
+#define DNS_EVENT_VERIFY			(ISC_EVENTCLASS_DNS + 59)
+#define DNS_EVENT_VERIFYDONE			(ISC_EVENTCLASS_DNS + 60)
+#define DNS_EVENT_ZONEMAINT			(ISC_EVENTCLASS_DNS + 61)
+#define DNS_EVENT_SIGNRANGE			(ISC_EVENTCLASS_DNS + 62)
+#define DNS_EVENT_SIGNDONE			(ISC_EVENTCLASS_DNS + 63)
 
 #define DNS_EVENT_FIRSTEVENT			(ISC_EVENTCLASS_DNS + 0)
 #define DNS_EVENT_LASTEVENT			(ISC_EVENTCLASS_DNS + 65535)
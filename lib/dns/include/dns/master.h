@@ -20,6 +20,7 @@
 #include <stdio.h>
 
 #include <isc/lang.h>
+#include <isc/taskpool.h>
 
 #include <dns/types.h>
 
@@ -256,6 +257,21 @@ dns_master_loadfileinc5(const char *master_file,
 			isc_mem_t *mctx, dns_masterformat_t format,
 			isc_uint32_t maxttl);
 
+isc_result_t
+dns_master_loadfileinc6(const char *master_file,
+			dns_name_t *top,
+			dns_name_t *origin,
+			dns_rdataclass_t zclass,
+			unsigned int options,
+			isc_uint32_t resign,
+			dns_rdatacallbacks_t *callbacks,
+			isc_task_t *task,
+			dns_loaddonefunc_t done, void *done_arg,
+			dns_loadctx_t **ctxp,
+			dns_masterincludecb_t include_cb, void *include_arg,
+			isc_mem_t *mctx, dns_masterformat_t format,
+			isc_uint32_t maxttl, isc_taskpool_t *taskpool);
+
 isc_result_t
 dns_master_loadstreaminc(FILE *stream,
 			 dns_name_t *top,
@@ -309,6 +325,13 @@ dns_master_loadlexerinc(isc_lex_t *lex,
  * 'resign' the number of seconds before a RRSIG expires that it should
  * be re-signed.  0 is used if not provided.
  *
+ * If 'taskpool' is not NULL, a large text file may be split at owner
+ * names into chunks which are parsed in parallel on tasks from the pool.
+ * 'callbacks->add' is still called for one rdataset at a time, but not
+ * necessarily in the order of the file nor on 'task'; 'done' is called
+ * on 'task' once every chunk has been loaded.  Files which use $INCLUDE
+ * or $DATE are not split.
+ *
  * Requires:
  *\li	'master_file' points to a valid string.
  *\li	'lexer' points to a valid lexer.
@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef DNS_QP_H
+#define DNS_QP_H 1
+
+/*! \file dns/qp.h
+ * \brief
+ * A qp-trie of domain names.
+ *
+ * A qp-trie is a radix tree which branches on one nibble of the key at
+ * a time, and which only has branch nodes where keys differ.  Each
+ * branch holds a bitmap of the nibble values present below it and a
+ * dense array of its children, so a lookup touches one small,
+ * contiguous branch per step rather than chasing left and right
+ * pointers through a red-black tree at every level of a tree of trees.
+ *
+ * Names are converted to keys whose byte order is the DNSSEC canonical
+ * order of the names: labels are taken from the root down, folded to
+ * lower case, and each label is terminated by a zero byte.  Walking the
+ * trie from left to right thus visits the names in DNSSEC order, and an
+ * ancestor of a name always has a key which is a prefix of the name's
+ * key.
+ *
+ * The interface mirrors dns_rbt_*(): the leaves of the trie are
+ * dns_rbtnode_t structures, and dns_qp_findnode() and the dns_qpchain_*()
+ * functions have the same semantics as their dns_rbt counterparts, so
+ * that the rbtdb code can be built on top of either structure (see
+ * qpdb.c).  The differences are:
+ *
+ *\li	Every node lives at the "top level": dns_qp_namefromnode() returns
+ *	the full name of a node, and dns_qpchain_current() always returns
+ *	"." as the origin.
+ *
+ *\li	The 'levels' of a chain filled in by dns_qp_findnode() are the
+ *	nodes, present in the trie, whose names are ancestors of the name
+ *	which was found.  There are no split nodes, so an ancestor is only
+ *	present if it has been added.
+ *
+ *\li	Deleting a node never leaves an empty node behind.
+ *
+ *\li	Trees cannot be serialized to map files.
+ *
+ * MP:
+ *\li	The caller must provide any required locking.
+ */
+
+#include <isc/lang.h>
+#include <isc/magic.h>
+
+#include <dns/rbt.h>
+#include <dns/types.h>
+
+ISC_LANG_BEGINDECLS
+
+/*%
+ * A chain is a cursor into the trie.  Unlike a dns_rbtnodechain_t it
+ * remembers the trie it points into, since moving it requires a fresh
+ * descent from the root.
+ */
+typedef struct dns_qpchain {
+	unsigned int		magic;
+	isc_mem_t *		mctx;
+	dns_qp_t *		qp;
+	/*%
+	 * The node the chain points to, or NULL if it points nowhere.
+	 */
+	dns_rbtnode_t *		end;
+	/*%
+	 * The ancestors of the node returned by dns_qp_findnode(), from
+	 * the root down, and how many of them there are.  level_count is
+	 * always zero; it exists so that code written for
+	 * dns_rbtnodechain_t compiles unchanged.
+	 */
+	dns_rbtnode_t *		levels[DNS_RBT_LEVELBLOCK];
+	unsigned int		level_count;
+	unsigned int		level_matches;
+} dns_qpchain_t;
+
+/*****
+ ***** Public interfaces.
+ *****/
+isc_result_t
+dns_qp_create(isc_mem_t *mctx, dns_rbtdeleter_t deleter,
+	      void *deleter_arg, dns_qp_t **qpp);
+/*%<
+ * Create an empty qp-trie.  See dns_rbt_create().
+ *
+ * Requires:
+ *\li	mctx is a pointer to a valid memory context.
+ *\li	qpp != NULL && *qpp == NULL
+ *\li	deleter_arg == NULL if deleter == NULL
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOMEMORY
+ */
+
+isc_result_t
+dns_qp_addnode(dns_qp_t *qp, const dns_name_t *name, dns_rbtnode_t **nodep);
+/*%<
+ * Add 'name' to the trie, and return its node in '*nodep'.  See
+ * dns_rbt_addnode().
+ *
+ * Requires:
+ *\li	qp is a valid qp-trie.
+ *\li	dns_name_isabsolute(name) == TRUE
+ *\li	nodep != NULL && *nodep == NULL
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS	The name was added; '*nodep' is its new node.
+ *\li	#ISC_R_EXISTS	The name was already present; '*nodep' is its node.
+ *\li	#ISC_R_NOMEMORY
+ */
+
+isc_result_t
+dns_qp_findnode(dns_qp_t *qp, const dns_name_t *name, dns_name_t *foundname,
+		dns_rbtnode_t **node, dns_qpchain_t *chain,
+		unsigned int options, dns_rbtfindcallback_t callback,
+		void *callback_arg);
+/*%<
+ * Find the node for 'name', or its deepest ancestor.  'options' and
+ * 'callback' are as for dns_rbt_findnode(): 'callback' is called for
+ * every ancestor of 'name' which has 'find_callback' set, from the root
+ * down, and stops the search if it returns anything but DNS_R_CONTINUE.
+ *
+ * If 'chain' is not NULL, its levels[] are set to the ancestors of the
+ * node returned, and it is pointed to the DNSSEC predecessor of 'name'
+ * when there is no exact match, unless #DNS_RBTFIND_NOPREDECESSOR or
+ * #DNS_RBTFIND_NOEXACT is set.
+ *
+ * Requires:
+ *\li	qp is a valid qp-trie.
+ *\li	dns_name_isabsolute(name) == TRUE
+ *\li	node != NULL && *node == NULL
+ *\li	#DNS_RBTFIND_NOEXACT and #DNS_RBTFIND_NOPREDECESSOR are mutually
+ *	exclusive.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS		Exact match
+ *\li	#DNS_R_PARTIALMATCH	Superdomain found
+ *\li	#ISC_R_NOTFOUND		No match
+ *\li	#ISC_R_NOSPACE		'foundname' is too small
+ */
+
+isc_result_t
+dns_qp_deletenode(dns_qp_t *qp, dns_rbtnode_t *node, isc_boolean_t recurse);
+/*%<
+ * Remove 'node' from the trie and free it, calling the deleter for its
+ * data.  Names below 'node' are not affected.
+ *
+ * Requires:
+ *\li	qp is a valid qp-trie.
+ *\li	'node' is in 'qp'.
+ *\li	'recurse' is ISC_FALSE.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ */
+
+void
+dns_qp_namefromnode(dns_rbtnode_t *node, dns_name_t *name);
+/*%<
+ * Set 'name' to the full name of 'node'.  The name data is not copied;
+ * see dns_rbt_namefromnode().
+ *
+ * Requires:
+ *\li	name->offsets == NULL
+ */
+
+isc_result_t
+dns_qp_fullnamefromnode(dns_rbtnode_t *node, dns_name_t *name);
+/*%<
+ * Copy the full name of 'node' into 'name'.
+ *
+ * Requires:
+ *\li	name has a dedicated buffer.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOSPACE
+ */
+
+char *
+dns_qp_formatnodename(dns_rbtnode_t *node, char *printname,
+		      unsigned int size);
+/*%<
+ * Format the full name of a node for printing.  See
+ * dns_rbt_formatnodename().
+ */
+
+unsigned int
+dns_qp_nodecount(dns_qp_t *qp);
+/*%<
+ * Return the number of names in the trie.
+ */
+
+size_t
+dns_qp_hashsize(dns_qp_t *qp);
+/*%<
+ * A qp-trie has no hash table; this always returns 0.
+ */
+
+size_t
+dns_qp_memusage(dns_qp_t *qp);
+/*%<
+ * Return the number of bytes used by the branches of the trie, not
+ * counting the nodes themselves.
+ */
+
+void
+dns_qp_destroy(dns_qp_t **qpp);
+isc_result_t
+dns_qp_destroy2(dns_qp_t **qpp, unsigned int quantum);
+/*%<
+ * Free every node in the trie, calling the deleter for its data, and
+ * then the trie itself.  If 'quantum' is not zero, at most 'quantum'
+ * nodes are freed and ISC_R_QUOTA is returned if any remain; see
+ * dns_rbt_destroy2().
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_QUOTA
+ */
+
+isc_result_t
+dns_qp_serialize_tree(FILE *file, dns_qp_t *qp,
+		      dns_rbtdatawriter_t datawriter,
+		      void *writer_arg, void *base, off_t *offset);
+isc_result_t
+dns_qp_deserialize_tree(void *base_address, size_t filesize,
+			off_t header_offset, isc_mem_t *mctx,
+			dns_rbtdeleter_t deleter, void *deleter_arg,
+			dns_rbtdatafixer_t datafixer, void *fixer_arg,
+			dns_rbtnode_t **originp, dns_qp_t **qpp);
+/*%<
+ * Map files are not supported for qp-tries; these always return
+ * ISC_R_NOTIMPLEMENTED.
+ */
+
+/*****
+ ***** Chain Functions
+ *****/
+
+void
+dns_qpchain_init(dns_qpchain_t *chain, isc_mem_t *mctx);
+void
+dns_qpchain_reset(dns_qpchain_t *chain);
+void
+dns_qpchain_invalidate(dns_qpchain_t *chain);
+/*%<
+ * Initialize, reset or invalidate a chain; see dns_rbtnodechain_init(),
+ * dns_rbtnodechain_reset() and dns_rbtnodechain_invalidate().
+ */
+
+isc_result_t
+dns_qpchain_current(dns_qpchain_t *chain, dns_name_t *name,
+		    dns_name_t *origin, dns_rbtnode_t **node);
+/*%<
+ * Provide the name, origin and node to which the chain is currently
+ * pointed.  'name' is the full name of the node, made relative to the
+ * root, and 'origin' is always ".".
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOTFOUND		The chain does not point to any node.
+ */
+
+isc_result_t
+dns_qpchain_first(dns_qpchain_t *chain, dns_qp_t *qp, dns_name_t *name,
+		  dns_name_t *origin);
+isc_result_t
+dns_qpchain_last(dns_qpchain_t *chain, dns_qp_t *qp, dns_name_t *name,
+		 dns_name_t *origin);
+/*%<
+ * Point the chain to the first or last name of the trie in DNSSEC order.
+ *
+ * Returns:
+ *\li	#DNS_R_NEWORIGIN	The chain was set, as were 'name' and
+ *				'origin' if not NULL.
+ *\li	#ISC_R_NOTFOUND		The trie is empty.
+ */
+
+isc_result_t
+dns_qpchain_prev(dns_qpchain_t *chain, dns_name_t *name, dns_name_t *origin);
+isc_result_t
+dns_qpchain_next(dns_qpchain_t *chain, dns_name_t *name, dns_name_t *origin);
+/*%<
+ * Point the chain to the DNSSEC predecessor or successor of the node it
+ * currently points to.  The origin never changes, so 'origin' is not
+ * set.
+ *
+ * Requires:
+ *\li	The chain points to a node which is still in the trie.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOMORE		There is no predecessor or successor; the
+ *				chain is unchanged.
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* DNS_QP_H */
@@ -174,6 +174,8 @@ typedef isc_result_t (*dns_rbtfindcallback_t)(dns_rbtnode_t *node,
 
 typedef isc_result_t (*dns_rbtdatawriter_t)(FILE *file,
 					    unsigned char *data,
+					    void *base,
+					    dns_rbtnode_t *node,
 					    void *arg,
 					    isc_uint64_t *crc);
 
@@ -729,10 +731,17 @@ dns_rbt_serialize_align(off_t target);
 isc_result_t
 dns_rbt_serialize_tree(FILE *file, dns_rbt_t *rbt,
 		       dns_rbtdatawriter_t datawriter,
-		       void *writer_arg, off_t *offset);
+		       void *writer_arg, void *base, off_t *offset);
 /*%<
  * Write out the RBT structure and its data to a file.
  *
+ * The image is laid out to be mapped with the start of the file at
+ * 'base': every pointer in it, including the node hash table, holds the
+ * address it will have there.  'datawriter' is called to write the data
+ * of each node, with 'base' and the address 'node' will have in the
+ * image, and must write its own pointers the same way.  When 'base' is
+ * NULL the pointers are simply offsets into the file.
+ *
  * Notes:
  * \li  The file must be an actual file which allows seek() calls, so it cannot
  *      be a stream.  Returns ISC_R_INVALIDFILE if not.
@@ -747,6 +756,15 @@ dns_rbt_deserialize_tree(void *base_address, size_t filesize,
 /*%<
  * Read a RBT structure and its data from a file.
  *
+ * If the file is mapped at the address it was written for, the tree is
+ * used where it lies: only the header and the root node are checked, so
+ * this takes the same time however large the tree is, and 'datafixer'
+ * is not called.  The rest of the image is trusted, as a map file is
+ * only expected to have been written by dns_rbt_serialize_tree().
+ * Otherwise every pointer in the image is relocated and the whole image
+ * is checked against the checksum written with it, calling 'datafixer'
+ * for each node which has data.
+ *
  * If 'originp' is not NULL, then it is pointed to the root node of the RBT.
  *
  * Notes:
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef DNS_RESPCACHE_H
+#define DNS_RESPCACHE_H 1
+
+/*****
+ ***** Module Info
+ *****/
+
+/*! \file dns/respcache.h
+ * \brief
+ * Defines dns_respcache_t, the "response cache" object.
+ *
+ * Notes:
+ *\li	A response cache holds fully rendered wire format responses to
+ *	queries answered from authoritative zone data, so that a repeat
+ *	of the same question can be answered by copying the response and
+ *	patching its message ID, without database lookups or name
+ *	compression.
+ *
+ *\li	Entries are keyed on the exact query name (including its case,
+ *	since the question is echoed in the response), the query type,
+ *	and caller-defined 'flags' describing every other property of
+ *	the query that influences the response (EDNS buffer size, DO
+ *	bit, ...).
+ *
+ *\li	Each entry records the generation of the zone database version
+ *	it was rendered from (see dns_db_getgeneration()).  A lookup
+ *	supplies the generation of the current version; entries from any
+ *	other version are discarded, so a zone update or reload
+ *	invalidates its responses without any explicit flushing.
+ *
+ *\li	The cache is a fixed size set-associative table.  When a set is
+ *	full, entries that have not been used since the last time the
+ *	set was swept are replaced first.
+ *
+ * MP:
+ *\li	The cache is locked per set, and is safe for use by multiple
+ *	threads.
+ */
+
+/***
+ ***	Imports
+ ***/
+
+#include <isc/lang.h>
+
+#include <dns/types.h>
+
+ISC_LANG_BEGINDECLS
+
+/***
+ ***	Functions
+ ***/
+
+isc_result_t
+dns_respcache_create(isc_mem_t *mctx, unsigned int size,
+		     dns_respcache_t **rcp);
+/*%
+ * Create a response cache able to hold about 'size' responses and store
+ * it in '*rcp'.
+ *
+ * Requires:
+ * \li	mctx != NULL
+ * \li	size > 0
+ * \li	rcp != NULL && *rcp == NULL
+ */
+
+void
+dns_respcache_destroy(dns_respcache_t **rcp);
+/*%
+ * Flush and then free the response cache in '*rcp'.  '*rcp' is set to
+ * NULL on return.
+ *
+ * Requires:
+ * \li	'*rcp' to be a valid response cache.
+ */
+
+isc_result_t
+dns_respcache_find(dns_respcache_t *rc, const dns_name_t *name,
+		   dns_rdatatype_t type, isc_uint32_t flags,
+		   isc_uint64_t generation, isc_buffer_t *target,
+		   unsigned int *attributesp);
+/*%
+ * Look for a response to the query for 'name', 'type' and 'flags'
+ * rendered from the zone database version 'generation'.  If one is
+ * found, copy it to 'target' and set '*attributesp' to the
+ * attributes it was added with.
+ *
+ * A cached response for the same query rendered from any other
+ * version is removed.
+ *
+ * Requires:
+ * \li	'rc' to be a valid response cache.
+ * \li	'name' to be a valid absolute name.
+ * \li	'target' to be a valid buffer.
+ * \li	'attributesp' != NULL
+ *
+ * Returns:
+ * \li	#ISC_R_SUCCESS
+ * \li	#ISC_R_NOTFOUND
+ * \li	#ISC_R_NOSPACE	- the response does not fit in 'target'.
+ */
+
+void
+dns_respcache_add(dns_respcache_t *rc, const dns_name_t *name,
+		  dns_rdatatype_t type, isc_uint32_t flags,
+		  isc_uint64_t generation, const isc_region_t *response,
+		  unsigned int attributes);
+/*%
+ * Add the rendered 'response' to the query for 'name', 'type' and
+ * 'flags', answered from the zone database version 'generation',
+ * replacing any existing entry for the same query.  'attributes' is
+ * stored with the response and returned by dns_respcache_find().
+ *
+ * Failure to allocate memory is silently ignored.
+ *
+ * Requires:
+ * \li	'rc' to be a valid response cache.
+ * \li	'name' to be a valid absolute name.
+ * \li	'response' != NULL and at least a message header long.
+ */
+
+void
+dns_respcache_flush(dns_respcache_t *rc);
+/*%
+ * Remove all responses from 'rc'.
+ *
+ * Requires:
+ * \li	'rc' to be a valid response cache.
+ */
+
+unsigned int
+dns_respcache_count(dns_respcache_t *rc);
+/*%
+ * Return the number of responses in 'rc'.
+ *
+ * Requires:
+ * \li	'rc' to be a valid response cache.
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* DNS_RESPCACHE_H */
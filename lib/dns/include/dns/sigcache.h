@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef DNS_SIGCACHE_H
+#define DNS_SIGCACHE_H 1
+
+/*****
+ ***** Module Info
+ *****/
+
+/*! \file dns/sigcache.h
+ * \brief
+ * Defines dns_sigcache_t, a cache of signatures known to be good.
+ *
+ * Notes:
+ *\li	A signature cache remembers digests of (RRSIG, DNSKEY, RRset)
+ *	tuples whose signature has been verified, so that the same
+ *	signature need not be checked again with a public key operation
+ *	when the RRset is seen again: after it expires from the cache,
+ *	in another view, or as part of a DS or DNSKEY chain shared by
+ *	many zones.  Whether a signature is good over some data with
+ *	some key never changes, so entries need no expiry; temporal
+ *	validity and key authorization are still checked by the caller
+ *	each time.
+ *
+ *\li	The cache has a fixed number of entries, in sets of four.  A
+ *	new entry replaces the oldest one in its set.
+ *
+ * MP:
+ *\li	The cache is locked internally and may be used by any number of
+ *	threads at once.
+ */
+
+/***
+ ***	Imports
+ ***/
+
+#include <isc/lang.h>
+#include <isc/sha2.h>
+
+#include <dns/types.h>
+
+/*%
+ * Length of the digests the cache is keyed on.
+ */
+#define DNS_SIGCACHE_DIGESTLENGTH	ISC_SHA256_DIGESTLENGTH
+
+ISC_LANG_BEGINDECLS
+
+/***
+ ***	Functions
+ ***/
+
+isc_result_t
+dns_sigcache_create(isc_mem_t *mctx, unsigned int size,
+		    dns_sigcache_t **cachep);
+/*%
+ * Create a signature cache holding at least 'size' digests and store
+ * it in '*cachep'.
+ *
+ * Requires:
+ * \li	mctx != NULL
+ * \li	size > 0
+ * \li	cachep != NULL && *cachep == NULL
+ *
+ * Returns:
+ * \li	#ISC_R_SUCCESS
+ * \li	#ISC_R_NOMEMORY
+ */
+
+void
+dns_sigcache_destroy(dns_sigcache_t **cachep);
+/*%
+ * Free the signature cache in '*cachep' and set '*cachep' to NULL.
+ *
+ * Requires:
+ * \li	'*cachep' to be a valid signature cache which no other thread is
+ *	using.
+ */
+
+isc_boolean_t
+dns_sigcache_find(dns_sigcache_t *cache, const unsigned char *digest);
+/*%
+ * Return ISC_TRUE if 'digest' is in 'cache'.
+ *
+ * Requires:
+ * \li	'cache' to be a valid signature cache.
+ * \li	'digest' points to #DNS_SIGCACHE_DIGESTLENGTH bytes.
+ */
+
+void
+dns_sigcache_add(dns_sigcache_t *cache, const unsigned char *digest);
+/*%
+ * Add 'digest' to 'cache', replacing the oldest entry in its set.
+ *
+ * Requires:
+ * \li	'cache' to be a valid signature cache.
+ * \li	'digest' points to #DNS_SIGCACHE_DIGESTLENGTH bytes.
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* DNS_SIGCACHE_H */
@@ -74,8 +74,10 @@ enum {
 	dns_dnssecstats_downcase = 1,
 	dns_dnssecstats_wildcard = 2,
 	dns_dnssecstats_fail = 3,
+	dns_dnssecstats_cachehit = 4,
+	dns_dnssecstats_cachemiss = 5,
 
-	dns_dnssecstats_max = 4,
+	dns_dnssecstats_max = 6,
 
 	/*%
 	 * Zone statistics counters.
@@ -535,6 +537,15 @@ dns_rdatatypestats_create(isc_mem_t *mctx, dns_stats_t **statsp);
  *\li	anything else	-- failure
  */
 
+isc_result_t
+dns_rdatatypestats_create2(isc_mem_t *mctx, dns_stats_t **statsp,
+			   unsigned int options);
+/*%<
+ * Like dns_rdatatypestats_create(), but 'options' are passed to
+ * isc_stats_create2(); use ISC_STATSCREATE_SHARDED for counters which
+ * are updated for every query.
+ */
+
 isc_result_t
 dns_rdatasetstats_create(isc_mem_t *mctx, dns_stats_t **statsp);
 /*%<
@@ -554,7 +565,8 @@ dns_rdatasetstats_create(isc_mem_t *mctx, dns_stats_t **statsp);
 isc_result_t
 dns_opcodestats_create(isc_mem_t *mctx, dns_stats_t **statsp);
 /*%<
- * Create a statistics counter structure per opcode.
+ * Create a statistics counter structure per opcode.  The counters are
+ * sharded (see isc_stats_create2()).
  *
  * Requires:
  *\li	'mctx' must be a valid memory context.
@@ -570,7 +582,8 @@ dns_opcodestats_create(isc_mem_t *mctx, dns_stats_t **statsp);
 isc_result_t
 dns_rcodestats_create(isc_mem_t *mctx, dns_stats_t **statsp);
 /*%<
- * Create a statistics counter structure per assigned rcode.
+ * Create a statistics counter structure per assigned rcode.  The counters
+ * are sharded (see isc_stats_create2()).
  *
  * Requires:
  *\li	'mctx' must be a valid memory context.
@@ -108,6 +108,7 @@ typedef struct dns_order			dns_order_t;
 typedef struct dns_peer				dns_peer_t;
 typedef struct dns_peerlist			dns_peerlist_t;
 typedef struct dns_portlist			dns_portlist_t;
+typedef struct dns_qp				dns_qp_t;
 typedef struct dns_rbt				dns_rbt_t;
 typedef isc_uint16_t				dns_rcode_t;
 typedef struct dns_rdata			dns_rdata_t;
@@ -121,9 +122,11 @@ typedef isc_uint16_t				dns_rdatatype_t;
 typedef struct dns_request			dns_request_t;
 typedef struct dns_requestmgr			dns_requestmgr_t;
 typedef struct dns_resolver			dns_resolver_t;
+typedef struct dns_respcache			dns_respcache_t;
 typedef struct dns_sdbimplementation		dns_sdbimplementation_t;
 typedef isc_uint8_t				dns_secalg_t;
 typedef isc_uint8_t				dns_secproto_t;
+typedef struct dns_sigcache			dns_sigcache_t;
 typedef struct dns_signature			dns_signature_t;
 typedef struct dns_sortlist_arg			dns_sortlist_arg_t;
 typedef struct dns_ssurule			dns_ssurule_t;
@@ -138,6 +141,7 @@ typedef struct dns_tsigkey			dns_tsigkey_t;
 typedef isc_uint32_t				dns_ttl_t;
 typedef struct dns_update_state			dns_update_state_t;
 typedef struct dns_validator			dns_validator_t;
+typedef struct dns_verifypool			dns_verifypool_t;
 typedef struct dns_view				dns_view_t;
 typedef ISC_LIST(dns_view_t)			dns_viewlist_t;
 typedef struct dns_zone				dns_zone_t;
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef DNS_VERIFYPOOL_H
+#define DNS_VERIFYPOOL_H 1
+
+/*****
+ ***** Module Info
+ *****/
+
+/*! \file dns/verifypool.h
+ * \brief
+ * A pool of tasks which verify DNSSEC signatures on behalf of other tasks.
+ *
+ * Checking an RRSIG is a public key operation and, for RSA and
+ * ECDSA keys, by far the most expensive thing a validating resolver
+ * does with a response.  The validator runs on the task of the fetch
+ * it is validating for, so a response carrying many signatures holds
+ * up every other fetch sharing that task while it is checked.
+ *
+ * A verify pool has a task manager of its own, with as many worker
+ * threads as it is created with, and a task for each of them.  A
+ * verification request is sent as an event to one of the tasks; the
+ * signature is checked there with dns_dnssec_verify3(), and the same
+ * event is then sent back to the requesting task with the result.
+ * The pool's tasks have a large quantum, so that a worker which finds
+ * many requests queued checks them in one batch.
+ *
+ * MP:
+ *\li	dns_verifypool_verify() may be called from any task.
+ */
+
+/***
+ *** Imports
+ ***/
+
+#include <isc/event.h>
+#include <isc/lang.h>
+
+#include <dns/fixedname.h>
+#include <dns/rdata.h>
+#include <dns/types.h>
+
+#include <dst/dst.h>
+
+/*%
+ * The event sent back when a verification is complete.  The fields
+ * after 'wild' are private to the pool.
+ */
+typedef struct dns_verifyevent {
+	ISC_EVENT_COMMON(struct dns_verifyevent);
+	isc_result_t		result;		/*%< of dns_dnssec_verify3() */
+	isc_boolean_t		ignoredtime;	/*%< expired but accepted */
+	dns_fixedname_t		wild;		/*%< if DNS_R_FROMWILDCARD */
+	const dns_name_t *	name;
+	dns_rdataset_t *	rdataset;
+	dst_key_t *		key;
+	dns_rdata_t		sigrdata;
+	isc_boolean_t		acceptexpired;
+	unsigned int		maxbits;
+	isc_mem_t *		mctx;
+	isc_task_t *		task;
+	isc_taskaction_t	action;
+	void *			arg;
+} dns_verifyevent_t;
+
+ISC_LANG_BEGINDECLS
+
+isc_result_t
+dns_verifypool_create(isc_mem_t *mctx, unsigned int workers,
+		      dns_verifypool_t **poolp);
+/*%<
+ * Create a verify pool with 'workers' worker threads.
+ *
+ * Requires:
+ *\li	'mctx' is a valid memory context.
+ *\li	'workers' is not zero.
+ *\li	'poolp' is not NULL and '*poolp' is NULL.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOMEMORY
+ *\li	Other errors from creating the task manager or its tasks.
+ */
+
+void
+dns_verifypool_attach(dns_verifypool_t *source, dns_verifypool_t **targetp);
+/*%<
+ * Attach '*targetp' to 'source'.
+ */
+
+void
+dns_verifypool_detach(dns_verifypool_t **poolp);
+/*%<
+ * Detach '*poolp' from its pool.  When the last reference goes away,
+ * the pool's tasks are detached and its task manager is destroyed,
+ * which waits for any verifications still queued to be completed and
+ * sent back.  The last reference must therefore not be dropped by a
+ * task of the pool itself.
+ */
+
+isc_result_t
+dns_verifypool_verify(dns_verifypool_t *pool, const dns_name_t *name,
+		      dns_rdataset_t *rdataset, dst_key_t *key,
+		      isc_boolean_t acceptexpired, unsigned int maxbits,
+		      isc_mem_t *mctx, dns_rdata_t *sigrdata,
+		      isc_task_t *task, isc_taskaction_t action, void *arg);
+/*%<
+ * Verify the signature 'sigrdata' over 'rdataset', owned by 'name',
+ * with 'key' on one of the pool's tasks, as dns_dnssec_verify3() with
+ * 'maxbits' would.  If 'acceptexpired' is true and the signature is
+ * only wrong because it has expired or is not yet valid, it is checked
+ * again ignoring its validity period and 'ignoredtime' is set in the
+ * completion event.
+ *
+ * When the check is complete a #DNS_EVENT_VERIFYDONE event of type
+ * dns_verifyevent_t is sent to 'task', with 'action' and 'arg'.  The
+ * receiver must free it with isc_event_free().
+ *
+ * 'name', 'rdataset', 'key' and the data 'sigrdata' refers to must
+ * stay valid, and 'rdataset' must not be used by the caller, until the
+ * event has been delivered.  'sigrdata' itself is copied.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS	The event will be sent.
+ *\li	#ISC_R_NOMEMORY
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* DNS_VERIFYPOOL_H */
@@ -104,6 +104,7 @@ struct dns_view {
 	isc_stats_t *			resstats;
 	dns_stats_t *			resquerystats;
 	isc_boolean_t			cacheshared;
+	dns_verifypool_t *		verifypool;
 
 	/* Configurable data. */
 	dns_tsig_keyring_t *		statickeys;
@@ -180,6 +181,7 @@ struct dns_view {
 	dns_dlzdblist_t 		dlz_unsearched;
 	isc_uint32_t			fail_ttl;
 	dns_badcache_t			*failcache;
+	dns_respcache_t			*respcache;
 
 	/*
 	 * Configurable data for server use only,
@@ -1092,6 +1094,18 @@ dns_view_setresquerystats(dns_view_t *view, dns_stats_t *stats);
  *\li	stats is a valid statistics created by dns_rdatatypestats_create().
  */
 
+void
+dns_view_setverifypool(dns_view_t *view, dns_verifypool_t *pool);
+/*%<
+ * Have the validators of 'view' check signatures on the tasks of
+ * 'pool' rather than on their own tasks.
+ *
+ * Requires:
+ * \li	'view' is valid and is not frozen.
+ *
+ *\li	'pool' is a valid verify pool.
+ */
+
 void
 dns_view_getresquerystats(dns_view_t *view, dns_stats_t **statsp);
 /*%<
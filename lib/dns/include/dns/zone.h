@@ -46,6 +46,18 @@ typedef enum {
 	dns_zonestat_full
 } dns_zonestat_level_t;
 
+/*%
+ * Progress of the current, or else the last, run of zone signing
+ * started by dns_zone_signwithkey().
+ */
+typedef struct dns_signingstats {
+	isc_boolean_t	active;		/*%< a run is in progress */
+	isc_uint64_t	nodes;		/*%< names visited */
+	isc_uint64_t	signatures;	/*%< signatures generated */
+	isc_uint64_t	usec;		/*%< time taken so far */
+	unsigned int	threads;	/*%< signing threads, 0 if none */
+} dns_signingstats_t;
+
 #define DNS_ZONEOPT_SERVERS	  0x00000001U	/*%< perform server checks */
 #define DNS_ZONEOPT_PARENTS	  0x00000002U	/*%< perform parent checks */
 #define DNS_ZONEOPT_CHILDREN	  0x00000004U	/*%< perform child checks */
@@ -1877,6 +1889,42 @@ dns_zonemgr_getcount(dns_zonemgr_t *zmgr, int state);
  *\li	'state' to be a valid DNS_ZONESTATE_ constant.
  */
 
+void
+dns_zonemgr_getschedstats(dns_zonemgr_t *zmgr, isc_uint64_t *wakeups,
+			  isc_uint64_t *dispatched, isc_uint64_t *lateusec);
+/*%<
+ *	Get zone maintenance scheduling statistics: the number of times
+ *	the zone manager's scheduling timer has fired, the number of
+ *	zones whose maintenance it has started, and the total number
+ *	of microseconds by which those zones were late.
+ *
+ * Requires:
+ *\li	'zmgr' to be a valid zone manager.
+ *\li	'wakeups', 'dispatched' and 'lateusec' to be non NULL.
+ */
+
+isc_result_t
+dns_zonemgr_setsigningthreads(dns_zonemgr_t *zmgr, unsigned int workers);
+/*%<
+ *	Sign zones in bulk using a pool of 'workers' threads, or
+ *	incrementally on the zone's own task if 'workers' is zero (the
+ *	default).  In bulk mode each pass of dns_zone_signwithkey()
+ *	signing queues up to 1024 signatures per worker and then
+ *	computes them on the pool before committing them together;
+ *	the zone's task waits while this is done.  The per-quantum
+ *	limits set by dns_zone_setnodes() and dns_zone_setsignatures()
+ *	do not apply.
+ *
+ * Requires:
+ *\li	'zmgr' to be a valid zone manager.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOMEMORY
+ *\li	#ISC_R_NOTIMPLEMENTED	'workers' is non zero and threads are
+ *				not supported.
+ */
+
 void
 dns_zonemgr_unreachableadd(dns_zonemgr_t *zmgr, isc_sockaddr_t *remote,
 			   isc_sockaddr_t *local, isc_time_t *now);
@@ -2144,6 +2192,16 @@ dns_zone_getsignatures(dns_zone_t *zone);
  * Get the number of signatures that will be generated per quantum.
  */
 
+void
+dns_zone_getsigningstats(dns_zone_t *zone, dns_signingstats_t *stats);
+/*%<
+ * Get the progress of the current or last run of signing the zone.
+ *
+ * Requires:
+ *\li	'zone' to be a valid zone.
+ *\li	'stats' to be non NULL.
+ */
+
 isc_result_t
 dns_zone_signwithkey(dns_zone_t *zone, dns_secalg_t algorithm,
 		     isc_uint16_t keyid, isc_boolean_t deleteit);
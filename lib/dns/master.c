@@ -13,6 +13,7 @@
 #include <config.h>
 
 #include <isc/event.h>
+#include <isc/file.h>
 #include <isc/lex.h>
 #include <isc/magic.h>
 #include <isc/mem.h>
@@ -22,6 +23,7 @@
 #include <isc/stdtime.h>
 #include <isc/string.h>
 #include <isc/task.h>
+#include <isc/taskpool.h>
 #include <isc/util.h>
 
 #include <dns/callbacks.h>
@@ -76,6 +78,14 @@
  */
 #define TOKENSIZ (8*1024)
 
+/*%
+ * A text file which is loaded incrementally with a task pool is split
+ * into chunks of at least SPLITMIN bytes, at most one per task in the
+ * pool and no more than MAXCHUNKS, which are parsed in parallel.
+ */
+#define SPLITMIN (1024*1024)
+#define MAXCHUNKS 64
+
 /*%
  * Buffers sizes for $GENERATE.
  */
@@ -87,6 +97,7 @@
 typedef ISC_LIST(dns_rdatalist_t) rdatalist_head_t;
 
 typedef struct dns_incctx dns_incctx_t;
+typedef struct dns_loadchunk dns_loadchunk_t;
 
 /*%
  * Master file load state.
@@ -145,6 +156,37 @@ struct dns_loadctx {
 
 	dns_masterincludecb_t	include_cb;
 	void			*include_arg;
+
+	/*
+	 * Members used when a text file is split (see split_text()).
+	 * The context returned to the caller owns the text and loads
+	 * the first chunk; each of the others is loaded by a child
+	 * context, which refers to it as its 'parent'.
+	 */
+	dns_loadctx_t		*parent;
+	unsigned int		chunkno;
+	isc_buffer_t		chunkbuf;
+	char			*text;
+	size_t			textlen;
+	dns_loadchunk_t		*chunks;
+	unsigned int		nchunks;
+	/* locked by lock */
+	unsigned int		pending;
+	/* serializes the callbacks->add() calls of all the chunks */
+	isc_mutex_t		addlock;
+};
+
+/*%
+ * Where a chunk of a split text file starts, and the state the parser
+ * would be in there.
+ */
+struct dns_loadchunk {
+	size_t			start;
+	unsigned long		line;
+	isc_uint32_t		ttl;
+	isc_boolean_t		ttl_known;
+	isc_result_t		result;
+	dns_fixedname_t		origin;
 };
 
 struct dns_incctx {
@@ -213,6 +255,13 @@ task_send(dns_loadctx_t *lctx);
 static void
 loadctx_destroy(dns_loadctx_t *lctx);
 
+static void
+chunk_finished(dns_loadctx_t *lctx, unsigned int chunkno,
+	       isc_result_t result, isc_boolean_t ontask);
+
+static void
+chunk_done(void *arg, isc_result_t result);
+
 #define GETTOKENERR(lexer, options, token, eol, err) \
 	do { \
 		result = gettoken(lexer, options, token, eol, callbacks); \
@@ -459,6 +508,15 @@ loadctx_destroy(dns_loadctx_t *lctx) {
 
 	if (lctx->task != NULL)
 		isc_task_detach(&lctx->task);
+	if (lctx->text != NULL)
+		isc_mem_put(lctx->mctx, lctx->text, lctx->textlen);
+	if (lctx->chunks != NULL) {
+		DESTROYLOCK(&lctx->addlock);
+		isc_mem_put(lctx->mctx, lctx->chunks,
+			    MAXCHUNKS * sizeof(*lctx->chunks));
+	}
+	if (lctx->parent != NULL)
+		dns_loadctx_detach(&lctx->parent);
 	DESTROYLOCK(&lctx->lock);
 	mctx = NULL;
 	isc_mem_attach(lctx->mctx, &mctx);
@@ -615,6 +673,13 @@ loadctx_create(dns_masterformat_t format, isc_mem_t *mctx,
 	lctx->mctx = NULL;
 	isc_mem_attach(mctx, &lctx->mctx);
 	lctx->references = 1;			/* Implicit attach. */
+	lctx->parent = NULL;
+	lctx->chunkno = 0;
+	lctx->text = NULL;
+	lctx->textlen = 0;
+	lctx->chunks = NULL;
+	lctx->nchunks = 0;
+	lctx->pending = 0;
 	lctx->magic = DNS_LCTX_MAGIC;
 	*lctxp = lctx;
 	return (ISC_R_SUCCESS);
@@ -1010,6 +1075,317 @@ openfile_text(dns_loadctx_t *lctx, const char *master_file) {
 	return (isc_lex_openfile(lctx->lex, master_file));
 }
 
+/*
+ * Get the token which follows the directive at the start of 'text',
+ * skipping the rest of the line if it is not a directive we need.
+ */
+static isc_boolean_t
+directive_arg(const char *text, size_t len, const char *directive,
+	      isc_textregion_t *arg)
+{
+	size_t n = strlen(directive), i;
+
+	if (len <= n || strncasecmp(text, directive, n) != 0 ||
+	    (text[n] != ' ' && text[n] != '\t'))
+		return (ISC_FALSE);
+	for (i = n; i < len && (text[i] == ' ' || text[i] == '\t'); i++)
+		;
+	DE_CONST(text + i, arg->base);
+	for (; i < len; i++) {
+		if (text[i] == ' ' || text[i] == '\t' || text[i] == ';' ||
+		    text[i] == '\r' || text[i] == '\n' || text[i] == '"' ||
+		    text[i] == '(' || text[i] == ')')
+			break;
+		if (text[i] == '\\')
+			i++;
+	}
+	if (i > len)
+		i = len;
+	arg->length = (unsigned int)(text + i - arg->base);
+	return (ISC_TF(arg->length != 0));
+}
+
+/*
+ * Find where the text of a master file could be split into chunks of
+ * about 'chunksize' bytes.  A chunk may only start at a line which
+ * begins with an owner name, outside parentheses, and only once a
+ * default TTL is known, so that it can be parsed given just the origin
+ * and default TTL in force there, which are recorded with it.
+ *
+ * Returns ISC_R_NOTFOUND if the text cannot be split, for instance
+ * because it uses $INCLUDE or $DATE; the file will then be loaded as
+ * usual, which also takes care of reporting any errors.
+ */
+static isc_result_t
+scan_text(dns_loadctx_t *lctx, size_t chunksize, unsigned int maxchunks) {
+	const char *text = lctx->text;
+	size_t len = lctx->textlen, pos = 0, next = chunksize;
+	unsigned long line = 1;
+	unsigned int depth = 0, n = 1;
+	isc_uint32_t ttl = lctx->default_ttl;
+	isc_boolean_t ttl_known = lctx->default_ttl_known;
+	dns_fixedname_t forigin, fname;
+	dns_name_t *origin, *name;
+	dns_loadchunk_t *chunk;
+	isc_textregion_t arg;
+	isc_buffer_t b;
+	isc_result_t result;
+	char c;
+
+	dns_fixedname_init(&forigin);
+	origin = dns_fixedname_name(&forigin);
+	RUNTIME_CHECK(dns_name_copy(lctx->inc->origin, origin, NULL)
+		      == ISC_R_SUCCESS);
+	dns_fixedname_init(&fname);
+	name = dns_fixedname_name(&fname);
+
+	chunk = &lctx->chunks[0];
+	chunk->start = 0;
+	chunk->line = 1;
+	chunk->ttl = ttl;
+	chunk->ttl_known = ttl_known;
+	chunk->result = ISC_R_SUCCESS;
+	dns_fixedname_init(&chunk->origin);
+	RUNTIME_CHECK(dns_name_copy(origin, dns_fixedname_name(&chunk->origin),
+				    NULL) == ISC_R_SUCCESS);
+
+	while (pos < len) {
+		/*
+		 * We are at the start of a line, outside parentheses.
+		 */
+		c = text[pos];
+		if (c == '$') {
+			if (directive_arg(text + pos, len - pos, "$ORIGIN",
+					  &arg))
+			{
+				isc_buffer_init(&b, arg.base, arg.length);
+				isc_buffer_add(&b, arg.length);
+				result = dns_name_fromtext(name, &b, origin,
+							   0, NULL);
+				if (result != ISC_R_SUCCESS)
+					return (ISC_R_NOTFOUND);
+				RUNTIME_CHECK(dns_name_copy(name, origin, NULL)
+					      == ISC_R_SUCCESS);
+			} else if (directive_arg(text + pos, len - pos,
+						 "$TTL", &arg))
+			{
+				result = dns_ttl_fromtext(&arg, &ttl);
+				if (result != ISC_R_SUCCESS)
+					return (ISC_R_NOTFOUND);
+				if (ttl > 0x7fffffffUL)
+					ttl = 0;
+				ttl_known = ISC_TRUE;
+			} else if (!directive_arg(text + pos, len - pos,
+						  "$GENERATE", &arg))
+				return (ISC_R_NOTFOUND);
+		} else if (c != ' ' && c != '\t' && c != '\r' &&
+			   c != '\n' && c != ';' && ttl_known &&
+			   pos >= next && n < maxchunks)
+		{
+			chunk = &lctx->chunks[n++];
+			chunk->start = pos;
+			chunk->line = line;
+			chunk->ttl = ttl;
+			chunk->ttl_known = ttl_known;
+			chunk->result = ISC_R_SUCCESS;
+			dns_fixedname_init(&chunk->origin);
+			RUNTIME_CHECK(dns_name_copy(origin,
+					dns_fixedname_name(&chunk->origin),
+					NULL) == ISC_R_SUCCESS);
+			next = pos + chunksize;
+		}
+
+		/*
+		 * Find the start of the next line.
+		 */
+		while (pos < len) {
+			c = text[pos++];
+			if (c == '\\') {
+				if (pos < len && text[pos++] == '\n')
+					line++;
+			} else if (c == '"') {
+				while (pos < len && text[pos] != '"') {
+					if (text[pos] == '\\')
+						pos++;
+					else if (text[pos] == '\n')
+						line++;
+					pos++;
+				}
+				pos++;
+			} else if (c == ';') {
+				while (pos < len && text[pos] != '\n')
+					pos++;
+			} else if (c == '(') {
+				depth++;
+			} else if (c == ')') {
+				if (depth > 0)
+					depth--;
+			} else if (c == '\n') {
+				line++;
+				if (depth == 0)
+					break;
+			}
+		}
+	}
+
+	if (n < 2)
+		return (ISC_R_NOTFOUND);
+	lctx->nchunks = n;
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Open 'master_file' to be loaded by 'lctx', splitting it into chunks
+ * to be loaded in parallel if it is a large enough text file.  The
+ * file is read into memory and the first chunk is opened with 'lctx';
+ * start_chunks() starts loading the others once 'lctx' is running.
+ */
+static isc_result_t
+split_text(dns_loadctx_t *lctx, const char *master_file,
+	   isc_taskpool_t *taskpool)
+{
+	isc_result_t result;
+	unsigned int maxchunks;
+	FILE *f = NULL;
+	off_t size;
+	size_t chunksize;
+
+	if (lctx->format != dns_masterformat_text || taskpool == NULL ||
+	    (lctx->options & DNS_MASTER_AGETTL) != 0)
+		return ((lctx->openfile)(lctx, master_file));
+
+	result = isc_file_getsize(master_file, &size);
+	if (result != ISC_R_SUCCESS)
+		return ((lctx->openfile)(lctx, master_file));
+	maxchunks = ISC_MIN(isc_taskpool_size(taskpool), MAXCHUNKS);
+	if (size / SPLITMIN < 2 || maxchunks < 2 ||
+	    (isc_uint64_t)size != (size_t)size)
+		return ((lctx->openfile)(lctx, master_file));
+	if (size / SPLITMIN < maxchunks)
+		maxchunks = (unsigned int)(size / SPLITMIN);
+	chunksize = (size_t)size / maxchunks;
+
+	lctx->textlen = (size_t)size;
+	lctx->text = isc_mem_get(lctx->mctx, lctx->textlen);
+	if (lctx->text == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup;
+	}
+	result = isc_stdio_open(master_file, "r", &f);
+	if (result == ISC_R_SUCCESS) {
+		result = isc_stdio_read(lctx->text, 1, lctx->textlen, f, NULL);
+		(void)isc_stdio_close(f);
+	}
+	if (result != ISC_R_SUCCESS)
+		goto cleanup;
+
+	lctx->chunks = isc_mem_get(lctx->mctx,
+				   MAXCHUNKS * sizeof(*lctx->chunks));
+	if (lctx->chunks == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup;
+	}
+	result = scan_text(lctx, chunksize, maxchunks);
+	if (result == ISC_R_SUCCESS)
+		result = isc_mutex_init(&lctx->addlock);
+	if (result != ISC_R_SUCCESS) {
+		isc_mem_put(lctx->mctx, lctx->chunks,
+			    MAXCHUNKS * sizeof(*lctx->chunks));
+		lctx->chunks = NULL;
+		lctx->nchunks = 0;
+		goto cleanup;
+	}
+
+	isc_buffer_init(&lctx->chunkbuf, lctx->text, lctx->chunks[1].start);
+	isc_buffer_add(&lctx->chunkbuf, lctx->chunks[1].start);
+	result = isc_lex_openbuffer(lctx->lex, &lctx->chunkbuf);
+	if (result == ISC_R_SUCCESS)
+		result = isc_lex_setsourcename(lctx->lex, master_file);
+	if (result != ISC_R_SUCCESS)
+		return (result);
+	lctx->pending = lctx->nchunks;
+	return (ISC_R_SUCCESS);
+
+ cleanup:
+	/*
+	 * Fall back to loading the file as usual.
+	 */
+	if (lctx->text != NULL) {
+		isc_mem_put(lctx->mctx, lctx->text, lctx->textlen);
+		lctx->text = NULL;
+	}
+	lctx->textlen = 0;
+	if (result == ISC_R_NOMEMORY)
+		return (result);
+	return ((lctx->openfile)(lctx, master_file));
+}
+
+/*
+ * Start loading each chunk of a split text file but the first with a
+ * child context on a task from 'taskpool'.
+ */
+static void
+start_chunks(dns_loadctx_t *lctx, const char *master_file,
+	     isc_taskpool_t *taskpool)
+{
+	dns_loadctx_t *child;
+	dns_loadchunk_t *chunk;
+	isc_task_t *task;
+	isc_result_t result;
+	size_t end;
+	unsigned int i;
+
+	for (i = 1; i < lctx->nchunks; i++) {
+		chunk = &lctx->chunks[i];
+		end = (i + 1 < lctx->nchunks) ? lctx->chunks[i + 1].start
+					      : lctx->textlen;
+
+		task = NULL;
+		isc_taskpool_gettask(taskpool, &task);
+		child = NULL;
+		result = loadctx_create(dns_masterformat_text, lctx->mctx,
+					lctx->options, lctx->resign, lctx->top,
+					lctx->zclass,
+					dns_fixedname_name(&chunk->origin),
+					lctx->callbacks, task, chunk_done,
+					NULL, NULL, NULL, NULL, &child);
+		isc_task_detach(&task);
+		if (result != ISC_R_SUCCESS)
+			goto fail;
+
+		child->done_arg = child;
+		child->chunkno = i;
+		dns_loadctx_attach(lctx, &child->parent);
+		child->maxttl = lctx->maxttl;
+		child->now = lctx->now;
+		child->ttl = chunk->ttl;
+		child->default_ttl = chunk->ttl;
+		child->default_ttl_known = chunk->ttl_known;
+
+		isc_buffer_init(&child->chunkbuf, lctx->text + chunk->start,
+				(unsigned int)(end - chunk->start));
+		isc_buffer_add(&child->chunkbuf,
+			       (unsigned int)(end - chunk->start));
+		result = isc_lex_openbuffer(child->lex, &child->chunkbuf);
+		if (result == ISC_R_SUCCESS)
+			result = isc_lex_setsourcename(child->lex,
+						       master_file);
+		if (result == ISC_R_SUCCESS)
+			result = isc_lex_setsourceline(child->lex,
+						       chunk->line);
+		if (result == ISC_R_SUCCESS)
+			result = task_send(child);
+		if (result != ISC_R_SUCCESS) {
+			dns_loadctx_detach(&child);
+			goto fail;
+		}
+		continue;
+
+ fail:
+		chunk_finished(lctx, i, result, ISC_FALSE);
+	}
+}
+
 static isc_result_t
 load_text(dns_loadctx_t *lctx) {
 	dns_rdataclass_t rdclass;
@@ -2733,6 +3109,24 @@ dns_master_loadfileinc5(const char *master_file, dns_name_t *top,
 			dns_masterincludecb_t include_cb, void *include_arg,
 			isc_mem_t *mctx, dns_masterformat_t format,
 			isc_uint32_t maxttl)
+{
+	return (dns_master_loadfileinc6(master_file, top, origin, zclass,
+					options, resign, callbacks, task,
+					done, done_arg, lctxp, include_cb,
+					include_arg, mctx, format, maxttl,
+					NULL));
+}
+
+isc_result_t
+dns_master_loadfileinc6(const char *master_file, dns_name_t *top,
+			dns_name_t *origin, dns_rdataclass_t zclass,
+			unsigned int options, isc_uint32_t resign,
+			dns_rdatacallbacks_t *callbacks,
+			isc_task_t *task, dns_loaddonefunc_t done,
+			void *done_arg, dns_loadctx_t **lctxp,
+			dns_masterincludecb_t include_cb, void *include_arg,
+			isc_mem_t *mctx, dns_masterformat_t format,
+			isc_uint32_t maxttl, isc_taskpool_t *taskpool)
 {
 	dns_loadctx_t *lctx = NULL;
 	isc_result_t result;
@@ -2748,12 +3142,14 @@ dns_master_loadfileinc5(const char *master_file, dns_name_t *top,
 
 	lctx->maxttl = maxttl;
 
-	result = (lctx->openfile)(lctx, master_file);
+	result = split_text(lctx, master_file, taskpool);
 	if (result != ISC_R_SUCCESS)
 		goto cleanup;
 
 	result = task_send(lctx);
 	if (result == ISC_R_SUCCESS) {
+		if (lctx->chunks != NULL)
+			start_chunks(lctx, master_file, taskpool);
 		dns_loadctx_attach(lctx, lctxp);
 		return (DNS_R_CONTINUE);
 	}
@@ -3104,9 +3500,14 @@ commit(dns_rdatacallbacks_t *callbacks, dns_loadctx_t *lctx,
 	isc_result_t result;
 	char namebuf[DNS_NAME_FORMATSIZE];
 	void    (*error)(struct dns_rdatacallbacks *, const char *, ...);
+	isc_mutex_t *addlock = NULL;
 
 	this = ISC_LIST_HEAD(*head);
 	error = callbacks->error;
+	if (lctx->parent != NULL)
+		addlock = &lctx->parent->addlock;
+	else if (lctx->chunks != NULL)
+		addlock = &lctx->addlock;
 
 	if (this == NULL)
 		return (ISC_R_SUCCESS);
@@ -3123,8 +3524,12 @@ commit(dns_rdatacallbacks_t *callbacks, dns_loadctx_t *lctx,
 			dataset.attributes |= DNS_RDATASETATTR_RESIGN;
 			dataset.resign = resign_fromlist(this, lctx);
 		}
+		if (addlock != NULL)
+			LOCK(addlock);
 		result = ((*callbacks->add)(callbacks->add_private, owner,
 					    &dataset));
+		if (addlock != NULL)
+			UNLOCK(addlock);
 		if (result == ISC_R_NOMEMORY) {
 			(*error)(callbacks, "dns_master_load: %s",
 				 dns_result_totext(result));
@@ -3194,7 +3599,8 @@ load_quantum(isc_task_t *task, isc_event_t *event) {
 	lctx = event->ev_arg;
 	REQUIRE(DNS_LCTX_VALID(lctx));
 
-	if (lctx->canceled)
+	if (lctx->canceled ||
+	    (lctx->parent != NULL && lctx->parent->canceled))
 		result = ISC_R_CANCELED;
 	else
 		result = (lctx->load)(lctx);
@@ -3202,12 +3608,92 @@ load_quantum(isc_task_t *task, isc_event_t *event) {
 		event->ev_arg = lctx;
 		isc_task_send(task, &event);
 	} else {
-		(lctx->done)(lctx->done_arg, result);
+		if (lctx->chunks != NULL)
+			chunk_finished(lctx, 0, result, ISC_TRUE);
+		else
+			(lctx->done)(lctx->done_arg, result);
 		isc_event_free(&event);
 		dns_loadctx_detach(&lctx);
 	}
 }
 
+/*
+ * Report the loading of a split text file as done, with the result of
+ * the first chunk that failed.
+ */
+static void
+split_done(dns_loadctx_t *lctx) {
+	isc_result_t result = ISC_R_SUCCESS;
+	unsigned int i;
+
+	for (i = 0; i < lctx->nchunks; i++) {
+		if (lctx->chunks[i].result != ISC_R_SUCCESS) {
+			result = lctx->chunks[i].result;
+			break;
+		}
+	}
+	(lctx->done)(lctx->done_arg, result);
+}
+
+static void
+split_done_action(isc_task_t *task, isc_event_t *event) {
+	dns_loadctx_t *lctx = event->ev_arg;
+
+	UNUSED(task);
+
+	split_done(lctx);
+	isc_event_free(&event);
+	dns_loadctx_detach(&lctx);
+}
+
+/*
+ * Record that chunk 'chunkno' of the split text file owned by 'lctx'
+ * has been loaded.  The last chunk to finish reports the whole load as
+ * done, on the task of 'lctx': directly if 'ontask' is set, as the
+ * caller is running on it, or else by sending it an event.
+ */
+static void
+chunk_finished(dns_loadctx_t *lctx, unsigned int chunkno,
+	       isc_result_t result, isc_boolean_t ontask)
+{
+	dns_loadctx_t *ref = NULL;
+	isc_event_t *event;
+	isc_boolean_t last;
+
+	LOCK(&lctx->lock);
+	lctx->chunks[chunkno].result = result;
+	INSIST(lctx->pending > 0);
+	last = ISC_TF(--lctx->pending == 0);
+	UNLOCK(&lctx->lock);
+
+	if (!last)
+		return;
+
+	if (!ontask) {
+		event = isc_event_allocate(lctx->mctx, NULL,
+					   DNS_EVENT_MASTERQUANTUM,
+					   split_done_action, lctx,
+					   sizeof(*event));
+		if (event != NULL) {
+			dns_loadctx_attach(lctx, &ref);
+			isc_task_send(lctx->task, &event);
+			return;
+		}
+	}
+	split_done(lctx);
+}
+
+/*
+ * The 'done' function of the contexts loading all but the first chunk
+ * of a split text file.
+ */
+static void
+chunk_done(void *arg, isc_result_t result) {
+	dns_loadctx_t *lctx = arg;
+
+	chunk_finished(lctx->parent, lctx->chunkno, result, ISC_FALSE);
+}
+
 static isc_result_t
 task_send(dns_loadctx_t *lctx) {
 	isc_event_t *event;
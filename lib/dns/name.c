@@ -15,6 +15,12 @@
 #include <ctype.h>
 #include <stdlib.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NAME_USE_SSE2 1
+#endif
+
 #include <isc/buffer.h>
 #include <isc/hash.h>
 #include <isc/mem.h>
@@ -42,12 +48,6 @@ typedef enum {
 	ft_at
 } ft_state;
 
-typedef enum {
-	fw_start = 0,
-	fw_ordinary,
-	fw_newcurrent
-} fw_state;
-
 static char digitvalue[256] = {
 	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,	/*16*/
 	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /*32*/
@@ -102,6 +102,42 @@ static unsigned char maptolower[] = {
 	0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
 };
 
+/*%
+ * Copy 'length' bytes from 'src' to 'dst', mapping upper case ASCII
+ * letters to lower case as maptolower[] does.  'dst' may be the same
+ * as 'src' but must not otherwise overlap it.
+ *
+ * With SSE2, which every x86-64 processor has, sixteen bytes are done
+ * at a time: the bytes are shifted so that 'A'..'Z' become the 26
+ * smallest signed values, and 0x20 is or'ed into those found below
+ * that bound.  Labels are at most 63 bytes long, so wider vectors
+ * would hardly ever be filled.
+ */
+static inline void
+copy_lower(unsigned char *dst, const unsigned char *src, unsigned int length)
+{
+#ifdef NAME_USE_SSE2
+	const __m128i shift = _mm_set1_epi8((char)(0x80 - 'A'));
+	const __m128i bound = _mm_set1_epi8((char)(-0x80 + 26));
+	const __m128i bit = _mm_set1_epi8(0x20);
+	__m128i v, upper;
+
+	while (length >= 16) {
+		v = _mm_loadu_si128((const __m128i *)src);
+		upper = _mm_cmplt_epi8(_mm_add_epi8(v, shift), bound);
+		v = _mm_or_si128(v, _mm_and_si128(upper, bit));
+		_mm_storeu_si128((__m128i *)dst, v);
+		src += 16;
+		dst += 16;
+		length -= 16;
+	}
+#endif
+	while (length > 0) {
+		*dst++ = maptolower[*src++];
+		length--;
+	}
+}
+
 #define CONVERTTOASCII(c)
 #define CONVERTFROMASCII(c)
 
@@ -1726,11 +1762,10 @@ dns_name_downcase(const dns_name_t *source, dns_name_t *name,
 		nlen--;
 		if (count < 64) {
 			INSIST(nlen >= count);
-			while (count > 0) {
-				*ndata++ = maptolower[(*sndata++)];
-				nlen--;
-				count--;
-			}
+			copy_lower(ndata, sndata, count);
+			ndata += count;
+			sndata += count;
+			nlen -= count;
 		} else {
 			FATAL_ERROR(__FILE__, __LINE__,
 				    "Unexpected label type %02x", count);
@@ -1801,10 +1836,8 @@ dns_name_fromwire(dns_name_t *name, isc_buffer_t *source,
 {
 	unsigned char *cdata, *ndata;
 	unsigned int cused; /* Bytes of compressed name data used */
-	unsigned int nused, labels, n, nmax;
-	unsigned int current, new_current, biggest_pointer;
-	isc_boolean_t done;
-	fw_state state = fw_start;
+	unsigned int nused, labels, nmax;
+	unsigned int current, biggest_pointer;
 	unsigned int c;
 	unsigned char *offsets;
 	dns_offsets_t odata;
@@ -1838,17 +1871,10 @@ dns_name_fromwire(dns_name_t *name, isc_buffer_t *source,
 	 */
 	MAKE_EMPTY(name);
 
-	/*
-	 * Initialize things to make the compiler happy; they're not required.
-	 */
-	n = 0;
-	new_current = 0;
-
 	/*
 	 * Set up.
 	 */
 	labels = 0;
-	done = ISC_FALSE;
 
 	ndata = isc_buffer_used(target);
 	nused = 0;
@@ -1871,77 +1897,65 @@ dns_name_fromwire(dns_name_t *name, isc_buffer_t *source,
 	biggest_pointer = current;
 
 	/*
-	 * Note:  The following code is not optimized for speed, but
-	 * rather for correctness.  Speed will be addressed in the future.
+	 * Each label is validated by its length byte and then copied
+	 * in one go; only the length bytes and compression pointers are
+	 * looked at one at a time.
 	 */
-
-	while (current < source->active && !done) {
+	for (;;) {
+		if (ISC_UNLIKELY(current >= source->active))
+			return (ISC_R_UNEXPECTEDEND);
 		c = *cdata++;
 		current++;
 		if (!seen_pointer)
 			cused++;
 
-		switch (state) {
-		case fw_start:
-			if (c < 64) {
-				offsets[labels] = nused;
-				labels++;
-				if (nused + c + 1 > nmax)
-					goto full;
-				nused += c + 1;
-				*ndata++ = c;
-				if (c == 0)
-					done = ISC_TRUE;
-				n = c;
-				state = fw_ordinary;
-			} else if (c >= 128 && c < 192) {
-				/*
-				 * 14 bit local compression pointer.
-				 * Local compression is no longer an
-				 * IETF draft.
-				 */
-				return (DNS_R_BADLABELTYPE);
-			} else if (c >= 192) {
-				/*
-				 * Ordinary 14-bit pointer.
-				 */
-				if ((dctx->allowed & DNS_COMPRESS_GLOBAL14) ==
-				    0)
-					return (DNS_R_DISALLOWED);
-				new_current = c & 0x3F;
-				state = fw_newcurrent;
-			} else
-				return (DNS_R_BADLABELTYPE);
-			break;
-		case fw_ordinary:
-			if (downcase)
-				c = maptolower[c];
+		if (ISC_LIKELY(c < 64)) {
+			offsets[labels] = nused;
+			labels++;
+			if (nused + c + 1 > nmax)
+				goto full;
+			nused += c + 1;
 			*ndata++ = c;
-			n--;
-			if (n == 0)
-				state = fw_start;
-			break;
-		case fw_newcurrent:
-			new_current *= 256;
-			new_current += c;
-			if (new_current >= biggest_pointer)
+			if (c == 0)
+				break;
+			if (ISC_UNLIKELY(source->active - current < c))
+				return (ISC_R_UNEXPECTEDEND);
+			if (downcase)
+				copy_lower(ndata, cdata, c);
+			else
+				memmove(ndata, cdata, c);
+			ndata += c;
+			cdata += c;
+			current += c;
+			if (!seen_pointer)
+				cused += c;
+		} else if (c >= 192) {
+			/*
+			 * Ordinary 14-bit pointer.
+			 */
+			if ((dctx->allowed & DNS_COMPRESS_GLOBAL14) == 0)
+				return (DNS_R_DISALLOWED);
+			if (ISC_UNLIKELY(current >= source->active))
+				return (ISC_R_UNEXPECTEDEND);
+			c = (c & 0x3F) * 256 + *cdata;
+			if (!seen_pointer)
+				cused++;
+			if (c >= biggest_pointer)
 				return (DNS_R_BADPOINTER);
-			biggest_pointer = new_current;
-			current = new_current;
+			biggest_pointer = c;
+			current = c;
 			cdata = (unsigned char *)source->base + current;
 			seen_pointer = ISC_TRUE;
-			state = fw_start;
-			break;
-		default:
-			FATAL_ERROR(__FILE__, __LINE__,
-				    "Unknown state %d", state);
-			/* Does not return. */
+		} else {
+			/*
+			 * 14 bit local compression pointers (128-191) are
+			 * no longer an IETF draft, and 64-127 were never
+			 * assigned.
+			 */
+			return (DNS_R_BADLABELTYPE);
 		}
 	}
 
-	if (!done)
-		return (ISC_R_UNEXPECTEDEND);
-
 	name->ndata = (unsigned char *)target->base + target->used;
 	name->labels = labels;
 	name->length = nused;
@@ -0,0 +1,1171 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <isc/mem.h>
+#include <isc/print.h>
+#include <isc/refcount.h>
+#include <isc/string.h>
+#include <isc/util.h>
+
+/*%
+ * This define is so dns/name.h (included by dns/fixedname.h) uses more
+ * efficient macro calls instead of functions for a few operations.
+ */
+#define DNS_NAME_USEINLINE 1
+
+#include <dns/fixedname.h>
+#include <dns/qp.h>
+#include <dns/rbt.h>
+#include <dns/result.h>
+
+#define QP_MAGIC		ISC_MAGIC('Q', 'P', 'T', 'r')
+#define VALID_QP(qp)		ISC_MAGIC_VALID(qp, QP_MAGIC)
+
+#define CHAIN_MAGIC		ISC_MAGIC('Q', 'P', 'C', 'h')
+#define VALID_CHAIN(chain)	ISC_MAGIC_VALID(chain, CHAIN_MAGIC)
+
+/*
+ * A key is at most two bytes for every octet of a name, since octets
+ * 254 and 255 are escaped, plus one separator per label.
+ */
+#define QP_KEYSIZE		(2 * DNS_NAME_MAXWIRE + 2)
+
+/*
+ * The most labels a name can have, including the root label.
+ */
+#define QP_MAXLABELS		128
+
+/*
+ * Branch slots.  Slot 0 is taken by the key which ends just before the
+ * branch's nibble, and slots 1 to 16 by the keys whose nibble there is
+ * 0 to 15.  The capacity of the twig array is kept in the top bits of
+ * the bitmap, since it can be larger than the number of twigs after a
+ * deletion.
+ */
+#define SLOT_MASK		0x0001ffffU
+#define CAP_SHIFT		24
+#define BIT(slot)		((isc_uint32_t)1 << (slot))
+#define SLOTS(n)		((n)->bitmap & SLOT_MASK)
+#define CAPACITY(n)		((n)->bitmap >> CAP_SHIFT)
+#define ISBRANCH(n)		(SLOTS(n) != 0)
+#define NODIFF			(~0U)
+
+#define NAME(node)		((unsigned char *)((node) + 1))
+#define OFFSETS(node)		(NAME(node) + (node)->oldnamelen + 1)
+#define OLDOFFSETLEN(node)	(OFFSETS(node)[-1])
+#define NODE_SIZE(node)		(sizeof(*node) + \
+				 (node)->oldnamelen + OLDOFFSETLEN(node) + 1)
+
+/*%
+ * A node of the trie: either a leaf, pointing to a dns_rbtnode_t, or a
+ * branch on nibble 'index' of the key, with one twig for each bit set
+ * in its bitmap, in slot order.
+ */
+typedef struct qpnode qpnode_t;
+struct qpnode {
+	isc_uint32_t		bitmap;
+	isc_uint32_t		index;
+	union {
+		qpnode_t *	twigs;
+		dns_rbtnode_t *	leaf;
+	} u;
+};
+
+struct dns_qp {
+	unsigned int		magic;
+	isc_mem_t *		mctx;
+	qpnode_t		root;
+	unsigned int		nodecount;
+	size_t			branchbytes;
+	dns_rbtdeleter_t	data_deleter;
+	void *			deleter_arg;
+};
+
+/*%
+ * A name converted to a key.  ends[i] is the length of the key of the
+ * name's ancestor with 'i' labels below the root, so ends[0] is 0 and
+ * ends[labels] is 'len'.
+ */
+typedef struct qpkey {
+	unsigned int		len;
+	unsigned int		labels;
+	isc_uint16_t		ends[QP_MAXLABELS];
+	unsigned char		bytes[QP_KEYSIZE];
+} qpkey_t;
+
+static unsigned char maptolower[] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+	0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+	0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+	0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+	0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+	0x40, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67,
+	0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+	0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77,
+	0x78, 0x79, 0x7a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f,
+	0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67,
+	0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+	0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77,
+	0x78, 0x79, 0x7a, 0x7b, 0x7c, 0x7d, 0x7e, 0x7f,
+	0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+	0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+	0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
+	0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+	0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf,
+	0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7,
+	0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf,
+	0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+	0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+	0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7,
+	0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf,
+	0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7,
+	0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef,
+	0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+	0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+
+static inline void
+NODENAME(dns_rbtnode_t *node, dns_name_t *name) {
+	name->length = node->namelen;
+	name->labels = node->offsetlen;
+	name->ndata = NAME(node);
+	name->offsets = OFFSETS(node);
+	name->attributes = node->attributes;
+	name->attributes |= DNS_NAMEATTR_READONLY;
+}
+
+/*
+ * Convert the absolute wire format name 'ndata' to a key.
+ *
+ * Labels are taken from the root down.  Each octet is folded to lower
+ * case and then incremented, so that a zero byte can terminate every
+ * label; 254 and 255, which would overflow, become 255 followed by 0 or
+ * 1.  Comparing keys as byte strings is then the same as comparing the
+ * names in DNSSEC canonical order.
+ */
+static void
+name_tokey(const unsigned char *ndata, unsigned int labels, qpkey_t *key) {
+	const unsigned char *starts[QP_MAXLABELS];
+	const unsigned char *label;
+	unsigned char *p = key->bytes;
+	unsigned int i, n, c;
+
+	INSIST(labels > 0 && labels <= QP_MAXLABELS);
+
+	for (i = 0; i < labels; i++) {
+		starts[i] = ndata;
+		ndata += *ndata + 1;
+	}
+
+	key->labels = labels - 1;
+	key->ends[0] = 0;
+	for (i = 1; i < labels; i++) {
+		label = starts[labels - 1 - i];
+		n = *label++;
+		while (n-- > 0) {
+			c = maptolower[*label++];
+			if (ISC_LIKELY(c < 254)) {
+				*p++ = c + 1;
+			} else {
+				*p++ = 255;
+				*p++ = c - 254;
+			}
+		}
+		*p++ = 0;
+		key->ends[i] = (isc_uint16_t)(p - key->bytes);
+	}
+	key->len = (unsigned int)(p - key->bytes);
+}
+
+static inline void
+node_tokey(dns_rbtnode_t *node, qpkey_t *key) {
+	name_tokey(NAME(node), node->offsetlen, key);
+}
+
+/*
+ * The slot for 'key' in a branch on nibble 'index'.
+ */
+static inline unsigned int
+keyslot(const qpkey_t *key, unsigned int index) {
+	unsigned int off = index >> 1;
+
+	if (off >= key->len)
+		return (0);
+	if ((index & 1) == 0)
+		return ((key->bytes[off] >> 4) + 1);
+	return ((key->bytes[off] & 0x0f) + 1);
+}
+
+/*
+ * The nibble index at which two keys first differ, or NODIFF if they
+ * are equal.  When one key is a prefix of the other they differ at the
+ * high nibble of the byte after the shorter one, where the shorter key
+ * has slot 0.
+ */
+static inline unsigned int
+keydiff(const qpkey_t *a, const qpkey_t *b) {
+	unsigned int i, n;
+
+	n = ISC_MIN(a->len, b->len);
+	for (i = 0; i < n; i++) {
+		if (a->bytes[i] != b->bytes[i]) {
+			if (((a->bytes[i] ^ b->bytes[i]) & 0xf0) != 0)
+				return (i * 2);
+			return (i * 2 + 1);
+		}
+	}
+	if (a->len == b->len)
+		return (NODIFF);
+	return (n * 2);
+}
+
+static inline unsigned int
+popcount(isc_uint32_t w) {
+	w -= (w >> 1) & 0x55555555U;
+	w = (w & 0x33333333U) + ((w >> 2) & 0x33333333U);
+	w = (w + (w >> 4)) & 0x0f0f0f0fU;
+	return ((w * 0x01010101U) >> 24);
+}
+
+static inline unsigned int
+twigpos(const qpnode_t *branch, unsigned int slot) {
+	return (popcount(SLOTS(branch) & (BIT(slot) - 1)));
+}
+
+static inline unsigned int
+twigcount(const qpnode_t *branch) {
+	return (popcount(SLOTS(branch)));
+}
+
+static inline qpnode_t *
+twigs_get(dns_qp_t *qp, unsigned int n) {
+	qpnode_t *twigs;
+
+	twigs = isc_mem_get(qp->mctx, n * sizeof(qpnode_t));
+	if (twigs != NULL)
+		qp->branchbytes += n * sizeof(qpnode_t);
+	return (twigs);
+}
+
+static inline void
+twigs_put(dns_qp_t *qp, qpnode_t *branch) {
+	unsigned int cap = CAPACITY(branch);
+
+	isc_mem_put(qp->mctx, branch->u.twigs, cap * sizeof(qpnode_t));
+	qp->branchbytes -= cap * sizeof(qpnode_t);
+}
+
+/*
+ * Follow 'key' down from the root as far as the trie allows, taking
+ * the first twig of any branch which has no slot for it, and return
+ * the leaf that is reached.  Every key in the trie which shares a
+ * prefix with 'key' shares it with this leaf too.
+ */
+static inline dns_rbtnode_t *
+closest_leaf(dns_qp_t *qp, const qpkey_t *key) {
+	qpnode_t *n = &qp->root;
+	unsigned int slot;
+
+	while (ISBRANCH(n)) {
+		slot = keyslot(key, n->index);
+		if ((SLOTS(n) & BIT(slot)) != 0)
+			n = &n->u.twigs[twigpos(n, slot)];
+		else
+			n = &n->u.twigs[0];
+	}
+	return (n->u.leaf);
+}
+
+/*
+ * The first or last leaf below 'n'.
+ */
+static inline dns_rbtnode_t *
+extreme_leaf(qpnode_t *n, isc_boolean_t first) {
+	while (ISBRANCH(n)) {
+		if (first)
+			n = &n->u.twigs[0];
+		else
+			n = &n->u.twigs[twigcount(n) - 1];
+	}
+	return (n->u.leaf);
+}
+
+/*
+ * Find the successor ('forward') or the predecessor of 'key', which
+ * need not be in the trie.
+ *
+ * The descent follows 'key' as long as it agrees with the trie,
+ * remembering the nearest subtree to the side of the path that is
+ * wanted.  Where 'key' leaves the trie, it either sorts before or
+ * after everything in the subtree it left, or falls between two twigs
+ * of the branch it left from.
+ */
+static dns_rbtnode_t *
+neighbour(dns_qp_t *qp, const qpkey_t *key, isc_boolean_t forward) {
+	qpnode_t *n, *alt = NULL;
+	dns_rbtnode_t *leaf;
+	qpkey_t leafkey;
+	isc_uint32_t mask;
+	unsigned int d, pos, slot, leafslot;
+
+	if (!ISBRANCH(&qp->root) && qp->root.u.leaf == NULL)
+		return (NULL);
+
+	leaf = closest_leaf(qp, key);
+	node_tokey(leaf, &leafkey);
+	d = keydiff(key, &leafkey);
+
+	n = &qp->root;
+	while (ISBRANCH(n) && n->index < d) {
+		slot = keyslot(key, n->index);
+		pos = twigpos(n, slot);
+		if (forward && pos + 1 < twigcount(n))
+			alt = &n->u.twigs[pos + 1];
+		else if (!forward && pos > 0)
+			alt = &n->u.twigs[pos - 1];
+		n = &n->u.twigs[pos];
+	}
+
+	if (d != NODIFF) {
+		slot = keyslot(key, d);
+		if (ISBRANCH(n) && n->index == d) {
+			if (forward) {
+				mask = SLOTS(n) & ~(BIT(slot + 1) - 1);
+				if (mask != 0) {
+					pos = twigpos(n, slot);
+					return (extreme_leaf(&n->u.twigs[pos],
+							     ISC_TRUE));
+				}
+			} else {
+				mask = SLOTS(n) & (BIT(slot) - 1);
+				if (mask != 0) {
+					pos = twigpos(n, slot) - 1;
+					return (extreme_leaf(&n->u.twigs[pos],
+							     ISC_FALSE));
+				}
+			}
+		} else {
+			leafslot = keyslot(&leafkey, d);
+			if (forward ? (leafslot > slot) : (leafslot < slot))
+				return (extreme_leaf(n, forward));
+		}
+	}
+
+	if (alt == NULL)
+		return (NULL);
+	return (extreme_leaf(alt, forward));
+}
+
+/*
+ * Look 'key' up, and return its leaf if it is in the trie.  The nodes
+ * of its ancestors which are in the trie are stored in 'levels', from
+ * the root down, and counted in '*countp'.
+ *
+ * An ancestor's key is a prefix of 'key' that ends at a label
+ * boundary, so its leaf hangs off slot 0 of the branch at that
+ * boundary, or is the leaf the descent ends at.
+ */
+static dns_rbtnode_t *
+lookup(dns_qp_t *qp, const qpkey_t *key, dns_rbtnode_t **levels,
+       unsigned int *countp)
+{
+	qpnode_t *n = &qp->root;
+	qpnode_t *twig;
+	dns_rbtnode_t *leaf;
+	qpkey_t leafkey;
+	unsigned int count = 0, j = 0;
+	unsigned int off, slot;
+
+	*countp = 0;
+	if (!ISBRANCH(n) && n->u.leaf == NULL)
+		return (NULL);
+
+	while (ISBRANCH(n)) {
+		off = n->index >> 1;
+		if ((n->index & 1) == 0 && (SLOTS(n) & BIT(0)) != 0 &&
+		    off < key->len)
+		{
+			while (j < key->labels && key->ends[j] < off)
+				j++;
+			twig = &n->u.twigs[0];
+			if (key->ends[j] == off && !ISBRANCH(twig)) {
+				node_tokey(twig->u.leaf, &leafkey);
+				if (leafkey.len == off &&
+				    memcmp(leafkey.bytes, key->bytes,
+					   off) == 0)
+					levels[count++] = twig->u.leaf;
+			}
+		}
+		slot = keyslot(key, n->index);
+		if ((SLOTS(n) & BIT(slot)) == 0) {
+			*countp = count;
+			return (NULL);
+		}
+		n = &n->u.twigs[twigpos(n, slot)];
+	}
+
+	leaf = n->u.leaf;
+	node_tokey(leaf, &leafkey);
+	if (leafkey.len <= key->len &&
+	    memcmp(leafkey.bytes, key->bytes, leafkey.len) == 0)
+	{
+		if (leafkey.len == key->len) {
+			*countp = count;
+			return (leaf);
+		}
+		while (j < key->labels && key->ends[j] < leafkey.len)
+			j++;
+		if (key->ends[j] == leafkey.len)
+			levels[count++] = leaf;
+	}
+
+	*countp = count;
+	return (NULL);
+}
+
+isc_result_t
+dns_qp_create(isc_mem_t *mctx, dns_rbtdeleter_t deleter,
+	      void *deleter_arg, dns_qp_t **qpp)
+{
+	dns_qp_t *qp;
+
+	REQUIRE(mctx != NULL);
+	REQUIRE(qpp != NULL && *qpp == NULL);
+	REQUIRE(deleter == NULL ? deleter_arg == NULL : 1);
+
+	qp = isc_mem_get(mctx, sizeof(*qp));
+	if (qp == NULL)
+		return (ISC_R_NOMEMORY);
+
+	qp->mctx = NULL;
+	isc_mem_attach(mctx, &qp->mctx);
+	qp->root.bitmap = 0;
+	qp->root.index = 0;
+	qp->root.u.leaf = NULL;
+	qp->nodecount = 0;
+	qp->branchbytes = 0;
+	qp->data_deleter = deleter;
+	qp->deleter_arg = deleter_arg;
+	qp->magic = QP_MAGIC;
+
+	*qpp = qp;
+
+	return (ISC_R_SUCCESS);
+}
+
+static isc_result_t
+create_node(isc_mem_t *mctx, const dns_name_t *name, dns_rbtnode_t **nodep) {
+	dns_rbtnode_t *node;
+	isc_region_t region;
+	unsigned int labels;
+	size_t nodelen;
+
+	REQUIRE(name->offsets != NULL);
+
+	dns_name_toregion(name, &region);
+	labels = dns_name_countlabels(name);
+	ENSURE(labels > 0);
+
+	nodelen = sizeof(dns_rbtnode_t) + region.length + labels + 1;
+	node = (dns_rbtnode_t *)isc_mem_get(mctx, nodelen);
+	if (node == NULL)
+		return (ISC_R_NOMEMORY);
+	memset(node, 0, nodelen);
+
+	/*
+	 * Every node is a top level node without neighbours; rbtdb
+	 * relies on this to delete nodes outright instead of pruning
+	 * them from a tree.  The hash value picks the node's lock.
+	 */
+	ISC_LINK_INIT(node, deadlink);
+	dns_rbtnode_refinit(node, 0);
+	node->nsec = DNS_RBT_NSEC_NORMAL;
+	node->color = 1;
+#ifdef DNS_RBT_USEHASH
+	node->hashval = dns_name_fullhash(name, ISC_FALSE);
+#endif
+
+	node->oldnamelen = node->namelen = region.length;
+	OLDOFFSETLEN(node) = node->offsetlen = labels;
+	node->attributes = name->attributes;
+
+	memmove(NAME(node), region.base, region.length);
+	memmove(OFFSETS(node), name->offsets, labels);
+
+#if DNS_RBT_USEMAGIC
+	node->magic = DNS_RBTNODE_MAGIC;
+#endif
+	*nodep = node;
+
+	return (ISC_R_SUCCESS);
+}
+
+static inline void
+destroy_node(isc_mem_t *mctx, dns_rbtnode_t *node) {
+#if DNS_RBT_USEMAGIC
+	node->magic = 0;
+#endif
+	dns_rbtnode_refdestroy(node);
+
+	isc_mem_put(mctx, node, NODE_SIZE(node));
+}
+
+static inline void
+free_node(dns_qp_t *qp, dns_rbtnode_t *node) {
+	if (node->data != NULL && qp->data_deleter != NULL)
+		qp->data_deleter(node->data, qp->deleter_arg);
+	node->data = NULL;
+
+	destroy_node(qp->mctx, node);
+	qp->nodecount--;
+}
+
+isc_result_t
+dns_qp_addnode(dns_qp_t *qp, const dns_name_t *name, dns_rbtnode_t **nodep) {
+	dns_fixedname_t fixed;
+	dns_name_t *addname;
+	dns_rbtnode_t *node = NULL, *leaf;
+	qpnode_t *n, *twigs;
+	qpkey_t key, leafkey;
+	isc_result_t result;
+	unsigned int d, count, pos, slot, leafslot;
+
+	REQUIRE(VALID_QP(qp));
+	REQUIRE(dns_name_isabsolute(name));
+	REQUIRE(nodep != NULL && *nodep == NULL);
+
+	name_tokey(name->ndata, dns_name_countlabels(name), &key);
+
+	/*
+	 * Find where the new key parts from the trie.
+	 */
+	if (!ISBRANCH(&qp->root) && qp->root.u.leaf == NULL) {
+		leaf = NULL;
+		d = 0;
+		leafslot = 0;
+	} else {
+		leaf = closest_leaf(qp, &key);
+		node_tokey(leaf, &leafkey);
+		d = keydiff(&key, &leafkey);
+		if (d == NODIFF) {
+			*nodep = leaf;
+			return (ISC_R_EXISTS);
+		}
+		leafslot = keyslot(&leafkey, d);
+	}
+
+	/*
+	 * The node needs a name with offsets.
+	 */
+	if (name->offsets == NULL) {
+		dns_fixedname_init(&fixed);
+		addname = dns_fixedname_name(&fixed);
+		dns_name_clone(name, addname);
+	} else
+		DE_CONST(name, addname);
+
+	result = create_node(qp->mctx, addname, &node);
+	if (result != ISC_R_SUCCESS)
+		return (result);
+
+	if (leaf == NULL) {
+		qp->root.bitmap = 0;
+		qp->root.u.leaf = node;
+		goto done;
+	}
+
+	/*
+	 * Every branch above the point where the keys part has a slot
+	 * for the new key, since the closest leaf is below it.
+	 */
+	n = &qp->root;
+	while (ISBRANCH(n) && n->index < d)
+		n = &n->u.twigs[twigpos(n, keyslot(&key, n->index))];
+
+	slot = keyslot(&key, d);
+	if (ISBRANCH(n) && n->index == d) {
+		INSIST((SLOTS(n) & BIT(slot)) == 0);
+		count = twigcount(n);
+		pos = twigpos(n, slot);
+		if (count < CAPACITY(n)) {
+			twigs = n->u.twigs;
+			memmove(&twigs[pos + 1], &twigs[pos],
+				(count - pos) * sizeof(qpnode_t));
+		} else {
+			twigs = twigs_get(qp, count + 1);
+			if (twigs == NULL) {
+				destroy_node(qp->mctx, node);
+				return (ISC_R_NOMEMORY);
+			}
+			memmove(twigs, n->u.twigs, pos * sizeof(qpnode_t));
+			memmove(&twigs[pos + 1], &n->u.twigs[pos],
+				(count - pos) * sizeof(qpnode_t));
+			twigs_put(qp, n);
+			n->bitmap = SLOTS(n) | ((count + 1) << CAP_SHIFT);
+			n->u.twigs = twigs;
+		}
+		twigs[pos].bitmap = 0;
+		twigs[pos].index = 0;
+		twigs[pos].u.leaf = node;
+		n->bitmap |= BIT(slot);
+	} else {
+		/*
+		 * Everything below 'n' shares the closest leaf's nibble
+		 * at 'd', so 'n' becomes a twig of a new branch.
+		 */
+		INSIST(slot != leafslot);
+		twigs = twigs_get(qp, 2);
+		if (twigs == NULL) {
+			destroy_node(qp->mctx, node);
+			return (ISC_R_NOMEMORY);
+		}
+		pos = (slot < leafslot) ? 0 : 1;
+		twigs[1 - pos] = *n;
+		twigs[pos].bitmap = 0;
+		twigs[pos].index = 0;
+		twigs[pos].u.leaf = node;
+		n->bitmap = BIT(slot) | BIT(leafslot) | (2U << CAP_SHIFT);
+		n->index = d;
+		n->u.twigs = twigs;
+	}
+
+ done:
+	qp->nodecount++;
+	*nodep = node;
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Remove twig 'pos' from 'branch', collapsing the branch into its
+ * remaining twig if only one is left.  Shrinking the twig array is
+ * best effort: if a smaller one cannot be allocated the twigs are
+ * moved down in place.
+ */
+static void
+remove_twig(dns_qp_t *qp, qpnode_t *branch, unsigned int pos,
+	    unsigned int slot)
+{
+	qpnode_t *twigs, other;
+	unsigned int count = twigcount(branch);
+
+	if (count == 2) {
+		other = branch->u.twigs[1 - pos];
+		twigs_put(qp, branch);
+		*branch = other;
+		return;
+	}
+
+	twigs = twigs_get(qp, count - 1);
+	if (twigs != NULL) {
+		memmove(twigs, branch->u.twigs, pos * sizeof(qpnode_t));
+		memmove(&twigs[pos], &branch->u.twigs[pos + 1],
+			(count - pos - 1) * sizeof(qpnode_t));
+		twigs_put(qp, branch);
+		branch->bitmap = SLOTS(branch) | ((count - 1) << CAP_SHIFT);
+		branch->u.twigs = twigs;
+	} else {
+		memmove(&branch->u.twigs[pos], &branch->u.twigs[pos + 1],
+			(count - pos - 1) * sizeof(qpnode_t));
+	}
+	branch->bitmap &= ~BIT(slot);
+}
+
+isc_result_t
+dns_qp_deletenode(dns_qp_t *qp, dns_rbtnode_t *node, isc_boolean_t recurse) {
+	qpnode_t *n, *parent = NULL;
+	qpkey_t key;
+	unsigned int slot = 0;
+
+	REQUIRE(VALID_QP(qp));
+	REQUIRE(DNS_RBTNODE_VALID(node));
+	REQUIRE(!recurse);
+	INSIST(qp->nodecount != 0);
+
+	node_tokey(node, &key);
+
+	n = &qp->root;
+	while (ISBRANCH(n)) {
+		parent = n;
+		slot = keyslot(&key, n->index);
+		INSIST((SLOTS(n) & BIT(slot)) != 0);
+		n = &n->u.twigs[twigpos(n, slot)];
+	}
+	INSIST(n->u.leaf == node);
+
+	if (parent == NULL)
+		qp->root.u.leaf = NULL;
+	else
+		remove_twig(qp, parent, twigpos(parent, slot), slot);
+
+	free_node(qp, node);
+
+	/*
+	 * This function never fails.
+	 */
+	return (ISC_R_SUCCESS);
+}
+
+isc_result_t
+dns_qp_findnode(dns_qp_t *qp, const dns_name_t *name, dns_name_t *foundname,
+		dns_rbtnode_t **node, dns_qpchain_t *chain,
+		unsigned int options, dns_rbtfindcallback_t callback,
+		void *callback_arg)
+{
+	dns_qpchain_t localchain;
+	dns_rbtnode_t *exact, *current;
+	dns_fixedname_t fixedcallbackname;
+	dns_name_t *callback_name, current_name;
+	qpkey_t key;
+	isc_result_t result, saved_result = ISC_R_SUCCESS;
+	isc_boolean_t stopped = ISC_FALSE;
+	unsigned int i, count;
+
+	REQUIRE(VALID_QP(qp));
+	REQUIRE(dns_name_isabsolute(name));
+	REQUIRE(node != NULL && *node == NULL);
+	REQUIRE((options & (DNS_RBTFIND_NOEXACT | DNS_RBTFIND_NOPREDECESSOR))
+		!=         (DNS_RBTFIND_NOEXACT | DNS_RBTFIND_NOPREDECESSOR));
+
+	if (chain == NULL) {
+		options |= DNS_RBTFIND_NOPREDECESSOR;
+		chain = &localchain;
+		dns_qpchain_init(chain, qp->mctx);
+	} else
+		dns_qpchain_reset(chain);
+	chain->qp = qp;
+
+	if (!ISBRANCH(&qp->root) && qp->root.u.leaf == NULL)
+		return (ISC_R_NOTFOUND);
+
+	name_tokey(name->ndata, dns_name_countlabels(name), &key);
+	exact = lookup(qp, &key, chain->levels, &count);
+
+	/*
+	 * Visit the ancestors from the root down, as dns_rbt_findnode()
+	 * does, noting the deepest one which may be returned and giving
+	 * the callback a chance to stop the search.
+	 */
+	dns_fixedname_init(&fixedcallbackname);
+	callback_name = dns_fixedname_name(&fixedcallbackname);
+	dns_name_init(&current_name, NULL);
+	for (i = 0; i < count; i++) {
+		current = chain->levels[i];
+		if (current->data != NULL ||
+		    (options & DNS_RBTFIND_EMPTYDATA) != 0)
+			*node = current;
+
+		if (callback != NULL && current->find_callback) {
+			NODENAME(current, &current_name);
+			result = dns_name_copy(&current_name, callback_name,
+					       NULL);
+			if (result != ISC_R_SUCCESS) {
+				dns_qpchain_reset(chain);
+				return (result);
+			}
+			result = (callback)(current, callback_name,
+					    callback_arg);
+			if (result != DNS_R_CONTINUE) {
+				saved_result = result;
+				stopped = ISC_TRUE;
+				count = i + 1;
+				break;
+			}
+		}
+	}
+
+	if (stopped)
+		exact = NULL;
+
+	if (exact != NULL && (options & DNS_RBTFIND_NOEXACT) == 0 &&
+	    (exact->data != NULL || (options & DNS_RBTFIND_EMPTYDATA) != 0))
+	{
+		/*
+		 * Found an exact match.
+		 */
+		chain->end = exact;
+		chain->level_matches = count;
+
+		if (foundname != NULL) {
+			NODENAME(exact, &current_name);
+			result = dns_name_copy(&current_name, foundname, NULL);
+		} else
+			result = ISC_R_SUCCESS;
+
+		if (result == ISC_R_SUCCESS) {
+			*node = exact;
+			result = saved_result;
+		} else
+			*node = NULL;
+
+		return (result);
+	}
+
+	if (*node != NULL) {
+		/*
+		 * No exact match, but a superdomain was found.
+		 */
+		INSIST(count > 0);
+		chain->level_matches = count - 1;
+		while (chain->levels[chain->level_matches] != *node) {
+			INSIST(chain->level_matches > 0);
+			chain->level_matches--;
+		}
+
+		if (foundname != NULL) {
+			NODENAME(*node, &current_name);
+			result = dns_name_copy(&current_name, foundname, NULL);
+		} else
+			result = ISC_R_SUCCESS;
+
+		if (result == ISC_R_SUCCESS)
+			result = DNS_R_PARTIALMATCH;
+	} else
+		result = ISC_R_NOTFOUND;
+
+	if (exact != NULL) {
+		/*
+		 * The name is present, but either DNS_RBTFIND_NOEXACT was
+		 * set or it had no data; like dns_rbt_findnode(), point
+		 * the chain at it.
+		 */
+		chain->end = exact;
+	} else if ((options & DNS_RBTFIND_NOPREDECESSOR) != 0) {
+		chain->end = NULL;
+	} else if (stopped) {
+		/*
+		 * The search was stopped at an ancestor, which is then
+		 * the predecessor since nothing below it is considered.
+		 */
+		chain->end = chain->levels[count - 1];
+	} else
+		chain->end = neighbour(qp, &key, ISC_FALSE);
+
+	return (result);
+}
+
+void
+dns_qp_namefromnode(dns_rbtnode_t *node, dns_name_t *name) {
+
+	REQUIRE(DNS_RBTNODE_VALID(node));
+	REQUIRE(name != NULL);
+	REQUIRE(name->offsets == NULL);
+
+	NODENAME(node, name);
+}
+
+isc_result_t
+dns_qp_fullnamefromnode(dns_rbtnode_t *node, dns_name_t *name) {
+	dns_name_t current;
+
+	REQUIRE(DNS_RBTNODE_VALID(node));
+	REQUIRE(name != NULL);
+	REQUIRE(name->buffer != NULL);
+
+	dns_name_init(&current, NULL);
+	NODENAME(node, &current);
+
+	return (dns_name_copy(&current, name, NULL));
+}
+
+char *
+dns_qp_formatnodename(dns_rbtnode_t *node, char *printname,
+		      unsigned int size)
+{
+	dns_name_t current;
+
+	REQUIRE(DNS_RBTNODE_VALID(node));
+	REQUIRE(printname != NULL);
+
+	dns_name_init(&current, NULL);
+	NODENAME(node, &current);
+	dns_name_format(&current, printname, size);
+
+	return (printname);
+}
+
+unsigned int
+dns_qp_nodecount(dns_qp_t *qp) {
+
+	REQUIRE(VALID_QP(qp));
+
+	return (qp->nodecount);
+}
+
+size_t
+dns_qp_hashsize(dns_qp_t *qp) {
+
+	REQUIRE(VALID_QP(qp));
+
+	return (0);
+}
+
+size_t
+dns_qp_memusage(dns_qp_t *qp) {
+
+	REQUIRE(VALID_QP(qp));
+
+	return (qp->branchbytes);
+}
+
+void
+dns_qp_destroy(dns_qp_t **qpp) {
+	RUNTIME_CHECK(dns_qp_destroy2(qpp, 0) == ISC_R_SUCCESS);
+}
+
+isc_result_t
+dns_qp_destroy2(dns_qp_t **qpp, unsigned int quantum) {
+	dns_qp_t *qp;
+	qpnode_t *n, *parent;
+	dns_rbtnode_t *node;
+	unsigned int freed = 0, slot;
+
+	REQUIRE(qpp != NULL && VALID_QP(*qpp));
+
+	qp = *qpp;
+
+	/*
+	 * Free the first leaf until the trie is empty or the quantum
+	 * is used up.
+	 */
+	while (ISBRANCH(&qp->root) || qp->root.u.leaf != NULL) {
+		if (quantum != 0 && freed++ >= quantum)
+			return (ISC_R_QUOTA);
+
+		parent = NULL;
+		n = &qp->root;
+		while (ISBRANCH(n)) {
+			parent = n;
+			n = &n->u.twigs[0];
+		}
+		node = n->u.leaf;
+		if (parent == NULL)
+			qp->root.u.leaf = NULL;
+		else {
+			/* The first twig is in the lowest slot. */
+			slot = 0;
+			while ((SLOTS(parent) & BIT(slot)) == 0)
+				slot++;
+			remove_twig(qp, parent, 0, slot);
+		}
+		free_node(qp, node);
+	}
+
+	INSIST(qp->nodecount == 0);
+	INSIST(qp->branchbytes == 0);
+
+	qp->magic = 0;
+	isc_mem_putanddetach(&qp->mctx, qp, sizeof(*qp));
+	*qpp = NULL;
+	return (ISC_R_SUCCESS);
+}
+
+isc_result_t
+dns_qp_serialize_tree(FILE *file, dns_qp_t *qp,
+		      dns_rbtdatawriter_t datawriter,
+		      void *writer_arg, void *base, off_t *offset)
+{
+	UNUSED(file);
+	UNUSED(datawriter);
+	UNUSED(writer_arg);
+	UNUSED(base);
+	UNUSED(offset);
+
+	REQUIRE(VALID_QP(qp));
+
+	return (ISC_R_NOTIMPLEMENTED);
+}
+
+isc_result_t
+dns_qp_deserialize_tree(void *base_address, size_t filesize,
+			off_t header_offset, isc_mem_t *mctx,
+			dns_rbtdeleter_t deleter, void *deleter_arg,
+			dns_rbtdatafixer_t datafixer, void *fixer_arg,
+			dns_rbtnode_t **originp, dns_qp_t **qpp)
+{
+	UNUSED(base_address);
+	UNUSED(filesize);
+	UNUSED(header_offset);
+	UNUSED(mctx);
+	UNUSED(deleter);
+	UNUSED(deleter_arg);
+	UNUSED(datafixer);
+	UNUSED(fixer_arg);
+	UNUSED(originp);
+
+	REQUIRE(qpp != NULL && *qpp == NULL);
+
+	return (ISC_R_NOTIMPLEMENTED);
+}
+
+/*
+ * Chain Functions
+ */
+
+void
+dns_qpchain_init(dns_qpchain_t *chain, isc_mem_t *mctx) {
+
+	REQUIRE(chain != NULL);
+
+	chain->mctx = mctx;
+	chain->qp = NULL;
+	chain->end = NULL;
+	chain->level_count = 0;
+	chain->level_matches = 0;
+	memset(chain->levels, 0, sizeof(chain->levels));
+
+	chain->magic = CHAIN_MAGIC;
+}
+
+void
+dns_qpchain_reset(dns_qpchain_t *chain) {
+
+	REQUIRE(VALID_CHAIN(chain));
+
+	chain->end = NULL;
+	chain->level_count = 0;
+	chain->level_matches = 0;
+}
+
+void
+dns_qpchain_invalidate(dns_qpchain_t *chain) {
+
+	dns_qpchain_reset(chain);
+
+	chain->magic = 0;
+}
+
+isc_result_t
+dns_qpchain_current(dns_qpchain_t *chain, dns_name_t *name,
+		    dns_name_t *origin, dns_rbtnode_t **node)
+{
+	isc_result_t result = ISC_R_SUCCESS;
+
+	REQUIRE(VALID_CHAIN(chain));
+
+	if (node != NULL)
+		*node = chain->end;
+
+	if (chain->end == NULL)
+		return (ISC_R_NOTFOUND);
+
+	if (name != NULL) {
+		NODENAME(chain->end, name);
+
+		/*
+		 * Every name is absolute; make it relative to the root
+		 * as dns_rbtnodechain_current() does for the top level.
+		 */
+		INSIST(dns_name_isabsolute(name));
+		name->labels--;
+		name->length--;
+		name->attributes &= ~DNS_NAMEATTR_ABSOLUTE;
+	}
+
+	if (origin != NULL)
+		result = dns_name_copy(dns_rootname, origin, NULL);
+
+	return (result);
+}
+
+static isc_result_t
+chain_move(dns_qpchain_t *chain, dns_name_t *name, dns_name_t *origin,
+	   dns_rbtnode_t *node)
+{
+	isc_result_t result;
+
+	if (node == NULL)
+		return (ISC_R_NOTFOUND);
+
+	chain->end = node;
+	chain->level_count = 0;
+	chain->level_matches = 0;
+
+	result = dns_qpchain_current(chain, name, origin, NULL);
+	if (result == ISC_R_SUCCESS)
+		result = DNS_R_NEWORIGIN;
+	return (result);
+}
+
+isc_result_t
+dns_qpchain_first(dns_qpchain_t *chain, dns_qp_t *qp, dns_name_t *name,
+		  dns_name_t *origin)
+{
+	dns_rbtnode_t *node = NULL;
+
+	REQUIRE(VALID_QP(qp));
+	REQUIRE(VALID_CHAIN(chain));
+
+	dns_qpchain_reset(chain);
+	chain->qp = qp;
+
+	if (ISBRANCH(&qp->root) || qp->root.u.leaf != NULL)
+		node = extreme_leaf(&qp->root, ISC_TRUE);
+
+	return (chain_move(chain, name, origin, node));
+}
+
+isc_result_t
+dns_qpchain_last(dns_qpchain_t *chain, dns_qp_t *qp, dns_name_t *name,
+		 dns_name_t *origin)
+{
+	dns_rbtnode_t *node = NULL;
+
+	REQUIRE(VALID_QP(qp));
+	REQUIRE(VALID_CHAIN(chain));
+
+	dns_qpchain_reset(chain);
+	chain->qp = qp;
+
+	if (ISBRANCH(&qp->root) || qp->root.u.leaf != NULL)
+		node = extreme_leaf(&qp->root, ISC_FALSE);
+
+	return (chain_move(chain, name, origin, node));
+}
+
+static isc_result_t
+chain_step(dns_qpchain_t *chain, dns_name_t *name, isc_boolean_t forward) {
+	dns_rbtnode_t *node;
+	qpkey_t key;
+
+	REQUIRE(VALID_CHAIN(chain));
+	REQUIRE(VALID_QP(chain->qp));
+	REQUIRE(chain->end != NULL);
+
+	node_tokey(chain->end, &key);
+	node = neighbour(chain->qp, &key, forward);
+	if (node == NULL)
+		return (ISC_R_NOMORE);
+
+	chain->end = node;
+	chain->level_count = 0;
+	chain->level_matches = 0;
+
+	return (dns_qpchain_current(chain, name, NULL, NULL));
+}
+
+isc_result_t
+dns_qpchain_prev(dns_qpchain_t *chain, dns_name_t *name, dns_name_t *origin) {
+	UNUSED(origin);
+
+	return (chain_step(chain, name, ISC_FALSE));
+}
+
+isc_result_t
+dns_qpchain_next(dns_qpchain_t *chain, dns_name_t *name, dns_name_t *origin) {
+	UNUSED(origin);
+
+	return (chain_step(chain, name, ISC_TRUE));
+}
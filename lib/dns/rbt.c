@@ -19,6 +19,7 @@
 
 #include <isc/crc64.h>
 #include <isc/file.h>
+#include <isc/hash.h>
 #include <isc/hex.h>
 #include <isc/mem.h>
 #include <isc/once.h>
@@ -78,6 +79,8 @@ struct dns_rbt {
 	unsigned int		nodecount;
 	size_t			hashsize;
 	dns_rbtnode_t **	hashtable;
+	isc_boolean_t		hashmapped;	/*%< hashtable is in a map */
+	isc_uint32_t		hashseed;
 	void *			mmap_location;
 };
 
@@ -110,6 +113,11 @@ struct file_header {
 	unsigned int rdataset_fixed:1;	/* compiled with --enable-rrset-fixed */
 	unsigned int nodecount;		/* shadow from rbt structure */
 	isc_uint64_t crc;
+	isc_uint64_t base;		/* address the image is laid out for */
+	isc_uint64_t hashtable_offset;
+	isc_uint64_t hashsize;
+	isc_uint32_t hashseed;
+	isc_uint64_t headercrc;		/* of the fields above */
 	char version2[32];  		/* repeated; must match version1 */
 };
 
@@ -118,13 +126,19 @@ struct file_header {
  *
  * step one: write out a zeroed header of 1024 bytes
  * step two: walk the tree in a depth-first, left-right-down order, writing
- * out the nodes, reserving space as we go, correcting addresses to point
- * at the proper offset in the file, and setting a flag for each pointer to
- * indicate that it is a reference to a location in the file, rather than in
- * memory.
- * step three: write out the header, adding the information that will be
+ * out the nodes, reserving space as we go, and setting each pointer to the
+ * address its target will have when the file is mapped at the base address
+ * chosen by the caller.  Each node is added to the head of its hash
+ * bucket's chain as it is written.
+ * step three: write out the hash table, whose buckets also hold addresses
+ * in the image.
+ * step four: write out the header, adding the information that will be
  * needed to re-create the tree object itself.
  *
+ * A tree mapped at its base address can be used as it is, once its
+ * header has been checked.  Anywhere else, treefix() walks it, moves
+ * every pointer by the difference and checks the whole image.
+ *
  * The RBTDB object will do this three times, once for each of the three
  * RBT objects it contains.
  *
@@ -135,66 +149,37 @@ struct file_header {
 static isc_result_t
 dns_rbt_zero_header(FILE *file);
 
+/*%
+ * State kept while a tree is being written out.
+ */
+typedef struct serializer {
+	FILE *			file;
+	uintptr_t		base;	/*%< where the image will be mapped */
+	dns_rbtdatawriter_t	datawriter;
+	void *			writer_arg;
+	uintptr_t *		buckets;	/*%< hash chain heads */
+	size_t			hashsize;
+	isc_uint64_t		crc;
+} serializer_t;
+
 static isc_result_t
 write_header(FILE *file, dns_rbt_t *rbt, isc_uint64_t first_node_offset,
-	     isc_uint64_t crc);
+	     isc_uint64_t hashtable_offset, serializer_t *ser);
 
 static isc_boolean_t
 match_header_version(file_header_t *header);
 
+static isc_uint64_t
+header_crc(file_header_t *header);
+
 static isc_result_t
-serialize_node(FILE *file, dns_rbtnode_t *node, uintptr_t left,
+serialize_node(serializer_t *ser, dns_rbtnode_t *node, uintptr_t left,
 	       uintptr_t right, uintptr_t down, uintptr_t parent,
-	       uintptr_t data, isc_uint64_t *crc);
+	       uintptr_t upper, uintptr_t data, uintptr_t hashnext);
 
 static isc_result_t
-serialize_nodes(FILE *file, dns_rbtnode_t *node, uintptr_t parent,
-		dns_rbtdatawriter_t datawriter, void *writer_arg,
-		uintptr_t *where, isc_uint64_t *crc);
-/*
- * The following functions allow you to get the actual address of a pointer
- * without having to use an if statement to check to see if that address is
- * relative or not
- */
-static inline dns_rbtnode_t *
-getparent(dns_rbtnode_t *node, file_header_t *header) {
-	char *adjusted_address = (char *)(node->parent);
-	adjusted_address += node->parent_is_relative * (uintptr_t)header;
-
-	return ((dns_rbtnode_t *)adjusted_address);
-}
-
-static inline dns_rbtnode_t *
-getleft(dns_rbtnode_t *node, file_header_t *header) {
-	char *adjusted_address = (char *)(node->left);
-	adjusted_address += node->left_is_relative * (uintptr_t)header;
-
-	return ((dns_rbtnode_t *)adjusted_address);
-}
-
-static inline dns_rbtnode_t *
-getright(dns_rbtnode_t *node, file_header_t *header) {
-	char *adjusted_address = (char *)(node->right);
-	adjusted_address += node->right_is_relative * (uintptr_t)header;
-
-	return ((dns_rbtnode_t *)adjusted_address);
-}
-
-static inline dns_rbtnode_t *
-getdown(dns_rbtnode_t *node, file_header_t *header) {
-	char *adjusted_address = (char *)(node->down);
-	adjusted_address += node->down_is_relative * (uintptr_t)header;
-
-	return ((dns_rbtnode_t *)adjusted_address);
-}
-
-static inline dns_rbtnode_t *
-getdata(dns_rbtnode_t *node, file_header_t *header) {
-	char *adjusted_address = (char *)(node->data);
-	adjusted_address += node->data_is_relative * (uintptr_t)header;
-
-	return ((dns_rbtnode_t *)adjusted_address);
-}
+serialize_nodes(serializer_t *ser, dns_rbtnode_t *node, uintptr_t parent,
+		uintptr_t upper, uintptr_t *where);
 
 /*%
  * Elements of the rbtnode structure.
@@ -354,25 +339,18 @@ get_upper_node(dns_rbtnode_t *node) {
 	return (UPPERNODE(node));
 }
 
-static void
-fixup_uppernodes_helper(dns_rbtnode_t *node, dns_rbtnode_t *uppernode) {
-	if (node == NULL)
-		return;
-
-	UPPERNODE(node) = uppernode;
-
-	fixup_uppernodes_helper(LEFT(node), uppernode);
-	fixup_uppernodes_helper(RIGHT(node), uppernode);
-	fixup_uppernodes_helper(DOWN(node), node);
-}
-
 /*
- * This function is used to fixup uppernode members of all dns_rbtnodes
- * after deserialization.
+ * Hash 'name' as dns_name_fullhash() does, but with the tree's own
+ * initializer, so that the hash values and chains in a map image stay
+ * valid in the process which loads it.
  */
-static void
-fixup_uppernodes(dns_rbt_t *rbt) {
-	fixup_uppernodes_helper(rbt->root, NULL);
+static inline unsigned int
+hashname(dns_rbt_t *rbt, const dns_name_t *name) {
+	if (name->labels == 0)
+		return (0);
+
+	return (isc_hash_function_reverse(name->ndata, name->length,
+					  ISC_FALSE, &rbt->hashseed));
 }
 
 #else
@@ -450,9 +428,8 @@ static void
 deletefromlevel(dns_rbtnode_t *item, dns_rbtnode_t **rootp);
 
 static isc_result_t
-treefix(dns_rbt_t *rbt, void *base, size_t size,
-	dns_rbtnode_t *n, const dns_name_t *name,
-	dns_rbtdatafixer_t datafixer, void *fixer_arg,
+treefix(dns_rbt_t *rbt, void *base, size_t size, uintptr_t imagebase,
+	dns_rbtnode_t *n, dns_rbtdatafixer_t datafixer, void *fixer_arg,
 	isc_uint64_t *crc);
 
 static void
@@ -508,7 +485,7 @@ init_file_version(void) {
  */
 static isc_result_t
 write_header(FILE *file, dns_rbt_t *rbt, isc_uint64_t first_node_offset,
-	     isc_uint64_t crc)
+	     isc_uint64_t hashtable_offset, serializer_t *ser)
 {
 	file_header_t header;
 	isc_result_t result;
@@ -531,7 +508,13 @@ write_header(FILE *file, dns_rbt_t *rbt, isc_uint64_t first_node_offset,
 
 	header.nodecount = rbt->nodecount;
 
-	header.crc = crc;
+	header.crc = ser->crc;
+
+	header.base = ser->base;
+	header.hashtable_offset = hashtable_offset;
+	header.hashsize = ser->hashsize;
+	header.hashseed = rbt->hashseed;
+	header.headercrc = header_crc(&header);
 
 	CHECK(isc_stdio_tell(file, &location));
 	location = dns_rbt_serialize_align(location);
@@ -546,6 +529,22 @@ write_header(FILE *file, dns_rbt_t *rbt, isc_uint64_t first_node_offset,
 	return (result);
 }
 
+/*
+ * Checksum the header up to the checksum field.  The header is zeroed
+ * before it is filled in, so its padding is always the same.
+ */
+static isc_uint64_t
+header_crc(file_header_t *header) {
+	isc_uint64_t crc;
+
+	isc_crc64_init(&crc);
+	isc_crc64_update(&crc, (const isc_uint8_t *) header,
+			 offsetof(file_header_t, headercrc));
+	isc_crc64_final(&crc);
+
+	return (crc);
+}
+
 static isc_boolean_t
 match_header_version(file_header_t *header) {
 	RUNTIME_CHECK(isc_once_do(&once, init_file_version) == ISC_R_SUCCESS);
@@ -561,10 +560,16 @@ match_header_version(file_header_t *header) {
 	return (ISC_TRUE);
 }
 
+/*
+ * The address an offset in the file will have in the image.
+ */
+#define IMAGEPTR(ser, offset) \
+	((offset) == 0 ? NULL : (void *)((ser)->base + (offset)))
+
 static isc_result_t
-serialize_node(FILE *file, dns_rbtnode_t *node, uintptr_t left,
+serialize_node(serializer_t *ser, dns_rbtnode_t *node, uintptr_t left,
 	       uintptr_t right, uintptr_t down, uintptr_t parent,
-	       uintptr_t data, isc_uint64_t *crc)
+	       uintptr_t upper, uintptr_t data, uintptr_t hashnext)
 {
 	dns_rbtnode_t temp_node;
 	off_t file_position;
@@ -577,9 +582,9 @@ serialize_node(FILE *file, dns_rbtnode_t *node, uintptr_t left,
 
 	INSIST(node != NULL);
 
-	CHECK(isc_stdio_tell(file, &file_position));
+	CHECK(isc_stdio_tell(ser->file, &file_position));
 	file_position = dns_rbt_serialize_align(file_position);
-	CHECK(isc_stdio_seek(file, file_position, SEEK_SET));
+	CHECK(isc_stdio_seek(ser->file, file_position, SEEK_SET));
 
 	temp_node = *node;
 	temp_node.down_is_relative = 0;
@@ -590,38 +595,29 @@ serialize_node(FILE *file, dns_rbtnode_t *node, uintptr_t left,
 	temp_node.is_mmapped = 1;
 
 	/*
-	 * If the next node is not NULL, calculate the next node's location
-	 * in the file.  Note that this will have to change when the data
-	 * structure changes, and it also assumes that we always write the
-	 * nodes out in list order (which we currently do.)
-	*/
-	if (temp_node.parent != NULL) {
-		temp_node.parent = (dns_rbtnode_t *)(parent);
-		temp_node.parent_is_relative = 1;
-	}
-	if (temp_node.left != NULL) {
-		temp_node.left = (dns_rbtnode_t *)(left);
-		temp_node.left_is_relative = 1;
-	}
-	if (temp_node.right != NULL) {
-		temp_node.right = (dns_rbtnode_t *)(right);
-		temp_node.right_is_relative = 1;
-	}
-	if (temp_node.down != NULL) {
-		temp_node.down = (dns_rbtnode_t *)(down);
-		temp_node.down_is_relative = 1;
-	}
-	if (temp_node.data != NULL) {
-		temp_node.data = (dns_rbtnode_t *)(data);
-		temp_node.data_is_relative = 1;
-	}
+	 * Point at where the other nodes and the data will be in the
+	 * image.  Note that this will have to change when the data
+	 * structure changes.
+	 */
+	temp_node.parent = IMAGEPTR(ser, parent);
+	temp_node.left = IMAGEPTR(ser, left);
+	temp_node.right = IMAGEPTR(ser, right);
+	temp_node.down = IMAGEPTR(ser, down);
+	temp_node.data = IMAGEPTR(ser, data);
+#ifdef DNS_RBT_USEHASH
+	temp_node.uppernode = IMAGEPTR(ser, upper);
+	temp_node.hashnext = IMAGEPTR(ser, hashnext);
+#else
+	UNUSED(upper);
+	UNUSED(hashnext);
+#endif
 
 	node_data = (unsigned char *) node + sizeof(dns_rbtnode_t);
 	datasize = NODE_SIZE(node) - sizeof(dns_rbtnode_t);
 
 	CHECK(isc_stdio_write(&temp_node, 1, sizeof(dns_rbtnode_t),
-			      file, NULL));
-	CHECK(isc_stdio_write(node_data, 1, datasize, file, NULL));
+			      ser->file, NULL));
+	CHECK(isc_stdio_write(node_data, 1, datasize, ser->file, NULL));
 
 #ifdef DEBUG
 	dns_name_init(&nodename, NULL);
@@ -634,20 +630,19 @@ serialize_node(FILE *file, dns_rbtnode_t *node, uintptr_t left,
 	hexdump("node data", node_data, datasize);
 #endif
 
-	isc_crc64_update(crc, (const isc_uint8_t *) &temp_node,
+	isc_crc64_update(&ser->crc, (const isc_uint8_t *) &temp_node,
 			 sizeof(dns_rbtnode_t));
-	isc_crc64_update(crc, (const isc_uint8_t *) node_data, datasize);
+	isc_crc64_update(&ser->crc, (const isc_uint8_t *) node_data, datasize);
 
  cleanup:
 	return (result);
 }
 
 static isc_result_t
-serialize_nodes(FILE *file, dns_rbtnode_t *node, uintptr_t parent,
-		dns_rbtdatawriter_t datawriter, void *writer_arg,
-		uintptr_t *where, isc_uint64_t *crc)
+serialize_nodes(serializer_t *ser, dns_rbtnode_t *node, uintptr_t parent,
+		uintptr_t upper, uintptr_t *where)
 {
-	uintptr_t left = 0, right = 0, down = 0, data = 0;
+	uintptr_t left = 0, right = 0, down = 0, data = 0, hashnext = 0;
 	off_t location = 0, offset_adjust;
 	isc_result_t result;
 
@@ -658,12 +653,12 @@ serialize_nodes(FILE *file, dns_rbtnode_t *node, uintptr_t parent,
 	}
 
 	/* Reserve space for current node. */
-	CHECK(isc_stdio_tell(file, &location));
+	CHECK(isc_stdio_tell(ser->file, &location));
 	location = dns_rbt_serialize_align(location);
-	CHECK(isc_stdio_seek(file, location, SEEK_SET));
+	CHECK(isc_stdio_seek(ser->file, location, SEEK_SET));
 
 	offset_adjust = dns_rbt_serialize_align(location + NODE_SIZE(node));
-	CHECK(isc_stdio_seek(file, offset_adjust, SEEK_SET));
+	CHECK(isc_stdio_seek(ser->file, offset_adjust, SEEK_SET));
 
 	/*
 	 * Serialize the rest of the tree.
@@ -671,32 +666,42 @@ serialize_nodes(FILE *file, dns_rbtnode_t *node, uintptr_t parent,
 	 * WARNING: A change in the order (from left, right, down)
 	 * will break the way the crc hash is computed.
 	 */
-	CHECK(serialize_nodes(file, getleft(node, NULL), location,
-			      datawriter, writer_arg, &left, crc));
-	CHECK(serialize_nodes(file, getright(node, NULL), location,
-			      datawriter, writer_arg, &right, crc));
-	CHECK(serialize_nodes(file, getdown(node, NULL), location,
-			      datawriter, writer_arg, &down, crc));
+	CHECK(serialize_nodes(ser, LEFT(node), location, upper, &left));
+	CHECK(serialize_nodes(ser, RIGHT(node), location, upper, &right));
+	CHECK(serialize_nodes(ser, DOWN(node), location, location, &down));
 
 	if (node->data != NULL) {
 		off_t ret;
 
-		CHECK(isc_stdio_tell(file, &ret));
+		CHECK(isc_stdio_tell(ser->file, &ret));
 		ret = dns_rbt_serialize_align(ret);
-		CHECK(isc_stdio_seek(file, ret, SEEK_SET));
+		CHECK(isc_stdio_seek(ser->file, ret, SEEK_SET));
 		data = ret;
 
-		datawriter(file, node->data, writer_arg, crc);
+		CHECK(ser->datawriter(ser->file, node->data,
+				      (void *) ser->base,
+				      IMAGEPTR(ser, (uintptr_t) location),
+				      ser->writer_arg, &ser->crc));
 	}
 
+#ifdef DNS_RBT_USEHASH
+	/*
+	 * The chains are rebuilt as the nodes are written, so that a
+	 * node only ever points at nodes which are already in the file.
+	 */
+	hashnext = ser->buckets[HASHVAL(node) % ser->hashsize];
+	ser->buckets[HASHVAL(node) % ser->hashsize] = location;
+#endif
+
 	/* Seek back to reserved space. */
-	CHECK(isc_stdio_seek(file, location, SEEK_SET));
+	CHECK(isc_stdio_seek(ser->file, location, SEEK_SET));
 
 	/* Serialize the current node. */
-	CHECK(serialize_node(file, node, left, right, down, parent, data, crc));
+	CHECK(serialize_node(ser, node, left, right, down, parent, upper,
+			     data, hashnext));
 
 	/* Ensure we are always at the end of the file. */
-	CHECK(isc_stdio_seek(file, 0, SEEK_END));
+	CHECK(isc_stdio_seek(ser->file, 0, SEEK_END));
 
 	if (where != NULL)
 		*where = (uintptr_t) location;
@@ -718,17 +723,35 @@ dns_rbt_serialize_align(off_t target) {
 isc_result_t
 dns_rbt_serialize_tree(FILE *file, dns_rbt_t *rbt,
 		       dns_rbtdatawriter_t datawriter,
-		       void *writer_arg, off_t *offset)
+		       void *writer_arg, void *base, off_t *offset)
 {
 	isc_result_t result;
 	off_t header_position, node_position, end_position;
-	isc_uint64_t crc;
+	off_t hashtable_position;
+	serializer_t ser;
+	size_t i;
 
 	REQUIRE(file != NULL);
+	REQUIRE(VALID_RBT(rbt));
 
 	CHECK(isc_file_isplainfilefd(fileno(file)));
 
-	isc_crc64_init(&crc);
+	ser.file = file;
+	ser.base = (uintptr_t) base;
+	ser.datawriter = datawriter;
+	ser.writer_arg = writer_arg;
+	ser.buckets = NULL;
+	ser.hashsize = 0;
+	isc_crc64_init(&ser.crc);
+
+#ifdef DNS_RBT_USEHASH
+	ser.hashsize = rbt->hashsize;
+	ser.buckets = isc_mem_get(rbt->mctx,
+				  ser.hashsize * sizeof(ser.buckets[0]));
+	if (ser.buckets == NULL)
+		return (ISC_R_NOMEMORY);
+	memset(ser.buckets, 0, ser.hashsize * sizeof(ser.buckets[0]));
+#endif
 
 	CHECK(isc_stdio_tell(file, &header_position));
 
@@ -737,30 +760,46 @@ dns_rbt_serialize_tree(FILE *file, dns_rbt_t *rbt,
 
 	/* Serialize nodes */
 	CHECK(isc_stdio_tell(file, &node_position));
-	CHECK(serialize_nodes(file, rbt->root, 0, datawriter,
-			      writer_arg, NULL, &crc));
+	CHECK(serialize_nodes(&ser, rbt->root, 0, 0, NULL));
 
 	CHECK(isc_stdio_tell(file, &end_position));
 	if (node_position == end_position) {
 		CHECK(isc_stdio_seek(file, header_position, SEEK_SET));
 		*offset = 0;
-		return (ISC_R_SUCCESS);
+		goto cleanup;
 	}
+	*offset = dns_rbt_serialize_align(header_position);
 
-	isc_crc64_final(&crc);
+	/* Serialize the hash table */
+	hashtable_position = dns_rbt_serialize_align(end_position);
+	CHECK(isc_stdio_seek(file, hashtable_position, SEEK_SET));
+	for (i = 0; i < ser.hashsize; i++)
+		ser.buckets[i] = (uintptr_t) IMAGEPTR(&ser, ser.buckets[i]);
+	if (ser.hashsize != 0) {
+		CHECK(isc_stdio_write(ser.buckets, sizeof(ser.buckets[0]),
+				      ser.hashsize, file, NULL));
+		isc_crc64_update(&ser.crc, (const isc_uint8_t *) ser.buckets,
+				 ser.hashsize * sizeof(ser.buckets[0]));
+	}
+
+	isc_crc64_final(&ser.crc);
 #ifdef DEBUG
-	hexdump("serializing CRC", (unsigned char *)&crc, sizeof(crc));
+	hexdump("serializing CRC", (unsigned char *)&ser.crc,
+		sizeof(ser.crc));
 #endif
 
 	/* Serialize header */
 	CHECK(isc_stdio_seek(file, header_position, SEEK_SET));
-	CHECK(write_header(file, rbt, HEADER_LENGTH, crc));
+	CHECK(write_header(file, rbt, HEADER_LENGTH,
+			   hashtable_position - *offset, &ser));
 
 	/* Ensure we are always at the end of the file. */
 	CHECK(isc_stdio_seek(file, 0, SEEK_END));
-	*offset = dns_rbt_serialize_align(header_position);
 
  cleanup:
+	if (ser.buckets != NULL)
+		isc_mem_put(rbt->mctx, ser.buckets,
+			    ser.hashsize * sizeof(ser.buckets[0]));
 	return (result);
 }
 
@@ -771,93 +810,88 @@ dns_rbt_serialize_tree(FILE *file, dns_rbt_t *rbt,
 	} \
 } while(0);
 
+/*
+ * Move pointer 'p' from where the image was laid out to be mapped
+ * ('imagebase') to where it actually is ('base'), checking that it stays
+ * within 'max' bytes of the start of the file.
+ */
+#define RELOCATE(p, max) do { \
+	if ((p) != NULL) { \
+		uintptr_t offset_ = (uintptr_t)(p) - imagebase; \
+		CONFIRM(offset_ <= (max)); \
+		(p) = (void *)((char *)base + offset_); \
+	} \
+} while (0)
+
 static isc_result_t
-treefix(dns_rbt_t *rbt, void *base, size_t filesize, dns_rbtnode_t *n,
-	const dns_name_t *name, dns_rbtdatafixer_t datafixer,
-	void *fixer_arg, isc_uint64_t *crc)
+treefix(dns_rbt_t *rbt, void *base, size_t filesize, uintptr_t imagebase,
+	dns_rbtnode_t *n, dns_rbtdatafixer_t datafixer, void *fixer_arg,
+	isc_uint64_t *crc)
 {
 	isc_result_t result = ISC_R_SUCCESS;
-	dns_fixedname_t fixed;
-	dns_name_t nodename, *fullname;
+	dns_name_t nodename;
 	unsigned char *node_data;
 	dns_rbtnode_t header;
 	size_t datasize, nodemax = filesize - sizeof(dns_rbtnode_t);
+	size_t where;
 
 	if (n == NULL)
 		return (ISC_R_SUCCESS);
 
 	CONFIRM((void *) n >= base);
-	CONFIRM((char *) n - (char *) base <= (int) nodemax);
+	where = (char *) n - (char *) base;
+	CONFIRM(where <= nodemax);
 	CONFIRM(DNS_RBTNODE_VALID(n));
+	CONFIRM(NODE_SIZE(n) <= filesize - where);
 
 	dns_name_init(&nodename, NULL);
 	NODENAME(n, &nodename);
-
-	fullname = &nodename;
-	CONFIRM(dns_name_isvalid(fullname));
-
-	if (!dns_name_isabsolute(&nodename)) {
-		dns_fixedname_init(&fixed);
-		fullname = dns_fixedname_name(&fixed);
-		CHECK(dns_name_concatenate(&nodename, name, fullname, NULL));
-	}
+	CONFIRM(dns_name_isvalid(&nodename));
 
 	/* memorize header contents prior to fixup */
 	memmove(&header, n, sizeof(header));
 
-	if (n->left_is_relative) {
-		CONFIRM(n->left <= (dns_rbtnode_t *) nodemax);
-		n->left = getleft(n, rbt->mmap_location);
-		n->left_is_relative = 0;
-		CONFIRM(DNS_RBTNODE_VALID(n->left));
-	} else
-		CONFIRM(n->left == NULL);
+	/*
+	 * Children are always written after their parent, so the walk
+	 * below only moves forward and cannot be led round in a loop.
+	 */
+	RELOCATE(n->left, nodemax);
+	CONFIRM(n->left == NULL ||
+		(n->left > n && DNS_RBTNODE_VALID(n->left)));
 
-	if (n->right_is_relative) {
-		CONFIRM(n->right <= (dns_rbtnode_t *) nodemax);
-		n->right = getright(n, rbt->mmap_location);
-		n->right_is_relative = 0;
-		CONFIRM(DNS_RBTNODE_VALID(n->right));
-	} else
-		CONFIRM(n->right == NULL);
-
-	if (n->down_is_relative) {
-		CONFIRM(n->down <= (dns_rbtnode_t *) nodemax);
-		n->down = getdown(n, rbt->mmap_location);
-		n->down_is_relative = 0;
-		CONFIRM(n->down > (dns_rbtnode_t *) n);
-		CONFIRM(DNS_RBTNODE_VALID(n->down));
-	} else
-		CONFIRM(n->down == NULL);
-
-	if (n->parent_is_relative) {
-		CONFIRM(n->parent <= (dns_rbtnode_t *) nodemax);
-		n->parent = getparent(n, rbt->mmap_location);
-		n->parent_is_relative = 0;
-		CONFIRM(n->parent < (dns_rbtnode_t *) n);
-		CONFIRM(DNS_RBTNODE_VALID(n->parent));
-	} else
-		CONFIRM(n->parent == NULL);
+	RELOCATE(n->right, nodemax);
+	CONFIRM(n->right == NULL ||
+		(n->right > n && DNS_RBTNODE_VALID(n->right)));
 
-	if (n->data_is_relative) {
-		CONFIRM(n->data <= (void *) filesize);
-		n->data = getdata(n, rbt->mmap_location);
-		n->data_is_relative = 0;
-		CONFIRM(n->data > (void *) n);
-	} else
-		CONFIRM(n->data == NULL);
+	RELOCATE(n->down, nodemax);
+	CONFIRM(n->down == NULL ||
+		(n->down > n && DNS_RBTNODE_VALID(n->down)));
+
+	RELOCATE(n->parent, nodemax);
+	CONFIRM(n->parent == NULL ||
+		(n->parent < n && DNS_RBTNODE_VALID(n->parent)));
 
-	hash_node(rbt, n, fullname);
+	RELOCATE(n->data, filesize);
+	CONFIRM(n->data == NULL || n->data > (void *) n);
+
+#ifdef DNS_RBT_USEHASH
+	RELOCATE(n->uppernode, nodemax);
+	CONFIRM(n->uppernode == NULL ||
+		(n->uppernode < n && DNS_RBTNODE_VALID(n->uppernode)));
+
+	RELOCATE(n->hashnext, nodemax);
+	CONFIRM(n->hashnext == NULL || DNS_RBTNODE_VALID(n->hashnext));
+#endif
 
 	/* a change in the order (from left, right, down) will break hashing*/
 	if (n->left != NULL)
-		CHECK(treefix(rbt, base, filesize, n->left, name,
+		CHECK(treefix(rbt, base, filesize, imagebase, n->left,
 			      datafixer, fixer_arg, crc));
 	if (n->right != NULL)
-		CHECK(treefix(rbt, base, filesize, n->right, name,
+		CHECK(treefix(rbt, base, filesize, imagebase, n->right,
 			      datafixer, fixer_arg, crc));
 	if (n->down != NULL)
-		CHECK(treefix(rbt, base, filesize, n->down, fullname,
+		CHECK(treefix(rbt, base, filesize, imagebase, n->down,
 			      datafixer, fixer_arg, crc));
 
 	if (datafixer != NULL && n->data != NULL)
@@ -884,6 +918,28 @@ treefix(dns_rbt_t *rbt, void *base, size_t filesize, dns_rbtnode_t *n,
 	return (result);
 }
 
+#ifdef DNS_RBT_USEHASH
+static isc_result_t
+hashfix(dns_rbt_t *rbt, void *base, size_t filesize, uintptr_t imagebase,
+	isc_uint64_t *crc)
+{
+	isc_result_t result = ISC_R_SUCCESS;
+	size_t i, nodemax = filesize - sizeof(dns_rbtnode_t);
+
+	isc_crc64_update(crc, (const isc_uint8_t *) rbt->hashtable,
+			 rbt->hashsize * sizeof(dns_rbtnode_t *));
+
+	for (i = 0; i < rbt->hashsize; i++) {
+		RELOCATE(rbt->hashtable[i], nodemax);
+		CONFIRM(rbt->hashtable[i] == NULL ||
+			DNS_RBTNODE_VALID(rbt->hashtable[i]));
+	}
+
+ cleanup:
+	return (result);
+}
+#endif /* DNS_RBT_USEHASH */
+
 isc_result_t
 dns_rbt_deserialize_tree(void *base_address, size_t filesize,
 			 off_t header_offset, isc_mem_t *mctx,
@@ -896,6 +952,7 @@ dns_rbt_deserialize_tree(void *base_address, size_t filesize,
 	dns_rbt_t *rbt = NULL;
 	isc_uint64_t crc;
 	unsigned int host_big_endian;
+	size_t room;
 
 	REQUIRE(originp == NULL || *originp == NULL);
 	REQUIRE(rbtp != NULL && *rbtp == NULL);
@@ -906,8 +963,20 @@ dns_rbt_deserialize_tree(void *base_address, size_t filesize,
 
 	rbt->mmap_location = base_address;
 
+	if (header_offset < 0 ||
+	    filesize < HEADER_LENGTH + sizeof(dns_rbtnode_t) ||
+	    (size_t) header_offset > filesize - HEADER_LENGTH -
+				     sizeof(dns_rbtnode_t))
+	{
+		result = ISC_R_INVALIDFILE;
+		goto cleanup;
+	}
+	room = filesize - (size_t) header_offset;
+
 	header = (file_header_t *)((char *)base_address + header_offset);
-	if (!match_header_version(header)) {
+	if (!match_header_version(header) ||
+	    header->headercrc != header_crc(header))
+	{
 		result = ISC_R_INVALIDFILE;
 		goto cleanup;
 	}
@@ -936,6 +1005,15 @@ dns_rbt_deserialize_tree(void *base_address, size_t filesize,
 		goto cleanup;
 	}
 
+	if (header->first_node_offset > room - sizeof(dns_rbtnode_t) ||
+	    header->hashsize > room / sizeof(dns_rbtnode_t *) ||
+	    header->hashtable_offset >
+		room - header->hashsize * sizeof(dns_rbtnode_t *))
+	{
+		result = ISC_R_INVALIDFILE;
+		goto cleanup;
+	}
+
 	/* Copy other data items from the header into our rbt. */
 	rbt->root = (dns_rbtnode_t *)((char *)base_address +
 				header_offset + header->first_node_offset);
@@ -944,30 +1022,66 @@ dns_rbt_deserialize_tree(void *base_address, size_t filesize,
 		result = ISC_R_INVALIDFILE;
 		goto cleanup;
 	}
-	rehash(rbt, header->nodecount);
-
-	CHECK(treefix(rbt, base_address, filesize, rbt->root,
-		      dns_rootname, datafixer, fixer_arg, &crc));
 
-	isc_crc64_final(&crc);
-#ifdef DEBUG
-	hexdump("deserializing CRC", (unsigned char *)&crc, sizeof(crc));
-#endif
-
-	/* Check file hash */
-	if (header->crc != crc) {
+#ifdef DNS_RBT_USEHASH
+	if (header->hashsize == 0) {
 		result = ISC_R_INVALIDFILE;
 		goto cleanup;
 	}
 
-	if (header->nodecount != rbt->nodecount) {
-		result = ISC_R_INVALIDFILE;
-		goto cleanup;
-	}
+	/*
+	 * Use the hash table in the image, and hash any names added
+	 * later as it was hashed.
+	 */
+	isc_mem_put(rbt->mctx, rbt->hashtable,
+		    rbt->hashsize * sizeof(dns_rbtnode_t *));
+	rbt->hashtable = (dns_rbtnode_t **)((char *)base_address +
+				header_offset + header->hashtable_offset);
+	rbt->hashsize = (size_t) header->hashsize;
+	rbt->hashmapped = ISC_TRUE;
+	rbt->hashseed = header->hashseed;
+#endif
 
+	if (header->base == (uintptr_t) base_address) {
+		/*
+		 * The file is mapped where it was laid out to be, so
+		 * every pointer in it is already right.  Only the header
+		 * and the root node are checked, so that loading takes
+		 * the same time however big the image is and its pages
+		 * are only read in as names are looked up.  Damage
+		 * elsewhere in the image is not noticed here.
+		 */
+		if (!DNS_RBTNODE_VALID(rbt->root)) {
+			result = ISC_R_INVALIDFILE;
+			goto cleanup;
+		}
+		rbt->nodecount = header->nodecount;
+	} else {
+		CHECK(treefix(rbt, base_address, filesize,
+			      (uintptr_t) header->base, rbt->root,
+			      datafixer, fixer_arg, &crc));
 #ifdef DNS_RBT_USEHASH
-	fixup_uppernodes(rbt);
-#endif /* DNS_RBT_USEHASH */
+		CHECK(hashfix(rbt, base_address, filesize,
+			      (uintptr_t) header->base, &crc));
+#endif
+
+		isc_crc64_final(&crc);
+#ifdef DEBUG
+		hexdump("deserializing CRC", (unsigned char *)&crc,
+			sizeof(crc));
+#endif
+
+		/* Check file hash */
+		if (header->crc != crc) {
+			result = ISC_R_INVALIDFILE;
+			goto cleanup;
+		}
+
+		if (header->nodecount != rbt->nodecount) {
+			result = ISC_R_INVALIDFILE;
+			goto cleanup;
+		}
+	}
 
 	*rbtp = rbt;
 	if (originp != NULL)
@@ -1011,6 +1125,8 @@ dns_rbt_create(isc_mem_t *mctx, dns_rbtdeleter_t deleter,
 	rbt->nodecount = 0;
 	rbt->hashtable = NULL;
 	rbt->hashsize = 0;
+	rbt->hashmapped = ISC_FALSE;
+	rbt->hashseed = *(const isc_uint32_t *) isc_hash_get_initializer();
 	rbt->mmap_location = NULL;
 
 #ifdef DNS_RBT_USEHASH
@@ -1052,7 +1168,7 @@ dns_rbt_destroy2(dns_rbt_t **rbtp, unsigned int quantum) {
 
 	rbt->mmap_location = NULL;
 
-	if (rbt->hashtable != NULL)
+	if (rbt->hashtable != NULL && !rbt->hashmapped)
 		isc_mem_put(rbt->mctx, rbt->hashtable,
 			    rbt->hashsize * sizeof(dns_rbtnode_t *));
 
@@ -1612,7 +1728,7 @@ dns_rbt_findnode(dns_rbt_t *rbt, const dns_name_t *name, dns_name_t *foundname,
 						  nlabels - tlabels,
 						  hlabels + tlabels,
 						  &hash_name);
-			hash = dns_name_fullhash(&hash_name, ISC_FALSE);
+			hash = hashname(rbt, &hash_name);
 			dns_name_getlabelsequence(search_name,
 						  nlabels - tlabels,
 						  tlabels, &hash_name);
@@ -2318,7 +2434,7 @@ hash_add_node(dns_rbt_t *rbt, dns_rbtnode_t *node, const dns_name_t *name) {
 
 	REQUIRE(name != NULL);
 
-	HASHVAL(node) = dns_name_fullhash(name, ISC_FALSE);
+	HASHVAL(node) = hashname(rbt, name);
 
 	hash = HASHVAL(node) % rbt->hashsize;
 	HASHNEXT(node) = rbt->hashtable[hash];
@@ -2377,7 +2493,14 @@ rehash(dns_rbt_t *rbt, unsigned int newcount) {
 		}
 	}
 
-	isc_mem_put(rbt->mctx, oldtable, oldsize * sizeof(dns_rbtnode_t *));
+	/*
+	 * A table in a map image is left where it is.
+	 */
+	if (rbt->hashmapped)
+		rbt->hashmapped = ISC_FALSE;
+	else
+		isc_mem_put(rbt->mctx, oldtable,
+			    oldsize * sizeof(dns_rbtnode_t *));
 }
 
 static inline void
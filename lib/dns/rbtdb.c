@@ -21,6 +21,7 @@
 #endif
 
 #include <isc/crc64.h>
+#include <isc/epoch.h>
 #include <isc/event.h>
 #include <isc/heap.h>
 #include <isc/file.h>
@@ -66,6 +67,42 @@
 #include <dns/zone.h>
 #include <dns/zonekey.h>
 
+#ifdef DNS_RBTDB_QP
+/*
+ * qpdb.c builds this file on top of a qp-trie instead of a red-black
+ * tree.  dns_qp_*() and dns_qpchain_*() have the same semantics as
+ * their dns_rbt counterparts, except that every node is at the top
+ * level, so its name from dns_rbt_namefromnode() is already complete.
+ */
+#include <dns/qp.h>
+
+#define dns_rbt_t			dns_qp_t
+#define dns_rbtnodechain_t		dns_qpchain_t
+
+#define dns_rbt_addnode			dns_qp_addnode
+#define dns_rbt_create			dns_qp_create
+#define dns_rbt_deletenode		dns_qp_deletenode
+#define dns_rbt_deserialize_tree	dns_qp_deserialize_tree
+#define dns_rbt_destroy			dns_qp_destroy
+#define dns_rbt_destroy2		dns_qp_destroy2
+#define dns_rbt_findnode		dns_qp_findnode
+#define dns_rbt_formatnodename		dns_qp_formatnodename
+#define dns_rbt_fullnamefromnode	dns_qp_fullnamefromnode
+#define dns_rbt_hashsize		dns_qp_hashsize
+#define dns_rbt_namefromnode		dns_qp_namefromnode
+#define dns_rbt_nodecount		dns_qp_nodecount
+#define dns_rbt_serialize_tree		dns_qp_serialize_tree
+
+#define dns_rbtnodechain_current	dns_qpchain_current
+#define dns_rbtnodechain_first		dns_qpchain_first
+#define dns_rbtnodechain_init		dns_qpchain_init
+#define dns_rbtnodechain_invalidate	dns_qpchain_invalidate
+#define dns_rbtnodechain_last		dns_qpchain_last
+#define dns_rbtnodechain_next		dns_qpchain_next
+#define dns_rbtnodechain_prev		dns_qpchain_prev
+#define dns_rbtnodechain_reset		dns_qpchain_reset
+#endif
+
 #ifndef WIN32
 #include <sys/mman.h>
 #else
@@ -75,14 +112,18 @@
 #define MAP_FAILED	((void *)-1)
 #endif
 
-#ifdef DNS_RBTDB_VERSION64
+#if defined(DNS_RBTDB_VERSION64)
 #include "rbtdb64.h"
+#elif defined(DNS_RBTDB_QP)
+#include "qpdb.h"
 #else
 #include "rbtdb.h"
 #endif
 
-#ifdef DNS_RBTDB_VERSION64
+#if defined(DNS_RBTDB_VERSION64)
 #define RBTDB_MAGIC                     ISC_MAGIC('R', 'B', 'D', '8')
+#elif defined(DNS_RBTDB_QP)
+#define RBTDB_MAGIC                     ISC_MAGIC('R', 'B', 'D', 'Q')
 #else
 #define RBTDB_MAGIC                     ISC_MAGIC('R', 'B', 'D', '4')
 #endif
@@ -110,10 +151,51 @@ struct rbtdb_file_header {
 	isc_uint64_t tree;
 	isc_uint64_t nsec;
 	isc_uint64_t nsec3;
+	isc_uint64_t base;		/* address the image is laid out for */
+	isc_uint64_t records;
+	isc_uint64_t bytes;
+	isc_uint64_t resign;		/* headers due for re-signing */
+	isc_uint64_t headercrc;		/* of the fields above */
 
 	char version2[32];  		/* repeated; must match version1 */
 };
 
+/*%
+ * Map images are laid out to be mapped at an address in a region which
+ * 64 bit systems normally leave unused, so that they can usually be
+ * mapped there and used without relocation.  The region is split into
+ * slots of a power of two no smaller than the image, and each zone's
+ * slot is picked by hashing its name, so that different zones tend to
+ * get different addresses.
+ */
+#define MAP_REGION		((isc_uint64_t)1 << 44)	/* 16 TiB, and size */
+#define MAP_MINSLOT		((isc_uint64_t)1 << 20)
+
+/*%
+ * Node and name overhead used to estimate the size of an image.
+ */
+#define MAP_NODESIZE		(sizeof(dns_rbtnode_t) + 64)
+
+/*%
+ * State kept by rbt_datawriter() across the trees of one image.
+ */
+typedef struct rbtdb_writer {
+	struct rbtdb_version *	version;
+	isc_uint64_t		records;
+	isc_uint64_t		bytes;
+	isc_uint64_t		resign;
+} rbtdb_writer_t;
+
+/*%
+ * Totals counted by rbt_datafixer() across the trees of an image, to be
+ * checked against those rbt_datawriter() stored in its header.
+ */
+typedef struct rbtdb_fixer {
+	isc_uint64_t		records;
+	isc_uint64_t		bytes;
+	isc_uint64_t		resign;
+} rbtdb_fixer_t;
+
 
 /*%
  * Note that "impmagic" is not the first four bytes of the struct, so
@@ -194,6 +276,7 @@ typedef isc_uint64_t                    rbtdb_serial_t;
 #define detach detach64
 #define detachnode detachnode64
 #define dump dump64
+#define dumpable_header dumpable_header64
 #define endload endload64
 #define expire_header expire_header64
 #define expirenode expirenode64
@@ -211,6 +294,7 @@ typedef isc_uint64_t                    rbtdb_serial_t;
 #define free_rbtdb free_rbtdb64
 #define free_rbtdb_callback free_rbtdb_callback64
 #define free_rdataset free_rdataset64
+#define getgeneration getgeneration64
 #define getnsec3parameters getnsec3parameters64
 #define getoriginnode getoriginnode64
 #define getrrsetstats getrrsetstats64
@@ -219,6 +303,7 @@ typedef isc_uint64_t                    rbtdb_serial_t;
 #define getsize getsize64
 #define glue_nsdname_cb glue_nsdname_cb64
 #define hashsize hashsize64
+#define header_crc header_crc64
 #define init_file_version init_file_version64
 #define init_rdataset init_rdataset64
 #define isdnssec isdnssec64
@@ -231,6 +316,7 @@ typedef isc_uint64_t                    rbtdb_serial_t;
 #define mark_header_ancient mark_header_ancient64
 #define mark_stale_header mark_stale_header64
 #define match_header_version match_header_version64
+#define map_base map_base64
 #define matchparams matchparams64
 #define maybe_free_rbtdb maybe_free_rbtdb64
 #define need_headerupdate need_headerupdate64
@@ -245,7 +331,9 @@ typedef isc_uint64_t                    rbtdb_serial_t;
 #define printnode printnode64
 #define prune_tree prune_tree64
 #define rbt_datafixer rbt_datafixer64
+#define rbt_slabsize rbt_slabsize64
 #define rbt_datawriter rbt_datawriter64
+#define rbt_insertresign rbt_insertresign64
 #define rbtdb_write_header rbtdb_write_header64
 #define rbtdb_zero_header rbtdb_zero_header64
 #define rdataset_addglue rdataset_addglue64
@@ -399,6 +487,35 @@ typedef isc_mutex_t nodelock_t;
 #define NODE_WEAKDOWNGRADE(l)   ((void)0)
 #endif
 
+/*%
+ * When node reference counts and node locks are both built on atomic
+ * operations, cache_find() first tries to answer from the node it has
+ * found without taking the node lock: it takes a reference to the node
+ * with a compare-and-swap, walks the node's rdatasets inside an epoch
+ * critical section and binds what it finds.  Anything that would change
+ * the node, such as cleaning up expired data or moving an rdataset in
+ * the LRU list, is left to the locked path.
+ *
+ * In a cache, rdatasets are only unlinked from a node that nobody holds
+ * a reference to.  A writer cleaning up such a node moves its reference
+ * count from zero to RBTDB_REFS_FROZEN until it is done, and lock-free
+ * lookups never take a reference to a frozen node.  A node also stays
+ * frozen while it is on rbtdb->deadnodes, and is thawed by whoever
+ * unlinks it under the node lock, so lock-free lookups never revive a
+ * dead node either.  Headers are retired to rbtdb->epoch rather than
+ * freed, so a lookup that is still walking past an unlinked header never
+ * touches freed memory, and writers only link a new header into a node
+ * once its own links are set.
+ */
+#if defined(ISC_REFCOUNT_HAVESTDATOMIC) && defined(ISC_RWLOCK_USEATOMIC) && \
+    defined(DNS_RBT_USEISCREFCOUNT)
+#define RBTDB_LOCKFREE 1
+#define RBTDB_REFS_FROZEN	0x40000000
+#define PUBLISH_BARRIER()	atomic_thread_fence(memory_order_release)
+#else
+#define PUBLISH_BARRIER()	((void)0)
+#endif
+
 /*%
  * Whether to rate-limit updating the LRU to avoid possible thread contention.
  * Our performance measurement has shown the cost is marginal, so it's defined
@@ -615,6 +732,7 @@ typedef enum {
 typedef struct rbtdb_version {
 	/* Not locked */
 	rbtdb_serial_t                  serial;
+	isc_uint64_t			generation;
 	dns_rbtdb_t *			rbtdb;
 	/*
 	 * Protected in the refcount routines.
@@ -713,6 +831,12 @@ struct dns_rbtdb {
 	isc_mem_t			*hmctx;
 	isc_heap_t                      **heaps;
 
+	/*
+	 * Grace period for headers freed while lock-free lookups may be
+	 * walking past them (cache DB only).
+	 */
+	isc_epoch_t			*epoch;
+
 	/*
 	 * Base values for the mmap() code.
 	 */
@@ -775,6 +899,8 @@ static isc_result_t rdataset_getclosest(dns_rdataset_t *rdataset,
 					dns_name_t *name,
 					dns_rdataset_t *neg,
 					dns_rdataset_t *negsig);
+static inline isc_boolean_t headerupdate_due(rdatasetheader_t *header,
+					       isc_stdtime_t now);
 static inline isc_boolean_t need_headerupdate(rdatasetheader_t *header,
 					      isc_stdtime_t now);
 static void update_header(dns_rbtdb_t *rbtdb, rdatasetheader_t *header,
@@ -926,6 +1052,7 @@ static void setnsec3parameters(dns_db_t *db, rbtdb_version_t *version);
 static void setownercase(rdatasetheader_t *header, const dns_name_t *name);
 
 static isc_boolean_t match_header_version(rbtdb_file_header_t *header);
+static isc_uint64_t header_crc(rbtdb_file_header_t *header);
 
 /* Pad to 32 bytes */
 static char FILE_VERSION[32] = "\0";
@@ -1199,6 +1326,13 @@ free_rbtdb(dns_rbtdb_t *rbtdb, isc_boolean_t log, isc_event_t *event) {
 	if (IS_CACHE(rbtdb) && rbtdb->common.rdclass == dns_rdataclass_in)
 		overmem((dns_db_t *)rbtdb, (isc_boolean_t)-1);
 
+	/*
+	 * Nobody can be looking up anything now, so there is no need to
+	 * defer freeing the headers any longer.
+	 */
+	if (rbtdb->epoch != NULL)
+		isc_epoch_destroy(&rbtdb->epoch);
+
 	REQUIRE(rbtdb->current_version != NULL || EMPTY(rbtdb->open_versions));
 	REQUIRE(rbtdb->future_version == NULL);
 
@@ -1458,6 +1592,7 @@ allocate_version(isc_mem_t *mctx, rbtdb_serial_t serial,
 	if (version == NULL)
 		return (NULL);
 	version->serial = serial;
+	version->generation = dns_db_newgeneration();
 	result = isc_refcount_init(&version->references, references);
 	if (result != ISC_R_SUCCESS) {
 		isc_mem_put(mctx, version, sizeof(*version));
@@ -1684,9 +1819,33 @@ new_rdataset(dns_rbtdb_t *rbtdb, isc_mem_t *mctx) {
 	return (h);
 }
 
+/*
+ * Free the memory of a header which has already been unlinked from
+ * its node and from the LRU list and heap.  This may be deferred by
+ * free_rdataset() until no lock-free lookup can still see the header.
+ */
+static void
+release_rdataset(void *arg1, void *arg2) {
+	isc_mem_t *mctx = arg1;
+	rdatasetheader_t *rdataset = arg2;
+	unsigned int size;
+
+	if (rdataset->noqname != NULL)
+		free_noqname(mctx, &rdataset->noqname);
+	if (rdataset->closest != NULL)
+		free_noqname(mctx, &rdataset->closest);
+
+	if (NONEXISTENT(rdataset))
+		size = sizeof(*rdataset);
+	else
+		size = dns_rdataslab_size((unsigned char *)rdataset,
+					  sizeof(*rdataset));
+
+	isc_mem_put(mctx, rdataset, size);
+}
+
 static inline void
 free_rdataset(dns_rbtdb_t *rbtdb, isc_mem_t *mctx, rdatasetheader_t *rdataset) {
-	unsigned int size;
 	int idx;
 
 	if (EXISTS(rdataset) &&
@@ -1704,21 +1863,19 @@ free_rdataset(dns_rbtdb_t *rbtdb, isc_mem_t *mctx, rdatasetheader_t *rdataset) {
 		isc_heap_delete(rbtdb->heaps[idx], rdataset->heap_index);
 	rdataset->heap_index = 0;
 
-	if (rdataset->noqname != NULL)
-		free_noqname(mctx, &rdataset->noqname);
-	if (rdataset->closest != NULL)
-		free_noqname(mctx, &rdataset->closest);
-
-	if (NONEXISTENT(rdataset))
-		size = sizeof(*rdataset);
-	else
-		size = dns_rdataslab_size((unsigned char *)rdataset,
-					  sizeof(*rdataset));
-
-	if (rdataset->is_mmapped == 1)
+	if (rdataset->is_mmapped == 1) {
+		if (rdataset->noqname != NULL)
+			free_noqname(mctx, &rdataset->noqname);
+		if (rdataset->closest != NULL)
+			free_noqname(mctx, &rdataset->closest);
 		return;
+	}
 
-	isc_mem_put(mctx, rdataset, size);
+	if (rbtdb->epoch != NULL)
+		isc_epoch_retire(rbtdb->epoch, release_rdataset, mctx,
+				 rdataset);
+	else
+		release_rdataset(mctx, rdataset);
 }
 
 static inline void
@@ -2119,6 +2276,114 @@ new_reference(dns_rbtdb_t *rbtdb, dns_rbtnode_t *node) {
 	INSIST(noderefs != 0);
 }
 
+#ifdef RBTDB_LOCKFREE
+/*
+ * Take a reference to 'node' without holding the node lock.  This fails
+ * if the node is frozen.  The caller must hold the tree lock.
+ */
+static inline isc_boolean_t
+reference_unlocked(dns_rbtdb_t *rbtdb, dns_rbtnode_t *node) {
+	int_fast32_t refs;
+
+	refs = atomic_load(&node->references.refs);
+	do {
+		if (refs >= RBTDB_REFS_FROZEN)
+			return (ISC_FALSE);
+	} while (!atomic_compare_exchange_weak(&node->references.refs,
+					       &refs, refs + 1));
+
+	if (refs == 0)
+		isc_refcount_increment0(&rbtdb->node_locks[node->locknum].
+					references, NULL);
+	return (ISC_TRUE);
+}
+
+/*
+ * Drop a reference to 'node' without holding the node lock.  This fails
+ * rather than drop the last reference, as that is when
+ * decrement_reference() may have to clean up the node.
+ */
+static inline isc_boolean_t
+dereference_unlocked(dns_rbtnode_t *node) {
+	int_fast32_t refs;
+
+	refs = atomic_load(&node->references.refs);
+	do {
+		INSIST(refs > 0 && refs < RBTDB_REFS_FROZEN);
+		if (refs == 1)
+			return (ISC_FALSE);
+	} while (!atomic_compare_exchange_weak(&node->references.refs,
+					       &refs, refs - 1));
+
+	return (ISC_TRUE);
+}
+#endif
+
+/*
+ * Drop a reference to 'node', freezing it if that was the last one.
+ * Caller must hold the node write lock.
+ */
+static inline unsigned int
+dereference_freeze(dns_rbtnode_t *node) {
+#ifdef RBTDB_LOCKFREE
+	int_fast32_t refs;
+
+	refs = atomic_load(&node->references.refs);
+	do {
+		INSIST(refs > 0 && refs < RBTDB_REFS_FROZEN);
+	} while (!atomic_compare_exchange_weak(&node->references.refs, &refs,
+					       (refs == 1) ?
+					       RBTDB_REFS_FROZEN : refs - 1));
+
+	return ((unsigned int)refs - 1);
+#else
+	unsigned int nrefs;
+
+	dns_rbtnode_refdecrement(node, &nrefs);
+	INSIST((int)nrefs >= 0);
+	return (nrefs);
+#endif
+}
+
+/*
+ * Freeze 'node' if nobody holds a reference to it, so that its headers
+ * can be freed.  Caller must hold the node write lock.
+ */
+static inline isc_boolean_t
+freeze_node(dns_rbtnode_t *node) {
+#ifdef RBTDB_LOCKFREE
+	int_fast32_t refs = 0;
+
+	return (ISC_TF(atomic_compare_exchange_strong(&node->references.refs,
+						      &refs,
+						      RBTDB_REFS_FROZEN)));
+#else
+	return (ISC_TF(dns_rbtnode_refcurrent(node) == 0));
+#endif
+}
+
+static inline void
+thaw_node(dns_rbtnode_t *node) {
+#ifdef RBTDB_LOCKFREE
+	INSIST(atomic_load(&node->references.refs) == RBTDB_REFS_FROZEN);
+	atomic_store(&node->references.refs, 0);
+#else
+	UNUSED(node);
+#endif
+}
+
+/*
+ * Take 'node' off the dead node list and thaw it.  Caller must hold the
+ * node write lock.
+ */
+static inline void
+unlink_dead_node(dns_rbtdb_t *rbtdb, dns_rbtnode_t *node,
+		 unsigned int bucket)
+{
+	ISC_LIST_UNLINK(rbtdb->deadnodes[bucket], node, deadlink);
+	thaw_node(node);
+}
+
 /*%
  * Clean up dead nodes.  These are nodes which have no references, and
  * have no data.  They are dead but we could not or chose not to delete
@@ -2134,7 +2399,7 @@ cleanup_dead_nodes(dns_rbtdb_t *rbtdb, int bucketnum) {
 
 	node = ISC_LIST_HEAD(rbtdb->deadnodes[bucketnum]);
 	while (node != NULL && count > 0) {
-		ISC_LIST_UNLINK(rbtdb->deadnodes[bucketnum], node, deadlink);
+		unlink_dead_node(rbtdb, node, bucketnum);
 
 		/*
 		 * Since we're holding a tree write lock, it should be
@@ -2161,6 +2426,7 @@ cleanup_dead_nodes(dns_rbtdb_t *rbtdb, int bucketnum) {
 				ev->ev_sender = db;
 				isc_task_send(rbtdb->task, &ev);
 			} else {
+				RUNTIME_CHECK(freeze_node(node));
 				ISC_LIST_APPEND(rbtdb->deadnodes[bucketnum],
 						node, deadlink);
 			}
@@ -2213,8 +2479,7 @@ reactivate_node(dns_rbtdb_t *rbtdb, dns_rbtnode_t *node,
 		POST(locktype);
 		NODE_WEAKLOCK(nodelock, locktype);
 		if (ISC_LINK_LINKED(node, deadlink))
-			ISC_LIST_UNLINK(rbtdb->deadnodes[node->locknum],
-					node, deadlink);
+			unlink_dead_node(rbtdb, node, node->locknum);
 		if (maybe_cleanup)
 			cleanup_dead_nodes(rbtdb, node->locknum);
 	}
@@ -2251,6 +2516,7 @@ decrement_reference(dns_rbtdb_t *rbtdb, dns_rbtnode_t *node,
 	unsigned int refs, nrefs;
 	int bucket = node->locknum;
 	isc_boolean_t no_reference = ISC_TRUE;
+	isc_boolean_t frozen;
 
 	nodelock = &rbtdb->node_locks[bucket];
 
@@ -2275,14 +2541,14 @@ decrement_reference(dns_rbtdb_t *rbtdb, dns_rbtnode_t *node,
 		NODE_WEAKLOCK(&nodelock->lock, isc_rwlocktype_write);
 	}
 
-	dns_rbtnode_refdecrement(node, &nrefs);
-	INSIST((int)nrefs >= 0);
+	nrefs = dereference_freeze(node);
 	if (nrefs > 0) {
 		/* Restore the lock? */
 		if (nlock == isc_rwlocktype_read)
 			NODE_WEAKDOWNGRADE(&nodelock->lock);
 		return (ISC_FALSE);
 	}
+	frozen = ISC_TRUE;
 
 	if (node->dirty) {
 		if (IS_CACHE(rbtdb))
@@ -2365,6 +2631,8 @@ decrement_reference(dns_rbtdb_t *rbtdb, dns_rbtnode_t *node,
 						prune_tree, node,
 						sizeof(isc_event_t));
 			if (ev != NULL) {
+				thaw_node(node);
+				frozen = ISC_FALSE;
 				new_reference(rbtdb, node);
 				db = NULL;
 				attach((dns_db_t *)rbtdb, &db);
@@ -2391,17 +2659,24 @@ decrement_reference(dns_rbtdb_t *rbtdb, dns_rbtnode_t *node,
 				INSIST(!ISC_LINK_LINKED(node, deadlink));
 				ISC_LIST_APPEND(rbtdb->deadnodes[bucket], node,
 						deadlink);
+				frozen = ISC_FALSE;
 			}
 		} else {
+			thaw_node(node);
+			frozen = ISC_FALSE;
 			delete_node(rbtdb, node);
 		}
 	} else {
 		INSIST(node->data == NULL);
 		INSIST(!ISC_LINK_LINKED(node, deadlink));
 		ISC_LIST_APPEND(rbtdb->deadnodes[bucket], node, deadlink);
+		frozen = ISC_FALSE;
 	}
 
  restore_locks:
+	if (frozen)
+		thaw_node(node);
+
 	/* Restore the lock? */
 	if (nlock == isc_rwlocktype_read)
 		NODE_WEAKDOWNGRADE(&nodelock->lock);
@@ -2469,8 +2744,7 @@ prune_tree(isc_task_t *task, isc_event_t *event) {
 			 * reactivate_node().
 			 */
 			if (ISC_LINK_LINKED(parent, deadlink))
-				ISC_LIST_UNLINK(rbtdb->deadnodes[locknum],
-						parent, deadlink);
+				unlink_dead_node(rbtdb, parent, locknum);
 			new_reference(rbtdb, parent);
 		} else
 			parent = NULL;
@@ -3718,7 +3992,12 @@ find_wildcard(rbtdb_search_t *search, dns_rbtnode_t **nodep,
 			wname = dns_fixedname_name(&fwname);
 			result = dns_name_concatenate(dns_wildcardname, &name,
 						      wname, NULL);
+#ifdef DNS_RBTDB_QP
+			/* The node name is already absolute. */
+			j = 0;
+#else
 			j = i;
+#endif
 			while (result == ISC_R_SUCCESS && j != 0) {
 				j--;
 				level_node = search->chain.levels[j];
@@ -4717,7 +4996,7 @@ check_stale_header(dns_rbtnode_t *node, rdatasetheader_t *header,
 			 */
 			*locktype = isc_rwlocktype_write;
 
-			if (dns_rbtnode_refcurrent(node) == 0) {
+			if (freeze_node(node)) {
 				isc_mem_t *mctx;
 
 				/*
@@ -4735,6 +5014,7 @@ check_stale_header(dns_rbtnode_t *node, rdatasetheader_t *header,
 				else
 					node->data = header->next;
 				free_rdataset(search->rbtdb, mctx, header);
+				thaw_node(node);
 			} else {
 				mark_header_ancient(search->rbtdb, header);
 				*header_prev = header;
@@ -4887,6 +5167,13 @@ find_deepest_zonecut(rbtdb_search_t *search, dns_rbtnode_t *node,
 				dns_name_init(&name, NULL);
 				dns_rbt_namefromnode(node, &name);
 				result = dns_name_copy(&name, foundname, NULL);
+#ifdef DNS_RBTDB_QP
+				/*
+				 * The node name is already absolute, and
+				 * 'i' is not needed once a cut is found.
+				 */
+				i = 0;
+#endif
 				while (result == ISC_R_SUCCESS && i > 0) {
 					i--;
 					level_node = search->chain.levels[i];
@@ -5038,6 +5325,134 @@ find_coveringnsec(rbtdb_search_t *search, dns_dbnode_t **nodep,
 	return (result);
 }
 
+#ifdef RBTDB_LOCKFREE
+/*
+ * Try to answer a cache lookup for 'node' without taking its node lock.
+ * This handles the common case of a name which has the type we are
+ * looking for (or a CNAME or a negative entry) and whose rdatasets
+ * neither need cleaning nor an LRU update.  Anything else returns
+ * ISC_FALSE, and the caller falls back to the locked path.
+ *
+ * The caller must hold the tree lock.  The headers are protected by
+ * the rbtdb epoch while the list is walked, and by the node reference
+ * once it has been taken, as headers are only freed from a node with no
+ * references.
+ */
+static isc_boolean_t
+cache_find_unlocked(rbtdb_search_t *search, dns_rbtnode_t *node,
+		    dns_rdatatype_t type, isc_boolean_t cname_ok,
+		    dns_dbnode_t **nodep, dns_rdataset_t *rdataset,
+		    dns_rdataset_t *sigrdataset, isc_result_t *resultp)
+{
+	dns_rbtdb_t *rbtdb = search->rbtdb;
+	rdatasetheader_t *header, *found, *foundsig, *cnamesig;
+	rbtdb_rdatatype_t sigtype, negtype;
+	isc_boolean_t answered = ISC_FALSE;
+	isc_result_t result;
+	nodelock_t *lock;
+	unsigned int token;
+
+	/*
+	 * An empty node may be dead; it is frozen while it is on the
+	 * dead node list, but there is nothing to answer from anyway.
+	 */
+	if (type == dns_rdatatype_any || node->data == NULL ||
+	    !reference_unlocked(rbtdb, node))
+		return (ISC_FALSE);
+
+	token = isc_epoch_enter(rbtdb->epoch);
+
+	found = NULL;
+	foundsig = NULL;
+	cnamesig = NULL;
+	sigtype = RBTDB_RDATATYPE_VALUE(dns_rdatatype_rrsig, type);
+	negtype = RBTDB_RDATATYPE_VALUE(0, type);
+	for (header = node->data; header != NULL; header = header->next) {
+		/*
+		 * Stale data has to be cleaned up or marked, which needs
+		 * the node lock.
+		 */
+		if (!ANCIENT(header) &&
+		    (!ACTIVE(header, search->now) || STALE(header)))
+			goto done;
+		if (!EXISTS(header) || ANCIENT(header))
+			continue;
+
+		if (header->type == type ||
+		    (cname_ok && header->type == dns_rdatatype_cname)) {
+			found = header;
+			if (header->type == dns_rdatatype_cname &&
+			    cnamesig != NULL)
+				foundsig = cnamesig;
+		} else if (header->type == sigtype) {
+			foundsig = header;
+		} else if (header->type == RBTDB_RDATATYPE_NCACHEANY ||
+			   header->type == negtype) {
+			found = header;
+		} else if (cname_ok &&
+			   header->type == RBTDB_RDATATYPE_SIGCNAME) {
+			cnamesig = header;
+		}
+	}
+
+	if (found == NULL ||
+	    (DNS_TRUST_ADDITIONAL(found->trust) &&
+	     ((search->options & DNS_DBFIND_ADDITIONALOK) == 0)) ||
+	    (found->trust == dns_trust_glue &&
+	     ((search->options & DNS_DBFIND_GLUEOK) == 0)) ||
+	    (DNS_TRUST_PENDING(found->trust) &&
+	     ((search->options & DNS_DBFIND_PENDINGOK) == 0)))
+		goto done;
+
+	if (headerupdate_due(found, search->now) ||
+	    (!NEGATIVE(found) && foundsig != NULL &&
+	     headerupdate_due(foundsig, search->now)))
+		goto done;
+
+	if (NEGATIVE(found)) {
+		if (NXDOMAIN(found))
+			result = DNS_R_NCACHENXDOMAIN;
+		else
+			result = DNS_R_NCACHENXRRSET;
+	} else if (type != found->type &&
+		   found->type == dns_rdatatype_cname) {
+		result = DNS_R_CNAME;
+	} else
+		result = ISC_R_SUCCESS;
+
+	bind_rdataset(rbtdb, node, found, search->now, rdataset);
+	if (!NEGATIVE(found) && foundsig != NULL)
+		bind_rdataset(rbtdb, node, foundsig, search->now, sigrdataset);
+
+	/*
+	 * The reference taken above becomes the caller's.
+	 */
+	if (nodep != NULL)
+		*nodep = node;
+
+	*resultp = result;
+	answered = ISC_TRUE;
+
+ done:
+	isc_epoch_exit(rbtdb->epoch, token);
+	if ((!answered || nodep == NULL) &&
+	    !dereference_unlocked(node))
+	{
+		/*
+		 * This was the last reference, and the node may need
+		 * cleaning up.
+		 */
+		lock = &rbtdb->node_locks[node->locknum].lock;
+		NODE_LOCK(lock, isc_rwlocktype_read);
+		decrement_reference(rbtdb, node, 0, isc_rwlocktype_read,
+				    isc_rwlocktype_read, ISC_FALSE);
+		NODE_UNLOCK(lock, isc_rwlocktype_read);
+	}
+
+	return (answered);
+}
+#endif
+
 static isc_result_t
 cache_find(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
 	   dns_rdatatype_t type, unsigned int options, isc_stdtime_t now,
@@ -5124,6 +5539,13 @@ cache_find(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
 	if (type == dns_rdatatype_key || type == dns_rdatatype_nsec)
 		cname_ok = ISC_FALSE;
 
+#ifdef RBTDB_LOCKFREE
+	if (search.zonecut == NULL &&
+	    cache_find_unlocked(&search, node, type, cname_ok, nodep,
+				rdataset, sigrdataset, &result))
+		goto tree_exit;
+#endif
+
 	/*
 	 * We now go looking for rdata...
 	 */
@@ -5559,6 +5981,16 @@ detachnode(dns_db_t *db, dns_dbnode_t **targetp) {
 	node = (dns_rbtnode_t *)(*targetp);
 	nodelock = &rbtdb->node_locks[node->locknum];
 
+#ifdef RBTDB_LOCKFREE
+	/*
+	 * Only the last reference needs the node lock.
+	 */
+	if (dereference_unlocked(node)) {
+		*targetp = NULL;
+		return;
+	}
+#endif
+
 	NODE_LOCK(&nodelock->lock, isc_rwlocktype_read);
 
 	if (decrement_reference(rbtdb, node, 0, isc_rwlocktype_read,
@@ -6516,11 +6948,12 @@ add32(dns_rbtdb_t *rbtdb, dns_rbtnode_t *rbtnode, rbtdb_version_t *rbtversion,
 			 * Since we don't generate changed records when
 			 * loading, we MUST clean up 'header' now.
 			 */
+			newheader->next = topheader->next;
+			PUBLISH_BARRIER();
 			if (topheader_prev != NULL)
 				topheader_prev->next = newheader;
 			else
 				rbtnode->data = newheader;
-			newheader->next = topheader->next;
 			if (rbtversion != NULL && !header_nx) {
 				RWLOCK(&rbtversion->rwlock,
 				       isc_rwlocktype_write);
@@ -6558,12 +6991,13 @@ add32(dns_rbtdb_t *rbtdb, dns_rbtnode_t *rbtnode, rbtdb_version_t *rbtversion,
 				}
 				resign_delete(rbtdb, rbtversion, header);
 			}
+			newheader->next = topheader->next;
+			newheader->down = topheader;
+			PUBLISH_BARRIER();
 			if (topheader_prev != NULL)
 				topheader_prev->next = newheader;
 			else
 				rbtnode->data = newheader;
-			newheader->next = topheader->next;
-			newheader->down = topheader;
 			topheader->next = newheader;
 			rbtnode->dirty = 1;
 			if (changed != NULL)
@@ -6635,12 +7069,13 @@ add32(dns_rbtdb_t *rbtdb, dns_rbtnode_t *rbtnode, rbtdb_version_t *rbtversion,
 			INSIST(!loading);
 			INSIST(rbtversion == NULL ||
 			       rbtversion->serial >= topheader->serial);
+			newheader->next = topheader->next;
+			newheader->down = topheader;
+			PUBLISH_BARRIER();
 			if (topheader_prev != NULL)
 				topheader_prev->next = newheader;
 			else
 				rbtnode->data = newheader;
-			newheader->next = topheader->next;
-			newheader->down = topheader;
 			topheader->next = newheader;
 			rbtnode->dirty = 1;
 			if (changed != NULL)
@@ -6651,6 +7086,7 @@ add32(dns_rbtdb_t *rbtdb, dns_rbtnode_t *rbtnode, rbtdb_version_t *rbtversion,
 			 */
 			newheader->next = rbtnode->data;
 			newheader->down = NULL;
+			PUBLISH_BARRIER();
 			rbtnode->data = newheader;
 		}
 	}
@@ -7455,63 +7891,130 @@ loading_addrdataset(void *arg, const dns_name_t *name,
 	return (result);
 }
 
+/*
+ * Find the size of the slab which starts with the header at 'p', as
+ * dns_rdataslab_size() does, but without reading past 'limit'.
+ */
+static isc_result_t
+rbt_slabsize(unsigned char *p, unsigned char *limit, size_t *sizep) {
+	unsigned int count, length;
+	unsigned char *current = p + sizeof(rdatasetheader_t);
+
+	if (limit - current < 2)
+		return (ISC_R_INVALIDFILE);
+	count = *current++ * 256;
+	count += *current++;
+#if DNS_RDATASET_FIXED
+	if ((size_t)(limit - current) < 4 * count)
+		return (ISC_R_INVALIDFILE);
+	current += (4 * count);
+#endif
+	while (count > 0) {
+		count--;
+		if (limit - current < 2)
+			return (ISC_R_INVALIDFILE);
+		length = *current++ * 256;
+		length += *current++;
+#if DNS_RDATASET_FIXED
+		length += 2;
+#endif
+		if ((size_t)(limit - current) < length)
+			return (ISC_R_INVALIDFILE);
+		current += length;
+	}
+
+	*sizep = current - p;
+	return (ISC_R_SUCCESS);
+}
+
 static isc_result_t
 rbt_datafixer(dns_rbtnode_t *rbtnode, void *base, size_t filesize,
 	      void *arg, isc_uint64_t *crc)
 {
-	isc_result_t result;
-	dns_rbtdb_t *rbtdb = (dns_rbtdb_t *) arg;
-	rdatasetheader_t *header;
+	rbtdb_fixer_t *fixer = (rbtdb_fixer_t *) arg;
+	rdatasetheader_t *header, *next;
 	unsigned char *limit = ((unsigned char *) base) + filesize;
 	unsigned char *p;
 	size_t size;
-	unsigned int count;
 
 	REQUIRE(rbtnode != NULL);
+	REQUIRE(fixer != NULL);
 
 	for (header = rbtnode->data; header != NULL; header = header->next) {
 		p = (unsigned char *) header;
 
-		size = dns_rdataslab_size(p, sizeof(*header));
-		count = dns_rdataslab_count(p, sizeof(*header));;
-		rbtdb->current_version->records += count;
-		rbtdb->current_version->bytes += size;
+		if (p + sizeof(*header) > limit ||
+		    rbt_slabsize(p, limit, &size) != ISC_R_SUCCESS)
+			return (ISC_R_INVALIDFILE);
 		isc_crc64_update(crc, p, size);
 #ifdef DEBUG
 		hexdump("hashing header", p, sizeof(rdatasetheader_t));
 		hexdump("hashing slab", p + sizeof(rdatasetheader_t),
 			size - sizeof(rdatasetheader_t));
 #endif
-		header->serial = 1;
-		header->is_mmapped = 1;
-		header->node = rbtnode;
-		header->node_is_relative = 0;
-
-		if (rbtdb != NULL && RESIGN(header) &&
+		fixer->records += dns_rdataslab_count(p, sizeof(*header));
+		fixer->bytes += size;
+		if (RESIGN(header) &&
 		    (header->resign != 0 || header->resign_lsb != 0))
-		{
-			int idx = header->node->locknum;
-			result = isc_heap_insert(rbtdb->heaps[idx], header);
-			if (result != ISC_R_SUCCESS)
-				return (result);
-		}
+			fixer->resign++;
+
+		header->node = rbtnode;
 
+		/*
+		 * The next header always follows this one.
+		 */
 		if (header->next != NULL) {
 			size_t cooked = dns_rbt_serialize_align(size);
-			if ((uintptr_t)header->next !=
-				    (p - (unsigned char *)base) + cooked)
-				return (ISC_R_INVALIDFILE);
-			header->next = (rdatasetheader_t *)(p + cooked);
-			header->next_is_relative = 0;
-			if ((header->next < (rdatasetheader_t *) base) ||
-			    (header->next > (rdatasetheader_t *) limit))
+			next = (rdatasetheader_t *)(p + cooked);
+			if ((unsigned char *) next >= limit)
 				return (ISC_R_INVALIDFILE);
+			header->next = next;
 		}
 	}
 
 	return (ISC_R_SUCCESS);
 }
 
+/*
+ * Put the headers in 'rbt' which are due to be re-signed on the resign
+ * heaps.  Only images which the header says have such headers need
+ * this walk.
+ */
+static isc_result_t
+rbt_insertresign(dns_rbtdb_t *rbtdb, dns_rbt_t *rbt) {
+	dns_rbtnodechain_t chain;
+	dns_rbtnode_t *node;
+	rdatasetheader_t *header;
+	isc_result_t result;
+
+	dns_rbtnodechain_init(&chain, rbtdb->common.mctx);
+	result = dns_rbtnodechain_first(&chain, rbt, NULL, NULL);
+	while (result == ISC_R_SUCCESS || result == DNS_R_NEWORIGIN) {
+		node = NULL;
+		result = dns_rbtnodechain_current(&chain, NULL, NULL, &node);
+		if (result != ISC_R_SUCCESS)
+			break;
+		for (header = node->data; header != NULL;
+		     header = header->next)
+		{
+			if (!RESIGN(header) ||
+			    (header->resign == 0 && header->resign_lsb == 0))
+				continue;
+			result = isc_heap_insert(rbtdb->heaps[node->locknum],
+						 header);
+			if (result != ISC_R_SUCCESS)
+				goto cleanup;
+		}
+		result = dns_rbtnodechain_next(&chain, NULL, NULL);
+	}
+	if (result == ISC_R_NOMORE)
+		result = ISC_R_SUCCESS;
+
+ cleanup:
+	dns_rbtnodechain_invalidate(&chain);
+	return (result);
+}
+
 /*
  * Load the RBT database from the image in 'f'
  */
@@ -7520,38 +8023,61 @@ deserialize32(void *arg, FILE *f, off_t offset) {
 	isc_result_t result;
 	rbtdb_load_t *loadctx = arg;
 	dns_rbtdb_t *rbtdb = loadctx->rbtdb;
-	rbtdb_file_header_t *header;
+	rbtdb_file_header_t *header, fileheader;
 	int fd;
 	off_t filesize = 0;
 	char *base;
+	void *hint = NULL;
 	dns_rbt_t *tree = NULL, *nsec = NULL, *nsec3 = NULL;
 	int protect, flags;
 	dns_rbtnode_t *origin_node = NULL;
+	rbtdb_fixer_t fixer;
 
 	REQUIRE(VALID_RBTDB(rbtdb));
 
+	fixer.records = 0;
+	fixer.bytes = 0;
+	fixer.resign = 0;
+
 	/*
-	 * TODO CKB: since this is read-write (had to be to add nodes later)
-	 * we will need to lock the file or the nodes in it before modifying
-	 * the nodes in the file.
+	 * Read the header to find out where the image was laid out to
+	 * be mapped.
 	 */
-
-	/* Map in the whole file in one go */
 	fd = fileno(f);
 	isc_file_getsizefd(fd, &filesize);
+	if (filesize < offset + (off_t) sizeof(fileheader))
+		return (ISC_R_INVALIDFILE);
+	result = isc_stdio_seek(f, offset, SEEK_SET);
+	if (result == ISC_R_SUCCESS)
+		result = isc_stdio_read(&fileheader, 1, sizeof(fileheader),
+					f, NULL);
+	if (result != ISC_R_SUCCESS)
+		return (result);
+	if (fileheader.ptrsize == sizeof(void *))
+		hint = (void *)(uintptr_t) fileheader.base;
+
+	/*
+	 * Map in the whole file in one go.  The mapping is private, so
+	 * the nodes can be written as they are referenced and the tree
+	 * changed by updates, but the pages which are only read stay
+	 * shared with the page cache and with any other process which
+	 * maps the same file.
+	 */
 	protect = PROT_READ|PROT_WRITE;
 	flags = MAP_PRIVATE;
 #ifdef MAP_FILE
 	flags |= MAP_FILE;
 #endif
 
-	base = isc_file_mmap(NULL, filesize, protect, flags, fd, 0);
+	base = isc_file_mmap(hint, filesize, protect, flags, fd, 0);
 	if (base == NULL || base == MAP_FAILED) {
 		return (ISC_R_FAILURE);
 	}
 
 	header = (rbtdb_file_header_t *)(base + offset);
-	if (!match_header_version(header)) {
+	if (!match_header_version(header) ||
+	    header->headercrc != header_crc(header))
+	{
 		result = ISC_R_INVALIDFILE;
 		goto cleanup;
 	}
@@ -7561,7 +8087,7 @@ deserialize32(void *arg, FILE *f, off_t offset) {
 						  (off_t) header->tree,
 						  rbtdb->common.mctx,
 						  delete_callback, rbtdb,
-						  rbt_datafixer, rbtdb,
+						  rbt_datafixer, &fixer,
 						  NULL, &tree);
 		if (result != ISC_R_SUCCESS)
 			goto cleanup;
@@ -7578,7 +8104,7 @@ deserialize32(void *arg, FILE *f, off_t offset) {
 						  (off_t) header->nsec,
 						  rbtdb->common.mctx,
 						  delete_callback, rbtdb,
-						  rbt_datafixer, rbtdb,
+						  rbt_datafixer, &fixer,
 						  NULL, &nsec);
 		if (result != ISC_R_SUCCESS)
 			goto cleanup;
@@ -7589,12 +8115,36 @@ deserialize32(void *arg, FILE *f, off_t offset) {
 						  (off_t) header->nsec3,
 						  rbtdb->common.mctx,
 						  delete_callback, rbtdb,
-						  rbt_datafixer, rbtdb,
+						  rbt_datafixer, &fixer,
 						  NULL, &nsec3);
 		if (result != ISC_R_SUCCESS)
 			goto cleanup;
 	}
 
+	/*
+	 * The totals in the header are used as they are, so when the
+	 * image has been relocated, and so checked in full, they must
+	 * agree with it.  An image mapped where it was laid out to be is
+	 * not walked, and its header is trusted.
+	 */
+	if (header->base != (uintptr_t) base &&
+	    (header->records != fixer.records ||
+	     header->bytes != fixer.bytes ||
+	     header->resign != fixer.resign))
+	{
+		result = ISC_R_INVALIDFILE;
+		goto cleanup;
+	}
+
+	if (header->resign != 0) {
+		if (tree != NULL)
+			result = rbt_insertresign(rbtdb, tree);
+		if (result == ISC_R_SUCCESS && nsec3 != NULL)
+			result = rbt_insertresign(rbtdb, nsec3);
+		if (result != ISC_R_SUCCESS)
+			goto cleanup;
+	}
+
 	/*
 	 * We have a successfully loaded all the rbt trees now update
 	 * rbtdb to use them.
@@ -7602,6 +8152,8 @@ deserialize32(void *arg, FILE *f, off_t offset) {
 
 	rbtdb->mmap_location = base;
 	rbtdb->mmap_size = (size_t) filesize;
+	rbtdb->current_version->records += header->records;
+	rbtdb->current_version->bytes += header->bytes;
 
 	if (tree != NULL) {
 		dns_rbt_destroy(&rbtdb->tree);
@@ -7705,44 +8257,63 @@ endload(dns_db_t *db, dns_rdatacallbacks_t *callbacks) {
 	return (ISC_R_SUCCESS);
 }
 
+/*
+ * Return the header of the rdataset headed by 'header' which is to be
+ * written out for 'serial', or NULL if there is none.
+ */
+static inline rdatasetheader_t *
+dumpable_header(rdatasetheader_t *header, rbtdb_serial_t serial) {
+	do {
+		if (header->serial <= serial && !IGNORE(header)) {
+			if (NONEXISTENT(header))
+				header = NULL;
+			break;
+		} else
+			header = header->down;
+	} while (header != NULL);
+
+	return (header);
+}
+
 /*
  * helper function to handle writing out the rdataset data pointed to
  * by the void *data pointer in the dns_rbtnode
  */
 static isc_result_t
-rbt_datawriter(FILE *rbtfile, unsigned char *data, void *arg,
-	       isc_uint64_t *crc)
+rbt_datawriter(FILE *rbtfile, unsigned char *data, void *base,
+	       dns_rbtnode_t *node, void *arg, isc_uint64_t *crc)
 {
-	rbtdb_version_t *version = (rbtdb_version_t *) arg;
+	rbtdb_writer_t *writer = (rbtdb_writer_t *) arg;
 	rbtdb_serial_t serial;
 	rdatasetheader_t newheader;
-	rdatasetheader_t *header = (rdatasetheader_t *) data, *next;
+	rdatasetheader_t *header, *top;
 	off_t where;
 	size_t cooked, size;
 	unsigned char *p;
 	isc_result_t result = ISC_R_SUCCESS;
 	char pad[sizeof(char *)];
+	unsigned int count = 0;
 	uintptr_t off;
 
 	REQUIRE(rbtfile != NULL);
 	REQUIRE(data != NULL);
-	REQUIRE(version != NULL);
+	REQUIRE(writer != NULL && writer->version != NULL);
 
-	serial = version->serial;
+	serial = writer->version->serial;
 
-	for (; header != NULL; header = next) {
-		next = header->next;
-		do {
-			if (header->serial <= serial && !IGNORE(header)) {
-				if (NONEXISTENT(header))
-					header = NULL;
-				break;
-			} else
-				header = header->down;
-		} while (header != NULL);
+	/*
+	 * Count the rdatasets first, so that the last one written
+	 * does not point at a header which is then skipped.
+	 */
+	for (top = (rdatasetheader_t *) data; top != NULL; top = top->next)
+		if (dumpable_header(top, serial) != NULL)
+			count++;
 
+	for (top = (rdatasetheader_t *) data; top != NULL; top = top->next) {
+		header = dumpable_header(top, serial);
 		if (header == NULL)
 			continue;
+		count--;
 
 		CHECK(isc_stdio_tell(rbtfile, &where));
 		size = dns_rdataslab_size((unsigned char *) header,
@@ -7755,8 +8326,11 @@ rbt_datawriter(FILE *rbtfile, unsigned char *data, void *arg,
 		off = where;
 		if ((off_t)off != where)
 			return (ISC_R_RANGE);
-		newheader.node = (dns_rbtnode_t *) off;
-		newheader.node_is_relative = 1;
+		newheader.node = node;
+		newheader.node_is_relative = 0;
+		newheader.next_is_relative = 0;
+		newheader.is_mmapped = 1;
+		newheader.heap_index = 0;
 		newheader.serial = 1;
 
 		/*
@@ -7764,10 +8338,16 @@ rbt_datawriter(FILE *rbtfile, unsigned char *data, void *arg,
 		 * will be properly aligned when read back in.
 		 */
 		cooked = dns_rbt_serialize_align(size);
-		if (next != NULL) {
-			newheader.next = (rdatasetheader_t *) (off + cooked);
-			newheader.next_is_relative = 1;
-		}
+		if (count != 0)
+			newheader.next = (rdatasetheader_t *)
+				((uintptr_t) base + off + cooked);
+
+		writer->records += dns_rdataslab_count(p,
+						sizeof(rdatasetheader_t));
+		writer->bytes += size;
+		if (RESIGN(header) &&
+		    (header->resign != 0 || header->resign_lsb != 0))
+			writer->resign++;
 
 #ifdef DEBUG
 		hexdump("writing header", (unsigned char *) &newheader,
@@ -7836,7 +8416,7 @@ init_file_version(void) {
  */
 static isc_result_t
 rbtdb_write_header(FILE *rbtfile, off_t tree_location, off_t nsec_location,
-		   off_t nsec3_location)
+		   off_t nsec3_location, void *base, rbtdb_writer_t *writer)
 {
 	rbtdb_file_header_t header;
 	isc_result_t result;
@@ -7851,6 +8431,11 @@ rbtdb_write_header(FILE *rbtfile, off_t tree_location, off_t nsec_location,
 	header.tree = (isc_uint64_t) tree_location;
 	header.nsec = (isc_uint64_t) nsec_location;
 	header.nsec3 = (isc_uint64_t) nsec3_location;
+	header.base = (uintptr_t) base;
+	header.records = writer->records;
+	header.bytes = writer->bytes;
+	header.resign = writer->resign;
+	header.headercrc = header_crc(&header);
 	result = isc_stdio_write(&header, 1, sizeof(rbtdb_file_header_t),
 			      rbtfile, NULL);
 	fflush(rbtfile);
@@ -7858,6 +8443,22 @@ rbtdb_write_header(FILE *rbtfile, off_t tree_location, off_t nsec_location,
 	return (result);
 }
 
+/*
+ * Checksum the header up to the checksum field.  The header is zeroed
+ * before it is filled in, so its padding is always the same.
+ */
+static isc_uint64_t
+header_crc(rbtdb_file_header_t *header) {
+	isc_uint64_t crc;
+
+	isc_crc64_init(&crc);
+	isc_crc64_update(&crc, (const isc_uint8_t *) header,
+			 offsetof(rbtdb_file_header_t, headercrc));
+	isc_crc64_final(&crc);
+
+	return (crc);
+}
+
 static isc_boolean_t
 match_header_version(rbtdb_file_header_t *header) {
 	RUNTIME_CHECK(isc_once_do(&once, init_file_version) == ISC_R_SUCCESS);
@@ -7873,12 +8474,40 @@ match_header_version(rbtdb_file_header_t *header) {
 	return (ISC_TRUE);
 }
 
+/*
+ * Choose the address an image of 'version' is to be mapped at.
+ */
+static void *
+map_base(dns_rbtdb_t *rbtdb, rbtdb_version_t *version) {
+	isc_uint64_t size, slot, crc;
+
+	if (sizeof(void *) < 8)
+		return (NULL);
+
+	size = version->bytes +
+	       (isc_uint64_t)(dns_rbt_nodecount(rbtdb->tree) +
+			      dns_rbt_nodecount(rbtdb->nsec) +
+			      dns_rbt_nodecount(rbtdb->nsec3)) * MAP_NODESIZE;
+	for (slot = MAP_MINSLOT; slot < size && slot < MAP_REGION; slot <<= 1)
+		;
+
+	isc_crc64_init(&crc);
+	isc_crc64_update(&crc, rbtdb->common.origin.ndata,
+			 rbtdb->common.origin.length);
+	isc_crc64_final(&crc);
+
+	return ((void *)(uintptr_t)(MAP_REGION + (crc % (MAP_REGION / slot)) *
+				    slot));
+}
+
 static isc_result_t
 serialize(dns_db_t *db, dns_dbversion_t *ver, FILE *rbtfile) {
 	rbtdb_version_t *version = (rbtdb_version_t *) ver;
 	dns_rbtdb_t *rbtdb;
+	rbtdb_writer_t writer;
 	isc_result_t result;
 	off_t tree_location, nsec_location, nsec3_location, header_location;
+	void *base;
 
 	rbtdb = (dns_rbtdb_t *)db;
 
@@ -7900,18 +8529,24 @@ serialize(dns_db_t *db, dns_dbversion_t *ver, FILE *rbtfile) {
 	 * NOTE: need to do something better with the return codes, &= will
 	 * not work.
 	 */
+	writer.version = version;
+	writer.records = 0;
+	writer.bytes = 0;
+	writer.resign = 0;
+	base = map_base(rbtdb, version);
+
 	CHECK(isc_stdio_tell(rbtfile, &header_location));
 	CHECK(rbtdb_zero_header(rbtfile));
 	CHECK(dns_rbt_serialize_tree(rbtfile, rbtdb->tree, rbt_datawriter,
-				     version, &tree_location));
+				     &writer, base, &tree_location));
 	CHECK(dns_rbt_serialize_tree(rbtfile, rbtdb->nsec, rbt_datawriter,
-				     version, &nsec_location));
+				     &writer, base, &nsec_location));
 	CHECK(dns_rbt_serialize_tree(rbtfile, rbtdb->nsec3, rbt_datawriter,
-				     version, &nsec3_location));
+				     &writer, base, &nsec3_location));
 
 	CHECK(isc_stdio_seek(rbtfile, header_location, SEEK_SET));
 	CHECK(rbtdb_write_header(rbtfile, tree_location, nsec_location,
-				 nsec3_location));
+				 nsec3_location, base, &writer));
  failure:
 	return (result);
 }
@@ -8280,6 +8915,28 @@ setcachestats(dns_db_t *db, isc_stats_t *stats) {
 	return (ISC_R_SUCCESS);
 }
 
+static isc_result_t
+getgeneration(dns_db_t *db, dns_dbversion_t *version,
+	      isc_uint64_t *generationp)
+{
+	dns_rbtdb_t *rbtdb = (dns_rbtdb_t *)db;
+	rbtdb_version_t *rbtversion = version;
+
+	REQUIRE(VALID_RBTDB(rbtdb));
+	REQUIRE(!IS_CACHE(rbtdb));
+	INSIST(rbtversion == NULL || rbtversion->rbtdb == rbtdb);
+
+	if (rbtversion == NULL) {
+		RBTDB_LOCK(&rbtdb->lock, isc_rwlocktype_read);
+		*generationp = rbtdb->current_version->generation;
+		RBTDB_UNLOCK(&rbtdb->lock, isc_rwlocktype_read);
+	} else {
+		*generationp = rbtversion->generation;
+	}
+
+	return (ISC_R_SUCCESS);
+}
+
 static isc_result_t
 setgluecachestats(dns_db_t *db, isc_stats_t *stats) {
 	dns_rbtdb_t *rbtdb = (dns_rbtdb_t *)db;
@@ -8391,7 +9048,8 @@ static dns_dbmethods_t zone_methods = {
 	getsize,
 	NULL,			/* setservestalettl */
 	NULL,			/* getservestalettl */
-	setgluecachestats
+	setgluecachestats,
+	getgeneration
 };
 
 static dns_dbmethods_t cache_methods = {
@@ -8442,12 +9100,15 @@ static dns_dbmethods_t cache_methods = {
 	NULL,			/* getsize */
 	setservestalettl,
 	getservestalettl,
-	NULL
+	NULL,			/* setgluecachestats */
+	NULL			/* getgeneration */
 };
 
 isc_result_t
-#ifdef DNS_RBTDB_VERSION64
+#if defined(DNS_RBTDB_VERSION64)
 dns_rbtdb64_create
+#elif defined(DNS_RBTDB_QP)
+dns_qpdb_create
 #else
 dns_rbtdb_create
 #endif
@@ -8538,6 +9199,11 @@ dns_rbtdb_create
 		}
 		for (i = 0; i < (int)rbtdb->node_lock_count; i++)
 			ISC_LIST_INIT(rbtdb->rdatasets[i]);
+#ifdef RBTDB_LOCKFREE
+		result = isc_epoch_create(mctx, &rbtdb->epoch);
+		if (result != ISC_R_SUCCESS)
+			goto cleanup_rdatasets;
+#endif
 	} else
 		rbtdb->rdatasets = NULL;
 
@@ -8777,6 +9443,8 @@ dns_rbtdb_create
 	}
 
  cleanup_rdatasets:
+	if (rbtdb->epoch != NULL)
+		isc_epoch_destroy(&rbtdb->epoch);
 	if (rbtdb->rdatasets != NULL)
 		isc_mem_put(mctx, rbtdb->rdatasets, rbtdb->node_lock_count *
 			    sizeof(rdatasetheaderlist_t));
@@ -10501,13 +11169,31 @@ no_glue:
  */
 static inline isc_boolean_t
 need_headerupdate(rdatasetheader_t *header, isc_stdtime_t now) {
+#if DNS_RBTDB_LIMITLRUUPDATE
+	return (headerupdate_due(header, now));
+#else
+	UNUSED(now);
+
+	return (ISC_TF((header->attributes &
+			(RDATASET_ATTR_NONEXISTENT |
+			 RDATASET_ATTR_ANCIENT |
+			 RDATASET_ATTR_ZEROTTL)) == 0));
+#endif
+}
+
+/*%
+ * The time based test used by need_headerupdate() when
+ * DNS_RBTDB_LIMITLRUUPDATE is set.  Lookups which do not take the node
+ * lock always use it, as they cannot update the LRU list themselves.
+ */
+static inline isc_boolean_t
+headerupdate_due(rdatasetheader_t *header, isc_stdtime_t now) {
 	if ((header->attributes &
 	     (RDATASET_ATTR_NONEXISTENT |
 	      RDATASET_ATTR_ANCIENT |
 	      RDATASET_ATTR_ZEROTTL)) != 0)
 		return (ISC_FALSE);
 
-#if DNS_RBTDB_LIMITLRUUPDATE
 	if (header->type == dns_rdatatype_ns ||
 	    (header->trust == dns_trust_glue &&
 	     (header->type == dns_rdatatype_a ||
@@ -10521,11 +11207,6 @@ need_headerupdate(rdatasetheader_t *header, isc_stdtime_t now) {
 
 	/* Other records are updated if 5 minutes have passed. */
 	return (header->last_used + 300 <= now);
-#else
-	UNUSED(now);
-
-	return (ISC_TRUE);
-#endif
 }
 
 /*%
@@ -10602,6 +11283,13 @@ overmem_purge(dns_rbtdb_t *rbtdb, unsigned int locknum_start,
 		NODE_UNLOCK(&rbtdb->node_locks[locknum].lock,
 				    isc_rwlocktype_write);
 	}
+
+	/*
+	 * Don't let headers which lock-free lookups might still see pile
+	 * up while memory is short.
+	 */
+	if (rbtdb->epoch != NULL)
+		isc_epoch_reclaim(rbtdb->epoch);
 }
 
 static void
@@ -13,6 +13,7 @@
 
 #include <isc/counter.h>
 #include <isc/log.h>
+#include <isc/mutexblock.h>
 #include <isc/platform.h>
 #include <isc/print.h>
 #include <isc/string.h>
@@ -260,9 +261,13 @@ struct fetchctx {
 	unsigned int			options;
 	unsigned int			bucketnum;
 	unsigned int			dbucketnum;
+	unsigned int			hashval;
 	char *				info;
 	isc_mem_t *			mctx;
 
+	/*% Locked by the stripe lock of its chain. */
+	ISC_LINK(struct fetchctx)	hlink;
+
 	/*% Locked by appropriate bucket lock. */
 	fetchstate			state;
 	isc_boolean_t			want_shutdown;
@@ -413,6 +418,31 @@ struct dns_fetch {
 #define DNS_FETCH_MAGIC			ISC_MAGIC('F', 't', 'c', 'h')
 #define DNS_FETCH_VALID(fetch)		ISC_MAGIC_VALID(fetch, DNS_FETCH_MAGIC)
 
+/*%
+ * Fetch contexts are found by name and type in a hash table of chains
+ * kept apart from the buckets, which only serialize the work on each
+ * fetch context on a task.  Like the ADB's tables, it grows one chain
+ * at a time (linear hashing): the contexts on chain 'n - 2^k' whose
+ * hash has bit k set move to a new chain 'n'.  Chains live in segments
+ * which are never moved; segment 0 holds the first RES_FCTXLOCKS
+ * chains and segment k > 0 the chains from 2^(k-1) * RES_FCTXLOCKS up
+ * to twice that.  Chain 'i' is covered by stripe lock
+ * 'i % RES_FCTXLOCKS', so a chain and the one split from it share a
+ * lock, which is also the one for the low bits of the hash.
+ */
+#define RES_FCTXSEGSHIFT		6
+#define RES_FCTXLOCKS			(1U << RES_FCTXSEGSHIFT)
+#define RES_FCTXMAXCHAINS		(1U << 24)
+#define RES_FCTXMAXSEGS			(24 - RES_FCTXSEGSHIFT + 1)
+
+/*%
+ * The table grows while there are more than this many fetch contexts
+ * per chain.
+ */
+#define RES_FCTXLOAD			2
+
+typedef ISC_LIST(fetchctx_t) fctxchain_t;
+
 typedef struct fctxbucket {
 	isc_task_t *			task;
 	isc_mutex_t			lock;
@@ -474,6 +504,8 @@ struct dns_resolver {
 	unsigned int			nbuckets;
 	fctxbucket_t *			buckets;
 	zonebucket_t *			dbuckets;
+	isc_mutex_t			fctxlocks[RES_FCTXLOCKS];
+	fctxchain_t *			fctxsegs[RES_FCTXMAXSEGS];
 	isc_uint32_t			lame_ttl;
 	ISC_LIST(alternate_t)		alternates;
 	isc_uint16_t			udpsize;
@@ -514,6 +546,12 @@ struct dns_resolver {
 	dns_fetch_t *			primefetch;
 	/* Locked by nlock. */
 	unsigned int			nfctx;
+	/*
+	 * Locked by growlock and the stripe lock of the chain being
+	 * split; see fctxchain().
+	 */
+	isc_mutex_t			growlock;
+	unsigned int			nfctxchains;
 };
 
 #define RES_MAGIC			ISC_MAGIC('R', 'e', 's', '!')
@@ -4032,6 +4070,158 @@ fctx_try(fetchctx_t *fctx, isc_boolean_t retrying, isc_boolean_t badcache) {
 		inc_stats(res, dns_resstatscounter_retry);
 }
 
+/*%
+ * The number of the highest bit set in 'n', which must not be zero.
+ */
+static inline unsigned int
+ilog2(unsigned int n) {
+#ifdef HAVE_BUILTIN_CLZ
+	return (sizeof(n) * 8 - 1 - __builtin_clz(n));
+#else
+	unsigned int bit = 0;
+
+	while ((n >>= 1) != 0)
+		bit++;
+	return (bit);
+#endif
+}
+
+/*%
+ * The segment holding chain 'chain', the first chain of segment 'seg'
+ * and the number of chains in it.
+ */
+static inline unsigned int
+chainseg(unsigned int chain) {
+	if (chain < RES_FCTXLOCKS)
+		return (0);
+	return (ilog2(chain) - RES_FCTXSEGSHIFT + 1);
+}
+
+static inline unsigned int
+segstart(unsigned int seg) {
+	return (seg == 0 ? 0 : RES_FCTXLOCKS << (seg - 1));
+}
+
+static inline unsigned int
+segsize(unsigned int seg) {
+	return (seg == 0 ? RES_FCTXLOCKS : RES_FCTXLOCKS << (seg - 1));
+}
+
+static inline fctxchain_t *
+chainat(dns_resolver_t *res, unsigned int chain) {
+	unsigned int seg = chainseg(chain);
+
+	return (&res->fctxsegs[seg][chain - segstart(seg)]);
+}
+
+/*%
+ * The hash of a fetch context for 'name' and 'type'; 'namehash' is
+ * the case insensitive hash of 'name'.  Multiplying spreads the type
+ * over the low bits, which pick the chain and its lock.
+ */
+static inline unsigned int
+fctxhash(unsigned int namehash, dns_rdatatype_t type) {
+	return (namehash ^ (type * 0x9e3779b1U));
+}
+
+static inline isc_mutex_t *
+fctxlock(dns_resolver_t *res, unsigned int hashval) {
+	return (&res->fctxlocks[hashval % RES_FCTXLOCKS]);
+}
+
+/*%
+ * The chain fetch contexts with hash 'hashval' are on.  Requires the
+ * stripe lock for 'hashval' be held: the chain count may be changed
+ * by a split under another stripe lock, but that never moves contexts
+ * with this hash.
+ */
+static inline fctxchain_t *
+fctxchain(dns_resolver_t *res, unsigned int hashval) {
+	unsigned int n = res->nfctxchains;
+	unsigned int low = 1U << ilog2(n);
+	unsigned int chain;
+
+	chain = hashval & (2 * low - 1);
+	if (chain >= n)
+		chain = hashval & (low - 1);
+	return (chainat(res, chain));
+}
+
+static isc_result_t
+new_fctxsegment(dns_resolver_t *res, unsigned int seg) {
+	fctxchain_t *chains;
+	unsigned int i, n = segsize(seg);
+
+	chains = isc_mem_get(res->mctx, n * sizeof(*chains));
+	if (chains == NULL)
+		return (ISC_R_NOMEMORY);
+	for (i = 0; i < n; i++)
+		ISC_LIST_INIT(chains[i]);
+	res->fctxsegs[seg] = chains;
+
+	return (ISC_R_SUCCESS);
+}
+
+static void
+free_fctxsegments(dns_resolver_t *res) {
+	unsigned int i, seg;
+
+	for (seg = 0; seg < RES_FCTXMAXSEGS; seg++) {
+		if (res->fctxsegs[seg] == NULL)
+			continue;
+		for (i = 0; i < segsize(seg); i++)
+			INSIST(ISC_LIST_EMPTY(res->fctxsegs[seg][i]));
+		isc_mem_put(res->mctx, res->fctxsegs[seg],
+			    segsize(seg) * sizeof(fctxchain_t));
+		res->fctxsegs[seg] = NULL;
+	}
+}
+
+/*%
+ * Split a chain if the table is loaded beyond RES_FCTXLOAD.  A thread
+ * finding another one growing the table leaves it alone; lookups only
+ * ever wait for the one chain being split.
+ */
+static void
+grow_fctxtable(dns_resolver_t *res) {
+	fctxchain_t *from, *to;
+	fetchctx_t *fctx, *next;
+	unsigned int n, low, seg, nfctx;
+
+	if (isc_mutex_trylock(&res->growlock) != ISC_R_SUCCESS)
+		return;
+
+	LOCK(&res->nlock);
+	nfctx = res->nfctx;
+	UNLOCK(&res->nlock);
+
+	n = res->nfctxchains;
+	if (nfctx <= RES_FCTXLOAD * n || n >= RES_FCTXMAXCHAINS)
+		goto unlock;
+	seg = chainseg(n);
+	if (res->fctxsegs[seg] == NULL &&
+	    new_fctxsegment(res, seg) != ISC_R_SUCCESS)
+		goto unlock;
+
+	low = 1U << ilog2(n);
+	from = chainat(res, n - low);
+	to = chainat(res, n);
+
+	LOCK(&res->fctxlocks[n % RES_FCTXLOCKS]);
+	for (fctx = ISC_LIST_HEAD(*from); fctx != NULL; fctx = next) {
+		next = ISC_LIST_NEXT(fctx, hlink);
+		if ((fctx->hashval & low) == 0)
+			continue;
+		ISC_LIST_UNLINK(*from, fctx, hlink);
+		ISC_LIST_APPEND(*to, fctx, hlink);
+	}
+	res->nfctxchains = n + 1;
+	UNLOCK(&res->fctxlocks[n % RES_FCTXLOCKS]);
+
+ unlock:
+	UNLOCK(&res->growlock);
+}
+
 static isc_boolean_t
 fctx_unlink(fetchctx_t *fctx) {
 	dns_resolver_t *res;
@@ -4059,6 +4249,10 @@ fctx_unlink(fetchctx_t *fctx) {
 
 	ISC_LIST_UNLINK(res->buckets[bucketnum].fctxs, fctx, link);
 
+	LOCK(fctxlock(res, fctx->hashval));
+	ISC_LIST_UNLINK(*fctxchain(res, fctx->hashval), fctx, hlink);
+	UNLOCK(fctxlock(res, fctx->hashval));
+
 	LOCK(&res->nlock);
 	res->nfctx--;
 	UNLOCK(&res->nlock);
@@ -4458,8 +4652,8 @@ log_ns_ttl(fetchctx_t *fctx, const char *where) {
 static isc_result_t
 fctx_create(dns_resolver_t *res, const dns_name_t *name, dns_rdatatype_t type,
 	    const dns_name_t *domain, dns_rdataset_t *nameservers,
-	    unsigned int options, unsigned int bucketnum, unsigned int depth,
-	    isc_counter_t *qc, fetchctx_t **fctxp)
+	    unsigned int options, unsigned int bucketnum, unsigned int hashval,
+	    unsigned int depth, isc_counter_t *qc, fetchctx_t **fctxp)
 {
 	fetchctx_t *fctx;
 	isc_result_t result;
@@ -4473,6 +4667,7 @@ fctx_create(dns_resolver_t *res, const dns_name_t *name, dns_rdatatype_t type,
 
 	/*
 	 * Caller must be holding the lock for bucket number 'bucketnum'.
+	 * 'hashval' is the hash of 'name' and 'type' from fctxhash().
 	 */
 	REQUIRE(fctxp != NULL && *fctxp == NULL);
 
@@ -4523,6 +4718,7 @@ fctx_create(dns_resolver_t *res, const dns_name_t *name, dns_rdatatype_t type,
 	fctx->res = res;
 	fctx->references = 0;
 	fctx->bucketnum = bucketnum;
+	fctx->hashval = hashval;
 	fctx->dbucketnum = RES_NOBUCKET;
 	fctx->state = fetchstate_init;
 	fctx->want_shutdown = ISC_FALSE;
@@ -4720,10 +4916,15 @@ fctx_create(dns_resolver_t *res, const dns_name_t *name, dns_rdatatype_t type,
 
 	ISC_LIST_INIT(fctx->events);
 	ISC_LINK_INIT(fctx, link);
+	ISC_LINK_INIT(fctx, hlink);
 	fctx->magic = FCTX_MAGIC;
 
 	ISC_LIST_APPEND(res->buckets[bucketnum].fctxs, fctx, link);
 
+	LOCK(fctxlock(res, hashval));
+	ISC_LIST_APPEND(*fctxchain(res, hashval), fctx, hlink);
+	UNLOCK(fctxlock(res, hashval));
+
 	LOCK(&res->nlock);
 	res->nfctx++;
 	UNLOCK(&res->nlock);
@@ -9542,6 +9743,9 @@ destroy(dns_resolver_t *res) {
 	}
 	isc_mem_put(res->mctx, res->dbuckets,
 		    RES_DOMAIN_BUCKETS * sizeof(zonebucket_t));
+	free_fctxsegments(res);
+	DESTROYMUTEXBLOCK(res->fctxlocks, RES_FCTXLOCKS);
+	DESTROYLOCK(&res->growlock);
 	if (res->dispatches4 != NULL)
 		dns_dispatchset_destroy(&res->dispatches4);
 	if (res->dispatches6 != NULL)
@@ -9760,6 +9964,18 @@ dns_resolver_create(dns_view_t *view,
 		dbuckets_created++;
 	}
 
+	memset(res->fctxsegs, 0, sizeof(res->fctxsegs));
+	res->nfctxchains = RES_FCTXLOCKS;
+	result = new_fctxsegment(res, 0);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_dbuckets;
+	result = isc_mutexblock_init(res->fctxlocks, RES_FCTXLOCKS);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_fctxsegments;
+	result = isc_mutex_init(&res->growlock);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_fctxlocks;
+
 	res->dispatches4 = NULL;
 	if (dispatchv4 != NULL) {
 		dns_dispatchset_create(view->mctx, socketmgr, taskmgr,
@@ -9855,6 +10071,13 @@ dns_resolver_create(dns_view_t *view,
 		dns_dispatchset_destroy(&res->dispatches6);
 	if (res->dispatches4 != NULL)
 		dns_dispatchset_destroy(&res->dispatches4);
+	DESTROYLOCK(&res->growlock);
+
+ cleanup_fctxlocks:
+	DESTROYMUTEXBLOCK(res->fctxlocks, RES_FCTXLOCKS);
+
+ cleanup_fctxsegments:
+	free_fctxsegments(res);
 
  cleanup_dbuckets:
 	for (i = 0; i < dbuckets_created; i++) {
@@ -10132,15 +10355,44 @@ fctx_match(fetchctx_t *fctx, const dns_name_t *name, dns_rdatatype_t type,
 	   unsigned int options)
 {
 	/*
-	 * Don't match fetch contexts that are shutting down.
+	 * The name, type and options never change, and are compared
+	 * first: the rest is locked by the bucket lock, which the caller
+	 * only holds for contexts with a matching name.
 	 */
-	if (fctx->cloned || fctx->state == fetchstate_done ||
-	    ISC_LIST_EMPTY(fctx->events))
+	if (fctx->type != type || fctx->options != options ||
+	    !dns_name_equal(&fctx->name, name))
 		return (ISC_FALSE);
 
-	if (fctx->type != type || fctx->options != options)
-		return (ISC_FALSE);
-	return (dns_name_equal(&fctx->name, name));
+	/*
+	 * Don't match fetch contexts that are shutting down.
+	 */
+	return (ISC_TF(!fctx->cloned && fctx->state != fetchstate_done &&
+		       !ISC_LIST_EMPTY(fctx->events)));
+}
+
+/*%
+ * Find a fetch context for 'name', 'type' and 'options' which can be
+ * joined.  Requires the bucket lock for 'name' be held, which keeps
+ * any context found from going away.
+ */
+static fetchctx_t *
+fctx_find(dns_resolver_t *res, unsigned int hashval, const dns_name_t *name,
+	  dns_rdatatype_t type, unsigned int options)
+{
+	fetchctx_t *fctx;
+
+	LOCK(fctxlock(res, hashval));
+	for (fctx = ISC_LIST_HEAD(*fctxchain(res, hashval));
+	     fctx != NULL;
+	     fctx = ISC_LIST_NEXT(fctx, hlink))
+	{
+		if (fctx->hashval == hashval &&
+		    fctx_match(fctx, name, type, options))
+			break;
+	}
+	UNLOCK(fctxlock(res, hashval));
+
+	return (fctx);
 }
 
 static inline void
@@ -10215,7 +10467,7 @@ dns_resolver_createfetch3(dns_resolver_t *res, const dns_name_t *name,
 	dns_fetch_t *fetch;
 	fetchctx_t *fctx = NULL;
 	isc_result_t result = ISC_R_SUCCESS;
-	unsigned int bucketnum;
+	unsigned int bucketnum, namehash, hashval;
 	isc_boolean_t new_fctx = ISC_FALSE;
 	isc_event_t *event;
 	unsigned int count = 0;
@@ -10250,7 +10502,9 @@ dns_resolver_createfetch3(dns_resolver_t *res, const dns_name_t *name,
 	fetch->mctx = NULL;
 	isc_mem_attach(res->mctx, &fetch->mctx);
 
-	bucketnum = dns_name_fullhash(name, ISC_FALSE) % res->nbuckets;
+	namehash = dns_name_fullhash(name, ISC_FALSE);
+	bucketnum = namehash % res->nbuckets;
+	hashval = fctxhash(namehash, type);
 
 	LOCK(&res->lock);
 	spillat = res->spillat;
@@ -10263,14 +10517,8 @@ dns_resolver_createfetch3(dns_resolver_t *res, const dns_name_t *name,
 		goto unlock;
 	}
 
-	if ((options & DNS_FETCHOPT_UNSHARED) == 0) {
-		for (fctx = ISC_LIST_HEAD(res->buckets[bucketnum].fctxs);
-		     fctx != NULL;
-		     fctx = ISC_LIST_NEXT(fctx, link)) {
-			if (fctx_match(fctx, name, type, options))
-				break;
-		}
-	}
+	if ((options & DNS_FETCHOPT_UNSHARED) == 0)
+		fctx = fctx_find(res, hashval, name, type, options);
 
 	/*
 	 * Is this a duplicate?
@@ -10300,7 +10548,8 @@ dns_resolver_createfetch3(dns_resolver_t *res, const dns_name_t *name,
 
 	if (fctx == NULL) {
 		result = fctx_create(res, name, type, domain, nameservers,
-				     options, bucketnum, depth, qc, &fctx);
+				     options, bucketnum, hashval, depth, qc,
+				     &fctx);
 		if (result != ISC_R_SUCCESS)
 			goto unlock;
 		new_fctx = ISC_TRUE;
@@ -10335,6 +10584,8 @@ dns_resolver_createfetch3(dns_resolver_t *res, const dns_name_t *name,
 
 	if (dodestroy)
 		fctx_destroy(fctx);
+	else if (new_fctx && result == ISC_R_SUCCESS)
+		grow_fctxtable(res);
 
 	if (result == ISC_R_SUCCESS) {
 		FTRACE("created");
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <isc/buffer.h>
+#include <isc/magic.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/region.h>
+#include <isc/string.h>
+#include <isc/util.h>
+
+#include <dns/message.h>
+#include <dns/name.h>
+#include <dns/respcache.h>
+#include <dns/types.h>
+
+#define RESPCACHE_MAGIC		ISC_MAGIC('R', 's', 'p', 'C')
+#define VALID_RESPCACHE(m)	ISC_MAGIC_VALID(m, RESPCACHE_MAGIC)
+
+/*%
+ * Number of entries in each set of the table.
+ */
+#define RESPCACHE_WAYS		4
+
+typedef struct dns_rcentry dns_rcentry_t;
+
+struct dns_rcentry {
+	isc_uint64_t		generation;
+	unsigned int		hashval;
+	isc_uint32_t		flags;
+	dns_rdatatype_t		type;
+	isc_boolean_t		referenced;
+	unsigned int		attributes;
+	unsigned int		namelen;
+	unsigned int		length;
+	/*
+	 * Followed by 'namelen' octets of query name and 'length'
+	 * octets of response.
+	 */
+};
+
+#define ENTRY_NAME(e)		((unsigned char *)((e) + 1))
+#define ENTRY_RESPONSE(e)	(ENTRY_NAME(e) + (e)->namelen)
+#define ENTRY_SIZE(e)		(sizeof(dns_rcentry_t) + (e)->namelen + \
+				 (e)->length)
+
+typedef struct dns_rcset {
+	isc_mutex_t		lock;
+	dns_rcentry_t		*entries[RESPCACHE_WAYS];
+	unsigned int		count;
+	unsigned int		hand;
+} dns_rcset_t;
+
+struct dns_respcache {
+	unsigned int		magic;
+	isc_mem_t		*mctx;
+	dns_rcset_t		*sets;
+	unsigned int		nsets;		/* power of 2 */
+};
+
+static inline unsigned int
+hash(const dns_name_t *name, dns_rdatatype_t type, isc_uint32_t flags) {
+	unsigned int hashval;
+
+	hashval = dns_name_hash(name, ISC_TRUE);
+	hashval += type * 31U;
+	hashval ^= flags * 0x9e3779b1U;
+	return (hashval);
+}
+
+static inline isc_boolean_t
+match(const dns_rcentry_t *entry, unsigned int hashval,
+      const dns_name_t *name, dns_rdatatype_t type, isc_uint32_t flags)
+{
+	return (ISC_TF(entry->hashval == hashval &&
+		       entry->type == type &&
+		       entry->flags == flags &&
+		       entry->namelen == name->length &&
+		       memcmp(entry + 1, name->ndata,
+			      name->length) == 0));
+}
+
+static inline void
+free_entry(dns_respcache_t *rc, dns_rcentry_t **entryp) {
+	dns_rcentry_t *entry = *entryp;
+
+	*entryp = NULL;
+	isc_mem_put(rc->mctx, entry, ENTRY_SIZE(entry));
+}
+
+isc_result_t
+dns_respcache_create(isc_mem_t *mctx, unsigned int size,
+		     dns_respcache_t **rcp)
+{
+	isc_result_t result;
+	dns_respcache_t *rc;
+	unsigned int i, nsets;
+
+	REQUIRE(mctx != NULL);
+	REQUIRE(size > 0);
+	REQUIRE(rcp != NULL && *rcp == NULL);
+
+	nsets = 1;
+	while (nsets * RESPCACHE_WAYS < size && nsets < (1U << 24))
+		nsets <<= 1;
+
+	rc = isc_mem_get(mctx, sizeof(*rc));
+	if (rc == NULL)
+		return (ISC_R_NOMEMORY);
+	rc->mctx = NULL;
+	isc_mem_attach(mctx, &rc->mctx);
+
+	rc->sets = isc_mem_get(mctx, nsets * sizeof(dns_rcset_t));
+	if (rc->sets == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup_rc;
+	}
+	memset(rc->sets, 0, nsets * sizeof(dns_rcset_t));
+
+	for (i = 0; i < nsets; i++) {
+		result = isc_mutex_init(&rc->sets[i].lock);
+		if (result != ISC_R_SUCCESS)
+			goto cleanup_locks;
+	}
+	rc->nsets = nsets;
+	rc->magic = RESPCACHE_MAGIC;
+
+	*rcp = rc;
+	return (ISC_R_SUCCESS);
+
+ cleanup_locks:
+	while (i-- > 0)
+		DESTROYLOCK(&rc->sets[i].lock);
+	isc_mem_put(mctx, rc->sets, nsets * sizeof(dns_rcset_t));
+ cleanup_rc:
+	isc_mem_putanddetach(&rc->mctx, rc, sizeof(*rc));
+	return (result);
+}
+
+void
+dns_respcache_destroy(dns_respcache_t **rcp) {
+	dns_respcache_t *rc;
+	unsigned int i;
+
+	REQUIRE(rcp != NULL);
+	rc = *rcp;
+	REQUIRE(VALID_RESPCACHE(rc));
+
+	dns_respcache_flush(rc);
+
+	rc->magic = 0;
+	for (i = 0; i < rc->nsets; i++)
+		DESTROYLOCK(&rc->sets[i].lock);
+	isc_mem_put(rc->mctx, rc->sets, rc->nsets * sizeof(dns_rcset_t));
+	isc_mem_putanddetach(&rc->mctx, rc, sizeof(*rc));
+	*rcp = NULL;
+}
+
+isc_result_t
+dns_respcache_find(dns_respcache_t *rc, const dns_name_t *name,
+		   dns_rdatatype_t type, isc_uint32_t flags,
+		   isc_uint64_t generation, isc_buffer_t *target,
+		   unsigned int *attributesp)
+{
+	isc_result_t result = ISC_R_NOTFOUND;
+	dns_rcentry_t *entry, *stale = NULL;
+	dns_rcset_t *set;
+	unsigned int i, hashval;
+
+	REQUIRE(VALID_RESPCACHE(rc));
+	REQUIRE(dns_name_isabsolute(name));
+	REQUIRE(ISC_BUFFER_VALID(target));
+	REQUIRE(attributesp != NULL);
+
+	hashval = hash(name, type, flags);
+	set = &rc->sets[hashval & (rc->nsets - 1)];
+
+	LOCK(&set->lock);
+	for (i = 0; i < RESPCACHE_WAYS; i++) {
+		entry = set->entries[i];
+		if (entry == NULL ||
+		    !match(entry, hashval, name, type, flags))
+		{
+			continue;
+		}
+
+		if (entry->generation != generation) {
+			/*
+			 * The zone has changed since this response was
+			 * rendered.
+			 */
+			stale = entry;
+			set->entries[i] = NULL;
+			set->count--;
+		} else if (entry->length >
+			   isc_buffer_availablelength(target))
+		{
+			result = ISC_R_NOSPACE;
+		} else {
+			isc_buffer_putmem(target, ENTRY_RESPONSE(entry),
+					  entry->length);
+			*attributesp = entry->attributes;
+			entry->referenced = ISC_TRUE;
+			result = ISC_R_SUCCESS;
+		}
+		break;
+	}
+	UNLOCK(&set->lock);
+
+	if (stale != NULL)
+		free_entry(rc, &stale);
+
+	return (result);
+}
+
+void
+dns_respcache_add(dns_respcache_t *rc, const dns_name_t *name,
+		  dns_rdatatype_t type, isc_uint32_t flags,
+		  isc_uint64_t generation, const isc_region_t *response,
+		  unsigned int attributes)
+{
+	dns_rcentry_t *entry, *old = NULL;
+	dns_rcset_t *set;
+	unsigned int i, slot;
+
+	REQUIRE(VALID_RESPCACHE(rc));
+	REQUIRE(dns_name_isabsolute(name));
+	REQUIRE(response != NULL && response->length >= DNS_MESSAGE_HEADERLEN);
+
+	entry = isc_mem_get(rc->mctx,
+			    sizeof(*entry) + name->length + response->length);
+	if (entry == NULL)
+		return;
+
+	entry->generation = generation;
+	entry->hashval = hash(name, type, flags);
+	entry->flags = flags;
+	entry->type = type;
+	entry->referenced = ISC_FALSE;
+	entry->attributes = attributes;
+	entry->namelen = name->length;
+	entry->length = response->length;
+	memmove(ENTRY_NAME(entry), name->ndata, name->length);
+	memmove(ENTRY_RESPONSE(entry), response->base, response->length);
+
+	set = &rc->sets[entry->hashval & (rc->nsets - 1)];
+
+	LOCK(&set->lock);
+
+	/*
+	 * Replace an existing response to the same query, or else use
+	 * a free slot.
+	 */
+	slot = RESPCACHE_WAYS;
+	for (i = 0; i < RESPCACHE_WAYS; i++) {
+		if (set->entries[i] == NULL) {
+			if (slot == RESPCACHE_WAYS)
+				slot = i;
+		} else if (match(set->entries[i], entry->hashval, name,
+				 type, flags))
+		{
+			slot = i;
+			break;
+		}
+	}
+
+	/*
+	 * The set is full: sweep it for an entry that has not been used
+	 * since the last sweep.
+	 */
+	if (slot == RESPCACHE_WAYS) {
+		for (;;) {
+			slot = set->hand;
+			set->hand = (set->hand + 1) % RESPCACHE_WAYS;
+			if (!set->entries[slot]->referenced)
+				break;
+			set->entries[slot]->referenced = ISC_FALSE;
+		}
+	}
+
+	old = set->entries[slot];
+	set->entries[slot] = entry;
+	if (old == NULL)
+		set->count++;
+
+	UNLOCK(&set->lock);
+
+	if (old != NULL)
+		free_entry(rc, &old);
+}
+
+void
+dns_respcache_flush(dns_respcache_t *rc) {
+	dns_rcset_t *set;
+	unsigned int i, j;
+
+	REQUIRE(VALID_RESPCACHE(rc));
+
+	for (i = 0; i < rc->nsets; i++) {
+		set = &rc->sets[i];
+		LOCK(&set->lock);
+		for (j = 0; j < RESPCACHE_WAYS; j++) {
+			if (set->entries[j] != NULL)
+				free_entry(rc, &set->entries[j]);
+		}
+		set->count = 0;
+		set->hand = 0;
+		UNLOCK(&set->lock);
+	}
+}
+
+unsigned int
+dns_respcache_count(dns_respcache_t *rc) {
+	unsigned int i, count = 0;
+
+	REQUIRE(VALID_RESPCACHE(rc));
+
+	for (i = 0; i < rc->nsets; i++) {
+		LOCK(&rc->sets[i].lock);
+		count += rc->sets[i].count;
+		UNLOCK(&rc->sets[i].lock);
+	}
+
+	return (count);
+}
@@ -1295,7 +1295,8 @@ static dns_dbmethods_t sdb_methods = {
 	NULL,			/* getsize */
 	NULL,			/* setservestalettl */
 	NULL,			/* getservestalettl */
-	NULL			/* setgluecachestats */
+	NULL,			/* setgluecachestats */
+	NULL			/* getgeneration */
 };
 
 static isc_result_t
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <isc/magic.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/mutexblock.h>
+#include <isc/string.h>
+#include <isc/util.h>
+
+#include <dns/sigcache.h>
+
+#define SIGCACHE_MAGIC			ISC_MAGIC('S', 'i', 'g', 'C')
+#define VALID_SIGCACHE(c)		ISC_MAGIC_VALID(c, SIGCACHE_MAGIC)
+
+/*%
+ * Entries per set.
+ */
+#define SIGCACHE_WAYS			4
+
+/*%
+ * Number of locks; each covers the sets whose index is equal to it
+ * modulo this.
+ */
+#define SIGCACHE_LOCKS			64
+
+typedef struct sigcache_set {
+	unsigned int	used;
+	unsigned char	digest[SIGCACHE_WAYS][DNS_SIGCACHE_DIGESTLENGTH];
+} sigcache_set_t;
+
+struct dns_sigcache {
+	unsigned int		magic;
+	isc_mem_t *		mctx;
+	isc_mutex_t		locks[SIGCACHE_LOCKS];
+	sigcache_set_t *	sets;
+	unsigned int		nsets;		/*%< a power of two */
+};
+
+isc_result_t
+dns_sigcache_create(isc_mem_t *mctx, unsigned int size,
+		    dns_sigcache_t **cachep)
+{
+	isc_result_t result;
+	dns_sigcache_t *cache;
+	unsigned int i;
+
+	REQUIRE(mctx != NULL);
+	REQUIRE(size > 0);
+	REQUIRE(cachep != NULL && *cachep == NULL);
+
+	cache = isc_mem_get(mctx, sizeof(*cache));
+	if (cache == NULL)
+		return (ISC_R_NOMEMORY);
+
+	cache->nsets = SIGCACHE_LOCKS;
+	while (cache->nsets * SIGCACHE_WAYS < size)
+		cache->nsets *= 2;
+	cache->sets = isc_mem_get(mctx, cache->nsets * sizeof(*cache->sets));
+	if (cache->sets == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup_cache;
+	}
+	for (i = 0; i < cache->nsets; i++)
+		cache->sets[i].used = 0;
+
+	result = isc_mutexblock_init(cache->locks, SIGCACHE_LOCKS);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_sets;
+
+	cache->mctx = NULL;
+	isc_mem_attach(mctx, &cache->mctx);
+	cache->magic = SIGCACHE_MAGIC;
+
+	*cachep = cache;
+	return (ISC_R_SUCCESS);
+
+ cleanup_sets:
+	isc_mem_put(mctx, cache->sets, cache->nsets * sizeof(*cache->sets));
+ cleanup_cache:
+	isc_mem_put(mctx, cache, sizeof(*cache));
+	return (result);
+}
+
+void
+dns_sigcache_destroy(dns_sigcache_t **cachep) {
+	dns_sigcache_t *cache;
+
+	REQUIRE(cachep != NULL && VALID_SIGCACHE(*cachep));
+
+	cache = *cachep;
+	*cachep = NULL;
+
+	cache->magic = 0;
+	DESTROYMUTEXBLOCK(cache->locks, SIGCACHE_LOCKS);
+	isc_mem_put(cache->mctx, cache->sets,
+		    cache->nsets * sizeof(*cache->sets));
+	isc_mem_putanddetach(&cache->mctx, cache, sizeof(*cache));
+}
+
+/*
+ * The digests are SHA-256 output, so any of their bits make a good
+ * hash.
+ */
+static inline unsigned int
+setindex(dns_sigcache_t *cache, const unsigned char *digest) {
+	return ((digest[0] | digest[1] << 8 | digest[2] << 16 |
+		 (unsigned int)digest[3] << 24) & (cache->nsets - 1));
+}
+
+static inline isc_boolean_t
+inset(sigcache_set_t *set, const unsigned char *digest) {
+	unsigned int i;
+
+	for (i = 0; i < set->used; i++)
+		if (memcmp(set->digest[i], digest,
+			   DNS_SIGCACHE_DIGESTLENGTH) == 0)
+			return (ISC_TRUE);
+	return (ISC_FALSE);
+}
+
+isc_boolean_t
+dns_sigcache_find(dns_sigcache_t *cache, const unsigned char *digest) {
+	unsigned int bucket;
+	isc_boolean_t found;
+
+	REQUIRE(VALID_SIGCACHE(cache));
+	REQUIRE(digest != NULL);
+
+	bucket = setindex(cache, digest);
+	LOCK(&cache->locks[bucket % SIGCACHE_LOCKS]);
+	found = inset(&cache->sets[bucket], digest);
+	UNLOCK(&cache->locks[bucket % SIGCACHE_LOCKS]);
+
+	return (found);
+}
+
+void
+dns_sigcache_add(dns_sigcache_t *cache, const unsigned char *digest) {
+	sigcache_set_t *set;
+	unsigned int bucket;
+
+	REQUIRE(VALID_SIGCACHE(cache));
+	REQUIRE(digest != NULL);
+
+	bucket = setindex(cache, digest);
+	set = &cache->sets[bucket];
+	LOCK(&cache->locks[bucket % SIGCACHE_LOCKS]);
+	if (!inset(set, digest)) {
+		/*
+		 * Entries are kept newest first, so the oldest one falls
+		 * off the end.
+		 */
+		memmove(set->digest[1], set->digest[0],
+			(SIGCACHE_WAYS - 1) * DNS_SIGCACHE_DIGESTLENGTH);
+		memmove(set->digest[0], digest, DNS_SIGCACHE_DIGESTLENGTH);
+		if (set->used < SIGCACHE_WAYS)
+			set->used++;
+	}
+	UNLOCK(&cache->locks[bucket % SIGCACHE_LOCKS]);
+}
@@ -17,6 +17,10 @@
 #include <unistd.h>
 #include <stdlib.h>
 
+#include <isc/task.h>
+#include <isc/thread.h>
+#include <isc/util.h>
+
 #include <dns/db.h>
 #include <dns/dbiterator.h>
 #include <dns/journal.h>
@@ -273,6 +277,328 @@ ATF_TC_BODY(dns_dbfind_staleok, tc) {
 	isc_mem_detach(&mymctx);
 }
 
+ATF_TC(dns_dbfind_replace);
+ATF_TC_HEAD(dns_dbfind_replace, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "check a cached rdataset stays valid after it "
+			  "has been replaced");
+}
+ATF_TC_BODY(dns_dbfind_replace, tc) {
+	dns_db_t *db = NULL;
+	dns_dbnode_t *node = NULL, *oldnode = NULL;
+	dns_fixedname_t example_fixed;
+	dns_fixedname_t found_fixed;
+	dns_name_t *example;
+	dns_name_t *found;
+	dns_rdata_t rdata = DNS_RDATA_INIT, current = DNS_RDATA_INIT;
+	dns_rdatalist_t rdatalist;
+	dns_rdataset_t rdataset, oldrdataset;
+	isc_mem_t *mymctx = NULL;
+	isc_result_t result;
+	unsigned char data[] = { 0x0a, 0x00, 0x00, 0x01 };
+	int i;
+
+	result = isc_mem_create(0, 0, &mymctx);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_hash_create(mymctx, NULL, 256);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_db_create(mymctx, "rbt", dns_rootname, dns_dbtype_cache,
+			       dns_rdataclass_in, 0, NULL, &db);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	dns_fixedname_init(&example_fixed);
+	example = dns_fixedname_name(&example_fixed);
+
+	dns_fixedname_init(&found_fixed);
+	found = dns_fixedname_name(&found_fixed);
+
+	result = dns_name_fromstring(example, "example", 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	dns_rdataset_init(&oldrdataset);
+	for (i = 1; i <= 3; i++) {
+		/* 10.0.0.i */
+		data[3] = i;
+		dns_rdata_init(&rdata);
+		rdata.data = data;
+		rdata.length = 4;
+		rdata.rdclass = dns_rdataclass_in;
+		rdata.type = dns_rdatatype_a;
+
+		dns_rdatalist_init(&rdatalist);
+		rdatalist.ttl = 3600;
+		rdatalist.type = dns_rdatatype_a;
+		rdatalist.rdclass = dns_rdataclass_in;
+		ISC_LIST_APPEND(rdatalist.rdata, &rdata, link);
+
+		dns_rdataset_init(&rdataset);
+		result = dns_rdatalist_tordataset(&rdatalist, &rdataset);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+		result = dns_db_findnode(db, example, ISC_TRUE, &node);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+		result = dns_db_addrdataset(db, node, NULL, 0, &rdataset,
+					    DNS_DBADD_FORCE, NULL);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+		dns_db_detachnode(db, &node);
+		dns_rdataset_disassociate(&rdataset);
+
+		/*
+		 * The rdataset found before this one was replaced must
+		 * still hold the old data.
+		 */
+		if (dns_rdataset_isassociated(&oldrdataset)) {
+			dns_rdata_reset(&current);
+			result = dns_rdataset_first(&oldrdataset);
+			ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+			dns_rdataset_current(&oldrdataset, &current);
+			ATF_CHECK_EQ(current.length, 4);
+			ATF_CHECK_EQ(current.data[3], i - 1);
+			dns_rdataset_disassociate(&oldrdataset);
+			dns_db_detachnode(db, &oldnode);
+		}
+
+		result = dns_db_find(db, example, NULL, dns_rdatatype_a,
+				     0, 0, &oldnode, found, &oldrdataset,
+				     NULL);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		dns_rdata_reset(&current);
+		result = dns_rdataset_first(&oldrdataset);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		dns_rdataset_current(&oldrdataset, &current);
+		ATF_CHECK_EQ(current.data[3], i);
+	}
+
+	dns_rdataset_disassociate(&oldrdataset);
+	dns_db_detachnode(db, &oldnode);
+
+	result = dns_db_find(db, example, NULL, dns_rdatatype_aaaa,
+			     0, 0, NULL, found, &rdataset, NULL);
+	ATF_CHECK_EQ(result, ISC_R_NOTFOUND);
+
+	dns_db_detach(&db);
+	isc_mem_detach(&mymctx);
+}
+
+#ifdef ISC_PLATFORM_USETHREADS
+/*
+ * Readers look names up while writers add, delete, expire and purge
+ * them, so that nodes keep going empty, onto the dead node list and
+ * into the prune task underneath lookups that skip the node lock.
+ * A walker holds the tree lock with an iterator, so that writers often
+ * cannot delete an empty node straight away.
+ */
+#define STRESS_NAMES		32
+#define STRESS_READERS		3
+#define STRESS_WRITERS		2
+#define STRESS_THREADS		(STRESS_READERS + STRESS_WRITERS + 1)
+#define STRESS_ITERATIONS	100000
+
+typedef struct {
+	dns_db_t		*db;
+	isc_uint32_t		seed;
+} stress_arg_t;
+
+static dns_fixedname_t stress_names[STRESS_NAMES];
+
+static dns_name_t *
+stress_name(stress_arg_t *arg) {
+	arg->seed = arg->seed * 1103515245 + 12345;
+	return (dns_fixedname_name(&stress_names[(arg->seed >> 16) %
+						 STRESS_NAMES]));
+}
+
+static void *
+stress_reader(void *arg0) {
+	stress_arg_t *arg = arg0;
+	dns_fixedname_t found_fixed;
+	dns_name_t *found;
+	dns_dbnode_t *node;
+	dns_rdataset_t rdataset;
+	isc_result_t result;
+	int i;
+
+	dns_fixedname_init(&found_fixed);
+	found = dns_fixedname_name(&found_fixed);
+	dns_rdataset_init(&rdataset);
+
+	for (i = 0; i < STRESS_ITERATIONS; i++) {
+		node = NULL;
+		result = dns_db_find(arg->db, stress_name(arg), NULL,
+				     dns_rdatatype_a, 0, 0, &node, found,
+				     &rdataset, NULL);
+		if (result == ISC_R_SUCCESS)
+			ATF_CHECK_EQ(rdataset.type, dns_rdatatype_a);
+		if (dns_rdataset_isassociated(&rdataset))
+			dns_rdataset_disassociate(&rdataset);
+		if (node != NULL)
+			dns_db_detachnode(arg->db, &node);
+	}
+
+	return (NULL);
+}
+
+static void *
+stress_walker(void *arg0) {
+	stress_arg_t *arg = arg0;
+	dns_dbiterator_t *iter;
+	dns_dbnode_t *node;
+	isc_result_t result;
+	int i;
+
+	for (i = 0; i < STRESS_ITERATIONS / 100; i++) {
+		iter = NULL;
+		result = dns_db_createiterator(arg->db, 0, &iter);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		for (result = dns_dbiterator_first(iter);
+		     result == ISC_R_SUCCESS;
+		     result = dns_dbiterator_next(iter))
+		{
+			node = NULL;
+			result = dns_dbiterator_current(iter, &node, NULL);
+			ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+			dns_db_detachnode(arg->db, &node);
+		}
+		ATF_CHECK_EQ(result, ISC_R_NOMORE);
+		dns_dbiterator_destroy(&iter);
+	}
+
+	return (NULL);
+}
+
+static void *
+stress_writer(void *arg0) {
+	stress_arg_t *arg = arg0;
+	unsigned char data[] = { 0x0a, 0x00, 0x00, 0x01 };
+	dns_rdata_t rdata = DNS_RDATA_INIT;
+	dns_rdatalist_t rdatalist;
+	dns_rdataset_t rdataset;
+	dns_dbnode_t *node;
+	isc_stdtime_t now;
+	isc_result_t result;
+	int i;
+
+	dns_rdatalist_init(&rdatalist);
+	rdata.data = data;
+	rdata.length = sizeof(data);
+	rdata.rdclass = dns_rdataclass_in;
+	rdata.type = dns_rdatatype_a;
+	rdatalist.ttl = 3600;
+	rdatalist.type = dns_rdatatype_a;
+	rdatalist.rdclass = dns_rdataclass_in;
+	ISC_LIST_APPEND(rdatalist.rdata, &rdata, link);
+
+	isc_stdtime_get(&now);
+
+	for (i = 0; i < STRESS_ITERATIONS; i++) {
+		node = NULL;
+		result = dns_db_findnode(arg->db, stress_name(arg), ISC_TRUE,
+					 &node);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+		switch (i % 4) {
+		case 0:
+			dns_db_overmem(arg->db, ISC_TF(i % 64 == 0));
+			/* FALLTHROUGH */
+		case 1:
+			data[3] = i & 0xff;
+			dns_rdataset_init(&rdataset);
+			result = dns_rdatalist_tordataset(&rdatalist,
+							  &rdataset);
+			ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+			result = dns_db_addrdataset(arg->db, node, NULL, 0,
+						    &rdataset, DNS_DBADD_FORCE,
+						    NULL);
+			ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+			dns_rdataset_disassociate(&rdataset);
+			break;
+		case 2:
+			dns_db_expirenode(arg->db, node, now + 7200);
+			break;
+		case 3:
+			(void)dns_db_deleterdataset(arg->db, node, NULL,
+						    dns_rdatatype_a, 0);
+			break;
+		}
+
+		dns_db_detachnode(arg->db, &node);
+	}
+
+	return (NULL);
+}
+
+ATF_TC(dns_dbfind_stress);
+ATF_TC_HEAD(dns_dbfind_stress, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "check concurrent cache lookups and updates");
+}
+ATF_TC_BODY(dns_dbfind_stress, tc) {
+	dns_db_t *db = NULL;
+	isc_task_t *task = NULL;
+	isc_thread_t threads[STRESS_THREADS];
+	stress_arg_t args[STRESS_THREADS];
+	isc_threadfunc_t func;
+	char namebuf[DNS_NAME_FORMATSIZE];
+	isc_result_t result;
+	unsigned int i;
+
+	result = dns_test_begin(NULL, ISC_TRUE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	/*
+	 * Half the names are the only child of the other half, so that
+	 * deleting them has the prune task look at their parents.
+	 */
+	for (i = 0; i < STRESS_NAMES; i++) {
+		if (i % 2 == 0)
+			snprintf(namebuf, sizeof(namebuf), "n%u.example",
+				 i / 2);
+		else
+			snprintf(namebuf, sizeof(namebuf), "a.n%u.example",
+				 i / 2);
+		dns_fixedname_init(&stress_names[i]);
+		result = dns_name_fromstring(
+				dns_fixedname_name(&stress_names[i]),
+				namebuf, 0, NULL);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+
+	result = dns_db_create(mctx, "rbt", dns_rootname, dns_dbtype_cache,
+			       dns_rdataclass_in, 0, NULL, &db);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_task_create(taskmgr, 0, &task);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	dns_db_settask(db, task);
+
+	for (i = 0; i < STRESS_THREADS; i++) {
+		if (i < STRESS_READERS)
+			func = stress_reader;
+		else if (i < STRESS_READERS + STRESS_WRITERS)
+			func = stress_writer;
+		else
+			func = stress_walker;
+		args[i].db = db;
+		args[i].seed = i;
+		result = isc_thread_create(func, &args[i], &threads[i]);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+
+	for (i = 0; i < STRESS_THREADS; i++) {
+		result = isc_thread_join(threads[i], NULL);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+
+	dns_db_detach(&db);
+	isc_task_detach(&task);
+	dns_test_end();
+}
+#endif /* ISC_PLATFORM_USETHREADS */
+
 /*
  * Main
  */
@@ -280,5 +606,9 @@ ATF_TP_ADD_TCS(tp) {
 	ATF_TP_ADD_TC(tp, getoriginnode);
 	ATF_TP_ADD_TC(tp, getsetservestalettl);
 	ATF_TP_ADD_TC(tp, dns_dbfind_staleok);
+	ATF_TP_ADD_TC(tp, dns_dbfind_replace);
+#ifdef ISC_PLATFORM_USETHREADS
+	ATF_TP_ADD_TC(tp, dns_dbfind_stress);
+#endif
 	return (atf_no_error());
 }
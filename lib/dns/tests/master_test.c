@@ -19,6 +19,7 @@
 
 #include <isc/print.h>
 #include <isc/string.h>
+#include <isc/taskpool.h>
 #include <isc/xml.h>
 
 #include <dns/cache.h>
@@ -651,6 +652,141 @@ ATF_TC_BODY(neworigin, tc) {
 	dns_test_end();
 }
 
+/*
+ * Split load test: a file large enough to be split is loaded with and
+ * without a task pool, and the same records are added either way.
+ */
+static isc_uint32_t split_count;
+static isc_uint32_t split_sum;
+static isc_boolean_t split_done;
+static isc_result_t split_result;
+
+static isc_result_t
+split_add(void *arg, const dns_name_t *owner, dns_rdataset_t *dataset) {
+	char buf[BIGBUFLEN];
+	isc_buffer_t target;
+	isc_result_t result;
+	isc_uint32_t hash = 0;
+	unsigned int i;
+
+	UNUSED(arg);
+
+	isc_buffer_init(&target, buf, BIGBUFLEN);
+	result = dns_rdataset_totext(dataset, owner, ISC_FALSE, ISC_FALSE,
+				     &target);
+	if (result != ISC_R_SUCCESS)
+		return (result);
+
+	/*
+	 * Records may be committed in different batches, so sum a hash
+	 * of each line.
+	 */
+	for (i = 0; i < isc_buffer_usedlength(&target); i++) {
+		if (buf[i] == '\n') {
+			split_sum += hash;
+			split_count++;
+			hash = 0;
+		} else
+			hash = hash * 31 + (unsigned char)buf[i];
+	}
+	return (ISC_R_SUCCESS);
+}
+
+static void
+split_loaded(void *arg, isc_result_t result) {
+	UNUSED(arg);
+
+	split_result = result;
+	split_done = ISC_TRUE;
+}
+
+static isc_result_t
+split_load(const char *file, isc_taskpool_t *pool) {
+	dns_loadctx_t *lctx = NULL;
+	isc_result_t result;
+	int i = 0;
+
+	result = setup_master(NULL, NULL);
+	if (result != ISC_R_SUCCESS)
+		return (result);
+	callbacks.add = split_add;
+	split_count = 0;
+	split_sum = 0;
+	split_done = ISC_FALSE;
+
+	result = dns_master_loadfileinc6(file, &dns_origin, &dns_origin,
+					 dns_rdataclass_in, 0, 0, &callbacks,
+					 maintask, split_loaded, NULL, &lctx,
+					 NULL, NULL, mctx,
+					 dns_masterformat_text, 0, pool);
+	if (result != DNS_R_CONTINUE)
+		return (result);
+	while (!split_done && i++ < 60000)
+		dns_test_nap(1000);
+	dns_loadctx_detach(&lctx);
+	return (split_done ? split_result : ISC_R_TIMEDOUT);
+}
+
+ATF_TC(splitload);
+ATF_TC_HEAD(splitload, tc) {
+	atf_tc_set_md_var(tc, "descr", "dns_master_loadfileinc6() loads "
+				       "a split file like an unsplit one");
+}
+ATF_TC_BODY(splitload, tc) {
+	isc_result_t result;
+	isc_taskpool_t *pool = NULL;
+	isc_uint32_t count, sum;
+	unsigned int i;
+	FILE *f;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, ISC_TRUE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_taskpool_create(taskmgr, mctx, 8, 0, &pool);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	/*
+	 * About 4MB of records, with the origin and default TTL changing
+	 * along the way and text which looks like the start of a record
+	 * inside parentheses, quotes and comments.
+	 */
+	f = fopen("split.data", "w");
+	ATF_REQUIRE(f != NULL);
+	fprintf(f, "$TTL 1000\n"
+		   "@\tIN SOA ns hostmaster ( 1 3600 600 86400 300 )\n"
+		   "\tNS ns\nns\tA 10.53.0.1\n");
+	for (i = 0; i < 40000; i++) {
+		if (i % 1000 == 0)
+			fprintf(f, "$ORIGIN sub%u.test.\n", i / 1000);
+		if (i == 20000)
+			fprintf(f, "$TTL 2000\n");
+		fprintf(f, "host%u\tA 10.%u.%u.%u\n"
+			   "\tTXT \"semi;colon\" \"\\\"quote\\\" (\"\n"
+			   "mx%u\t600 MX ( 10 ; paren (\n"
+			   "mail%u )\n"
+			   "; comment\n"
+			   "\n",
+			i, i >> 16, (i >> 8) & 0xff, i & 0xff, i, i);
+	}
+	ATF_REQUIRE(fclose(f) == 0);
+
+	result = split_load("split.data", NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	count = split_count;
+	sum = split_sum;
+	ATF_CHECK_EQ(count, 3 + 40000 * 3);
+
+	result = split_load("split.data", pool);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(split_count, count);
+	ATF_CHECK_EQ(split_sum, sum);
+
+	unlink("split.data");
+	isc_taskpool_destroy(&pool);
+	dns_test_end();
+}
+
 /*
  * Main
  */
@@ -673,6 +809,7 @@ ATF_TP_ADD_TCS(tp) {
 	ATF_TP_ADD_TC(tp, toobig);
 	ATF_TP_ADD_TC(tp, maxrdata);
 	ATF_TP_ADD_TC(tp, neworigin);
+	ATF_TP_ADD_TC(tp, splitload);
 
 	return (atf_no_error());
 }
@@ -277,6 +277,99 @@ ATF_TC_BODY(compression, tc) {
 	dns_test_end();
 }
 
+ATF_TC(compression_table);
+ATF_TC_HEAD(compression_table, tc) {
+	atf_tc_set_md_var(tc, "descr", "compression table growth, lookup "
+				       "and rollback");
+}
+ATF_TC_BODY(compression_table, tc) {
+	dns_compress_t cctx;
+	dns_fixedname_t fixed;
+	dns_name_t *name, prefix;
+	isc_buffer_t target;
+	unsigned char buf[16384];
+	isc_uint16_t offsets[500], offset;
+	char text[64];
+	unsigned int i;
+
+	UNUSED(tc);
+
+	ATF_REQUIRE_EQ(dns_test_begin(NULL, ISC_FALSE), ISC_R_SUCCESS);
+
+	ATF_REQUIRE_EQ(dns_compress_init(&cctx, -1, mctx), ISC_R_SUCCESS);
+	dns_compress_setmethods(&cctx, DNS_COMPRESS_ALL);
+	isc_buffer_init(&target, buf, sizeof(buf));
+	dns_name_init(&prefix, NULL);
+
+	/*
+	 * Enough names to grow the table well past its initial size.
+	 */
+	for (i = 0; i < 500; i++) {
+		snprintf(text, sizeof(text), "host%u.example.", i);
+		dns_fixedname_init(&fixed);
+		name = dns_fixedname_name(&fixed);
+		ATF_REQUIRE_EQ(dns_name_fromstring(name, text, 0, NULL),
+			       ISC_R_SUCCESS);
+		offsets[i] = isc_buffer_usedlength(&target);
+		ATF_REQUIRE_EQ(dns_name_towire(name, &cctx, &target),
+			       ISC_R_SUCCESS);
+	}
+
+	/*
+	 * Every name is found, ignoring case, where it was written.
+	 */
+	for (i = 0; i < 500; i++) {
+		snprintf(text, sizeof(text), "HOST%u.Example.", i);
+		dns_fixedname_init(&fixed);
+		name = dns_fixedname_name(&fixed);
+		ATF_REQUIRE_EQ(dns_name_fromstring(name, text, 0, NULL),
+			       ISC_R_SUCCESS);
+		ATF_REQUIRE(dns_compress_findglobal(&cctx, name, &prefix,
+						    &offset));
+		ATF_CHECK_EQ(dns_name_countlabels(&prefix), 0);
+		ATF_CHECK_EQ(offset, offsets[i]);
+
+		dns_compress_setsensitive(&cctx, ISC_TRUE);
+		ATF_CHECK(!dns_compress_findglobal(&cctx, name, &prefix,
+						   &offset));
+		dns_compress_setsensitive(&cctx, ISC_FALSE);
+	}
+
+	/*
+	 * Rolling back removes the later names only.
+	 */
+	dns_compress_rollback(&cctx, offsets[250]);
+	for (i = 0; i < 500; i++) {
+		snprintf(text, sizeof(text), "host%u.example.", i);
+		dns_fixedname_init(&fixed);
+		name = dns_fixedname_name(&fixed);
+		ATF_REQUIRE_EQ(dns_name_fromstring(name, text, 0, NULL),
+			       ISC_R_SUCCESS);
+		if (i < 250) {
+			ATF_CHECK(dns_compress_findglobal(&cctx, name,
+							  &prefix, &offset));
+			ATF_CHECK_EQ(offset, offsets[i]);
+		} else {
+			/* The "example." suffix is still present. */
+			ATF_CHECK(dns_compress_findglobal(&cctx, name,
+							  &prefix, &offset));
+			ATF_CHECK_EQ(dns_name_countlabels(&prefix), 1);
+		}
+	}
+
+	dns_compress_rollback(&cctx, 0);
+	snprintf(text, sizeof(text), "host0.example.");
+	dns_fixedname_init(&fixed);
+	name = dns_fixedname_name(&fixed);
+	ATF_REQUIRE_EQ(dns_name_fromstring(name, text, 0, NULL),
+		       ISC_R_SUCCESS);
+	ATF_CHECK(!dns_compress_findglobal(&cctx, name, &prefix, &offset));
+
+	dns_compress_invalidate(&cctx);
+
+	dns_test_end();
+}
+
 ATF_TC(istat);
 ATF_TC_HEAD(istat, tc) {
 	atf_tc_set_md_var(tc, "descr", "is trust-anchor-telementry test");
@@ -325,6 +418,140 @@ ATF_TC_BODY(istat, tc) {
 	}
 }
 
+ATF_TC(fromwire);
+ATF_TC_HEAD(fromwire, tc) {
+	atf_tc_set_md_var(tc, "descr", "dns_name_fromwire() copies, "
+				       "downcases and decompresses names");
+}
+ATF_TC_BODY(fromwire, tc) {
+	unsigned char wire[400], buf[DNS_NAME_MAXWIRE], small[10];
+	unsigned char *p;
+	isc_buffer_t source, target;
+	dns_decompress_t dctx, strict;
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	isc_result_t result;
+	unsigned int i, j, start;
+	struct {
+		const char *wire;
+		unsigned int length;
+		isc_result_t result;
+	} bad[] = {
+		{ "\003www\007exam", 9, ISC_R_UNEXPECTEDEND },
+		{ "\003www", 4, ISC_R_UNEXPECTEDEND },
+		{ "\003www\300", 5, ISC_R_UNEXPECTEDEND },
+		{ "\003www\300\004", 6, DNS_R_BADPOINTER },
+		{ "\003www\100", 5, DNS_R_BADLABELTYPE },
+		{ "\003www\200\000", 6, DNS_R_BADLABELTYPE },
+	};
+
+	UNUSED(tc);
+
+	dns_fixedname_init(&fixed);
+	name = dns_fixedname_name(&fixed);
+	dns_decompress_init(&dctx, -1, DNS_DECOMPRESS_ANY);
+	dns_decompress_setmethods(&dctx, DNS_COMPRESS_GLOBAL14);
+
+	/*
+	 * Every byte value, in labels long enough to take the vector
+	 * path and with tails of every length, as is and downcased.
+	 */
+	for (start = 0; start < 256; start += 125) {
+		p = wire;
+		for (i = 0; i < 3; i++) {
+			*p++ = 63 - i * 21;
+			for (j = 0; j < 63 - i * 21U; j++, p++)
+				*p = (start + (p - wire)) & 0xff;
+		}
+		*p++ = 0;
+
+		isc_buffer_init(&source, wire, p - wire);
+		isc_buffer_add(&source, p - wire);
+		isc_buffer_setactive(&source, p - wire);
+		isc_buffer_init(&target, buf, sizeof(buf));
+		result = dns_name_fromwire(name, &source, &dctx, 0, &target);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		ATF_CHECK_EQ(name->length, (unsigned int)(p - wire));
+		ATF_CHECK_EQ(name->labels, 4);
+		ATF_CHECK(memcmp(name->ndata, wire, p - wire) == 0);
+		ATF_CHECK_EQ(isc_buffer_remaininglength(&source), 0);
+
+		isc_buffer_first(&source);
+		isc_buffer_init(&target, buf, sizeof(buf));
+		result = dns_name_fromwire(name, &source, &dctx,
+					   DNS_NAME_DOWNCASE, &target);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		for (i = 0; i < name->length; i++) {
+			if (wire[i] >= 'A' && wire[i] <= 'Z')
+				ATF_CHECK_EQ(name->ndata[i], wire[i] + 32);
+			else
+				ATF_CHECK_EQ(name->ndata[i], wire[i]);
+		}
+	}
+
+	/*
+	 * A compression pointer: only the bytes up to and including the
+	 * pointer are consumed.
+	 */
+	memmove(wire, "\007EXAMPLE\003COM\000\003WwW\300\000", 19);
+	isc_buffer_init(&source, wire, 19);
+	isc_buffer_add(&source, 19);
+	isc_buffer_setactive(&source, 19);
+	isc_buffer_forward(&source, 13);
+	isc_buffer_init(&target, buf, sizeof(buf));
+	result = dns_name_fromwire(name, &source, &dctx, DNS_NAME_DOWNCASE,
+				   &target);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(name->length, 17);
+	ATF_CHECK_EQ(name->labels, 4);
+	ATF_CHECK(memcmp(name->ndata, "\003www\007example\003com", 17) == 0);
+	ATF_CHECK_EQ(isc_buffer_remaininglength(&source), 0);
+
+	isc_buffer_first(&source);
+	isc_buffer_forward(&source, 13);
+	isc_buffer_init(&target, small, sizeof(small));
+	result = dns_name_fromwire(name, &source, &dctx, 0, &target);
+	ATF_CHECK_EQ(result, ISC_R_NOSPACE);
+
+	dns_decompress_init(&strict, -1, DNS_DECOMPRESS_STRICT);
+	dns_decompress_setmethods(&strict, DNS_COMPRESS_NONE);
+	isc_buffer_first(&source);
+	isc_buffer_forward(&source, 13);
+	isc_buffer_init(&target, buf, sizeof(buf));
+	result = dns_name_fromwire(name, &source, &strict, 0, &target);
+	ATF_CHECK_EQ(result, DNS_R_DISALLOWED);
+	dns_decompress_invalidate(&strict);
+
+	/*
+	 * Five labels of 63 bytes make a name that is too long.
+	 */
+	memset(wire, 'a', sizeof(wire));
+	for (i = 0; i < 5; i++)
+		wire[i * 64] = 63;
+	wire[5 * 64] = 0;
+	isc_buffer_init(&source, wire, 5 * 64 + 1);
+	isc_buffer_add(&source, 5 * 64 + 1);
+	isc_buffer_setactive(&source, 5 * 64 + 1);
+	isc_buffer_init(&target, buf, sizeof(buf));
+	result = dns_name_fromwire(name, &source, &dctx, 0, &target);
+	ATF_CHECK_EQ(result, DNS_R_NAMETOOLONG);
+
+	for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		memmove(wire, bad[i].wire, bad[i].length);
+		isc_buffer_init(&source, wire, bad[i].length);
+		isc_buffer_add(&source, bad[i].length);
+		isc_buffer_setactive(&source, bad[i].length);
+		isc_buffer_init(&target, buf, sizeof(buf));
+		result = dns_name_fromwire(name, &source, &dctx, 0, &target);
+		ATF_CHECK_EQ_MSG(result, bad[i].result, "case %u: %s", i,
+				 isc_result_totext(result));
+		ATF_CHECK_EQ(name->length, 0);
+		ATF_CHECK_EQ(source.current, 0);
+	}
+
+	dns_decompress_invalidate(&dctx);
+}
+
 #ifdef ISC_PLATFORM_USETHREADS
 #ifdef DNS_BENCHMARK_TESTS
 
@@ -429,7 +656,9 @@ ATF_TC_BODY(benchmark, tc) {
 ATF_TP_ADD_TCS(tp) {
 	ATF_TP_ADD_TC(tp, fullcompare);
 	ATF_TP_ADD_TC(tp, compression);
+	ATF_TP_ADD_TC(tp, compression_table);
 	ATF_TP_ADD_TC(tp, istat);
+	ATF_TP_ADD_TC(tp, fromwire);
 #ifdef ISC_PLATFORM_USETHREADS
 #ifdef DNS_BENCHMARK_TESTS
 	ATF_TP_ADD_TC(tp, benchmark);
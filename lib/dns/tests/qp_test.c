@@ -0,0 +1,666 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <atf-c.h>
+
+#include <string.h>
+
+#include <isc/buffer.h>
+#include <isc/print.h>
+#include <isc/util.h>
+
+#include <dns/db.h>
+#include <dns/dbiterator.h>
+#include <dns/fixedname.h>
+#include <dns/name.h>
+#include <dns/qp.h>
+#include <dns/rbt.h>
+#include <dns/rdataset.h>
+#include <dns/result.h>
+
+#include "dnstest.h"
+
+#define NNAMES		3000
+
+static dns_name_t *
+makename(dns_fixedname_t *fixed, const char *text) {
+	isc_result_t result;
+	dns_name_t *name;
+
+	dns_fixedname_init(fixed);
+	name = dns_fixedname_name(fixed);
+	result = dns_name_fromstring(name, text, 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	return (name);
+}
+
+/*
+ * A small generator, so that failures can be reproduced.
+ */
+static isc_uint32_t seed = 1;
+
+static isc_uint32_t
+next_random(void) {
+	seed = seed * 1103515245U + 12345U;
+	return (seed >> 16);
+}
+
+/*
+ * Names built from a few short labels share many prefixes and
+ * suffixes, which exercises branches at every nibble.  Some labels
+ * differ only in case, and some contain the octets which the key
+ * encoding escapes.
+ */
+static const char *labels[] = {
+	"a", "b", "ab", "ba", "abc", "A", "AB", "x", "xy", "\\000",
+	"\\254", "\\255", "\\254\\255", "z\\255", "-", "0", "www", "mail"
+};
+
+static void
+random_name(char *buf, size_t size) {
+	unsigned int i, n;
+
+	buf[0] = '\0';
+	n = 1 + next_random() % 4;
+	for (i = 0; i < n; i++) {
+		strlcat(buf, labels[next_random() %
+				    (sizeof(labels) / sizeof(labels[0]))],
+			size);
+		strlcat(buf, ".", size);
+	}
+}
+
+static void
+check_name(dns_rbtnode_t *qnode, dns_rbtnode_t *rnode) {
+	dns_fixedname_t fq, fr;
+	dns_name_t *qname, *rname;
+	isc_result_t result;
+
+	ATF_REQUIRE(qnode != NULL && rnode != NULL);
+
+	dns_fixedname_init(&fq);
+	qname = dns_fixedname_name(&fq);
+	dns_fixedname_init(&fr);
+	rname = dns_fixedname_name(&fr);
+
+	result = dns_qp_fullnamefromnode(qnode, qname);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_rbt_fullnamefromnode(rnode, rname);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK(dns_name_equal(qname, rname));
+}
+
+/*
+ * The rbt keeps nodes without data where names have been split or
+ * deleted; skip them to find the predecessor among the names added.
+ */
+static dns_rbtnode_t *
+rbt_pred(dns_rbtnodechain_t *chain) {
+	dns_fixedname_t fn, fo;
+	dns_rbtnode_t *node = NULL;
+	isc_result_t result;
+
+	dns_fixedname_init(&fn);
+	dns_fixedname_init(&fo);
+	result = dns_rbtnodechain_current(chain, NULL, NULL, &node);
+	while (result == ISC_R_SUCCESS && node != NULL &&
+	       node->data == NULL)
+	{
+		result = dns_rbtnodechain_prev(chain,
+					       dns_fixedname_name(&fn),
+					       dns_fixedname_name(&fo));
+		if (result != ISC_R_SUCCESS && result != DNS_R_NEWORIGIN)
+			return (NULL);
+		result = dns_rbtnodechain_current(chain, NULL, NULL, &node);
+	}
+	return (result == ISC_R_SUCCESS ? node : NULL);
+}
+
+static void
+compare_find(dns_qp_t *qp, dns_rbt_t *rbt, const dns_name_t *name) {
+	dns_qpchain_t qchain;
+	dns_rbtnodechain_t rchain;
+	dns_rbtnode_t *qnode = NULL, *rnode = NULL;
+	dns_rbtnode_t *qpred = NULL, *rpred;
+	isc_result_t qresult, rresult;
+
+	dns_qpchain_init(&qchain, mctx);
+	dns_rbtnodechain_init(&rchain, mctx);
+
+	qresult = dns_qp_findnode(qp, name, NULL, &qnode, &qchain, 0,
+				  NULL, NULL);
+	rresult = dns_rbt_findnode(rbt, name, NULL, &rnode, &rchain, 0,
+				   NULL, NULL);
+	ATF_CHECK_EQ(qresult, rresult);
+	if (qresult != rresult)
+		return;
+
+	if (qresult == ISC_R_SUCCESS || qresult == DNS_R_PARTIALMATCH)
+		check_name(qnode, rnode);
+
+	if (qresult != ISC_R_SUCCESS) {
+		(void)dns_qpchain_current(&qchain, NULL, NULL, &qpred);
+		rpred = rbt_pred(&rchain);
+		ATF_CHECK_EQ(qpred == NULL, rpred == NULL);
+		if (qpred != NULL && rpred != NULL)
+			check_name(qpred, rpred);
+	}
+
+	dns_qpchain_invalidate(&qchain);
+	dns_rbtnodechain_invalidate(&rchain);
+}
+
+/*
+ * Walk both trees in DNSSEC order, forwards and backwards, and check
+ * that they hold the same names.
+ */
+static void
+compare_walk(dns_qp_t *qp, dns_rbt_t *rbt, isc_boolean_t forward) {
+	dns_qpchain_t qchain;
+	dns_rbtnodechain_t rchain;
+	dns_fixedname_t fn, fo;
+	dns_name_t *name, *origin;
+	dns_rbtnode_t *qnode, *rnode;
+	isc_result_t qresult, rresult;
+	unsigned int count = 0;
+
+	dns_fixedname_init(&fn);
+	name = dns_fixedname_name(&fn);
+	dns_fixedname_init(&fo);
+	origin = dns_fixedname_name(&fo);
+
+	dns_qpchain_init(&qchain, mctx);
+	dns_rbtnodechain_init(&rchain, mctx);
+
+	if (forward) {
+		qresult = dns_qpchain_first(&qchain, qp, name, origin);
+		rresult = dns_rbtnodechain_first(&rchain, rbt, name, origin);
+	} else {
+		qresult = dns_qpchain_last(&qchain, qp, name, origin);
+		rresult = dns_rbtnodechain_last(&rchain, rbt, name, origin);
+	}
+
+	for (;;) {
+		while (rresult == ISC_R_SUCCESS ||
+		       rresult == DNS_R_NEWORIGIN)
+		{
+			rnode = NULL;
+			dns_rbtnodechain_current(&rchain, NULL, NULL, &rnode);
+			if (rnode->data != NULL)
+				break;
+			if (forward)
+				rresult = dns_rbtnodechain_next(&rchain, name,
+								origin);
+			else
+				rresult = dns_rbtnodechain_prev(&rchain, name,
+								origin);
+		}
+		if (qresult != ISC_R_SUCCESS && qresult != DNS_R_NEWORIGIN) {
+			ATF_CHECK(rresult != ISC_R_SUCCESS &&
+				  rresult != DNS_R_NEWORIGIN);
+			break;
+		}
+		ATF_REQUIRE(rresult == ISC_R_SUCCESS ||
+			    rresult == DNS_R_NEWORIGIN);
+
+		qnode = NULL;
+		rnode = NULL;
+		dns_qpchain_current(&qchain, NULL, NULL, &qnode);
+		dns_rbtnodechain_current(&rchain, NULL, NULL, &rnode);
+		check_name(qnode, rnode);
+		count++;
+
+		if (forward) {
+			qresult = dns_qpchain_next(&qchain, name, origin);
+			rresult = dns_rbtnodechain_next(&rchain, name, origin);
+		} else {
+			qresult = dns_qpchain_prev(&qchain, name, origin);
+			rresult = dns_rbtnodechain_prev(&rchain, name, origin);
+		}
+	}
+
+	ATF_CHECK_EQ(count, dns_qp_nodecount(qp));
+
+	dns_qpchain_invalidate(&qchain);
+	dns_rbtnodechain_invalidate(&rchain);
+}
+
+ATF_TC(qp_addfind);
+ATF_TC_HEAD(qp_addfind, tc) {
+	atf_tc_set_md_var(tc, "descr", "add and find names, and the "
+				       "ancestors of names");
+}
+ATF_TC_BODY(qp_addfind, tc) {
+	static const char *names[] = {
+		"example.", "www.example.", "a.b.example.", "EXAMPLE.org.",
+		"org.", "\\255.example.", "\\254.example.", "example.\\255."
+	};
+	dns_fixedname_t fixed, ffound;
+	dns_name_t *name, *found;
+	dns_qp_t *qp = NULL;
+	dns_qpchain_t chain;
+	dns_rbtnode_t *node, *exnode = NULL, *orgnode = NULL;
+	isc_result_t result;
+	unsigned int i;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, ISC_FALSE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_qp_create(mctx, NULL, NULL, &qp);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	dns_fixedname_init(&ffound);
+	found = dns_fixedname_name(&ffound);
+
+	node = NULL;
+	name = makename(&fixed, "example.");
+	result = dns_qp_findnode(qp, name, NULL, &node, NULL, 0, NULL, NULL);
+	ATF_CHECK_EQ(result, ISC_R_NOTFOUND);
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		name = makename(&fixed, names[i]);
+		node = NULL;
+		result = dns_qp_addnode(qp, name, &node);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		node->data = node;
+		if (i == 0)
+			exnode = node;
+		if (i == 4)
+			orgnode = node;
+	}
+	ATF_CHECK_EQ(dns_qp_nodecount(qp), i);
+
+	/* Names are compared without regard to case. */
+	name = makename(&fixed, "Example.");
+	node = NULL;
+	result = dns_qp_addnode(qp, name, &node);
+	ATF_CHECK_EQ(result, ISC_R_EXISTS);
+	ATF_CHECK_EQ(node, exnode);
+
+	/* An exact match has every ancestor in the trie as a level. */
+	dns_qpchain_init(&chain, mctx);
+	name = makename(&fixed, "www.Example.");
+	node = NULL;
+	result = dns_qp_findnode(qp, name, found, &node, &chain, 0,
+				 NULL, NULL);
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK(dns_name_equal(found, name));
+	ATF_CHECK_EQ(chain.level_matches, 1);
+	ATF_CHECK_EQ(chain.levels[0], exnode);
+
+	/* "b.example." is not in the trie, so it is not an ancestor. */
+	name = makename(&fixed, "x.a.b.example.");
+	node = NULL;
+	result = dns_qp_findnode(qp, name, found, &node, &chain, 0,
+				 NULL, NULL);
+	ATF_CHECK_EQ(result, DNS_R_PARTIALMATCH);
+	ATF_CHECK(dns_name_equal(found, makename(&fixed, "a.b.example.")));
+	ATF_CHECK_EQ(chain.level_matches, 1);
+	ATF_CHECK_EQ(chain.levels[0], exnode);
+
+	name = makename(&fixed, "b.example.");
+	node = NULL;
+	result = dns_qp_findnode(qp, name, found, &node, &chain, 0,
+				 NULL, NULL);
+	ATF_CHECK_EQ(result, DNS_R_PARTIALMATCH);
+	ATF_CHECK_EQ(node, exnode);
+	ATF_CHECK_EQ(chain.level_matches, 0);
+
+	/* A name with data hidden by NOEXACT finds its parent. */
+	name = makename(&fixed, "example.org.");
+	node = NULL;
+	result = dns_qp_findnode(qp, name, found, &node, &chain,
+				 DNS_RBTFIND_NOEXACT, NULL, NULL);
+	ATF_CHECK_EQ(result, DNS_R_PARTIALMATCH);
+	ATF_CHECK_EQ(node, orgnode);
+
+	/* Nothing above "net." */
+	name = makename(&fixed, "example.net.");
+	node = NULL;
+	result = dns_qp_findnode(qp, name, found, &node, &chain, 0,
+				 NULL, NULL);
+	ATF_CHECK_EQ(result, ISC_R_NOTFOUND);
+
+	dns_qpchain_invalidate(&chain);
+
+	/* Delete every name, checking the others are still found. */
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		unsigned int j;
+
+		name = makename(&fixed, names[i]);
+		node = NULL;
+		result = dns_qp_findnode(qp, name, NULL, &node, NULL, 0,
+					 NULL, NULL);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		result = dns_qp_deletenode(qp, node, ISC_FALSE);
+		ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+
+		for (j = i + 1; j < sizeof(names) / sizeof(names[0]); j++) {
+			name = makename(&fixed, names[j]);
+			node = NULL;
+			result = dns_qp_findnode(qp, name, NULL, &node, NULL,
+						 0, NULL, NULL);
+			ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+		}
+	}
+	ATF_CHECK_EQ(dns_qp_nodecount(qp), 0);
+	ATF_CHECK_EQ(dns_qp_memusage(qp), 0);
+
+	dns_qp_destroy(&qp);
+	ATF_CHECK_EQ(qp, NULL);
+
+	dns_test_end();
+}
+
+ATF_TC(qp_rbt);
+ATF_TC_HEAD(qp_rbt, tc) {
+	atf_tc_set_md_var(tc, "descr", "lookups, predecessors and walks "
+				       "match those of an rbt");
+}
+ATF_TC_BODY(qp_rbt, tc) {
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	dns_qp_t *qp = NULL;
+	dns_rbt_t *rbt = NULL;
+	dns_rbtnode_t *qnode, *rnode;
+	isc_result_t qresult, rresult;
+	char buf[DNS_NAME_FORMATSIZE];
+	unsigned int i;
+
+	UNUSED(tc);
+
+	qresult = dns_test_begin(NULL, ISC_FALSE);
+	ATF_REQUIRE_EQ(qresult, ISC_R_SUCCESS);
+
+	qresult = dns_qp_create(mctx, NULL, NULL, &qp);
+	ATF_REQUIRE_EQ(qresult, ISC_R_SUCCESS);
+	rresult = dns_rbt_create(mctx, NULL, NULL, &rbt);
+	ATF_REQUIRE_EQ(rresult, ISC_R_SUCCESS);
+
+	seed = 1;
+	for (i = 0; i < NNAMES; i++) {
+		random_name(buf, sizeof(buf));
+		name = makename(&fixed, buf);
+		qnode = NULL;
+		rnode = NULL;
+		qresult = dns_qp_addnode(qp, name, &qnode);
+		rresult = dns_rbt_addnode(rbt, name, &rnode);
+		if (rresult == ISC_R_EXISTS && rnode->data == NULL)
+			rresult = ISC_R_SUCCESS;
+		ATF_CHECK_EQ(qresult, rresult);
+		qnode->data = qnode;
+		rnode->data = rnode;
+	}
+
+	for (i = 0; i < NNAMES; i++) {
+		random_name(buf, sizeof(buf));
+		compare_find(qp, rbt, makename(&fixed, buf));
+	}
+	compare_walk(qp, rbt, ISC_TRUE);
+	compare_walk(qp, rbt, ISC_FALSE);
+
+	/*
+	 * Delete about half of the names and check again.
+	 */
+	seed = 1;
+	for (i = 0; i < NNAMES; i++) {
+		random_name(buf, sizeof(buf));
+		if (i % 2 != 0)
+			continue;
+		name = makename(&fixed, buf);
+		qnode = NULL;
+		qresult = dns_qp_findnode(qp, name, NULL, &qnode, NULL, 0,
+					  NULL, NULL);
+		if (qresult != ISC_R_SUCCESS)
+			continue;
+		qresult = dns_qp_deletenode(qp, qnode, ISC_FALSE);
+		ATF_CHECK_EQ(qresult, ISC_R_SUCCESS);
+		rresult = dns_rbt_deletename(rbt, name, ISC_FALSE);
+		ATF_CHECK_EQ(rresult, ISC_R_SUCCESS);
+	}
+
+	for (i = 0; i < NNAMES; i++) {
+		random_name(buf, sizeof(buf));
+		compare_find(qp, rbt, makename(&fixed, buf));
+	}
+	compare_walk(qp, rbt, ISC_TRUE);
+	compare_walk(qp, rbt, ISC_FALSE);
+
+	dns_qp_destroy(&qp);
+	dns_rbt_destroy(&rbt);
+
+	dns_test_end();
+}
+
+static isc_result_t
+stop_callback(dns_rbtnode_t *node, dns_name_t *name, void *arg) {
+	unsigned int *calls = arg;
+
+	UNUSED(node);
+	UNUSED(name);
+
+	(*calls)++;
+	return (DNS_R_PARTIALMATCH);
+}
+
+ATF_TC(qp_callback);
+ATF_TC_HEAD(qp_callback, tc) {
+	atf_tc_set_md_var(tc, "descr", "a find callback stops the search "
+				       "at an ancestor");
+}
+ATF_TC_BODY(qp_callback, tc) {
+	dns_fixedname_t fixed, ffound;
+	dns_name_t *name, *found;
+	dns_qp_t *qp = NULL;
+	dns_qpchain_t chain;
+	dns_rbtnode_t *node = NULL, *cut = NULL;
+	isc_result_t result;
+	unsigned int calls = 0;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, ISC_FALSE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_qp_create(mctx, NULL, NULL, &qp);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	name = makename(&fixed, "example.");
+	result = dns_qp_addnode(qp, name, &node);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	node->data = node;
+
+	name = makename(&fixed, "sub.example.");
+	result = dns_qp_addnode(qp, name, &cut);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	cut->data = cut;
+	cut->find_callback = 1;
+
+	node = NULL;
+	name = makename(&fixed, "www.sub.example.");
+	result = dns_qp_addnode(qp, name, &node);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	node->data = node;
+
+	dns_fixedname_init(&ffound);
+	found = dns_fixedname_name(&ffound);
+	dns_qpchain_init(&chain, mctx);
+
+	node = NULL;
+	result = dns_qp_findnode(qp, name, found, &node, &chain, 0,
+				 stop_callback, &calls);
+	ATF_CHECK_EQ(result, DNS_R_PARTIALMATCH);
+	ATF_CHECK_EQ(calls, 1);
+	ATF_CHECK_EQ(node, cut);
+	ATF_CHECK_EQ(chain.end, cut);
+	ATF_CHECK(dns_name_equal(found, makename(&fixed, "sub.example.")));
+
+	/* Without the callback the name itself is found. */
+	node = NULL;
+	name = makename(&fixed, "www.sub.example.");
+	result = dns_qp_findnode(qp, name, NULL, &node, &chain, 0,
+				 NULL, NULL);
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(chain.level_matches, 2);
+
+	dns_qpchain_invalidate(&chain);
+	dns_qp_destroy(&qp);
+
+	dns_test_end();
+}
+
+/*
+ * Load the same zone into an "rbt" and a "qp" database, and check
+ * that lookups give the same answers.
+ */
+static void
+compare_dbfind(dns_db_t *rdb, dns_db_t *qdb, const char *text,
+	       dns_rdatatype_t type)
+{
+	dns_fixedname_t fixed, frfound, fqfound;
+	dns_name_t *name, *rfound, *qfound;
+	dns_rdataset_t rrdataset, qrdataset;
+	isc_result_t rresult, qresult;
+
+	name = makename(&fixed, text);
+	dns_fixedname_init(&frfound);
+	rfound = dns_fixedname_name(&frfound);
+	dns_fixedname_init(&fqfound);
+	qfound = dns_fixedname_name(&fqfound);
+	dns_rdataset_init(&rrdataset);
+	dns_rdataset_init(&qrdataset);
+
+	rresult = dns_db_find(rdb, name, NULL, type, 0, 0, NULL, rfound,
+			      &rrdataset, NULL);
+	qresult = dns_db_find(qdb, name, NULL, type, 0, 0, NULL, qfound,
+			      &qrdataset, NULL);
+	ATF_CHECK_EQ_MSG(qresult, rresult, "%s: %s != %s", text,
+			 dns_result_totext(qresult),
+			 dns_result_totext(rresult));
+	ATF_CHECK_MSG(dns_name_equal(rfound, qfound), "%s", text);
+	ATF_CHECK_EQ(dns_rdataset_isassociated(&rrdataset),
+		     dns_rdataset_isassociated(&qrdataset));
+	if (dns_rdataset_isassociated(&rrdataset)) {
+		ATF_CHECK_EQ(rrdataset.type, qrdataset.type);
+		ATF_CHECK_EQ(dns_rdataset_count(&rrdataset),
+			     dns_rdataset_count(&qrdataset));
+		dns_rdataset_disassociate(&rrdataset);
+	}
+	if (dns_rdataset_isassociated(&qrdataset))
+		dns_rdataset_disassociate(&qrdataset);
+}
+
+ATF_TC(qp_db);
+ATF_TC_HEAD(qp_db, tc) {
+	atf_tc_set_md_var(tc, "descr", "a \"qp\" zone database answers as "
+				       "an \"rbt\" one does");
+}
+ATF_TC_BODY(qp_db, tc) {
+	static const char *file = "testdata/qp/zone.data";
+	dns_fixedname_t fixed, frname, fqname;
+	dns_name_t *origin, *rname, *qname;
+	dns_db_t *rdb = NULL, *qdb = NULL;
+	dns_dbiterator_t *riter = NULL, *qiter = NULL;
+	dns_dbnode_t *node;
+	isc_result_t result, rresult, qresult;
+	unsigned int count = 0;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, ISC_FALSE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	origin = makename(&fixed, "example.");
+	result = dns_db_create(mctx, "rbt", origin, dns_dbtype_zone,
+			       dns_rdataclass_in, 0, NULL, &rdb);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_db_load(rdb, file);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_db_create(mctx, "qp", origin, dns_dbtype_zone,
+			       dns_rdataclass_in, 0, NULL, &qdb);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_db_load(qdb, file);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	compare_dbfind(rdb, qdb, "example.", dns_rdatatype_soa);
+	compare_dbfind(rdb, qdb, "example.", dns_rdatatype_mx);
+	compare_dbfind(rdb, qdb, "www.example.", dns_rdatatype_a);
+	compare_dbfind(rdb, qdb, "WWW.Example.", dns_rdatatype_a);
+	compare_dbfind(rdb, qdb, "www.example.", dns_rdatatype_aaaa);
+	compare_dbfind(rdb, qdb, "alias.example.", dns_rdatatype_a);
+	compare_dbfind(rdb, qdb, "nothere.example.", dns_rdatatype_a);
+	compare_dbfind(rdb, qdb, "zzz.example.", dns_rdatatype_a);
+	compare_dbfind(rdb, qdb, "b.c.d.example.", dns_rdatatype_txt);
+	compare_dbfind(rdb, qdb, "c.d.example.", dns_rdatatype_txt);
+	compare_dbfind(rdb, qdb, "x.c.d.example.", dns_rdatatype_txt);
+	compare_dbfind(rdb, qdb, "foo.wild.example.", dns_rdatatype_txt);
+	compare_dbfind(rdb, qdb, "a.b.wild.example.", dns_rdatatype_txt);
+	compare_dbfind(rdb, qdb, "wild.example.", dns_rdatatype_txt);
+	compare_dbfind(rdb, qdb, "sub.example.", dns_rdatatype_a);
+	compare_dbfind(rdb, qdb, "www.sub.example.", dns_rdatatype_a);
+	compare_dbfind(rdb, qdb, "ns.sub.example.", dns_rdatatype_a);
+	compare_dbfind(rdb, qdb, "other.", dns_rdatatype_a);
+
+	/*
+	 * Both databases hold the same names in the same order.
+	 */
+	result = dns_db_createiterator(rdb, 0, &riter);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_db_createiterator(qdb, 0, &qiter);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	dns_fixedname_init(&frname);
+	rname = dns_fixedname_name(&frname);
+	dns_fixedname_init(&fqname);
+	qname = dns_fixedname_name(&fqname);
+
+	for (rresult = dns_dbiterator_first(riter),
+	     qresult = dns_dbiterator_first(qiter);
+	     rresult == ISC_R_SUCCESS && qresult == ISC_R_SUCCESS;
+	     rresult = dns_dbiterator_next(riter),
+	     qresult = dns_dbiterator_next(qiter))
+	{
+		node = NULL;
+		result = dns_dbiterator_current(riter, &node, rname);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		dns_db_detachnode(rdb, &node);
+		result = dns_dbiterator_current(qiter, &node, qname);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		dns_db_detachnode(qdb, &node);
+		ATF_CHECK(dns_name_equal(rname, qname));
+		count++;
+	}
+	ATF_CHECK_EQ(rresult, ISC_R_NOMORE);
+	ATF_CHECK_EQ(qresult, ISC_R_NOMORE);
+	ATF_CHECK(count > 10);
+
+	dns_dbiterator_destroy(&riter);
+	dns_dbiterator_destroy(&qiter);
+	dns_db_detach(&rdb);
+	dns_db_detach(&qdb);
+
+	dns_test_end();
+}
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, qp_addfind);
+	ATF_TP_ADD_TC(tp, qp_rbt);
+	ATF_TP_ADD_TC(tp, qp_callback);
+	ATF_TP_ADD_TC(tp, qp_db);
+	return (atf_no_error());
+}
@@ -100,13 +100,16 @@ delete_data(void *data, void *arg) {
 }
 
 static isc_result_t
-write_data(FILE *file, unsigned char *datap, void *arg, isc_uint64_t *crc) {
+write_data(FILE *file, unsigned char *datap, void *base, dns_rbtnode_t *node,
+	   void *arg, isc_uint64_t *crc)
+{
 	isc_result_t result;
 	size_t ret = 0;
 	data_holder_t *data = (data_holder_t *)datap;
 	data_holder_t temp;
 	off_t where;
 
+	UNUSED(node);
 	UNUSED(arg);
 
 	REQUIRE(file != NULL);
@@ -122,7 +125,8 @@ write_data(FILE *file, unsigned char *datap, void *arg, isc_uint64_t *crc) {
 	temp = *data;
 	temp.data = (data->len == 0
 		     ? NULL
-		     : (char *)((uintptr_t)where + sizeof(data_holder_t)));
+		     : (char *)((uintptr_t)base + (uintptr_t)where +
+				sizeof(data_holder_t)));
 
 	isc_crc64_update(crc, (void *)&temp, sizeof(temp));
 	ret = fwrite(&temp, sizeof(data_holder_t), 1, file);
@@ -165,7 +169,7 @@ fix_data(dns_rbtnode_t *p, void *base, size_t max, void *arg,
 
 	size = max - ((char *)p - (char *)base);
 
-	if (data->len > (int) size || data->data > (const char *) max) {
+	if (data->len > (int) size) {
 		printf("data invalid\n");
 		return (ISC_R_INVALIDFILE);
 	}
@@ -182,6 +186,19 @@ fix_data(dns_rbtnode_t *p, void *base, size_t max, void *arg,
 	return (ISC_R_SUCCESS);
 }
 
+/*
+ * Count the calls to fix_data(), and otherwise behave as it does.
+ */
+static unsigned int fixes;
+
+static isc_result_t
+count_fixes(dns_rbtnode_t *p, void *base, size_t max, void *arg,
+	    isc_uint64_t *crc)
+{
+	fixes++;
+	return (fix_data(p, base, max, arg, crc));
+}
+
 /*
  * Load test data into the RBT.
  */
@@ -303,7 +320,7 @@ ATF_TC_BODY(serialize, tc) {
 	printf("serialization begins.\n");
 	rbtfile = fopen("./zone.bin", "w+b");
 	ATF_REQUIRE(rbtfile != NULL);
-	result = dns_rbt_serialize_tree(rbtfile, rbt, write_data, NULL,
+	result = dns_rbt_serialize_tree(rbtfile, rbt, write_data, NULL, NULL,
 					&offset);
 	ATF_REQUIRE(result == ISC_R_SUCCESS);
 	dns_rbt_destroy(&rbt);
@@ -343,6 +360,90 @@ ATF_TC_BODY(serialize, tc) {
 	dns_test_end();
 }
 
+ATF_TC(serialize_prelinked);
+ATF_TC_HEAD(serialize_prelinked, tc) {
+	atf_tc_set_md_var(tc, "descr", "Test that an rbt mapped at the "
+				       "address it was written for needs "
+				       "no fixups");
+}
+ATF_TC_BODY(serialize_prelinked, tc) {
+	dns_rbt_t *rbt = NULL;
+	isc_result_t result;
+	FILE *rbtfile = NULL;
+	dns_rbt_t *rbt_deserialized = NULL;
+	off_t offset;
+	int fd;
+	off_t filesize = 0;
+	char *base, *where;
+	unsigned int i;
+
+	UNUSED(tc);
+
+	isc_mem_debugging = ISC_MEM_DEBUGRECORD;
+
+	result = dns_test_begin(NULL, ISC_TRUE);
+	ATF_CHECK_STREQ(dns_result_totext(result), "success");
+
+	/*
+	 * Find an address the image can be mapped at, by mapping an
+	 * anonymous region and releasing it again.
+	 */
+	where = mmap(NULL, 1024 * 1024, PROT_READ,
+		     MAP_PRIVATE|MAP_ANON, -1, 0);
+	ATF_REQUIRE(where != MAP_FAILED);
+	munmap(where, 1024 * 1024);
+
+	result = dns_rbt_create(mctx, delete_data, NULL, &rbt);
+	ATF_CHECK_STREQ(dns_result_totext(result), "success");
+	add_test_data(mctx, rbt);
+
+	rbtfile = fopen("./zone.bin", "w+b");
+	ATF_REQUIRE(rbtfile != NULL);
+	result = dns_rbt_serialize_tree(rbtfile, rbt, write_data, NULL, where,
+					&offset);
+	ATF_REQUIRE(result == ISC_R_SUCCESS);
+	dns_rbt_destroy(&rbt);
+	fclose(rbtfile);
+
+	/*
+	 * Once at the address the image was written for and once
+	 * elsewhere: only the second needs its pointers fixed up.  The
+	 * first is mapped read-only while it is loaded, so any write to
+	 * it would fault.
+	 */
+	for (i = 0; i < 2; i++) {
+		fd = open("zone.bin", O_RDWR);
+		isc_file_getsizefd(fd, &filesize);
+		base = mmap(i == 0 ? where : NULL, filesize,
+			    i == 0 ? PROT_READ : PROT_READ|PROT_WRITE,
+			    MAP_FILE|MAP_PRIVATE, fd, 0);
+		ATF_REQUIRE(base != NULL && base != MAP_FAILED);
+		close(fd);
+
+		fixes = 0;
+		result = dns_rbt_deserialize_tree(base, filesize, 0, mctx,
+						  delete_data, NULL,
+						  count_fixes, NULL, NULL,
+						  &rbt_deserialized);
+		ATF_REQUIRE(result == ISC_R_SUCCESS);
+		ATF_REQUIRE(rbt_deserialized != NULL);
+		if (i == 0) {
+			ATF_CHECK_EQ(fixes, 0);
+			ATF_REQUIRE(mprotect(base, filesize,
+					     PROT_READ|PROT_WRITE) == 0);
+		} else
+			ATF_CHECK(fixes > 0);
+
+		check_test_data(rbt_deserialized);
+
+		dns_rbt_destroy(&rbt_deserialized);
+		munmap(base, filesize);
+	}
+
+	unlink("zone.bin");
+	dns_test_end();
+}
+
 ATF_TC(deserialize_corrupt);
 ATF_TC_HEAD(deserialize_corrupt, tc) {
 	atf_tc_set_md_var(tc, "descr", "Test reading a corrupt map file");
@@ -353,8 +454,8 @@ ATF_TC_BODY(deserialize_corrupt, tc) {
 	FILE *rbtfile = NULL;
 	off_t offset;
 	int fd;
-	off_t filesize = 0;
-	char *base, *p, *q;
+	off_t filesize = 0, size;
+	char *base, *p, *q, *where;
 	isc_uint32_t r;
 	int i;
 
@@ -365,6 +466,11 @@ ATF_TC_BODY(deserialize_corrupt, tc) {
 	result = dns_test_begin(NULL, ISC_TRUE);
 	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
 
+	where = mmap(NULL, 1024 * 1024, PROT_READ,
+		     MAP_PRIVATE|MAP_ANON, -1, 0);
+	ATF_REQUIRE(where != MAP_FAILED);
+	munmap(where, 1024 * 1024);
+
 	/* Set up map file */
 	result = dns_rbt_create(mctx, delete_data, NULL, &rbt);
 	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
@@ -372,27 +478,33 @@ ATF_TC_BODY(deserialize_corrupt, tc) {
 	add_test_data(mctx, rbt);
 	rbtfile = fopen("./zone.bin", "w+b");
 	ATF_REQUIRE(rbtfile != NULL);
-	result = dns_rbt_serialize_tree(rbtfile, rbt, write_data, NULL,
+	result = dns_rbt_serialize_tree(rbtfile, rbt, write_data, NULL, where,
 					&offset);
 	ATF_REQUIRE(result == ISC_R_SUCCESS);
 	dns_rbt_destroy(&rbt);
 
-	/* Read back with random fuzzing */
+	/*
+	 * Read back with random fuzzing, alternately at the address the
+	 * image was written for and elsewhere.  Only the header is checked
+	 * at the address the image was written for, so only the header is
+	 * fuzzed there.
+	 */
 	for (i = 0; i < 256; i++) {
 		dns_rbt_t *rbt_deserialized = NULL;
 
 		fd = open("zone.bin", O_RDWR);
 		isc_file_getsizefd(fd, &filesize);
-		base = mmap(NULL, filesize,
+		base = mmap((i % 2) == 0 ? where : NULL, filesize,
 			    PROT_READ|PROT_WRITE,
 			    MAP_FILE|MAP_PRIVATE, fd, 0);
 		ATF_REQUIRE(base != NULL && base != MAP_FAILED);
 		close(fd);
 
 		/* Randomly fuzz a portion of the memory */
+		size = ((i % 2) == 0) ? 1024 : filesize;
 		isc_random_get(&r);
-		p = base + (r % filesize);
-		q = base + filesize;
+		p = base + (r % size);
+		q = base + size;
 		isc_random_get(&r);
 		q -= (r % (q - p));
 		while (p++ < q) {
@@ -450,6 +562,7 @@ ATF_TC_BODY(serialize_align, tc) {
  */
 ATF_TP_ADD_TCS(tp) {
 	ATF_TP_ADD_TC(tp, serialize);
+	ATF_TP_ADD_TC(tp, serialize_prelinked);
 	ATF_TP_ADD_TC(tp, deserialize_corrupt);
 	ATF_TP_ADD_TC(tp, serialize_align);
 
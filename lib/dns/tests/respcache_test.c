@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <atf-c.h>
+
+#include <string.h>
+
+#include <isc/buffer.h>
+#include <isc/print.h>
+#include <isc/util.h>
+
+#include <dns/db.h>
+#include <dns/fixedname.h>
+#include <dns/message.h>
+#include <dns/name.h>
+#include <dns/respcache.h>
+
+#include "dnstest.h"
+
+static dns_name_t *
+makename(dns_fixedname_t *fixed, const char *text) {
+	isc_result_t result;
+	dns_name_t *name;
+
+	dns_fixedname_init(fixed);
+	name = dns_fixedname_name(fixed);
+	result = dns_name_fromstring(name, text, 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	return (name);
+}
+
+static void
+makeresponse(unsigned char *buf, size_t len, isc_region_t *r) {
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (unsigned char)i;
+	r->base = buf;
+	r->length = (unsigned int)len;
+}
+
+/*
+ * Individual unit tests
+ */
+ATF_TC(respcache_find);
+ATF_TC_HEAD(respcache_find, tc) {
+	atf_tc_set_md_var(tc, "descr", "responses are found only for the "
+				       "exact query they were added for");
+}
+ATF_TC_BODY(respcache_find, tc) {
+	isc_result_t result;
+	dns_respcache_t *rc = NULL;
+	dns_fixedname_t f1, f2;
+	dns_name_t *name, *upper;
+	unsigned char data[100], out[512], small[20];
+	isc_region_t response;
+	isc_buffer_t b;
+	unsigned int attributes = 0;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, ISC_FALSE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_respcache_create(mctx, 100, &rc);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	name = makename(&f1, "www.example.");
+	upper = makename(&f2, "WWW.example.");
+	makeresponse(data, sizeof(data), &response);
+
+	dns_respcache_add(rc, name, dns_rdatatype_a, 512, 1, &response, 7);
+	ATF_CHECK_EQ(dns_respcache_count(rc), 1);
+
+	isc_buffer_init(&b, out, sizeof(out));
+	result = dns_respcache_find(rc, name, dns_rdatatype_a, 512, 1,
+				    &b, &attributes);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(attributes, 7);
+	ATF_REQUIRE_EQ(isc_buffer_usedlength(&b), sizeof(data));
+	ATF_CHECK(memcmp(out, data, sizeof(data)) == 0);
+
+	/* Type, flags and the case of the name are all part of the key. */
+	isc_buffer_init(&b, out, sizeof(out));
+	result = dns_respcache_find(rc, name, dns_rdatatype_aaaa, 512, 1,
+				    &b, &attributes);
+	ATF_CHECK_EQ(result, ISC_R_NOTFOUND);
+	result = dns_respcache_find(rc, name, dns_rdatatype_a, 4096, 1,
+				    &b, &attributes);
+	ATF_CHECK_EQ(result, ISC_R_NOTFOUND);
+	result = dns_respcache_find(rc, upper, dns_rdatatype_a, 512, 1,
+				    &b, &attributes);
+	ATF_CHECK_EQ(result, ISC_R_NOTFOUND);
+	ATF_CHECK_EQ(isc_buffer_usedlength(&b), 0);
+
+	isc_buffer_init(&b, small, sizeof(small));
+	result = dns_respcache_find(rc, name, dns_rdatatype_a, 512, 1,
+				    &b, &attributes);
+	ATF_CHECK_EQ(result, ISC_R_NOSPACE);
+
+	dns_respcache_flush(rc);
+	ATF_CHECK_EQ(dns_respcache_count(rc), 0);
+
+	dns_respcache_destroy(&rc);
+	ATF_REQUIRE_EQ(rc, NULL);
+
+	dns_test_end();
+}
+
+ATF_TC(respcache_generation);
+ATF_TC_HEAD(respcache_generation, tc) {
+	atf_tc_set_md_var(tc, "descr", "responses from an older database "
+				       "version are discarded");
+}
+ATF_TC_BODY(respcache_generation, tc) {
+	isc_result_t result;
+	dns_respcache_t *rc = NULL;
+	dns_db_t *db = NULL;
+	dns_dbversion_t *version = NULL;
+	isc_uint64_t gen1, gen2, gen3;
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	unsigned char data[DNS_MESSAGE_HEADERLEN], out[512];
+	isc_region_t response;
+	isc_buffer_t b;
+	unsigned int attributes;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, ISC_FALSE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_db_create(mctx, "rbt", dns_rootname, dns_dbtype_zone,
+			       dns_rdataclass_in, 0, NULL, &db);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_db_getgeneration(db, NULL, &gen1);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	/*
+	 * A new version has its own generation, which becomes current
+	 * only when it is committed.
+	 */
+	result = dns_db_newversion(db, &version);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_db_getgeneration(db, version, &gen2);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK(gen2 != gen1);
+	result = dns_db_getgeneration(db, NULL, &gen3);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(gen3, gen1);
+	dns_db_closeversion(db, &version, ISC_TRUE);
+	result = dns_db_getgeneration(db, NULL, &gen3);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(gen3, gen2);
+
+	result = dns_respcache_create(mctx, 10, &rc);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	name = makename(&fixed, "example.");
+	makeresponse(data, sizeof(data), &response);
+	dns_respcache_add(rc, name, dns_rdatatype_soa, 0, gen1,
+			  &response, 0);
+
+	isc_buffer_init(&b, out, sizeof(out));
+	result = dns_respcache_find(rc, name, dns_rdatatype_soa, 0, gen3,
+				    &b, &attributes);
+	ATF_CHECK_EQ(result, ISC_R_NOTFOUND);
+	ATF_CHECK_EQ(dns_respcache_count(rc), 0);
+
+	dns_respcache_destroy(&rc);
+	dns_db_detach(&db);
+	dns_test_end();
+}
+
+ATF_TC(respcache_replace);
+ATF_TC_HEAD(respcache_replace, tc) {
+	atf_tc_set_md_var(tc, "descr", "a full cache replaces entries "
+				       "rather than growing");
+}
+ATF_TC_BODY(respcache_replace, tc) {
+	isc_result_t result;
+	dns_respcache_t *rc = NULL;
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	unsigned char data[DNS_MESSAGE_HEADERLEN];
+	isc_region_t response;
+	char text[64];
+	unsigned int i;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, ISC_FALSE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_respcache_create(mctx, 16, &rc);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	makeresponse(data, sizeof(data), &response);
+	for (i = 0; i < 1000; i++) {
+		snprintf(text, sizeof(text), "name%u.example.", i);
+		name = makename(&fixed, text);
+		dns_respcache_add(rc, name, dns_rdatatype_a, 0, 1,
+				  &response, 0);
+	}
+	ATF_CHECK(dns_respcache_count(rc) <= 16);
+
+	/* Adding the same query again replaces the existing entry. */
+	dns_respcache_flush(rc);
+	for (i = 0; i < 10; i++)
+		dns_respcache_add(rc, name, dns_rdatatype_a, 0, 1,
+				  &response, 0);
+	ATF_CHECK_EQ(dns_respcache_count(rc), 1);
+
+	dns_respcache_destroy(&rc);
+	dns_test_end();
+}
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, respcache_find);
+	ATF_TP_ADD_TC(tp, respcache_generation);
+	ATF_TP_ADD_TC(tp, respcache_replace);
+	return (atf_no_error());
+}
@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <atf-c.h>
+
+#include <string.h>
+
+#include <isc/buffer.h>
+#include <isc/stats.h>
+#include <isc/stdtime.h>
+#include <isc/util.h>
+
+#include <dns/dnssec.h>
+#include <dns/fixedname.h>
+#include <dns/keyvalues.h>
+#include <dns/name.h>
+#include <dns/rdata.h>
+#include <dns/rdatalist.h>
+#include <dns/rdataset.h>
+#include <dns/sigcache.h>
+#include <dns/stats.h>
+
+#include <dst/dst.h>
+
+#include "dnstest.h"
+
+static void
+makedigest(unsigned char *digest, unsigned char set, unsigned char entry) {
+	memset(digest, 0, DNS_SIGCACHE_DIGESTLENGTH);
+	digest[0] = set;
+	digest[DNS_SIGCACHE_DIGESTLENGTH - 1] = entry;
+}
+
+/*
+ * Individual unit tests
+ */
+ATF_TC(sigcache_find);
+ATF_TC_HEAD(sigcache_find, tc) {
+	atf_tc_set_md_var(tc, "descr", "only digests which have been added "
+				       "are found");
+}
+ATF_TC_BODY(sigcache_find, tc) {
+	isc_result_t result;
+	dns_sigcache_t *cache = NULL;
+	unsigned char d1[DNS_SIGCACHE_DIGESTLENGTH];
+	unsigned char d2[DNS_SIGCACHE_DIGESTLENGTH];
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, ISC_FALSE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_sigcache_create(mctx, 1000, &cache);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	makedigest(d1, 1, 1);
+	makedigest(d2, 1, 2);
+	ATF_CHECK(!dns_sigcache_find(cache, d1));
+
+	dns_sigcache_add(cache, d1);
+	ATF_CHECK(dns_sigcache_find(cache, d1));
+	ATF_CHECK(!dns_sigcache_find(cache, d2));
+
+	dns_sigcache_destroy(&cache);
+	ATF_CHECK(cache == NULL);
+
+	dns_test_end();
+}
+
+ATF_TC(sigcache_evict);
+ATF_TC_HEAD(sigcache_evict, tc) {
+	atf_tc_set_md_var(tc, "descr", "a full set loses its oldest entry");
+}
+ATF_TC_BODY(sigcache_evict, tc) {
+	isc_result_t result;
+	dns_sigcache_t *cache = NULL;
+	unsigned char d[6][DNS_SIGCACHE_DIGESTLENGTH];
+	unsigned int i;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, ISC_FALSE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_sigcache_create(mctx, 1, &cache);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	/*
+	 * Digests differing only in their last byte fall in the same set,
+	 * which holds four of them.
+	 */
+	for (i = 0; i < 6; i++)
+		makedigest(d[i], 7, i);
+	for (i = 0; i < 4; i++)
+		dns_sigcache_add(cache, d[i]);
+	for (i = 0; i < 4; i++)
+		ATF_CHECK(dns_sigcache_find(cache, d[i]));
+
+	/* Adding an entry again does not push another one out. */
+	dns_sigcache_add(cache, d[2]);
+	for (i = 0; i < 4; i++)
+		ATF_CHECK(dns_sigcache_find(cache, d[i]));
+
+	dns_sigcache_add(cache, d[4]);
+	ATF_CHECK(!dns_sigcache_find(cache, d[0]));
+	for (i = 1; i < 5; i++)
+		ATF_CHECK(dns_sigcache_find(cache, d[i]));
+
+	dns_sigcache_add(cache, d[5]);
+	ATF_CHECK(!dns_sigcache_find(cache, d[1]));
+	for (i = 2; i < 6; i++)
+		ATF_CHECK(dns_sigcache_find(cache, d[i]));
+
+	dns_sigcache_destroy(&cache);
+
+	dns_test_end();
+}
+
+#if defined(OPENSSL) || defined(PKCS11CRYPTO)
+/*
+ * Make 'rdataset' an A rdataset holding just 'addr'.
+ */
+static void
+makeset(dns_rdatalist_t *rdatalist, dns_rdata_t *rdata,
+	unsigned char *addr, dns_rdataset_t *rdataset)
+{
+	dns_rdata_init(rdata);
+	rdata->data = addr;
+	rdata->length = 4;
+	rdata->rdclass = dns_rdataclass_in;
+	rdata->type = dns_rdatatype_a;
+
+	dns_rdatalist_init(rdatalist);
+	rdatalist->rdclass = dns_rdataclass_in;
+	rdatalist->type = dns_rdatatype_a;
+	rdatalist->ttl = 300;
+	ISC_LIST_APPEND(rdatalist->rdata, rdata, link);
+
+	dns_rdataset_init(rdataset);
+	RUNTIME_CHECK(dns_rdatalist_tordataset(rdatalist, rdataset) ==
+		      ISC_R_SUCCESS);
+}
+
+static void
+getcounter(isc_statscounter_t counter, isc_uint64_t value, void *arg) {
+	isc_uint64_t *values = arg;
+
+	values[counter] = value;
+}
+
+static isc_uint64_t
+counter(isc_stats_t *stats, isc_statscounter_t which) {
+	isc_uint64_t values[dns_dnssecstats_max];
+
+	isc_stats_dump(stats, getcounter, values, ISC_STATSDUMP_VERBOSE);
+	return (values[which]);
+}
+
+ATF_TC(sigcache_verify);
+ATF_TC_HEAD(sigcache_verify, tc) {
+	atf_tc_set_md_var(tc, "descr", "dns_dnssec_verify3() finds good "
+				       "signatures in the signature cache");
+}
+ATF_TC_BODY(sigcache_verify, tc) {
+	isc_result_t result;
+	dns_sigcache_t *cache = NULL;
+	isc_stats_t *stats = NULL;
+	dns_fixedname_t fname;
+	dns_name_t *name;
+	dst_key_t *key = NULL;
+	dns_rdatalist_t rdatalist, badlist;
+	dns_rdata_t rdata, badrdata, sigrdata = DNS_RDATA_INIT;
+	dns_rdataset_t rdataset, badset;
+	unsigned char addr[4] = { 10, 0, 0, 1 };
+	unsigned char badaddr[4] = { 10, 0, 0, 2 };
+	unsigned char sigbuf[1024];
+	isc_buffer_t b;
+	isc_stdtime_t now, expire;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, ISC_FALSE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	dns_fixedname_init(&fname);
+	name = dns_fixedname_name(&fname);
+	result = dns_name_fromstring(name, "example.", 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dst_key_generate(name, DST_ALG_RSASHA256, 1024, 0,
+				  DNS_KEYOWNER_ZONE, DNS_KEYPROTO_DNSSEC,
+				  dns_rdataclass_in, mctx, &key);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	makeset(&rdatalist, &rdata, addr, &rdataset);
+	makeset(&badlist, &badrdata, badaddr, &badset);
+
+	isc_stdtime_get(&now);
+	now -= 3600;
+	expire = now + 86400;
+	isc_buffer_init(&b, sigbuf, sizeof(sigbuf));
+	result = dns_dnssec_sign(name, &rdataset, key, &now, &expire,
+				 mctx, &b, &sigrdata);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_stats_create(mctx, &stats, dns_dnssecstats_max);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_sigcache_create(mctx, 1000, &cache);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	dns_dnssec_stats = stats;
+	dns_dnssec_sigcache = cache;
+
+	result = dns_dnssec_verify3(name, &rdataset, key, ISC_FALSE, 0,
+				    mctx, &sigrdata, NULL);
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(counter(stats, dns_dnssecstats_asis), 1);
+	ATF_CHECK_EQ(counter(stats, dns_dnssecstats_cachemiss), 1);
+	ATF_CHECK_EQ(counter(stats, dns_dnssecstats_cachehit), 0);
+
+	result = dns_dnssec_verify3(name, &rdataset, key, ISC_FALSE, 0,
+				    mctx, &sigrdata, NULL);
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(counter(stats, dns_dnssecstats_asis), 1);
+	ATF_CHECK_EQ(counter(stats, dns_dnssecstats_cachehit), 1);
+
+	/*
+	 * The same signature over other data is still checked, and
+	 * still fails.
+	 */
+	result = dns_dnssec_verify3(name, &badset, key, ISC_FALSE, 0,
+				    mctx, &sigrdata, NULL);
+	ATF_CHECK_EQ(result, DNS_R_SIGINVALID);
+	ATF_CHECK_EQ(counter(stats, dns_dnssecstats_cachemiss), 2);
+	ATF_CHECK_EQ(counter(stats, dns_dnssecstats_cachehit), 1);
+
+	/*
+	 * The time is checked even when the signature is cached.
+	 */
+	isc_stdtime_get(&now);
+	now += 86400;
+	expire = now + 86400;
+	dns_rdata_reset(&sigrdata);
+	isc_buffer_init(&b, sigbuf, sizeof(sigbuf));
+	result = dns_dnssec_sign(name, &rdataset, key, &now, &expire,
+				 mctx, &b, &sigrdata);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_dnssec_verify3(name, &rdataset, key, ISC_TRUE, 0,
+				    mctx, &sigrdata, NULL);
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+	result = dns_dnssec_verify3(name, &rdataset, key, ISC_FALSE, 0,
+				    mctx, &sigrdata, NULL);
+	ATF_CHECK_EQ(result, DNS_R_SIGFUTURE);
+	ATF_CHECK_EQ(counter(stats, dns_dnssecstats_cachehit), 1);
+
+	dns_dnssec_sigcache = NULL;
+	dns_dnssec_stats = NULL;
+	dns_sigcache_destroy(&cache);
+	isc_stats_detach(&stats);
+	dns_rdataset_disassociate(&rdataset);
+	dns_rdataset_disassociate(&badset);
+	dst_key_free(&key);
+
+	dns_test_end();
+}
+#endif
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, sigcache_find);
+	ATF_TP_ADD_TC(tp, sigcache_evict);
+#if defined(OPENSSL) || defined(PKCS11CRYPTO)
+	ATF_TP_ADD_TC(tp, sigcache_verify);
+#endif
+
+	return (atf_no_error());
+}
@@ -34,6 +34,7 @@
 #include <dns/resolver.h>
 #include <dns/result.h>
 #include <dns/validator.h>
+#include <dns/verifypool.h>
 #include <dns/view.h>
 
 /*! \file
@@ -84,6 +85,10 @@
 						 * have attempted a verify. */
 #define VALATTR_INSECURITY		0x0010	/*%< Attempting proveunsecure. */
 #define VALATTR_DLVTRIED		0x0020	/*%< Looked for a DLV record. */
+#define VALATTR_VERIFYING		0x0040	/*%< A verify pool is checking
+						 * a signature for us. */
+#define VALATTR_VERIFIED		0x0080	/*%< 'vresult' holds the result
+						 * of that check. */
 
 /*!
  * NSEC proofs to be looked for.
@@ -131,6 +136,13 @@ get_dst_key(dns_validator_t *val, dns_rdata_rrsig_t *siginfo,
 static isc_result_t
 validate(dns_validator_t *val, isc_boolean_t resume);
 
+static isc_result_t
+verify_result(dns_validator_t *val, isc_result_t result, isc_boolean_t ignore,
+	      dns_name_t *wild, isc_uint16_t keyid);
+
+static void
+verified(isc_task_t *task, isc_event_t *event);
+
 static isc_result_t
 validatezonekey(dns_validator_t *val);
 
@@ -218,7 +230,8 @@ exit_check(dns_validator_t *val) {
 
 	INSIST(val->event == NULL);
 
-	if (val->fetch != NULL || val->subvalidator != NULL)
+	if (val->fetch != NULL || val->subvalidator != NULL ||
+	    (val->attributes & VALATTR_VERIFYING) != 0)
 		return (ISC_FALSE);
 
 	return (ISC_TRUE);
@@ -703,6 +716,48 @@ keyvalidated(isc_task_t *task, isc_event_t *event) {
 		destroy(val);
 }
 
+/*%
+ * Callback from the verify pool when a signature has been checked.
+ *
+ * Resumes validate() at the signature and key that were checked.
+ */
+static void
+verified(isc_task_t *task, isc_event_t *event) {
+	dns_verifyevent_t *vevent;
+	dns_validator_t *val;
+	isc_boolean_t want_destroy;
+	isc_result_t result;
+
+	UNUSED(task);
+	INSIST(event->ev_type == DNS_EVENT_VERIFYDONE);
+
+	vevent = (dns_verifyevent_t *)event;
+	val = vevent->ev_arg;
+
+	LOCK(&val->lock);
+	INSIST((val->attributes & VALATTR_VERIFYING) != 0);
+	val->attributes &= ~VALATTR_VERIFYING;
+	if (CANCELED(val)) {
+		validator_done(val, ISC_R_CANCELED);
+	} else {
+		INSIST(val->event != NULL);
+		val->vresult = verify_result(val, vevent->result,
+					     vevent->ignoredtime,
+					     dns_fixedname_name(&vevent->wild),
+					     val->siginfo->keyid);
+		val->attributes |= VALATTR_VERIFIED;
+		result = validate(val, ISC_TRUE);
+		if (result != DNS_R_WAIT)
+			validator_done(val, result);
+	}
+	want_destroy = exit_check(val);
+	UNLOCK(&val->lock);
+
+	isc_event_free(&event);
+	if (want_destroy)
+		destroy(val);
+}
+
 /*%
  * Callback when the DS record has been validated.
  *
@@ -1490,20 +1545,49 @@ isselfsigned(dns_validator_t *val) {
  * The signature was good and from a wildcard record and the QNAME does
  * not match the wildcard we need to look for a NOQNAME proof.
  *
+ * If 'offload' is true and the view has a verify pool, the check is
+ * handed to the pool and DNS_R_WAIT returned; verified() calls
+ * validate() again when it is done, and this function then returns
+ * the result of the check.
+ *
  * Returns:
  * \li	ISC_R_SUCCESS if the verification succeeds.
+ * \li	DNS_R_WAIT if the verification has been handed to the pool.
  * \li	Others if the verification fails.
  */
 static isc_result_t
 verify(dns_validator_t *val, dst_key_t *key, dns_rdata_t *rdata,
-       isc_uint16_t keyid)
+       isc_uint16_t keyid, isc_boolean_t offload)
 {
 	isc_result_t result;
 	dns_fixedname_t fixed;
 	isc_boolean_t ignore = ISC_FALSE;
 	dns_name_t *wild;
 
+	if ((val->attributes & VALATTR_VERIFIED) != 0) {
+		/*
+		 * verified() has the result for this signature and key.
+		 */
+		INSIST(offload);
+		val->attributes &= ~VALATTR_VERIFIED;
+		return (val->vresult);
+	}
+
 	val->attributes |= VALATTR_TRIEDVERIFY;
+	if (offload && val->view->verifypool != NULL) {
+		result = dns_verifypool_verify(val->view->verifypool,
+					       val->event->name,
+					       val->event->rdataset, key,
+					       val->view->acceptexpired,
+					       val->view->maxbits,
+					       val->view->mctx, rdata,
+					       val->task, verified, val);
+		if (result == ISC_R_SUCCESS) {
+			val->attributes |= VALATTR_VERIFYING;
+			return (DNS_R_WAIT);
+		}
+	}
+
 	dns_fixedname_init(&fixed);
 	wild = dns_fixedname_name(&fixed);
  again:
@@ -1516,6 +1600,19 @@ verify(dns_validator_t *val, dst_key_t *key, dns_rdata_t *rdata,
 		ignore = ISC_TRUE;
 		goto again;
 	}
+	return (verify_result(val, result, ignore, wild, keyid));
+}
+
+/*%
+ * Log the outcome of a signature check, and note whether a NOQNAME
+ * proof is needed.  'ignore' is true if the signature's validity
+ * period was ignored, and 'wild' is the wildcard name if the
+ * signature was generated from one.
+ */
+static isc_result_t
+verify_result(dns_validator_t *val, isc_result_t result, isc_boolean_t ignore,
+	      dns_name_t *wild, isc_uint16_t keyid)
+{
 	if (ignore && (result == ISC_R_SUCCESS || result == DNS_R_FROMWILDCARD))
 		validator_log(val, ISC_LOG_INFO,
 			      "accepted expired %sRRSIG (keyid=%u)",
@@ -1626,7 +1723,9 @@ validate(dns_validator_t *val, isc_boolean_t resume) {
 
 		do {
 			vresult = verify(val, val->key, &rdata,
-					val->siginfo->keyid);
+					val->siginfo->keyid, ISC_TRUE);
+			if (vresult == DNS_R_WAIT)
+				return (DNS_R_WAIT);
 			if (vresult == ISC_R_SUCCESS)
 				break;
 			if (val->keynode != NULL) {
@@ -1740,7 +1839,7 @@ checkkey(dns_validator_t *val, dns_rdata_t *keyrdata, isc_uint16_t keyid,
 				 */
 				continue;
 		}
-		result = verify(val, dstkey, &rdata, sig.keyid);
+		result = verify(val, dstkey, &rdata, sig.keyid, ISC_FALSE);
 		if (result == ISC_R_SUCCESS)
 			break;
 	}
@@ -2025,7 +2124,7 @@ validatezonekey(dns_validator_t *val) {
 					break;
 				}
 				result = verify(val, dstkey, &sigrdata,
-						sig.keyid);
+						sig.keyid, ISC_FALSE);
 				if (result == ISC_R_SUCCESS) {
 					dns_keytable_detachkeynode(
 								val->keytable,
@@ -3800,6 +3899,7 @@ dns_validator_create(dns_view_t *view, dns_name_t *name, dns_rdatatype_t type,
 	val->depth = 0;
 	val->authcount = 0;
 	val->authfail = 0;
+	val->vresult = ISC_R_UNEXPECTED;
 	val->mustbesecure = dns_resolver_getmustbesecure(view->resolver, name);
 	dns_rdataset_init(&val->frdataset);
 	dns_rdataset_init(&val->fsigrdataset);
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <isc/magic.h>
+#include <isc/mem.h>
+#include <isc/refcount.h>
+#include <isc/task.h>
+#include <isc/taskpool.h>
+#include <isc/util.h>
+
+#include <dns/dnssec.h>
+#include <dns/events.h>
+#include <dns/result.h>
+#include <dns/verifypool.h>
+
+#define VERIFYPOOL_MAGIC		ISC_MAGIC('V', 'r', 'f', 'P')
+#define VALID_VERIFYPOOL(p)		ISC_MAGIC_VALID(p, VERIFYPOOL_MAGIC)
+
+/*%
+ * The number of requests a pool task handles before letting another
+ * task run on its thread.  As the pool's threads run nothing else,
+ * this only bounds how long its task lock is held at a time.
+ */
+#define VERIFYPOOL_QUANTUM		64
+
+struct dns_verifypool {
+	unsigned int		magic;
+	isc_mem_t *		mctx;
+	isc_refcount_t		references;
+	isc_taskmgr_t *		taskmgr;
+	isc_taskpool_t *	tasks;
+};
+
+isc_result_t
+dns_verifypool_create(isc_mem_t *mctx, unsigned int workers,
+		      dns_verifypool_t **poolp)
+{
+	isc_result_t result;
+	dns_verifypool_t *pool;
+
+	REQUIRE(mctx != NULL);
+	REQUIRE(workers > 0);
+	REQUIRE(poolp != NULL && *poolp == NULL);
+
+	pool = isc_mem_get(mctx, sizeof(*pool));
+	if (pool == NULL)
+		return (ISC_R_NOMEMORY);
+	pool->taskmgr = NULL;
+	pool->tasks = NULL;
+
+	result = isc_refcount_init(&pool->references, 1);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_pool;
+
+	result = isc_taskmgr_create(mctx, workers, 0, &pool->taskmgr);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_refcount;
+
+	result = isc_taskpool_create(pool->taskmgr, mctx, workers,
+				     VERIFYPOOL_QUANTUM, &pool->tasks);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_taskmgr;
+
+	pool->mctx = NULL;
+	isc_mem_attach(mctx, &pool->mctx);
+	pool->magic = VERIFYPOOL_MAGIC;
+
+	*poolp = pool;
+	return (ISC_R_SUCCESS);
+
+ cleanup_taskmgr:
+	isc_taskmgr_destroy(&pool->taskmgr);
+ cleanup_refcount:
+	isc_refcount_destroy(&pool->references);
+ cleanup_pool:
+	isc_mem_put(mctx, pool, sizeof(*pool));
+	return (result);
+}
+
+void
+dns_verifypool_attach(dns_verifypool_t *source, dns_verifypool_t **targetp) {
+	REQUIRE(VALID_VERIFYPOOL(source));
+	REQUIRE(targetp != NULL && *targetp == NULL);
+
+	isc_refcount_increment(&source->references, NULL);
+	*targetp = source;
+}
+
+void
+dns_verifypool_detach(dns_verifypool_t **poolp) {
+	dns_verifypool_t *pool;
+	unsigned int refs;
+
+	REQUIRE(poolp != NULL && VALID_VERIFYPOOL(*poolp));
+
+	pool = *poolp;
+	*poolp = NULL;
+
+	isc_refcount_decrement(&pool->references, &refs);
+	if (refs > 0)
+		return;
+
+	/*
+	 * Destroying the task manager waits for the tasks to finish the
+	 * requests they still have queued.
+	 */
+	isc_taskpool_destroy(&pool->tasks);
+	isc_taskmgr_destroy(&pool->taskmgr);
+	isc_refcount_destroy(&pool->references);
+	pool->magic = 0;
+	isc_mem_putanddetach(&pool->mctx, pool, sizeof(*pool));
+}
+
+/*
+ * Runs on a task of the pool.
+ */
+static void
+verify(isc_task_t *task, isc_event_t *event) {
+	dns_verifyevent_t *vevent = (dns_verifyevent_t *)event;
+	dns_name_t *wild;
+	isc_task_t *target;
+
+	UNUSED(task);
+	INSIST(event->ev_type == DNS_EVENT_VERIFY);
+
+	wild = dns_fixedname_name(&vevent->wild);
+	vevent->ignoredtime = ISC_FALSE;
+	vevent->result = dns_dnssec_verify3(vevent->name, vevent->rdataset,
+					    vevent->key, ISC_FALSE,
+					    vevent->maxbits, vevent->mctx,
+					    &vevent->sigrdata, wild);
+	if ((vevent->result == DNS_R_SIGEXPIRED ||
+	     vevent->result == DNS_R_SIGFUTURE) && vevent->acceptexpired)
+	{
+		vevent->ignoredtime = ISC_TRUE;
+		vevent->result = dns_dnssec_verify3(vevent->name,
+						    vevent->rdataset,
+						    vevent->key, ISC_TRUE,
+						    vevent->maxbits,
+						    vevent->mctx,
+						    &vevent->sigrdata, wild);
+	}
+
+	target = vevent->task;
+	vevent->task = NULL;
+	event->ev_type = DNS_EVENT_VERIFYDONE;
+	event->ev_action = vevent->action;
+	event->ev_arg = vevent->arg;
+	isc_task_sendanddetach(&target, &event);
+}
+
+isc_result_t
+dns_verifypool_verify(dns_verifypool_t *pool, const dns_name_t *name,
+		      dns_rdataset_t *rdataset, dst_key_t *key,
+		      isc_boolean_t acceptexpired, unsigned int maxbits,
+		      isc_mem_t *mctx, dns_rdata_t *sigrdata,
+		      isc_task_t *task, isc_taskaction_t action, void *arg)
+{
+	dns_verifyevent_t *vevent;
+	isc_task_t *worker = NULL;
+	isc_event_t *event;
+
+	REQUIRE(VALID_VERIFYPOOL(pool));
+	REQUIRE(name != NULL);
+	REQUIRE(rdataset != NULL);
+	REQUIRE(key != NULL);
+	REQUIRE(sigrdata != NULL);
+	REQUIRE(task != NULL);
+	REQUIRE(action != NULL);
+
+	vevent = (dns_verifyevent_t *)
+		isc_event_allocate(pool->mctx, pool, DNS_EVENT_VERIFY,
+				   verify, NULL, sizeof(*vevent));
+	if (vevent == NULL)
+		return (ISC_R_NOMEMORY);
+
+	vevent->result = ISC_R_UNEXPECTED;
+	vevent->ignoredtime = ISC_FALSE;
+	dns_fixedname_init(&vevent->wild);
+	vevent->name = name;
+	vevent->rdataset = rdataset;
+	vevent->key = key;
+	dns_rdata_init(&vevent->sigrdata);
+	dns_rdata_clone(sigrdata, &vevent->sigrdata);
+	vevent->acceptexpired = acceptexpired;
+	vevent->maxbits = maxbits;
+	vevent->mctx = mctx;
+	vevent->task = NULL;
+	isc_task_attach(task, &vevent->task);
+	vevent->action = action;
+	vevent->arg = arg;
+
+	isc_taskpool_gettask(pool->tasks, &worker);
+	event = (isc_event_t *)vevent;
+	isc_task_sendanddetach(&worker, &event);
+
+	return (ISC_R_SUCCESS);
+}
@@ -46,12 +46,14 @@
 #include <dns/rdataset.h>
 #include <dns/request.h>
 #include <dns/resolver.h>
+#include <dns/respcache.h>
 #include <dns/result.h>
 #include <dns/rpz.h>
 #include <dns/rrl.h>
 #include <dns/stats.h>
 #include <dns/time.h>
 #include <dns/tsig.h>
+#include <dns/verifypool.h>
 #include <dns/zone.h>
 #include <dns/zt.h>
 
@@ -170,6 +172,7 @@ dns_view_create(isc_mem_t *mctx, dns_rdataclass_t rdclass,
 	view->resstats = NULL;
 	view->resquerystats = NULL;
 	view->cacheshared = ISC_FALSE;
+	view->verifypool = NULL;
 	ISC_LIST_INIT(view->dns64);
 	view->dns64cnt = 0;
 
@@ -248,6 +251,7 @@ dns_view_create(isc_mem_t *mctx, dns_rdataclass_t rdclass,
 	view->failcache = NULL;
 	(void)dns_badcache_init(view->mctx, DNS_VIEW_FAILCACHESIZE,
 				   &view->failcache);
+	view->respcache = NULL;
 	view->v6bias = 0;
 	view->dtenv = NULL;
 	view->dttypes = 0;
@@ -491,6 +495,8 @@ destroy(dns_view_t *view) {
 		isc_stats_detach(&view->resstats);
 	if (view->resquerystats != NULL)
 		dns_stats_detach(&view->resquerystats);
+	if (view->verifypool != NULL)
+		dns_verifypool_detach(&view->verifypool);
 	if (view->secroots_priv != NULL)
 		dns_keytable_detach(&view->secroots_priv);
 	if (view->ntatable_priv != NULL)
@@ -532,6 +538,8 @@ destroy(dns_view_t *view) {
 	dns_aclenv_destroy(&view->aclenv);
 	if (view->failcache != NULL)
 		dns_badcache_destroy(&view->failcache);
+	if (view->respcache != NULL)
+		dns_respcache_destroy(&view->respcache);
 	DESTROYLOCK(&view->new_zone_lock);
 	DESTROYLOCK(&view->lock);
 	isc_refcount_destroy(&view->references);
@@ -1849,6 +1857,15 @@ dns_view_setresquerystats(dns_view_t *view, dns_stats_t *stats) {
 	dns_stats_attach(stats, &view->resquerystats);
 }
 
+void
+dns_view_setverifypool(dns_view_t *view, dns_verifypool_t *pool) {
+	REQUIRE(DNS_VIEW_VALID(view));
+	REQUIRE(!view->frozen);
+	REQUIRE(view->verifypool == NULL);
+
+	dns_verifypool_attach(pool, &view->verifypool);
+}
+
 void
 dns_view_getresquerystats(dns_view_t *view, dns_stats_t **statsp) {
 	REQUIRE(DNS_VIEW_VALID(view));
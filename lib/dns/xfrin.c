@@ -266,9 +266,20 @@ axfr_init(dns_xfrin_ctx_t *xfr) {
 static isc_result_t
 axfr_makedb(dns_xfrin_ctx_t *xfr, dns_db_t **dbp) {
 	isc_result_t result;
+	const char *dbtype = "rbt";	/* XXX guess */
+	char **argv = NULL;
+
+	/*
+	 * Keep zones which are configured to use a qp-trie on one.
+	 */
+	result = dns_zone_getdbtype(xfr->zone, &argv, xfr->mctx);
+	if (result == ISC_R_SUCCESS && strcmp(argv[0], "qp") == 0)
+		dbtype = "qp";
+	if (argv != NULL)
+		isc_mem_free(xfr->mctx, argv);
 
 	result = dns_db_create(xfr->mctx, /* XXX */
-			       "rbt",	/* XXX guess */
+			       dbtype,
 			       &xfr->name,
 			       dns_dbtype_zone,
 			       xfr->rdclass,
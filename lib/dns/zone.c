@@ -12,7 +12,9 @@
 #include <errno.h>
 
 #include <isc/file.h>
+#include <isc/heap.h>
 #include <isc/hex.h>
+#include <isc/ht.h>
 #include <isc/mutex.h>
 #include <isc/pool.h>
 #include <isc/print.h>
@@ -142,6 +144,9 @@ typedef ISC_LIST(dns_nsec3chain_t) dns_nsec3chainlist_t;
 typedef struct dns_keyfetch dns_keyfetch_t;
 typedef struct dns_asyncload dns_asyncload_t;
 typedef struct dns_include dns_include_t;
+typedef struct dns_signpool dns_signpool_t;
+typedef struct dns_signjob dns_signjob_t;
+typedef struct dns_signbatch dns_signbatch_t;
 
 #define DNS_ZONE_CHECKLOCK
 #ifdef DNS_ZONE_CHECKLOCK
@@ -201,7 +206,7 @@ struct dns_zone {
 	/* Locked */
 	dns_zonemgr_t		*zmgr;
 	ISC_LINK(dns_zone_t)	link;		/* Used by zmgr. */
-	isc_timer_t		*timer;
+	isc_boolean_t		scheduled;	/* Holds an iref. */
 	unsigned int		irefs;
 	dns_name_t		origin;
 	char			*masterfile;
@@ -229,6 +234,13 @@ struct dns_zone {
 	isc_time_t		signingtime;
 	isc_time_t		nsec3chaintime;
 	isc_time_t		refreshkeytime;
+
+	/* Locked by zmgr->schedlock. */
+	isc_time_t		schedtime;	/* Earliest action due */
+	unsigned int		schedindex;	/* In zmgr->schedheap */
+	isc_boolean_t		maintpending;	/* maintevent is queued */
+	isc_event_t		maintevent;
+
 	isc_uint32_t		refreshkeyinterval;
 	isc_uint32_t		refreshkeycount;
 	isc_uint32_t		refresh;
@@ -349,6 +361,21 @@ struct dns_zone {
 	 */
 	isc_uint32_t		signatures;
 	isc_uint32_t		nodes;
+	/*%
+	 * Progress of the current (or last) run of zone_sign(), for
+	 * "rndc signing -list".  Locked.
+	 */
+	isc_boolean_t		signingactive;
+	isc_time_t		signingstart;
+	isc_time_t		signingend;
+	isc_uint64_t		signingnodes;
+	isc_uint64_t		signingsigs;
+	unsigned int		signingthreads;
+	/*%
+	 * Signatures a signing pool is computing, or has computed, for
+	 * the next pass of zone_sign().  Zone task only.
+	 */
+	dns_signbatch_t		*signbatch;
 	dns_rdatatype_t		privatetype;
 
 	/*%
@@ -537,6 +564,7 @@ struct dns_zonemgr {
 	isc_rwlock_t		rwlock;
 	isc_mutex_t		iolock;
 	isc_rwlock_t		urlock;
+	isc_mutex_t		schedlock;
 
 	/* Locked by rwlock. */
 	dns_zonelist_t		zones;
@@ -557,6 +585,21 @@ struct dns_zonemgr {
 	dns_iolist_t		high;
 	dns_iolist_t		low;
 
+	/*
+	 * Locked by schedlock.  Zones waiting for maintenance, ordered
+	 * by the time their earliest action falls due, and the single
+	 * timer that fires when the first of them does.
+	 */
+	isc_heap_t *		schedheap;
+	isc_timer_t *		schedtimer;
+	isc_time_t		schedtime;
+	isc_uint64_t		schedwakeups;
+	isc_uint64_t		scheddispatched;
+	isc_uint64_t		schedlateusec;
+
+	/* Locked by rwlock. */
+	dns_signpool_t *	signpool;
+
 	/* Locked by urlock. */
 	/* LRU cache */
 	struct dns_unreachable	unreachable[UNREACH_CHACHE_SIZE];
@@ -715,6 +758,100 @@ struct dns_include {
 	ISC_LINK(dns_include_t)	link;
 };
 
+/*%
+ * Bulk signing.  When the zone manager has a signing pool, zone_sign()
+ * works through the zone in much larger passes.  Rather than computing
+ * each RRSIG as it goes, it copies the RRsets to be signed into a batch
+ * and makes every other change (NSEC and NSEC3 records, removed
+ * signatures, private records) as usual.  At the end of the pass it
+ * moves those changes into the batch as well, rolls the version back
+ * and hands the batch to the pool, split into contiguous ranges of
+ * jobs, one for each worker.  The zone task is not held up meanwhile.
+ * When the last worker is done it sends a DNS_EVENT_SIGNDONE to the
+ * zone task and zone_signdone() makes the recorded changes again in a
+ * new version, adds the signatures and commits, without walking the
+ * zone a second time.
+ *
+ * The recorded changes are only good against the version the pass
+ * started from.  If the zone has been changed in the meantime the
+ * batch is dropped, the signings are put back where the pass began
+ * and the next pass is made without the pool.
+ *
+ * The pool's workers run on a task manager of their own.
+ */
+struct dns_signpool {
+	isc_mem_t *		mctx;
+	isc_refcount_t		references;
+	isc_taskmgr_t *		taskmgr;
+	unsigned int		workers;
+	isc_task_t **		tasks;
+};
+
+/*
+ * A job owns a copy of the RRset to be signed, in a dns_rdatalist_t
+ * whose rdata follow the job in the same allocation.
+ */
+struct dns_signjob {
+	size_t			size;
+	dns_fixedname_t		name;
+	dns_rdatalist_t		rdatalist;
+	dns_rdataset_t		rdataset;
+	dst_key_t *		key;
+	dns_rdata_t		rdata;
+	isc_result_t		result;
+	unsigned char		data[1024];
+};
+
+/*
+ * Where each of the zone's signings was when a pass began, so that
+ * they can be put back there if the pass is dropped.
+ */
+typedef struct signingmark {
+	dns_signing_t *		signing;
+	dns_fixedname_t		name;
+	isc_boolean_t		positioned;
+} signingmark_t;
+
+struct dns_signbatch {
+	isc_mem_t *		mctx;
+	dns_signpool_t *	pool;
+	dns_signjob_t **	jobs;
+	unsigned int		njobs;
+	unsigned int		maxjobs;
+	isc_ht_t *		index;
+	isc_stdtime_t		inception;
+	isc_stdtime_t		expire;
+	isc_boolean_t		ready;
+	isc_task_t *		task;
+	isc_event_t *		done;
+	isc_mutex_t		lock;
+	unsigned int		running;	/* Locked by lock. */
+	/*
+	 * The pass the batch was made for.
+	 */
+	dns_db_t *		db;
+	dns_dbversion_t *	base;
+	dns_diff_t		diff;
+	dns_diff_t		postdiff;
+	dns_signinglist_t	cleanup;
+	signingmark_t *		marks;
+	unsigned int		nmarks;
+	isc_uint32_t		nvisited;
+	isc_int32_t		nsigs;
+};
+
+typedef struct signrangeevent {
+	ISC_EVENT_COMMON(struct signrangeevent);
+	dns_signbatch_t *	batch;
+	unsigned int		first;
+	unsigned int		last;
+} signrangeevent_t;
+
+/*%
+ * The number of RRsets each worker of a signing pool signs in a pass.
+ */
+#define SIGNPOOL_PERWORKER	1024
+
 /*
  * These can be overridden by the -T mkeytimers option on the command
  * line, so that we can test with shorter periods than specified in
@@ -754,6 +891,7 @@ static isc_result_t zone_postload(dns_zone_t *zone, dns_db_t *db,
 				  isc_time_t loadtime, isc_result_t result);
 static void zone_needdump(dns_zone_t *zone, unsigned int delay);
 static void zone_shutdown(isc_task_t *, isc_event_t *);
+static void zone_timer(isc_task_t *, isc_event_t *);
 static void zone_loaddone(void *arg, isc_result_t result);
 static isc_result_t zone_startload(dns_db_t *db, dns_zone_t *zone,
 				   isc_time_t loadtime);
@@ -785,6 +923,9 @@ static isc_result_t zmgr_start_xfrin_ifquota(dns_zonemgr_t *zmgr,
 					     dns_zone_t *zone);
 static void zmgr_resume_xfrs(dns_zonemgr_t *zmgr, isc_boolean_t multi);
 static void zonemgr_free(dns_zonemgr_t *zmgr);
+static void zonemgr_schedule(dns_zonemgr_t *zmgr, dns_zone_t *zone,
+			     const isc_time_t *next);
+static void zonemgr_unschedule(dns_zonemgr_t *zmgr, dns_zone_t *zone);
 static isc_result_t zonemgr_getio(dns_zonemgr_t *zmgr, isc_boolean_t high,
 				  isc_task_t *task, isc_taskaction_t action,
 				  void *arg, dns_io_t **iop);
@@ -803,6 +944,8 @@ static void forward_callback(isc_task_t *task, isc_event_t *event);
 static void zone_saveunique(dns_zone_t *zone, const char *path,
 			    const char *templat);
 static void zone_maintenance(dns_zone_t *zone);
+static void zone_signdone(isc_task_t *task, isc_event_t *event);
+static void signbatch_drop(dns_zone_t *zone, dns_signbatch_t **batchp);
 static void zone_notify(dns_zone_t *zone, isc_time_t *now);
 static void dump_done(void *arg, isc_result_t result);
 static isc_result_t zone_signwithkey(dns_zone_t *zone, dns_secalg_t algorithm,
@@ -990,7 +1133,10 @@ dns_zone_create(dns_zone_t **zonep, isc_mem_t *mctx) {
 	zone->readio = NULL;
 	zone->dctx = NULL;
 	zone->writeio = NULL;
-	zone->timer = NULL;
+	zone->scheduled = ISC_FALSE;
+	isc_time_settoepoch(&zone->schedtime);
+	zone->schedindex = 0;
+	zone->maintpending = ISC_FALSE;
 	zone->idlein = DNS_DEFAULT_IDLEIN;
 	zone->idleout = DNS_DEFAULT_IDLEOUT;
 	zone->log_key_expired_timer = 0;
@@ -1033,6 +1179,13 @@ dns_zone_create(dns_zone_t **zonep, isc_mem_t *mctx) {
 	ISC_LIST_INIT(zone->nsec3chain);
 	zone->signatures = 10;
 	zone->nodes = 100;
+	zone->signingactive = ISC_FALSE;
+	isc_time_settoepoch(&zone->signingstart);
+	isc_time_settoepoch(&zone->signingend);
+	zone->signingnodes = 0;
+	zone->signingsigs = 0;
+	zone->signingthreads = 0;
+	zone->signbatch = NULL;
 	zone->privatetype = (dns_rdatatype_t)0xffffU;
 	zone->added = ISC_FALSE;
 	zone->automatic = ISC_FALSE;
@@ -1077,6 +1230,9 @@ dns_zone_create(dns_zone_t **zonep, isc_mem_t *mctx) {
 	ISC_EVENT_INIT(&zone->ctlevent, sizeof(zone->ctlevent), 0, NULL,
 		       DNS_EVENT_ZONECONTROL, zone_shutdown, zone, zone,
 		       NULL, NULL);
+	ISC_EVENT_INIT(&zone->maintevent, sizeof(zone->maintevent), 0, NULL,
+		       DNS_EVENT_ZONEMAINT, zone_timer, zone, zone,
+		       NULL, NULL);
 	*zonep = zone;
 	return (ISC_R_SUCCESS);
 
@@ -1114,7 +1270,7 @@ zone_free(dns_zone_t *zone) {
 	REQUIRE(isc_refcount_current(&zone->erefs) == 0);
 	REQUIRE(zone->irefs == 0);
 	REQUIRE(!LOCKED_ZONE(zone));
-	REQUIRE(zone->timer == NULL);
+	REQUIRE(!zone->scheduled);
 	REQUIRE(zone->zmgr == NULL);
 
 	/*
@@ -1141,6 +1297,8 @@ zone_free(dns_zone_t *zone) {
 	}
 
 	/* Unmanaged objects */
+	if (zone->signbatch != NULL)
+		signbatch_drop(zone, &zone->signbatch);
 	for (signing = ISC_LIST_HEAD(zone->signing);
 	     signing != NULL;
 	     signing = ISC_LIST_HEAD(zone->signing)) {
@@ -1762,13 +1920,14 @@ dns_zone_rpz_enable(dns_zone_t *zone, dns_rpz_zones_t *rpzs,
 		    dns_rpz_num_t rpz_num)
 {
 	/*
-	 * Only RBTDB zones can be used for response policy zones,
+	 * Only RBTDB (and QPDB) zones can be used for response policy zones,
 	 * because only they have the code to load the create the summary data.
 	 * Only zones that are loaded instead of mmap()ed create the
 	 * summary data and so can be policy zones.
 	 */
 	if (strcmp(zone->db_argv[0], "rbt") != 0 &&
-	    strcmp(zone->db_argv[0], "rbt64") != 0)
+	    strcmp(zone->db_argv[0], "rbt64") != 0 &&
+	    strcmp(zone->db_argv[0], "qp") != 0)
 		return (ISC_R_NOTIMPLEMENTED);
 	if (zone->masterformat == dns_masterformat_map)
 		return (ISC_R_NOTIMPLEMENTED);
@@ -1923,7 +2082,8 @@ zone_load(dns_zone_t *zone, unsigned int flags, isc_boolean_t locked) {
 	INSIST(zone->db_argc >= 1);
 
 	rbt = strcmp(zone->db_argv[0], "rbt") == 0 ||
-	      strcmp(zone->db_argv[0], "rbt64") == 0;
+	      strcmp(zone->db_argv[0], "rbt64") == 0 ||
+	      strcmp(zone->db_argv[0], "qp") == 0;
 
 	if (zone->db != NULL && zone->masterfile == NULL && rbt) {
 		/*
@@ -2361,7 +2521,10 @@ zone_gotreadhandle(isc_task_t *task, isc_event_t *event) {
 
 	options = get_master_options(load->zone);
 
-	result = dns_master_loadfileinc5(load->zone->masterfile,
+	/*
+	 * Large text files are parsed in parallel on the load tasks.
+	 */
+	result = dns_master_loadfileinc6(load->zone->masterfile,
 					 dns_db_origin(load->db),
 					 dns_db_origin(load->db),
 					 load->zone->rdclass, options, 0,
@@ -2371,7 +2534,8 @@ zone_gotreadhandle(isc_task_t *task, isc_event_t *event) {
 					 zone_registerinclude,
 					 load->zone, load->zone->mctx,
 					 load->zone->masterformat,
-					 load->zone->maxttl);
+					 load->zone->maxttl,
+					 load->zone->zmgr->loadtasks);
 	if (result != ISC_R_SUCCESS && result != DNS_R_CONTINUE &&
 	    result != DNS_R_SEENINCLUDE)
 		goto fail;
@@ -6762,6 +6926,541 @@ add_nsec(dns_db_t *db, dns_dbversion_t *version, dns_name_t *name,
 	return (result);
 }
 
+static isc_result_t
+signpool_create(isc_mem_t *mctx, unsigned int workers,
+		dns_signpool_t **poolp)
+{
+	dns_signpool_t *pool;
+	isc_result_t result;
+	unsigned int i;
+
+	REQUIRE(workers > 0);
+	REQUIRE(poolp != NULL && *poolp == NULL);
+
+	pool = isc_mem_get(mctx, sizeof(*pool));
+	if (pool == NULL)
+		return (ISC_R_NOMEMORY);
+	pool->taskmgr = NULL;
+	pool->workers = 0;
+	pool->tasks = isc_mem_get(mctx, workers * sizeof(pool->tasks[0]));
+	if (pool->tasks == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup_pool;
+	}
+
+	result = isc_refcount_init(&pool->references, 1);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_tasks;
+
+	result = isc_taskmgr_create(mctx, workers, 0, &pool->taskmgr);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_refcount;
+
+	for (i = 0; i < workers; i++) {
+		pool->tasks[i] = NULL;
+		result = isc_task_create(pool->taskmgr, 0, &pool->tasks[i]);
+		if (result != ISC_R_SUCCESS)
+			goto cleanup_taskmgr;
+		isc_task_setname(pool->tasks[i], "signpool", pool);
+		pool->workers++;
+	}
+
+	pool->mctx = NULL;
+	isc_mem_attach(mctx, &pool->mctx);
+
+	*poolp = pool;
+	return (ISC_R_SUCCESS);
+
+ cleanup_taskmgr:
+	for (i = 0; i < pool->workers; i++)
+		isc_task_detach(&pool->tasks[i]);
+	isc_taskmgr_destroy(&pool->taskmgr);
+ cleanup_refcount:
+	isc_refcount_destroy(&pool->references);
+ cleanup_tasks:
+	isc_mem_put(mctx, pool->tasks, workers * sizeof(pool->tasks[0]));
+ cleanup_pool:
+	isc_mem_put(mctx, pool, sizeof(*pool));
+	return (result);
+}
+
+static void
+signpool_attach(dns_signpool_t *source, dns_signpool_t **targetp) {
+	REQUIRE(targetp != NULL && *targetp == NULL);
+
+	isc_refcount_increment(&source->references, NULL);
+	*targetp = source;
+}
+
+static void
+signpool_detach(dns_signpool_t **poolp) {
+	dns_signpool_t *pool;
+	unsigned int i, refs;
+
+	REQUIRE(poolp != NULL && *poolp != NULL);
+
+	pool = *poolp;
+	*poolp = NULL;
+
+	isc_refcount_decrement(&pool->references, &refs);
+	if (refs > 0)
+		return;
+
+	for (i = 0; i < pool->workers; i++)
+		isc_task_detach(&pool->tasks[i]);
+	isc_taskmgr_destroy(&pool->taskmgr);
+	isc_refcount_destroy(&pool->references);
+	isc_mem_put(pool->mctx, pool->tasks,
+		    pool->workers * sizeof(pool->tasks[0]));
+	isc_mem_putanddetach(&pool->mctx, pool, sizeof(*pool));
+}
+
+static isc_result_t
+signbatch_create(isc_mem_t *mctx, dns_signpool_t *pool,
+		 isc_stdtime_t inception, isc_stdtime_t expire,
+		 dns_signbatch_t **batchp)
+{
+	dns_signbatch_t *batch;
+	isc_result_t result;
+
+	REQUIRE(batchp != NULL && *batchp == NULL);
+
+	batch = isc_mem_get(mctx, sizeof(*batch));
+	if (batch == NULL)
+		return (ISC_R_NOMEMORY);
+
+	batch->index = NULL;
+	result = isc_ht_init(&batch->index, mctx, 12);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_batch;
+
+	result = isc_mutex_init(&batch->lock);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_index;
+
+	batch->mctx = NULL;
+	isc_mem_attach(mctx, &batch->mctx);
+	batch->pool = NULL;
+	signpool_attach(pool, &batch->pool);
+	batch->jobs = NULL;
+	batch->njobs = 0;
+	batch->maxjobs = 0;
+	batch->inception = inception;
+	batch->expire = expire;
+	batch->ready = ISC_FALSE;
+	batch->task = NULL;
+	batch->done = NULL;
+	batch->running = 0;
+	batch->db = NULL;
+	batch->base = NULL;
+	dns_diff_init(mctx, &batch->diff);
+	dns_diff_init(mctx, &batch->postdiff);
+	ISC_LIST_INIT(batch->cleanup);
+	batch->marks = NULL;
+	batch->nmarks = 0;
+	batch->nvisited = 0;
+	batch->nsigs = 0;
+
+	*batchp = batch;
+	return (ISC_R_SUCCESS);
+
+ cleanup_index:
+	isc_ht_destroy(&batch->index);
+ cleanup_batch:
+	isc_mem_put(mctx, batch, sizeof(*batch));
+	return (result);
+}
+
+static void
+signbatch_destroy(dns_signbatch_t **batchp) {
+	dns_signbatch_t *batch;
+	dns_signjob_t *job;
+	unsigned int i;
+
+	REQUIRE(batchp != NULL && *batchp != NULL);
+
+	batch = *batchp;
+	*batchp = NULL;
+
+	INSIST(batch->running == 0);
+	INSIST(ISC_LIST_EMPTY(batch->cleanup));
+
+	for (i = 0; i < batch->njobs; i++) {
+		job = batch->jobs[i];
+		dst_key_free(&job->key);
+		isc_mem_put(batch->mctx, job, job->size);
+	}
+	if (batch->jobs != NULL)
+		isc_mem_put(batch->mctx, batch->jobs,
+			    batch->maxjobs * sizeof(batch->jobs[0]));
+	if (batch->done != NULL)
+		isc_event_free(&batch->done);
+	if (batch->task != NULL)
+		isc_task_detach(&batch->task);
+	dns_diff_clear(&batch->diff);
+	dns_diff_clear(&batch->postdiff);
+	if (batch->marks != NULL)
+		isc_mem_put(batch->mctx, batch->marks,
+			    batch->nmarks * sizeof(batch->marks[0]));
+	if (batch->base != NULL)
+		dns_db_closeversion(batch->db, &batch->base, ISC_FALSE);
+	if (batch->db != NULL)
+		dns_db_detach(&batch->db);
+	isc_ht_destroy(&batch->index);
+	DESTROYLOCK(&batch->lock);
+	signpool_detach(&batch->pool);
+	isc_mem_putanddetach(&batch->mctx, batch, sizeof(*batch));
+}
+
+/*
+ * The key under which the signature of the 'type' RRset at 'name'
+ * made with 'key' is found in a batch's index.
+ */
+#define SIGNJOB_KEYSIZE	(DNS_NAME_MAXWIRE + 5)
+
+static unsigned int
+signjob_key(dns_name_t *name, dns_rdatatype_t type, dst_key_t *key,
+	    unsigned char *buf)
+{
+	isc_region_t r;
+
+	dns_name_toregion(name, &r);
+	memmove(buf, r.base, r.length);
+	buf[r.length++] = (type >> 8) & 0xff;
+	buf[r.length++] = type & 0xff;
+	buf[r.length++] = dst_key_alg(key) & 0xff;
+	buf[r.length++] = (dst_key_id(key) >> 8) & 0xff;
+	buf[r.length++] = dst_key_id(key) & 0xff;
+	return (r.length);
+}
+
+/*
+ * Queue a copy of 'rdataset', owned by 'name', to be signed with 'key'.
+ */
+static isc_result_t
+signbatch_add(dns_signbatch_t *batch, dns_name_t *name,
+	      dns_rdataset_t *rdataset, dst_key_t *key)
+{
+	unsigned char keybuf[SIGNJOB_KEYSIZE];
+	unsigned int keysize;
+	dns_signjob_t *job, **jobs;
+	dns_rdata_t rdata = DNS_RDATA_INIT;
+	dns_rdata_t *rdatas;
+	isc_region_t r;
+	unsigned char *data;
+	unsigned int maxjobs, count, i;
+	size_t size;
+	isc_result_t result;
+
+	/*
+	 * Another signing of the zone with the same key has already
+	 * queued this RRset.
+	 */
+	keysize = signjob_key(name, rdataset->type, key, keybuf);
+	if (isc_ht_find(batch->index, keybuf, keysize, NULL) == ISC_R_SUCCESS)
+		return (ISC_R_SUCCESS);
+
+	if (batch->njobs == batch->maxjobs) {
+		maxjobs = batch->maxjobs == 0 ? 256 : batch->maxjobs * 2;
+		jobs = isc_mem_get(batch->mctx, maxjobs * sizeof(jobs[0]));
+		if (jobs == NULL)
+			return (ISC_R_NOMEMORY);
+		if (batch->jobs != NULL) {
+			memmove(jobs, batch->jobs,
+				batch->njobs * sizeof(jobs[0]));
+			isc_mem_put(batch->mctx, batch->jobs,
+				    batch->maxjobs * sizeof(jobs[0]));
+		}
+		batch->jobs = jobs;
+		batch->maxjobs = maxjobs;
+	}
+
+	count = 0;
+	size = sizeof(*job);
+	for (result = dns_rdataset_first(rdataset);
+	     result == ISC_R_SUCCESS;
+	     result = dns_rdataset_next(rdataset))
+	{
+		dns_rdataset_current(rdataset, &rdata);
+		size += sizeof(dns_rdata_t) + rdata.length;
+		dns_rdata_reset(&rdata);
+		count++;
+	}
+	if (result != ISC_R_NOMORE)
+		return (result);
+
+	job = isc_mem_get(batch->mctx, size);
+	if (job == NULL)
+		return (ISC_R_NOMEMORY);
+	job->size = size;
+	dns_fixedname_init(&job->name);
+	dns_name_copy(name, dns_fixedname_name(&job->name), NULL);
+	dns_rdatalist_init(&job->rdatalist);
+	job->rdatalist.rdclass = rdataset->rdclass;
+	job->rdatalist.type = rdataset->type;
+	job->rdatalist.covers = rdataset->covers;
+	job->rdatalist.ttl = rdataset->ttl;
+
+	rdatas = (dns_rdata_t *)(job + 1);
+	data = (unsigned char *)(rdatas + count);
+	for (i = 0, result = dns_rdataset_first(rdataset);
+	     result == ISC_R_SUCCESS;
+	     i++, result = dns_rdataset_next(rdataset))
+	{
+		INSIST(i < count);
+		dns_rdataset_current(rdataset, &rdata);
+		dns_rdata_toregion(&rdata, &r);
+		memmove(data, r.base, r.length);
+		r.base = data;
+		data += r.length;
+		dns_rdata_init(&rdatas[i]);
+		dns_rdata_fromregion(&rdatas[i], rdata.rdclass, rdata.type,
+				     &r);
+		ISC_LIST_APPEND(job->rdatalist.rdata, &rdatas[i], link);
+		dns_rdata_reset(&rdata);
+	}
+	INSIST(i == count);
+
+	dns_rdataset_init(&job->rdataset);
+	RUNTIME_CHECK(dns_rdatalist_tordataset(&job->rdatalist,
+					       &job->rdataset)
+		      == ISC_R_SUCCESS);
+	job->key = NULL;
+	dst_key_attach(key, &job->key);
+	dns_rdata_init(&job->rdata);
+	job->result = ISC_R_UNEXPECTED;
+
+	result = isc_ht_add(batch->index, keybuf, keysize, job);
+	if (result != ISC_R_SUCCESS) {
+		dst_key_free(&job->key);
+		isc_mem_put(batch->mctx, job, size);
+		return (result);
+	}
+	batch->jobs[batch->njobs++] = job;
+
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Runs on a task of the signing pool.  The last worker to finish
+ * tells the zone task.
+ */
+static void
+signrange(isc_task_t *task, isc_event_t *event) {
+	signrangeevent_t *sevent = (signrangeevent_t *)event;
+	dns_signbatch_t *batch = sevent->batch;
+	dns_signjob_t *job;
+	isc_buffer_t buffer;
+	isc_task_t *zonetask;
+	isc_boolean_t last;
+	unsigned int i;
+
+	UNUSED(task);
+
+	for (i = sevent->first; i < sevent->last; i++) {
+		job = batch->jobs[i];
+		isc_buffer_init(&buffer, job->data, sizeof(job->data));
+		job->result = dns_dnssec_sign(dns_fixedname_name(&job->name),
+					      &job->rdataset, job->key,
+					      &batch->inception,
+					      &batch->expire, batch->mctx,
+					      &buffer, &job->rdata);
+	}
+	isc_event_free(&event);
+
+	LOCK(&batch->lock);
+	INSIST(batch->running > 0);
+	last = ISC_TF(--batch->running == 0);
+	UNLOCK(&batch->lock);
+
+	if (last) {
+		/*
+		 * The batch may be gone as soon as the event is sent.
+		 */
+		zonetask = batch->task;
+		event = batch->done;
+		batch->done = NULL;
+		isc_task_send(zonetask, &event);
+	}
+}
+
+/*
+ * Hand the jobs in 'batch' to the workers of its pool, giving each a
+ * contiguous range of them.  'zone' is sent a DNS_EVENT_SIGNDONE
+ * when they are all done.
+ *
+ * 'zone' locked by caller.
+ */
+static isc_result_t
+signbatch_start(dns_signbatch_t *batch, dns_zone_t *zone) {
+	dns_signpool_t *pool = batch->pool;
+	isc_eventlist_t events;
+	signrangeevent_t *sevent;
+	isc_event_t *event;
+	dns_zone_t *dummy = NULL;
+	unsigned int i, n, first, per;
+
+	REQUIRE(LOCKED_ZONE(zone));
+	REQUIRE(zone->signbatch == NULL);
+	REQUIRE(batch->njobs > 0);
+
+	n = ISC_MIN(pool->workers, batch->njobs);
+	per = (batch->njobs + n - 1) / n;
+
+	batch->done = isc_event_allocate(zone->mctx, zone, DNS_EVENT_SIGNDONE,
+					 zone_signdone, zone,
+					 sizeof(isc_event_t));
+	if (batch->done == NULL)
+		return (ISC_R_NOMEMORY);
+
+	ISC_LIST_INIT(events);
+	for (first = 0; first < batch->njobs; first += per) {
+		event = isc_event_allocate(batch->mctx, pool,
+					   DNS_EVENT_SIGNRANGE, signrange,
+					   NULL, sizeof(*sevent));
+		if (event == NULL) {
+			while ((event = ISC_LIST_HEAD(events)) != NULL) {
+				ISC_LIST_UNLINK(events, event, ev_link);
+				isc_event_free(&event);
+			}
+			isc_event_free(&batch->done);
+			return (ISC_R_NOMEMORY);
+		}
+		sevent = (signrangeevent_t *)event;
+		sevent->batch = batch;
+		sevent->first = first;
+		sevent->last = ISC_MIN(first + per, batch->njobs);
+		ISC_LIST_APPEND(events, event, ev_link);
+	}
+
+	isc_task_attach(zone->task, &batch->task);
+	zone_iattach(zone, &dummy);
+	zone->signbatch = batch;
+
+	LOCK(&batch->lock);
+	for (i = 0; (event = ISC_LIST_HEAD(events)) != NULL; i++) {
+		ISC_LIST_UNLINK(events, event, ev_link);
+		batch->running++;
+		isc_task_send(pool->tasks[i], &event);
+	}
+	UNLOCK(&batch->lock);
+
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Put the signings of 'zone', including those moved to 'cleanup', back
+ * in the order and at the names recorded in 'marks'.
+ */
+static void
+signing_rewind(dns_zone_t *zone, dns_signinglist_t *cleanup,
+	       signingmark_t *marks, unsigned int nmarks)
+{
+	dns_signing_t *signing;
+	isc_result_t result;
+	unsigned int i;
+
+	while ((signing = ISC_LIST_HEAD(*cleanup)) != NULL) {
+		ISC_LIST_UNLINK(*cleanup, signing, link);
+		ISC_LIST_APPEND(zone->signing, signing, link);
+	}
+
+	for (i = nmarks; i-- > 0; ) {
+		signing = marks[i].signing;
+		ISC_LIST_UNLINK(zone->signing, signing, link);
+		ISC_LIST_PREPEND(zone->signing, signing, link);
+		if (marks[i].positioned) {
+			result = dns_dbiterator_seek(signing->dbiterator,
+					dns_fixedname_name(&marks[i].name));
+			if (result != ISC_R_SUCCESS)
+				dns_dbiterator_first(signing->dbiterator);
+		}
+		dns_dbiterator_pause(signing->dbiterator);
+	}
+}
+
+/*
+ * Drop 'batch' without using it, putting the signings back where its
+ * pass began.
+ */
+static void
+signbatch_drop(dns_zone_t *zone, dns_signbatch_t **batchp) {
+	dns_signbatch_t *batch;
+
+	REQUIRE(batchp != NULL && *batchp != NULL);
+
+	batch = *batchp;
+	signing_rewind(zone, &batch->cleanup, batch->marks, batch->nmarks);
+	signbatch_destroy(batchp);
+}
+
+/*
+ * Is 'db' still at the version the pass of 'batch' started from?
+ */
+static isc_boolean_t
+signbatch_current(dns_signbatch_t *batch, dns_db_t *db) {
+	dns_dbversion_t *version = NULL;
+	isc_boolean_t current;
+
+	if (batch->db != db)
+		return (ISC_FALSE);
+	dns_db_currentversion(db, &version);
+	current = ISC_TF(version == batch->base);
+	dns_db_closeversion(db, &version, ISC_FALSE);
+	return (current);
+}
+
+/*
+ * Make the changes of the pass of 'batch' again in 'version' and add
+ * the signatures computed by the pool, recording them in 'diff'.  The
+ * changes whose signatures are still to be updated are moved to
+ * 'postdiff'.
+ */
+static isc_result_t
+signbatch_replay(dns_signbatch_t *batch, dns_db_t *db,
+		 dns_dbversion_t *version, dns_diff_t *diff,
+		 dns_diff_t *postdiff)
+{
+	dns_signjob_t *job;
+	dns_name_t *name;
+	dns_rdata_t rdata = DNS_RDATA_INIT;
+	isc_buffer_t buffer;
+	unsigned char data[1024];
+	unsigned int i;
+	isc_result_t result;
+
+	CHECK(dns_diff_apply(&batch->diff, db, version));
+	ISC_LIST_APPENDLIST(diff->tuples, batch->diff.tuples, link);
+
+	for (i = 0; i < batch->njobs; i++) {
+		job = batch->jobs[i];
+		name = dns_fixedname_name(&job->name);
+		if (job->result != ISC_R_SUCCESS) {
+			/*
+			 * The pool could not sign it; try again here.
+			 */
+			isc_buffer_init(&buffer, data, sizeof(data));
+			CHECK(dns_dnssec_sign(name, &job->rdataset, job->key,
+					      &batch->inception,
+					      &batch->expire, batch->mctx,
+					      &buffer, &rdata));
+			CHECK(update_one_rr(db, version, diff,
+					    DNS_DIFFOP_ADDRESIGN, name,
+					    job->rdataset.ttl, &rdata));
+			dns_rdata_reset(&rdata);
+			continue;
+		}
+		CHECK(update_one_rr(db, version, diff, DNS_DIFFOP_ADDRESIGN,
+				    name, job->rdataset.ttl, &job->rdata));
+	}
+
+	CHECK(dns_diff_apply(&batch->postdiff, db, version));
+	ISC_LIST_APPENDLIST(postdiff->tuples, batch->postdiff.tuples, link);
+
+ failure:
+	return (result);
+}
+
 static isc_result_t
 sign_a_node(dns_db_t *db, dns_name_t *name, dns_dbnode_t *node,
 	    dns_dbversion_t *version, isc_boolean_t build_nsec3,
@@ -6769,7 +7468,8 @@ sign_a_node(dns_db_t *db, dns_name_t *name, dns_dbnode_t *node,
 	    isc_stdtime_t inception, isc_stdtime_t expire,
 	    unsigned int minimum, isc_boolean_t is_ksk,
 	    isc_boolean_t keyset_kskonly, isc_boolean_t *delegation,
-	    dns_diff_t *diff, isc_int32_t *signatures, isc_mem_t *mctx)
+	    dns_diff_t *diff, isc_int32_t *signatures,
+	    dns_signbatch_t *batch, isc_mem_t *mctx)
 {
 	isc_result_t result;
 	dns_rdatasetiter_t *iterator = NULL;
@@ -6876,6 +7576,12 @@ sign_a_node(dns_db_t *db, dns_name_t *name, dns_dbnode_t *node,
 		if (signed_with_key(db, node, version, rdataset.type, key)) {
 			goto next_rdataset;
 		}
+		if (batch != NULL) {
+			/* Leave the signature to the signing pool. */
+			CHECK(signbatch_add(batch, name, &rdataset, key));
+			(*signatures)--;
+			goto next_rdataset;
+		}
 		/* Calculate the signature, creating a RRSIG RDATA. */
 		isc_buffer_clear(&buffer);
 		CHECK(dns_dnssec_sign(name, &rdataset, key, &inception,
@@ -8300,6 +9006,49 @@ del_sig(dns_db_t *db, dns_dbversion_t *version, dns_name_t *name,
 	return (result);
 }
 
+/*
+ * Record where each of the zone's signings is.
+ */
+static isc_result_t
+signing_mark(dns_zone_t *zone, signingmark_t **marksp,
+	     unsigned int *nmarksp)
+{
+	dns_signing_t *signing;
+	dns_dbnode_t *node = NULL;
+	signingmark_t *marks;
+	isc_result_t result;
+	unsigned int i, n = 0;
+
+	for (signing = ISC_LIST_HEAD(zone->signing);
+	     signing != NULL;
+	     signing = ISC_LIST_NEXT(signing, link))
+		n++;
+	if (n == 0)
+		return (ISC_R_SUCCESS);
+
+	marks = isc_mem_get(zone->mctx, n * sizeof(marks[0]));
+	if (marks == NULL)
+		return (ISC_R_NOMEMORY);
+
+	for (i = 0, signing = ISC_LIST_HEAD(zone->signing);
+	     signing != NULL;
+	     i++, signing = ISC_LIST_NEXT(signing, link))
+	{
+		marks[i].signing = signing;
+		dns_fixedname_init(&marks[i].name);
+		result = dns_dbiterator_current(signing->dbiterator, &node,
+					dns_fixedname_name(&marks[i].name));
+		marks[i].positioned = ISC_TF(result == ISC_R_SUCCESS);
+		if (node != NULL)
+			dns_db_detachnode(signing->db, &node);
+		dns_dbiterator_pause(signing->dbiterator);
+	}
+
+	*marksp = marks;
+	*nmarksp = n;
+	return (ISC_R_SUCCESS);
+}
+
 /*
  * Incrementally sign the zone using the keys requested.
  * Builds the NSEC chain if required.
@@ -8333,9 +9082,25 @@ zone_sign(dns_zone_t *zone) {
 	unsigned int i, j;
 	unsigned int nkeys = 0;
 	isc_uint32_t nodes;
+	isc_uint32_t nvisited = 0;
+	isc_int32_t budget;
+	dns_signpool_t *signpool = NULL;
+	dns_signbatch_t *batch = NULL;
+	isc_boolean_t serial = ISC_FALSE;
 
 	ENTER;
 
+	/*
+	 * The signing pool is still busy with the last pass.
+	 * zone_signdone() will finish it when the pool is done.
+	 */
+	if (zone->signbatch != NULL && !zone->signbatch->ready) {
+		isc_time_settoepoch(&zone->signingtime);
+		return;
+	}
+	batch = zone->signbatch;
+	zone->signbatch = NULL;
+
 	dns_rdataset_init(&rdataset);
 	dns_fixedname_init(&fixed);
 	name = dns_fixedname_name(&fixed);
@@ -8363,6 +9128,16 @@ zone_sign(dns_zone_t *zone) {
 		goto failure;
 	}
 
+	/*
+	 * The zone has changed since the pass of the batch began, so
+	 * the changes recorded in it no longer apply.  Make the pass
+	 * again without the pool.
+	 */
+	if (batch != NULL && !signbatch_current(batch, db)) {
+		signbatch_drop(zone, &batch);
+		serial = ISC_TRUE;
+	}
+
 	result = dns_db_newversion(db, &version);
 	if (result != ISC_R_SUCCESS) {
 		dns_zone_log(zone, ISC_LOG_ERROR,
@@ -8393,19 +9168,73 @@ zone_sign(dns_zone_t *zone) {
 	isc_random_get(&jitter);
 	expire = soaexpire - jitter % 3600;
 
+	/*
+	 * If the zone manager has a signing pool, queue the signatures
+	 * for it and make the pass as large as the pool can keep busy.
+	 */
+	if (batch != NULL) {
+		signpool_attach(batch->pool, &signpool);
+	} else if (!serial && zone->zmgr != NULL) {
+		RWLOCK(&zone->zmgr->rwlock, isc_rwlocktype_read);
+		if (zone->zmgr->signpool != NULL)
+			signpool_attach(zone->zmgr->signpool, &signpool);
+		RWUNLOCK(&zone->zmgr->rwlock, isc_rwlocktype_read);
+	}
+
 	/*
 	 * We keep pulling nodes off each iterator in turn until
 	 * we have no more nodes to pull off or we reach the limits
 	 * for this quantum.
 	 */
-	nodes = zone->nodes;
-	signatures = zone->signatures;
+	if (signpool != NULL) {
+		if (batch == NULL) {
+			CHECK(signbatch_create(zone->mctx, signpool,
+					       inception, expire, &batch));
+			CHECK(signing_mark(zone, &batch->marks,
+					   &batch->nmarks));
+		}
+		nodes = SIGNPOOL_PERWORKER * signpool->workers;
+		signatures = SIGNPOOL_PERWORKER * signpool->workers;
+	} else {
+		nodes = zone->nodes;
+		signatures = zone->signatures;
+	}
+	budget = signatures;
 	signing = ISC_LIST_HEAD(zone->signing);
+
+	LOCK_ZONE(zone);
+	if (!zone->signingactive) {
+		zone->signingactive = ISC_TRUE;
+		TIME_NOW(&zone->signingstart);
+		zone->signingnodes = 0;
+		zone->signingsigs = 0;
+	}
+	zone->signingthreads = (signpool != NULL) ? signpool->workers : 0;
+	UNLOCK_ZONE(zone);
 	first = ISC_TRUE;
 
 	check_ksk = DNS_ZONE_OPTION(zone, DNS_ZONEOPT_UPDATECHECKKSK);
 	keyset_kskonly = DNS_ZONE_OPTION(zone, DNS_ZONEOPT_DNSKEYKSKONLY);
 
+	/*
+	 * The pool has signed the batch.  Make the changes of its pass
+	 * again, with the signatures, and finish the pass.
+	 */
+	if (batch != NULL && batch->ready) {
+		result = signbatch_replay(batch, db, version, zonediff.diff,
+					  &post_diff);
+		if (result != ISC_R_SUCCESS) {
+			dns_zone_log(zone, ISC_LOG_ERROR, "zone_sign:"
+				     "signbatch_replay -> %s",
+				     dns_result_totext(result));
+			goto failure;
+		}
+		ISC_LIST_APPENDLIST(cleanup, batch->cleanup, link);
+		nvisited = batch->nvisited;
+		signatures = budget - batch->nsigs;
+		goto finish;
+	}
+
 	/* Determine which type of chain to build */
 	CHECK(dns_private_chains(db, version, zone->privatetype,
 				 &build_nsec, &build_nsec3));
@@ -8571,7 +9400,7 @@ zone_sign(dns_zone_t *zone) {
 					  expire, zone->minimum, is_ksk,
 					  ISC_TF(both && keyset_kskonly),
 					  &delegation, zonediff.diff,
-					  &signatures, zone->mctx));
+					  &signatures, batch, zone->mctx));
 			/*
 			 * If we are adding we are done.  Look for other keys
 			 * of the same algorithm if deleting.
@@ -8585,6 +9414,7 @@ zone_sign(dns_zone_t *zone) {
 		 */
  next_node:
 		first = ISC_FALSE;
+		nvisited++;
 		dns_db_detachnode(db, &node);
 		do {
 			result = dns_dbiterator_next(signing->dbiterator);
@@ -8649,6 +9479,45 @@ zone_sign(dns_zone_t *zone) {
 		first = ISC_TRUE;
 	}
 
+	if (batch != NULL && batch->njobs != 0) {
+		/*
+		 * Record the changes of this pass in the batch, throw
+		 * the pass away and hand the batch to the signing pool.
+		 */
+		for (signing = ISC_LIST_HEAD(zone->signing);
+		     signing != NULL;
+		     signing = ISC_LIST_NEXT(signing, link))
+			dns_dbiterator_pause(signing->dbiterator);
+		for (signing = ISC_LIST_HEAD(cleanup);
+		     signing != NULL;
+		     signing = ISC_LIST_NEXT(signing, link))
+			dns_dbiterator_pause(signing->dbiterator);
+		dns_db_closeversion(db, &version, ISC_FALSE);
+
+		ISC_LIST_APPENDLIST(batch->diff.tuples, _sig_diff.tuples,
+				    link);
+		ISC_LIST_APPENDLIST(batch->postdiff.tuples, post_diff.tuples,
+				    link);
+		ISC_LIST_APPENDLIST(batch->cleanup, cleanup, link);
+		batch->nvisited = nvisited;
+		batch->nsigs = budget - signatures;
+		dns_db_attach(db, &batch->db);
+		dns_db_currentversion(db, &batch->base);
+
+		LOCK_ZONE(zone);
+		result = signbatch_start(batch, zone);
+		UNLOCK_ZONE(zone);
+		if (result != ISC_R_SUCCESS) {
+			dns_zone_log(zone, ISC_LOG_ERROR, "zone_sign:"
+				     "signbatch_start -> %s",
+				     dns_result_totext(result));
+			goto failure;
+		}
+		batch = NULL;
+		goto failure;
+	}
+
+ finish:
 	if (ISC_LIST_HEAD(post_diff.tuples) != NULL) {
 		result = update_sigs(&post_diff, db, version, zone_keys,
 				     nkeys, zone, inception, expire, now,
@@ -8743,12 +9612,18 @@ zone_sign(dns_zone_t *zone) {
 
 	set_resigntime(zone);
 
+	LOCK_ZONE(zone);
+	zone->signingnodes += nvisited;
+	zone->signingsigs += budget - signatures;
+	if (ISC_LIST_EMPTY(zone->signing)) {
+		zone->signingactive = ISC_FALSE;
+		TIME_NOW(&zone->signingend);
+	}
 	if (commit) {
-		LOCK_ZONE(zone);
 		DNS_ZONE_SETFLAG(zone, DNS_ZONEFLG_NEEDNOTIFY);
 		zone_needdump(zone, DNS_DUMP_DELAY);
-		UNLOCK_ZONE(zone);
 	}
+	UNLOCK_ZONE(zone);
 
  failure:
 	/*
@@ -8759,6 +9634,18 @@ zone_sign(dns_zone_t *zone) {
 	     signing = ISC_LIST_NEXT(signing, link))
 		dns_dbiterator_pause(signing->dbiterator);
 
+	/*
+	 * A pass made for the signing pool that failed is made again
+	 * from where it began.
+	 */
+	if (batch != NULL) {
+		if (result != ISC_R_SUCCESS) {
+			ISC_LIST_APPENDLIST(batch->cleanup, cleanup, link);
+			signbatch_drop(zone, &batch);
+		} else
+			signbatch_destroy(&batch);
+	}
+
 	/*
 	 * Rollback the cleanup list.
 	 */
@@ -8772,6 +9659,10 @@ zone_sign(dns_zone_t *zone) {
 	}
 
 	dns_diff_clear(&_sig_diff);
+	dns_diff_clear(&post_diff);
+
+	if (signpool != NULL)
+		signpool_detach(&signpool);
 
 	for (i = 0; i < nkeys; i++)
 		dst_key_free(&zone_keys[i]);
@@ -8785,7 +9676,11 @@ zone_sign(dns_zone_t *zone) {
 	} else if (db != NULL)
 		dns_db_detach(&db);
 
-	if (ISC_LIST_HEAD(zone->signing) != NULL) {
+	/*
+	 * While the signing pool has the batch, zone_signdone() decides
+	 * when to carry on.
+	 */
+	if (ISC_LIST_HEAD(zone->signing) != NULL && zone->signbatch == NULL) {
 		isc_interval_t interval;
 		if (zone->update_disabled || result != ISC_R_SUCCESS)
 			isc_interval_set(&interval, 60, 0);	  /* 1 minute */
@@ -8798,6 +9693,48 @@ zone_sign(dns_zone_t *zone) {
 	INSIST(version == NULL);
 }
 
+/*
+ * The signing pool has computed the signatures in zone->signbatch.
+ */
+static void
+zone_signdone(isc_task_t *task, isc_event_t *event) {
+	const char me[] = "zone_signdone";
+	dns_zone_t *zone = event->ev_arg;
+	isc_time_t now;
+
+	UNUSED(task);
+
+	REQUIRE(DNS_ZONE_VALID(zone));
+	INSIST(event->ev_type == DNS_EVENT_SIGNDONE);
+
+	ENTER;
+
+	isc_event_free(&event);
+
+	INSIST(zone->signbatch != NULL && !zone->signbatch->ready);
+	zone->signbatch->ready = ISC_TRUE;
+	isc_task_detach(&zone->signbatch->task);
+
+	if (DNS_ZONE_FLAG(zone, DNS_ZONEFLG_EXITING)) {
+		signbatch_drop(zone, &zone->signbatch);
+	} else {
+		TIME_NOW(&now);
+		/*
+		 * receive_secure_serial() holds a new version open
+		 * until it is done; leave the pass to zone_maintenance().
+		 */
+		if (zone->rss_event == NULL)
+			zone_sign(zone);
+		else
+			zone->signingtime = now;
+		LOCK_ZONE(zone);
+		zone_settimer(zone, &now);
+		UNLOCK_ZONE(zone);
+	}
+
+	dns_zone_idetach(&zone);
+}
+
 static isc_result_t
 normalize_key(dns_rdata_t *rr, dns_rdata_t *target,
 	      unsigned char *data, int size)
@@ -12796,8 +13733,14 @@ zone_shutdown(isc_task_t *task, isc_event_t *event) {
 
 	forward_cancel(zone);
 
-	if (zone->timer != NULL) {
-		isc_timer_detach(&zone->timer);
+	/*
+	 * dns_zonemgr_releasezone() has taken the zone off the
+	 * maintenance schedule, and any maintenance event that was
+	 * queued on this task has run or been purged.
+	 */
+	if (zone->scheduled) {
+		INSIST(zone->zmgr == NULL);
+		zone->scheduled = ISC_FALSE;
 		INSIST(zone->irefs > 0);
 		zone->irefs--;
 	}
@@ -12830,27 +13773,40 @@ static void
 zone_timer(isc_task_t *task, isc_event_t *event) {
 	const char me[] = "zone_timer";
 	dns_zone_t *zone = (dns_zone_t *)event->ev_arg;
+	dns_zonemgr_t *zmgr;
 
 	UNUSED(task);
 	REQUIRE(DNS_ZONE_VALID(zone));
+	REQUIRE(event == &zone->maintevent);
 
 	ENTER;
 
-	zone_maintenance(zone);
+	/*
+	 * If the zone has been released by the zone manager since the
+	 * event was posted there is nothing left to maintain.
+	 */
+	LOCK_ZONE(zone);
+	zmgr = zone->zmgr;
+	if (zmgr != NULL) {
+		LOCK(&zmgr->schedlock);
+		zone->maintpending = ISC_FALSE;
+		UNLOCK(&zmgr->schedlock);
+	}
+	UNLOCK_ZONE(zone);
 
-	isc_event_free(&event);
+	if (zmgr != NULL)
+		zone_maintenance(zone);
 }
 
 static void
 zone_settimer(dns_zone_t *zone, isc_time_t *now) {
 	const char me[] = "zone_settimer";
 	isc_time_t next;
-	isc_result_t result;
 
 	REQUIRE(DNS_ZONE_VALID(zone));
 	ENTER;
 
-	if (DNS_ZONE_FLAG(zone, DNS_ZONEFLG_EXITING))
+	if (DNS_ZONE_FLAG(zone, DNS_ZONEFLG_EXITING) || zone->zmgr == NULL)
 		return;
 
 	isc_time_settoepoch(&next);
@@ -12954,24 +13910,11 @@ zone_settimer(dns_zone_t *zone, isc_time_t *now) {
 		break;
 	}
 
-	if (isc_time_isepoch(&next)) {
+	if (isc_time_isepoch(&next))
 		zone_debuglog(zone, me, 10, "settimer inactive");
-		result = isc_timer_reset(zone->timer, isc_timertype_inactive,
-					  NULL, NULL, ISC_TRUE);
-		if (result != ISC_R_SUCCESS)
-			dns_zone_log(zone, ISC_LOG_ERROR,
-				     "could not deactivate zone timer: %s",
-				     isc_result_totext(result));
-	} else {
-		if (isc_time_compare(&next, now) <= 0)
-			next = *now;
-		result = isc_timer_reset(zone->timer, isc_timertype_once,
-					 &next, NULL, ISC_TRUE);
-		if (result != ISC_R_SUCCESS)
-			dns_zone_log(zone, ISC_LOG_ERROR,
-				     "could not reset zone timer: %s",
-				     isc_result_totext(result));
-	}
+	else if (isc_time_compare(&next, now) <= 0)
+		next = *now;
+	zonemgr_schedule(zone->zmgr, zone, &next);
 }
 
 static void
@@ -15925,6 +16868,187 @@ dns_zone_first(dns_zonemgr_t *zmgr, dns_zone_t **first) {
  ***	Zone manager.
  ***/
 
+/*
+ * Zone maintenance is scheduled by the zone manager rather than by a
+ * timer per zone.  zone_settimer() files each managed zone in
+ * zmgr->schedheap under the time its earliest timed action (refresh,
+ * expire, dump, notify, re-signing, key refresh, ...) falls due, and a
+ * single timer on zmgr->task is kept set for the zone at the top.
+ * When it fires, the zones that are due are taken off the heap in
+ * batches and a maintenance event is posted to each zone's own task;
+ * zone_maintenance() then reschedules the zone.  Idle zones cost
+ * nothing until they are due.
+ */
+#define ZONEMGR_SCHEDBATCH	256
+
+static isc_boolean_t
+sched_higher(void *v1, void *v2) {
+	dns_zone_t *z1 = v1;
+	dns_zone_t *z2 = v2;
+
+	return (ISC_TF(isc_time_compare(&z1->schedtime, &z2->schedtime) < 0));
+}
+
+static void
+sched_index(void *what, unsigned int idx) {
+	dns_zone_t *zone = what;
+
+	zone->schedindex = idx;
+}
+
+/*
+ * Set the scheduling timer for the first zone due.  Called with
+ * zmgr->schedlock held.
+ */
+static void
+zonemgr_settimer(dns_zonemgr_t *zmgr) {
+	dns_zone_t *zone;
+	isc_result_t result;
+
+	if (zmgr->schedtimer == NULL)
+		return;
+
+	zone = isc_heap_element(zmgr->schedheap, 1);
+	if (zone == NULL) {
+		if (isc_time_isepoch(&zmgr->schedtime))
+			return;
+		isc_time_settoepoch(&zmgr->schedtime);
+		result = isc_timer_reset(zmgr->schedtimer,
+					 isc_timertype_inactive,
+					 NULL, NULL, ISC_TRUE);
+	} else {
+		if (isc_time_compare(&zone->schedtime, &zmgr->schedtime) == 0)
+			return;
+		zmgr->schedtime = zone->schedtime;
+		result = isc_timer_reset(zmgr->schedtimer, isc_timertype_once,
+					 &zmgr->schedtime, NULL, ISC_TRUE);
+	}
+	if (result != ISC_R_SUCCESS)
+		isc_log_write(dns_lctx, DNS_LOGCATEGORY_GENERAL,
+			      DNS_LOGMODULE_ZONE, ISC_LOG_ERROR,
+			      "could not reset zone maintenance timer: %s",
+			      isc_result_totext(result));
+}
+
+/*
+ * (Re)schedule maintenance of 'zone' at 'next', or take it off the
+ * schedule if 'next' is the epoch.
+ */
+static void
+zonemgr_schedule(dns_zonemgr_t *zmgr, dns_zone_t *zone,
+		 const isc_time_t *next)
+{
+	isc_result_t result;
+	int order;
+
+	REQUIRE(DNS_ZONEMGR_VALID(zmgr));
+
+	LOCK(&zmgr->schedlock);
+	if (isc_time_isepoch(next)) {
+		if (zone->schedindex != 0)
+			isc_heap_delete(zmgr->schedheap, zone->schedindex);
+		isc_time_settoepoch(&zone->schedtime);
+	} else if (zone->schedindex == 0) {
+		zone->schedtime = *next;
+		result = isc_heap_insert(zmgr->schedheap, zone);
+		if (result != ISC_R_SUCCESS)
+			dns_zone_log(zone, ISC_LOG_ERROR,
+				     "could not schedule zone maintenance: %s",
+				     isc_result_totext(result));
+	} else {
+		order = isc_time_compare(next, &zone->schedtime);
+		zone->schedtime = *next;
+		if (order < 0)
+			isc_heap_increased(zmgr->schedheap, zone->schedindex);
+		else if (order > 0)
+			isc_heap_decreased(zmgr->schedheap, zone->schedindex);
+	}
+	zonemgr_settimer(zmgr);
+	UNLOCK(&zmgr->schedlock);
+}
+
+/*
+ * Take 'zone' off the schedule for good, purging a maintenance event
+ * that has been posted but has not yet run.  'zone' is locked by the
+ * caller.
+ */
+static void
+zonemgr_unschedule(dns_zonemgr_t *zmgr, dns_zone_t *zone) {
+	REQUIRE(DNS_ZONEMGR_VALID(zmgr));
+	REQUIRE(LOCKED_ZONE(zone));
+
+	LOCK(&zmgr->schedlock);
+	if (zone->schedindex != 0)
+		isc_heap_delete(zmgr->schedheap, zone->schedindex);
+	isc_time_settoepoch(&zone->schedtime);
+	if (zone->maintpending) {
+		(void)isc_task_purgeevent(zone->task, &zone->maintevent);
+		zone->maintpending = ISC_FALSE;
+	}
+	UNLOCK(&zmgr->schedlock);
+}
+
+static void
+zonemgr_schedtimer(isc_task_t *task, isc_event_t *event) {
+	dns_zonemgr_t *zmgr = event->ev_arg;
+	dns_zone_t *zone;
+	isc_event_t *ev;
+	isc_time_t now;
+	unsigned int n;
+
+	REQUIRE(DNS_ZONEMGR_VALID(zmgr));
+
+	TIME_NOW(&now);
+
+	LOCK(&zmgr->schedlock);
+	if (zmgr->schedtimer == NULL) {
+		UNLOCK(&zmgr->schedlock);
+		isc_event_free(&event);
+		return;
+	}
+
+	/* A once timer is inactive after firing. */
+	isc_time_settoepoch(&zmgr->schedtime);
+	zmgr->schedwakeups++;
+
+	for (n = 0; n < ZONEMGR_SCHEDBATCH; n++) {
+		zone = isc_heap_element(zmgr->schedheap, 1);
+		if (zone == NULL ||
+		    isc_time_compare(&zone->schedtime, &now) > 0)
+			break;
+		isc_heap_delete(zmgr->schedheap, 1);
+
+		/*
+		 * A zone whose last maintenance event has not run yet
+		 * will be rescheduled when it does.
+		 */
+		if (!zone->maintpending) {
+			zmgr->scheddispatched++;
+			zmgr->schedlateusec +=
+				isc_time_microdiff(&now, &zone->schedtime);
+			zone->maintpending = ISC_TRUE;
+			ev = &zone->maintevent;
+			isc_task_send(zone->task, &ev);
+		}
+		isc_time_settoepoch(&zone->schedtime);
+	}
+
+	/*
+	 * If more zones are due, let anything else queued on the zone
+	 * manager's task run before posting the next batch.
+	 */
+	if (n == ZONEMGR_SCHEDBATCH) {
+		UNLOCK(&zmgr->schedlock);
+		isc_task_send(task, &event);
+		return;
+	}
+
+	zonemgr_settimer(zmgr);
+	UNLOCK(&zmgr->schedlock);
+	isc_event_free(&event);
+}
+
+
 isc_result_t
 dns_zonemgr_create(isc_mem_t *mctx, isc_taskmgr_t *taskmgr,
 		   isc_timermgr_t *timermgr, isc_socketmgr_t *socketmgr,
@@ -16009,15 +17133,39 @@ dns_zonemgr_create(isc_mem_t *mctx, isc_taskmgr_t *taskmgr,
 	if (result != ISC_R_SUCCESS)
 		goto free_startuprefreshrl;
 
+	result = isc_mutex_init(&zmgr->schedlock);
+	if (result != ISC_R_SUCCESS)
+		goto free_iolock;
+
+	zmgr->schedheap = NULL;
+	result = isc_heap_create(mctx, sched_higher, sched_index, 1024,
+				 &zmgr->schedheap);
+	if (result != ISC_R_SUCCESS)
+		goto free_schedlock;
+
+	zmgr->schedtimer = NULL;
+	isc_time_settoepoch(&zmgr->schedtime);
+	zmgr->schedwakeups = 0;
+	zmgr->scheddispatched = 0;
+	zmgr->schedlateusec = 0;
+	zmgr->signpool = NULL;
+	result = isc_timer_create(timermgr, isc_timertype_inactive,
+				  NULL, NULL, zmgr->task, zonemgr_schedtimer,
+				  zmgr, &zmgr->schedtimer);
+	if (result != ISC_R_SUCCESS)
+		goto free_schedheap;
+
 	zmgr->magic = ZONEMGR_MAGIC;
 
 	*zmgrp = zmgr;
 	return (ISC_R_SUCCESS);
 
-#if 0
+ free_schedheap:
+	isc_heap_destroy(&zmgr->schedheap);
+ free_schedlock:
+	DESTROYLOCK(&zmgr->schedlock);
  free_iolock:
 	DESTROYLOCK(&zmgr->iolock);
-#endif
  free_startuprefreshrl:
 	isc_ratelimiter_detach(&zmgr->startuprefreshrl);
  free_startupnotifyrl:
@@ -16067,8 +17215,6 @@ dns_zonemgr_createzone(dns_zonemgr_t *zmgr, dns_zone_t **zonep) {
 
 isc_result_t
 dns_zonemgr_managezone(dns_zonemgr_t *zmgr, dns_zone_t *zone) {
-	isc_result_t result;
-
 	REQUIRE(DNS_ZONE_VALID(zone));
 	REQUIRE(DNS_ZONEMGR_VALID(zmgr));
 
@@ -16078,7 +17224,7 @@ dns_zonemgr_managezone(dns_zonemgr_t *zmgr, dns_zone_t *zone) {
 	RWLOCK(&zmgr->rwlock, isc_rwlocktype_write);
 	LOCK_ZONE(zone);
 	REQUIRE(zone->task == NULL);
-	REQUIRE(zone->timer == NULL);
+	REQUIRE(!zone->scheduled);
 	REQUIRE(zone->zmgr == NULL);
 
 	isc_taskpool_gettask(zmgr->zonetasks, &zone->task);
@@ -16092,17 +17238,11 @@ dns_zonemgr_managezone(dns_zonemgr_t *zmgr, dns_zone_t *zone) {
 	isc_task_setname(zone->task, "zone", zone);
 	isc_task_setname(zone->loadtask, "loadzone", zone);
 
-	result = isc_timer_create(zmgr->timermgr, isc_timertype_inactive,
-				  NULL, NULL,
-				  zone->task, zone_timer, zone,
-				  &zone->timer);
-
-	if (result != ISC_R_SUCCESS)
-		goto cleanup_tasks;
-
 	/*
-	 * The timer "holds" a iref.
+	 * Maintenance is scheduled by the zone manager rather than by a
+	 * timer per zone; being scheduled "holds" a iref.
 	 */
+	zone->scheduled = ISC_TRUE;
 	zone->irefs++;
 	INSIST(zone->irefs != 0);
 
@@ -16110,16 +17250,9 @@ dns_zonemgr_managezone(dns_zonemgr_t *zmgr, dns_zone_t *zone) {
 	zone->zmgr = zmgr;
 	zmgr->refs++;
 
-	goto unlock;
-
- cleanup_tasks:
-	isc_task_detach(&zone->loadtask);
-	isc_task_detach(&zone->task);
-
- unlock:
 	UNLOCK_ZONE(zone);
 	RWUNLOCK(&zmgr->rwlock, isc_rwlocktype_write);
-	return (result);
+	return (ISC_R_SUCCESS);
 }
 
 void
@@ -16133,6 +17266,9 @@ dns_zonemgr_releasezone(dns_zonemgr_t *zmgr, dns_zone_t *zone) {
 	RWLOCK(&zmgr->rwlock, isc_rwlocktype_write);
 	LOCK_ZONE(zone);
 
+	if (zone->scheduled)
+		zonemgr_unschedule(zmgr, zone);
+
 	ISC_LIST_UNLINK(zmgr->zones, zone, link);
 	zone->zmgr = NULL;
 	zmgr->refs--;
@@ -16228,6 +17364,11 @@ dns_zonemgr_shutdown(dns_zonemgr_t *zmgr) {
 	isc_ratelimiter_shutdown(zmgr->startupnotifyrl);
 	isc_ratelimiter_shutdown(zmgr->startuprefreshrl);
 
+	LOCK(&zmgr->schedlock);
+	if (zmgr->schedtimer != NULL)
+		isc_timer_detach(&zmgr->schedtimer);
+	UNLOCK(&zmgr->schedlock);
+
 	if (zmgr->task != NULL)
 		isc_task_destroy(&zmgr->task);
 	if (zmgr->zonetasks != NULL)
@@ -16237,6 +17378,11 @@ dns_zonemgr_shutdown(dns_zonemgr_t *zmgr) {
 	if (zmgr->mctxpool != NULL)
 		isc_pool_destroy(&zmgr->mctxpool);
 
+	RWLOCK(&zmgr->rwlock, isc_rwlocktype_write);
+	if (zmgr->signpool != NULL)
+		signpool_detach(&zmgr->signpool);
+	RWUNLOCK(&zmgr->rwlock, isc_rwlocktype_write);
+
 	RWLOCK(&zmgr->rwlock, isc_rwlocktype_read);
 	for (zone = ISC_LIST_HEAD(zmgr->zones);
 	     zone != NULL;
@@ -16355,6 +17501,12 @@ zonemgr_free(dns_zonemgr_t *zmgr) {
 
 	zmgr->magic = 0;
 
+	INSIST(zmgr->schedtimer == NULL);
+	INSIST(isc_heap_element(zmgr->schedheap, 1) == NULL);
+	if (zmgr->signpool != NULL)
+		signpool_detach(&zmgr->signpool);
+	isc_heap_destroy(&zmgr->schedheap);
+	DESTROYLOCK(&zmgr->schedlock);
 	DESTROYLOCK(&zmgr->iolock);
 	isc_ratelimiter_detach(&zmgr->notifyrl);
 	isc_ratelimiter_detach(&zmgr->refreshrl);
@@ -17156,6 +18308,89 @@ dns_zonemgr_getcount(dns_zonemgr_t *zmgr, int state) {
 	return (count);
 }
 
+void
+dns_zonemgr_getschedstats(dns_zonemgr_t *zmgr, isc_uint64_t *wakeups,
+			  isc_uint64_t *dispatched, isc_uint64_t *lateusec)
+{
+	REQUIRE(DNS_ZONEMGR_VALID(zmgr));
+	REQUIRE(wakeups != NULL);
+	REQUIRE(dispatched != NULL);
+	REQUIRE(lateusec != NULL);
+
+	LOCK(&zmgr->schedlock);
+	*wakeups = zmgr->schedwakeups;
+	*dispatched = zmgr->scheddispatched;
+	*lateusec = zmgr->schedlateusec;
+	UNLOCK(&zmgr->schedlock);
+}
+
+isc_result_t
+dns_zonemgr_setsigningthreads(dns_zonemgr_t *zmgr, unsigned int workers) {
+	dns_signpool_t *pool = NULL, *old;
+
+	REQUIRE(DNS_ZONEMGR_VALID(zmgr));
+
+#ifdef ISC_PLATFORM_USETHREADS
+	RWLOCK(&zmgr->rwlock, isc_rwlocktype_read);
+	if (zmgr->signpool == NULL ? workers == 0 :
+	    zmgr->signpool->workers == workers)
+	{
+		RWUNLOCK(&zmgr->rwlock, isc_rwlocktype_read);
+		return (ISC_R_SUCCESS);
+	}
+	RWUNLOCK(&zmgr->rwlock, isc_rwlocktype_read);
+
+	if (workers > 0) {
+		isc_result_t result;
+
+		result = signpool_create(zmgr->mctx, workers, &pool);
+		if (result != ISC_R_SUCCESS)
+			return (result);
+	}
+
+	/*
+	 * A zone that is signing holds its own reference to the old
+	 * pool until its pass is done.
+	 */
+	RWLOCK(&zmgr->rwlock, isc_rwlocktype_write);
+	old = zmgr->signpool;
+	zmgr->signpool = pool;
+	RWUNLOCK(&zmgr->rwlock, isc_rwlocktype_write);
+
+	if (old != NULL)
+		signpool_detach(&old);
+	return (ISC_R_SUCCESS);
+#else
+	UNUSED(pool);
+	UNUSED(old);
+
+	if (workers > 0)
+		return (ISC_R_NOTIMPLEMENTED);
+	return (ISC_R_SUCCESS);
+#endif
+}
+
+void
+dns_zone_getsigningstats(dns_zone_t *zone, dns_signingstats_t *stats) {
+	isc_time_t now;
+
+	REQUIRE(DNS_ZONE_VALID(zone));
+	REQUIRE(stats != NULL);
+
+	LOCK_ZONE(zone);
+	stats->active = zone->signingactive;
+	stats->nodes = zone->signingnodes;
+	stats->signatures = zone->signingsigs;
+	stats->threads = zone->signingthreads;
+	if (zone->signingactive) {
+		TIME_NOW(&now);
+		stats->usec = isc_time_microdiff(&now, &zone->signingstart);
+	} else
+		stats->usec = isc_time_microdiff(&zone->signingend,
+						 &zone->signingstart);
+	UNLOCK_ZONE(zone);
+}
+
 isc_result_t
 dns_zone_checknames(dns_zone_t *zone, const dns_name_t *name,
 		    dns_rdata_t *rdata)
@@ -18456,7 +19691,6 @@ dns_zone_getserialupdatemethod(dns_zone_t *zone) {
  */
 isc_result_t
 dns_zone_link(dns_zone_t *zone, dns_zone_t *raw) {
-	isc_result_t result;
 	dns_zonemgr_t *zmgr;
 
 	REQUIRE(DNS_ZONE_VALID(zone));
@@ -18481,15 +19715,10 @@ dns_zone_link(dns_zone_t *zone, dns_zone_t *raw) {
 	LOCK_ZONE(zone);
 	LOCK_ZONE(raw);
 
-	result = isc_timer_create(zmgr->timermgr, isc_timertype_inactive,
-				  NULL, NULL, zone->task, zone_timer, raw,
-				  &raw->timer);
-	if (result != ISC_R_SUCCESS)
-		goto unlock;
-
 	/*
-	 * The timer "holds" a iref.
+	 * Being scheduled "holds" a iref.
 	 */
+	raw->scheduled = ISC_TRUE;
 	raw->irefs++;
 	INSIST(raw->irefs != 0);
 
@@ -18508,11 +19737,10 @@ dns_zone_link(dns_zone_t *zone, dns_zone_t *raw) {
 	raw->zmgr = zmgr;
 	zmgr->refs++;
 
- unlock:
 	UNLOCK_ZONE(raw);
 	UNLOCK_ZONE(zone);
 	RWUNLOCK(&zmgr->rwlock, isc_rwlocktype_write);
-	return (result);
+	return (ISC_R_SUCCESS);
 }
 
 void
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <stddef.h>
+
+#include <isc/arena.h>
+#include <isc/magic.h>
+#include <isc/mem.h>
+#include <isc/util.h>
+
+#define ARENA_MAGIC			ISC_MAGIC('A', 'r', 'n', 'a')
+#define VALID_ARENA(a)			ISC_MAGIC_VALID(a, ARENA_MAGIC)
+
+/*%
+ * Objects are aligned as isc_mem_get() aligns them.
+ */
+#define ARENA_ALIGN			8U		/*%< must be a power of 2 */
+#define ARENA_ROUND(n)			(((n) + ARENA_ALIGN - 1) & \
+					 ~((size_t)ARENA_ALIGN - 1))
+
+typedef struct arenablock arenablock_t;
+
+/*%
+ * A block header, followed by 'size' bytes of memory to hand out.
+ */
+struct arenablock {
+	arenablock_t *		next;
+	size_t			size;
+};
+
+#define BLOCK_HEADER			ARENA_ROUND(sizeof(arenablock_t))
+#define BLOCK_DATA(b)			((unsigned char *)(b) + BLOCK_HEADER)
+
+struct isc_arena {
+	unsigned int		magic;
+	isc_mem_t *		mctx;
+	size_t			blocksize;
+	/*%
+	 * 'first' is kept across resets.  Blocks allocated since the last
+	 * reset are linked from 'current' back to 'first'.
+	 */
+	arenablock_t *		first;
+	arenablock_t *		current;
+	size_t			used;		/*%< of 'current' */
+	size_t			inuse;
+};
+
+static arenablock_t *
+newblock(isc_arena_t *arena, size_t size) {
+	arenablock_t *block;
+
+	block = isc_mem_get(arena->mctx, BLOCK_HEADER + size);
+	if (block == NULL)
+		return (NULL);
+	block->next = NULL;
+	block->size = size;
+	return (block);
+}
+
+static void
+freeblocks(isc_arena_t *arena) {
+	arenablock_t *block;
+
+	while (arena->current != arena->first) {
+		block = arena->current;
+		arena->current = block->next;
+		isc_mem_put(arena->mctx, block, BLOCK_HEADER + block->size);
+	}
+}
+
+isc_result_t
+isc_arena_create(isc_mem_t *mctx, size_t blocksize, isc_arena_t **arenap) {
+	isc_arena_t *arena;
+
+	REQUIRE(mctx != NULL);
+	REQUIRE(blocksize > 0);
+	REQUIRE(arenap != NULL && *arenap == NULL);
+
+	arena = isc_mem_get(mctx, sizeof(*arena));
+	if (arena == NULL)
+		return (ISC_R_NOMEMORY);
+
+	arena->mctx = NULL;
+	isc_mem_attach(mctx, &arena->mctx);
+	arena->blocksize = ARENA_ROUND(blocksize);
+	arena->first = newblock(arena, arena->blocksize);
+	if (arena->first == NULL) {
+		isc_mem_putanddetach(&arena->mctx, arena, sizeof(*arena));
+		return (ISC_R_NOMEMORY);
+	}
+	arena->current = arena->first;
+	arena->used = 0;
+	arena->inuse = 0;
+	arena->magic = ARENA_MAGIC;
+
+	*arenap = arena;
+	return (ISC_R_SUCCESS);
+}
+
+void
+isc_arena_destroy(isc_arena_t **arenap) {
+	isc_arena_t *arena;
+
+	REQUIRE(arenap != NULL && VALID_ARENA(*arenap));
+
+	arena = *arenap;
+	*arenap = NULL;
+
+	freeblocks(arena);
+	isc_mem_put(arena->mctx, arena->first,
+		    BLOCK_HEADER + arena->first->size);
+	arena->magic = 0;
+	isc_mem_putanddetach(&arena->mctx, arena, sizeof(*arena));
+}
+
+void *
+isc_arena_get(isc_arena_t *arena, size_t size) {
+	arenablock_t *block;
+	void *ptr;
+
+	REQUIRE(VALID_ARENA(arena));
+	REQUIRE(size > 0);
+
+	size = ARENA_ROUND(size);
+	if (size > arena->current->size - arena->used) {
+		block = newblock(arena, ISC_MAX(size, arena->blocksize));
+		if (block == NULL)
+			return (NULL);
+		block->next = arena->current;
+		arena->current = block;
+		arena->used = 0;
+	}
+
+	ptr = BLOCK_DATA(arena->current) + arena->used;
+	arena->used += size;
+	arena->inuse += size;
+	return (ptr);
+}
+
+void
+isc_arena_reset(isc_arena_t *arena) {
+	REQUIRE(VALID_ARENA(arena));
+
+	freeblocks(arena);
+	arena->used = 0;
+	arena->inuse = 0;
+}
+
+size_t
+isc_arena_inuse(isc_arena_t *arena) {
+	REQUIRE(VALID_ARENA(arena));
+
+	return (arena->inuse);
+}
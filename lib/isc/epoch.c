@@ -0,0 +1,489 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <stddef.h>
+#include <string.h>
+
+#include <isc/atomic.h>
+#include <isc/epoch.h>
+#include <isc/magic.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/os.h>
+#include <isc/platform.h>
+#include <isc/thread.h>
+#include <isc/util.h>
+
+#if defined(ISC_PLATFORM_HAVESTDATOMIC)
+#include <stdatomic.h>
+#endif
+
+#define EPOCH_MAGIC			ISC_MAGIC('E', 'p', 'o', 'c')
+#define VALID_EPOCH(e)			ISC_MAGIC_VALID(e, EPOCH_MAGIC)
+
+#define EPOCH_MAXSHARDS			64
+#define EPOCH_CACHELINE			64
+
+/*%
+ * Readers are counted separately for the last three epochs.  The epoch
+ * number wraps at a multiple of three below 2^31, so that 'epoch % 3'
+ * stays continuous across the wrap and the atomic fallbacks, which only
+ * work on signed 32-bit integers, can hold it.
+ */
+#define EPOCH_SLOTS			3
+#define EPOCH_MODULUS			(EPOCH_SLOTS * 0x20000000U)
+
+/*%
+ * A thread tries to release the objects it retired each time it has
+ * another EPOCH_BATCH of them pending.
+ */
+#define EPOCH_BATCH			64
+
+#if defined(ISC_PLATFORM_USETHREADS)
+#if defined(ISC_PLATFORM_HAVESTDATOMIC) && defined(ATOMIC_INT_LOCK_FREE)
+#define EPOCH_HAVESTDATOMIC 1
+#elif defined(ISC_PLATFORM_HAVEXADD)
+#define EPOCH_HAVEXADD 1
+#endif
+#endif
+
+#if defined(EPOCH_HAVESTDATOMIC)
+typedef atomic_int_fast32_t epochcounter_t;
+#else
+typedef isc_int32_t epochcounter_t;
+#endif
+
+typedef struct retired {
+	isc_epochaction_t	action;
+	void			*ctx;
+	void			*arg;
+	unsigned int		epoch;
+} retired_t;
+
+/*%
+ * Each shard is padded out to a whole number of cache lines.  'readers'
+ * is updated without a lock when atomic operations are available; the
+ * retired list is locked by 'lock'.
+ */
+typedef struct epochshard {
+	epochcounter_t		readers[EPOCH_SLOTS];
+	isc_mutex_t		lock;
+	retired_t		*retired;
+	unsigned int		count;
+	unsigned int		size;
+} epochshard_t;
+
+struct isc_epoch {
+	unsigned int		magic;
+	isc_mem_t		*mctx;
+	isc_mutex_t		lock;		/*%< serializes advance() */
+	epochcounter_t		epoch;
+	unsigned int		nshards;	/*%< a power of 2 */
+	size_t			stride;
+	void			*shardmem;	/*%< before alignment */
+	size_t			shardsize;
+	unsigned char		*shards;
+};
+
+#define SHARD(e, n) \
+	((epochshard_t *)((e)->shards + (n) * (e)->stride))
+
+/*%
+ * As with sharded statistics, thread 'n' uses shard 'n % nshards'.
+ */
+#define getshard(epoch)		isc_thread_shard((epoch)->nshards)
+
+/*
+ * Without atomic operations the epoch number and the reader counts are
+ * all protected by epoch->lock.  A shard lock may be held when taking
+ * epoch->lock, but not the other way around.
+ */
+static inline unsigned int
+load_epoch(isc_epoch_t *epoch) {
+#if defined(EPOCH_HAVESTDATOMIC)
+	return ((unsigned int)atomic_load(&epoch->epoch));
+#elif defined(EPOCH_HAVEXADD)
+	return ((unsigned int)isc_atomic_xadd(&epoch->epoch, 0));
+#else
+	unsigned int e;
+
+	LOCK(&epoch->lock);
+	e = (unsigned int)epoch->epoch;
+	UNLOCK(&epoch->lock);
+	return (e);
+#endif
+}
+
+/*
+ * Order the caller's earlier stores before its later loads.  The
+ * fallbacks need nothing here: isc_atomic_xadd() is a locked
+ * read-modify-write, and without atomics load_epoch() takes a lock.
+ */
+static inline void
+full_fence(void) {
+#if defined(EPOCH_HAVESTDATOMIC)
+	atomic_thread_fence(memory_order_seq_cst);
+#endif
+}
+
+/*
+ * Caller must hold epoch->lock.
+ */
+static inline void
+store_epoch(isc_epoch_t *epoch, unsigned int value) {
+#if defined(EPOCH_HAVESTDATOMIC)
+	atomic_store(&epoch->epoch, (isc_int32_t)value);
+#elif defined(EPOCH_HAVEXADD)
+	(void)isc_atomic_xadd(&epoch->epoch,
+			      (isc_int32_t)value - epoch->epoch);
+#else
+	epoch->epoch = (isc_int32_t)value;
+#endif
+}
+
+static inline void
+add_readers(isc_epoch_t *epoch, epochshard_t *shard, unsigned int slot,
+	    isc_int32_t delta)
+{
+#if defined(EPOCH_HAVESTDATOMIC)
+	UNUSED(epoch);
+	(void)atomic_fetch_add(&shard->readers[slot], delta);
+#elif defined(EPOCH_HAVEXADD)
+	UNUSED(epoch);
+	(void)isc_atomic_xadd(&shard->readers[slot], delta);
+#else
+	LOCK(&epoch->lock);
+	shard->readers[slot] += delta;
+	UNLOCK(&epoch->lock);
+#endif
+}
+
+/*
+ * Caller must hold epoch->lock, unless the epoch is being destroyed.
+ */
+static inline isc_int32_t
+load_readers(epochshard_t *shard, unsigned int slot) {
+#if defined(EPOCH_HAVESTDATOMIC)
+	return ((isc_int32_t)atomic_load(&shard->readers[slot]));
+#elif defined(EPOCH_HAVEXADD)
+	return (isc_atomic_xadd(&shard->readers[slot], 0));
+#else
+	return (shard->readers[slot]);
+#endif
+}
+
+/*
+ * Return ISC_TRUE if an object retired in epoch 'tag' may be released
+ * now that the epoch is 'current'.
+ */
+static inline isc_boolean_t
+expired(unsigned int current, unsigned int tag) {
+	return (ISC_TF((current + EPOCH_MODULUS - tag) % EPOCH_MODULUS >= 2));
+}
+
+/*
+ * Move to the next epoch if no reader remains from the previous one.
+ * Caller must hold epoch->lock.
+ */
+static isc_boolean_t
+advance(isc_epoch_t *epoch) {
+	unsigned int current, previous, i;
+
+	current = (unsigned int)epoch->epoch;
+	previous = (current + EPOCH_SLOTS - 1) % EPOCH_SLOTS;
+
+	for (i = 0; i < epoch->nshards; i++) {
+		if (load_readers(SHARD(epoch, i), previous) != 0)
+			return (ISC_FALSE);
+	}
+
+	store_epoch(epoch, (current + 1) % EPOCH_MODULUS);
+	return (ISC_TRUE);
+}
+
+/*
+ * Release the objects in 'shard' whose grace period has ended, or all
+ * of them if 'all' is true.  Objects are queued roughly in the order
+ * they were retired; stopping at the first one that must wait at worst
+ * delays the release of those behind it.
+ */
+static void
+release(isc_epoch_t *epoch, epochshard_t *shard, isc_boolean_t all) {
+	unsigned int current, i;
+	retired_t *r;
+
+	/*
+	 * Read the epoch only once the list is locked: every object on
+	 * the list was then retired no later than 'current'.
+	 */
+	LOCK(&shard->lock);
+	current = load_epoch(epoch);
+	for (i = 0; i < shard->count; i++) {
+		r = &shard->retired[i];
+		if (!all && !expired(current, r->epoch))
+			break;
+		(r->action)(r->ctx, r->arg);
+	}
+	if (i > 0 && i < shard->count)
+		memmove(shard->retired, shard->retired + i,
+			(shard->count - i) * sizeof(retired_t));
+	shard->count -= i;
+	UNLOCK(&shard->lock);
+}
+
+/*
+ * Wait until every critical section that is now in progress has ended.
+ */
+static void
+synchronize(isc_epoch_t *epoch) {
+	unsigned int start = load_epoch(epoch);
+
+	for (;;) {
+		LOCK(&epoch->lock);
+		(void)advance(epoch);
+		UNLOCK(&epoch->lock);
+		if (expired(load_epoch(epoch), start))
+			break;
+		isc_thread_yield();
+	}
+}
+
+isc_result_t
+isc_epoch_create(isc_mem_t *mctx, isc_epoch_t **epochp) {
+	isc_epoch_t *epoch;
+	epochshard_t *shard;
+	isc_result_t result;
+	unsigned int i, j;
+
+	REQUIRE(epochp != NULL && *epochp == NULL);
+
+	epoch = isc_mem_get(mctx, sizeof(*epoch));
+	if (epoch == NULL)
+		return (ISC_R_NOMEMORY);
+
+	result = isc_mutex_init(&epoch->lock);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_epoch;
+
+	epoch->nshards = 1;
+#ifdef ISC_PLATFORM_USETHREADS
+	while (epoch->nshards < isc_os_ncpus() &&
+	       epoch->nshards < EPOCH_MAXSHARDS)
+		epoch->nshards <<= 1;
+#endif
+	epoch->stride = (sizeof(epochshard_t) + EPOCH_CACHELINE - 1) &
+			~((size_t)EPOCH_CACHELINE - 1);
+	epoch->shardsize = epoch->stride * epoch->nshards + EPOCH_CACHELINE;
+	epoch->shardmem = isc_mem_get(mctx, epoch->shardsize);
+	if (epoch->shardmem == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup_lock;
+	}
+	epoch->shards = (unsigned char *)
+		(((size_t)epoch->shardmem + EPOCH_CACHELINE - 1) &
+		 ~((size_t)EPOCH_CACHELINE - 1));
+
+	for (i = 0; i < epoch->nshards; i++) {
+		shard = SHARD(epoch, i);
+		result = isc_mutex_init(&shard->lock);
+		if (result != ISC_R_SUCCESS) {
+			while (i-- > 0)
+				DESTROYLOCK(&SHARD(epoch, i)->lock);
+			goto cleanup_shards;
+		}
+		for (j = 0; j < EPOCH_SLOTS; j++) {
+#if defined(EPOCH_HAVESTDATOMIC)
+			atomic_init(&shard->readers[j], 0);
+#else
+			shard->readers[j] = 0;
+#endif
+		}
+		shard->retired = NULL;
+		shard->count = 0;
+		shard->size = 0;
+	}
+
+#if defined(EPOCH_HAVESTDATOMIC)
+	atomic_init(&epoch->epoch, 0);
+#else
+	epoch->epoch = 0;
+#endif
+	epoch->mctx = NULL;
+	isc_mem_attach(mctx, &epoch->mctx);
+	epoch->magic = EPOCH_MAGIC;
+
+	*epochp = epoch;
+	return (ISC_R_SUCCESS);
+
+ cleanup_shards:
+	isc_mem_put(mctx, epoch->shardmem, epoch->shardsize);
+ cleanup_lock:
+	DESTROYLOCK(&epoch->lock);
+ cleanup_epoch:
+	isc_mem_put(mctx, epoch, sizeof(*epoch));
+	return (result);
+}
+
+void
+isc_epoch_destroy(isc_epoch_t **epochp) {
+	isc_epoch_t *epoch;
+	epochshard_t *shard;
+	unsigned int i, j;
+
+	REQUIRE(epochp != NULL && VALID_EPOCH(*epochp));
+
+	epoch = *epochp;
+	*epochp = NULL;
+
+	for (i = 0; i < epoch->nshards; i++) {
+		shard = SHARD(epoch, i);
+		for (j = 0; j < EPOCH_SLOTS; j++)
+			INSIST(load_readers(shard, j) == 0);
+		release(epoch, shard, ISC_TRUE);
+		if (shard->retired != NULL)
+			isc_mem_put(epoch->mctx, shard->retired,
+				    shard->size * sizeof(retired_t));
+		DESTROYLOCK(&shard->lock);
+	}
+
+	epoch->magic = 0;
+	isc_mem_put(epoch->mctx, epoch->shardmem, epoch->shardsize);
+	DESTROYLOCK(&epoch->lock);
+	isc_mem_putanddetach(&epoch->mctx, epoch, sizeof(*epoch));
+}
+
+unsigned int
+isc_epoch_enter(isc_epoch_t *epoch) {
+	epochshard_t *shard;
+	unsigned int n, e;
+
+	REQUIRE(VALID_EPOCH(epoch));
+
+	n = getshard(epoch);
+	shard = SHARD(epoch, n);
+
+	/*
+	 * If the epoch moved on before we were counted, advance() may
+	 * not have seen us; count ourselves in the new epoch instead.
+	 */
+	for (;;) {
+		e = load_epoch(epoch);
+		add_readers(epoch, shard, e % EPOCH_SLOTS, 1);
+		if (load_epoch(epoch) == e)
+			break;
+		add_readers(epoch, shard, e % EPOCH_SLOTS, -1);
+	}
+
+	return ((n << 2) | (e % EPOCH_SLOTS));
+}
+
+void
+isc_epoch_exit(isc_epoch_t *epoch, unsigned int token) {
+	REQUIRE(VALID_EPOCH(epoch));
+	REQUIRE((token >> 2) < epoch->nshards &&
+		(token & 3) < EPOCH_SLOTS);
+
+	add_readers(epoch, SHARD(epoch, token >> 2), token & 3, -1);
+}
+
+void
+isc_epoch_retire(isc_epoch_t *epoch, isc_epochaction_t action,
+		 void *ctx, void *arg)
+{
+	epochshard_t *shard;
+	retired_t *retired;
+	unsigned int size, current;
+	isc_boolean_t due;
+
+	REQUIRE(VALID_EPOCH(epoch));
+	REQUIRE(action != NULL);
+
+	shard = SHARD(epoch, getshard(epoch));
+
+	LOCK(&shard->lock);
+	/*
+	 * The caller has just unlinked the object with a plain or
+	 * release store.  Without a full fence that store may become
+	 * visible only after the epoch is read, so a reader entering the
+	 * next epoch could still find the object, and it would be
+	 * released while that reader is using it.  Taking the shard
+	 * lock first is not enough, as acquiring a lock does not order
+	 * earlier stores before later loads.
+	 */
+	full_fence();
+	current = load_epoch(epoch);
+	if (shard->count == shard->size) {
+		size = (shard->size == 0) ? EPOCH_BATCH : shard->size * 2;
+		retired = isc_mem_get(epoch->mctx, size * sizeof(retired_t));
+		if (retired == NULL) {
+			UNLOCK(&shard->lock);
+			synchronize(epoch);
+			(action)(ctx, arg);
+			return;
+		}
+		if (shard->retired != NULL) {
+			memmove(retired, shard->retired,
+				shard->count * sizeof(retired_t));
+			isc_mem_put(epoch->mctx, shard->retired,
+				    shard->size * sizeof(retired_t));
+		}
+		shard->retired = retired;
+		shard->size = size;
+	}
+	retired = &shard->retired[shard->count++];
+	retired->action = action;
+	retired->ctx = ctx;
+	retired->arg = arg;
+	retired->epoch = current;
+	due = ISC_TF(shard->count % EPOCH_BATCH == 0);
+	UNLOCK(&shard->lock);
+
+	if (due) {
+		if (isc_mutex_trylock(&epoch->lock) == ISC_R_SUCCESS) {
+			(void)advance(epoch);
+			UNLOCK(&epoch->lock);
+		}
+		release(epoch, shard, ISC_FALSE);
+	}
+}
+
+void
+isc_epoch_reclaim(isc_epoch_t *epoch) {
+	unsigned int i;
+
+	REQUIRE(VALID_EPOCH(epoch));
+
+	LOCK(&epoch->lock);
+	if (advance(epoch))
+		(void)advance(epoch);
+	UNLOCK(&epoch->lock);
+
+	for (i = 0; i < epoch->nshards; i++)
+		release(epoch, SHARD(epoch, i), ISC_FALSE);
+}
+
+unsigned int
+isc_epoch_pending(isc_epoch_t *epoch) {
+	epochshard_t *shard;
+	unsigned int i, count = 0;
+
+	REQUIRE(VALID_EPOCH(epoch));
+
+	for (i = 0; i < epoch->nshards; i++) {
+		shard = SHARD(epoch, i);
+		LOCK(&shard->lock);
+		count += shard->count;
+		UNLOCK(&shard->lock);
+	}
+
+	return (count);
+}
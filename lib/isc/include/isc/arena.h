@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef ISC_ARENA_H
+#define ISC_ARENA_H 1
+
+/*****
+ ***** Module Info
+ *****/
+
+/*! \file isc/arena.h
+ *
+ * \brief Bump allocation of short lived objects.
+ *
+ * An isc_arena_t hands out memory from large blocks by advancing a
+ * pointer.  Objects are never freed individually: isc_arena_reset()
+ * releases everything allocated from the arena at once.  This suits
+ * objects which all live exactly as long as some unit of work, such
+ * as the processing of one request.
+ *
+ * Blocks are obtained from the memory context the arena was created
+ * with, so the memory context accounts for whole blocks rather than for
+ * each object.  The first block is kept when the arena is reset; any
+ * further blocks are returned to the memory context.
+ *
+ * MP:
+ *\li	An arena is not thread safe; the caller must ensure that it is
+ *	only used by one thread at a time.
+ */
+
+/***
+ *** Imports.
+ ***/
+
+#include <isc/lang.h>
+#include <isc/types.h>
+
+ISC_LANG_BEGINDECLS
+
+isc_result_t
+isc_arena_create(isc_mem_t *mctx, size_t blocksize, isc_arena_t **arenap);
+/*%<
+ * Create an arena which allocates memory from 'mctx' in blocks of at
+ * least 'blocksize' bytes.  The first block is allocated immediately.
+ *
+ * Requires:
+ *\li	'mctx' is a valid memory context.
+ *\li	'blocksize' is not zero.
+ *\li	'arenap' is not NULL and '*arenap' is NULL.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOMEMORY
+ */
+
+void
+isc_arena_destroy(isc_arena_t **arenap);
+/*%<
+ * Free every block of the arena and the arena itself.
+ *
+ * Requires:
+ *\li	'*arenap' is a valid arena.
+ *
+ * Ensures:
+ *\li	'*arenap' is NULL.
+ */
+
+void *
+isc_arena_get(isc_arena_t *arena, size_t size);
+/*%<
+ * Allocate 'size' bytes from 'arena', suitably aligned for any object.
+ * A request which does not fit in the current block starts a new one,
+ * which is as large as the request if that is larger than the arena's
+ * block size.
+ *
+ * The memory remains valid until the next isc_arena_reset() or
+ * isc_arena_destroy().
+ *
+ * Requires:
+ *\li	'arena' is a valid arena.
+ *\li	'size' is not zero.
+ *
+ * Returns:
+ *\li	A pointer to the memory, or NULL if a new block was needed and
+ *	could not be allocated.
+ */
+
+void
+isc_arena_reset(isc_arena_t *arena);
+/*%<
+ * Release everything allocated from 'arena'.  The first block is kept
+ * for reuse and the others are freed.
+ *
+ * Requires:
+ *\li	'arena' is a valid arena.
+ */
+
+size_t
+isc_arena_inuse(isc_arena_t *arena);
+/*%<
+ * Return the number of bytes handed out by 'arena' since it was last
+ * reset, including alignment padding.
+ *
+ * Requires:
+ *\li	'arena' is a valid arena.
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* ISC_ARENA_H */
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef ISC_EPOCH_H
+#define ISC_EPOCH_H 1
+
+/*****
+ ***** Module Info
+ *****/
+
+/*! \file isc/epoch.h
+ *
+ * \brief Epoch based memory reclamation.
+ *
+ * An isc_epoch_t lets readers walk a shared data structure without
+ * holding the lock that writers use to modify it.  Readers bracket
+ * each walk with isc_epoch_enter() and isc_epoch_exit().  A writer
+ * that unlinks an object from the structure does not free it, but
+ * passes it to isc_epoch_retire(); the object is released only after
+ * every reader that might have seen it has left its critical section.
+ *
+ * The epoch counter advances from 'e' to 'e + 1' only when no reader
+ * remains from epoch 'e - 1', so an object retired during epoch 'e'
+ * can be released once the counter has reached 'e + 2'.  Readers
+ * record themselves in per-thread shards so that entering and leaving
+ * a critical section does not bounce a shared cache line between CPUs.
+ *
+ * MP:
+ *\li	All functions are thread safe.  Critical sections may run
+ *	concurrently with each other and with isc_epoch_retire().
+ *
+ * Reliability:
+ *\li	isc_epoch_retire() cannot fail: when it is unable to queue an
+ *	object it waits for a grace period and releases the object
+ *	itself.
+ */
+
+/***
+ *** Imports.
+ ***/
+
+#include <isc/lang.h>
+#include <isc/types.h>
+
+/*****
+ ***** Types.
+ *****/
+
+typedef void (*isc_epochaction_t)(void *ctx, void *arg);
+
+ISC_LANG_BEGINDECLS
+
+isc_result_t
+isc_epoch_create(isc_mem_t *mctx, isc_epoch_t **epochp);
+/*%<
+ * Create an epoch object.
+ *
+ * Requires:
+ *\li	'mctx' is a valid memory context.
+ *\li	'epochp' is not NULL and '*epochp' is NULL.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOMEMORY
+ */
+
+void
+isc_epoch_destroy(isc_epoch_t **epochp);
+/*%<
+ * Release every retired object and destroy the epoch object.
+ *
+ * Requires:
+ *\li	'*epochp' is a valid epoch object with no reader in a critical
+ *	section.
+ */
+
+unsigned int
+isc_epoch_enter(isc_epoch_t *epoch);
+/*%<
+ * Begin a read side critical section.  Objects which are retired after
+ * this call are not released before the matching isc_epoch_exit().
+ *
+ * Critical sections may not be nested in the same thread for the same
+ * epoch object, and should be short: a long critical section delays
+ * the release of every object retired meanwhile.
+ *
+ * Returns a token which must be passed to isc_epoch_exit().
+ */
+
+void
+isc_epoch_exit(isc_epoch_t *epoch, unsigned int token);
+/*%<
+ * End the read side critical section started by the isc_epoch_enter()
+ * call which returned 'token'.
+ */
+
+void
+isc_epoch_retire(isc_epoch_t *epoch, isc_epochaction_t action,
+		 void *ctx, void *arg);
+/*%<
+ * Arrange for 'action(ctx, arg)' to be called once every critical
+ * section which was in progress when this function was called has
+ * ended.  The caller must already have made the object unreachable to
+ * new readers.
+ *
+ * Retired objects are released in batches, from whichever thread
+ * happens to retire an object when enough of them are pending, or from
+ * isc_epoch_reclaim().
+ *
+ * Requires:
+ *\li	The calling thread is not in a critical section of 'epoch'.
+ */
+
+void
+isc_epoch_reclaim(isc_epoch_t *epoch);
+/*%<
+ * Advance the epoch as far as the current readers allow and release
+ * every object whose grace period has ended.  This never waits for
+ * readers.
+ *
+ * Requires:
+ *\li	The calling thread is not in a critical section of 'epoch'.
+ */
+
+unsigned int
+isc_epoch_pending(isc_epoch_t *epoch);
+/*%<
+ * Return the number of retired objects that have not been released.
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* ISC_EPOCH_H */
@@ -376,6 +376,11 @@ isc_mem_inuse(isc_mem_t *mctx);
  * Get an estimate of the amount of memory in use in 'mctx', in bytes.
  * This includes quantization overhead, but does not include memory
  * allocated from the system but not yet used.
+ *
+ * When threads are in use, a locked context with the internal allocator
+ * keeps small free blocks in per-thread magazines rather than returning
+ * them to the context straight away.  Those blocks are counted as in
+ * use, so the estimate may be high by up to about 32KB for each CPU.
  */
 
 size_t
@@ -68,6 +68,7 @@
 #define isc_socket_detach isc__socket_detach
 #define isc_socketmgr_create isc__socketmgr_create
 #define isc_socketmgr_create2 isc__socketmgr_create2
+#define isc_socketmgr_create3 isc__socketmgr_create3
 #define isc_socketmgr_destroy isc__socketmgr_destroy
 #define isc_socket_open isc__socket_open
 #define isc_socket_close isc__socket_close
@@ -97,6 +98,8 @@
 #define isc_socket_isbound isc__socket_isbound
 #define isc_socket_ipv6only isc__socket_ipv6only
 #define isc_socket_setname isc__socket_setname
+#define isc_socket_setbatch isc__socket_setbatch
+#define isc_socket_setthread isc__socket_setthread
 #define isc_socketmgr_getmaxsockets isc__socketmgr_getmaxsockets
 #define isc_socketmgr_setstats isc__socketmgr_setstats
 #define isc_socketmgr_setreserved isc__socketmgr_setreserved
@@ -119,12 +122,25 @@ ISC_LANG_BEGINDECLS
  */
 #define ISC_SOCKET_MAXSCATTERGATHER	8
 
+/*%
+ * Maximum number of datagrams moved per system call on a socket that
+ * has batching enabled with isc_socket_setbatch().
+ */
+#define ISC_SOCKET_MAXBATCH		64
+
 /*%
  * In isc_socket_bind() set socket option SO_REUSEADDR prior to calling
  * bind() if a non zero port is specified (AF_INET and AF_INET6).
  */
 #define ISC_SOCKET_REUSEADDRESS		0x01U
 
+/*%
+ * In isc_socket_bind() set socket option SO_REUSEPORT prior to calling
+ * bind(), so that several sockets can be bound to the same address and
+ * port.  Ignored where SO_REUSEPORT is not available.
+ */
+#define ISC_SOCKET_REUSEPORT		0x02U
+
 /*%
  * Statistics counters.  Used as isc_statscounter_t values.
  */
@@ -254,6 +270,7 @@ struct isc_socket_connev {
  * _USEMINMTU:	Set the per packet IPV6_USE_MIN_MTU flag.
  */
 #define ISC_SOCKEVENTATTR_ATTACHED		0x80000000U /* internal */
+#define ISC_SOCKEVENTATTR_NORETRY		0x40000000U /* internal */
 #define ISC_SOCKEVENTATTR_TRUNC			0x00800000U /* public */
 #define ISC_SOCKEVENTATTR_CTRUNC		0x00400000U /* public */
 #define ISC_SOCKEVENTATTR_TIMESTAMP		0x00200000U /* public */
@@ -1058,6 +1075,27 @@ isc_socketmgr_create2(isc_mem_t *mctx, isc_socketmgr_t **managerp,
  *\li	#ISC_R_NOTIMPLEMENTED
  */
 
+isc_result_t
+isc_socketmgr_create3(isc_mem_t *mctx, isc_socketmgr_t **managerp,
+		      unsigned int maxsocks, unsigned int nthreads);
+/*%<
+ * Like isc_socketmgr_create2(), but run 'nthreads' watcher threads.
+ * Each socket is watched by one of them, chosen by descriptor unless
+ * set with isc_socket_setthread().  When there is more than one
+ * watcher thread, thread 'i' is bound to CPU 'i' (modulo the number
+ * of CPUs) where the platform supports it.
+ *
+ * 'nthreads' is forced to 1 in builds without threads and where the
+ * event notification mechanism cannot be shared (select(), /dev/poll).
+ * isc_socketmgr_create2() is equivalent to 'nthreads' being 1.
+ *
+ * Requires:
+ *
+ *\li	'nthreads' is greater than zero.
+ *
+ *\li	The requirements of isc_socketmgr_create2().
+ */
+
 isc_result_t
 isc_socketmgr_getmaxsockets(isc_socketmgr_t *manager, unsigned int *nsockp);
 /*%<
@@ -1201,6 +1239,42 @@ void isc_socket_setname(isc_socket_t *socket, const char *name, void *tag);
  * reporting.
  */
 
+isc_result_t
+isc_socket_setbatch(isc_socket_t *sock, unsigned int n);
+/*%<
+ * Enable batched I/O on the UDP socket 'sock': up to 'n' queued
+ * receive requests are filled by a single recvmmsg() call and up to
+ * 'n' queued send requests are flushed by a single sendmmsg() call.
+ * On a batching socket, isc_socket_recv*() and isc_socket_send*()
+ * always queue the request instead of attempting the I/O at once,
+ * trading a little latency for fewer system calls under load.
+ * A send made with ISC_SOCKFLAG_NORETRY is still dropped if the
+ * socket would block when the queue is flushed.
+ *
+ * 'n' is capped at #ISC_SOCKET_MAXBATCH; 0 or 1 disables batching.
+ * Where recvmmsg()/sendmmsg() are unavailable this is a no-op.
+ *
+ * Requires:
+ *\li	'sock' is a valid UDP socket.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOMEMORY
+ */
+
+void
+isc_socket_setthread(isc_socket_t *sock, unsigned int threadid);
+/*%<
+ * Have 'sock' watched by the socket manager's watcher thread
+ * 'threadid' (modulo the number of watcher threads), so that sockets
+ * sharing a port through #ISC_SOCKET_REUSEPORT can each be served by
+ * a separate thread.  This is a no-op if the manager has one thread.
+ *
+ * Requires:
+ *\li	'sock' is a valid, open socket other than an fdwatch socket,
+ *	with no I/O started on it yet.
+ */
+
 const char *isc_socket_getname(isc_socket_t *socket);
 /*%<
  * Get the name associated with a socket, if any.
@@ -22,6 +22,11 @@ ISC_LANG_BEGINDECLS
  */
 #define ISC_STATSDUMP_VERBOSE	0x00000001 /*%< dump 0-value counters */
 
+/*%<
+ * Flag(s) for isc_stats_create2().
+ */
+#define ISC_STATSCREATE_SHARDED	0x00000001 /*%< per-CPU counter shards */
+
 /*%<
  * Dump callback type.
  */
@@ -44,6 +49,29 @@ isc_stats_create(isc_mem_t *mctx, isc_stats_t **statsp, int ncounters);
  *\li	anything else	-- failure
  */
 
+isc_result_t
+isc_stats_create2(isc_mem_t *mctx, isc_stats_t **statsp, int ncounters,
+		  unsigned int options);
+/*%<
+ * Like isc_stats_create(), but with 'options'.  If ISC_STATSCREATE_SHARDED
+ * is set, a separate set of counters is kept for each CPU, up to a limit,
+ * and threads update different sets; the sets are summed whenever the
+ * counters are read.  This makes updates cheap for counters which are
+ * changed by many threads at once, such as per-query statistics, at the
+ * cost of memory, so it should not be used for per-zone statistics.
+ * Without threads ISC_STATSCREATE_SHARDED is ignored.
+ *
+ * Requires:
+ *\li	'mctx' must be a valid memory context.
+ *
+ *\li	'statsp' != NULL && '*statsp' == NULL.
+ *
+ * Returns:
+ *\li	ISC_R_SUCCESS	-- all ok
+ *
+ *\li	anything else	-- failure
+ */
+
 void
 isc_stats_attach(isc_stats_t *stats, isc_stats_t **statsp);
 /*%<
@@ -202,6 +202,22 @@ isc_task_create(isc_taskmgr_t *manager, unsigned int quantum,
  *\li	#ISC_R_SHUTTINGDOWN
  */
 
+isc_result_t
+isc_task_create_bound(isc_taskmgr_t *manager, unsigned int quantum,
+		      isc_task_t **taskp, int threadid);
+/*%<
+ * Like isc_task_create(), but the task is made ready on the run queue
+ * of worker 'threadid' (modulo the number of workers) rather than on
+ * the next queue in turn.  The worker threads are pinned to CPUs in
+ * order, so this lets a caller keep a task on the same CPU as, for
+ * instance, the socket watcher thread feeding it.  A task may still be
+ * run by another worker that has run out of work of its own.
+ *
+ * A negative 'threadid' is the same as calling isc_task_create().
+ *
+ * Requires and returns as isc_task_create().
+ */
+
 void
 isc_task_attach(isc_task_t *source, isc_task_t **targetp);
 /*%<
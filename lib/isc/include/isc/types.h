@@ -32,6 +32,7 @@
 /* Core Types.  Alphabetized by defined type. */
 
 typedef struct isc_appctx		isc_appctx_t;	 	/*%< Application context */
+typedef struct isc_arena		isc_arena_t;		/*%< Arena */
 typedef struct isc_backtrace_symmap	isc_backtrace_symmap_t; /*%< Symbol Table Entry */
 typedef struct isc_buffer		isc_buffer_t;		/*%< Buffer */
 typedef ISC_LIST(isc_buffer_t)		isc_bufferlist_t;	/*%< Buffer List */
@@ -41,6 +42,7 @@ typedef struct isc_counter		isc_counter_t;		/*%< Counter */
 typedef isc_int16_t			isc_dscp_t;		/*%< Diffserv code point */
 typedef struct isc_entropy		isc_entropy_t;		/*%< Entropy */
 typedef struct isc_entropysource	isc_entropysource_t;	/*%< Entropy Source */
+typedef struct isc_epoch		isc_epoch_t;		/*%< Epoch */
 typedef struct isc_event		isc_event_t;		/*%< Event */
 typedef ISC_LIST(isc_event_t)		isc_eventlist_t;	/*%< Event List */
 typedef unsigned int			isc_eventtype_t;	/*%< Event Type */
@@ -23,9 +23,11 @@
 #include <isc/mem.h>
 #include <isc/msgs.h>
 #include <isc/once.h>
+#include <isc/os.h>
 #include <isc/string.h>
 #include <isc/mutex.h>
 #include <isc/print.h>
+#include <isc/thread.h>
 #include <isc/util.h>
 #include <isc/xml.h>
 
@@ -48,6 +50,10 @@ LIBISC_EXTERNAL_DATA unsigned int isc_mem_defaultflags = ISC_MEMFLAG_DEFAULT;
 #define NUM_BASIC_BLOCKS	64		/*%< must be > 1 */
 #define TABLE_INCREMENT		1024
 #define DEBUG_TABLE_COUNT	65536
+#define MAGAZINE_BYTES		2048		/*%< per size class */
+#define MAGAZINE_BUDGET		32768		/*%< per shard */
+#define MAGAZINE_MAXSHARDS	64
+#define MAGAZINE_CACHELINE	64
 
 /*
  * Types.
@@ -97,6 +103,24 @@ struct stats {
 	unsigned long		freefrags;
 };
 
+/*%
+ * A magazine caches free blocks of one size class for one shard.
+ */
+typedef struct magazine {
+	element *		items;
+	unsigned int		count;
+} magazine_t;
+
+/*%
+ * 'magazines' is indexed by size class and is allocated when the shard
+ * is first used.  Everything in a shard is locked by 'lock'.
+ */
+typedef struct memshard {
+	isc_mutex_t		lock;
+	magazine_t *		magazines;
+	size_t			cached;		/*%< bytes in magazines */
+} memshard_t;
+
 #define MEM_MAGIC		ISC_MAGIC('M', 'e', 'm', 'C')
 #define VALID_CONTEXT(c)	ISC_MAGIC_VALID(c, MEM_MAGIC)
 
@@ -152,6 +176,13 @@ struct isc__mem {
 	unsigned char *		lowest;
 	unsigned char *		highest;
 
+	/*  Magazines, if nshards != 0 */
+	unsigned int		nshards;	/*%< a power of 2 */
+	size_t			shardstride;
+	void *			shardmem;	/*%< before alignment */
+	size_t			shardsize;
+	unsigned char *		shards;
+
 #if ISC_MEM_TRACKLINES
 	debuglist_t *	 	debuglist;
 	size_t			debuglistcnt;
@@ -161,6 +192,11 @@ struct isc__mem {
 	ISC_LINK(isc__mem_t)	link;
 };
 
+#define SHARD(c, n) \
+	((memshard_t *)((c)->shards + (n) * (c)->shardstride))
+#define STATSIZE(c, size, new_size) \
+	((c)->nshards != 0 ? (new_size) : (size))
+
 #define MEMPOOL_MAGIC		ISC_MAGIC('M', 'E', 'M', 'p')
 #define VALID_MEMPOOL(c)	ISC_MAGIC_VALID(c, MEMPOOL_MAGIC)
 
@@ -676,10 +712,12 @@ mem_getunlocked(isc__mem_t *ctx, size_t size) {
 	 * The stats[] uses the _actual_ "size" requested by the
 	 * caller, with the caveat (in the code above) that "size" >= the
 	 * max. size (max_size) ends up getting recorded as a call to
-	 * max_size.
+	 * max_size.  With magazines, blocks move between the free lists
+	 * and the magazines without their requested size being known,
+	 * so the "rounded-up" size is used instead.
 	 */
-	ctx->stats[size].gets++;
-	ctx->stats[size].totalgets++;
+	ctx->stats[STATSIZE(ctx, size, new_size)].gets++;
+	ctx->stats[STATSIZE(ctx, size, new_size)].totalgets++;
 	ctx->stats[new_size].freefrags--;
 	ctx->inuse += new_size;
 
@@ -744,14 +782,340 @@ mem_putunlocked(isc__mem_t *ctx, void *mem, size_t size) {
 	 * The stats[] uses the _actual_ "size" requested by the
 	 * caller, with the caveat (in the code above) that "size" >= the
 	 * max. size (max_size) ends up getting recorded as a call to
-	 * max_size.
+	 * max_size, and that with magazines the "rounded-up" size is used.
 	 */
-	INSIST(ctx->stats[size].gets != 0U);
-	ctx->stats[size].gets--;
+	INSIST(ctx->stats[STATSIZE(ctx, size, new_size)].gets != 0U);
+	ctx->stats[STATSIZE(ctx, size, new_size)].gets--;
 	ctx->stats[new_size].freefrags++;
 	ctx->inuse -= new_size;
 }
 
+/*
+ * Magazines.
+ *
+ * Each shard of a context caches free blocks of every size class below
+ * max_size.  isc___mem_get() and isc___mem_put() only take the shard
+ * lock while a magazine can satisfy them, and move blocks between the
+ * magazines and the context's free lists in bulk when it cannot.
+ *
+ * Blocks in magazines are counted in ctx->inuse, so that the water
+ * marks only need checking when blocks move in bulk, at the cost of
+ * isc_mem_inuse() overstating what is in use by up to about
+ * MAGAZINE_BUDGET per shard.
+ *
+ * A shard lock may be held when taking the context lock, but not the
+ * other way around.  Thread 'n' uses the magazines of shard
+ * 'n % nshards'.
+ */
+
+static inline unsigned int
+getshard(isc__mem_t *ctx) {
+#ifdef ISC_PLATFORM_USETHREADS
+	return (isc_thread_shard(ctx->nshards));
+#else
+	UNUSED(ctx);
+	return (0);
+#endif
+}
+
+/*%
+ * The number of blocks of 'new_size' bytes a magazine may hold.
+ */
+static inline unsigned int
+capacity(size_t new_size) {
+	unsigned int n = MAGAZINE_BYTES / new_size;
+
+	return (n < 2 ? 2 : n);
+}
+
+/*%
+ * Return the blocks of 'mag' beyond the first 'keep' to the free lists.
+ * Requires that we hold the shard lock and the context lock.
+ */
+static void
+flush(isc__mem_t *ctx, memshard_t *shard, magazine_t *mag, size_t new_size,
+      unsigned int keep)
+{
+	element *item;
+
+	while (mag->count > keep) {
+		item = mag->items;
+		mag->items = item->next;
+		mag->count--;
+
+		item->next = ctx->freelists[new_size];
+		ctx->freelists[new_size] = item;
+
+		INSIST(ctx->stats[new_size].gets != 0U);
+		ctx->stats[new_size].gets--;
+		ctx->stats[new_size].freefrags++;
+		INSIST(new_size <= ctx->inuse);
+		ctx->inuse -= new_size;
+		shard->cached -= new_size;
+	}
+}
+
+/*%
+ * Return every block in 'shard' to the free lists.
+ * Requires that we hold the shard lock and the context lock.
+ */
+static void
+flushall(isc__mem_t *ctx, memshard_t *shard) {
+	size_t new_size;
+
+	for (new_size = ALIGNMENT_SIZE;
+	     new_size < ctx->max_size && shard->cached > 0;
+	     new_size += ALIGNMENT_SIZE)
+		flush(ctx, shard, &shard->magazines[new_size / ALIGNMENT_SIZE],
+		      new_size, 0);
+	INSIST(shard->cached == 0);
+}
+
+/*%
+ * Move up to half a magazine of blocks of 'new_size' bytes from the
+ * free lists to the magazine, returning ISC_FALSE if none could be
+ * moved.  Requires that we hold the shard lock.
+ */
+static isc_boolean_t
+refill(isc__mem_t *ctx, memshard_t *shard, size_t new_size,
+       isc_boolean_t *call_water)
+{
+	magazine_t *mag;
+	element *item;
+	unsigned int want;
+	size_t size;
+
+	LOCK(&ctx->lock);
+
+	if (shard->magazines == NULL) {
+		size = (ctx->max_size / ALIGNMENT_SIZE + 1) *
+			sizeof(magazine_t);
+		shard->magazines = (ctx->memalloc)(ctx->arg, size);
+		if (shard->magazines == NULL) {
+			ctx->memalloc_failures++;
+			UNLOCK(&ctx->lock);
+			return (ISC_FALSE);
+		}
+		memset(shard->magazines, 0, size);
+		ctx->malloced += size;
+		if (ctx->malloced > ctx->maxmalloced)
+			ctx->maxmalloced = ctx->malloced;
+	}
+
+	mag = &shard->magazines[new_size / ALIGNMENT_SIZE];
+	want = capacity(new_size) / 2;
+	while (mag->count < want) {
+		if (ctx->freelists[new_size] == NULL &&
+		    !more_frags(ctx, new_size))
+			break;
+
+		item = ctx->freelists[new_size];
+		ctx->freelists[new_size] = item->next;
+		item->next = mag->items;
+		mag->items = item;
+		mag->count++;
+
+		ctx->stats[new_size].gets++;
+		ctx->stats[new_size].totalgets++;
+		ctx->stats[new_size].freefrags--;
+		ctx->inuse += new_size;
+		shard->cached += new_size;
+	}
+
+	if (ctx->hi_water != 0U && ctx->inuse > ctx->hi_water) {
+		ctx->is_overmem = ISC_TRUE;
+		if (!ctx->hi_called)
+			*call_water = ISC_TRUE;
+	}
+	if (ctx->inuse > ctx->maxinuse)
+		ctx->maxinuse = ctx->inuse;
+
+	UNLOCK(&ctx->lock);
+
+	return (ISC_TF(mag->count != 0));
+}
+
+static inline void *
+magazine_get(isc__mem_t *ctx, size_t size, isc_boolean_t *call_water) {
+	size_t new_size = quantize(size);
+	memshard_t *shard;
+	magazine_t *mag;
+	element *item;
+
+	shard = SHARD(ctx, getshard(ctx));
+	LOCK(&shard->lock);
+
+	if (shard->magazines == NULL ||
+	    shard->magazines[new_size / ALIGNMENT_SIZE].count == 0)
+	{
+		if (!refill(ctx, shard, new_size, call_water)) {
+			UNLOCK(&shard->lock);
+			return (NULL);
+		}
+	}
+
+	mag = &shard->magazines[new_size / ALIGNMENT_SIZE];
+	item = mag->items;
+	mag->items = item->next;
+	mag->count--;
+	shard->cached -= new_size;
+
+	UNLOCK(&shard->lock);
+
+	if (ISC_UNLIKELY((ctx->flags & ISC_MEMFLAG_FILL) != 0))
+		memset(item, 0xbe, new_size); /* Mnemonic for "beef". */
+
+	return (item);
+}
+
+/*%
+ * Put 'mem' in a magazine, returning ISC_FALSE if it should go straight
+ * back to the free lists instead.  That is the case while the context
+ * is over its high water mark, so that dropping below the low water mark
+ * is noticed as soon as it happens, and in threads whose shard has never
+ * allocated anything.
+ */
+static inline isc_boolean_t
+magazine_put(isc__mem_t *ctx, void *mem, size_t size,
+	     isc_boolean_t *call_water)
+{
+	size_t new_size = quantize(size);
+	memshard_t *shard;
+	magazine_t *mag;
+
+	if (ctx->is_overmem)
+		return (ISC_FALSE);
+
+	shard = SHARD(ctx, getshard(ctx));
+	LOCK(&shard->lock);
+
+	if (shard->magazines == NULL) {
+		UNLOCK(&shard->lock);
+		return (ISC_FALSE);
+	}
+
+	if (ISC_UNLIKELY((ctx->flags & ISC_MEMFLAG_FILL) != 0)) {
+#if ISC_MEM_CHECKOVERRUN
+		check_overrun(mem, size, new_size);
+#endif
+		memset(mem, 0xde, new_size); /* Mnemonic for "dead". */
+	}
+
+	mag = &shard->magazines[new_size / ALIGNMENT_SIZE];
+	((element *)mem)->next = mag->items;
+	mag->items = (element *)mem;
+	mag->count++;
+	shard->cached += new_size;
+
+	if (mag->count >= capacity(new_size) ||
+	    shard->cached > MAGAZINE_BUDGET)
+	{
+		LOCK(&ctx->lock);
+		if (shard->cached > MAGAZINE_BUDGET)
+			flushall(ctx, shard);
+		else
+			flush(ctx, shard, mag, new_size,
+			      capacity(new_size) / 2);
+		/*
+		 * See isc___mem_put().
+		 */
+		if ((ctx->inuse < ctx->lo_water) || (ctx->lo_water == 0U)) {
+			ctx->is_overmem = ISC_FALSE;
+			if (ctx->hi_called)
+				*call_water = ISC_TRUE;
+		}
+		UNLOCK(&ctx->lock);
+	}
+
+	UNLOCK(&shard->lock);
+
+	return (ISC_TRUE);
+}
+
+/*%
+ * Set up magazines for 'ctx' if it is locked, uses the internal
+ * allocator and there may be more than one thread.
+ */
+static isc_result_t
+magazines_create(isc__mem_t *ctx) {
+#ifdef ISC_PLATFORM_USETHREADS
+	memshard_t *shard;
+	unsigned int i;
+	isc_result_t result;
+#endif
+
+	ctx->nshards = 0;
+	ctx->shards = NULL;
+	ctx->shardmem = NULL;
+#ifdef ISC_PLATFORM_USETHREADS
+	if ((ctx->flags & (ISC_MEMFLAG_NOLOCK|ISC_MEMFLAG_INTERNAL)) !=
+	    ISC_MEMFLAG_INTERNAL)
+		return (ISC_R_SUCCESS);
+
+	ctx->nshards = 1;
+	while (ctx->nshards < isc_os_ncpus() &&
+	       ctx->nshards < MAGAZINE_MAXSHARDS)
+		ctx->nshards <<= 1;
+
+	ctx->shardstride = (sizeof(memshard_t) + MAGAZINE_CACHELINE - 1) &
+			   ~((size_t)MAGAZINE_CACHELINE - 1);
+	ctx->shardsize = ctx->shardstride * ctx->nshards + MAGAZINE_CACHELINE;
+	ctx->shardmem = (ctx->memalloc)(ctx->arg, ctx->shardsize);
+	if (ctx->shardmem == NULL) {
+		ctx->nshards = 0;
+		return (ISC_R_NOMEMORY);
+	}
+	ctx->malloced += ctx->shardsize;
+	ctx->maxmalloced += ctx->shardsize;
+	ctx->shards = (unsigned char *)
+		(((size_t)ctx->shardmem + MAGAZINE_CACHELINE - 1) &
+		 ~((size_t)MAGAZINE_CACHELINE - 1));
+
+	for (i = 0; i < ctx->nshards; i++) {
+		shard = SHARD(ctx, i);
+		result = isc_mutex_init(&shard->lock);
+		if (result != ISC_R_SUCCESS) {
+			while (i-- > 0)
+				DESTROYLOCK(&SHARD(ctx, i)->lock);
+			(ctx->memfree)(ctx->arg, ctx->shardmem);
+			ctx->malloced -= ctx->shardsize;
+			ctx->shardmem = NULL;
+			ctx->nshards = 0;
+			return (result);
+		}
+		shard->magazines = NULL;
+		shard->cached = 0;
+	}
+#endif
+	return (ISC_R_SUCCESS);
+}
+
+/*%
+ * Return everything in the magazines of 'ctx' to its free lists and
+ * free the magazines.  No other thread may be using 'ctx'.
+ */
+static void
+magazines_destroy(isc__mem_t *ctx) {
+	memshard_t *shard;
+	unsigned int i;
+
+	for (i = 0; i < ctx->nshards; i++) {
+		shard = SHARD(ctx, i);
+		if (shard->magazines != NULL) {
+			flushall(ctx, shard);
+			(ctx->memfree)(ctx->arg, shard->magazines);
+			ctx->malloced -= (ctx->max_size / ALIGNMENT_SIZE + 1) *
+					 sizeof(magazine_t);
+		}
+		DESTROYLOCK(&shard->lock);
+	}
+	if (ctx->shardmem != NULL) {
+		(ctx->memfree)(ctx->arg, ctx->shardmem);
+		ctx->malloced -= ctx->shardsize;
+	}
+	ctx->nshards = 0;
+}
+
 /*!
  * Perform a malloc, doing memory filling and overrun detection as necessary.
  */
@@ -951,6 +1315,8 @@ isc_mem_createx2(size_t init_max_size, size_t target_size,
 	ctx->basic_table_size = 0;
 	ctx->lowest = NULL;
 	ctx->highest = NULL;
+	ctx->nshards = 0;
+	ctx->shardmem = NULL;
 
 	ctx->stats = (memalloc)(arg,
 				(ctx->max_size+1) * sizeof(struct stats));
@@ -979,6 +1345,10 @@ isc_mem_createx2(size_t init_max_size, size_t target_size,
 		ctx->maxmalloced += ctx->max_size * sizeof(element *);
 	}
 
+	result = magazines_create(ctx);
+	if (result != ISC_R_SUCCESS)
+		goto error;
+
 #if ISC_MEM_TRACKLINES
 	if (ISC_UNLIKELY((isc_mem_debugging & ISC_MEM_DEBUGRECORD) != 0)) {
 		unsigned int i;
@@ -1011,6 +1381,8 @@ isc_mem_createx2(size_t init_max_size, size_t target_size,
 			(memfree)(arg, ctx->stats);
 		if (ctx->freelists != NULL)
 			(memfree)(arg, ctx->freelists);
+		if (ctx->shardmem != NULL)
+			magazines_destroy(ctx);
 #if ISC_MEM_TRACKLINES
 		if (ctx->debuglist != NULL)
 			(ctx->memfree)(ctx->arg, ctx->debuglist);
@@ -1027,6 +1399,9 @@ static void
 destroy(isc__mem_t *ctx) {
 	unsigned int i;
 
+	if (ctx->nshards != 0)
+		magazines_destroy(ctx);
+
 	LOCK(&contextslock);
 	ISC_LIST_UNLINK(contexts, ctx, link);
 	totallost += ctx->inuse;
@@ -1249,6 +1624,15 @@ isc___mem_get(isc_mem_t *ctx0, size_t size FLARG) {
 			  (ISC_MEM_DEBUGSIZE|ISC_MEM_DEBUGCTX)) != 0))
 		return (isc__mem_allocate(ctx0, size FLARG_PASS));
 
+	if (ctx->nshards != 0 && quantize(size) < ctx->max_size &&
+	    ISC_LIKELY(isc_mem_debugging == 0))
+	{
+		ptr = magazine_get(ctx, size, &call_water);
+		if (call_water && (ctx->water != NULL))
+			(ctx->water)(ctx->water_arg, ISC_MEM_HIWATER);
+		return (ptr);
+	}
+
 	if ((ctx->flags & ISC_MEMFLAG_INTERNAL) != 0) {
 		MCTXLOCK(ctx, &ctx->lock);
 		ptr = mem_getunlocked(ctx, size);
@@ -1305,6 +1689,15 @@ isc___mem_put(isc_mem_t *ctx0, void *ptr, size_t size FLARG) {
 		return;
 	}
 
+	if (ctx->nshards != 0 && quantize(size) < ctx->max_size &&
+	    ISC_LIKELY(isc_mem_debugging == 0) &&
+	    magazine_put(ctx, ptr, size, &call_water))
+	{
+		if (call_water && (ctx->water != NULL))
+			(ctx->water)(ctx->water_arg, ISC_MEM_LOWATER);
+		return;
+	}
+
 	MCTXLOCK(ctx, &ctx->lock);
 
 	DELETE_TRACE(ctx, ptr, size, file, line);
@@ -30,6 +30,12 @@ isc_thread_setconcurrency(unsigned int level);
 void
 isc_thread_setname(isc_thread_t thread, const char *name);
 
+isc_result_t
+isc_thread_setaffinity(isc_thread_t thread, int cpu);
+
+unsigned int
+isc_thread_shard(unsigned int max);
+
 #define isc_thread_self() ((unsigned long)0)
 #define isc_thread_yield() ((void)0)
 
@@ -42,6 +42,23 @@ isc_thread_yield(void);
 void
 isc_thread_setname(isc_thread_t thread, const char *name);
 
+isc_result_t
+isc_thread_setaffinity(isc_thread_t thread, int cpu);
+/*%<
+ * Bind 'thread' to CPU 'cpu'.  Returns ISC_R_NOTIMPLEMENTED where
+ * the platform cannot do this.
+ */
+
+unsigned int
+isc_thread_shard(unsigned int max);
+/*%<
+ * Return the calling thread's number modulo 'max', for picking which
+ * of 'max' per-thread shards of a data structure the thread uses.
+ * Threads are numbered in the order in which they first call this
+ * function, so that the first 'max' threads get a shard each.
+ * Returns 0 if 'max' is 0 or 1.
+ */
+
 /* XXX We could do fancier error handling... */
 
 #define isc_thread_join(t, rp) \
@@ -16,6 +16,8 @@
 #include <sched.h>
 #endif
 
+#include <isc/mutex.h>
+#include <isc/once.h>
 #include <isc/thread.h>
 #include <isc/util.h>
 
@@ -86,6 +88,28 @@ isc_thread_setname(isc_thread_t thread, const char *name) {
 #endif
 }
 
+isc_result_t
+isc_thread_setaffinity(isc_thread_t thread, int cpu) {
+#if defined(HAVE_PTHREAD_SETAFFINITY_NP) && defined(CPU_SET)
+	cpu_set_t set;
+
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+		return (ISC_R_RANGE);
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0)
+		return (ISC_R_UNEXPECTED);
+
+	return (ISC_R_SUCCESS);
+#else
+	UNUSED(thread);
+	UNUSED(cpu);
+
+	return (ISC_R_NOTIMPLEMENTED);
+#endif
+}
+
 void
 isc_thread_yield(void) {
 #if defined(HAVE_SCHED_YIELD)
@@ -96,3 +120,41 @@ isc_thread_yield(void) {
 	pthread_yield_np();
 #endif
 }
+
+/*
+ * Threads are numbered in the order in which they first ask for a
+ * shard; the number, plus one, is kept in thread specific data.
+ */
+static isc_once_t shard_once = ISC_ONCE_INIT;
+static isc_thread_key_t shard_key;
+static isc_mutex_t shard_lock;
+static unsigned int shard_next = 0;
+
+static void
+shard_initialize(void) {
+	RUNTIME_CHECK(isc_mutex_init(&shard_lock) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_thread_key_create(&shard_key, NULL) == 0);
+}
+
+unsigned int
+isc_thread_shard(unsigned int max) {
+	void *value;
+	unsigned int n;
+
+	if (max <= 1)
+		return (0);
+
+	RUNTIME_CHECK(isc_once_do(&shard_once, shard_initialize) ==
+		      ISC_R_SUCCESS);
+
+	value = isc_thread_key_getspecific(shard_key);
+	if (value != NULL)
+		return (((unsigned int)(size_t)value - 1) % max);
+
+	LOCK(&shard_lock);
+	n = shard_next++;
+	UNLOCK(&shard_lock);
+	(void)isc_thread_key_setspecific(shard_key, (void *)(size_t)(n + 1));
+
+	return (n % max);
+}
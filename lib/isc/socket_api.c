@@ -235,6 +235,27 @@ isc_socket_setname(isc_socket_t *sock, const char *name, void *tag) {
 	UNUSED(tag);
 }
 
+isc_result_t
+isc_socket_setbatch(isc_socket_t *sock, unsigned int n) {
+	REQUIRE(ISCAPI_SOCKET_VALID(sock));
+
+	if (isc_bind9)
+		return (isc__socket_setbatch(sock, n));
+
+	UNUSED(n);
+	return (ISC_R_SUCCESS);
+}
+
+void
+isc_socket_setthread(isc_socket_t *sock, unsigned int threadid) {
+	REQUIRE(ISCAPI_SOCKET_VALID(sock));
+
+	if (isc_bind9)
+		isc__socket_setthread(sock, threadid);
+
+	UNUSED(threadid);
+}
+
 isc_result_t
 isc_socket_fdwatchcreate(isc_socketmgr_t *manager, int fd, int flags,
 			 isc_sockfdwatch_t callback, void *cbarg,
@@ -301,6 +322,13 @@ isc_socketmgr_create2(isc_mem_t *mctx, isc_socketmgr_t **managerp,
 	return (isc__socketmgr_create2(mctx, managerp, maxsocks));
 }
 
+isc_result_t
+isc_socketmgr_create3(isc_mem_t *mctx, isc_socketmgr_t **managerp,
+		       unsigned int maxsocks, unsigned int nthreads)
+{
+	return (isc__socketmgr_create3(mctx, managerp, maxsocks, nthreads));
+}
+
 isc_result_t
 isc_socket_recvv(isc_socket_t *sock, isc_bufferlist_t *buflist,
 		 unsigned int minimum, isc_task_t *task,
@@ -18,10 +18,13 @@
 #include <isc/buffer.h>
 #include <isc/magic.h>
 #include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/os.h>
 #include <isc/platform.h>
 #include <isc/print.h>
 #include <isc/rwlock.h>
 #include <isc/stats.h>
+#include <isc/thread.h>
 #include <isc/util.h>
 
 #if defined(ISC_PLATFORM_HAVESTDATOMIC)
@@ -31,6 +34,15 @@
 #define ISC_STATS_MAGIC			ISC_MAGIC('S', 't', 'a', 't')
 #define ISC_STATS_VALID(x)		ISC_MAGIC_VALID(x, ISC_STATS_MAGIC)
 
+/*%
+ * Sharded statistics keep one copy of the counters per shard, and each
+ * thread updates the shard it was given on first use, so that threads
+ * running on different CPUs don't fight over the same cache lines.
+ * The shards are only summed when the counters are read.
+ */
+#define ISC_STATS_MAXSHARDS		64
+#define ISC_STATS_CACHELINE		64
+
 /*%
  * Local macro confirming prescence of 64-bit
  * increment and store operations, just to make
@@ -101,6 +113,10 @@ struct isc_stats {
 	unsigned int	magic;
 	isc_mem_t	*mctx;
 	int		ncounters;
+	unsigned int	nshards;	/* a power of 2 */
+	unsigned int	stride;		/* counters per shard, padded */
+	void		*countermem;	/* 'counters' before alignment */
+	size_t		countersize;
 
 	isc_mutex_t	lock;
 	unsigned int	references; /* locked by lock */
@@ -128,10 +144,18 @@ struct isc_stats {
 	isc_uint64_t	*copiedcounters;
 };
 
+/*%
+ * Thread 'n' uses shard 'n % nshards' of every sharded statistics set.
+ */
+#define getshard(stats)		isc_thread_shard((stats)->nshards)
+
 static isc_result_t
-create_stats(isc_mem_t *mctx, int ncounters, isc_stats_t **statsp) {
+create_stats(isc_mem_t *mctx, int ncounters, unsigned int options,
+	     isc_stats_t **statsp)
+{
 	isc_stats_t *stats;
 	isc_result_t result = ISC_R_SUCCESS;
+	unsigned int ncpus, perline;
 
 	REQUIRE(statsp != NULL && *statsp == NULL);
 
@@ -143,11 +167,45 @@ create_stats(isc_mem_t *mctx, int ncounters, isc_stats_t **statsp) {
 	if (result != ISC_R_SUCCESS)
 		goto clean_stats;
 
-	stats->counters = isc_mem_get(mctx, sizeof(isc_stat_t) * ncounters);
-	if (stats->counters == NULL) {
+	stats->nshards = 1;
+	stats->stride = ncounters;
+#ifdef ISC_PLATFORM_USETHREADS
+	if ((options & ISC_STATSCREATE_SHARDED) != 0) {
+		ncpus = isc_os_ncpus();
+		while (stats->nshards < ncpus &&
+		       stats->nshards < ISC_STATS_MAXSHARDS)
+			stats->nshards <<= 1;
+		/*
+		 * Pad each shard out to a whole number of cache lines.
+		 */
+		perline = ISC_STATS_CACHELINE / sizeof(isc_stat_t);
+		if (perline == 0)
+			perline = 1;
+		stats->stride = (ncounters + perline - 1) / perline * perline;
+	}
+#else
+	UNUSED(options);
+	UNUSED(ncpus);
+	UNUSED(perline);
+#endif
+
+	stats->countersize = sizeof(isc_stat_t) * stats->stride *
+			     stats->nshards;
+	if (stats->nshards > 1)
+		stats->countersize += ISC_STATS_CACHELINE;
+	stats->countermem = isc_mem_get(mctx, stats->countersize);
+	if (stats->countermem == NULL) {
 		result = ISC_R_NOMEMORY;
 		goto clean_mutex;
 	}
+	stats->counters = stats->countermem;
+	if (stats->nshards > 1) {
+		size_t p = (size_t)stats->countermem;
+
+		p = (p + ISC_STATS_CACHELINE - 1) &
+		    ~((size_t)ISC_STATS_CACHELINE - 1);
+		stats->counters = (isc_stat_t *)p;
+	}
 	stats->copiedcounters = isc_mem_get(mctx,
 					    sizeof(isc_uint64_t) * ncounters);
 	if (stats->copiedcounters == NULL) {
@@ -162,7 +220,7 @@ create_stats(isc_mem_t *mctx, int ncounters, isc_stats_t **statsp) {
 #endif
 
 	stats->references = 1;
-	memset(stats->counters, 0, sizeof(isc_stat_t) * ncounters);
+	memset(stats->countermem, 0, stats->countersize);
 	stats->mctx = NULL;
 	isc_mem_attach(mctx, &stats->mctx);
 	stats->ncounters = ncounters;
@@ -173,7 +231,7 @@ create_stats(isc_mem_t *mctx, int ncounters, isc_stats_t **statsp) {
 	return (result);
 
 clean_counters:
-	isc_mem_put(mctx, stats->counters, sizeof(isc_stat_t) * ncounters);
+	isc_mem_put(mctx, stats->countermem, stats->countersize);
 
 #if ISC_STATS_LOCKCOUNTERS
 clean_copiedcounters:
@@ -217,8 +275,8 @@ isc_stats_detach(isc_stats_t **statsp) {
 	if (stats->references == 0) {
 		isc_mem_put(stats->mctx, stats->copiedcounters,
 			    sizeof(isc_stat_t) * stats->ncounters);
-		isc_mem_put(stats->mctx, stats->counters,
-			    sizeof(isc_stat_t) * stats->ncounters);
+		isc_mem_put(stats->mctx, stats->countermem,
+			    stats->countersize);
 		UNLOCK(&stats->lock);
 		DESTROYLOCK(&stats->lock);
 #if ISC_STATS_LOCKCOUNTERS
@@ -240,6 +298,8 @@ isc_stats_ncounters(isc_stats_t *stats) {
 
 static inline void
 incrementcounter(isc_stats_t *stats, int counter) {
+	isc_stat_t *c = &stats->counters[getshard(stats) * stats->stride +
+					 counter];
 	isc_int32_t prev;
 
 #if ISC_STATS_LOCKCOUNTERS
@@ -253,10 +313,10 @@ incrementcounter(isc_stats_t *stats, int counter) {
 
 #if ISC_STATS_USEMULTIFIELDS
 #if defined(ISC_STATS_HAVESTDATOMIC)
-	prev = atomic_fetch_add_explicit(&stats->counters[counter].lo, 1,
+	prev = atomic_fetch_add_explicit(&c->lo, 1,
 					 memory_order_relaxed);
 #else
-	prev = isc_atomic_xadd((isc_int32_t *)&stats->counters[counter].lo, 1);
+	prev = isc_atomic_xadd((isc_int32_t *)&c->lo, 1);
 #endif
 	/*
 	 * If the lower 32-bit field overflows, increment the higher field.
@@ -268,23 +328,23 @@ incrementcounter(isc_stats_t *stats, int counter) {
 	 */
 	if (prev == (isc_int32_t)0xffffffff) {
 #if defined(ISC_STATS_HAVESTDATOMIC)
-		atomic_fetch_add_explicit(&stats->counters[counter].hi, 1,
+		atomic_fetch_add_explicit(&c->hi, 1,
 					  memory_order_relaxed);
 #else
-		isc_atomic_xadd((isc_int32_t *)&stats->counters[counter].hi, 1);
+		isc_atomic_xadd((isc_int32_t *)&c->hi, 1);
 #endif
 	}
 #elif ISC_STATS_HAVEATOMICQ
 	UNUSED(prev);
 #if defined(ISC_STATS_HAVESTDATOMICQ)
-	atomic_fetch_add_explicit(&stats->counters[counter], 1,
+	atomic_fetch_add_explicit(c, 1,
 				  memory_order_relaxed);
 #else
-	isc_atomic_xaddq((isc_int64_t *)&stats->counters[counter], 1);
+	isc_atomic_xaddq((isc_int64_t *)c, 1);
 #endif
 #else
 	UNUSED(prev);
-	stats->counters[counter]++;
+	(*c)++;
 #endif
 
 #if ISC_STATS_LOCKCOUNTERS
@@ -294,6 +354,8 @@ incrementcounter(isc_stats_t *stats, int counter) {
 
 static inline void
 decrementcounter(isc_stats_t *stats, int counter) {
+	isc_stat_t *c = &stats->counters[getshard(stats) * stats->stride +
+					 counter];
 	isc_int32_t prev;
 
 #if ISC_STATS_LOCKCOUNTERS
@@ -302,31 +364,31 @@ decrementcounter(isc_stats_t *stats, int counter) {
 
 #if ISC_STATS_USEMULTIFIELDS
 #if defined(ISC_STATS_HAVESTDATOMIC)
-	prev = atomic_fetch_sub_explicit(&stats->counters[counter].lo, 1,
+	prev = atomic_fetch_sub_explicit(&c->lo, 1,
 					 memory_order_relaxed);
 #else
-	prev = isc_atomic_xadd((isc_int32_t *)&stats->counters[counter].lo, -1);
+	prev = isc_atomic_xadd((isc_int32_t *)&c->lo, -1);
 #endif
 	if (prev == 0) {
 #if defined(ISC_STATS_HAVESTDATOMIC)
-		atomic_fetch_sub_explicit(&stats->counters[counter].hi, 1,
+		atomic_fetch_sub_explicit(&c->hi, 1,
 					  memory_order_relaxed);
 #else
-		isc_atomic_xadd((isc_int32_t *)&stats->counters[counter].hi,
+		isc_atomic_xadd((isc_int32_t *)&c->hi,
 				-1);
 #endif
 	}
 #elif ISC_STATS_HAVEATOMICQ
 	UNUSED(prev);
 #if defined(ISC_STATS_HAVESTDATOMICQ)
-	atomic_fetch_sub_explicit(&stats->counters[counter], 1,
+	atomic_fetch_sub_explicit(c, 1,
 				  memory_order_relaxed);
 #else
-	isc_atomic_xaddq((isc_int64_t *)&stats->counters[counter], -1);
+	isc_atomic_xaddq((isc_int64_t *)c, -1);
 #endif
 #else
 	UNUSED(prev);
-	stats->counters[counter]--;
+	(*c)--;
 #endif
 
 #if ISC_STATS_LOCKCOUNTERS
@@ -336,6 +398,9 @@ decrementcounter(isc_stats_t *stats, int counter) {
 
 static void
 copy_counters(isc_stats_t *stats) {
+	isc_stat_t *c;
+	unsigned int shard;
+	isc_uint64_t value;
 	int i;
 
 #if ISC_STATS_LOCKCOUNTERS
@@ -347,23 +412,29 @@ copy_counters(isc_stats_t *stats) {
 #endif
 
 	for (i = 0; i < stats->ncounters; i++) {
+		/*
+		 * Sum the shards.  Each shard may have wrapped if it saw
+		 * more decrements than increments, but the total is right.
+		 */
+		stats->copiedcounters[i] = 0;
+		for (shard = 0; shard < stats->nshards; shard++) {
+			c = &stats->counters[shard * stats->stride + i];
 #if ISC_STATS_USEMULTIFIELDS
-		stats->copiedcounters[i] =
-			(isc_uint64_t)(stats->counters[i].hi) << 32 |
-			stats->counters[i].lo;
+			value = (isc_uint64_t)(c->hi) << 32 |
+				(isc_uint32_t)c->lo;
 #elif ISC_STATS_HAVEATOMICQ
 #if defined(ISC_STATS_HAVESTDATOMICQ)
-		stats->copiedcounters[i] =
-			atomic_load_explicit(&stats->counters[i],
-					     memory_order_relaxed);
+			value = atomic_load_explicit(c, memory_order_relaxed);
 #else
-		/* use xaddq(..., 0) as an atomic load */
-		stats->copiedcounters[i] =
-			(isc_uint64_t)isc_atomic_xaddq((isc_int64_t *)&stats->counters[i], 0);
+			/* use xaddq(..., 0) as an atomic load */
+			value = (isc_uint64_t)isc_atomic_xaddq((isc_int64_t *)c,
+							       0);
 #endif
 #else
-		stats->copiedcounters[i] = stats->counters[i];
+			value = *c;
 #endif
+			stats->copiedcounters[i] += value;
+		}
 	}
 
 #if ISC_STATS_LOCKCOUNTERS
@@ -375,7 +446,16 @@ isc_result_t
 isc_stats_create(isc_mem_t *mctx, isc_stats_t **statsp, int ncounters) {
 	REQUIRE(statsp != NULL && *statsp == NULL);
 
-	return (create_stats(mctx, ncounters, statsp));
+	return (create_stats(mctx, ncounters, 0, statsp));
+}
+
+isc_result_t
+isc_stats_create2(isc_mem_t *mctx, isc_stats_t **statsp, int ncounters,
+		  unsigned int options)
+{
+	REQUIRE(statsp != NULL && *statsp == NULL);
+
+	return (create_stats(mctx, ncounters, options, statsp));
 }
 
 void
@@ -416,6 +496,9 @@ void
 isc_stats_set(isc_stats_t *stats, isc_uint64_t val,
 	      isc_statscounter_t counter)
 {
+	isc_stat_t *c;
+	unsigned int shard;
+
 	REQUIRE(ISC_STATS_VALID(stats));
 	REQUIRE(counter < stats->ncounters);
 
@@ -427,19 +510,25 @@ isc_stats_set(isc_stats_t *stats, isc_uint64_t val,
 	isc_rwlock_lock(&stats->counterlock, isc_rwlocktype_write);
 #endif
 
+	/*
+	 * The first shard holds the value, the others are cleared.
+	 */
+	for (shard = 0; shard < stats->nshards; shard++) {
+		c = &stats->counters[shard * stats->stride + counter];
 #if ISC_STATS_USEMULTIFIELDS
-	stats->counters[counter].hi = (isc_uint32_t)((val >> 32) & 0xffffffff);
-	stats->counters[counter].lo = (isc_uint32_t)(val & 0xffffffff);
+		c->hi = (isc_uint32_t)((val >> 32) & 0xffffffff);
+		c->lo = (isc_uint32_t)(val & 0xffffffff);
 #elif ISC_STATS_HAVEATOMICQ
 #if defined(ISC_STATS_HAVESTDATOMICQ)
-	atomic_store_explicit(&stats->counters[counter], val,
-			      memory_order_relaxed);
+		atomic_store_explicit(c, val, memory_order_relaxed);
 #else
-	isc_atomic_storeq((isc_int64_t *)&stats->counters[counter], val);
+		isc_atomic_storeq((isc_int64_t *)c, val);
 #endif
 #else
-	stats->counters[counter] = val;
+		*c = val;
 #endif
+		val = 0;
+	}
 
 #if ISC_STATS_LOCKCOUNTERS
 	isc_rwlock_unlock(&stats->counterlock, isc_rwlocktype_write);
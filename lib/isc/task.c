@@ -25,6 +25,7 @@
 #include <isc/mem.h>
 #include <isc/msgs.h>
 #include <isc/once.h>
+#include <isc/os.h>
 #include <isc/platform.h>
 #include <isc/print.h>
 #include <isc/string.h>
@@ -107,8 +108,10 @@ struct isc__task {
 	isc_time_t			tnow;
 	char				name[16];
 	void *				tag;
+	unsigned int			threadid;
 	/* Locked by task manager lock. */
 	LINK(isc__task_t)		link;
+	/* Locked by the lock of queue 'threadid'. */
 	LINK(isc__task_t)		ready_link;
 	LINK(isc__task_t)		ready_priority_link;
 };
@@ -124,31 +127,60 @@ struct isc__task {
 
 typedef ISC_LIST(isc__task_t)	isc__tasklist_t;
 
+/*%
+ * Each worker thread has its own run queue.  A task is assigned to one
+ * queue when it is created and is always made ready on that queue; a
+ * worker whose queue is empty steals ready tasks from its peers before
+ * going to sleep.  'tasks_running' counts the tasks taken from this
+ * queue which are currently executing, whichever worker runs them.
+ */
+typedef struct isc__taskqueue {
+	isc_mutex_t			lock;
+	/* Locked by queue lock. */
+	isc__tasklist_t			ready_tasks;
+	isc__tasklist_t			ready_priority_tasks;
+	unsigned int			tasks_running;
+	unsigned int			tasks_ready;
+#ifdef USE_WORKER_THREADS
+	isc_condition_t			work_available;
+	isc_boolean_t			idle;
+	/* Not locked. */
+	isc__taskmgr_t *		manager;
+	unsigned int			threadid;
+	isc_thread_t			thread;
+#endif /* USE_WORKER_THREADS */
+} isc__taskqueue_t;
+
 struct isc__taskmgr {
 	/* Not locked. */
 	isc_taskmgr_t			common;
 	isc_mem_t *			mctx;
 	isc_mutex_t			lock;
-#ifdef ISC_PLATFORM_USETHREADS
 	unsigned int			workers;
-	isc_thread_t *			threads;
-#endif /* ISC_PLATFORM_USETHREADS */
+	unsigned int			nqueues;
+	isc__taskqueue_t *		queues;
 	/* Locked by task manager lock. */
 	unsigned int			default_quantum;
 	LIST(isc__task_t)		tasks;
-	isc__tasklist_t			ready_tasks;
-	isc__tasklist_t			ready_priority_tasks;
+	unsigned int			curq;
+	isc_boolean_t			exiting;
+	/*
+	 * Changed with every queue lock held, so it may be read
+	 * holding any one of them.
+	 */
 	isc_taskmgrmode_t		mode;
-#ifdef ISC_PLATFORM_USETHREADS
-	isc_condition_t			work_available;
-	isc_condition_t			exclusive_granted;
-	isc_condition_t			paused;
-#endif /* ISC_PLATFORM_USETHREADS */
-	unsigned int			tasks_running;
-	unsigned int			tasks_ready;
+#ifdef USE_WORKER_THREADS
+	/*
+	 * Workers stop at the top of their dispatch loop while a pause
+	 * or exclusive access is requested, and 'halted' counts them.
+	 */
+	isc_mutex_t			halt_lock;
+	isc_condition_t			halt_cond;
+	unsigned int			halted;
+#endif /* USE_WORKER_THREADS */
+	/* Locked by halt lock; also read holding a queue lock. */
 	isc_boolean_t			pause_requested;
 	isc_boolean_t			exclusive_requested;
-	isc_boolean_t			exiting;
 
 	/*
 	 * Multiple threads can read/write 'excl' at the same time, so we need
@@ -179,6 +211,9 @@ static isc__taskmgr_t *taskmgr = NULL;
 isc_result_t
 isc__task_create(isc_taskmgr_t *manager0, unsigned int quantum,
 		 isc_task_t **taskp);
+isc_result_t
+isc__task_create_bound(isc_taskmgr_t *manager0, unsigned int quantum,
+		       isc_task_t **taskp, int threadid);
 void
 isc__task_attach(isc_task_t *source0, isc_task_t **targetp);
 void
@@ -242,13 +277,18 @@ isc_taskmgrmode_t
 isc__taskmgr_mode(isc_taskmgr_t *manager0);
 
 static inline isc_boolean_t
-empty_readyq(isc__taskmgr_t *manager);
+empty_readyq(isc__taskmgr_t *manager, isc__taskqueue_t *queue);
 
 static inline isc__task_t *
-pop_readyq(isc__taskmgr_t *manager);
+pop_readyq(isc__taskmgr_t *manager, isc__taskqueue_t *queue);
+
+static inline void
+push_readyq(isc__taskqueue_t *queue, isc__task_t *task);
 
+#ifdef USE_WORKER_THREADS
 static inline void
-push_readyq(isc__taskmgr_t *manager, isc__task_t *task);
+wake_all_queues(isc__taskmgr_t *manager);
+#endif /* USE_WORKER_THREADS */
 
 static struct isc__taskmethods {
 	isc_taskmethods_t methods;
@@ -319,7 +359,7 @@ task_finished(isc__task_t *task) {
 		 * any idle worker threads so they
 		 * can exit.
 		 */
-		BROADCAST(&manager->work_available);
+		wake_all_queues(manager);
 	}
 #endif /* USE_WORKER_THREADS */
 	UNLOCK(&manager->lock);
@@ -333,6 +373,13 @@ task_finished(isc__task_t *task) {
 isc_result_t
 isc__task_create(isc_taskmgr_t *manager0, unsigned int quantum,
 		 isc_task_t **taskp)
+{
+	return (isc__task_create_bound(manager0, quantum, taskp, -1));
+}
+
+isc_result_t
+isc__task_create_bound(isc_taskmgr_t *manager0, unsigned int quantum,
+		       isc_task_t **taskp, int threadid)
 {
 	isc__taskmgr_t *manager = (isc__taskmgr_t *)manager0;
 	isc__task_t *task;
@@ -363,6 +410,7 @@ isc__task_create(isc_taskmgr_t *manager0, unsigned int quantum,
 	isc_time_settoepoch(&task->tnow);
 	memset(task->name, 0, sizeof(task->name));
 	task->tag = NULL;
+	task->threadid = 0;
 	INIT_LINK(task, link);
 	INIT_LINK(task, ready_link);
 	INIT_LINK(task, ready_priority_link);
@@ -372,6 +420,10 @@ isc__task_create(isc_taskmgr_t *manager0, unsigned int quantum,
 	if (!manager->exiting) {
 		if (task->quantum == 0)
 			task->quantum = manager->default_quantum;
+		if (threadid >= 0)
+			task->threadid = threadid % manager->workers;
+		else
+			task->threadid = manager->curq++ % manager->workers;
 		APPEND(manager->tasks, task, link);
 	} else
 		exiting = ISC_TRUE;
@@ -450,6 +502,68 @@ task_shutdown(isc__task_t *task) {
 	return (was_idle);
 }
 
+#ifdef USE_WORKER_THREADS
+/*
+ * Wake an idle worker other than the one owning 'queue' so it can steal
+ * work.  The 'idle' flags are only read as a hint here; a worker that
+ * misses the wakeup leaves the task to its owner.
+ */
+static inline void
+wake_idle_peer(isc__taskmgr_t *manager, isc__taskqueue_t *queue) {
+	isc__taskqueue_t *peer;
+	unsigned int i;
+
+	for (i = 1; i < manager->workers; i++) {
+		peer = &manager->queues[(queue->threadid + i) %
+					manager->workers];
+		if (!peer->idle)
+			continue;
+		LOCK(&peer->lock);
+		if (peer->idle) {
+			SIGNAL(&peer->work_available);
+			UNLOCK(&peer->lock);
+			return;
+		}
+		UNLOCK(&peer->lock);
+	}
+}
+#endif /* USE_WORKER_THREADS */
+
+/*
+ * Push 'task' onto its run queue and, if 'wake' is set, wake a worker to
+ * run it: the queue's own worker if it is idle, otherwise an idle peer.
+ *
+ * Caller must NOT hold any queue lock.
+ */
+static inline void
+task_enqueue(isc__taskmgr_t *manager, isc__task_t *task, isc_boolean_t wake) {
+	isc__taskqueue_t *queue = &manager->queues[task->threadid];
+#ifdef USE_WORKER_THREADS
+	isc_boolean_t busy = ISC_FALSE;
+#endif /* USE_WORKER_THREADS */
+
+	LOCK(&queue->lock);
+	push_readyq(queue, task);
+#ifdef USE_WORKER_THREADS
+	if (wake && (manager->mode == isc_taskmgrmode_normal ||
+		     ISC_LINK_LINKED(task, ready_priority_link)))
+	{
+		if (queue->idle)
+			SIGNAL(&queue->work_available);
+		else
+			busy = ISC_TRUE;
+	}
+#else
+	UNUSED(wake);
+#endif /* USE_WORKER_THREADS */
+	UNLOCK(&queue->lock);
+
+#ifdef USE_WORKER_THREADS
+	if (busy)
+		wake_idle_peer(manager, queue);
+#endif /* USE_WORKER_THREADS */
+}
+
 /*
  * Moves a task onto the appropriate run queue.
  *
@@ -458,22 +572,13 @@ task_shutdown(isc__task_t *task) {
 static inline void
 task_ready(isc__task_t *task) {
 	isc__taskmgr_t *manager = task->manager;
-#ifdef USE_WORKER_THREADS
-	isc_boolean_t has_privilege = isc__task_privilege((isc_task_t *) task);
-#endif /* USE_WORKER_THREADS */
 
 	REQUIRE(VALID_MANAGER(manager));
 	REQUIRE(task->state == task_state_ready);
 
 	XTRACE("task_ready");
 
-	LOCK(&manager->lock);
-	push_readyq(manager, task);
-#ifdef USE_WORKER_THREADS
-	if (manager->mode == isc_taskmgrmode_normal || has_privilege)
-		SIGNAL(&manager->work_available);
-#endif /* USE_WORKER_THREADS */
-	UNLOCK(&manager->lock);
+	task_enqueue(manager, task, ISC_TRUE);
 }
 
 static inline isc_boolean_t
@@ -935,46 +1040,49 @@ isc__task_getcurrenttimex(isc_task_t *task0, isc_time_t *t) {
  ***/
 
 /*
- * Return ISC_TRUE if the current ready list for the manager, which is
+ * Return ISC_TRUE if the current ready list for 'queue', which is
  * either ready_tasks or the ready_priority_tasks, depending on whether
  * the manager is currently in normal or privileged execution mode.
  *
- * Caller must hold the task manager lock.
+ * Caller must hold the queue lock.
  */
 static inline isc_boolean_t
-empty_readyq(isc__taskmgr_t *manager) {
-	isc__tasklist_t queue;
+empty_readyq(isc__taskmgr_t *manager, isc__taskqueue_t *queue) {
+	isc__tasklist_t list;
 
 	if (manager->mode == isc_taskmgrmode_normal)
-		queue = manager->ready_tasks;
+		list = queue->ready_tasks;
 	else
-		queue = manager->ready_priority_tasks;
+		list = queue->ready_priority_tasks;
 
-	return (ISC_TF(EMPTY(queue)));
+	return (ISC_TF(EMPTY(list)));
 }
 
 /*
  * Dequeue and return a pointer to the first task on the current ready
- * list for the manager.
+ * list for 'queue'.
  * If the task is privileged, dequeue it from the other ready list
- * as well.
+ * as well.  The task is counted as running until the caller has
+ * finished with it.
  *
- * Caller must hold the task manager lock.
+ * Caller must hold the queue lock.
  */
 static inline isc__task_t *
-pop_readyq(isc__taskmgr_t *manager) {
+pop_readyq(isc__taskmgr_t *manager, isc__taskqueue_t *queue) {
 	isc__task_t *task;
 
 	if (manager->mode == isc_taskmgrmode_normal)
-		task = HEAD(manager->ready_tasks);
+		task = HEAD(queue->ready_tasks);
 	else
-		task = HEAD(manager->ready_priority_tasks);
+		task = HEAD(queue->ready_priority_tasks);
 
 	if (task != NULL) {
-		DEQUEUE(manager->ready_tasks, task, ready_link);
+		DEQUEUE(queue->ready_tasks, task, ready_link);
 		if (ISC_LINK_LINKED(task, ready_priority_link))
-			DEQUEUE(manager->ready_priority_tasks, task,
+			DEQUEUE(queue->ready_priority_tasks, task,
 				ready_priority_link);
+		queue->tasks_ready--;
+		queue->tasks_running++;
 	}
 
 	return (task);
@@ -984,26 +1092,404 @@ pop_readyq(isc__taskmgr_t *manager) {
  * Push 'task' onto the ready_tasks queue.  If 'task' has the privilege
  * flag set, then also push it onto the ready_priority_tasks queue.
  *
- * Caller must hold the task manager lock.
+ * Caller must hold the queue lock.
  */
 static inline void
-push_readyq(isc__taskmgr_t *manager, isc__task_t *task) {
-	ENQUEUE(manager->ready_tasks, task, ready_link);
+push_readyq(isc__taskqueue_t *queue, isc__task_t *task) {
+	ENQUEUE(queue->ready_tasks, task, ready_link);
 	if ((task->flags & TASK_F_PRIVILEGED) != 0)
-		ENQUEUE(manager->ready_priority_tasks, task,
+		ENQUEUE(queue->ready_priority_tasks, task,
 			ready_priority_link);
-	manager->tasks_ready++;
+	queue->tasks_ready++;
+}
+
+/*
+ * Lock every queue, in order.  Caller must NOT hold any queue lock.
+ */
+static inline void
+lock_queues(isc__taskmgr_t *manager) {
+	unsigned int i;
+
+	for (i = 0; i < manager->workers; i++)
+		LOCK(&manager->queues[i].lock);
 }
 
+static inline void
+unlock_queues(isc__taskmgr_t *manager, isc_boolean_t wake) {
+	unsigned int i;
+
+	for (i = manager->workers; i > 0; i--) {
+#ifdef USE_WORKER_THREADS
+		if (wake)
+			BROADCAST(&manager->queues[i - 1].work_available);
+#else
+		UNUSED(wake);
+#endif /* USE_WORKER_THREADS */
+		UNLOCK(&manager->queues[i - 1].lock);
+	}
+}
+
+/*
+ * Execute events from 'task' until it runs out of events or its quantum
+ * expires, adding the number of events dispatched to '*countp'.
+ * Returns ISC_TRUE if the task is still ready and must be requeued.
+ *
+ * Caller must NOT hold any lock.
+ */
+static isc_boolean_t
+run_task(isc__task_t *task, unsigned int *countp) {
+	unsigned int dispatch_count = 0;
+	isc_boolean_t done = ISC_FALSE;
+	isc_boolean_t requeue = ISC_FALSE;
+	isc_boolean_t finished = ISC_FALSE;
+	isc_event_t *event;
+
+	INSIST(VALID_TASK(task));
+
+	LOCK(&task->lock);
+	INSIST(task->state == task_state_ready);
+	task->state = task_state_running;
+	XTRACE(isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
+			      ISC_MSG_RUNNING, "running"));
+	TIME_NOW(&task->tnow);
+	task->now = isc_time_seconds(&task->tnow);
+	do {
+		if (!EMPTY(task->events)) {
+			event = HEAD(task->events);
+			DEQUEUE(task->events, event, ev_link);
+			task->nevents--;
+
+			/*
+			 * Execute the event action.
+			 */
+			XTRACE(isc_msgcat_get(isc_msgcat,
+					    ISC_MSGSET_TASK,
+					    ISC_MSG_EXECUTE,
+					    "execute action"));
+			if (event->ev_action != NULL) {
+				UNLOCK(&task->lock);
+				(event->ev_action)(
+					(isc_task_t *)task,
+					event);
+				LOCK(&task->lock);
+			}
+			dispatch_count++;
+			(*countp)++;
+		}
+
+		if (task->references == 0 &&
+		    EMPTY(task->events) &&
+		    !TASK_SHUTTINGDOWN(task)) {
+			isc_boolean_t was_idle;
+
+			/*
+			 * There are no references and no
+			 * pending events for this task,
+			 * which means it will not become
+			 * runnable again via an external
+			 * action (such as sending an event
+			 * or detaching).
+			 *
+			 * We initiate shutdown to prevent
+			 * it from becoming a zombie.
+			 *
+			 * We do this here instead of in
+			 * the "if EMPTY(task->events)" block
+			 * below because:
+			 *
+			 *	If we post no shutdown events,
+			 *	we want the task to finish.
+			 *
+			 *	If we did post shutdown events,
+			 *	will still want the task's
+			 *	quantum to be applied.
+			 */
+			was_idle = task_shutdown(task);
+			INSIST(!was_idle);
+		}
+
+		if (EMPTY(task->events)) {
+			/*
+			 * Nothing else to do for this task
+			 * right now.
+			 */
+			XTRACE(isc_msgcat_get(isc_msgcat,
+					      ISC_MSGSET_TASK,
+					      ISC_MSG_EMPTY,
+					      "empty"));
+			if (task->references == 0 &&
+			    TASK_SHUTTINGDOWN(task)) {
+				/*
+				 * The task is done.
+				 */
+				XTRACE(isc_msgcat_get(
+					       isc_msgcat,
+					       ISC_MSGSET_TASK,
+					       ISC_MSG_DONE,
+					       "done"));
+				finished = ISC_TRUE;
+				task->state = task_state_done;
+			} else
+				task->state = task_state_idle;
+			done = ISC_TRUE;
+		} else if (dispatch_count >= task->quantum) {
+			/*
+			 * Our quantum has expired, but
+			 * there is more work to be done.
+			 * We'll requeue it to the ready
+			 * queue later.
+			 *
+			 * We don't check quantum until
+			 * dispatching at least one event,
+			 * so the minimum quantum is one.
+			 */
+			XTRACE(isc_msgcat_get(isc_msgcat,
+					      ISC_MSGSET_TASK,
+					      ISC_MSG_QUANTUM,
+					      "quantum"));
+			task->state = task_state_ready;
+			requeue = ISC_TRUE;
+			done = ISC_TRUE;
+		}
+	} while (!done);
+	UNLOCK(&task->lock);
+
+	if (finished)
+		task_finished(task);
+
+	return (requeue);
+}
+
+#ifdef USE_WORKER_THREADS
+static inline void
+wake_all_queues(isc__taskmgr_t *manager) {
+	unsigned int i;
+
+	for (i = 0; i < manager->workers; i++) {
+		LOCK(&manager->queues[i].lock);
+		BROADCAST(&manager->queues[i].work_available);
+		UNLOCK(&manager->queues[i].lock);
+	}
+}
+
+/*
+ * Stop the calling worker until any pause or exclusive access request
+ * has been released.
+ *
+ * Caller must NOT hold any queue lock.
+ */
+static void
+halt(isc__taskmgr_t *manager) {
+	LOCK(&manager->halt_lock);
+	manager->halted++;
+	BROADCAST(&manager->halt_cond);
+	while (manager->pause_requested || manager->exclusive_requested) {
+		XTHREADTRACE(isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
+					    ISC_MSG_WAIT, "wait"));
+		WAIT(&manager->halt_cond, &manager->halt_lock);
+		XTHREADTRACE(isc_msgcat_get(isc_msgcat, ISC_MSGSET_TASK,
+					    ISC_MSG_AWAKE, "awake"));
+	}
+	manager->halted--;
+	UNLOCK(&manager->halt_lock);
+}
+
+/*
+ * Take a ready task from the queue of another worker, starting with
+ * the next one along from 'queue'.  Returns NULL if there is none.
+ *
+ * The emptiness test before locking a peer is only a hint; it keeps
+ * an idle worker from taking every peer's lock in turn.
+ *
+ * Caller must NOT hold any queue lock.
+ */
+static isc__task_t *
+steal_task(isc__taskmgr_t *manager, isc__taskqueue_t *queue) {
+	isc__taskqueue_t *peer;
+	isc__task_t *task;
+	unsigned int i;
+
+	for (i = 1; i < manager->workers; i++) {
+		peer = &manager->queues[(queue->threadid + i) %
+					manager->workers];
+		if (empty_readyq(manager, peer))
+			continue;
+		LOCK(&peer->lock);
+		task = pop_readyq(manager, peer);
+		UNLOCK(&peer->lock);
+		if (task != NULL) {
+			XTHREADTRACE("stole");
+			return (task);
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * If we are in privileged execution mode and there are no privileged
+ * tasks running or ready on any queue, then we're stuck.  Automatically
+ * drop privileges at that point and continue with the regular ready
+ * queues.
+ *
+ * Caller must NOT hold any queue lock.
+ */
+static void
+drop_privilege(isc__taskmgr_t *manager) {
+	isc_boolean_t stuck = ISC_TRUE;
+	unsigned int i;
+
+	/*
+	 * Unlocked test; the mode is checked again below.
+	 */
+	if (manager->mode == isc_taskmgrmode_normal)
+		return;
+
+	lock_queues(manager);
+	for (i = 0; i < manager->workers; i++) {
+		if (manager->queues[i].tasks_running != 0 ||
+		    !empty_readyq(manager, &manager->queues[i]))
+		{
+			stuck = ISC_FALSE;
+			break;
+		}
+	}
+	if (stuck && manager->mode != isc_taskmgrmode_normal)
+		manager->mode = isc_taskmgrmode_normal;
+	else
+		stuck = ISC_FALSE;
+	unlock_queues(manager, stuck);
+}
+
+/*
+ * Return the next task the worker owning 'queue' should run, sleeping
+ * until there is one, or NULL once the manager has finished.
+ *
+ * For reasons similar to those given in the comment in isc_task_send()
+ * above, it is safe for us to dequeue the task while only holding the
+ * queue lock, and then change the task to running state while only
+ * holding the task lock.
+ *
+ * If a pause or exclusive access has been requested, don't do any work
+ * until it's been released.
+ */
+static isc__task_t *
+next_task(isc__taskmgr_t *manager, isc__taskqueue_t *queue) {
+	isc__task_t *task = NULL;
+
+	LOCK(&queue->lock);
+	while (!FINISHED(manager)) {
+		if (manager->pause_requested || manager->exclusive_requested) {
+			UNLOCK(&queue->lock);
+			halt(manager);
+			LOCK(&queue->lock);
+			continue;
+		}
+
+		task = pop_readyq(manager, queue);
+		if (task != NULL)
+			break;
+
+		/*
+		 * Our own queue is empty; look for work on the other
+		 * queues before going to sleep.  A task made ready on
+		 * this queue meanwhile will be caught by the test below.
+		 */
+		UNLOCK(&queue->lock);
+		task = steal_task(manager, queue);
+		if (task != NULL)
+			return (task);
+		drop_privilege(manager);
+		LOCK(&queue->lock);
+
+		if (empty_readyq(manager, queue) && !FINISHED(manager) &&
+		    !manager->pause_requested && !manager->exclusive_requested)
+		{
+			XTHREADTRACE(isc_msgcat_get(isc_msgcat,
+						    ISC_MSGSET_GENERAL,
+						    ISC_MSG_WAIT, "wait"));
+			queue->idle = ISC_TRUE;
+			WAIT(&queue->work_available, &queue->lock);
+			queue->idle = ISC_FALSE;
+			XTHREADTRACE(isc_msgcat_get(isc_msgcat,
+						    ISC_MSGSET_TASK,
+						    ISC_MSG_AWAKE, "awake"));
+		}
+	}
+	UNLOCK(&queue->lock);
+
+	return (task);
+}
+
+static void
+dispatch(isc__taskmgr_t *manager, isc__taskqueue_t *queue) {
+	isc__taskqueue_t *home;
+	isc__task_t *task;
+	unsigned int dispatch_count;
+	isc_boolean_t requeue;
+
+	REQUIRE(VALID_MANAGER(manager));
+
+	while ((task = next_task(manager, queue)) != NULL) {
+		XTHREADTRACE(isc_msgcat_get(isc_msgcat, ISC_MSGSET_TASK,
+					    ISC_MSG_WORKING, "working"));
+
+		/*
+		 * 'task' may have been stolen from another queue, and
+		 * it may be freed by run_task(), so note where it came
+		 * from first.
+		 */
+		home = &manager->queues[task->threadid];
+		dispatch_count = 0;
+		requeue = run_task(task, &dispatch_count);
+
+		LOCK(&home->lock);
+		home->tasks_running--;
+		if (requeue) {
+			/*
+			 * If the task came from our own queue we know
+			 * we're awake, so we don't have to wake up anyone.
+			 * Otherwise its owner may be asleep.
+			 */
+			push_readyq(home, task);
+			if (home != queue && home->idle)
+				SIGNAL(&home->work_available);
+		}
+		UNLOCK(&home->lock);
+	}
+}
+
+static isc_threadresult_t
+#ifdef _WIN32
+WINAPI
+#endif
+run(void *uap) {
+	isc__taskqueue_t *queue = uap;
+
+	XTHREADTRACE(isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
+				    ISC_MSG_STARTING, "starting"));
+
+	dispatch(queue->manager, queue);
+
+	XTHREADTRACE(isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
+				    ISC_MSG_EXITING, "exiting"));
+
+#ifdef OPENSSL_LEAKS
+	ERR_remove_state(0);
+#endif
+
+	return ((isc_threadresult_t)0);
+}
+#else /* USE_WORKER_THREADS */
 static void
 dispatch(isc__taskmgr_t *manager) {
+	isc__taskqueue_t *queue = &manager->queues[0];
 	isc__task_t *task;
-#ifndef USE_WORKER_THREADS
 	unsigned int total_dispatch_count = 0;
 	isc__tasklist_t new_ready_tasks;
 	isc__tasklist_t new_priority_tasks;
 	unsigned int tasks_ready = 0;
-#endif /* USE_WORKER_THREADS */
+	isc_boolean_t requeue;
 
 	REQUIRE(VALID_MANAGER(manager));
 
@@ -1011,7 +1497,7 @@ dispatch(isc__taskmgr_t *manager) {
 	 * Again we're trying to hold the lock for as short a time as possible
 	 * and to do as little locking and unlocking as possible.
 	 *
-	 * In both while loops, the appropriate lock must be held before the
+	 * In the while loop, the appropriate lock must be held before the
 	 * while body starts.  Code which acquired the lock at the top of
 	 * the loop would be more readable, but would result in a lot of
 	 * extra locking.  Compare:
@@ -1057,278 +1543,76 @@ dispatch(isc__taskmgr_t *manager) {
 	 * unlocks.  The while expression is always protected by the lock.
 	 */
 
-#ifndef USE_WORKER_THREADS
 	ISC_LIST_INIT(new_ready_tasks);
 	ISC_LIST_INIT(new_priority_tasks);
-#endif
-	LOCK(&manager->lock);
+	LOCK(&queue->lock);
 
 	while (!FINISHED(manager)) {
-#ifdef USE_WORKER_THREADS
-		/*
-		 * For reasons similar to those given in the comment in
-		 * isc_task_send() above, it is safe for us to dequeue
-		 * the task while only holding the manager lock, and then
-		 * change the task to running state while only holding the
-		 * task lock.
-		 *
-		 * If a pause has been requested, don't do any work
-		 * until it's been released.
-		 */
-		while ((empty_readyq(manager) || manager->pause_requested ||
-			manager->exclusive_requested) && !FINISHED(manager))
-		{
-			XTHREADTRACE(isc_msgcat_get(isc_msgcat,
-						    ISC_MSGSET_GENERAL,
-						    ISC_MSG_WAIT, "wait"));
-			WAIT(&manager->work_available, &manager->lock);
-			XTHREADTRACE(isc_msgcat_get(isc_msgcat,
-						    ISC_MSGSET_TASK,
-						    ISC_MSG_AWAKE, "awake"));
-		}
-#else /* USE_WORKER_THREADS */
 		if (total_dispatch_count >= DEFAULT_TASKMGR_QUANTUM ||
-		    empty_readyq(manager))
+		    empty_readyq(manager, queue))
 			break;
-#endif /* USE_WORKER_THREADS */
 		XTHREADTRACE(isc_msgcat_get(isc_msgcat, ISC_MSGSET_TASK,
 					    ISC_MSG_WORKING, "working"));
 
-		task = pop_readyq(manager);
+		task = pop_readyq(manager, queue);
 		if (task != NULL) {
-			unsigned int dispatch_count = 0;
-			isc_boolean_t done = ISC_FALSE;
-			isc_boolean_t requeue = ISC_FALSE;
-			isc_boolean_t finished = ISC_FALSE;
-			isc_event_t *event;
-
-			INSIST(VALID_TASK(task));
-
 			/*
-			 * Note we only unlock the manager lock if we actually
-			 * have a task to do.  We must reacquire the manager
+			 * Note we only unlock the queue lock if we actually
+			 * have a task to do.  We must reacquire the queue
 			 * lock before exiting the 'if (task != NULL)' block.
 			 */
-			manager->tasks_ready--;
-			manager->tasks_running++;
-			UNLOCK(&manager->lock);
-
-			LOCK(&task->lock);
-			INSIST(task->state == task_state_ready);
-			task->state = task_state_running;
-			XTRACE(isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
-					      ISC_MSG_RUNNING, "running"));
-			TIME_NOW(&task->tnow);
-			task->now = isc_time_seconds(&task->tnow);
-			do {
-				if (!EMPTY(task->events)) {
-					event = HEAD(task->events);
-					DEQUEUE(task->events, event, ev_link);
-					task->nevents--;
-
-					/*
-					 * Execute the event action.
-					 */
-					XTRACE(isc_msgcat_get(isc_msgcat,
-							    ISC_MSGSET_TASK,
-							    ISC_MSG_EXECUTE,
-							    "execute action"));
-					if (event->ev_action != NULL) {
-						UNLOCK(&task->lock);
-						(event->ev_action)(
-							(isc_task_t *)task,
-							event);
-						LOCK(&task->lock);
-					}
-					dispatch_count++;
-#ifndef USE_WORKER_THREADS
-					total_dispatch_count++;
-#endif /* USE_WORKER_THREADS */
-				}
-
-				if (task->references == 0 &&
-				    EMPTY(task->events) &&
-				    !TASK_SHUTTINGDOWN(task)) {
-					isc_boolean_t was_idle;
-
-					/*
-					 * There are no references and no
-					 * pending events for this task,
-					 * which means it will not become
-					 * runnable again via an external
-					 * action (such as sending an event
-					 * or detaching).
-					 *
-					 * We initiate shutdown to prevent
-					 * it from becoming a zombie.
-					 *
-					 * We do this here instead of in
-					 * the "if EMPTY(task->events)" block
-					 * below because:
-					 *
-					 *	If we post no shutdown events,
-					 *	we want the task to finish.
-					 *
-					 *	If we did post shutdown events,
-					 *	will still want the task's
-					 *	quantum to be applied.
-					 */
-					was_idle = task_shutdown(task);
-					INSIST(!was_idle);
-				}
-
-				if (EMPTY(task->events)) {
-					/*
-					 * Nothing else to do for this task
-					 * right now.
-					 */
-					XTRACE(isc_msgcat_get(isc_msgcat,
-							      ISC_MSGSET_TASK,
-							      ISC_MSG_EMPTY,
-							      "empty"));
-					if (task->references == 0 &&
-					    TASK_SHUTTINGDOWN(task)) {
-						/*
-						 * The task is done.
-						 */
-						XTRACE(isc_msgcat_get(
-							       isc_msgcat,
-							       ISC_MSGSET_TASK,
-							       ISC_MSG_DONE,
-							       "done"));
-						finished = ISC_TRUE;
-						task->state = task_state_done;
-					} else
-						task->state = task_state_idle;
-					done = ISC_TRUE;
-				} else if (dispatch_count >= task->quantum) {
-					/*
-					 * Our quantum has expired, but
-					 * there is more work to be done.
-					 * We'll requeue it to the ready
-					 * queue later.
-					 *
-					 * We don't check quantum until
-					 * dispatching at least one event,
-					 * so the minimum quantum is one.
-					 */
-					XTRACE(isc_msgcat_get(isc_msgcat,
-							      ISC_MSGSET_TASK,
-							      ISC_MSG_QUANTUM,
-							      "quantum"));
-					task->state = task_state_ready;
-					requeue = ISC_TRUE;
-					done = ISC_TRUE;
-				}
-			} while (!done);
-			UNLOCK(&task->lock);
-
-			if (finished)
-				task_finished(task);
-
-			LOCK(&manager->lock);
-			manager->tasks_running--;
-#ifdef USE_WORKER_THREADS
-			if (manager->exclusive_requested &&
-			    manager->tasks_running == 1) {
-				SIGNAL(&manager->exclusive_granted);
-			} else if (manager->pause_requested &&
-				   manager->tasks_running == 0) {
-				SIGNAL(&manager->paused);
-			}
-#endif /* USE_WORKER_THREADS */
+			UNLOCK(&queue->lock);
+			requeue = run_task(task, &total_dispatch_count);
+			LOCK(&queue->lock);
+			queue->tasks_running--;
 			if (requeue) {
-				/*
-				 * We know we're awake, so we don't have
-				 * to wakeup any sleeping threads if the
-				 * ready queue is empty before we requeue.
-				 *
-				 * A possible optimization if the queue is
-				 * empty is to 'goto' the 'if (task != NULL)'
-				 * block, avoiding the ENQUEUE of the task
-				 * and the subsequent immediate DEQUEUE
-				 * (since it is the only executable task).
-				 * We don't do this because then we'd be
-				 * skipping the exit_requested check.  The
-				 * cost of ENQUEUE is low anyway, especially
-				 * when you consider that we'd have to do
-				 * an extra EMPTY check to see if we could
-				 * do the optimization.  If the ready queue
-				 * were usually nonempty, the 'optimization'
-				 * might even hurt rather than help.
-				 */
-#ifdef USE_WORKER_THREADS
-				push_readyq(manager, task);
-#else
 				ENQUEUE(new_ready_tasks, task, ready_link);
 				if ((task->flags & TASK_F_PRIVILEGED) != 0)
 					ENQUEUE(new_priority_tasks, task,
 						ready_priority_link);
 				tasks_ready++;
-#endif
 			}
 		}
-
-#ifdef USE_WORKER_THREADS
-		/*
-		 * If we are in privileged execution mode and there are no
-		 * tasks remaining on the current ready queue, then
-		 * we're stuck.  Automatically drop privileges at that
-		 * point and continue with the regular ready queue.
-		 */
-		if (manager->tasks_running == 0 && empty_readyq(manager)) {
-			manager->mode = isc_taskmgrmode_normal;
-			if (!empty_readyq(manager))
-				BROADCAST(&manager->work_available);
-		}
-#endif
 	}
 
-#ifndef USE_WORKER_THREADS
-	ISC_LIST_APPENDLIST(manager->ready_tasks, new_ready_tasks, ready_link);
-	ISC_LIST_APPENDLIST(manager->ready_priority_tasks, new_priority_tasks,
+	ISC_LIST_APPENDLIST(queue->ready_tasks, new_ready_tasks, ready_link);
+	ISC_LIST_APPENDLIST(queue->ready_priority_tasks, new_priority_tasks,
 			    ready_priority_link);
-	manager->tasks_ready += tasks_ready;
-	if (empty_readyq(manager))
+	queue->tasks_ready += tasks_ready;
+	if (empty_readyq(manager, queue))
 		manager->mode = isc_taskmgrmode_normal;
-#endif
 
-	UNLOCK(&manager->lock);
+	UNLOCK(&queue->lock);
 }
+#endif /* USE_WORKER_THREADS */
 
-#ifdef USE_WORKER_THREADS
-static isc_threadresult_t
-#ifdef _WIN32
-WINAPI
-#endif
-run(void *uap) {
-	isc__taskmgr_t *manager = uap;
-
-	XTHREADTRACE(isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
-				    ISC_MSG_STARTING, "starting"));
-
-	dispatch(manager);
-
-	XTHREADTRACE(isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
-				    ISC_MSG_EXITING, "exiting"));
-
-#ifdef OPENSSL_LEAKS
-	ERR_remove_state(0);
-#endif
+/*
+ * Destroy the first 'n' queues and free the queue array.
+ */
+static void
+queues_free(isc_mem_t *mctx, isc__taskqueue_t *queues, unsigned int n,
+	    unsigned int nqueues)
+{
+	unsigned int i;
 
-	return ((isc_threadresult_t)0);
-}
+	for (i = 0; i < n; i++) {
+#ifdef USE_WORKER_THREADS
+		(void)isc_condition_destroy(&queues[i].work_available);
 #endif /* USE_WORKER_THREADS */
+		DESTROYLOCK(&queues[i].lock);
+	}
+	isc_mem_put(mctx, queues, nqueues * sizeof(isc__taskqueue_t));
+}
 
 static void
 manager_free(isc__taskmgr_t *manager) {
 	isc_mem_t *mctx;
 
+	queues_free(manager->mctx, manager->queues, manager->nqueues,
+		    manager->nqueues);
 #ifdef USE_WORKER_THREADS
-	(void)isc_condition_destroy(&manager->exclusive_granted);
-	(void)isc_condition_destroy(&manager->work_available);
-	(void)isc_condition_destroy(&manager->paused);
-	isc_mem_free(manager->mctx, manager->threads);
+	(void)isc_condition_destroy(&manager->halt_cond);
+	DESTROYLOCK(&manager->halt_lock);
 #endif /* USE_WORKER_THREADS */
 	DESTROYLOCK(&manager->lock);
 	DESTROYLOCK(&manager->excl_lock);
@@ -1350,6 +1634,7 @@ isc__taskmgr_create(isc_mem_t *mctx, unsigned int workers,
 	isc_result_t result;
 	unsigned int i, started = 0;
 	isc__taskmgr_t *manager;
+	isc__taskqueue_t *queue;
 
 	/*
 	 * Create a new task manager.
@@ -1359,8 +1644,11 @@ isc__taskmgr_create(isc_mem_t *mctx, unsigned int workers,
 	REQUIRE(managerp != NULL && *managerp == NULL);
 
 #ifndef USE_WORKER_THREADS
-	UNUSED(i);
 	UNUSED(started);
+	/*
+	 * Without worker threads there is a single run queue.
+	 */
+	workers = 1;
 #endif
 
 #ifdef USE_SHARED_MANAGER
@@ -1391,46 +1679,60 @@ isc__taskmgr_create(isc_mem_t *mctx, unsigned int workers,
 	}
 
 #ifdef USE_WORKER_THREADS
-	manager->workers = 0;
-	manager->threads = isc_mem_allocate(mctx,
-					    workers * sizeof(isc_thread_t));
-	if (manager->threads == NULL) {
-		result = ISC_R_NOMEMORY;
+	result = isc_mutex_init(&manager->halt_lock);
+	if (result != ISC_R_SUCCESS)
 		goto cleanup_lock;
-	}
-	if (isc_condition_init(&manager->work_available) != ISC_R_SUCCESS) {
-		UNEXPECTED_ERROR(__FILE__, __LINE__,
-				 "isc_condition_init() %s",
-				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
-						ISC_MSG_FAILED, "failed"));
-		result = ISC_R_UNEXPECTED;
-		goto cleanup_threads;
-	}
-	if (isc_condition_init(&manager->exclusive_granted) != ISC_R_SUCCESS) {
+	if (isc_condition_init(&manager->halt_cond) != ISC_R_SUCCESS) {
 		UNEXPECTED_ERROR(__FILE__, __LINE__,
 				 "isc_condition_init() %s",
 				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
 						ISC_MSG_FAILED, "failed"));
 		result = ISC_R_UNEXPECTED;
-		goto cleanup_workavailable;
+		goto cleanup_haltlock;
 	}
-	if (isc_condition_init(&manager->paused) != ISC_R_SUCCESS) {
-		UNEXPECTED_ERROR(__FILE__, __LINE__,
-				 "isc_condition_init() %s",
-				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
-						ISC_MSG_FAILED, "failed"));
-		result = ISC_R_UNEXPECTED;
-		goto cleanup_exclusivegranted;
+	manager->halted = 0;
+#endif /* USE_WORKER_THREADS */
+
+	manager->queues = isc_mem_get(mctx, workers * sizeof(isc__taskqueue_t));
+	if (manager->queues == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup_haltcond;
 	}
+	for (i = 0; i < workers; i++) {
+		queue = &manager->queues[i];
+		result = isc_mutex_init(&queue->lock);
+		if (result != ISC_R_SUCCESS)
+			goto cleanup_queues;
+#ifdef USE_WORKER_THREADS
+		if (isc_condition_init(&queue->work_available) !=
+		    ISC_R_SUCCESS)
+		{
+			UNEXPECTED_ERROR(__FILE__, __LINE__,
+					 "isc_condition_init() %s",
+					 isc_msgcat_get(isc_msgcat,
+							ISC_MSGSET_GENERAL,
+							ISC_MSG_FAILED,
+							"failed"));
+			DESTROYLOCK(&queue->lock);
+			result = ISC_R_UNEXPECTED;
+			goto cleanup_queues;
+		}
+		queue->idle = ISC_FALSE;
+		queue->manager = manager;
+		queue->threadid = i;
 #endif /* USE_WORKER_THREADS */
+		INIT_LIST(queue->ready_tasks);
+		INIT_LIST(queue->ready_priority_tasks);
+		queue->tasks_running = 0;
+		queue->tasks_ready = 0;
+	}
+	manager->nqueues = workers;
+
 	if (default_quantum == 0)
 		default_quantum = DEFAULT_DEFAULT_QUANTUM;
 	manager->default_quantum = default_quantum;
 	INIT_LIST(manager->tasks);
-	INIT_LIST(manager->ready_tasks);
-	INIT_LIST(manager->ready_priority_tasks);
-	manager->tasks_running = 0;
-	manager->tasks_ready = 0;
+	manager->curq = 0;
 	manager->exclusive_requested = ISC_FALSE;
 	manager->pause_requested = ISC_FALSE;
 	manager->exiting = ISC_FALSE;
@@ -1439,18 +1741,29 @@ isc__taskmgr_create(isc_mem_t *mctx, unsigned int workers,
 	isc_mem_attach(mctx, &manager->mctx);
 
 #ifdef USE_WORKER_THREADS
+	manager->workers = 0;
 	LOCK(&manager->lock);
 	/*
-	 * Start workers.
+	 * Start workers.  A queue whose thread could not be started
+	 * is left unused.
 	 */
 	for (i = 0; i < workers; i++) {
-		if (isc_thread_create(run, manager,
-				      &manager->threads[manager->workers]) ==
+		queue = &manager->queues[manager->workers];
+		queue->threadid = manager->workers;
+		if (isc_thread_create(run, queue, &queue->thread) ==
 		    ISC_R_SUCCESS) {
 			char name[16];	/* thread name limit on Linux */
+			unsigned int ncpus = isc_os_ncpus();
+
 			snprintf(name, sizeof(name), "isc-worker%04d", i);
-			isc_thread_setname(manager->threads[manager->workers],
-					   name);
+			isc_thread_setname(queue->thread, name);
+			/*
+			 * Pin the workers to the CPUs in order, as the
+			 * socket manager does its watcher threads.
+			 */
+			if (workers > 1)
+				(void)isc_thread_setaffinity(queue->thread,
+						queue->threadid % ncpus);
 			manager->workers++;
 			started++;
 		}
@@ -1462,6 +1775,8 @@ isc__taskmgr_create(isc_mem_t *mctx, unsigned int workers,
 		return (ISC_R_NOTHREADS);
 	}
 	isc_thread_setconcurrency(workers);
+#else /* USE_WORKER_THREADS */
+	manager->workers = 1;
 #endif /* USE_WORKER_THREADS */
 #ifdef USE_SHARED_MANAGER
 	manager->refs = 1;
@@ -1472,16 +1787,17 @@ isc__taskmgr_create(isc_mem_t *mctx, unsigned int workers,
 
 	return (ISC_R_SUCCESS);
 
+ cleanup_queues:
+	queues_free(mctx, manager->queues, i, workers);
+ cleanup_haltcond:
 #ifdef USE_WORKER_THREADS
- cleanup_exclusivegranted:
-	(void)isc_condition_destroy(&manager->exclusive_granted);
- cleanup_workavailable:
-	(void)isc_condition_destroy(&manager->work_available);
- cleanup_threads:
-	isc_mem_free(mctx, manager->threads);
+	(void)isc_condition_destroy(&manager->halt_cond);
+ cleanup_haltlock:
+	DESTROYLOCK(&manager->halt_lock);
  cleanup_lock:
+#endif /* USE_WORKER_THREADS */
+	DESTROYLOCK(&manager->excl_lock);
 	DESTROYLOCK(&manager->lock);
-#endif
  cleanup_mgr:
 	isc_mem_put(mctx, manager, sizeof(*manager));
 	return (result);
@@ -1550,7 +1866,9 @@ isc__taskmgr_destroy(isc_taskmgr_t **managerp) {
 	/*
 	 * If privileged mode was on, turn it off.
 	 */
+	lock_queues(manager);
 	manager->mode = isc_taskmgrmode_normal;
+	unlock_queues(manager, ISC_FALSE);
 
 	/*
 	 * Post shutdown event(s) to every task (if they haven't already been
@@ -1561,7 +1879,7 @@ isc__taskmgr_destroy(isc_taskmgr_t **managerp) {
 	     task = NEXT(task, link)) {
 		LOCK(&task->lock);
 		if (task_shutdown(task))
-			push_readyq(manager, task);
+			task_enqueue(manager, task, ISC_FALSE);
 		UNLOCK(&task->lock);
 	}
 #ifdef USE_WORKER_THREADS
@@ -1570,14 +1888,14 @@ isc__taskmgr_destroy(isc_taskmgr_t **managerp) {
 	 * there's work left to do, and if there are already no tasks left
 	 * it will cause the workers to see manager->exiting.
 	 */
-	BROADCAST(&manager->work_available);
+	wake_all_queues(manager);
 	UNLOCK(&manager->lock);
 
 	/*
 	 * Wait for all the worker threads to exit.
 	 */
 	for (i = 0; i < manager->workers; i++)
-		(void)isc_thread_join(manager->threads[i], NULL);
+		(void)isc_thread_join(manager->queues[i].thread, NULL);
 #else /* USE_WORKER_THREADS */
 	/*
 	 * Dispatch the shutdown events.
@@ -1610,18 +1928,18 @@ void
 isc__taskmgr_setmode(isc_taskmgr_t *manager0, isc_taskmgrmode_t mode) {
 	isc__taskmgr_t *manager = (isc__taskmgr_t *)manager0;
 
-	LOCK(&manager->lock);
+	lock_queues(manager);
 	manager->mode = mode;
-	UNLOCK(&manager->lock);
+	unlock_queues(manager, ISC_TF(mode == isc_taskmgrmode_normal));
 }
 
 isc_taskmgrmode_t
 isc__taskmgr_mode(isc_taskmgr_t *manager0) {
 	isc__taskmgr_t *manager = (isc__taskmgr_t *)manager0;
 	isc_taskmgrmode_t mode;
-	LOCK(&manager->lock);
+	LOCK(&manager->queues[0].lock);
 	mode = manager->mode;
-	UNLOCK(&manager->lock);
+	UNLOCK(&manager->queues[0].lock);
 	return (mode);
 }
 
@@ -1638,9 +1956,9 @@ isc__taskmgr_ready(isc_taskmgr_t *manager0) {
 	if (manager == NULL)
 		return (ISC_FALSE);
 
-	LOCK(&manager->lock);
-	is_ready = !empty_readyq(manager);
-	UNLOCK(&manager->lock);
+	LOCK(&manager->queues[0].lock);
+	is_ready = !empty_readyq(manager, &manager->queues[0]);
+	UNLOCK(&manager->queues[0].lock);
 
 	return (is_ready);
 }
@@ -1665,24 +1983,26 @@ isc__taskmgr_dispatch(isc_taskmgr_t *manager0) {
 void
 isc__taskmgr_pause(isc_taskmgr_t *manager0) {
 	isc__taskmgr_t *manager = (isc__taskmgr_t *)manager0;
+
+	LOCK(&manager->halt_lock);
 	manager->pause_requested = ISC_TRUE;
-	LOCK(&manager->lock);
-	while (manager->tasks_running > 0) {
-		WAIT(&manager->paused, &manager->lock);
+	wake_all_queues(manager);
+	while (manager->halted < manager->workers) {
+		WAIT(&manager->halt_cond, &manager->halt_lock);
 	}
-	UNLOCK(&manager->lock);
+	UNLOCK(&manager->halt_lock);
 }
 
 void
 isc__taskmgr_resume(isc_taskmgr_t *manager0) {
 	isc__taskmgr_t *manager = (isc__taskmgr_t *)manager0;
 
-	LOCK(&manager->lock);
+	LOCK(&manager->halt_lock);
 	if (manager->pause_requested) {
 		manager->pause_requested = ISC_FALSE;
-		BROADCAST(&manager->work_available);
+		BROADCAST(&manager->halt_cond);
 	}
-	UNLOCK(&manager->lock);
+	UNLOCK(&manager->halt_lock);
 }
 #endif /* USE_WORKER_THREADS */
 
@@ -1730,16 +2050,20 @@ isc__task_beginexclusive(isc_task_t *task0) {
  *  it should be here, it fails on shutdown server->task
  */
 
-	LOCK(&manager->lock);
+	LOCK(&manager->halt_lock);
 	if (manager->exclusive_requested) {
-		UNLOCK(&manager->lock);
+		UNLOCK(&manager->halt_lock);
 		return (ISC_R_LOCKBUSY);
 	}
 	manager->exclusive_requested = ISC_TRUE;
-	while (manager->tasks_running > 1) {
-		WAIT(&manager->exclusive_granted, &manager->lock);
+	/*
+	 * Every worker but the one running us must halt.
+	 */
+	wake_all_queues(manager);
+	while (manager->halted + 1 < manager->workers) {
+		WAIT(&manager->halt_cond, &manager->halt_lock);
 	}
-	UNLOCK(&manager->lock);
+	UNLOCK(&manager->halt_lock);
 #else
 	UNUSED(task0);
 #endif
@@ -1753,11 +2077,11 @@ isc__task_endexclusive(isc_task_t *task0) {
 	isc__taskmgr_t *manager = task->manager;
 
 	REQUIRE(task->state == task_state_running);
-	LOCK(&manager->lock);
+	LOCK(&manager->halt_lock);
 	REQUIRE(manager->exclusive_requested);
 	manager->exclusive_requested = ISC_FALSE;
-	BROADCAST(&manager->work_available);
-	UNLOCK(&manager->lock);
+	BROADCAST(&manager->halt_cond);
+	UNLOCK(&manager->halt_lock);
 #else
 	UNUSED(task0);
 #endif
@@ -1767,6 +2091,7 @@ void
 isc__task_setprivilege(isc_task_t *task0, isc_boolean_t priv) {
 	isc__task_t *task = (isc__task_t *)task0;
 	isc__taskmgr_t *manager = task->manager;
+	isc__taskqueue_t *queue;
 	isc_boolean_t oldpriv;
 
 	LOCK(&task->lock);
@@ -1780,14 +2105,15 @@ isc__task_setprivilege(isc_task_t *task0, isc_boolean_t priv) {
 	if (priv == oldpriv)
 		return;
 
-	LOCK(&manager->lock);
+	queue = &manager->queues[task->threadid];
+	LOCK(&queue->lock);
 	if (priv && ISC_LINK_LINKED(task, ready_link))
-		ENQUEUE(manager->ready_priority_tasks, task,
+		ENQUEUE(queue->ready_priority_tasks, task,
 			ready_priority_link);
 	else if (!priv && ISC_LINK_LINKED(task, ready_priority_link))
-		DEQUEUE(manager->ready_priority_tasks, task,
+		DEQUEUE(queue->ready_priority_tasks, task,
 			ready_priority_link);
-	UNLOCK(&manager->lock);
+	UNLOCK(&queue->lock);
 }
 
 isc_boolean_t
@@ -1815,15 +2141,37 @@ isc_task_exiting(isc_task_t *t) {
 }
 
 
+#if defined(HAVE_LIBXML2) || defined(HAVE_JSON)
+/*
+ * Total the running and ready task counts over all the queues.
+ */
+static void
+count_tasks(isc__taskmgr_t *mgr, unsigned int *runningp,
+	    unsigned int *readyp)
+{
+	unsigned int i;
+
+	*runningp = *readyp = 0;
+	for (i = 0; i < mgr->workers; i++) {
+		LOCK(&mgr->queues[i].lock);
+		*runningp += mgr->queues[i].tasks_running;
+		*readyp += mgr->queues[i].tasks_ready;
+		UNLOCK(&mgr->queues[i].lock);
+	}
+}
+#endif
+
 #ifdef HAVE_LIBXML2
 #define TRY0(a) do { xmlrc = (a); if (xmlrc < 0) goto error; } while(0)
 int
 isc_taskmgr_renderxml(isc_taskmgr_t *mgr0, xmlTextWriterPtr writer) {
 	isc__taskmgr_t *mgr = (isc__taskmgr_t *)mgr0;
 	isc__task_t *task = NULL;
+	unsigned int running, ready;
 	int xmlrc;
 
 	LOCK(&mgr->lock);
+	count_tasks(mgr, &running, &ready);
 
 	/*
 	 * Write out the thread-model, and some details about each depending
@@ -1854,11 +2202,11 @@ isc_taskmgr_renderxml(isc_taskmgr_t *mgr0, xmlTextWriterPtr writer) {
 	TRY0(xmlTextWriterEndElement(writer)); /* default-quantum */
 
 	TRY0(xmlTextWriterStartElement(writer, ISC_XMLCHAR "tasks-running"));
-	TRY0(xmlTextWriterWriteFormatString(writer, "%d", mgr->tasks_running));
+	TRY0(xmlTextWriterWriteFormatString(writer, "%u", running));
 	TRY0(xmlTextWriterEndElement(writer)); /* tasks-running */
 
 	TRY0(xmlTextWriterStartElement(writer, ISC_XMLCHAR "tasks-ready"));
-	TRY0(xmlTextWriterWriteFormatString(writer, "%d", mgr->tasks_ready));
+	TRY0(xmlTextWriterWriteFormatString(writer, "%u", ready));
 	TRY0(xmlTextWriterEndElement(writer)); /* tasks-ready */
 
 	TRY0(xmlTextWriterEndElement(writer)); /* thread-model */
@@ -1932,8 +2280,10 @@ isc_taskmgr_renderjson(isc_taskmgr_t *mgr0, json_object *tasks) {
 	isc__taskmgr_t *mgr = (isc__taskmgr_t *)mgr0;
 	isc__task_t *task = NULL;
 	json_object *obj = NULL, *array = NULL, *taskobj = NULL;
+	unsigned int running, ready;
 
 	LOCK(&mgr->lock);
+	count_tasks(mgr, &running, &ready);
 
 	/*
 	 * Write out the thread-model, and some details about each depending
@@ -1961,11 +2311,11 @@ isc_taskmgr_renderjson(isc_taskmgr_t *mgr0, json_object *tasks) {
 	CHECKMEM(obj);
 	json_object_object_add(tasks, "default-quantum", obj);
 
-	obj = json_object_new_int(mgr->tasks_running);
+	obj = json_object_new_int(running);
 	CHECKMEM(obj);
 	json_object_object_add(tasks, "tasks-running", obj);
 
-	obj = json_object_new_int(mgr->tasks_ready);
+	obj = json_object_new_int(ready);
 	CHECKMEM(obj);
 	json_object_object_add(tasks, "tasks-ready", obj);
 
@@ -2142,6 +2492,20 @@ isc_task_create(isc_taskmgr_t *manager, unsigned int quantum,
 	return (manager->methods->taskcreate(manager, quantum, taskp));
 }
 
+isc_result_t
+isc_task_create_bound(isc_taskmgr_t *manager, unsigned int quantum,
+		      isc_task_t **taskp, int threadid)
+{
+	REQUIRE(ISCAPI_TASKMGR_VALID(manager));
+	REQUIRE(taskp != NULL && *taskp == NULL);
+
+	if (isc_bind9)
+		return (isc__task_create_bound(manager, quantum, taskp,
+					       threadid));
+
+	return (manager->methods->taskcreate(manager, quantum, taskp));
+}
+
 void
 isc_task_attach(isc_task_t *source, isc_task_t **targetp) {
 	REQUIRE(ISCAPI_TASK_VALID(source));
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include <atf-c.h>
+
+#include <string.h>
+
+#include <isc/arena.h>
+#include <isc/mem.h>
+#include <isc/result.h>
+#include <isc/util.h>
+
+#include "isctest.h"
+
+ATF_TC(arena_get);
+ATF_TC_HEAD(arena_get, tc) {
+	atf_tc_set_md_var(tc, "descr", "allocations are aligned, distinct "
+				       "and accounted for");
+}
+ATF_TC_BODY(arena_get, tc) {
+	isc_result_t result;
+	isc_arena_t *arena = NULL;
+	unsigned char *p[100];
+	size_t inuse;
+	unsigned int i, j;
+
+	UNUSED(tc);
+
+	result = isc_test_begin(NULL, ISC_TRUE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_arena_create(mctx, 1000, &arena);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(isc_arena_inuse(arena), 0);
+
+	/*
+	 * Odd sizes, enough of them to spill into several blocks.
+	 */
+	for (i = 0; i < 100; i++) {
+		p[i] = isc_arena_get(arena, 1 + i % 37);
+		ATF_REQUIRE(p[i] != NULL);
+		ATF_CHECK_EQ((size_t)p[i] % 8, 0);
+		memset(p[i], i, 1 + i % 37);
+	}
+	ATF_CHECK(isc_arena_inuse(arena) >= 100 * 8);
+
+	for (i = 0; i < 100; i++)
+		for (j = 0; j < 1 + i % 37; j++)
+			ATF_CHECK_EQ(p[i][j], i);
+
+	/*
+	 * A request larger than a block gets a block of its own.
+	 */
+	inuse = isc_arena_inuse(arena);
+	p[0] = isc_arena_get(arena, 5000);
+	ATF_REQUIRE(p[0] != NULL);
+	memset(p[0], 0xff, 5000);
+	ATF_CHECK_EQ(isc_arena_inuse(arena), inuse + 5000);
+
+	isc_arena_destroy(&arena);
+	ATF_CHECK_EQ(arena, NULL);
+
+	isc_test_end();
+}
+
+ATF_TC(arena_reset);
+ATF_TC_HEAD(arena_reset, tc) {
+	atf_tc_set_md_var(tc, "descr", "reset keeps only the first block");
+}
+ATF_TC_BODY(arena_reset, tc) {
+	isc_result_t result;
+	isc_arena_t *arena = NULL;
+	size_t base;
+	void *first, *p;
+	unsigned int i, round;
+
+	UNUSED(tc);
+
+	result = isc_test_begin(NULL, ISC_TRUE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_arena_create(mctx, 512, &arena);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	base = isc_mem_inuse(mctx);
+
+	first = isc_arena_get(arena, 16);
+	ATF_REQUIRE(first != NULL);
+	isc_arena_reset(arena);
+
+	for (round = 0; round < 3; round++) {
+		/*
+		 * Memory is handed out from the start of the first block
+		 * again after each reset.
+		 */
+		p = isc_arena_get(arena, 16);
+		ATF_CHECK_EQ(p, first);
+
+		for (i = 0; i < 100; i++)
+			ATF_REQUIRE(isc_arena_get(arena, 64) != NULL);
+		ATF_CHECK(isc_mem_inuse(mctx) > base);
+
+		isc_arena_reset(arena);
+		ATF_CHECK_EQ(isc_arena_inuse(arena), 0);
+		ATF_CHECK_EQ(isc_mem_inuse(mctx), base);
+	}
+
+	isc_arena_destroy(&arena);
+
+	isc_test_end();
+}
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, arena_get);
+	ATF_TP_ADD_TC(tp, arena_reset);
+	return (atf_no_error());
+}
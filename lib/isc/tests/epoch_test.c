@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include <atf-c.h>
+
+#include <isc/epoch.h>
+#include <isc/mem.h>
+#include <isc/platform.h>
+#include <isc/result.h>
+#include <isc/thread.h>
+#include <isc/util.h>
+
+#if defined(ISC_PLATFORM_HAVESTDATOMIC)
+#include <stdatomic.h>
+#include <stdint.h>
+#endif
+
+#include "isctest.h"
+
+#define NREADERS	4
+#define NLOOPS		20000
+
+#define LIVE		0x4c495645U
+#define DEAD		0xdeadbeefU
+
+typedef struct object {
+	unsigned int	magic;
+	unsigned int	value;
+} object_t;
+
+static void
+release_count(void *ctx, void *arg) {
+	unsigned int *released = ctx;
+
+	UNUSED(arg);
+
+	(*released)++;
+}
+
+static void
+release_object(void *ctx, void *arg) {
+	object_t *object = arg;
+
+	UNUSED(ctx);
+
+	object->magic = DEAD;
+	isc_mem_put(mctx, object, sizeof(*object));
+}
+
+ATF_TC(epoch_grace);
+ATF_TC_HEAD(epoch_grace, tc) {
+	atf_tc_set_md_var(tc, "descr", "retired objects are released only "
+				       "after the readers have left");
+}
+ATF_TC_BODY(epoch_grace, tc) {
+	isc_result_t result;
+	isc_epoch_t *epoch = NULL;
+	unsigned int released = 0;
+	unsigned int token, i;
+
+	UNUSED(tc);
+
+	result = isc_test_begin(NULL, ISC_TRUE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_epoch_create(mctx, &epoch);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	/* With no reader at all, a reclaim releases everything. */
+	isc_epoch_retire(epoch, release_count, &released, NULL);
+	ATF_CHECK_EQ(isc_epoch_pending(epoch), 1);
+	isc_epoch_reclaim(epoch);
+	ATF_CHECK_EQ(released, 1);
+	ATF_CHECK_EQ(isc_epoch_pending(epoch), 0);
+
+	/* A reader holds back everything retired while it is inside. */
+	token = isc_epoch_enter(epoch);
+	for (i = 0; i < 1000; i++)
+		isc_epoch_retire(epoch, release_count, &released, NULL);
+	isc_epoch_reclaim(epoch);
+	isc_epoch_reclaim(epoch);
+	ATF_CHECK_EQ(released, 1);
+	ATF_CHECK_EQ(isc_epoch_pending(epoch), 1000);
+
+	isc_epoch_exit(epoch, token);
+	isc_epoch_reclaim(epoch);
+	ATF_CHECK_EQ(released, 1001);
+	ATF_CHECK_EQ(isc_epoch_pending(epoch), 0);
+
+	/* Destroying the epoch releases what is still pending. */
+	for (i = 0; i < 10; i++)
+		isc_epoch_retire(epoch, release_count, &released, NULL);
+	isc_epoch_destroy(&epoch);
+	ATF_CHECK_EQ(epoch, NULL);
+	ATF_CHECK_EQ(released, 1011);
+
+	isc_test_end();
+}
+
+#if defined(ISC_PLATFORM_USETHREADS) && defined(ISC_PLATFORM_HAVESTDATOMIC)
+static isc_epoch_t *shared_epoch;
+static atomic_uintptr_t shared_object;
+static atomic_int_fast32_t readers_done;
+static atomic_int_fast32_t failures;
+
+static isc_threadresult_t
+#ifdef WIN32
+WINAPI
+#endif
+reader(void *arg) {
+	object_t *object;
+	unsigned int token, value, last = 0;
+	int i;
+
+	UNUSED(arg);
+
+	for (i = 0; i < NLOOPS; i++) {
+		token = isc_epoch_enter(shared_epoch);
+		object = (object_t *)atomic_load(&shared_object);
+		value = object->value;
+		if (i % 64 == 0)
+			isc_thread_yield();
+		if (object->magic != LIVE || object->value != value ||
+		    value < last)
+			atomic_fetch_add(&failures, 1);
+		last = value;
+		isc_epoch_exit(shared_epoch, token);
+	}
+
+	atomic_fetch_add(&readers_done, 1);
+	return ((isc_threadresult_t)0);
+}
+
+static isc_threadresult_t
+#ifdef WIN32
+WINAPI
+#endif
+writer(void *arg) {
+	object_t *object, *old;
+	unsigned int value = 0;
+
+	UNUSED(arg);
+
+	while (atomic_load(&readers_done) < NREADERS) {
+		object = isc_mem_get(mctx, sizeof(*object));
+		if (object == NULL)
+			continue;
+		object->magic = LIVE;
+		object->value = ++value;
+		old = (object_t *)atomic_exchange(&shared_object,
+						  (uintptr_t)object);
+		isc_epoch_retire(shared_epoch, release_object, NULL, old);
+		if (value % 16 == 0)
+			isc_thread_yield();
+	}
+
+	return ((isc_threadresult_t)0);
+}
+#endif
+
+ATF_TC(epoch_stress);
+ATF_TC_HEAD(epoch_stress, tc) {
+	atf_tc_set_md_var(tc, "descr", "concurrent readers never see an "
+				       "object that has been released");
+}
+ATF_TC_BODY(epoch_stress, tc) {
+#if defined(ISC_PLATFORM_USETHREADS) && defined(ISC_PLATFORM_HAVESTDATOMIC)
+	isc_result_t result;
+	isc_thread_t threads[NREADERS + 1];
+	object_t *object;
+	int i;
+
+	UNUSED(tc);
+
+	result = isc_test_begin(NULL, ISC_TRUE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_epoch_create(mctx, &shared_epoch);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	object = isc_mem_get(mctx, sizeof(*object));
+	ATF_REQUIRE(object != NULL);
+	object->magic = LIVE;
+	object->value = 0;
+	atomic_init(&shared_object, (uintptr_t)object);
+	atomic_init(&readers_done, 0);
+	atomic_init(&failures, 0);
+
+	for (i = 0; i < NREADERS; i++) {
+		result = isc_thread_create(reader, NULL, &threads[i]);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+	result = isc_thread_create(writer, NULL, &threads[NREADERS]);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	for (i = 0; i <= NREADERS; i++)
+		isc_thread_join(threads[i], NULL);
+
+	ATF_CHECK_EQ(atomic_load(&failures), 0);
+
+	isc_epoch_reclaim(shared_epoch);
+	ATF_CHECK_EQ(isc_epoch_pending(shared_epoch), 0);
+
+	object = (object_t *)atomic_load(&shared_object);
+	isc_mem_put(mctx, object, sizeof(*object));
+	isc_epoch_destroy(&shared_epoch);
+
+	isc_test_end();
+#else
+	UNUSED(tc);
+
+	atf_tc_skip("threads or atomic operations not available");
+#endif
+}
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, epoch_grace);
+	ATF_TP_ADD_TC(tp, epoch_stress);
+	return (atf_no_error());
+}
@@ -17,9 +17,11 @@
 
 #include <isc/file.h>
 #include <isc/mem.h>
+#include <isc/os.h>
 #include <isc/print.h>
 #include <isc/result.h>
 #include <isc/stdio.h>
+#include <isc/thread.h>
 
 static void *
 default_memalloc(void *arg, size_t size) {
@@ -143,6 +145,169 @@ ATF_TC_BODY(isc_mem_inuse, tc) {
 	isc_test_end();
 }
 
+#define NTHREADS	4
+#define NOBJECTS	2000
+
+static isc_mem_t *mctx_threads = NULL;
+static void *objects[NTHREADS][NOBJECTS];
+
+#ifdef ISC_PLATFORM_USETHREADS
+static isc_threadresult_t
+#ifdef WIN32
+WINAPI
+#endif
+getobjects(isc_threadarg_t arg) {
+	unsigned int n = *(unsigned int *)arg;
+	unsigned int i;
+
+	for (i = 0; i < NOBJECTS; i++) {
+		objects[n][i] = isc_mem_get(mctx_threads, 1 + (i * 7) % 1200);
+		ATF_REQUIRE(objects[n][i] != NULL);
+		memset(objects[n][i], n, 1 + (i * 7) % 1200);
+	}
+	return ((isc_threadresult_t)0);
+}
+
+static isc_threadresult_t
+#ifdef WIN32
+WINAPI
+#endif
+putobjects(isc_threadarg_t arg) {
+	unsigned int n = *(unsigned int *)arg;
+	unsigned int i;
+
+	/*
+	 * Free what another thread allocated.
+	 */
+	n = (n + 1) % NTHREADS;
+	for (i = 0; i < NOBJECTS; i++)
+		isc_mem_put(mctx_threads, objects[n][i], 1 + (i * 7) % 1200);
+	return ((isc_threadresult_t)0);
+}
+#endif
+
+ATF_TC(isc_mem_threads);
+ATF_TC_HEAD(isc_mem_threads, tc) {
+	atf_tc_set_md_var(tc, "descr", "test InUse with several threads "
+				       "getting and putting memory");
+}
+
+ATF_TC_BODY(isc_mem_threads, tc) {
+#ifdef ISC_PLATFORM_USETHREADS
+	isc_result_t result;
+	isc_thread_t threads[NTHREADS];
+	unsigned int ids[NTHREADS];
+	unsigned int debugging, i, nshards;
+	size_t before, after;
+
+	result = isc_test_begin(NULL, ISC_TRUE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	/*
+	 * Memory is only cached per thread without debugging.
+	 */
+	debugging = isc_mem_debugging;
+	isc_mem_debugging = 0;
+	result = isc_mem_create(0, 0, &mctx_threads);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	before = isc_mem_inuse(mctx_threads);
+
+	for (i = 0; i < NTHREADS; i++) {
+		ids[i] = i;
+		result = isc_thread_create(getobjects, &ids[i], &threads[i]);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+	for (i = 0; i < NTHREADS; i++)
+		isc_thread_join(threads[i], NULL);
+	ATF_CHECK(isc_mem_inuse(mctx_threads) >=
+		  before + NTHREADS * NOBJECTS * 500);
+
+	for (i = 0; i < NTHREADS; i++) {
+		result = isc_thread_create(putobjects, &ids[i], &threads[i]);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+	for (i = 0; i < NTHREADS; i++)
+		isc_thread_join(threads[i], NULL);
+
+	/*
+	 * Each shard may keep a little memory cached.
+	 */
+	nshards = 1;
+	while (nshards < isc_os_ncpus() && nshards < 64)
+		nshards <<= 1;
+	after = isc_mem_inuse(mctx_threads);
+	printf("inuse_before=%lu, inuse_after=%lu, shards=%u\n",
+	       (unsigned long)before, (unsigned long)after, nshards);
+	ATF_CHECK(after <= before + nshards * 36 * 1024);
+
+	/*
+	 * This fails if anything leaked.
+	 */
+	isc_mem_destroy(&mctx_threads);
+	isc_mem_debugging = debugging;
+
+	isc_test_end();
+#else
+	UNUSED(tc);
+	atf_tc_skip("threads not available");
+#endif
+}
+
+static int hiwater_calls, lowater_calls;
+
+static void
+water(void *arg, int mark) {
+	isc_mem_t *mctx2 = arg;
+
+	if (mark == ISC_MEM_HIWATER)
+		hiwater_calls++;
+	else
+		lowater_calls++;
+	isc_mem_waterack(mctx2, mark);
+}
+
+ATF_TC(isc_mem_water);
+ATF_TC_HEAD(isc_mem_water, tc) {
+	atf_tc_set_md_var(tc, "descr", "test high and low water marks");
+}
+
+ATF_TC_BODY(isc_mem_water, tc) {
+	isc_result_t result;
+	isc_mem_t *mctx2 = NULL;
+	unsigned int debugging, i;
+	void *ptrs[200];
+
+	result = isc_test_begin(NULL, ISC_TRUE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	debugging = isc_mem_debugging;
+	isc_mem_debugging = 0;
+	result = isc_mem_create(0, 0, &mctx2);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	isc_mem_setwater(mctx2, water, mctx2, 100000, 50000);
+
+	for (i = 0; i < 200; i++) {
+		ptrs[i] = isc_mem_get(mctx2, 1000);
+		ATF_REQUIRE(ptrs[i] != NULL);
+	}
+	ATF_CHECK_EQ(hiwater_calls, 1);
+	ATF_CHECK_EQ(lowater_calls, 0);
+	ATF_CHECK(isc_mem_isovermem(mctx2));
+
+	for (i = 0; i < 200; i++)
+		isc_mem_put(mctx2, ptrs[i], 1000);
+	ATF_CHECK_EQ(hiwater_calls, 1);
+	ATF_CHECK_EQ(lowater_calls, 1);
+	ATF_CHECK(!isc_mem_isovermem(mctx2));
+	ATF_CHECK(isc_mem_inuse(mctx2) < 50000);
+
+	isc_mem_setwater(mctx2, NULL, NULL, 0, 0);
+	isc_mem_destroy(&mctx2);
+	isc_mem_debugging = debugging;
+
+	isc_test_end();
+}
+
 #if ISC_MEM_TRACKLINES
 ATF_TC(isc_mem_noflags);
 ATF_TC_HEAD(isc_mem_noflags, tc) {
@@ -310,6 +475,8 @@ ATF_TC_BODY(isc_mem_traceflag, tc) {
 ATF_TP_ADD_TCS(tp) {
 	ATF_TP_ADD_TC(tp, isc_mem_total);
 	ATF_TP_ADD_TC(tp, isc_mem_inuse);
+	ATF_TP_ADD_TC(tp, isc_mem_threads);
+	ATF_TP_ADD_TC(tp, isc_mem_water);
 #if ISC_MEM_TRACKLINES
 	ATF_TP_ADD_TC(tp, isc_mem_noflags);
 	ATF_TP_ADD_TC(tp, isc_mem_recordflag);
@@ -313,6 +313,120 @@ ATF_TC_BODY(udp_dup, tc) {
 	isc_test_end();
 }
 
+/* Test UDP sockets sharing a port through SO_REUSEPORT */
+ATF_TC(udp_reuseport);
+ATF_TC_HEAD(udp_reuseport, tc) {
+	atf_tc_set_md_var(tc, "descr", "SO_REUSEPORT sockets on separate "
+			  "watcher threads");
+}
+ATF_TC_BODY(udp_reuseport, tc) {
+#ifdef SO_REUSEPORT
+	isc_result_t result;
+	isc_sockaddr_t addr1, addr2;
+	struct in_addr in;
+	isc_socketmgr_t *manager = NULL;
+	isc_socket_t *s1 = NULL, *s2 = NULL, *s3 = NULL;
+	isc_task_t *task = NULL;
+	char sendbuf[BUFSIZ], recvbuf1[BUFSIZ], recvbuf2[BUFSIZ];
+	completion_t completion, completion1, completion2;
+	isc_region_t r;
+	int i;
+
+	UNUSED(tc);
+
+	result = isc_test_begin(NULL, ISC_TRUE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_socketmgr_create3(mctx, &manager, 0, 2);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	in.s_addr = inet_addr("127.0.0.1");
+	isc_sockaddr_fromin(&addr1, &in, 0);
+	isc_sockaddr_fromin(&addr2, &in, 0);
+
+	result = isc_socket_create(manager, PF_INET, isc_sockettype_udp, &s1);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_socket_bind(s1, &addr1, ISC_SOCKET_REUSEPORT);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_socket_getsockname(s1, &addr1);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_REQUIRE(isc_sockaddr_getport(&addr1) != 0);
+	isc_socket_setthread(s1, 0);
+
+	result = isc_socket_create(manager, PF_INET, isc_sockettype_udp, &s2);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_socket_bind(s2, &addr1, ISC_SOCKET_REUSEPORT);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	isc_socket_setthread(s2, 1);
+
+	result = isc_socket_create(manager, PF_INET, isc_sockettype_udp, &s3);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_socket_bind(s3, &addr2, 0);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_task_create(taskmgr, 0, &task);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	/*
+	 * The kernel picks which of the listeners gets the datagram.
+	 */
+	r.base = (void *) recvbuf1;
+	r.length = BUFSIZ;
+	completion_init(&completion1);
+	result = isc_socket_recv(s1, &r, 1, task, event_done, &completion1);
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+
+	r.base = (void *) recvbuf2;
+	r.length = BUFSIZ;
+	completion_init(&completion2);
+	result = isc_socket_recv(s2, &r, 1, task, event_done, &completion2);
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+
+	snprintf(sendbuf, sizeof(sendbuf), "Hello");
+	r.base = (void *) sendbuf;
+	r.length = strlen(sendbuf) + 1;
+
+	completion_init(&completion);
+	result = isc_socket_sendto(s3, &r, task, event_done, &completion,
+				   &addr1, NULL);
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+	waitfor(&completion);
+	ATF_CHECK(completion.done);
+	ATF_CHECK_EQ(completion.result, ISC_R_SUCCESS);
+
+	for (i = 0; i < 5000; i++) {
+		if (completion1.done || completion2.done)
+			break;
+		waitbody();
+	}
+	ATF_REQUIRE(completion1.done || completion2.done);
+	if (completion1.done) {
+		ATF_CHECK_EQ(completion1.result, ISC_R_SUCCESS);
+		ATF_CHECK_STREQ(recvbuf1, "Hello");
+		isc_socket_cancel(s2, task, ISC_SOCKCANCEL_RECV);
+	} else {
+		ATF_CHECK_EQ(completion2.result, ISC_R_SUCCESS);
+		ATF_CHECK_STREQ(recvbuf2, "Hello");
+		isc_socket_cancel(s1, task, ISC_SOCKCANCEL_RECV);
+	}
+	waitfor2(&completion1, &completion2);
+
+	isc_task_detach(&task);
+
+	isc_socket_detach(&s1);
+	isc_socket_detach(&s2);
+	isc_socket_detach(&s3);
+
+	isc_socketmgr_destroy(&manager);
+
+	isc_test_end();
+#else
+	UNUSED(tc);
+
+	atf_tc_skip("SO_REUSEPORT not available");
+#endif
+}
+
 /* Test TCP sendto/recv (IPv4) */
 ATF_TC(udp_dscp_v4);
 ATF_TC_HEAD(udp_dscp_v4, tc) {
@@ -780,6 +894,7 @@ ATF_TC_BODY(net_probedscp, tc) {
 ATF_TP_ADD_TCS(tp) {
 	ATF_TP_ADD_TC(tp, udp_sendto);
 	ATF_TP_ADD_TC(tp, udp_dup);
+	ATF_TP_ADD_TC(tp, udp_reuseport);
 	ATF_TP_ADD_TC(tp, tcp_dscp_v4);
 	ATF_TP_ADD_TC(tp, tcp_dscp_v6);
 	ATF_TP_ADD_TC(tp, udp_dscp_v4);
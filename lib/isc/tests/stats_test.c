@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2017  Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <atf-c.h>
+
+#include <isc/result.h>
+#include <isc/stats.h>
+#include <isc/thread.h>
+#include <isc/util.h>
+
+#include "isctest.h"
+
+#define NCOUNTERS	3
+#define NTHREADS	8
+#define NLOOPS		10000
+
+static isc_uint64_t values[NCOUNTERS];
+
+static void
+dumper(isc_statscounter_t counter, isc_uint64_t value, void *arg) {
+	UNUSED(arg);
+
+	values[counter] = value;
+}
+
+static void
+getvalues(isc_stats_t *stats) {
+	memset(values, 0, sizeof(values));
+	isc_stats_dump(stats, dumper, NULL, ISC_STATSDUMP_VERBOSE);
+}
+
+#ifdef ISC_PLATFORM_USETHREADS
+static isc_threadresult_t
+#ifdef WIN32
+WINAPI
+#endif
+update(void *arg) {
+	isc_stats_t *stats = arg;
+	int i;
+
+	for (i = 0; i < NLOOPS; i++) {
+		isc_stats_increment(stats, 0);
+		isc_stats_increment(stats, 1);
+		isc_stats_decrement(stats, 1);
+		isc_stats_decrement(stats, 2);
+	}
+
+	return ((isc_threadresult_t)0);
+}
+#endif
+
+static void
+check_stats(unsigned int options) {
+	isc_result_t result;
+	isc_stats_t *stats = NULL;
+#ifdef ISC_PLATFORM_USETHREADS
+	isc_thread_t threads[NTHREADS];
+	int i;
+#endif
+
+	result = isc_stats_create2(mctx, &stats, NCOUNTERS, options);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(isc_stats_ncounters(stats), NCOUNTERS);
+
+	isc_stats_set(stats, 5, 2);
+	getvalues(stats);
+	ATF_CHECK_EQ(values[0], 0);
+	ATF_CHECK_EQ(values[2], 5);
+
+#ifdef ISC_PLATFORM_USETHREADS
+	isc_stats_set(stats, (isc_uint64_t)NTHREADS * NLOOPS, 2);
+	for (i = 0; i < NTHREADS; i++) {
+		result = isc_thread_create(update, stats, &threads[i]);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+	for (i = 0; i < NTHREADS; i++)
+		isc_thread_join(threads[i], NULL);
+
+	getvalues(stats);
+	ATF_CHECK_EQ(values[0], (isc_uint64_t)NTHREADS * NLOOPS);
+	ATF_CHECK_EQ(values[1], 0);
+	ATF_CHECK_EQ(values[2], 0);
+
+	/* Setting a counter overrides every shard. */
+	isc_stats_set(stats, 7, 0);
+	getvalues(stats);
+	ATF_CHECK_EQ(values[0], 7);
+#endif
+
+	isc_stats_detach(&stats);
+}
+
+ATF_TC(stats_create);
+ATF_TC_HEAD(stats_create, tc) {
+	atf_tc_set_md_var(tc, "descr", "unsharded statistics counters");
+}
+ATF_TC_BODY(stats_create, tc) {
+	isc_result_t result;
+
+	result = isc_test_begin(NULL, ISC_TRUE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	check_stats(0);
+
+	isc_test_end();
+}
+
+ATF_TC(stats_sharded);
+ATF_TC_HEAD(stats_sharded, tc) {
+	atf_tc_set_md_var(tc, "descr", "sharded statistics counters "
+				       "report exact totals");
+}
+ATF_TC_BODY(stats_sharded, tc) {
+	isc_result_t result;
+
+	result = isc_test_begin(NULL, ISC_TRUE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	check_stats(ISC_STATSCREATE_SHARDED);
+
+	isc_test_end();
+}
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, stats_create);
+	ATF_TP_ADD_TC(tp, stats_sharded);
+	return (atf_no_error());
+}
@@ -14,12 +14,12 @@
 
 #include <isc/app.h>
 #include <isc/condition.h>
-#include <isc/heap.h>
 #include <isc/log.h>
 #include <isc/magic.h>
 #include <isc/mem.h>
 #include <isc/msgs.h>
 #include <isc/once.h>
+#include <isc/os.h>
 #include <isc/platform.h>
 #include <isc/print.h>
 #include <isc/task.h>
@@ -63,27 +63,69 @@
 #define TIMER_MAGIC			ISC_MAGIC('T', 'I', 'M', 'R')
 #define VALID_TIMER(t)			ISC_MAGIC_VALID(t, TIMER_MAGIC)
 
+/*%
+ * Scheduled timers are kept in hierarchical timing wheels (Varghese
+ * and Lauck).  Time is counted in ticks of a millisecond.  Level 0 of
+ * a wheel has a slot for each of the next WHEEL_SLOTS ticks, and each
+ * slot of level n covers WHEEL_SLOTS times as many ticks as a slot of
+ * level n - 1.  A timer is filed in the lowest level that reaches its
+ * due tick and is filed again, in a lower level, when the wheel turns
+ * to the start of its slot ("cascading"), so scheduling and cancelling
+ * a timer take constant time.  Timers due beyond the reach of the top
+ * level wait in its furthest slot.
+ *
+ * A timer manager has a wheel for each thread, up to TIMER_MAXWHEELS,
+ * each with its own lock, so that threads setting timers do not
+ * contend with each other.  The timer thread turns all of the wheels.
+ */
+#define WHEEL_BITS			6
+#define WHEEL_SLOTS			(1U << WHEEL_BITS)
+#define WHEEL_MASK			(WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS			6
+#define WHEEL_SPAN(level)		((isc_uint64_t)1 << \
+					 (WHEEL_BITS * (level)))
+#define TIMER_MAXWHEELS			64
+#define TICK_NEVER			ISC_UINT64_MAX
+
 typedef struct isc__timer isc__timer_t;
 typedef struct isc__timermgr isc__timermgr_t;
+typedef struct timerwheel timerwheel_t;
+typedef ISC_LIST(isc__timer_t) timerlist_t;
 
 struct isc__timer {
 	/*! Not locked. */
 	isc_timer_t			common;
 	isc__timermgr_t *		manager;
+	timerwheel_t *			wheel;
 	isc_mutex_t			lock;
 	/*! Locked by timer lock. */
 	unsigned int			references;
 	isc_time_t			idle;
-	/*! Locked by manager lock. */
+	/*! Locked by wheel lock. */
 	isc_timertype_t			type;
 	isc_time_t			expires;
 	isc_interval_t			interval;
 	isc_task_t *			task;
 	isc_taskaction_t		action;
 	void *				arg;
-	unsigned int			index;
+	isc_boolean_t			scheduled;
+	unsigned int			level;
+	unsigned int			slot;
+	isc_uint64_t			tick;
 	isc_time_t			due;
 	LINK(isc__timer_t)		link;
+	LINK(isc__timer_t)		wlink;
+};
+
+struct timerwheel {
+	isc_mutex_t			lock;
+	/* Locked by wheel lock. */
+	isc_uint64_t			now;	/*%< next tick to turn to */
+	isc_uint64_t			wake;	/*%< next turn with work */
+	unsigned int			nscheduled;
+	timerlist_t			timers;
+	isc_uint64_t			occupied[WHEEL_LEVELS];
+	timerlist_t			slots[WHEEL_LEVELS][WHEEL_SLOTS];
 };
 
 #define TIMER_MANAGER_MAGIC		ISC_MAGIC('T', 'I', 'M', 'M')
@@ -94,11 +136,11 @@ struct isc__timermgr {
 	isc_timermgr_t			common;
 	isc_mem_t *			mctx;
 	isc_mutex_t			lock;
+	timerwheel_t *			wheels;
+	unsigned int			nwheels;	/*%< a power of 2 */
 	/* Locked by manager lock. */
 	isc_boolean_t			done;
-	LIST(isc__timer_t)		timers;
-	unsigned int			nscheduled;
-	isc_time_t			due;
+	isc_boolean_t			poked;
 #ifdef USE_TIMER_THREAD
 	isc_condition_t			wakeup;
 	isc_thread_t			thread;
@@ -106,7 +148,6 @@ struct isc__timermgr {
 #ifdef USE_SHARED_MANAGER
 	unsigned int			refs;
 #endif /* USE_SHARED_MANAGER */
-	isc_heap_t *			heap;
 };
 
 /*%
@@ -174,15 +215,155 @@ static struct isc__timermgrmethods {
 static isc__timermgr_t *timermgr = NULL;
 #endif /* USE_SHARED_MANAGER */
 
+static isc_mutex_t createlock;
+static isc_once_t once = ISC_ONCE_INIT;
+static isc_timermgrcreatefunc_t timermgr_createfunc = NULL;
+
+static void
+initialize(void) {
+	RUNTIME_CHECK(isc_mutex_init(&createlock) == ISC_R_SUCCESS);
+}
+
+/*%
+ * Thread 'n' files its timers in wheel 'n % nwheels'.
+ */
+static timerwheel_t *
+getwheel(isc__timermgr_t *manager) {
+#ifdef USE_TIMER_THREAD
+	return (&manager->wheels[isc_thread_shard(manager->nwheels)]);
+#else
+	return (&manager->wheels[0]);
+#endif
+}
+
+/*%
+ * Convert between times and ticks.  Due times are rounded up, so that
+ * a timer never fires early, and the current time is rounded down.
+ */
+static inline isc_uint64_t
+time2tick(const isc_time_t *t, isc_boolean_t roundup) {
+	isc_uint64_t tick;
+	unsigned int ns = isc_time_nanoseconds(t);
+
+	tick = (isc_uint64_t)isc_time_seconds(t) * 1000 + ns / 1000000;
+	if (roundup && ns % 1000000 != 0)
+		tick++;
+	return (tick);
+}
+
+static inline void
+tick2time(isc_uint64_t tick, isc_time_t *t) {
+	isc_time_set(t, (unsigned int)(tick / 1000),
+		     (unsigned int)(tick % 1000) * 1000000);
+}
+
+/*%
+ * The position of the lowest bit set in 'mask', which is not zero.
+ */
+static inline unsigned int
+lowbit(isc_uint64_t mask) {
+#ifdef HAVE_BUILTIN_CLZ
+	return (__builtin_ctzll(mask));
+#else
+	unsigned int bit = 0;
+
+	while ((mask & 0xff) == 0) {
+		mask >>= 8;
+		bit += 8;
+	}
+	while ((mask & 1) == 0) {
+		mask >>= 1;
+		bit++;
+	}
+	return (bit);
+#endif
+}
+
+/*%
+ * File 'timer' in 'wheel' according to timer->tick, and return the tick
+ * at which the wheel must next be turned to deal with it.
+ *
+ * Requires the wheel to be locked.
+ */
+static isc_uint64_t
+file(timerwheel_t *wheel, isc__timer_t *timer) {
+	isc_uint64_t tick, delta;
+	unsigned int level, shift;
+
+	tick = ISC_MAX(timer->tick, wheel->now);
+	delta = tick - wheel->now;
+	for (level = 0; level < WHEEL_LEVELS - 1; level++)
+		if (delta < WHEEL_SPAN(level + 1))
+			break;
+	if (delta >= WHEEL_SPAN(WHEEL_LEVELS))
+		tick = wheel->now + WHEEL_SPAN(WHEEL_LEVELS) - 1;
+
+	shift = WHEEL_BITS * level;
+	timer->level = level;
+	timer->slot = (tick >> shift) & WHEEL_MASK;
+	APPEND(wheel->slots[level][timer->slot], timer, wlink);
+	wheel->occupied[level] |= (isc_uint64_t)1 << timer->slot;
+
+	return ((tick >> shift) << shift);
+}
+
+static void
+unfile(timerwheel_t *wheel, isc__timer_t *timer) {
+	UNLINK(wheel->slots[timer->level][timer->slot], timer, wlink);
+	if (EMPTY(wheel->slots[timer->level][timer->slot]))
+		wheel->occupied[timer->level] &=
+			~((isc_uint64_t)1 << timer->slot);
+}
+
+/*%
+ * The next tick at which turning 'wheel' will fire or cascade timers,
+ * or TICK_NEVER.
+ *
+ * Requires the wheel to be locked.
+ */
+static isc_uint64_t
+nextturn(timerwheel_t *wheel) {
+	isc_uint64_t next = TICK_NEVER, mask, tick;
+	unsigned int level, shift, pos, dist;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		if (wheel->occupied[level] == 0)
+			continue;
+		shift = WHEEL_BITS * level;
+		pos = (wheel->now >> shift) & WHEEL_MASK;
+		mask = wheel->occupied[level];
+		if (pos != 0)
+			mask = (mask >> pos) | (mask << (WHEEL_SLOTS - pos));
+
+		/*
+		 * The slot 'now' is in has already been cascaded, unless
+		 * 'now' is at its start; its timers are for the next time
+		 * round.
+		 */
+		if (level != 0 &&
+		    (wheel->now & (WHEEL_SPAN(level) - 1)) != 0)
+		{
+			if ((mask & ~(isc_uint64_t)1) == 0)
+				dist = WHEEL_SLOTS;
+			else
+				dist = lowbit(mask & ~(isc_uint64_t)1);
+		} else
+			dist = lowbit(mask);
+
+		tick = ((wheel->now >> shift) + dist) << shift;
+		if (tick < next)
+			next = tick;
+	}
+
+	return (next);
+}
+
 static inline isc_result_t
-schedule(isc__timer_t *timer, isc_time_t *now, isc_boolean_t signal_ok) {
+schedule(isc__timer_t *timer, isc_time_t *now, isc_boolean_t *signalp) {
 	isc_result_t result;
-	isc__timermgr_t *manager;
+	timerwheel_t *wheel;
 	isc_time_t due;
-	int cmp;
-#ifdef USE_TIMER_THREAD
-	isc_boolean_t timedwait;
-#endif
+	isc_uint64_t turn;
 
 	/*!
 	 * Note: the caller must ensure locking.
@@ -190,20 +371,7 @@ schedule(isc__timer_t *timer, isc_time_t *now, isc_boolean_t signal_ok) {
 
 	REQUIRE(timer->type != isc_timertype_inactive);
 
-#ifndef USE_TIMER_THREAD
-	UNUSED(signal_ok);
-#endif /* USE_TIMER_THREAD */
-
-	manager = timer->manager;
-
-#ifdef USE_TIMER_THREAD
-	/*!
-	 * If the manager was timed wait, we may need to signal the
-	 * manager to force a wakeup.
-	 */
-	timedwait = ISC_TF(manager->nscheduled > 0 &&
-			   isc_time_seconds(&manager->due) != 0);
-#endif
+	wheel = timer->wheel;
 
 	/*
 	 * Compute the new due time.
@@ -229,126 +397,84 @@ schedule(isc__timer_t *timer, isc_time_t *now, isc_boolean_t signal_ok) {
 	/*
 	 * Schedule the timer.
 	 */
-
-	if (timer->index > 0) {
+	if (timer->scheduled)
+		unfile(wheel, timer);
+	else {
 		/*
-		 * Already scheduled.
+		 * An empty wheel may not have been turned for a while;
+		 * catch it up so that the timer is filed accurately.
 		 */
-		cmp = isc_time_compare(&due, &timer->due);
-		timer->due = due;
-		switch (cmp) {
-		case -1:
-			isc_heap_increased(manager->heap, timer->index);
-			break;
-		case 1:
-			isc_heap_decreased(manager->heap, timer->index);
-			break;
-		case 0:
-			/* Nothing to do. */
-			break;
-		}
-	} else {
-		timer->due = due;
-		result = isc_heap_insert(manager->heap, timer);
-		if (result != ISC_R_SUCCESS) {
-			INSIST(result == ISC_R_NOMEMORY);
-			return (ISC_R_NOMEMORY);
-		}
-		manager->nscheduled++;
+		if (wheel->nscheduled == 0)
+			wheel->now = ISC_MAX(wheel->now,
+					     time2tick(now, ISC_FALSE));
+		timer->scheduled = ISC_TRUE;
+		wheel->nscheduled++;
 	}
+	timer->due = due;
+	timer->tick = time2tick(&due, ISC_TRUE);
+	turn = file(wheel, timer);
 
 	XTRACETIMER(isc_msgcat_get(isc_msgcat, ISC_MSGSET_TIMER,
 				   ISC_MSG_SCHEDULE, "schedule"), timer, due);
 
 	/*
-	 * If this timer is at the head of the queue, we need to ensure
-	 * that we won't miss it if it has a more recent due time than
-	 * the current "next" timer.  We do this either by waking up the
-	 * run thread, or explicitly setting the value in the manager.
-	 */
-#ifdef USE_TIMER_THREAD
-
-	/*
-	 * This is a temporary (probably) hack to fix a bug on tru64 5.1
-	 * and 5.1a.  Sometimes, pthread_cond_timedwait() doesn't actually
-	 * return when the time expires, so here, we check to see if
-	 * we're 15 seconds or more behind, and if we are, we signal
-	 * the dispatcher.  This isn't such a bad idea as a general purpose
-	 * watchdog, so perhaps we should just leave it in here.
+	 * If the wheel now needs turning sooner than the timer thread
+	 * plans to, the caller must wake it up (or, without threads,
+	 * the next call to isc__timermgr_nextevent() will pick it up).
 	 */
-	if (signal_ok && timedwait) {
-		isc_interval_t fifteen;
-		isc_time_t then;
-
-		isc_interval_set(&fifteen, 15, 0);
-		result = isc_time_add(&manager->due, &fifteen, &then);
-
-		if (result == ISC_R_SUCCESS &&
-		    isc_time_compare(&then, now) < 0) {
-			SIGNAL(&manager->wakeup);
-			signal_ok = ISC_FALSE;
-			isc_log_write(isc_lctx, ISC_LOGCATEGORY_GENERAL,
-				      ISC_LOGMODULE_TIMER, ISC_LOG_WARNING,
-				      "*** POKED TIMER ***");
-		}
+	if (turn < wheel->wake) {
+		wheel->wake = turn;
+		if (signalp != NULL)
+			*signalp = ISC_TRUE;
 	}
 
-	if (timer->index == 1 && signal_ok) {
-		XTRACE(isc_msgcat_get(isc_msgcat, ISC_MSGSET_TIMER,
-				      ISC_MSG_SIGNALSCHED,
-				      "signal (schedule)"));
-		SIGNAL(&manager->wakeup);
-	}
-#else /* USE_TIMER_THREAD */
-	if (timer->index == 1 &&
-	    isc_time_compare(&timer->due, &manager->due) < 0)
-		manager->due = timer->due;
-#endif /* USE_TIMER_THREAD */
-
 	return (ISC_R_SUCCESS);
 }
 
 static inline void
 deschedule(isc__timer_t *timer) {
-#ifdef USE_TIMER_THREAD
-	isc_boolean_t need_wakeup = ISC_FALSE;
-#endif
-	isc__timermgr_t *manager;
+	timerwheel_t *wheel;
 
 	/*
-	 * The caller must ensure locking.
+	 * The caller must ensure locking.  There is no need to wake the
+	 * timer thread; if it wakes early it will find nothing to do.
 	 */
 
-	manager = timer->manager;
-	if (timer->index > 0) {
-#ifdef USE_TIMER_THREAD
-		if (timer->index == 1)
-			need_wakeup = ISC_TRUE;
-#endif
-		isc_heap_delete(manager->heap, timer->index);
-		timer->index = 0;
-		INSIST(manager->nscheduled > 0);
-		manager->nscheduled--;
+	wheel = timer->wheel;
+	if (timer->scheduled) {
+		unfile(wheel, timer);
+		timer->scheduled = ISC_FALSE;
+		INSIST(wheel->nscheduled > 0);
+		wheel->nscheduled--;
+	}
+}
+
+/*%
+ * Wake up the timer thread, because a wheel needs turning sooner than
+ * it planned.  Requires that no wheel lock be held.
+ */
+static void
+wakeup(isc__timermgr_t *manager) {
+	LOCK(&manager->lock);
+	manager->poked = ISC_TRUE;
 #ifdef USE_TIMER_THREAD
-		if (need_wakeup) {
-			XTRACE(isc_msgcat_get(isc_msgcat, ISC_MSGSET_TIMER,
-					      ISC_MSG_SIGNALDESCHED,
-					      "signal (deschedule)"));
-			SIGNAL(&manager->wakeup);
-		}
+	XTRACE(isc_msgcat_get(isc_msgcat, ISC_MSGSET_TIMER,
+			      ISC_MSG_SIGNALSCHED, "signal (schedule)"));
+	SIGNAL(&manager->wakeup);
 #endif /* USE_TIMER_THREAD */
-	}
+	UNLOCK(&manager->lock);
 }
 
 static void
 destroy(isc__timer_t *timer) {
 	isc__timermgr_t *manager = timer->manager;
+	timerwheel_t *wheel = timer->wheel;
 
 	/*
 	 * The caller must ensure it is safe to destroy the timer.
 	 */
 
-	LOCK(&manager->lock);
+	LOCK(&wheel->lock);
 
 	(void)isc_task_purgerange(timer->task,
 				  timer,
@@ -356,9 +482,9 @@ destroy(isc__timer_t *timer) {
 				  ISC_TIMEREVENT_LASTEVENT,
 				  NULL);
 	deschedule(timer);
-	UNLINK(manager->timers, timer, link);
+	UNLINK(wheel->timers, timer, link);
 
-	UNLOCK(&manager->lock);
+	UNLOCK(&wheel->lock);
 
 	isc_task_detach(&timer->task);
 	DESTROYLOCK(&timer->lock);
@@ -375,8 +501,10 @@ isc__timer_create(isc_timermgr_t *manager0, isc_timertype_t type,
 {
 	isc__timermgr_t *manager = (isc__timermgr_t *)manager0;
 	isc__timer_t *timer;
+	timerwheel_t *wheel;
 	isc_result_t result;
 	isc_time_t now;
+	isc_boolean_t signal = ISC_FALSE;
 
 	/*
 	 * Create a new 'type' timer managed by 'manager'.  The timers
@@ -419,6 +547,7 @@ isc__timer_create(isc_timermgr_t *manager0, isc_timertype_t type,
 		return (ISC_R_NOMEMORY);
 
 	timer->manager = manager;
+	timer->wheel = wheel = getwheel(manager);
 	timer->references = 1;
 
 	if (type == isc_timertype_once && !isc_interval_iszero(interval)) {
@@ -447,7 +576,7 @@ isc__timer_create(isc_timermgr_t *manager0, isc_timertype_t type,
 	 * keep track of whether arg started as a true const.
 	 */
 	DE_CONST(arg, timer->arg);
-	timer->index = 0;
+	timer->scheduled = ISC_FALSE;
 	result = isc_mutex_init(&timer->lock);
 	if (result != ISC_R_SUCCESS) {
 		isc_task_detach(&timer->task);
@@ -455,11 +584,12 @@ isc__timer_create(isc_timermgr_t *manager0, isc_timertype_t type,
 		return (result);
 	}
 	ISC_LINK_INIT(timer, link);
+	ISC_LINK_INIT(timer, wlink);
 	timer->common.impmagic = TIMER_MAGIC;
 	timer->common.magic = ISCAPI_TIMER_MAGIC;
 	timer->common.methods = (isc_timermethods_t *)&timermethods;
 
-	LOCK(&manager->lock);
+	LOCK(&wheel->lock);
 
 	/*
 	 * Note we don't have to lock the timer like we normally would because
@@ -467,13 +597,16 @@ isc__timer_create(isc_timermgr_t *manager0, isc_timertype_t type,
 	 */
 
 	if (type != isc_timertype_inactive)
-		result = schedule(timer, &now, ISC_TRUE);
+		result = schedule(timer, &now, &signal);
 	else
 		result = ISC_R_SUCCESS;
 	if (result == ISC_R_SUCCESS)
-		APPEND(manager->timers, timer, link);
+		APPEND(wheel->timers, timer, link);
 
-	UNLOCK(&manager->lock);
+	UNLOCK(&wheel->lock);
+
+	if (signal)
+		wakeup(manager);
 
 	if (result != ISC_R_SUCCESS) {
 		timer->common.impmagic = 0;
@@ -497,7 +630,9 @@ isc__timer_reset(isc_timer_t *timer0, isc_timertype_t type,
 	isc__timer_t *timer = (isc__timer_t *)timer0;
 	isc_time_t now;
 	isc__timermgr_t *manager;
+	timerwheel_t *wheel;
 	isc_result_t result;
+	isc_boolean_t signal = ISC_FALSE;
 
 	/*
 	 * Change the timer's type, expires, and interval values to the given
@@ -508,6 +643,7 @@ isc__timer_reset(isc_timer_t *timer0, isc_timertype_t type,
 	REQUIRE(VALID_TIMER(timer));
 	manager = timer->manager;
 	REQUIRE(VALID_MANAGER(manager));
+	wheel = timer->wheel;
 
 	if (expires == NULL)
 		expires = isc_time_epoch;
@@ -532,7 +668,7 @@ isc__timer_reset(isc_timer_t *timer0, isc_timertype_t type,
 		isc_time_settoepoch(&now);
 	}
 
-	LOCK(&manager->lock);
+	LOCK(&wheel->lock);
 	LOCK(&timer->lock);
 
 	if (purge)
@@ -556,11 +692,14 @@ isc__timer_reset(isc_timer_t *timer0, isc_timertype_t type,
 			deschedule(timer);
 			result = ISC_R_SUCCESS;
 		} else
-			result = schedule(timer, &now, ISC_TRUE);
+			result = schedule(timer, &now, &signal);
 	}
 
 	UNLOCK(&timer->lock);
-	UNLOCK(&manager->lock);
+	UNLOCK(&wheel->lock);
+
+	if (signal)
+		wakeup(manager);
 
 	return (result);
 }
@@ -598,7 +737,7 @@ isc__timer_touch(isc_timer_t *timer0) {
 	 *
 	 *	REQUIRE(timer->type == isc_timertype_once);
 	 *
-	 * but we cannot without locking the manager lock too, which we
+	 * but we cannot without locking the wheel lock too, which we
 	 * don't want to do.
 	 */
 
@@ -654,125 +793,216 @@ isc__timer_detach(isc_timer_t **timerp) {
 	*timerp = NULL;
 }
 
+/*%
+ * Post the event for a timer which the wheel has turned to, and
+ * reschedule it if need be.
+ *
+ * Requires the wheel to be locked.
+ */
 static void
-dispatch(isc__timermgr_t *manager, isc_time_t *now) {
-	isc_boolean_t done = ISC_FALSE, post_event, need_schedule;
+expire(isc__timer_t *timer, isc_time_t *now) {
+	isc_boolean_t post_event, need_schedule;
 	isc_timerevent_t *event;
 	isc_eventtype_t type = 0;
-	isc__timer_t *timer;
 	isc_result_t result;
 	isc_boolean_t idle;
 
-	/*!
-	 * The caller must be holding the manager lock.
-	 */
+	INSIST(timer->type != isc_timertype_inactive);
+
+	if (timer->type == isc_timertype_ticker) {
+		type = ISC_TIMEREVENT_TICK;
+		post_event = ISC_TRUE;
+		need_schedule = ISC_TRUE;
+	} else if (timer->type == isc_timertype_limited) {
+		int cmp;
+		cmp = isc_time_compare(now, &timer->expires);
+		if (cmp >= 0) {
+			type = ISC_TIMEREVENT_LIFE;
+			post_event = ISC_TRUE;
+			need_schedule = ISC_FALSE;
+		} else {
+			type = ISC_TIMEREVENT_TICK;
+			post_event = ISC_TRUE;
+			need_schedule = ISC_TRUE;
+		}
+	} else if (!isc_time_isepoch(&timer->expires) &&
+		   isc_time_compare(now,
+				    &timer->expires) >= 0) {
+		type = ISC_TIMEREVENT_LIFE;
+		post_event = ISC_TRUE;
+		need_schedule = ISC_FALSE;
+	} else {
+		idle = ISC_FALSE;
+
+		LOCK(&timer->lock);
+		if (!isc_time_isepoch(&timer->idle) &&
+		    isc_time_compare(now,
+				     &timer->idle) >= 0) {
+			idle = ISC_TRUE;
+		}
+		UNLOCK(&timer->lock);
+		if (idle) {
+			type = ISC_TIMEREVENT_IDLE;
+			post_event = ISC_TRUE;
+			need_schedule = ISC_FALSE;
+		} else {
+			/*
+			 * Idle timer has been touched;
+			 * reschedule.
+			 */
+			XTRACEID(isc_msgcat_get(isc_msgcat,
+						ISC_MSGSET_TIMER,
+						ISC_MSG_IDLERESCHED,
+						"idle reschedule"),
+				 timer);
+			post_event = ISC_FALSE;
+			need_schedule = ISC_TRUE;
+		}
+	}
+
+	if (post_event) {
+		XTRACEID(isc_msgcat_get(isc_msgcat,
+					ISC_MSGSET_TIMER,
+					ISC_MSG_POSTING,
+					"posting"), timer);
+		/*
+		 * XXX We could preallocate this event.
+		 */
+		event = (isc_timerevent_t *)isc_event_allocate(
+						timer->manager->mctx,
+						timer,
+						type,
+						timer->action,
+						timer->arg,
+						sizeof(*event));
+
+		if (event != NULL) {
+			event->due = timer->due;
+			isc_task_send(timer->task,
+				      ISC_EVENT_PTR(&event));
+		} else
+			UNEXPECTED_ERROR(__FILE__, __LINE__, "%s",
+				 isc_msgcat_get(isc_msgcat,
+					 ISC_MSGSET_TIMER,
+					 ISC_MSG_EVENTNOTALLOC,
+					 "couldn't "
+					 "allocate event"));
+	}
+
+	timer->scheduled = ISC_FALSE;
+	timer->wheel->nscheduled--;
+
+	if (need_schedule) {
+		result = schedule(timer, now, NULL);
+		if (result != ISC_R_SUCCESS)
+			UNEXPECTED_ERROR(__FILE__, __LINE__,
+					 "%s: %u",
+				isc_msgcat_get(isc_msgcat,
+					ISC_MSGSET_TIMER,
+					ISC_MSG_SCHEDFAIL,
+					"couldn't schedule "
+					"timer"),
+					 result);
+	}
+}
 
-	while (manager->nscheduled > 0 && !done) {
-		timer = isc_heap_element(manager->heap, 1);
-		INSIST(timer != NULL && timer->type != isc_timertype_inactive);
-		if (isc_time_compare(now, &timer->due) >= 0) {
-			if (timer->type == isc_timertype_ticker) {
-				type = ISC_TIMEREVENT_TICK;
-				post_event = ISC_TRUE;
-				need_schedule = ISC_TRUE;
-			} else if (timer->type == isc_timertype_limited) {
-				int cmp;
-				cmp = isc_time_compare(now, &timer->expires);
-				if (cmp >= 0) {
-					type = ISC_TIMEREVENT_LIFE;
-					post_event = ISC_TRUE;
-					need_schedule = ISC_FALSE;
-				} else {
-					type = ISC_TIMEREVENT_TICK;
-					post_event = ISC_TRUE;
-					need_schedule = ISC_TRUE;
-				}
-			} else if (!isc_time_isepoch(&timer->expires) &&
-				   isc_time_compare(now,
-						    &timer->expires) >= 0) {
-				type = ISC_TIMEREVENT_LIFE;
-				post_event = ISC_TRUE;
-				need_schedule = ISC_FALSE;
-			} else {
-				idle = ISC_FALSE;
-
-				LOCK(&timer->lock);
-				if (!isc_time_isepoch(&timer->idle) &&
-				    isc_time_compare(now,
-						     &timer->idle) >= 0) {
-					idle = ISC_TRUE;
-				}
-				UNLOCK(&timer->lock);
-				if (idle) {
-					type = ISC_TIMEREVENT_IDLE;
-					post_event = ISC_TRUE;
-					need_schedule = ISC_FALSE;
-				} else {
-					/*
-					 * Idle timer has been touched;
-					 * reschedule.
-					 */
-					XTRACEID(isc_msgcat_get(isc_msgcat,
-								ISC_MSGSET_TIMER,
-								ISC_MSG_IDLERESCHED,
-								"idle reschedule"),
-						 timer);
-					post_event = ISC_FALSE;
-					need_schedule = ISC_TRUE;
-				}
+/*%
+ * Turn 'wheel' up to and including the tick for 'now', firing the
+ * timers which are due.
+ *
+ * Requires the wheel to be locked.
+ */
+static void
+turn(timerwheel_t *wheel, isc_time_t *now) {
+	isc_uint64_t target, next;
+	unsigned int level, shift, slot;
+	timerlist_t list;
+	isc__timer_t *timer;
+
+	target = time2tick(now, ISC_FALSE);
+	while (wheel->now <= target) {
+		/*
+		 * Skip straight to the next tick with something to do.
+		 */
+		next = (wheel->nscheduled == 0) ? TICK_NEVER : nextturn(wheel);
+		if (next > target) {
+			wheel->now = target + 1;
+			break;
+		}
+		wheel->now = next;
+
+		/*
+		 * Cascade the slots whose span starts here, highest level
+		 * first, as timers may move into the slots below.
+		 */
+		for (level = 1; level < WHEEL_LEVELS; level++)
+			if ((wheel->now & (WHEEL_SPAN(level) - 1)) != 0)
+				break;
+		while (--level > 0) {
+			shift = WHEEL_BITS * level;
+			slot = (wheel->now >> shift) & WHEEL_MASK;
+			list = wheel->slots[level][slot];
+			INIT_LIST(wheel->slots[level][slot]);
+			wheel->occupied[level] &= ~((isc_uint64_t)1 << slot);
+			while ((timer = HEAD(list)) != NULL) {
+				UNLINK(list, timer, wlink);
+				(void)file(wheel, timer);
 			}
+		}
 
-			if (post_event) {
-				XTRACEID(isc_msgcat_get(isc_msgcat,
-							ISC_MSGSET_TIMER,
-							ISC_MSG_POSTING,
-							"posting"), timer);
+		/*
+		 * Take the timers due now off the wheel before expiring
+		 * them, as a ticker may be filed in this slot again.
+		 */
+		slot = wheel->now & WHEEL_MASK;
+		list = wheel->slots[0][slot];
+		INIT_LIST(wheel->slots[0][slot]);
+		wheel->occupied[0] &= ~((isc_uint64_t)1 << slot);
+		wheel->now++;
+
+		while ((timer = HEAD(list)) != NULL) {
+			UNLINK(list, timer, wlink);
+			if (isc_time_compare(now, &timer->due) < 0) {
 				/*
-				 * XXX We could preallocate this event.
+				 * Due later in the same millisecond; leave
+				 * it for the next turn.
 				 */
-				event = (isc_timerevent_t *)isc_event_allocate(manager->mctx,
-							   timer,
-							   type,
-							   timer->action,
-							   timer->arg,
-							   sizeof(*event));
-
-				if (event != NULL) {
-					event->due = timer->due;
-					isc_task_send(timer->task,
-						      ISC_EVENT_PTR(&event));
-				} else
-					UNEXPECTED_ERROR(__FILE__, __LINE__, "%s",
-						 isc_msgcat_get(isc_msgcat,
-							 ISC_MSGSET_TIMER,
-							 ISC_MSG_EVENTNOTALLOC,
-							 "couldn't "
-							 "allocate event"));
-			}
-
-			timer->index = 0;
-			isc_heap_delete(manager->heap, 1);
-			manager->nscheduled--;
-
-			if (need_schedule) {
-				result = schedule(timer, now, ISC_FALSE);
-				if (result != ISC_R_SUCCESS)
-					UNEXPECTED_ERROR(__FILE__, __LINE__,
-							 "%s: %u",
-						isc_msgcat_get(isc_msgcat,
-							ISC_MSGSET_TIMER,
-							ISC_MSG_SCHEDFAIL,
-							"couldn't schedule "
-							"timer"),
-							 result);
+				timer->tick = target + 1;
+				(void)file(wheel, timer);
+				continue;
 			}
-		} else {
-			manager->due = timer->due;
-			done = ISC_TRUE;
+			expire(timer, now);
 		}
 	}
 }
 
+/*%
+ * Turn every wheel and return, in '*duep', when the wheels next need
+ * turning.  Returns ISC_FALSE if no timers are scheduled.
+ */
+static isc_boolean_t
+dispatch(isc__timermgr_t *manager, isc_time_t *now, isc_time_t *duep) {
+	timerwheel_t *wheel;
+	isc_uint64_t due = TICK_NEVER;
+	unsigned int i;
+
+	for (i = 0; i < manager->nwheels; i++) {
+		wheel = &manager->wheels[i];
+		LOCK(&wheel->lock);
+		turn(wheel, now);
+		wheel->wake = (wheel->nscheduled == 0) ? TICK_NEVER :
+			      nextturn(wheel);
+		if (wheel->wake < due)
+			due = wheel->wake;
+		UNLOCK(&wheel->lock);
+	}
+
+	if (due == TICK_NEVER)
+		return (ISC_FALSE);
+	tick2time(due, duep);
+	return (ISC_TRUE);
+}
+
 #ifdef USE_TIMER_THREAD
 static isc_threadresult_t
 #ifdef _WIN32			/* XXXDCL */
@@ -780,26 +1010,34 @@ WINAPI
 #endif
 run(void *uap) {
 	isc__timermgr_t *manager = uap;
-	isc_time_t now;
+	isc_time_t now, due;
+	isc_boolean_t scheduled;
 	isc_result_t result;
 
 	LOCK(&manager->lock);
 	while (!manager->done) {
+		manager->poked = ISC_FALSE;
+		UNLOCK(&manager->lock);
+
 		TIME_NOW(&now);
 
 		XTRACETIME(isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
 					  ISC_MSG_RUNNING,
 					  "running"), now);
 
-		dispatch(manager, &now);
+		scheduled = dispatch(manager, &now, &due);
 
-		if (manager->nscheduled > 0) {
+		LOCK(&manager->lock);
+		if (manager->poked || manager->done)
+			continue;
+		if (scheduled) {
 			XTRACETIME2(isc_msgcat_get(isc_msgcat,
 						   ISC_MSGSET_GENERAL,
 						   ISC_MSG_WAITUNTIL,
 						   "waituntil"),
-				    manager->due, now);
-			result = WAITUNTIL(&manager->wakeup, &manager->lock, &manager->due);
+				    due, now);
+			result = WAITUNTIL(&manager->wakeup, &manager->lock,
+					   &due);
 			INSIST(result == ISC_R_SUCCESS ||
 			       result == ISC_R_TIMEDOUT);
 		} else {
@@ -820,28 +1058,59 @@ run(void *uap) {
 }
 #endif /* USE_TIMER_THREAD */
 
-static isc_boolean_t
-sooner(void *v1, void *v2) {
-	isc__timer_t *t1, *t2;
+static isc_result_t
+wheels_create(isc__timermgr_t *manager) {
+	timerwheel_t *wheel;
+	isc_result_t result;
+	isc_time_t now;
+	unsigned int i, level, slot;
 
-	t1 = v1;
-	t2 = v2;
-	REQUIRE(VALID_TIMER(t1));
-	REQUIRE(VALID_TIMER(t2));
+	manager->nwheels = 1;
+#ifdef USE_TIMER_THREAD
+	while (manager->nwheels < isc_os_ncpus() &&
+	       manager->nwheels < TIMER_MAXWHEELS)
+		manager->nwheels <<= 1;
+#endif
+	manager->wheels = isc_mem_get(manager->mctx,
+				      manager->nwheels * sizeof(timerwheel_t));
+	if (manager->wheels == NULL)
+		return (ISC_R_NOMEMORY);
 
-	if (isc_time_compare(&t1->due, &t2->due) < 0)
-		return (ISC_TRUE);
-	return (ISC_FALSE);
+	TIME_NOW(&now);
+	for (i = 0; i < manager->nwheels; i++) {
+		wheel = &manager->wheels[i];
+		result = isc_mutex_init(&wheel->lock);
+		if (result != ISC_R_SUCCESS) {
+			while (i-- > 0)
+				DESTROYLOCK(&manager->wheels[i].lock);
+			isc_mem_put(manager->mctx, manager->wheels,
+				    manager->nwheels * sizeof(timerwheel_t));
+			return (result);
+		}
+		wheel->now = time2tick(&now, ISC_FALSE);
+		wheel->wake = TICK_NEVER;
+		wheel->nscheduled = 0;
+		INIT_LIST(wheel->timers);
+		for (level = 0; level < WHEEL_LEVELS; level++) {
+			wheel->occupied[level] = 0;
+			for (slot = 0; slot < WHEEL_SLOTS; slot++)
+				INIT_LIST(wheel->slots[level][slot]);
+		}
+	}
+
+	return (ISC_R_SUCCESS);
 }
 
 static void
-set_index(void *what, unsigned int index) {
-	isc__timer_t *timer;
+wheels_destroy(isc__timermgr_t *manager) {
+	unsigned int i;
 
-	timer = what;
-	REQUIRE(VALID_TIMER(timer));
-
-	timer->index = index;
+	for (i = 0; i < manager->nwheels; i++) {
+		REQUIRE(EMPTY(manager->wheels[i].timers));
+		DESTROYLOCK(&manager->wheels[i].lock);
+	}
+	isc_mem_put(manager->mctx, manager->wheels,
+		    manager->nwheels * sizeof(timerwheel_t));
 }
 
 isc_result_t
@@ -855,6 +1124,8 @@ isc__timermgr_create(isc_mem_t *mctx, isc_timermgr_t **managerp) {
 
 	REQUIRE(managerp != NULL && *managerp == NULL);
 
+	RUNTIME_CHECK(isc_once_do(&once, initialize) == ISC_R_SUCCESS);
+
 #ifdef USE_SHARED_MANAGER
 	if (timermgr != NULL) {
 		timermgr->refs++;
@@ -872,28 +1143,25 @@ isc__timermgr_create(isc_mem_t *mctx, isc_timermgr_t **managerp) {
 	manager->common.methods = (isc_timermgrmethods_t *)&timermgrmethods;
 	manager->mctx = NULL;
 	manager->done = ISC_FALSE;
-	INIT_LIST(manager->timers);
-	manager->nscheduled = 0;
-	isc_time_settoepoch(&manager->due);
-	manager->heap = NULL;
-	result = isc_heap_create(mctx, sooner, set_index, 0, &manager->heap);
+	manager->poked = ISC_FALSE;
+	result = isc_mutex_init(&manager->lock);
 	if (result != ISC_R_SUCCESS) {
-		INSIST(result == ISC_R_NOMEMORY);
 		isc_mem_put(mctx, manager, sizeof(*manager));
-		return (ISC_R_NOMEMORY);
+		return (result);
 	}
-	result = isc_mutex_init(&manager->lock);
+	isc_mem_attach(mctx, &manager->mctx);
+	result = wheels_create(manager);
 	if (result != ISC_R_SUCCESS) {
-		isc_heap_destroy(&manager->heap);
+		isc_mem_detach(&manager->mctx);
+		DESTROYLOCK(&manager->lock);
 		isc_mem_put(mctx, manager, sizeof(*manager));
 		return (result);
 	}
-	isc_mem_attach(mctx, &manager->mctx);
 #ifdef USE_TIMER_THREAD
 	if (isc_condition_init(&manager->wakeup) != ISC_R_SUCCESS) {
+		wheels_destroy(manager);
 		isc_mem_detach(&manager->mctx);
 		DESTROYLOCK(&manager->lock);
-		isc_heap_destroy(&manager->heap);
 		isc_mem_put(mctx, manager, sizeof(*manager));
 		UNEXPECTED_ERROR(__FILE__, __LINE__,
 				 "isc_condition_init() %s",
@@ -903,10 +1171,10 @@ isc__timermgr_create(isc_mem_t *mctx, isc_timermgr_t **managerp) {
 	}
 	if (isc_thread_create(run, manager, &manager->thread) !=
 	    ISC_R_SUCCESS) {
-		isc_mem_detach(&manager->mctx);
 		(void)isc_condition_destroy(&manager->wakeup);
+		wheels_destroy(manager);
+		isc_mem_detach(&manager->mctx);
 		DESTROYLOCK(&manager->lock);
-		isc_heap_destroy(&manager->heap);
 		isc_mem_put(mctx, manager, sizeof(*manager));
 		UNEXPECTED_ERROR(__FILE__, __LINE__,
 				 "isc_thread_create() %s",
@@ -968,7 +1236,6 @@ isc__timermgr_destroy(isc_timermgr_t **managerp) {
 	isc__timermgr_dispatch((isc_timermgr_t *)manager);
 #endif
 
-	REQUIRE(EMPTY(manager->timers));
 	manager->done = ISC_TRUE;
 
 #ifdef USE_TIMER_THREAD
@@ -996,8 +1263,8 @@ isc__timermgr_destroy(isc_timermgr_t **managerp) {
 #ifdef USE_TIMER_THREAD
 	(void)isc_condition_destroy(&manager->wakeup);
 #endif /* USE_TIMER_THREAD */
+	wheels_destroy(manager);
 	DESTROYLOCK(&manager->lock);
-	isc_heap_destroy(&manager->heap);
 	manager->common.impmagic = 0;
 	manager->common.magic = 0;
 	mctx = manager->mctx;
@@ -1015,21 +1282,28 @@ isc__timermgr_destroy(isc_timermgr_t **managerp) {
 isc_result_t
 isc__timermgr_nextevent(isc_timermgr_t *manager0, isc_time_t *when) {
 	isc__timermgr_t *manager = (isc__timermgr_t *)manager0;
+	isc_uint64_t due = TICK_NEVER;
+	unsigned int i;
 
 #ifdef USE_SHARED_MANAGER
 	if (manager == NULL)
 		manager = timermgr;
 #endif
-	if (manager == NULL || manager->nscheduled == 0)
+	if (manager == NULL)
 		return (ISC_R_NOTFOUND);
-	*when = manager->due;
+	for (i = 0; i < manager->nwheels; i++)
+		if (manager->wheels[i].wake < due)
+			due = manager->wheels[i].wake;
+	if (due == TICK_NEVER)
+		return (ISC_R_NOTFOUND);
+	tick2time(due, when);
 	return (ISC_R_SUCCESS);
 }
 
 void
 isc__timermgr_dispatch(isc_timermgr_t *manager0) {
 	isc__timermgr_t *manager = (isc__timermgr_t *)manager0;
-	isc_time_t now;
+	isc_time_t now, due;
 
 #ifdef USE_SHARED_MANAGER
 	if (manager == NULL)
@@ -1038,7 +1312,7 @@ isc__timermgr_dispatch(isc_timermgr_t *manager0) {
 	if (manager == NULL)
 		return;
 	TIME_NOW(&now);
-	dispatch(manager, &now);
+	(void)dispatch(manager, &now, &due);
 }
 #endif /* USE_TIMER_THREAD */
 
@@ -1047,15 +1321,6 @@ isc__timer_register(void) {
 	return (isc_timer_register(isc__timermgr_create));
 }
 
-static isc_mutex_t createlock;
-static isc_once_t once = ISC_ONCE_INIT;
-static isc_timermgrcreatefunc_t timermgr_createfunc = NULL;
-
-static void
-initialize(void) {
-	RUNTIME_CHECK(isc_mutex_init(&createlock) == ISC_R_SUCCESS);
-}
-
 isc_result_t
 isc_timer_register(isc_timermgrcreatefunc_t createfunc) {
 	isc_result_t result = ISC_R_SUCCESS;
@@ -47,6 +47,7 @@
 #include <isc/mutex.h>
 #include <isc/net.h>
 #include <isc/once.h>
+#include <isc/os.h>
 #include <isc/platform.h>
 #include <isc/print.h>
 #include <isc/region.h>
@@ -117,6 +118,25 @@ typedef struct {
 #define USE_SELECT
 #endif	/* ISC_PLATFORM_HAVEKQUEUE */
 
+/*%
+ * kqueue and epoll keep all of their polling state in a per-thread
+ * descriptor, so the socket manager can run several watcher threads,
+ * each polling its own share of the sockets.  The other methods are
+ * limited to a single watcher.
+ */
+#if defined(USE_WATCHER_THREAD) && (defined(USE_KQUEUE) || defined(USE_EPOLL))
+#define USE_MULTI_WATCHER
+#endif
+
+/*%
+ * Use recvmmsg()/sendmmsg() to move several datagrams per system call
+ * on sockets that have batching enabled with isc_socket_setbatch().
+ */
+#if defined(__linux__) && defined(ISC_NET_BSD44MSGHDR) && \
+    defined(MSG_WAITFORONE)
+#define USE_MMSG
+#endif
+
 #ifndef USE_WATCHER_THREAD
 #if defined(USE_KQUEUE) || defined(USE_EPOLL) || defined(USE_DEVPOLL)
 struct isc_socketwait {
@@ -323,6 +343,7 @@ typedef isc_event_t intev_t;
 
 typedef struct isc__socket isc__socket_t;
 typedef struct isc__socketmgr isc__socketmgr_t;
+typedef struct isc__socketthread isc__socketthread_t;
 
 #define NEWCONNSOCK(ev) ((isc__socket_t *)(ev)->newsocket)
 
@@ -356,6 +377,7 @@ struct isc__socket {
 	intev_t			writable_ev;
 
 	isc_sockaddr_t		peer_address;       /* remote address */
+	int			threadid;	    /* watcher thread */
 
 	unsigned int		pending_recv : 1,
 				pending_send : 1,
@@ -367,6 +389,7 @@ struct isc__socket {
 				dupped : 1,
 				active : 1,         /* currently active */
 				pktdscp : 1;	    /* per packet dscp */
+	unsigned int		batch;		    /* UDP mmsg batch size */
 
 #ifdef ISC_NET_RECVOVERFLOW
 	unsigned char		overflow; /* used for MSG_TRUNC fake */
@@ -376,6 +399,10 @@ struct isc__socket {
 	ISC_SOCKADDR_LEN_T	recvcmsgbuflen;
 	char			*sendcmsgbuf;
 	ISC_SOCKADDR_LEN_T	sendcmsgbuflen;
+#ifdef USE_MMSG
+	char			*batchcmsgbuf;	/* per-message cmsg space */
+	size_t			batchcmsgbuflen;
+#endif
 
 	void			*fdwatcharg;
 	isc_sockfdwatch_t	fdwatchcb;
@@ -387,13 +414,14 @@ struct isc__socket {
 #define SOCKET_MANAGER_MAGIC	ISC_MAGIC('I', 'O', 'm', 'g')
 #define VALID_MANAGER(m)	ISC_MAGIC_VALID(m, SOCKET_MANAGER_MAGIC)
 
-struct isc__socketmgr {
-	/* Not locked. */
-	isc_socketmgr_t		common;
-	isc_mem_t	       *mctx;
-	isc_mutex_t		lock;
-	isc_mutex_t		*fdlock;
-	isc_stats_t		*stats;
+/*%
+ * Per watcher thread state.  Each descriptor is owned by exactly one
+ * watcher thread (isc__socket_t.threadid), which polls it through its
+ * own event queue and is poked through its own control pipe.
+ */
+struct isc__socketthread {
+	isc__socketmgr_t	*manager;
+	int			threadid;
 #ifdef USE_KQUEUE
 	int			kqueue_fd;
 	int			nevents;
@@ -406,18 +434,32 @@ struct isc__socketmgr {
 #endif	/* USE_EPOLL */
 #ifdef USE_DEVPOLL
 	int			devpoll_fd;
-	isc_resourcevalue_t	open_max;
-	unsigned int		calls;
 	int			nevents;
 	struct pollfd		*events;
 #endif	/* USE_DEVPOLL */
+#ifdef USE_WATCHER_THREAD
+	int			pipe_fds[2];
+	isc_thread_t		thread;
+#endif	/* USE_WATCHER_THREAD */
+};
+
+struct isc__socketmgr {
+	/* Not locked. */
+	isc_socketmgr_t		common;
+	isc_mem_t	       *mctx;
+	isc_mutex_t		lock;
+	isc_mutex_t		*fdlock;
+	isc_stats_t		*stats;
+	int			nthreads;
+	isc__socketthread_t	*threads;
+#ifdef USE_DEVPOLL
+	isc_resourcevalue_t	open_max;
+	unsigned int		calls;
+#endif	/* USE_DEVPOLL */
 #ifdef USE_SELECT
 	int			fd_bufsize;
 #endif	/* USE_SELECT */
 	unsigned int		maxsocks;
-#ifdef ISC_PLATFORM_USETHREADS
-	int			pipe_fds[2];
-#endif
 
 	/* Locked by fdlock. */
 	isc__socket_t	       **fds;
@@ -440,7 +482,6 @@ struct isc__socketmgr {
 #endif	/* USE_SELECT */
 	int			reserved;	/* unlocked */
 #ifdef USE_WATCHER_THREAD
-	isc_thread_t		watcher;
 	isc_condition_t		shutdown_ok;
 #else /* USE_WATCHER_THREAD */
 	unsigned int		refs;
@@ -484,12 +525,12 @@ static void internal_send(isc_task_t *, isc_event_t *);
 static void internal_fdwatch_write(isc_task_t *, isc_event_t *);
 static void internal_fdwatch_read(isc_task_t *, isc_event_t *);
 static void process_cmsg(isc__socket_t *, struct msghdr *, isc_socketevent_t *);
-static void build_msghdr_send(isc__socket_t *, isc_socketevent_t *,
+static void build_msghdr_send(isc__socket_t *, char *, isc_socketevent_t *,
 			      struct msghdr *, struct iovec *, size_t *);
-static void build_msghdr_recv(isc__socket_t *, isc_socketevent_t *,
+static void build_msghdr_recv(isc__socket_t *, char *, isc_socketevent_t *,
 			      struct msghdr *, struct iovec *, size_t *);
 #ifdef USE_WATCHER_THREAD
-static isc_boolean_t process_ctlfd(isc__socketmgr_t *manager);
+static isc_boolean_t process_ctlfd(isc__socketthread_t *thread);
 #endif
 static void setdscp(isc__socket_t *sock, isc_dscp_t dscp);
 
@@ -601,6 +642,9 @@ isc_result_t
 isc__socketmgr_create2(isc_mem_t *mctx, isc_socketmgr_t **managerp,
 		       unsigned int maxsocks);
 isc_result_t
+isc__socketmgr_create3(isc_mem_t *mctx, isc_socketmgr_t **managerp,
+		       unsigned int maxsocks, unsigned int nthreads);
+isc_result_t
 isc_socketmgr_getmaxsockets(isc_socketmgr_t *manager0, unsigned int *nsockp);
 void
 isc_socketmgr_setstats(isc_socketmgr_t *manager0, isc_stats_t *stats);
@@ -608,6 +652,10 @@ void
 isc__socketmgr_destroy(isc_socketmgr_t **managerp);
 void
 isc__socket_setname(isc_socket_t *socket0, const char *name, void *tag);
+isc_result_t
+isc__socket_setbatch(isc_socket_t *sock0, unsigned int n);
+void
+isc__socket_setthread(isc_socket_t *sock0, unsigned int threadid);
 const char *
 isc__socket_getname(isc_socket_t *socket0);
 void *
@@ -896,8 +944,17 @@ dec_stats(isc_stats_t *stats, isc_statscounter_t counterid) {
 		isc_stats_decrement(stats, counterid);
 }
 
+/*%
+ * Select the watcher thread that polls a newly opened descriptor.
+ */
+static inline int
+gen_threadid(isc__socketmgr_t *manager, int fd) {
+	return (fd % manager->nthreads);
+}
+
 static inline isc_result_t
-watch_fd(isc__socketmgr_t *manager, int fd, int msg) {
+watch_fd(isc__socketthread_t *thread, int fd, int msg) {
+	isc__socketmgr_t *manager = thread->manager;
 	isc_result_t result = ISC_R_SUCCESS;
 
 #ifdef USE_KQUEUE
@@ -910,7 +967,7 @@ watch_fd(isc__socketmgr_t *manager, int fd, int msg) {
 		evchange.filter = EVFILT_WRITE;
 	evchange.flags = EV_ADD;
 	evchange.ident = fd;
-	if (kevent(manager->kqueue_fd, &evchange, 1, NULL, 0, NULL) != 0)
+	if (kevent(thread->kqueue_fd, &evchange, 1, NULL, 0, NULL) != 0)
 		result = isc__errno2result(errno);
 
 	return (result);
@@ -931,7 +988,7 @@ watch_fd(isc__socketmgr_t *manager, int fd, int msg) {
 	event.data.fd = fd;
 
 	op = (oldevents == 0U) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
-	ret = epoll_ctl(manager->epoll_fd, op, fd, &event);
+	ret = epoll_ctl(thread->epoll_fd, op, fd, &event);
 	if (ret == -1) {
 		if (errno == EEXIST)
 			UNEXPECTED_ERROR(__FILE__, __LINE__,
@@ -953,7 +1010,7 @@ watch_fd(isc__socketmgr_t *manager, int fd, int msg) {
 	pfd.fd = fd;
 	pfd.revents = 0;
 	LOCK(&manager->fdlock[lockid]);
-	if (write(manager->devpoll_fd, &pfd, sizeof(pfd)) == -1)
+	if (write(thread->devpoll_fd, &pfd, sizeof(pfd)) == -1)
 		result = isc__errno2result(errno);
 	else {
 		if (msg == SELECT_POKE_READ)
@@ -977,7 +1034,8 @@ watch_fd(isc__socketmgr_t *manager, int fd, int msg) {
 }
 
 static inline isc_result_t
-unwatch_fd(isc__socketmgr_t *manager, int fd, int msg) {
+unwatch_fd(isc__socketthread_t *thread, int fd, int msg) {
+	isc__socketmgr_t *manager = thread->manager;
 	isc_result_t result = ISC_R_SUCCESS;
 
 #ifdef USE_KQUEUE
@@ -990,7 +1048,7 @@ unwatch_fd(isc__socketmgr_t *manager, int fd, int msg) {
 		evchange.filter = EVFILT_WRITE;
 	evchange.flags = EV_DELETE;
 	evchange.ident = fd;
-	if (kevent(manager->kqueue_fd, &evchange, 1, NULL, 0, NULL) != 0)
+	if (kevent(thread->kqueue_fd, &evchange, 1, NULL, 0, NULL) != 0)
 		result = isc__errno2result(errno);
 
 	return (result);
@@ -1009,7 +1067,7 @@ unwatch_fd(isc__socketmgr_t *manager, int fd, int msg) {
 	event.data.fd = fd;
 
 	op = (event.events == 0U) ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
-	ret = epoll_ctl(manager->epoll_fd, op, fd, &event);
+	ret = epoll_ctl(thread->epoll_fd, op, fd, &event);
 	if (ret == -1 && errno != ENOENT) {
 		char strbuf[ISC_STRERRORSIZE];
 		isc__strerror(errno, strbuf, sizeof(strbuf));
@@ -1046,7 +1104,7 @@ unwatch_fd(isc__socketmgr_t *manager, int fd, int msg) {
 		writelen += sizeof(pfds[1]);
 	}
 
-	if (write(manager->devpoll_fd, pfds, writelen) == -1)
+	if (write(thread->devpoll_fd, pfds, writelen) == -1)
 		result = isc__errno2result(errno);
 	else {
 		if (msg == SELECT_POKE_READ)
@@ -1070,7 +1128,8 @@ unwatch_fd(isc__socketmgr_t *manager, int fd, int msg) {
 }
 
 static void
-wakeup_socket(isc__socketmgr_t *manager, int fd, int msg) {
+wakeup_socket(isc__socketthread_t *thread, int fd, int msg) {
+	isc__socketmgr_t *manager = thread->manager;
 	isc_result_t result;
 	int lockid = FDLOCK_ID(fd);
 
@@ -1086,8 +1145,8 @@ wakeup_socket(isc__socketmgr_t *manager, int fd, int msg) {
 		/* No one should be updating fdstate, so no need to lock it */
 		INSIST(manager->fdstate[fd] == CLOSE_PENDING);
 		manager->fdstate[fd] = CLOSED;
-		(void)unwatch_fd(manager, fd, SELECT_POKE_READ);
-		(void)unwatch_fd(manager, fd, SELECT_POKE_WRITE);
+		(void)unwatch_fd(thread, fd, SELECT_POKE_READ);
+		(void)unwatch_fd(thread, fd, SELECT_POKE_WRITE);
 		(void)close(fd);
 		return;
 	}
@@ -1104,8 +1163,8 @@ wakeup_socket(isc__socketmgr_t *manager, int fd, int msg) {
 		 * fdlock; otherwise it could cause deadlock due to a lock order
 		 * reversal.
 		 */
-		(void)unwatch_fd(manager, fd, SELECT_POKE_READ);
-		(void)unwatch_fd(manager, fd, SELECT_POKE_WRITE);
+		(void)unwatch_fd(thread, fd, SELECT_POKE_READ);
+		(void)unwatch_fd(thread, fd, SELECT_POKE_WRITE);
 		return;
 	}
 	if (manager->fdstate[fd] != MANAGED) {
@@ -1117,7 +1176,7 @@ wakeup_socket(isc__socketmgr_t *manager, int fd, int msg) {
 	/*
 	 * Set requested bit.
 	 */
-	result = watch_fd(manager, fd, msg);
+	result = watch_fd(thread, fd, msg);
 	if (result != ISC_R_SUCCESS) {
 		/*
 		 * XXXJT: what should we do?  Ignoring the failure of watching
@@ -1133,21 +1192,24 @@ wakeup_socket(isc__socketmgr_t *manager, int fd, int msg) {
 
 #ifdef USE_WATCHER_THREAD
 /*
- * Poke the select loop when there is something for us to do.
- * The write is required (by POSIX) to complete.  That is, we
- * will not get partial writes.
+ * Poke the select loop of watcher thread 'threadid' when there is
+ * something for it to do.  The write is required (by POSIX) to complete.
+ * That is, we will not get partial writes.
  */
 static void
-select_poke(isc__socketmgr_t *mgr, int fd, int msg) {
+select_poke(isc__socketmgr_t *mgr, int threadid, int fd, int msg) {
 	int cc;
 	int buf[2];
 	char strbuf[ISC_STRERRORSIZE];
 
+	REQUIRE(threadid >= 0 && threadid < mgr->nthreads);
+
 	buf[0] = fd;
 	buf[1] = msg;
 
 	do {
-		cc = write(mgr->pipe_fds[1], buf, sizeof(buf));
+		cc = write(mgr->threads[threadid].pipe_fds[1], buf,
+			   sizeof(buf));
 #ifdef ENOSR
 		/*
 		 * Treat ENOSR as EAGAIN but loop slowly as it is
@@ -1177,12 +1239,12 @@ select_poke(isc__socketmgr_t *mgr, int fd, int msg) {
  * Read a message on the internal fd.
  */
 static void
-select_readmsg(isc__socketmgr_t *mgr, int *fd, int *msg) {
+select_readmsg(isc__socketthread_t *thread, int *fd, int *msg) {
 	int buf[2];
 	int cc;
 	char strbuf[ISC_STRERRORSIZE];
 
-	cc = read(mgr->pipe_fds[0], buf, sizeof(buf));
+	cc = read(thread->pipe_fds[0], buf, sizeof(buf));
 	if (cc < 0) {
 		*msg = SELECT_POKE_NOTHING;
 		*fd = -1;	/* Silence compiler. */
@@ -1207,11 +1269,11 @@ select_readmsg(isc__socketmgr_t *mgr, int *fd, int *msg) {
  * Update the state of the socketmgr when something changes.
  */
 static void
-select_poke(isc__socketmgr_t *manager, int fd, int msg) {
+select_poke(isc__socketmgr_t *manager, int threadid, int fd, int msg) {
 	if (msg == SELECT_POKE_SHUTDOWN)
 		return;
 	else if (fd >= 0)
-		wakeup_socket(manager, fd, msg);
+		wakeup_socket(&manager->threads[threadid], fd, msg);
 	return;
 }
 #endif /* USE_WATCHER_THREAD */
@@ -1431,11 +1493,14 @@ process_cmsg(isc__socket_t *sock, struct msghdr *msg, isc_socketevent_t *dev) {
  * Nothing can be NULL, and the done event must list at least one buffer
  * on the buffer linked list for this function to be meaningful.
  *
+ * Control messages are built in 'cmsgbuf', which must be at least
+ * sock->sendcmsgbuflen bytes long.
+ *
  * If write_countp != NULL, *write_countp will hold the number of bytes
  * this transaction can send.
  */
 static void
-build_msghdr_send(isc__socket_t *sock, isc_socketevent_t *dev,
+build_msghdr_send(isc__socket_t *sock, char *cmsgbuf, isc_socketevent_t *dev,
 		  struct msghdr *msg, struct iovec *iov, size_t *write_countp)
 {
 	unsigned int iovcount;
@@ -1449,7 +1514,7 @@ build_msghdr_send(isc__socket_t *sock, isc_socketevent_t *dev,
 
 	memset(msg, 0, sizeof(*msg));
 	if (sock->sendcmsgbuflen != 0U) {
-		memset(sock->sendcmsgbuf, 0, sock->sendcmsgbuflen);
+		memset(cmsgbuf, 0, sock->sendcmsgbuflen);
 	}
 
 	if (!sock->connected) {
@@ -1528,11 +1593,11 @@ build_msghdr_send(isc__socket_t *sock, isc_socketevent_t *dev,
 			   "sendto pktinfo data, ifindex %u",
 			   dev->pktinfo.ipi6_ifindex);
 
-		msg->msg_control = (void *)sock->sendcmsgbuf;
+		msg->msg_control = (void *)cmsgbuf;
 		msg->msg_controllen = cmsg_space(sizeof(struct in6_pktinfo));
 		INSIST(msg->msg_controllen <= sock->sendcmsgbuflen);
 
-		cmsgp = (struct cmsghdr *)sock->sendcmsgbuf;
+		cmsgp = (struct cmsghdr *)cmsgbuf;
 		cmsgp->cmsg_level = IPPROTO_IPV6;
 		cmsgp->cmsg_type = IPV6_PKTINFO;
 		cmsgp->cmsg_len = cmsg_len(sizeof(struct in6_pktinfo));
@@ -1547,9 +1612,9 @@ build_msghdr_send(isc__socket_t *sock, isc_socketevent_t *dev,
 	{
 		int use_min_mtu = 1;	/* -1, 0, 1 */
 
-		cmsgp = (struct cmsghdr *)(sock->sendcmsgbuf +
+		cmsgp = (struct cmsghdr *)(cmsgbuf +
 					   msg->msg_controllen);
-		msg->msg_control = (void *)sock->sendcmsgbuf;
+		msg->msg_control = (void *)cmsgbuf;
 		msg->msg_controllen += cmsg_space(sizeof(use_min_mtu));
 		INSIST(msg->msg_controllen <= sock->sendcmsgbuflen);
 
@@ -1576,9 +1641,9 @@ build_msghdr_send(isc__socket_t *sock, isc_socketevent_t *dev,
 
 #ifdef IP_TOS
 		if (sock->pf == AF_INET && sock->pktdscp) {
-			cmsgp = (struct cmsghdr *)(sock->sendcmsgbuf +
+			cmsgp = (struct cmsghdr *)(cmsgbuf +
 						   msg->msg_controllen);
-			msg->msg_control = (void *)sock->sendcmsgbuf;
+			msg->msg_control = (void *)cmsgbuf;
 			msg->msg_controllen += cmsg_space(sizeof(dscp));
 			INSIST(msg->msg_controllen <= sock->sendcmsgbuflen);
 
@@ -1607,9 +1672,9 @@ build_msghdr_send(isc__socket_t *sock, isc_socketevent_t *dev,
 #endif
 #if defined(IPPROTO_IPV6) && defined(IPV6_TCLASS)
 		if (sock->pf == AF_INET6 && sock->pktdscp) {
-			cmsgp = (struct cmsghdr *)(sock->sendcmsgbuf +
+			cmsgp = (struct cmsghdr *)(cmsgbuf +
 						   msg->msg_controllen);
-			msg->msg_control = (void *)sock->sendcmsgbuf;
+			msg->msg_control = (void *)cmsgbuf;
 			msg->msg_controllen += cmsg_space(sizeof(dscp));
 			INSIST(msg->msg_controllen <= sock->sendcmsgbuflen);
 
@@ -1638,7 +1703,7 @@ build_msghdr_send(isc__socket_t *sock, isc_socketevent_t *dev,
 		if (msg->msg_controllen != 0 &&
 		    msg->msg_controllen < sock->sendcmsgbuflen)
 		{
-			memset(sock->sendcmsgbuf + msg->msg_controllen, 0,
+			memset(cmsgbuf + msg->msg_controllen, 0,
 			       sock->sendcmsgbuflen - msg->msg_controllen);
 		}
 	}
@@ -1661,11 +1726,14 @@ build_msghdr_send(isc__socket_t *sock, isc_socketevent_t *dev,
  * Nothing can be NULL, and the done event must list at least one buffer
  * on the buffer linked list for this function to be meaningful.
  *
+ * Control messages are received into 'cmsgbuf', which must be at least
+ * sock->recvcmsgbuflen bytes long.
+ *
  * If read_countp != NULL, *read_countp will hold the number of bytes
  * this transaction can receive.
  */
 static void
-build_msghdr_recv(isc__socket_t *sock, isc_socketevent_t *dev,
+build_msghdr_recv(isc__socket_t *sock, char *cmsgbuf, isc_socketevent_t *dev,
 		  struct msghdr *msg, struct iovec *iov, size_t *read_countp)
 {
 	unsigned int iovcount;
@@ -1768,7 +1836,7 @@ build_msghdr_recv(isc__socket_t *sock, isc_socketevent_t *dev,
 
 #ifdef ISC_NET_BSD44MSGHDR
 #if defined(USE_CMSG)
-	msg->msg_control = sock->recvcmsgbuf;
+	msg->msg_control = cmsgbuf;
 	msg->msg_controllen = sock->recvcmsgbuflen;
 #else
 	msg->msg_control = NULL;
@@ -1862,89 +1930,17 @@ dump_msg(struct msghdr *msg) {
 #define DOIO_HARD		2	/* i/o error, event sent */
 #define DOIO_EOF		3	/* EOF, no event sent */
 
+/*
+ * Finish a receive of 'cc' bytes into 'dev' using 'msghdr', which was
+ * built by build_msghdr_recv() to receive at most 'read_count' bytes.
+ * Returns the same values as doio_recv().
+ */
 static int
-doio_recv(isc__socket_t *sock, isc_socketevent_t *dev) {
-	int cc;
-	struct iovec iov[MAXSCATTERGATHER_RECV];
-	size_t read_count;
+doio_recvdone(isc__socket_t *sock, isc_socketevent_t *dev,
+	      struct msghdr *msghdr, int cc, size_t read_count)
+{
 	size_t actual_count;
-	struct msghdr msghdr;
 	isc_buffer_t *buffer;
-	int recv_errno;
-	char strbuf[ISC_STRERRORSIZE];
-
-	build_msghdr_recv(sock, dev, &msghdr, iov, &read_count);
-
-#if defined(ISC_SOCKET_DEBUG)
-	dump_msg(&msghdr);
-#endif
-
-	cc = recvmsg(sock->fd, &msghdr, 0);
-	recv_errno = errno;
-
-#if defined(ISC_SOCKET_DEBUG)
-	dump_msg(&msghdr);
-#endif
-
-	if (cc < 0) {
-		if (SOFT_ERROR(recv_errno))
-			return (DOIO_SOFT);
-
-		if (isc_log_wouldlog(isc_lctx, IOEVENT_LEVEL)) {
-			isc__strerror(recv_errno, strbuf, sizeof(strbuf));
-			socket_log(sock, NULL, IOEVENT,
-				   isc_msgcat, ISC_MSGSET_SOCKET,
-				   ISC_MSG_DOIORECV,
-				  "doio_recv: recvmsg(%d) %d bytes, err %d/%s",
-				   sock->fd, cc, recv_errno, strbuf);
-		}
-
-#define SOFT_OR_HARD(_system, _isc) \
-	if (recv_errno == _system) { \
-		if (sock->connected) { \
-			dev->result = _isc; \
-			inc_stats(sock->manager->stats, \
-				  sock->statsindex[STATID_RECVFAIL]); \
-			return (DOIO_HARD); \
-		} \
-		return (DOIO_SOFT); \
-	}
-#define ALWAYS_HARD(_system, _isc) \
-	if (recv_errno == _system) { \
-		dev->result = _isc; \
-		inc_stats(sock->manager->stats, \
-			  sock->statsindex[STATID_RECVFAIL]); \
-		return (DOIO_HARD); \
-	}
-
-		SOFT_OR_HARD(ECONNREFUSED, ISC_R_CONNREFUSED);
-		SOFT_OR_HARD(ENETUNREACH, ISC_R_NETUNREACH);
-		SOFT_OR_HARD(EHOSTUNREACH, ISC_R_HOSTUNREACH);
-		SOFT_OR_HARD(EHOSTDOWN, ISC_R_HOSTDOWN);
-		/* HPUX 11.11 can return EADDRNOTAVAIL. */
-		SOFT_OR_HARD(EADDRNOTAVAIL, ISC_R_ADDRNOTAVAIL);
-		ALWAYS_HARD(ENOBUFS, ISC_R_NORESOURCES);
-		/* Should never get this one but it was seen. */
-#ifdef ENOPROTOOPT
-		SOFT_OR_HARD(ENOPROTOOPT, ISC_R_HOSTUNREACH);
-#endif
-		/*
-		 * HPUX returns EPROTO and EINVAL on receiving some ICMP/ICMPv6
-		 * errors.
-		 */
-#ifdef EPROTO
-		SOFT_OR_HARD(EPROTO, ISC_R_HOSTUNREACH);
-#endif
-		SOFT_OR_HARD(EINVAL, ISC_R_HOSTUNREACH);
-
-#undef SOFT_OR_HARD
-#undef ALWAYS_HARD
-
-		dev->result = isc__errno2result(recv_errno);
-		inc_stats(sock->manager->stats,
-			  sock->statsindex[STATID_RECVFAIL]);
-		return (DOIO_HARD);
-	}
 
 	/*
 	 * On TCP and UNIX sockets, zero length reads indicate EOF,
@@ -1966,7 +1962,7 @@ doio_recv(isc__socket_t *sock, isc_socketevent_t *dev) {
 	}
 
 	if (sock->type == isc_sockettype_udp) {
-		dev->address.length = msghdr.msg_namelen;
+		dev->address.length = msghdr->msg_namelen;
 		if (isc_sockaddr_getport(&dev->address) == 0) {
 			if (isc_log_wouldlog(isc_lctx, IOEVENT_LEVEL)) {
 				socket_log(sock, &dev->address, IOEVENT,
@@ -2004,7 +2000,7 @@ doio_recv(isc__socket_t *sock, isc_socketevent_t *dev) {
 	 * If there are control messages attached, run through them and pull
 	 * out the interesting bits.
 	 */
-	process_cmsg(sock, &msghdr, dev);
+	process_cmsg(sock, msghdr, dev);
 
 	/*
 	 * update the buffers (if any) and the i/o count
@@ -2044,6 +2040,102 @@ doio_recv(isc__socket_t *sock, isc_socketevent_t *dev) {
 	return (DOIO_SUCCESS);
 }
 
+/*
+ * Classify the error 'recv_errno' from a receive call named 'func' for
+ * the request 'dev'.  On DOIO_HARD, dev->result is set.
+ */
+static int
+doio_recverror(isc__socket_t *sock, isc_socketevent_t *dev, int recv_errno,
+	       const char *func)
+{
+	char strbuf[ISC_STRERRORSIZE];
+
+	if (SOFT_ERROR(recv_errno))
+		return (DOIO_SOFT);
+
+	if (isc_log_wouldlog(isc_lctx, IOEVENT_LEVEL)) {
+		isc__strerror(recv_errno, strbuf, sizeof(strbuf));
+		socket_log(sock, NULL, IOEVENT,
+			   isc_msgcat, ISC_MSGSET_SOCKET,
+			   ISC_MSG_DOIORECV,
+			   "doio_recv: %s(%d) err %d/%s",
+			   func, sock->fd, recv_errno, strbuf);
+	}
+
+#define SOFT_OR_HARD(_system, _isc) \
+	if (recv_errno == _system) { \
+		if (sock->connected) { \
+			dev->result = _isc; \
+			inc_stats(sock->manager->stats, \
+				  sock->statsindex[STATID_RECVFAIL]); \
+			return (DOIO_HARD); \
+		} \
+		return (DOIO_SOFT); \
+	}
+#define ALWAYS_HARD(_system, _isc) \
+	if (recv_errno == _system) { \
+		dev->result = _isc; \
+		inc_stats(sock->manager->stats, \
+			  sock->statsindex[STATID_RECVFAIL]); \
+		return (DOIO_HARD); \
+	}
+
+	SOFT_OR_HARD(ECONNREFUSED, ISC_R_CONNREFUSED);
+	SOFT_OR_HARD(ENETUNREACH, ISC_R_NETUNREACH);
+	SOFT_OR_HARD(EHOSTUNREACH, ISC_R_HOSTUNREACH);
+	SOFT_OR_HARD(EHOSTDOWN, ISC_R_HOSTDOWN);
+	/* HPUX 11.11 can return EADDRNOTAVAIL. */
+	SOFT_OR_HARD(EADDRNOTAVAIL, ISC_R_ADDRNOTAVAIL);
+	ALWAYS_HARD(ENOBUFS, ISC_R_NORESOURCES);
+	/* Should never get this one but it was seen. */
+#ifdef ENOPROTOOPT
+	SOFT_OR_HARD(ENOPROTOOPT, ISC_R_HOSTUNREACH);
+#endif
+	/*
+	 * HPUX returns EPROTO and EINVAL on receiving some ICMP/ICMPv6
+	 * errors.
+	 */
+#ifdef EPROTO
+	SOFT_OR_HARD(EPROTO, ISC_R_HOSTUNREACH);
+#endif
+	SOFT_OR_HARD(EINVAL, ISC_R_HOSTUNREACH);
+
+#undef SOFT_OR_HARD
+#undef ALWAYS_HARD
+
+	dev->result = isc__errno2result(recv_errno);
+	inc_stats(sock->manager->stats, sock->statsindex[STATID_RECVFAIL]);
+	return (DOIO_HARD);
+}
+
+static int
+doio_recv(isc__socket_t *sock, isc_socketevent_t *dev) {
+	int cc;
+	struct iovec iov[MAXSCATTERGATHER_RECV];
+	size_t read_count;
+	struct msghdr msghdr;
+	int recv_errno;
+
+	build_msghdr_recv(sock, sock->recvcmsgbuf, dev, &msghdr, iov,
+			  &read_count);
+
+#if defined(ISC_SOCKET_DEBUG)
+	dump_msg(&msghdr);
+#endif
+
+	cc = recvmsg(sock->fd, &msghdr, 0);
+	recv_errno = errno;
+
+#if defined(ISC_SOCKET_DEBUG)
+	dump_msg(&msghdr);
+#endif
+
+	if (cc < 0)
+		return (doio_recverror(sock, dev, recv_errno, "recvmsg"));
+
+	return (doio_recvdone(sock, dev, &msghdr, cc, read_count));
+}
+
 /*
  * Returns:
  *	DOIO_SUCCESS	The operation succeeded.  dev->result contains
@@ -2068,7 +2160,8 @@ doio_send(isc__socket_t *sock, isc_socketevent_t *dev) {
 	int send_errno;
 	char strbuf[ISC_STRERRORSIZE];
 
-	build_msghdr_send(sock, dev, &msghdr, iov, &write_count);
+	build_msghdr_send(sock, sock->sendcmsgbuf, dev, &msghdr, iov,
+			  &write_count);
 
  resend:
 	if (sock->type == isc_sockettype_udp &&
@@ -2170,6 +2263,130 @@ doio_send(isc__socket_t *sock, isc_socketevent_t *dev) {
 	return (DOIO_SUCCESS);
 }
 
+#ifdef USE_MMSG
+/*
+ * Try to satisfy up to sock->batch of the receive requests queued on
+ * 'sock' with a single recvmmsg() call.  Requests that complete are
+ * posted; the rest stay on the queue.
+ *
+ * Returns the number of requests completed, or 0 if the socket would
+ * block.  If recvmmsg() fails with a hard error, the request at the head
+ * of the queue is completed with that error, as doio_recv() would.
+ *
+ * Caller must hold the socket lock.
+ */
+static int
+doio_recvbatch(isc__socket_t *sock) {
+	struct mmsghdr msgs[ISC_SOCKET_MAXBATCH];
+	struct iovec iov[ISC_SOCKET_MAXBATCH][MAXSCATTERGATHER_RECV];
+	isc_socketevent_t *devs[ISC_SOCKET_MAXBATCH];
+	size_t read_count[ISC_SOCKET_MAXBATCH];
+	isc_socketevent_t *dev;
+	char *cmsgbuf;
+	unsigned int count = 0;
+	int cc, i;
+
+	INSIST(sock->batch <= ISC_SOCKET_MAXBATCH);
+
+	dev = ISC_LIST_HEAD(sock->recv_list);
+	while (dev != NULL && count < sock->batch) {
+		cmsgbuf = sock->batchcmsgbuf + count * sock->recvcmsgbuflen;
+		build_msghdr_recv(sock, cmsgbuf, dev, &msgs[count].msg_hdr,
+				  iov[count], &read_count[count]);
+		msgs[count].msg_len = 0;
+		devs[count++] = dev;
+		dev = ISC_LIST_NEXT(dev, ev_link);
+	}
+
+	cc = recvmmsg(sock->fd, msgs, count, 0, NULL);
+	if (cc < 0) {
+		if (doio_recverror(sock, devs[0], errno,
+				   "recvmmsg") == DOIO_SOFT)
+			return (0);
+		send_recvdone_event(sock, &devs[0]);
+		return (1);
+	}
+
+	for (i = 0; i < cc; i++) {
+		switch (doio_recvdone(sock, devs[i], &msgs[i].msg_hdr,
+				      msgs[i].msg_len, read_count[i]))
+		{
+		case DOIO_SUCCESS:
+		case DOIO_HARD:
+			send_recvdone_event(sock, &devs[i]);
+			break;
+		default:
+			break;
+		}
+	}
+
+	return (cc);
+}
+
+/*
+ * Try to write up to sock->batch of the datagrams queued on 'sock' with
+ * a single sendmmsg() call, posting a completion event for each one
+ * sent.  Requests that would need the socket's IP_TOS/IPV6_TCLASS
+ * option changed end the batch, as that option applies to every
+ * message in the call.
+ *
+ * Returns the number of datagrams written, 0 if the socket would block,
+ * or -1 on any other error, in which case the caller should retry the
+ * head of the queue with doio_send() to have the error classified.
+ *
+ * Caller must hold the socket lock.
+ */
+static int
+doio_sendbatch(isc__socket_t *sock) {
+	struct mmsghdr msgs[ISC_SOCKET_MAXBATCH];
+	struct iovec iov[ISC_SOCKET_MAXBATCH][MAXSCATTERGATHER_SEND];
+	isc_socketevent_t *devs[ISC_SOCKET_MAXBATCH];
+	size_t write_count[ISC_SOCKET_MAXBATCH];
+	isc_socketevent_t *dev;
+	char *cmsgbuf;
+	unsigned int count = 0;
+	int cc, i;
+
+	INSIST(sock->batch <= ISC_SOCKET_MAXBATCH);
+
+	dev = ISC_LIST_HEAD(sock->send_list);
+	while (dev != NULL && count < sock->batch) {
+		if (count > 0 && !sock->pktdscp &&
+		    (dev->attributes & ISC_SOCKEVENTATTR_DSCP) != 0 &&
+		    ((devs[0]->attributes & ISC_SOCKEVENTATTR_DSCP) == 0 ||
+		     dev->dscp != devs[0]->dscp))
+			break;
+		cmsgbuf = sock->batchcmsgbuf +
+			  sock->batch * sock->recvcmsgbuflen +
+			  count * sock->sendcmsgbuflen;
+		build_msghdr_send(sock, cmsgbuf, dev, &msgs[count].msg_hdr,
+				  iov[count], &write_count[count]);
+		msgs[count].msg_len = 0;
+		devs[count++] = dev;
+		dev = ISC_LIST_NEXT(dev, ev_link);
+	}
+
+	cc = sendmmsg(sock->fd, msgs, count, 0);
+	if (cc < 0)
+		return (SOFT_ERROR(errno) ? 0 : -1);
+
+	for (i = 0; i < cc; i++) {
+		devs[i]->n += msgs[i].msg_len;
+		if ((size_t)msgs[i].msg_len != write_count[i]) {
+			/*
+			 * Datagrams are never sent partially, so let
+			 * doio_send() deal with whatever this was.
+			 */
+			return (i);
+		}
+		devs[i]->result = ISC_R_SUCCESS;
+		send_senddone_event(sock, &devs[i]);
+	}
+
+	return (cc);
+}
+#endif /* USE_MMSG */
+
 /*
  * Kill.
  *
@@ -2202,10 +2419,12 @@ socketclose(isc__socketmgr_t *manager, isc__socket_t *sock, int fd) {
 		 * solve this would be to dup() the watched descriptor, but we
 		 * take a simpler approach at this moment.
 		 */
-		(void)unwatch_fd(manager, fd, SELECT_POKE_READ);
-		(void)unwatch_fd(manager, fd, SELECT_POKE_WRITE);
+		(void)unwatch_fd(&manager->threads[sock->threadid], fd,
+				 SELECT_POKE_READ);
+		(void)unwatch_fd(&manager->threads[sock->threadid], fd,
+				 SELECT_POKE_WRITE);
 	} else
-		select_poke(manager, fd, SELECT_POKE_CLOSE);
+		select_poke(manager, sock->threadid, fd, SELECT_POKE_CLOSE);
 
 	inc_stats(manager->stats, sock->statsindex[STATID_CLOSE]);
 	if (sock->active == 1) {
@@ -2235,8 +2454,8 @@ socketclose(isc__socketmgr_t *manager, isc__socket_t *sock, int fd) {
 			UNLOCK(&manager->fdlock[lockid]);
 		}
 #ifdef ISC_PLATFORM_USETHREADS
-		if (manager->maxfd < manager->pipe_fds[0])
-			manager->maxfd = manager->pipe_fds[0];
+		if (manager->maxfd < manager->threads[0].pipe_fds[0])
+			manager->maxfd = manager->threads[0].pipe_fds[0];
 #endif
 	}
 
@@ -2300,6 +2519,7 @@ allocate_socket(isc__socketmgr_t *manager, isc_sockettype_t type,
 	sock->manager = manager;
 	sock->type = type;
 	sock->fd = -1;
+	sock->threadid = 0;
 	sock->dscp = 0;		/* TOS/TCLASS is zero until set. */
 	sock->dupped = 0;
 	sock->statsindex = NULL;
@@ -2309,6 +2529,11 @@ allocate_socket(isc__socketmgr_t *manager, isc_sockettype_t type,
 
 	sock->recvcmsgbuf = NULL;
 	sock->sendcmsgbuf = NULL;
+	sock->batch = 0;
+#ifdef USE_MMSG
+	sock->batchcmsgbuf = NULL;
+	sock->batchcmsgbuflen = 0;
+#endif
 
 	/*
 	 * Set up cmsg buffers.
@@ -2441,6 +2666,11 @@ free_socket(isc__socket_t **socketp) {
 	if (sock->sendcmsgbuf != NULL)
 		isc_mem_put(sock->manager->mctx, sock->sendcmsgbuf,
 			    sock->sendcmsgbuflen);
+#ifdef USE_MMSG
+	if (sock->batchcmsgbuf != NULL)
+		isc_mem_put(sock->manager->mctx, sock->batchcmsgbuf,
+			    sock->batchcmsgbuflen);
+#endif
 
 	sock->common.magic = 0;
 	sock->common.impmagic = 0;
@@ -3022,6 +3252,7 @@ socket_create(isc_socketmgr_t *manager0, int pf, isc_sockettype_t type,
 	 * there are no external references to it yet.
 	 */
 
+	sock->threadid = gen_threadid(manager, sock->fd);
 	lockid = FDLOCK_ID(sock->fd);
 	LOCK(&manager->fdlock[lockid]);
 	manager->fds[sock->fd] = sock;
@@ -3102,6 +3333,7 @@ isc__socket_open(isc_socket_t *sock0) {
 	if (result == ISC_R_SUCCESS) {
 		int lockid = FDLOCK_ID(sock->fd);
 
+		sock->threadid = gen_threadid(sock->manager, sock->fd);
 		LOCK(&sock->manager->fdlock[lockid]);
 		sock->manager->fds[sock->fd] = sock;
 		sock->manager->fdstate[sock->fd] = MANAGED;
@@ -3167,6 +3399,7 @@ isc__socket_fdwatchcreate(isc_socketmgr_t *manager0, int fd, int flags,
 	 * there are no external references to it yet.
 	 */
 
+	sock->threadid = gen_threadid(manager, sock->fd);
 	lockid = FDLOCK_ID(sock->fd);
 	LOCK(&manager->fdlock[lockid]);
 	manager->fds[sock->fd] = sock;
@@ -3185,9 +3418,11 @@ isc__socket_fdwatchcreate(isc_socketmgr_t *manager0, int fd, int flags,
 	UNLOCK(&manager->lock);
 
 	if (flags & ISC_SOCKFDWATCH_READ)
-		select_poke(sock->manager, sock->fd, SELECT_POKE_READ);
+		select_poke(sock->manager, sock->threadid, sock->fd,
+			    SELECT_POKE_READ);
 	if (flags & ISC_SOCKFDWATCH_WRITE)
-		select_poke(sock->manager, sock->fd, SELECT_POKE_WRITE);
+		select_poke(sock->manager, sock->threadid, sock->fd,
+			    SELECT_POKE_WRITE);
 
 	socket_log(sock, NULL, CREATION, isc_msgcat, ISC_MSGSET_SOCKET,
 		   ISC_MSG_CREATED, "fdwatch-created");
@@ -3218,11 +3453,11 @@ isc__socket_fdwatchpoke(isc_socket_t *sock0, int flags)
 		LOCK(&sock->lock);
 		if (((flags & ISC_SOCKFDWATCH_READ) != 0) &&
 		    !sock->pending_recv)
-			select_poke(sock->manager, sock->fd,
+			select_poke(sock->manager, sock->threadid, sock->fd,
 				    SELECT_POKE_READ);
 		if (((flags & ISC_SOCKFDWATCH_WRITE) != 0) &&
 		    !sock->pending_send)
-			select_poke(sock->manager, sock->fd,
+			select_poke(sock->manager, sock->threadid, sock->fd,
 				    SELECT_POKE_WRITE);
 		UNLOCK(&sock->lock);
 	}
@@ -3696,7 +3931,8 @@ internal_accept(isc_task_t *me, isc_event_t *ev) {
 	 * Poke watcher if there are more pending accepts.
 	 */
 	if (!ISC_LIST_EMPTY(sock->accept_list))
-		select_poke(sock->manager, sock->fd, SELECT_POKE_ACCEPT);
+		select_poke(sock->manager, sock->threadid, sock->fd,
+			    SELECT_POKE_ACCEPT);
 
 	UNLOCK(&sock->lock);
 
@@ -3740,6 +3976,7 @@ internal_accept(isc_task_t *me, isc_event_t *ev) {
 			NEWCONNSOCK(dev)->active = 1;
 		}
 
+		NEWCONNSOCK(dev)->threadid = gen_threadid(manager, fd);
 		LOCK(&manager->fdlock[lockid]);
 		manager->fds[fd] = NEWCONNSOCK(dev);
 		manager->fdstate[fd] = MANAGED;
@@ -3782,7 +4019,8 @@ internal_accept(isc_task_t *me, isc_event_t *ev) {
 	return;
 
  soft_error:
-	select_poke(sock->manager, sock->fd, SELECT_POKE_ACCEPT);
+	select_poke(sock->manager, sock->threadid, sock->fd,
+		    SELECT_POKE_ACCEPT);
 	UNLOCK(&sock->lock);
 
 	inc_stats(manager->stats, sock->statsindex[STATID_ACCEPTFAIL]);
@@ -3821,6 +4059,14 @@ internal_recv(isc_task_t *me, isc_event_t *ev) {
 	 */
 	dev = ISC_LIST_HEAD(sock->recv_list);
 	while (dev != NULL) {
+#ifdef USE_MMSG
+		if (sock->batch > 1 && ISC_LIST_NEXT(dev, ev_link) != NULL) {
+			if (doio_recvbatch(sock) == 0)
+				goto poke;
+			dev = ISC_LIST_HEAD(sock->recv_list);
+			continue;
+		}
+#endif
 		switch (doio_recv(sock, dev)) {
 		case DOIO_SOFT:
 			goto poke;
@@ -3849,7 +4095,8 @@ internal_recv(isc_task_t *me, isc_event_t *ev) {
 
  poke:
 	if (!ISC_LIST_EMPTY(sock->recv_list))
-		select_poke(sock->manager, sock->fd, SELECT_POKE_READ);
+		select_poke(sock->manager, sock->threadid, sock->fd,
+			    SELECT_POKE_READ);
 
 	UNLOCK(&sock->lock);
 }
@@ -3889,8 +4136,30 @@ internal_send(isc_task_t *me, isc_event_t *ev) {
 	 */
 	dev = ISC_LIST_HEAD(sock->send_list);
 	while (dev != NULL) {
+#ifdef USE_MMSG
+		if (sock->batch > 1 && sock->manager->maxudp == 0 &&
+		    ISC_LIST_NEXT(dev, ev_link) != NULL)
+		{
+			int n = doio_sendbatch(sock);
+			if (n > 0) {
+				dev = ISC_LIST_HEAD(sock->send_list);
+				continue;
+			}
+		}
+#endif
 		switch (doio_send(sock, dev)) {
 		case DOIO_SOFT:
+			/*
+			 * Sends that were queued on a batching socket
+			 * with ISC_SOCKFLAG_NORETRY are dropped rather
+			 * than retried, as they would have been had they
+			 * been attempted immediately.
+			 */
+			if ((dev->attributes & ISC_SOCKEVENTATTR_NORETRY) != 0)
+			{
+				send_senddone_event(sock, &dev);
+				break;
+			}
 			goto poke;
 
 		case DOIO_HARD:
@@ -3904,7 +4173,8 @@ internal_send(isc_task_t *me, isc_event_t *ev) {
 
  poke:
 	if (!ISC_LIST_EMPTY(sock->send_list))
-		select_poke(sock->manager, sock->fd, SELECT_POKE_WRITE);
+		select_poke(sock->manager, sock->threadid, sock->fd,
+			    SELECT_POKE_WRITE);
 
 	UNLOCK(&sock->lock);
 }
@@ -3945,7 +4215,8 @@ internal_fdwatch_write(isc_task_t *me, isc_event_t *ev) {
 	}
 
 	if (more_data)
-		select_poke(sock->manager, sock->fd, SELECT_POKE_WRITE);
+		select_poke(sock->manager, sock->threadid, sock->fd,
+			    SELECT_POKE_WRITE);
 
 	UNLOCK(&sock->lock);
 }
@@ -3986,7 +4257,8 @@ internal_fdwatch_read(isc_task_t *me, isc_event_t *ev) {
 	}
 
 	if (more_data)
-		select_poke(sock->manager, sock->fd, SELECT_POKE_READ);
+		select_poke(sock->manager, sock->threadid, sock->fd,
+			    SELECT_POKE_READ);
 
 	UNLOCK(&sock->lock);
 }
@@ -3996,9 +4268,10 @@ internal_fdwatch_read(isc_task_t *me, isc_event_t *ev) {
  * and unlocking twice if both reads and writes are possible.
  */
 static void
-process_fd(isc__socketmgr_t *manager, int fd, isc_boolean_t readable,
+process_fd(isc__socketthread_t *thread, int fd, isc_boolean_t readable,
 	   isc_boolean_t writeable)
 {
+	isc__socketmgr_t *manager = thread->manager;
 	isc__socket_t *sock;
 	isc_boolean_t unlock_sock;
 	isc_boolean_t unwatch_read = ISC_FALSE, unwatch_write = ISC_FALSE;
@@ -4011,8 +4284,8 @@ process_fd(isc__socketmgr_t *manager, int fd, isc_boolean_t readable,
 	if (manager->fdstate[fd] == CLOSE_PENDING) {
 		UNLOCK(&manager->fdlock[lockid]);
 
-		(void)unwatch_fd(manager, fd, SELECT_POKE_READ);
-		(void)unwatch_fd(manager, fd, SELECT_POKE_WRITE);
+		(void)unwatch_fd(thread, fd, SELECT_POKE_READ);
+		(void)unwatch_fd(thread, fd, SELECT_POKE_WRITE);
 		return;
 	}
 
@@ -4057,15 +4330,16 @@ check_write:
  unlock_fd:
 	UNLOCK(&manager->fdlock[lockid]);
 	if (unwatch_read)
-		(void)unwatch_fd(manager, fd, SELECT_POKE_READ);
+		(void)unwatch_fd(thread, fd, SELECT_POKE_READ);
 	if (unwatch_write)
-		(void)unwatch_fd(manager, fd, SELECT_POKE_WRITE);
+		(void)unwatch_fd(thread, fd, SELECT_POKE_WRITE);
 
 }
 
 #ifdef USE_KQUEUE
 static isc_boolean_t
-process_fds(isc__socketmgr_t *manager, struct kevent *events, int nevents) {
+process_fds(isc__socketthread_t *thread, struct kevent *events, int nevents) {
+	isc__socketmgr_t *manager = thread->manager;
 	int i;
 	isc_boolean_t readable, writable;
 	isc_boolean_t done = ISC_FALSE;
@@ -4073,7 +4347,7 @@ process_fds(isc__socketmgr_t *manager, struct kevent *events, int nevents) {
 	isc_boolean_t have_ctlevent = ISC_FALSE;
 #endif
 
-	if (nevents == manager->nevents) {
+	if (nevents == thread->nevents) {
 		/*
 		 * This is not an error, but something unexpected.  If this
 		 * happens, it may indicate the need for increasing
@@ -4088,34 +4362,36 @@ process_fds(isc__socketmgr_t *manager, struct kevent *events, int nevents) {
 	for (i = 0; i < nevents; i++) {
 		REQUIRE(events[i].ident < manager->maxsocks);
 #ifdef USE_WATCHER_THREAD
-		if (events[i].ident == (uintptr_t)manager->pipe_fds[0]) {
+		if (events[i].ident == (uintptr_t)thread->pipe_fds[0]) {
 			have_ctlevent = ISC_TRUE;
 			continue;
 		}
 #endif
 		readable = ISC_TF(events[i].filter == EVFILT_READ);
 		writable = ISC_TF(events[i].filter == EVFILT_WRITE);
-		process_fd(manager, events[i].ident, readable, writable);
+		process_fd(thread, events[i].ident, readable, writable);
 	}
 
 #ifdef USE_WATCHER_THREAD
 	if (have_ctlevent)
-		done = process_ctlfd(manager);
+		done = process_ctlfd(thread);
 #endif
 
 	return (done);
 }
 #elif defined(USE_EPOLL)
 static isc_boolean_t
-process_fds(isc__socketmgr_t *manager, struct epoll_event *events, int nevents)
+process_fds(isc__socketthread_t *thread, struct epoll_event *events,
+	    int nevents)
 {
+	isc__socketmgr_t *manager = thread->manager;
 	int i;
 	isc_boolean_t done = ISC_FALSE;
 #ifdef USE_WATCHER_THREAD
 	isc_boolean_t have_ctlevent = ISC_FALSE;
 #endif
 
-	if (nevents == manager->nevents) {
+	if (nevents == thread->nevents) {
 		manager_log(manager, ISC_LOGCATEGORY_GENERAL,
 			    ISC_LOGMODULE_SOCKET, ISC_LOG_INFO,
 			    "maximum number of FD events (%d) received",
@@ -4125,7 +4401,7 @@ process_fds(isc__socketmgr_t *manager, struct epoll_event *events, int nevents)
 	for (i = 0; i < nevents; i++) {
 		REQUIRE(events[i].data.fd < (int)manager->maxsocks);
 #ifdef USE_WATCHER_THREAD
-		if (events[i].data.fd == manager->pipe_fds[0]) {
+		if (events[i].data.fd == thread->pipe_fds[0]) {
 			have_ctlevent = ISC_TRUE;
 			continue;
 		}
@@ -4142,28 +4418,29 @@ process_fds(isc__socketmgr_t *manager, struct epoll_event *events, int nevents)
 			int fd = events[i].data.fd;
 			events[i].events |= manager->epoll_events[fd];
 		}
-		process_fd(manager, events[i].data.fd,
+		process_fd(thread, events[i].data.fd,
 			   (events[i].events & EPOLLIN) != 0,
 			   (events[i].events & EPOLLOUT) != 0);
 	}
 
 #ifdef USE_WATCHER_THREAD
 	if (have_ctlevent)
-		done = process_ctlfd(manager);
+		done = process_ctlfd(thread);
 #endif
 
 	return (done);
 }
 #elif defined(USE_DEVPOLL)
 static isc_boolean_t
-process_fds(isc__socketmgr_t *manager, struct pollfd *events, int nevents) {
+process_fds(isc__socketthread_t *thread, struct pollfd *events, int nevents) {
+	isc__socketmgr_t *manager = thread->manager;
 	int i;
 	isc_boolean_t done = ISC_FALSE;
 #ifdef USE_WATCHER_THREAD
 	isc_boolean_t have_ctlevent = ISC_FALSE;
 #endif
 
-	if (nevents == manager->nevents) {
+	if (nevents == thread->nevents) {
 		manager_log(manager, ISC_LOGCATEGORY_GENERAL,
 			    ISC_LOGMODULE_SOCKET, ISC_LOG_INFO,
 			    "maximum number of FD events (%d) received",
@@ -4173,38 +4450,39 @@ process_fds(isc__socketmgr_t *manager, struct pollfd *events, int nevents) {
 	for (i = 0; i < nevents; i++) {
 		REQUIRE(events[i].fd < (int)manager->maxsocks);
 #ifdef USE_WATCHER_THREAD
-		if (events[i].fd == manager->pipe_fds[0]) {
+		if (events[i].fd == thread->pipe_fds[0]) {
 			have_ctlevent = ISC_TRUE;
 			continue;
 		}
 #endif
-		process_fd(manager, events[i].fd,
+		process_fd(thread, events[i].fd,
 			   (events[i].events & POLLIN) != 0,
 			   (events[i].events & POLLOUT) != 0);
 	}
 
 #ifdef USE_WATCHER_THREAD
 	if (have_ctlevent)
-		done = process_ctlfd(manager);
+		done = process_ctlfd(thread);
 #endif
 
 	return (done);
 }
 #elif defined(USE_SELECT)
 static void
-process_fds(isc__socketmgr_t *manager, int maxfd, fd_set *readfds,
+process_fds(isc__socketthread_t *thread, int maxfd, fd_set *readfds,
 	    fd_set *writefds)
 {
+	isc__socketmgr_t *manager = thread->manager;
 	int i;
 
 	REQUIRE(maxfd <= (int)manager->maxsocks);
 
 	for (i = 0; i < maxfd; i++) {
 #ifdef USE_WATCHER_THREAD
-		if (i == manager->pipe_fds[0] || i == manager->pipe_fds[1])
+		if (i == thread->pipe_fds[0] || i == thread->pipe_fds[1])
 			continue;
 #endif /* USE_WATCHER_THREAD */
-		process_fd(manager, i, FD_ISSET(i, readfds),
+		process_fd(thread, i, FD_ISSET(i, readfds),
 			   FD_ISSET(i, writefds));
 	}
 }
@@ -4212,13 +4490,13 @@ process_fds(isc__socketmgr_t *manager, int maxfd, fd_set *readfds,
 
 #ifdef USE_WATCHER_THREAD
 static isc_boolean_t
-process_ctlfd(isc__socketmgr_t *manager) {
+process_ctlfd(isc__socketthread_t *thread) {
 	int msg, fd;
 
 	for (;;) {
-		select_readmsg(manager, &fd, &msg);
+		select_readmsg(thread, &fd, &msg);
 
-		manager_log(manager, IOEVENT,
+		manager_log(thread->manager, IOEVENT,
 			    isc_msgcat_get(isc_msgcat, ISC_MSGSET_SOCKET,
 					   ISC_MSG_WATCHERMSG,
 					   "watcher got message %d "
@@ -4245,7 +4523,7 @@ process_ctlfd(isc__socketmgr_t *manager) {
 		 * and decide if we need to watch on it now
 		 * or not.
 		 */
-		wakeup_socket(manager, fd, msg);
+		wakeup_socket(thread, fd, msg);
 	}
 
 	return (ISC_FALSE);
@@ -4253,14 +4531,16 @@ process_ctlfd(isc__socketmgr_t *manager) {
 
 /*
  * This is the thread that will loop forever, always in a select or poll
- * call.
+ * call.  There is one per element of manager->threads, each polling the
+ * descriptors assigned to it.
  *
  * When select returns something to do, track down what thread gets to do
  * this I/O and post the event to it.
  */
 static isc_threadresult_t
 watcher(void *uap) {
-	isc__socketmgr_t *manager = uap;
+	isc__socketthread_t *thread = uap;
+	isc__socketmgr_t *manager = thread->manager;
 	isc_boolean_t done;
 	int cc;
 #ifdef USE_KQUEUE
@@ -4286,17 +4566,17 @@ watcher(void *uap) {
 	/*
 	 * Get the control fd here.  This will never change.
 	 */
-	ctlfd = manager->pipe_fds[0];
+	ctlfd = thread->pipe_fds[0];
 #endif
 	done = ISC_FALSE;
 	while (!done) {
 		do {
 #ifdef USE_KQUEUE
-			cc = kevent(manager->kqueue_fd, NULL, 0,
-				    manager->events, manager->nevents, NULL);
+			cc = kevent(thread->kqueue_fd, NULL, 0,
+				    thread->events, thread->nevents, NULL);
 #elif defined(USE_EPOLL)
-			cc = epoll_wait(manager->epoll_fd, manager->events,
-					manager->nevents, -1);
+			cc = epoll_wait(thread->epoll_fd, thread->events,
+					thread->nevents, -1);
 #elif defined(USE_DEVPOLL)
 			/*
 			 * Re-probe every thousand calls.
@@ -4310,8 +4590,8 @@ watcher(void *uap) {
 				manager->calls = 0;
 			}
 			for (pass = 0; pass < 2; pass++) {
-				dvp.dp_fds = manager->events;
-				dvp.dp_nfds = manager->nevents;
+				dvp.dp_fds = thread->events;
+				dvp.dp_nfds = thread->nevents;
 				if (dvp.dp_nfds >= manager->open_max)
 					dvp.dp_nfds = manager->open_max - 1;
 #ifndef ISC_SOCKET_USE_POLLWATCH
@@ -4323,7 +4603,7 @@ watcher(void *uap) {
 					dvp.dp_timeout =
 						 ISC_SOCKET_POLLWATCH_TIMEOUT;
 #endif	/* ISC_SOCKET_USE_POLLWATCH */
-				cc = ioctl(manager->devpoll_fd, DP_POLL, &dvp);
+				cc = ioctl(thread->devpoll_fd, DP_POLL, &dvp);
 				if (cc == -1 && errno == EINVAL) {
 					/*
 					 * {OPEN_MAX} may have dropped.  Look
@@ -4388,16 +4668,16 @@ watcher(void *uap) {
 		} while (cc < 0);
 
 #if defined(USE_KQUEUE) || defined (USE_EPOLL) || defined (USE_DEVPOLL)
-		done = process_fds(manager, manager->events, cc);
+		done = process_fds(thread, thread->events, cc);
 #elif defined(USE_SELECT)
-		process_fds(manager, maxfd, manager->read_fds_copy,
+		process_fds(thread, maxfd, manager->read_fds_copy,
 			    manager->write_fds_copy);
 
 		/*
 		 * Process reads on internal, control fd.
 		 */
 		if (FD_ISSET(ctlfd, manager->read_fds_copy))
-			done = process_ctlfd(manager);
+			done = process_ctlfd(thread);
 #endif
 	}
 
@@ -4431,50 +4711,112 @@ isc__socketmgr_maxudp(isc_socketmgr_t *manager0, int maxudp) {
  * Create a new socket manager.
  */
 
+/*
+ * Release the polling state and control pipe of a watcher thread.
+ * Descriptors that were never opened are -1.
+ */
+static void
+free_thread(isc_mem_t *mctx, isc__socketthread_t *thread) {
+#ifdef USE_KQUEUE
+	if (thread->kqueue_fd != -1)
+		(void)close(thread->kqueue_fd);
+	if (thread->events != NULL)
+		isc_mem_put(mctx, thread->events,
+			    sizeof(struct kevent) * thread->nevents);
+#elif defined(USE_EPOLL)
+	if (thread->epoll_fd != -1)
+		(void)close(thread->epoll_fd);
+	if (thread->events != NULL)
+		isc_mem_put(mctx, thread->events,
+			    sizeof(struct epoll_event) * thread->nevents);
+#elif defined(USE_DEVPOLL)
+	if (thread->devpoll_fd != -1)
+		(void)close(thread->devpoll_fd);
+	if (thread->events != NULL)
+		isc_mem_put(mctx, thread->events,
+			    sizeof(struct pollfd) * thread->nevents);
+#else
+	UNUSED(mctx);
+#endif	/* USE_KQUEUE */
+#ifdef USE_WATCHER_THREAD
+	if (thread->pipe_fds[0] != -1)
+		(void)close(thread->pipe_fds[0]);
+	if (thread->pipe_fds[1] != -1)
+		(void)close(thread->pipe_fds[1]);
+#endif	/* USE_WATCHER_THREAD */
+}
+
 static isc_result_t
-setup_watcher(isc_mem_t *mctx, isc__socketmgr_t *manager) {
-	isc_result_t result;
-#if defined(USE_KQUEUE) || defined(USE_EPOLL) || defined(USE_DEVPOLL)
+setup_thread(isc_mem_t *mctx, isc__socketthread_t *thread) {
+	isc_result_t result = ISC_R_SUCCESS;
+#if defined(USE_KQUEUE) || defined(USE_EPOLL) || defined(USE_DEVPOLL) || \
+    defined(USE_WATCHER_THREAD)
 	char strbuf[ISC_STRERRORSIZE];
 #endif
 
 #ifdef USE_KQUEUE
-	manager->nevents = ISC_SOCKET_MAXEVENTS;
-	manager->events = isc_mem_get(mctx, sizeof(struct kevent) *
-				      manager->nevents);
-	if (manager->events == NULL)
-		return (ISC_R_NOMEMORY);
-	manager->kqueue_fd = kqueue();
-	if (manager->kqueue_fd == -1) {
-		result = isc__errno2result(errno);
-		isc__strerror(errno, strbuf, sizeof(strbuf));
-		UNEXPECTED_ERROR(__FILE__, __LINE__,
-				 "kqueue %s: %s",
-				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
+	thread->kqueue_fd = -1;
+	thread->events = NULL;
+#elif defined(USE_EPOLL)
+	thread->epoll_fd = -1;
+	thread->events = NULL;
+#elif defined(USE_DEVPOLL)
+	thread->devpoll_fd = -1;
+	thread->events = NULL;
+#endif	/* USE_KQUEUE */
+
+#ifdef USE_WATCHER_THREAD
+	/*
+	 * Create the special fds that will be used to wake up the
+	 * select/poll loop when something internal needs to be done.
+	 */
+	if (pipe(thread->pipe_fds) != 0) {
+		thread->pipe_fds[0] = thread->pipe_fds[1] = -1;
+		isc__strerror(errno, strbuf, sizeof(strbuf));
+		UNEXPECTED_ERROR(__FILE__, __LINE__,
+				 "pipe() %s: %s",
+				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
 						ISC_MSG_FAILED, "failed"),
 				 strbuf);
-		isc_mem_put(mctx, manager->events,
-			    sizeof(struct kevent) * manager->nevents);
-		return (result);
+		result = ISC_R_UNEXPECTED;
+		goto cleanup;
 	}
 
-#ifdef USE_WATCHER_THREAD
-	result = watch_fd(manager, manager->pipe_fds[0], SELECT_POKE_READ);
-	if (result != ISC_R_SUCCESS) {
-		close(manager->kqueue_fd);
-		isc_mem_put(mctx, manager->events,
-			    sizeof(struct kevent) * manager->nevents);
-		return (result);
-	}
+	RUNTIME_CHECK(make_nonblock(thread->pipe_fds[0]) == ISC_R_SUCCESS);
+#if 0
+	RUNTIME_CHECK(make_nonblock(thread->pipe_fds[1]) == ISC_R_SUCCESS);
+#endif
 #endif	/* USE_WATCHER_THREAD */
+
+#ifdef USE_KQUEUE
+	thread->nevents = ISC_SOCKET_MAXEVENTS;
+	thread->events = isc_mem_get(mctx, sizeof(struct kevent) *
+				     thread->nevents);
+	if (thread->events == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup;
+	}
+	thread->kqueue_fd = kqueue();
+	if (thread->kqueue_fd == -1) {
+		result = isc__errno2result(errno);
+		isc__strerror(errno, strbuf, sizeof(strbuf));
+		UNEXPECTED_ERROR(__FILE__, __LINE__,
+				 "kqueue %s: %s",
+				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
+						ISC_MSG_FAILED, "failed"),
+				 strbuf);
+		goto cleanup;
+	}
 #elif defined(USE_EPOLL)
-	manager->nevents = ISC_SOCKET_MAXEVENTS;
-	manager->events = isc_mem_get(mctx, sizeof(struct epoll_event) *
-				      manager->nevents);
-	if (manager->events == NULL)
-		return (ISC_R_NOMEMORY);
-	manager->epoll_fd = epoll_create(manager->nevents);
-	if (manager->epoll_fd == -1) {
+	thread->nevents = ISC_SOCKET_MAXEVENTS;
+	thread->events = isc_mem_get(mctx, sizeof(struct epoll_event) *
+				     thread->nevents);
+	if (thread->events == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup;
+	}
+	thread->epoll_fd = epoll_create(thread->nevents);
+	if (thread->epoll_fd == -1) {
 		result = isc__errno2result(errno);
 		isc__strerror(errno, strbuf, sizeof(strbuf));
 		UNEXPECTED_ERROR(__FILE__, __LINE__,
@@ -4482,71 +4824,104 @@ setup_watcher(isc_mem_t *mctx, isc__socketmgr_t *manager) {
 				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
 						ISC_MSG_FAILED, "failed"),
 				 strbuf);
-		isc_mem_put(mctx, manager->events,
-			    sizeof(struct epoll_event) * manager->nevents);
-		return (result);
+		goto cleanup;
 	}
+#elif defined(USE_DEVPOLL)
+	thread->nevents = ISC_SOCKET_MAXEVENTS;
+	thread->events = isc_mem_get(mctx, sizeof(struct pollfd) *
+				     thread->nevents);
+	if (thread->events == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup;
+	}
+	thread->devpoll_fd = open("/dev/poll", O_RDWR);
+	if (thread->devpoll_fd == -1) {
+		result = isc__errno2result(errno);
+		isc__strerror(errno, strbuf, sizeof(strbuf));
+		UNEXPECTED_ERROR(__FILE__, __LINE__,
+				 "open(/dev/poll) %s: %s",
+				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
+						ISC_MSG_FAILED, "failed"),
+				 strbuf);
+		goto cleanup;
+	}
+#endif	/* USE_KQUEUE */
+
+#ifdef USE_WATCHER_THREAD
+	result = watch_fd(thread, thread->pipe_fds[0], SELECT_POKE_READ);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup;
+#endif	/* USE_WATCHER_THREAD */
+
+	return (ISC_R_SUCCESS);
+
+ cleanup:
+	free_thread(mctx, thread);
+	return (result);
+}
+
+static void
+cleanup_thread(isc_mem_t *mctx, isc__socketthread_t *thread) {
 #ifdef USE_WATCHER_THREAD
-	result = watch_fd(manager, manager->pipe_fds[0], SELECT_POKE_READ);
+	isc_result_t result;
+
+	result = unwatch_fd(thread, thread->pipe_fds[0], SELECT_POKE_READ);
 	if (result != ISC_R_SUCCESS) {
-		close(manager->epoll_fd);
-		isc_mem_put(mctx, manager->events,
-			    sizeof(struct epoll_event) * manager->nevents);
-		return (result);
+		UNEXPECTED_ERROR(__FILE__, __LINE__,
+				 "epoll_ctl(DEL) %s",
+				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
+						ISC_MSG_FAILED, "failed"));
 	}
 #endif	/* USE_WATCHER_THREAD */
-#elif defined(USE_DEVPOLL)
-	manager->nevents = ISC_SOCKET_MAXEVENTS;
+
+	free_thread(mctx, thread);
+}
+
+/*
+ * Release the polling state shared by all watcher threads.
+ */
+static void
+free_watcher(isc_mem_t *mctx, isc__socketmgr_t *manager) {
+#if defined(USE_DEVPOLL)
+	if (manager->fdpollinfo != NULL)
+		isc_mem_put(mctx, manager->fdpollinfo,
+			    sizeof(pollinfo_t) * manager->maxsocks);
+#elif defined(USE_SELECT)
+	if (manager->read_fds != NULL)
+		isc_mem_put(mctx, manager->read_fds, manager->fd_bufsize);
+	if (manager->read_fds_copy != NULL)
+		isc_mem_put(mctx, manager->read_fds_copy, manager->fd_bufsize);
+	if (manager->write_fds != NULL)
+		isc_mem_put(mctx, manager->write_fds, manager->fd_bufsize);
+	if (manager->write_fds_copy != NULL)
+		isc_mem_put(mctx, manager->write_fds_copy, manager->fd_bufsize);
+#else
+	UNUSED(mctx);
+	UNUSED(manager);
+#endif	/* USE_DEVPOLL */
+}
+
+static isc_result_t
+setup_watcher(isc_mem_t *mctx, isc__socketmgr_t *manager) {
+	isc_result_t result;
+	int i;
+
+#if defined(USE_DEVPOLL)
 	result = isc_resource_getcurlimit(isc_resource_openfiles,
 					  &manager->open_max);
 	if (result != ISC_R_SUCCESS)
 		manager->open_max = 64;
 	manager->calls = 0;
-	manager->events = isc_mem_get(mctx, sizeof(struct pollfd) *
-				      manager->nevents);
-	if (manager->events == NULL)
-		return (ISC_R_NOMEMORY);
 	/*
 	 * Note: fdpollinfo should be able to support all possible FDs, so
 	 * it must have maxsocks entries (not nevents).
 	 */
 	manager->fdpollinfo = isc_mem_get(mctx, sizeof(pollinfo_t) *
 					  manager->maxsocks);
-	if (manager->fdpollinfo == NULL) {
-		isc_mem_put(mctx, manager->events,
-			    sizeof(struct pollfd) * manager->nevents);
+	if (manager->fdpollinfo == NULL)
 		return (ISC_R_NOMEMORY);
-	}
 	memset(manager->fdpollinfo, 0, sizeof(pollinfo_t) * manager->maxsocks);
-	manager->devpoll_fd = open("/dev/poll", O_RDWR);
-	if (manager->devpoll_fd == -1) {
-		result = isc__errno2result(errno);
-		isc__strerror(errno, strbuf, sizeof(strbuf));
-		UNEXPECTED_ERROR(__FILE__, __LINE__,
-				 "open(/dev/poll) %s: %s",
-				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
-						ISC_MSG_FAILED, "failed"),
-				 strbuf);
-		isc_mem_put(mctx, manager->events,
-			    sizeof(struct pollfd) * manager->nevents);
-		isc_mem_put(mctx, manager->fdpollinfo,
-			    sizeof(pollinfo_t) * manager->maxsocks);
-		return (result);
-	}
-#ifdef USE_WATCHER_THREAD
-	result = watch_fd(manager, manager->pipe_fds[0], SELECT_POKE_READ);
-	if (result != ISC_R_SUCCESS) {
-		close(manager->devpoll_fd);
-		isc_mem_put(mctx, manager->events,
-			    sizeof(struct pollfd) * manager->nevents);
-		isc_mem_put(mctx, manager->fdpollinfo,
-			    sizeof(pollinfo_t) * manager->maxsocks);
-		return (result);
-	}
-#endif	/* USE_WATCHER_THREAD */
 #elif defined(USE_SELECT)
-	UNUSED(result);
-
 #if ISC_SOCKET_MAXSOCKETS > FD_SETSIZE
 	/*
 	 * Note: this code should also cover the case of MAXSOCKETS <=
@@ -4574,72 +4949,38 @@ setup_watcher(isc_mem_t *mctx, isc__socketmgr_t *manager) {
 						      manager->fd_bufsize);
 	}
 	if (manager->write_fds_copy == NULL) {
-		if (manager->write_fds != NULL) {
-			isc_mem_put(mctx, manager->write_fds,
-				    manager->fd_bufsize);
-		}
-		if (manager->read_fds_copy != NULL) {
-			isc_mem_put(mctx, manager->read_fds_copy,
-				    manager->fd_bufsize);
-		}
-		if (manager->read_fds != NULL) {
-			isc_mem_put(mctx, manager->read_fds,
-				    manager->fd_bufsize);
-		}
+		free_watcher(mctx, manager);
 		return (ISC_R_NOMEMORY);
 	}
 	memset(manager->read_fds, 0, manager->fd_bufsize);
 	memset(manager->write_fds, 0, manager->fd_bufsize);
-
-#ifdef USE_WATCHER_THREAD
-	(void)watch_fd(manager, manager->pipe_fds[0], SELECT_POKE_READ);
-	manager->maxfd = manager->pipe_fds[0];
-#else /* USE_WATCHER_THREAD */
 	manager->maxfd = 0;
-#endif /* USE_WATCHER_THREAD */
-#endif	/* USE_KQUEUE */
+#endif	/* USE_DEVPOLL */
+
+	for (i = 0; i < manager->nthreads; i++) {
+		result = setup_thread(mctx, &manager->threads[i]);
+		if (result != ISC_R_SUCCESS) {
+			while (--i >= 0)
+				cleanup_thread(mctx, &manager->threads[i]);
+			free_watcher(mctx, manager);
+			return (result);
+		}
+	}
+
+#if defined(USE_SELECT) && defined(USE_WATCHER_THREAD)
+	manager->maxfd = manager->threads[0].pipe_fds[0];
+#endif
 
 	return (ISC_R_SUCCESS);
 }
 
 static void
 cleanup_watcher(isc_mem_t *mctx, isc__socketmgr_t *manager) {
-#ifdef USE_WATCHER_THREAD
-	isc_result_t result;
-
-	result = unwatch_fd(manager, manager->pipe_fds[0], SELECT_POKE_READ);
-	if (result != ISC_R_SUCCESS) {
-		UNEXPECTED_ERROR(__FILE__, __LINE__,
-				 "epoll_ctl(DEL) %s",
-				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
-						ISC_MSG_FAILED, "failed"));
-	}
-#endif	/* USE_WATCHER_THREAD */
+	int i;
 
-#ifdef USE_KQUEUE
-	close(manager->kqueue_fd);
-	isc_mem_put(mctx, manager->events,
-		    sizeof(struct kevent) * manager->nevents);
-#elif defined(USE_EPOLL)
-	close(manager->epoll_fd);
-	isc_mem_put(mctx, manager->events,
-		    sizeof(struct epoll_event) * manager->nevents);
-#elif defined(USE_DEVPOLL)
-	close(manager->devpoll_fd);
-	isc_mem_put(mctx, manager->events,
-		    sizeof(struct pollfd) * manager->nevents);
-	isc_mem_put(mctx, manager->fdpollinfo,
-		    sizeof(pollinfo_t) * manager->maxsocks);
-#elif defined(USE_SELECT)
-	if (manager->read_fds != NULL)
-		isc_mem_put(mctx, manager->read_fds, manager->fd_bufsize);
-	if (manager->read_fds_copy != NULL)
-		isc_mem_put(mctx, manager->read_fds_copy, manager->fd_bufsize);
-	if (manager->write_fds != NULL)
-		isc_mem_put(mctx, manager->write_fds, manager->fd_bufsize);
-	if (manager->write_fds_copy != NULL)
-		isc_mem_put(mctx, manager->write_fds_copy, manager->fd_bufsize);
-#endif	/* USE_KQUEUE */
+	for (i = 0; i < manager->nthreads; i++)
+		cleanup_thread(mctx, &manager->threads[i]);
+	free_watcher(mctx, manager);
 }
 
 isc_result_t
@@ -4650,15 +4991,20 @@ isc__socketmgr_create(isc_mem_t *mctx, isc_socketmgr_t **managerp) {
 isc_result_t
 isc__socketmgr_create2(isc_mem_t *mctx, isc_socketmgr_t **managerp,
 		       unsigned int maxsocks)
+{
+	return (isc__socketmgr_create3(mctx, managerp, maxsocks, 1));
+}
+
+isc_result_t
+isc__socketmgr_create3(isc_mem_t *mctx, isc_socketmgr_t **managerp,
+		       unsigned int maxsocks, unsigned int nthreads)
 {
 	int i;
 	isc__socketmgr_t *manager;
-#ifdef USE_WATCHER_THREAD
-	char strbuf[ISC_STRERRORSIZE];
-#endif
 	isc_result_t result;
 
 	REQUIRE(managerp != NULL && *managerp == NULL);
+	REQUIRE(nthreads > 0);
 
 #ifdef USE_SHARED_MANAGER
 	if (socketmgr != NULL) {
@@ -4674,6 +5020,9 @@ isc__socketmgr_create2(isc_mem_t *mctx, isc_socketmgr_t **managerp,
 
 	if (maxsocks == 0)
 		maxsocks = ISC_SOCKET_MAXSOCKETS;
+#ifndef USE_MULTI_WATCHER
+	nthreads = 1;
+#endif
 
 	manager = isc_mem_get(mctx, sizeof(*manager));
 	if (manager == NULL)
@@ -4684,6 +5033,18 @@ isc__socketmgr_create2(isc_mem_t *mctx, isc_socketmgr_t **managerp,
 	manager->maxsocks = maxsocks;
 	manager->reserved = 0;
 	manager->maxudp = 0;
+	manager->nthreads = nthreads;
+	manager->threads = isc_mem_get(mctx, nthreads *
+				       sizeof(isc__socketthread_t));
+	if (manager->threads == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto free_manager;
+	}
+	memset(manager->threads, 0, nthreads * sizeof(isc__socketthread_t));
+	for (i = 0; i < manager->nthreads; i++) {
+		manager->threads[i].manager = manager;
+		manager->threads[i].threadid = i;
+	}
 	manager->fds = isc_mem_get(mctx,
 				   manager->maxsocks * sizeof(isc__socket_t *));
 	if (manager->fds == NULL) {
@@ -4741,26 +5102,6 @@ isc__socketmgr_create2(isc_mem_t *mctx, isc_socketmgr_t **managerp,
 		result = ISC_R_UNEXPECTED;
 		goto cleanup_lock;
 	}
-
-	/*
-	 * Create the special fds that will be used to wake up the
-	 * select/poll loop when something internal needs to be done.
-	 */
-	if (pipe(manager->pipe_fds) != 0) {
-		isc__strerror(errno, strbuf, sizeof(strbuf));
-		UNEXPECTED_ERROR(__FILE__, __LINE__,
-				 "pipe() %s: %s",
-				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
-						ISC_MSG_FAILED, "failed"),
-				 strbuf);
-		result = ISC_R_UNEXPECTED;
-		goto cleanup_condition;
-	}
-
-	RUNTIME_CHECK(make_nonblock(manager->pipe_fds[0]) == ISC_R_SUCCESS);
-#if 0
-	RUNTIME_CHECK(make_nonblock(manager->pipe_fds[1]) == ISC_R_SUCCESS);
-#endif
 #endif	/* USE_WATCHER_THREAD */
 
 #ifdef USE_SHARED_MANAGER
@@ -4778,19 +5119,36 @@ isc__socketmgr_create2(isc_mem_t *mctx, isc_socketmgr_t **managerp,
 
 #ifdef USE_WATCHER_THREAD
 	/*
-	 * Start up the select/poll thread.
+	 * Start up the select/poll threads.  When there is more than one,
+	 * each is pinned to its own CPU so that the sockets it watches
+	 * stay on that core.
 	 */
-	if (isc_thread_create(watcher, manager, &manager->watcher) !=
-	    ISC_R_SUCCESS) {
-		UNEXPECTED_ERROR(__FILE__, __LINE__,
-				 "isc_thread_create() %s",
-				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
-						ISC_MSG_FAILED, "failed"));
-		cleanup_watcher(mctx, manager);
-		result = ISC_R_UNEXPECTED;
-		goto cleanup;
+	for (i = 0; i < manager->nthreads; i++) {
+		isc__socketthread_t *thread = &manager->threads[i];
+
+		if (isc_thread_create(watcher, thread, &thread->thread) !=
+		    ISC_R_SUCCESS) {
+			UNEXPECTED_ERROR(__FILE__, __LINE__,
+					 "isc_thread_create() %s",
+					 isc_msgcat_get(isc_msgcat,
+							ISC_MSGSET_GENERAL,
+							ISC_MSG_FAILED,
+							"failed"));
+			while (--i >= 0) {
+				select_poke(manager, i, 0,
+					    SELECT_POKE_SHUTDOWN);
+				(void)isc_thread_join(manager->threads[i].thread,
+						      NULL);
+			}
+			cleanup_watcher(mctx, manager);
+			result = ISC_R_UNEXPECTED;
+			goto cleanup;
+		}
+		isc_thread_setname(thread->thread, "isc-socket");
+		if (manager->nthreads > 1)
+			(void)isc_thread_setaffinity(thread->thread,
+						     i % isc_os_ncpus());
 	}
-	isc_thread_setname(manager->watcher, "isc-socket");
 #endif /* USE_WATCHER_THREAD */
 	isc_mem_attach(mctx, &manager->mctx);
 
@@ -4803,12 +5161,6 @@ isc__socketmgr_create2(isc_mem_t *mctx, isc_socketmgr_t **managerp,
 
 cleanup:
 #ifdef USE_WATCHER_THREAD
-	(void)close(manager->pipe_fds[0]);
-	(void)close(manager->pipe_fds[1]);
-#endif	/* USE_WATCHER_THREAD */
-
-#ifdef USE_WATCHER_THREAD
-cleanup_condition:
 	(void)isc_condition_destroy(&manager->shutdown_ok);
 #endif	/* USE_WATCHER_THREAD */
 
@@ -4839,6 +5191,10 @@ free_manager:
 		isc_mem_put(mctx, manager->fds,
 			    manager->maxsocks * sizeof(isc_socket_t *));
 	}
+	if (manager->threads != NULL) {
+		isc_mem_put(mctx, manager->threads,
+			    manager->nthreads * sizeof(isc__socketthread_t));
+	}
 	isc_mem_put(mctx, manager, sizeof(*manager));
 
 	return (result);
@@ -4912,21 +5268,27 @@ isc__socketmgr_destroy(isc_socketmgr_t **managerp) {
 	UNLOCK(&manager->lock);
 
 	/*
-	 * Here, poke our select/poll thread.  Do this by closing the write
+	 * Here, poke our select/poll threads.  Do this by closing the write
 	 * half of the pipe, which will send EOF to the read half.
 	 * This is currently a no-op in the non-threaded case.
 	 */
-	select_poke(manager, 0, SELECT_POKE_SHUTDOWN);
+	for (i = 0; i < manager->nthreads; i++)
+		select_poke(manager, i, 0, SELECT_POKE_SHUTDOWN);
 
 #ifdef USE_WATCHER_THREAD
 	/*
-	 * Wait for thread to exit.
+	 * Wait for threads to exit.
 	 */
-	if (isc_thread_join(manager->watcher, NULL) != ISC_R_SUCCESS)
-		UNEXPECTED_ERROR(__FILE__, __LINE__,
-				 "isc_thread_join() %s",
-				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
-						ISC_MSG_FAILED, "failed"));
+	for (i = 0; i < manager->nthreads; i++) {
+		if (isc_thread_join(manager->threads[i].thread, NULL) !=
+		    ISC_R_SUCCESS)
+			UNEXPECTED_ERROR(__FILE__, __LINE__,
+					 "isc_thread_join() %s",
+					 isc_msgcat_get(isc_msgcat,
+							ISC_MSGSET_GENERAL,
+							ISC_MSG_FAILED,
+							"failed"));
+	}
 #endif /* USE_WATCHER_THREAD */
 
 	/*
@@ -4935,8 +5297,6 @@ isc__socketmgr_destroy(isc_socketmgr_t **managerp) {
 	cleanup_watcher(manager->mctx, manager);
 
 #ifdef USE_WATCHER_THREAD
-	(void)close(manager->pipe_fds[0]);
-	(void)close(manager->pipe_fds[1]);
 	(void)isc_condition_destroy(&manager->shutdown_ok);
 #endif /* USE_WATCHER_THREAD */
 
@@ -4952,6 +5312,8 @@ isc__socketmgr_destroy(isc_socketmgr_t **managerp) {
 		    manager->maxsocks * sizeof(isc__socket_t *));
 	isc_mem_put(manager->mctx, manager->fdstate,
 		    manager->maxsocks * sizeof(int));
+	isc_mem_put(manager->mctx, manager->threads,
+		    manager->nthreads * sizeof(isc__socketthread_t));
 
 	if (manager->stats != NULL)
 		isc_stats_detach(&manager->stats);
@@ -4988,13 +5350,17 @@ socket_recv(isc__socket_t *sock, isc_socketevent_t *dev, isc_task_t *task,
 
 	dev->ev_sender = task;
 
-	if (sock->type == isc_sockettype_udp) {
+	/*
+	 * On a batching socket, requests are always queued so that the
+	 * watcher can fill as many of them as possible per system call.
+	 */
+	if (sock->type == isc_sockettype_udp && sock->batch <= 1) {
 		io_state = doio_recv(sock, dev);
 	} else {
 		LOCK(&sock->lock);
 		have_lock = ISC_TRUE;
 
-		if (ISC_LIST_EMPTY(sock->recv_list))
+		if (ISC_LIST_EMPTY(sock->recv_list) && sock->batch <= 1)
 			io_state = doio_recv(sock, dev);
 		else
 			io_state = DOIO_SOFT;
@@ -5021,7 +5387,8 @@ socket_recv(isc__socket_t *sock, isc_socketevent_t *dev, isc_task_t *task,
 		 * watched, poke the watcher to start paying attention to it.
 		 */
 		if (ISC_LIST_EMPTY(sock->recv_list) && !sock->pending_recv)
-			select_poke(sock->manager, sock->fd, SELECT_POKE_READ);
+			select_poke(sock->manager, sock->threadid, sock->fd,
+				    SELECT_POKE_READ);
 		ISC_LIST_ENQUEUE(sock->recv_list, dev, ev_link);
 
 		socket_log(sock, NULL, EVENT, NULL, 0, 0,
@@ -5191,7 +5558,20 @@ socket_send(isc__socket_t *sock, isc_socketevent_t *dev, isc_task_t *task,
 		}
 	}
 
-	if (sock->type == isc_sockettype_udp)
+	dev->attributes &= ~ISC_SOCKEVENTATTR_NORETRY;
+	if (sock->type == isc_sockettype_udp && sock->batch > 1) {
+		/*
+		 * Batching socket: queue the request so that the watcher
+		 * can flush it together with others.
+		 */
+		LOCK(&sock->lock);
+		have_lock = ISC_TRUE;
+		io_state = DOIO_SOFT;
+		if ((flags & ISC_SOCKFLAG_NORETRY) != 0) {
+			dev->attributes |= ISC_SOCKEVENTATTR_NORETRY;
+			flags &= ~ISC_SOCKFLAG_NORETRY;
+		}
+	} else if (sock->type == isc_sockettype_udp)
 		io_state = doio_send(sock, dev);
 	else {
 		LOCK(&sock->lock);
@@ -5225,7 +5605,7 @@ socket_send(isc__socket_t *sock, isc_socketevent_t *dev, isc_task_t *task,
 			 */
 			if (ISC_LIST_EMPTY(sock->send_list) &&
 			    !sock->pending_send)
-				select_poke(sock->manager, sock->fd,
+				select_poke(sock->manager, sock->threadid, sock->fd,
 					    SELECT_POKE_WRITE);
 			ISC_LIST_ENQUEUE(sock->send_list, dev, ev_link);
 
@@ -5597,6 +5977,21 @@ isc__socket_bind(isc_socket_t *sock0, const isc_sockaddr_t *sockaddr,
 						ISC_MSG_FAILED, "failed"));
 		/* Press on... */
 	}
+#ifdef SO_REUSEPORT
+	/*
+	 * Let several sockets share the port, with the kernel spreading
+	 * incoming datagrams across them.
+	 */
+	if ((options & ISC_SOCKET_REUSEPORT) != 0 &&
+	    setsockopt(sock->fd, SOL_SOCKET, SO_REUSEPORT, (void *)&on,
+		       sizeof(on)) < 0) {
+		UNEXPECTED_ERROR(__FILE__, __LINE__,
+				 "setsockopt(%d, SO_REUSEPORT) %s", sock->fd,
+				 isc_msgcat_get(isc_msgcat, ISC_MSGSET_GENERAL,
+						ISC_MSG_FAILED, "failed"));
+		/* Press on... */
+	}
+#endif
 #ifdef AF_UNIX
  bind_socket:
 #endif
@@ -5846,7 +6241,8 @@ isc__socket_accept(isc_socket_t *sock0,
 	ISC_LIST_ENQUEUE(sock->accept_list, dev, ev_link);
 
 	if (do_poke)
-		select_poke(manager, sock->fd, SELECT_POKE_ACCEPT);
+		select_poke(manager, sock->threadid, sock->fd,
+			    SELECT_POKE_ACCEPT);
 
 	UNLOCK(&sock->lock);
 	return (ISC_R_SUCCESS);
@@ -5997,7 +6393,8 @@ isc__socket_connect(isc_socket_t *sock0, const isc_sockaddr_t *addr,
 	 * bit of time waking it up now or later won't matter all that much.
 	 */
 	if (ISC_LIST_EMPTY(sock->connect_list) && !sock->connecting)
-		select_poke(manager, sock->fd, SELECT_POKE_CONNECT);
+		select_poke(manager, sock->threadid, sock->fd,
+			    SELECT_POKE_CONNECT);
 
 	sock->connecting = 1;
 
@@ -6071,7 +6468,7 @@ internal_connect(isc_task_t *me, isc_event_t *ev) {
 		 */
 		if (SOFT_ERROR(errno) || errno == EINPROGRESS) {
 			sock->connecting = 1;
-			select_poke(sock->manager, sock->fd,
+			select_poke(sock->manager, sock->threadid, sock->fd,
 				    SELECT_POKE_CONNECT);
 			UNLOCK(&sock->lock);
 
@@ -6484,18 +6881,19 @@ isc__socketmgr_waitevents(isc_socketmgr_t *manager0, struct timeval *tvp,
 		tsp = &ts;
 	} else
 		tsp = NULL;
-	swait_private.nevents = kevent(manager->kqueue_fd, NULL, 0,
-				       manager->events, manager->nevents,
-				       tsp);
+	swait_private.nevents = kevent(manager->threads[0].kqueue_fd, NULL, 0,
+				       manager->threads[0].events,
+				       manager->threads[0].nevents, tsp);
 	n = swait_private.nevents;
 #elif defined(USE_EPOLL)
 	if (tvp != NULL)
 		timeout = tvp->tv_sec * 1000 + (tvp->tv_usec + 999) / 1000;
 	else
 		timeout = -1;
-	swait_private.nevents = epoll_wait(manager->epoll_fd,
-					   manager->events,
-					   manager->nevents, timeout);
+	swait_private.nevents = epoll_wait(manager->threads[0].epoll_fd,
+					   manager->threads[0].events,
+					   manager->threads[0].nevents,
+					   timeout);
 	n = swait_private.nevents;
 #elif defined(USE_DEVPOLL)
 	/*
@@ -6509,8 +6907,8 @@ isc__socketmgr_waitevents(isc_socketmgr_t *manager0, struct timeval *tvp,
 		manager->calls = 0;
 	}
 	for (pass = 0; pass < 2; pass++) {
-		dvp.dp_fds = manager->events;
-		dvp.dp_nfds = manager->nevents;
+		dvp.dp_fds = manager->threads[0].events;
+		dvp.dp_nfds = manager->threads[0].nevents;
 		if (dvp.dp_nfds >= manager->open_max)
 			dvp.dp_nfds = manager->open_max - 1;
 		if (tvp != NULL) {
@@ -6518,7 +6916,7 @@ isc__socketmgr_waitevents(isc_socketmgr_t *manager0, struct timeval *tvp,
 				(tvp->tv_usec + 999) / 1000;
 		} else
 			dvp.dp_timeout = -1;
-		n = ioctl(manager->devpoll_fd, DP_POLL, &dvp);
+		n = ioctl(manager->threads[0].devpoll_fd, DP_POLL, &dvp);
 		if (n == -1 && errno == EINVAL) {
 			/*
 			 * {OPEN_MAX} may have dropped.  Look
@@ -6564,10 +6962,12 @@ isc__socketmgr_dispatch(isc_socketmgr_t *manager0, isc_socketwait_t *swait) {
 		return (ISC_R_NOTFOUND);
 
 #if defined(USE_KQUEUE) || defined(USE_EPOLL) || defined(USE_DEVPOLL)
-	(void)process_fds(manager, manager->events, swait->nevents);
+	(void)process_fds(&manager->threads[0], manager->threads[0].events,
+			  swait->nevents);
 	return (ISC_R_SUCCESS);
 #elif defined(USE_SELECT)
-	process_fds(manager, swait->maxfd, swait->readset, swait->writeset);
+	process_fds(&manager->threads[0], swait->maxfd, swait->readset,
+		    swait->writeset);
 	return (ISC_R_SUCCESS);
 #endif
 }
@@ -6589,6 +6989,73 @@ isc__socket_setname(isc_socket_t *socket0, const char *name, void *tag) {
 	UNLOCK(&sock->lock);
 }
 
+isc_result_t
+isc__socket_setbatch(isc_socket_t *sock0, unsigned int n) {
+	isc__socket_t *sock = (isc__socket_t *)sock0;
+#ifdef USE_MMSG
+	char *cmsgbuf = NULL;
+	size_t cmsgbuflen = 0;
+#endif
+
+	REQUIRE(VALID_SOCKET(sock));
+	REQUIRE(sock->type == isc_sockettype_udp);
+
+	if (n > ISC_SOCKET_MAXBATCH)
+		n = ISC_SOCKET_MAXBATCH;
+
+#ifdef USE_MMSG
+	if (n > 1) {
+		cmsgbuflen = n * (sock->recvcmsgbuflen + sock->sendcmsgbuflen);
+		if (cmsgbuflen != 0) {
+			cmsgbuf = isc_mem_get(sock->manager->mctx, cmsgbuflen);
+			if (cmsgbuf == NULL)
+				return (ISC_R_NOMEMORY);
+		}
+	}
+#else
+	/*
+	 * Without recvmmsg()/sendmmsg() there is nothing to gain from
+	 * queueing requests.
+	 */
+	n = 0;
+#endif
+
+	LOCK(&sock->lock);
+#ifdef USE_MMSG
+	if (sock->batchcmsgbuf != NULL)
+		isc_mem_put(sock->manager->mctx, sock->batchcmsgbuf,
+			    sock->batchcmsgbuflen);
+	sock->batchcmsgbuf = cmsgbuf;
+	sock->batchcmsgbuflen = cmsgbuflen;
+#endif
+	sock->batch = (n > 1) ? n : 0;
+	UNLOCK(&sock->lock);
+
+	return (ISC_R_SUCCESS);
+}
+
+void
+isc__socket_setthread(isc_socket_t *sock0, unsigned int threadid) {
+	isc__socket_t *sock = (isc__socket_t *)sock0;
+
+	REQUIRE(VALID_SOCKET(sock));
+
+	LOCK(&sock->lock);
+	/*
+	 * The descriptor must not be watched yet, as it would otherwise
+	 * be left registered with the old thread's event queue.
+	 */
+	REQUIRE(sock->fd >= 0);
+	REQUIRE(ISC_LIST_EMPTY(sock->recv_list) &&
+		ISC_LIST_EMPTY(sock->send_list) &&
+		ISC_LIST_EMPTY(sock->accept_list) &&
+		ISC_LIST_EMPTY(sock->connect_list));
+	REQUIRE(sock->type != isc_sockettype_fdwatch);
+
+	sock->threadid = threadid % sock->manager->nthreads;
+	UNLOCK(&sock->lock);
+}
+
 const char *
 isc__socket_getname(isc_socket_t *socket0) {
 	isc__socket_t *sock = (isc__socket_t *)socket0;
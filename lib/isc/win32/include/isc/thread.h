@@ -77,6 +77,12 @@ isc_thread_setconcurrency(unsigned int level);
 void
 isc_thread_setname(isc_thread_t, const char *);
 
+isc_result_t
+isc_thread_setaffinity(isc_thread_t, int);
+
+unsigned int
+isc_thread_shard(unsigned int max);
+
 int
 isc_thread_key_create(isc_thread_key_t *key, void (*func)(void *));
 
@@ -2656,6 +2656,15 @@ isc__socketmgr_create(isc_mem_t *mctx, isc_socketmgr_t **managerp) {
 	return (isc_socketmgr_create2(mctx, managerp, 0));
 }
 
+isc_result_t
+isc__socketmgr_create3(isc_mem_t *mctx, isc_socketmgr_t **managerp,
+		       unsigned int maxsocks, unsigned int nthreads)
+{
+	UNUSED(nthreads);
+
+	return (isc__socketmgr_create2(mctx, managerp, maxsocks));
+}
+
 isc_result_t
 isc__socketmgr_create2(isc_mem_t *mctx, isc_socketmgr_t **managerp,
 		       unsigned int maxsocks)
@@ -3952,6 +3961,20 @@ isc__socket_setname(isc_socket_t *socket, const char *name, void *tag) {
 	UNLOCK(&socket->lock);
 }
 
+isc_result_t
+isc__socket_setbatch(isc_socket_t *socket, unsigned int n) {
+	REQUIRE(VALID_SOCKET(socket));
+	UNUSED(n);
+
+	return (ISC_R_SUCCESS);
+}
+
+void
+isc__socket_setthread(isc_socket_t *socket, unsigned int threadid) {
+	REQUIRE(VALID_SOCKET(socket));
+	UNUSED(threadid);
+}
+
 const char *
 isc__socket_getname(isc_socket_t *socket) {
 	return (socket->name);
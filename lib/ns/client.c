@@ -9,11 +9,13 @@
 #include <config.h>
 
 #include <isc/aes.h>
+#include <isc/arena.h>
 #include <isc/formatcheck.h>
 #include <isc/fuzz.h>
 #include <isc/hmacsha.h>
 #include <isc/mutex.h>
 #include <isc/once.h>
+#include <isc/os.h>
 #include <isc/platform.h>
 #include <isc/print.h>
 #include <isc/queue.h>
@@ -43,6 +45,7 @@
 #include <dns/rdatalist.h>
 #include <dns/rdataset.h>
 #include <dns/resolver.h>
+#include <dns/respcache.h>
 #include <dns/stats.h>
 #include <dns/tsig.h>
 #include <dns/view.h>
@@ -94,6 +97,7 @@
 #define TCP_BUFFER_SIZE			(65535 + 2)
 #define SEND_BUFFER_SIZE		4096
 #define RECV_BUFFER_SIZE		4096
+#define ARENA_SIZE			4096
 
 #ifdef ISC_PLATFORM_USETHREADS
 #define NMCTXS				100
@@ -126,8 +130,13 @@ struct ns_clientmgr {
 	/* Unlocked. */
 	unsigned int			magic;
 
-	/* The queue object has its own locks */
-	client_queue_t			inactive;     /*%< To be recycled */
+	/*
+	 * Clients to be recycled.  inactive[0] holds the clients whose
+	 * task is not bound to a worker thread, inactive[i + 1] those
+	 * bound to worker 'i'.  The queue objects have their own locks.
+	 */
+	unsigned int			ninactive;
+	client_queue_t			*inactive;
 
 	isc_mem_t *			mctx;
 	ns_server_t *			sctx;
@@ -157,6 +166,35 @@ struct ns_clientmgr {
 #define MANAGER_MAGIC			ISC_MAGIC('N', 'S', 'C', 'm')
 #define VALID_MANAGER(m)		ISC_MAGIC_VALID(m, MANAGER_MAGIC)
 
+#define INACTIVE(m, c)			((m)->inactive[(c)->threadid + 1])
+
+/*%
+ * A TCP connection, shared by the clients working on queries read from
+ * it.  Unlike the clients themselves it is used from several tasks, so
+ * it has a lock.
+ *
+ * Responses are queued on the connection and written a batch at a time
+ * with a single gathering send, in whatever order they become ready.
+ * Once a send fails or is canceled the stream may be half written, so
+ * nothing more is sent on it.
+ */
+struct ns_tcpconn {
+	unsigned int			magic;
+	isc_mem_t *			mctx;
+	isc_mutex_t			lock;
+	unsigned int			references;
+	isc_socket_t *			sock;
+	isc_boolean_t			pipelined;
+	unsigned int			inflight;  /*%< queries in progress */
+	isc_boolean_t			sending;
+	isc_boolean_t			failed;	   /*%< no more sends */
+	client_list_t			sendq;	   /*%< responses to send */
+	client_list_t			sent;	   /*%< responses being sent */
+};
+
+#define TCPCONN_MAGIC			ISC_MAGIC('N', 'S', 'T', 'c')
+#define VALID_TCPCONN(c)		ISC_MAGIC_VALID(c, TCPCONN_MAGIC)
+
 /*!
  * Client object states.  Ordering is significant: higher-numbered
  * states are generally "more active", meaning that the client can
@@ -244,7 +282,9 @@ static void ns_client_dumpmessage(ns_client_t *client, const char *reason);
 static isc_result_t get_client(ns_clientmgr_t *manager, ns_interface_t *ifp,
 			       dns_dispatch_t *disp, isc_boolean_t tcp);
 static isc_result_t get_worker(ns_clientmgr_t *manager, ns_interface_t *ifp,
-			       isc_socket_t *sock);
+			       ns_tcpconn_t *conn);
+static void tcpconn_detach(ns_tcpconn_t **connp);
+static void tcpconn_cancel(ns_client_t *client);
 static void compute_cookie(ns_client_t *client, isc_uint32_t when,
 			   isc_uint32_t nonce, const unsigned char *secret,
 			   isc_buffer_t *buf);
@@ -366,7 +406,13 @@ exit_check(ns_client_t *client) {
 		/*
 		 * We are trying to abort request processing.
 		 */
-		if (client->nsends > 0) {
+		if (client->nsends > 0 && client->tcpconn != NULL) {
+			/*
+			 * The response may be queued on the connection or
+			 * part of a batch sent from another client's task.
+			 */
+			tcpconn_cancel(client);
+		} else if (client->nsends > 0) {
 			isc_socket_t *sock;
 			if (TCP_CLIENT(client))
 				sock = client->tcpsocket;
@@ -441,6 +487,8 @@ exit_check(ns_client_t *client) {
 			CTRACE("closetcp");
 			isc_socket_detach(&client->tcpsocket);
 		}
+		if (client->tcpconn != NULL)
+			tcpconn_detach(&client->tcpconn);
 
 		if (client->tcpquota != NULL)
 			isc_quota_detach(&client->tcpquota);
@@ -544,11 +592,8 @@ exit_check(ns_client_t *client) {
 		client->mortal = ISC_FALSE;
 		client->sendcb = NULL;
 
-		if (client->keytag != NULL) {
-			isc_mem_put(client->mctx, client->keytag,
-				    client->keytag_len);
-			client->keytag_len = 0;
-		}
+		client->keytag = NULL;
+		client->keytag_len = 0;
 
 		/*
 		 * Put the client on the inactive list.  If we are aiming for
@@ -566,8 +611,8 @@ exit_check(ns_client_t *client) {
 			     NS_SERVER_CLIENTTEST) == 0 &&
 			    manager != NULL && !manager->exiting)
 			{
-				ISC_QUEUE_PUSH(manager->inactive, client,
-					       ilink);
+				ISC_QUEUE_PUSH(INACTIVE(manager, client),
+					       client, ilink);
 			}
 			if (client->needshutdown)
 				isc_task_shutdown(client->task);
@@ -603,6 +648,7 @@ exit_check(ns_client_t *client) {
 
 		ns_query_free(client);
 		isc_mem_put(client->mctx, client->recvbuf, RECV_BUFFER_SIZE);
+		isc_mem_put(client->mctx, client->sendbuf, SEND_BUFFER_SIZE);
 		isc_event_free((isc_event_t **)&client->sendevent);
 		isc_event_free((isc_event_t **)&client->recvevent);
 		isc_timer_detach(&client->timer);
@@ -618,13 +664,9 @@ exit_check(ns_client_t *client) {
 			dns_message_puttemprdataset(client->message,
 						    &client->opt);
 		}
-		if (client->keytag != NULL) {
-			isc_mem_put(client->mctx, client->keytag,
-				    client->keytag_len);
-			client->keytag_len = 0;
-		}
 
 		dns_message_destroy(&client->message);
+		isc_arena_destroy(&client->arena);
 
 		/*
 		 * Detaching the task must be done after unlinking from
@@ -722,7 +764,8 @@ client_shutdown(isc_task_t *task, isc_event_t *event) {
 	}
 
 	if (ISC_QLINK_LINKED(client, ilink))
-		ISC_QUEUE_UNLINK(client->manager->inactive, client, ilink);
+		ISC_QUEUE_UNLINK(INACTIVE(client->manager, client),
+				 client, ilink);
 
 	client->newstate = NS_CLIENTSTATE_FREED;
 	client->needshutdown = ISC_FALSE;
@@ -765,14 +808,30 @@ ns_client_endrequest(ns_client_t *client) {
 	client->udpsize = 512;
 	client->extflags = 0;
 	client->ednsversion = -1;
+	client->keytag = NULL;
+	client->keytag_len = 0;
 	dns_message_reset(client->message, DNS_MESSAGE_INTENTPARSE);
 
+	/*
+	 * Everything allocated from the arena for this request has now
+	 * been dropped by the query reset and the message reset above.
+	 */
+	isc_arena_reset(client->arena);
+
 	if (client->recursionquota != NULL) {
 		isc_quota_detach(&client->recursionquota);
 		ns_stats_decrement(client->sctx->nsstats,
 				   ns_statscounter_recursclients);
 	}
 
+	if (client->tcpinflight) {
+		LOCK(&client->tcpconn->lock);
+		INSIST(client->tcpconn->inflight > 0);
+		client->tcpconn->inflight--;
+		UNLOCK(&client->tcpconn->lock);
+		client->tcpinflight = ISC_FALSE;
+	}
+
 	/*
 	 * Clear all client attributes that are specific to
 	 * the request; that's all except the TCP flag.
@@ -821,6 +880,262 @@ ns_client_next(ns_client_t *client, isc_result_t result) {
 	(void)exit_check(client);
 }
 
+static isc_result_t
+tcpconn_create(isc_mem_t *mctx, isc_socket_t *sock, ns_tcpconn_t **connp) {
+	ns_tcpconn_t *conn;
+	isc_result_t result;
+
+	REQUIRE(connp != NULL && *connp == NULL);
+
+	conn = isc_mem_get(mctx, sizeof(*conn));
+	if (conn == NULL)
+		return (ISC_R_NOMEMORY);
+
+	result = isc_mutex_init(&conn->lock);
+	if (result != ISC_R_SUCCESS) {
+		isc_mem_put(mctx, conn, sizeof(*conn));
+		return (result);
+	}
+
+	conn->mctx = NULL;
+	isc_mem_attach(mctx, &conn->mctx);
+	conn->references = 1;
+	conn->sock = NULL;
+	isc_socket_attach(sock, &conn->sock);
+	conn->pipelined = ISC_FALSE;
+	conn->inflight = 0;
+	conn->sending = ISC_FALSE;
+	conn->failed = ISC_FALSE;
+	ISC_LIST_INIT(conn->sendq);
+	ISC_LIST_INIT(conn->sent);
+	conn->magic = TCPCONN_MAGIC;
+
+	*connp = conn;
+	return (ISC_R_SUCCESS);
+}
+
+static void
+tcpconn_attach(ns_tcpconn_t *source, ns_tcpconn_t **targetp) {
+	REQUIRE(VALID_TCPCONN(source));
+	REQUIRE(targetp != NULL && *targetp == NULL);
+
+	LOCK(&source->lock);
+	source->references++;
+	UNLOCK(&source->lock);
+
+	*targetp = source;
+}
+
+static void
+tcpconn_detach(ns_tcpconn_t **connp) {
+	ns_tcpconn_t *conn;
+	unsigned int refs;
+
+	REQUIRE(connp != NULL && VALID_TCPCONN(*connp));
+
+	conn = *connp;
+	*connp = NULL;
+
+	LOCK(&conn->lock);
+	INSIST(conn->references > 0);
+	refs = --conn->references;
+	UNLOCK(&conn->lock);
+
+	if (refs != 0)
+		return;
+
+	INSIST(conn->inflight == 0);
+	INSIST(!conn->sending);
+	INSIST(ISC_LIST_EMPTY(conn->sendq) && ISC_LIST_EMPTY(conn->sent));
+
+	conn->magic = 0;
+	isc_socket_detach(&conn->sock);
+	DESTROYLOCK(&conn->lock);
+	isc_mem_putanddetach(&conn->mctx, conn, sizeof(*conn));
+}
+
+/*%
+ * Hand the client's send event back to it with 'result', as if it had
+ * sent the response itself.
+ */
+static void
+tcpconn_complete(ns_client_t *client, isc_result_t result) {
+	isc_event_t *ev;
+
+	client->sendevent->result = result;
+	ev = (isc_event_t *)client->sendevent;
+	isc_task_send(client->task, &ev);
+}
+
+/*%
+ * Complete every client whose response was in the batch just sent.
+ * The connection must be locked.
+ */
+static void
+tcpconn_senddone_clients(ns_tcpconn_t *conn, isc_result_t result) {
+	ns_client_t *client;
+
+	while ((client = ISC_LIST_HEAD(conn->sent)) != NULL) {
+		ISC_LIST_UNLINK(conn->sent, client, slink);
+		tcpconn_complete(client, result);
+	}
+}
+
+/*%
+ * Complete every client whose response is still queued with
+ * ISC_R_CANCELED.  The connection must be locked.
+ */
+static void
+tcpconn_drain(ns_tcpconn_t *conn) {
+	ns_client_t *client;
+
+	while ((client = ISC_LIST_HEAD(conn->sendq)) != NULL) {
+		ISC_LIST_UNLINK(conn->sendq, client, slink);
+		tcpconn_complete(client, ISC_R_CANCELED);
+	}
+}
+
+static void tcpconn_senddone(isc_task_t *task, isc_event_t *event);
+
+/*%
+ * Send the queued responses, up to ISC_SOCKET_MAXSCATTERGATHER of them
+ * in each send.  The connection must be locked, and 'sending' set; it is
+ * cleared once the queue is empty.  If the connection has failed, the
+ * queue is drained instead.
+ */
+static void
+tcpconn_flush(ns_tcpconn_t *conn) {
+	ns_client_t *client, *first;
+	isc_bufferlist_t bufferlist;
+	isc_buffer_t *buffer;
+	isc_result_t result;
+	unsigned int n;
+
+	INSIST(conn->sending);
+	INSIST(ISC_LIST_EMPTY(conn->sent));
+
+	while (!ISC_LIST_EMPTY(conn->sendq)) {
+		if (conn->failed) {
+			tcpconn_drain(conn);
+			break;
+		}
+
+		ISC_LIST_INIT(bufferlist);
+		first = ISC_LIST_HEAD(conn->sendq);
+		for (n = 0; n < ISC_SOCKET_MAXSCATTERGATHER; n++) {
+			client = ISC_LIST_HEAD(conn->sendq);
+			if (client == NULL)
+				break;
+			ISC_LIST_UNLINK(conn->sendq, client, slink);
+			ISC_LIST_APPEND(conn->sent, client, slink);
+			ISC_LIST_APPEND(bufferlist, &client->tcpsendbuf, link);
+		}
+
+		/*
+		 * The first client in the batch cannot go away before
+		 * its response is sent, so its task gets the event.
+		 */
+		result = isc_socket_sendv(conn->sock, &bufferlist,
+					  first->task, tcpconn_senddone, conn);
+		if (result == ISC_R_SUCCESS)
+			return;
+
+		while ((buffer = ISC_LIST_HEAD(bufferlist)) != NULL)
+			ISC_LIST_UNLINK(bufferlist, buffer, link);
+		conn->failed = ISC_TRUE;
+		tcpconn_senddone_clients(conn, result);
+	}
+
+	conn->sending = ISC_FALSE;
+}
+
+static void
+tcpconn_senddone(isc_task_t *task, isc_event_t *event) {
+	isc_socketevent_t *sevent = (isc_socketevent_t *)event;
+	ns_tcpconn_t *conn = event->ev_arg;
+	isc_buffer_t *buffer;
+
+	REQUIRE(sevent->ev_type == ISC_SOCKEVENT_SENDDONE);
+	REQUIRE(VALID_TCPCONN(conn));
+
+	UNUSED(task);
+
+	/*
+	 * The buffers belong to the clients.
+	 */
+	while ((buffer = ISC_LIST_HEAD(sevent->bufferlist)) != NULL)
+		ISC_LIST_UNLINK(sevent->bufferlist, buffer, link);
+
+	LOCK(&conn->lock);
+	if (sevent->result != ISC_R_SUCCESS)
+		conn->failed = ISC_TRUE;
+	tcpconn_senddone_clients(conn, sevent->result);
+	tcpconn_flush(conn);
+	UNLOCK(&conn->lock);
+
+	isc_event_free(&event);
+}
+
+/*%
+ * Queue a response to be sent on the client's TCP connection.  The
+ * client's send event is posted once it has been sent.
+ */
+static void
+tcpconn_send(ns_client_t *client, isc_region_t *r) {
+	ns_tcpconn_t *conn = client->tcpconn;
+
+	isc_buffer_init(&client->tcpsendbuf, r->base, r->length);
+	isc_buffer_add(&client->tcpsendbuf, r->length);
+
+	LOCK(&conn->lock);
+	if (conn->failed) {
+		tcpconn_complete(client, ISC_R_CANCELED);
+	} else {
+		ISC_LIST_APPEND(conn->sendq, client, slink);
+		if (!conn->sending) {
+			conn->sending = ISC_TRUE;
+			tcpconn_flush(conn);
+		}
+	}
+	UNLOCK(&conn->lock);
+}
+
+/*%
+ * Cancel the send of the client's response.  A response which is still
+ * queued is simply completed with ISC_R_CANCELED.  One which is being
+ * written cannot be taken out of the middle of the stream, so the whole
+ * connection fails: the send in flight is canceled, whichever task it
+ * was issued from, and every queued response is completed with
+ * ISC_R_CANCELED.
+ */
+static void
+tcpconn_cancel(ns_client_t *client) {
+	ns_tcpconn_t *conn = client->tcpconn;
+	ns_client_t *c;
+
+	LOCK(&conn->lock);
+	for (c = ISC_LIST_HEAD(conn->sendq);
+	     c != NULL && c != client;
+	     c = ISC_LIST_NEXT(c, slink))
+		;
+	if (c != NULL) {
+		ISC_LIST_UNLINK(conn->sendq, client, slink);
+		tcpconn_complete(client, ISC_R_CANCELED);
+		UNLOCK(&conn->lock);
+		return;
+	}
+
+	for (c = ISC_LIST_HEAD(conn->sent);
+	     c != NULL && c != client;
+	     c = ISC_LIST_NEXT(c, slink))
+		;
+	if (c != NULL && !conn->failed) {
+		conn->failed = ISC_TRUE;
+		tcpconn_drain(conn);
+		isc_socket_cancel(conn->sock, NULL, ISC_SOCKCANCEL_SEND);
+	}
+	UNLOCK(&conn->lock);
+}
 
 static void
 client_senddone(isc_task_t *task, isc_event_t *event) {
@@ -853,7 +1168,14 @@ client_senddone(isc_task_t *task, isc_event_t *event) {
 		client->tcpbuf = NULL;
 	}
 
-	ns_client_next(client, ISC_R_SUCCESS);
+	/*
+	 * After a failed or canceled send the TCP stream may be half
+	 * written, so the connection is closed.
+	 */
+	if (TCP_CLIENT(client) && sevent->result != ISC_R_SUCCESS)
+		ns_client_next(client, sevent->result);
+	else
+		ns_client_next(client, ISC_R_SUCCESS);
 }
 
 /*%
@@ -867,7 +1189,7 @@ client_senddone(isc_task_t *task, isc_event_t *event) {
 static isc_result_t
 client_allocsendbuf(ns_client_t *client, isc_buffer_t *buffer,
 		    isc_buffer_t *tcpbuffer, isc_uint32_t length,
-		    unsigned char *sendbuf, unsigned char **datap)
+		    unsigned char **datap)
 {
 	unsigned char *data;
 	isc_uint32_t bufsize;
@@ -898,7 +1220,7 @@ client_allocsendbuf(ns_client_t *client, isc_buffer_t *buffer,
 			isc_buffer_putuint16(buffer, (isc_uint16_t)length);
 		}
 	} else {
-		data = sendbuf;
+		data = client->sendbuf;
 		if ((client->attributes & NS_CLIENTATTR_HAVECOOKIE) == 0) {
 			if (client->view != NULL)
 				bufsize = client->view->nocookieudp;
@@ -987,6 +1309,13 @@ client_sendpkg(ns_client_t *client, isc_buffer_t *buffer) {
 	if (!TCP_CLIENT(client) && r.length > 1432)
 		client->sendevent->attributes |= ISC_SOCKEVENTATTR_USEMINMTU;
 
+	if (TCP_CLIENT(client) && client->tcpconn != NULL) {
+		CTRACE("sendv");
+		client->nsends++;
+		tcpconn_send(client, &r);
+		return (ISC_R_SUCCESS);
+	}
+
 	CTRACE("sendto");
 
 	result = isc_socket_sendto2(sock, &r, client->task,
@@ -1009,7 +1338,6 @@ ns_client_sendraw(ns_client_t *client, dns_message_t *message) {
 	isc_buffer_t buffer;
 	isc_region_t r;
 	isc_region_t *mr;
-	unsigned char sendbuf[SEND_BUFFER_SIZE];
 
 	REQUIRE(NS_CLIENT_VALID(client));
 
@@ -1022,7 +1350,7 @@ ns_client_sendraw(ns_client_t *client, dns_message_t *message) {
 	}
 
 	result = client_allocsendbuf(client, &buffer, NULL, mr->length,
-				     sendbuf, &data);
+				     &data);
 	if (result != ISC_R_SUCCESS)
 		goto done;
 
@@ -1048,6 +1376,98 @@ ns_client_sendraw(ns_client_t *client, dns_message_t *message) {
 	ns_client_next(client, result);
 }
 
+isc_result_t
+ns_client_sendcached(ns_client_t *client, unsigned int *attributesp) {
+	isc_result_t result;
+	isc_buffer_t buffer;
+	isc_region_t r;
+	unsigned int rcode;
+
+	REQUIRE(NS_CLIENT_VALID(client));
+	REQUIRE((client->query.attributes & NS_QUERYATTR_RESPCACHE) != 0);
+	REQUIRE(!TCP_CLIENT(client));
+	REQUIRE(attributesp != NULL);
+
+	isc_buffer_init(&buffer, client->sendbuf, SEND_BUFFER_SIZE);
+	result = dns_respcache_find(client->view->respcache,
+				    client->query.qname, client->query.qtype,
+				    client->query.respcacheflags,
+				    client->query.respcachegen, &buffer,
+				    attributesp);
+	if (result != ISC_R_SUCCESS)
+		return (ISC_R_NOTFOUND);
+
+	CTRACE("sendcached");
+
+	/*
+	 * Fix up the ID.
+	 */
+	isc_buffer_usedregion(&buffer, &r);
+	r.base[0] = (client->message->id >> 8) & 0xff;
+	r.base[1] = client->message->id & 0xff;
+	rcode = r.base[3] & 0x0f;
+
+	result = client_sendpkg(client, &buffer);
+
+	switch (isc_sockaddr_pf(&client->peeraddr)) {
+	case AF_INET:
+		isc_stats_increment(client->sctx->udpoutstats4,
+				    ISC_MIN((int)r.length / 16, 256));
+		break;
+	case AF_INET6:
+		isc_stats_increment(client->sctx->udpoutstats6,
+				    ISC_MIN((int)r.length / 16, 256));
+		break;
+	default:
+		INSIST(0);
+		break;
+	}
+
+	ns_stats_increment(client->sctx->nsstats, ns_statscounter_response);
+	dns_rcodestats_increment(client->sctx->rcodestats, rcode);
+	if ((*attributesp & NS_CLIENT_RESPCACHE_OPT) != 0) {
+		ns_stats_increment(client->sctx->nsstats,
+				   ns_statscounter_edns0out);
+	}
+	if ((r.base[2] & 0x02) != 0) {
+		ns_stats_increment(client->sctx->nsstats,
+				   ns_statscounter_truncatedresp);
+	}
+
+	if (result != ISC_R_SUCCESS)
+		ns_client_next(client, result);
+
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Store the rendered response in 'buffer' in the view's response cache.
+ */
+static void
+client_respcache_add(ns_client_t *client, isc_buffer_t *buffer,
+		     isc_boolean_t opt_included)
+{
+	dns_message_t *message = client->message;
+	unsigned int attributes = 0;
+	isc_region_t r;
+
+	if ((message->flags & DNS_MESSAGEFLAG_AA) != 0)
+		attributes |= NS_CLIENT_RESPCACHE_AA;
+	if (!ISC_LIST_EMPTY(message->sections[DNS_SECTION_ANSWER]))
+		attributes |= NS_CLIENT_RESPCACHE_ANSWER;
+	if (message->rcode == dns_rcode_nxdomain)
+		attributes |= NS_CLIENT_RESPCACHE_NXDOMAIN;
+	if (client->query.isreferral)
+		attributes |= NS_CLIENT_RESPCACHE_REFERRAL;
+	if (opt_included)
+		attributes |= NS_CLIENT_RESPCACHE_OPT;
+
+	isc_buffer_usedregion(buffer, &r);
+	dns_respcache_add(client->view->respcache, client->query.qname,
+			  client->query.qtype, client->query.respcacheflags,
+			  client->query.respcachegen, &r, attributes);
+}
+
 static void
 client_send(ns_client_t *client) {
 	isc_result_t result;
@@ -1057,7 +1477,6 @@ client_send(ns_client_t *client) {
 	isc_region_t r;
 	dns_compress_t cctx;
 	isc_boolean_t cleanup_cctx = ISC_FALSE;
-	unsigned char sendbuf[SEND_BUFFER_SIZE];
 	unsigned int render_opts;
 	unsigned int preferred_glue;
 	isc_boolean_t opt_included = ISC_FALSE;
@@ -1126,8 +1545,7 @@ client_send(ns_client_t *client) {
 	/*
 	 * XXXRTH  The following doesn't deal with TCP buffer resizing.
 	 */
-	result = client_allocsendbuf(client, &buffer, &tcpbuffer, 0,
-				     sendbuf, &data);
+	result = client_allocsendbuf(client, &buffer, &tcpbuffer, 0, &data);
 	if (result != ISC_R_SUCCESS)
 		goto done;
 
@@ -1270,6 +1688,11 @@ client_send(ns_client_t *client) {
 		}
 	} else {
 		respsize = isc_buffer_usedlength(&buffer);
+		if ((client->query.attributes & NS_QUERYATTR_RESPCACHE) != 0 &&
+		    client->message->opcode == dns_opcode_query)
+		{
+			client_respcache_add(client, &buffer, opt_included);
+		}
 		result = client_sendpkg(client, &buffer);
 #ifdef HAVE_DNSTAP
 		if (client->view != NULL) {
@@ -2111,7 +2534,7 @@ process_keytag(ns_client_t *client, isc_buffer_t *buf, size_t optlen) {
 		return (DNS_R_OPTERR);
 	}
 
-	client->keytag = isc_mem_get(client->mctx, optlen);
+	client->keytag = isc_arena_get(client->arena, optlen);
 	if (client->keytag != NULL) {
 		client->keytag_len = (isc_uint16_t)optlen;
 		memmove(client->keytag, isc_buffer_current(buf), optlen);
@@ -2330,6 +2753,19 @@ ns__client_request(isc_task_t *task, isc_event_t *event) {
 	}
 	client->state = client->newstate = NS_CLIENTSTATE_WORKING;
 
+	if (client->tcpconn != NULL) {
+		LOCK(&client->tcpconn->lock);
+		client->tcpconn->inflight++;
+		/*
+		 * No answer could be sent, so stop reading too.
+		 */
+		if (client->tcpconn->failed && result == ISC_R_SUCCESS)
+			result = ISC_R_CANCELED;
+		UNLOCK(&client->tcpconn->lock);
+		client->tcpinflight = ISC_TRUE;
+		client->pipelined = client->tcpconn->pipelined;
+	}
+
 	isc_task_getcurrenttimex(task, &client->requesttime);
 	client->tnow = client->requesttime;
 	client->now = isc_time_seconds(&client->tnow);
@@ -2495,6 +2931,22 @@ ns__client_request(isc_task_t *task, isc_event_t *event) {
 	 */
 	if (client->message->opcode != dns_opcode_query)
 		client->pipelined = ISC_FALSE;
+	if (TCP_CLIENT(client) && client->pipelined &&
+	    client->tcpconn != NULL)
+	{
+		unsigned int inflight;
+
+		LOCK(&client->tcpconn->lock);
+		inflight = client->tcpconn->inflight;
+		UNLOCK(&client->tcpconn->lock);
+
+		/*
+		 * Enough queries from this connection are being worked
+		 * on already.  Read the next one when this one is done.
+		 */
+		if (inflight >= client->sctx->tcppipelinelimit)
+			client->pipelined = ISC_FALSE;
+	}
 	if (TCP_CLIENT(client) && client->pipelined) {
 		result = isc_quota_reserve(&client->sctx->tcpquota);
 		if (result == ISC_R_SUCCESS)
@@ -2921,7 +3373,7 @@ get_clientmctx(ns_clientmgr_t *manager, isc_mem_t **mctxp) {
 }
 
 static isc_result_t
-client_create(ns_clientmgr_t *manager, ns_client_t **clientp) {
+client_create(ns_clientmgr_t *manager, int threadid, ns_client_t **clientp) {
 	ns_client_t *client;
 	isc_result_t result;
 	isc_mem_t *mctx = NULL;
@@ -2951,9 +3403,11 @@ client_create(ns_clientmgr_t *manager, ns_client_t **clientp) {
 	ns_server_attach(manager->sctx, &client->sctx);
 
 	client->task = NULL;
-	result = isc_task_create(manager->taskmgr, 0, &client->task);
+	result = isc_task_create_bound(manager->taskmgr, 0, &client->task,
+				       threadid);
 	if (result != ISC_R_SUCCESS)
 		goto cleanup_client;
+	client->threadid = threadid;
 	isc_task_setname(client->task, "client", client);
 
 	client->timer = NULL;
@@ -2988,14 +3442,25 @@ client_create(ns_clientmgr_t *manager, ns_client_t **clientp) {
 		goto cleanup_sendevent;
 	}
 
+	client->sendbuf = isc_mem_get(client->mctx, SEND_BUFFER_SIZE);
+	if (client->sendbuf == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup_recvbuf;
+	}
+
 	client->recvevent = isc_socket_socketevent(client->mctx, client,
 						   ISC_SOCKEVENT_RECVDONE,
 						   ns__client_request, client);
 	if (client->recvevent == NULL) {
 		result = ISC_R_NOMEMORY;
-		goto cleanup_recvbuf;
+		goto cleanup_sendbuf;
 	}
 
+	client->arena = NULL;
+	result = isc_arena_create(client->mctx, ARENA_SIZE, &client->arena);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_recvevent;
+
 	client->magic = NS_CLIENT_MAGIC;
 	client->manager = NULL;
 	client->state = NS_CLIENTSTATE_INACTIVE;
@@ -3029,6 +3494,8 @@ client_create(ns_clientmgr_t *manager, ns_client_t **clientp) {
 	client->sendcb = NULL;
 	client->pipelined = ISC_FALSE;
 	client->tcpquota = NULL;
+	client->tcpconn = NULL;
+	client->tcpinflight = ISC_FALSE;
 	client->recursionquota = NULL;
 	client->interface = NULL;
 	client->peeraddr_valid = ISC_FALSE;
@@ -3049,6 +3516,7 @@ client_create(ns_clientmgr_t *manager, ns_client_t **clientp) {
 	client->formerrcache.id = 0;
 	ISC_LINK_INIT(client, link);
 	ISC_LINK_INIT(client, rlink);
+	ISC_LINK_INIT(client, slink);
 	ISC_QLINK_INIT(client, ilink);
 	client->keytag = NULL;
 	client->keytag_len = 0;
@@ -3060,7 +3528,7 @@ client_create(ns_clientmgr_t *manager, ns_client_t **clientp) {
 	 */
 	result = ns_query_init(client);
 	if (result != ISC_R_SUCCESS)
-		goto cleanup_recvevent;
+		goto cleanup_arena;
 
 	result = isc_task_onshutdown(client->task, client_shutdown, client);
 	if (result != ISC_R_SUCCESS)
@@ -3075,9 +3543,15 @@ client_create(ns_clientmgr_t *manager, ns_client_t **clientp) {
  cleanup_query:
 	ns_query_free(client);
 
+ cleanup_arena:
+	isc_arena_destroy(&client->arena);
+
  cleanup_recvevent:
 	isc_event_free((isc_event_t **)&client->recvevent);
 
+ cleanup_sendbuf:
+	isc_mem_put(client->mctx, client->sendbuf, SEND_BUFFER_SIZE);
+
  cleanup_recvbuf:
 	isc_mem_put(client->mctx, client->recvbuf, RECV_BUFFER_SIZE);
 
@@ -3237,6 +3711,18 @@ client_newconn(isc_task_t *task, isc_event_t *event) {
 			client->pipelined = ISC_TRUE;
 		}
 
+		/*
+		 * Clients working on pipelined queries from this
+		 * connection share it, to send their responses and to
+		 * count how many queries are in flight.
+		 */
+		INSIST(client->tcpconn == NULL);
+		if (tcpconn_create(client->mctx, client->tcpsocket,
+				   &client->tcpconn) == ISC_R_SUCCESS)
+			client->tcpconn->pipelined = client->pipelined;
+		else
+			client->pipelined = ISC_FALSE;
+
 		client_read(client, ISC_TRUE);
 	}
 
@@ -3342,7 +3828,7 @@ ns_client_replace(ns_client_t *client) {
 	tcp = TCP_CLIENT(client);
 	if (tcp && client->pipelined) {
 		result = get_worker(client->manager, client->interface,
-				    client->tcpsocket);
+				    client->tcpconn);
 	} else {
 		result = get_client(client->manager, client->interface,
 				    client->dispatch, tcp);
@@ -3366,9 +3852,7 @@ ns_client_replace(ns_client_t *client) {
 
 static void
 clientmgr_destroy(ns_clientmgr_t *manager) {
-#if NMCTXS > 0
-	int i;
-#endif
+	unsigned int i;
 
 	REQUIRE(ISC_LIST_EMPTY(manager->clients));
 
@@ -3381,7 +3865,10 @@ clientmgr_destroy(ns_clientmgr_t *manager) {
 	}
 #endif
 
-	ISC_QUEUE_DESTROY(manager->inactive);
+	for (i = 0; i < manager->ninactive; i++)
+		ISC_QUEUE_DESTROY(manager->inactive[i]);
+	isc_mem_put(manager->mctx, manager->inactive,
+		    manager->ninactive * sizeof(manager->inactive[0]));
 
 	DESTROYLOCK(&manager->lock);
 	DESTROYLOCK(&manager->listlock);
@@ -3402,17 +3889,27 @@ ns_clientmgr_create(isc_mem_t *mctx, ns_server_t *sctx, isc_taskmgr_t *taskmgr,
 {
 	ns_clientmgr_t *manager;
 	isc_result_t result;
-#if NMCTXS > 0
-	int i;
-#endif
+	unsigned int i;
 
 	manager = isc_mem_get(mctx, sizeof(*manager));
 	if (manager == NULL)
 		return (ISC_R_NOMEMORY);
 
+	/*
+	 * One queue for unbound clients, and one for each CPU, as UDP
+	 * clients are bound to the worker on their listener's CPU.
+	 */
+	manager->ninactive = isc_os_ncpus() + 1;
+	manager->inactive = isc_mem_get(mctx, manager->ninactive *
+					sizeof(manager->inactive[0]));
+	if (manager->inactive == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup_manager;
+	}
+
 	result = isc_mutex_init(&manager->lock);
 	if (result != ISC_R_SUCCESS)
-		goto cleanup_manager;
+		goto cleanup_inactive;
 
 	result = isc_mutex_init(&manager->listlock);
 	if (result != ISC_R_SUCCESS)
@@ -3438,7 +3935,8 @@ ns_clientmgr_create(isc_mem_t *mctx, ns_server_t *sctx, isc_taskmgr_t *taskmgr,
 
 	ISC_LIST_INIT(manager->clients);
 	ISC_LIST_INIT(manager->recursing);
-	ISC_QUEUE_INIT(manager->inactive, ilink);
+	for (i = 0; i < manager->ninactive; i++)
+		ISC_QUEUE_INIT(manager->inactive[i], ilink);
 #if NMCTXS > 0
 	manager->nextmctx = 0;
 	for (i = 0; i < NMCTXS; i++)
@@ -3461,8 +3959,12 @@ ns_clientmgr_create(isc_mem_t *mctx, ns_server_t *sctx, isc_taskmgr_t *taskmgr,
  cleanup_lock:
 	(void) isc_mutex_destroy(&manager->lock);
 
+ cleanup_inactive:
+	isc_mem_put(mctx, manager->inactive,
+		    manager->ninactive * sizeof(manager->inactive[0]));
+
  cleanup_manager:
-	isc_mem_put(manager->mctx, manager, sizeof(*manager));
+	isc_mem_put(mctx, manager, sizeof(*manager));
 
 	return (result);
 }
@@ -3508,6 +4010,27 @@ ns_clientmgr_destroy(ns_clientmgr_t **managerp) {
 	*managerp = NULL;
 }
 
+/*
+ * Return the worker thread that the clients of UDP dispatch 'disp' of
+ * 'ifp' are bound to.  The listener sockets are spread over the socket
+ * manager's watcher threads and the task manager's workers are spread
+ * over the CPUs in the same order, so a query is received and answered
+ * on the same CPU.
+ */
+static int
+client_threadid(ns_clientmgr_t *manager, ns_interface_t *ifp,
+		dns_dispatch_t *disp)
+{
+	int i;
+
+	for (i = 0; i < ifp->nudpdispatch; i++) {
+		if (ifp->udpdispatch[i] == disp)
+			return (i % (manager->ninactive - 1));
+	}
+
+	return (-1);
+}
+
 static isc_result_t
 get_client(ns_clientmgr_t *manager, ns_interface_t *ifp,
 	   dns_dispatch_t *disp, isc_boolean_t tcp)
@@ -3515,6 +4038,7 @@ get_client(ns_clientmgr_t *manager, ns_interface_t *ifp,
 	isc_result_t result = ISC_R_SUCCESS;
 	isc_event_t *ev;
 	ns_client_t *client;
+	int threadid = -1;
 	MTRACE("get client");
 
 	REQUIRE(manager != NULL);
@@ -3522,13 +4046,16 @@ get_client(ns_clientmgr_t *manager, ns_interface_t *ifp,
 	if (manager->exiting)
 		return (ISC_R_SHUTTINGDOWN);
 
+	if (!tcp)
+		threadid = client_threadid(manager, ifp, disp);
+
 	/*
 	 * Allocate a client.  First try to get a recycled one;
 	 * if that fails, make a new one.
 	 */
 	client = NULL;
 	if ((manager->sctx->options & NS_SERVER_CLIENTTEST) == 0)
-		ISC_QUEUE_POP(manager->inactive, ilink, client);
+		ISC_QUEUE_POP(manager->inactive[threadid + 1], ilink, client);
 
 	if (client != NULL)
 		MTRACE("recycle");
@@ -3536,7 +4063,7 @@ get_client(ns_clientmgr_t *manager, ns_interface_t *ifp,
 		MTRACE("create new");
 
 		LOCK(&manager->lock);
-		result = client_create(manager, &client);
+		result = client_create(manager, threadid, &client);
 		UNLOCK(&manager->lock);
 		if (result != ISC_R_SUCCESS)
 			return (result);
@@ -3575,7 +4102,7 @@ get_client(ns_clientmgr_t *manager, ns_interface_t *ifp,
 }
 
 static isc_result_t
-get_worker(ns_clientmgr_t *manager, ns_interface_t *ifp, isc_socket_t *sock) {
+get_worker(ns_clientmgr_t *manager, ns_interface_t *ifp, ns_tcpconn_t *conn) {
 	isc_result_t result = ISC_R_SUCCESS;
 	isc_event_t *ev;
 	ns_client_t *client;
@@ -3592,7 +4119,7 @@ get_worker(ns_clientmgr_t *manager, ns_interface_t *ifp, isc_socket_t *sock) {
 	 */
 	client = NULL;
 	if ((manager->sctx->options & NS_SERVER_CLIENTTEST) == 0)
-		ISC_QUEUE_POP(manager->inactive, ilink, client);
+		ISC_QUEUE_POP(manager->inactive[0], ilink, client);
 
 	if (client != NULL)
 		MTRACE("recycle");
@@ -3600,7 +4127,7 @@ get_worker(ns_clientmgr_t *manager, ns_interface_t *ifp, isc_socket_t *sock) {
 		MTRACE("create new");
 
 		LOCK(&manager->lock);
-		result = client_create(manager, &client);
+		result = client_create(manager, -1, &client);
 		UNLOCK(&manager->lock);
 		if (result != ISC_R_SUCCESS)
 			return (result);
@@ -3625,8 +4152,9 @@ get_worker(ns_clientmgr_t *manager, ns_interface_t *ifp, isc_socket_t *sock) {
 	client->sendcb = NULL;
 
 	isc_socket_attach(ifp->tcpsocket, &client->tcplistener);
-	isc_socket_attach(sock, &client->tcpsocket);
+	isc_socket_attach(conn->sock, &client->tcpsocket);
 	isc_socket_setname(client->tcpsocket, "worker-tcp", NULL);
+	tcpconn_attach(conn, &client->tcpconn);
 	(void)isc_socket_getpeername(client->tcpsocket, &client->peeraddr);
 	client->peeraddr_valid = ISC_TRUE;
 
@@ -3657,14 +4185,14 @@ ns__clientmgr_getclient(ns_clientmgr_t *manager, ns_interface_t *ifp,
 		return (ISC_R_SHUTTINGDOWN);
 
 	client = NULL;
-	ISC_QUEUE_POP(manager->inactive, ilink, client);
+	ISC_QUEUE_POP(manager->inactive[0], ilink, client);
 	if (client != NULL)
 		MTRACE("getclient (recycle)");
 	else {
 		MTRACE("getclient (create)");
 
 		LOCK(&manager->lock);
-		result = client_create(manager, &client);
+		result = client_create(manager, -1, &client);
 		UNLOCK(&manager->lock);
 		if (result != ISC_R_SUCCESS)
 			return (result);
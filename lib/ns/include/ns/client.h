@@ -98,6 +98,7 @@ struct ns_client {
 						 */
 	unsigned int		attributes;
 	isc_task_t *		task;
+	int			threadid;	/*%< task's worker, or -1 */
 	dns_view_t *		view;
 	dns_dispatch_t *	dispatch;
 	isc_socket_t *		udpsocket;
@@ -110,9 +111,11 @@ struct ns_client {
 	isc_timer_t *		delaytimer;
 	isc_boolean_t 		timerset;
 	dns_message_t *		message;
+	isc_arena_t *		arena;	      /*%< Per-request allocations */
 	isc_socketevent_t *	sendevent;
 	isc_socketevent_t *	recvevent;
 	unsigned char *		recvbuf;
+	unsigned char *		sendbuf;	/*%< UDP response */
 	dns_rdataset_t *	opt;
 	isc_uint16_t		udpsize;
 	isc_uint16_t		extflags;
@@ -129,6 +132,9 @@ struct ns_client {
 	isc_boolean_t		mortal;	      /*%< Die after handling request */
 	isc_boolean_t		pipelined;   /*%< TCP queries not in sequence */
 	isc_quota_t		*tcpquota;
+	ns_tcpconn_t		*tcpconn;    /*%< shared TCP connection */
+	isc_boolean_t		tcpinflight; /*%< counted in tcpconn */
+	isc_buffer_t		tcpsendbuf;  /*%< response queued on tcpconn */
 	isc_quota_t		*recursionquota;
 	ns_interface_t		*interface;
 
@@ -160,6 +166,7 @@ struct ns_client {
 
 	ISC_LINK(ns_client_t)	link;
 	ISC_LINK(ns_client_t)	rlink;
+	ISC_LINK(ns_client_t)	slink;
 	ISC_QLINK(ns_client_t)	ilink;
 	unsigned char		cookie[8];
 	isc_uint32_t		expire;
@@ -193,6 +200,15 @@ typedef ISC_LIST(ns_client_t) client_list_t;
 
 #define NS_CLIENTATTR_NOSETFC		0x20000 /*%< don't set servfail cache */
 
+/*
+ * Attributes stored with a response in the response cache.
+ */
+#define NS_CLIENT_RESPCACHE_AA		0x0001 /*%< authoritative answer */
+#define NS_CLIENT_RESPCACHE_ANSWER	0x0002 /*%< answer section not empty */
+#define NS_CLIENT_RESPCACHE_NXDOMAIN	0x0004 /*%< rcode NXDOMAIN */
+#define NS_CLIENT_RESPCACHE_REFERRAL	0x0008 /*%< referral */
+#define NS_CLIENT_RESPCACHE_OPT		0x0010 /*%< has an OPT record */
+
 /*
  * Flag to use with the SERVFAIL cache to indicate
  * that a query had the CD bit set.
@@ -227,6 +243,24 @@ ns_client_sendraw(ns_client_t *client, dns_message_t *msg);
  * send msg as a response using client->message->id for the id.
  */
 
+isc_result_t
+ns_client_sendcached(ns_client_t *client, unsigned int *attributesp);
+/*%<
+ * If the view's response cache holds a response to the current
+ * query, finish processing the current client request by sending
+ * it, with the ID patched to client->message->id, and set
+ * '*attributesp' to the NS_CLIENT_RESPCACHE_* attributes describing
+ * it.
+ *
+ * Requires:
+ *\li	The query is eligible for the response cache
+ *	(NS_QUERYATTR_RESPCACHE is set).
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS		the request has been finished.
+ *\li	#ISC_R_NOTFOUND		no cached response; nothing was done.
+ */
+
 void
 ns_client_error(ns_client_t *client, isc_result_t result);
 /*%<
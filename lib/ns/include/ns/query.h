@@ -59,6 +59,8 @@ struct ns_query {
 	unsigned int			dns64_aaaaoklen;
 	unsigned int			dns64_options;
 	unsigned int			dns64_ttl;
+	isc_uint64_t			respcachegen;
+	isc_uint32_t			respcacheflags;
 	struct {
 		dns_db_t *      	db;
 		dns_zone_t *      	zone;
@@ -92,6 +94,7 @@ struct ns_query {
 #define NS_QUERYATTR_DNS64EXCLUDE	0x8000
 #define NS_QUERYATTR_RRL_CHECKED	0x10000
 #define NS_QUERYATTR_REDIRECT		0x20000
+#define NS_QUERYATTR_RESPCACHE		0x40000
 
 /* query context structure */
 
@@ -37,6 +37,7 @@
 #define NS_SERVER_DISABLE4	0x00000100U	/*%< -6 */
 #define NS_SERVER_DISABLE6	0x00000200U	/*%< -4 */
 #define NS_SERVER_FIXEDLOCAL	0x00000400U	/*%< -T fixedlocal */
+#define NS_SERVER_REUSEPORT	0x00000800U	/*%< SO_REUSEPORT listeners */
 
 /*%
  * Type for callback function to get hostname.
@@ -81,6 +82,8 @@ struct ns_server {
 	/*% Test options and other configurables */
 	isc_uint32_t		options;
 	unsigned int		delay;
+	unsigned int		udpbatch;	/*%< datagrams per syscall */
+	unsigned int		tcppipelinelimit; /*%< queries per TCP conn */
 
 	unsigned int		initialtimo;
 	unsigned int		idletimo;
@@ -91,6 +94,7 @@ struct ns_server {
 	dns_acl_t		*keepresporder;
 	isc_uint16_t		udpsize;
 	isc_uint16_t		transfer_tcp_message_size;
+	ns_xfrcache_t *		xfrcache;	/*%< recent IXFR responses */
 	isc_boolean_t		interface_auto;
 	dns_tkeyctx_t *		tkeyctx;
 	isc_rng_t *		rngctx;
@@ -20,6 +20,8 @@ typedef struct ns_interfacemgr		ns_interfacemgr_t;
 typedef struct ns_query			ns_query_t;
 typedef struct ns_server		ns_server_t;
 typedef struct ns_stats			ns_stats_t;
+typedef struct ns_tcpconn		ns_tcpconn_t;
+typedef struct ns_xfrcache		ns_xfrcache_t;
 
 typedef enum {
 	ns_cookiealg_aes,
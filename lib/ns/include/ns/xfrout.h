@@ -25,4 +25,50 @@
 void
 ns_xfr_start(ns_client_t *client, dns_rdatatype_t xfrtype);
 
+isc_result_t
+ns_xfrcache_create(isc_mem_t *mctx, ns_xfrcache_t **cachep);
+/*%<
+ * Create a cache of recently sent IXFR responses.  When several
+ * clients ask for the same change to a zone shortly after one another,
+ * the messages rendered for the first are replayed to the others with
+ * only the message ID replaced.  Transfers signed with TSIG are never
+ * cached.
+ *
+ * Requires:
+ *\li	'cachep' is not NULL and '*cachep' is NULL.
+ */
+
+void
+ns_xfrcache_flush(ns_xfrcache_t *cache, dns_zone_t *zone);
+/*%<
+ * Drop the responses cached for 'zone'.  Cached responses hold a
+ * reference to their zone, so this lets a zone that is being deleted
+ * go away without waiting for them to expire.
+ *
+ * Requires:
+ *\li	'cache' is a valid cache.
+ *\li	'zone' is not NULL.
+ */
+
+void
+ns_xfrcache_shutdown(ns_xfrcache_t *cache);
+/*%<
+ * Drop all cached responses and stop caching new ones, so that the
+ * zones they refer to can be freed when the server shuts down.
+ *
+ * Requires:
+ *\li	'cache' is a valid cache.
+ */
+
+void
+ns_xfrcache_destroy(ns_xfrcache_t **cachep);
+/*%<
+ * Destroy an IXFR response cache.  No transfers may be using it.
+ *
+ * Requires:
+ *\li	'*cachep' is a valid cache.
+ * Ensures:
+ *\li	'*cachep' is NULL on return.
+ */
+
 #endif /* NS_XFROUT_H */
@@ -13,6 +13,7 @@
 #include <isc/interfaceiter.h>
 #include <isc/os.h>
 #include <isc/random.h>
+#include <isc/socket.h>
 #include <isc/string.h>
 #include <isc/task.h>
 #include <isc/util.h>
@@ -465,12 +466,24 @@ ns_interface_listenudp(ns_interface_t *ifp) {
 	else
 		attrs |= DNS_DISPATCHATTR_IPV6;
 	attrs |= DNS_DISPATCHATTR_NOLISTEN;
+	if ((ifp->mgr->sctx->options & NS_SERVER_REUSEPORT) != 0)
+		attrs |= DNS_DISPATCHATTR_REUSEPORT;
 	attrmask = 0;
 	attrmask |= DNS_DISPATCHATTR_UDP | DNS_DISPATCHATTR_TCP;
 	attrmask |= DNS_DISPATCHATTR_IPV4 | DNS_DISPATCHATTR_IPV6;
 
 	ifp->nudpdispatch = ISC_MIN(ifp->mgr->udpdisp, MAX_UDP_DISPATCH);
 	for (disp = 0; disp < ifp->nudpdispatch; disp++) {
+		dns_dispatch_t *dup_dispatch = NULL;
+		isc_socket_t *sock;
+
+		/*
+		 * With SO_REUSEPORT each dispatcher owns a socket and the
+		 * kernel spreads the queries across them; otherwise they
+		 * all share duplicates of the first dispatcher's socket.
+		 */
+		if (disp > 0 && (attrs & DNS_DISPATCHATTR_REUSEPORT) == 0)
+			dup_dispatch = ifp->udpdispatch[0];
 		result = dns_dispatch_getudp_dup(ifp->mgr->dispatchmgr,
 						 ifp->mgr->socketmgr,
 						 ifp->mgr->taskmgr, &ifp->addr,
@@ -478,9 +491,24 @@ ns_interface_listenudp(ns_interface_t *ifp) {
 						 32768, 8219, 8237,
 						 attrs, attrmask,
 						 &ifp->udpdispatch[disp],
-						 disp == 0
-						    ? NULL
-						    : ifp->udpdispatch[0]);
+						 dup_dispatch);
+		if (result == ISC_R_ADDRINUSE && disp > 0 &&
+		    (attrs & DNS_DISPATCHATTR_REUSEPORT) != 0)
+		{
+			isc_log_write(IFMGR_COMMON_LOGARGS, ISC_LOG_INFO,
+				      "SO_REUSEPORT not available, "
+				      "sharing UDP socket");
+			attrs &= ~DNS_DISPATCHATTR_REUSEPORT;
+			result = dns_dispatch_getudp_dup(ifp->mgr->dispatchmgr,
+							 ifp->mgr->socketmgr,
+							 ifp->mgr->taskmgr,
+							 &ifp->addr,
+							 4096, UDPBUFFERS,
+							 32768, 8219, 8237,
+							 attrs, attrmask,
+							 &ifp->udpdispatch[disp],
+							 ifp->udpdispatch[0]);
+		}
 		if (result != ISC_R_SUCCESS) {
 			isc_log_write(IFMGR_COMMON_LOGARGS, ISC_LOG_ERROR,
 				      "could not listen on UDP socket: %s",
@@ -488,6 +516,23 @@ ns_interface_listenudp(ns_interface_t *ifp) {
 			goto udp_dispatch_failure;
 		}
 
+		/*
+		 * Spread the listeners over the socket manager's watcher
+		 * threads, one each.
+		 */
+		sock = dns_dispatch_getsocket(ifp->udpdispatch[disp]);
+		isc_socket_setthread(sock, disp);
+
+		if (ifp->mgr->sctx->udpbatch > 1) {
+			result = isc_socket_setbatch(sock,
+						     ifp->mgr->sctx->udpbatch);
+			if (result != ISC_R_SUCCESS) {
+				isc_log_write(IFMGR_COMMON_LOGARGS,
+					      ISC_LOG_WARNING,
+					      "could not enable UDP batching: "
+					      "%s", isc_result_totext(result));
+			}
+		}
 	}
 
 	result = ns_clientmgr_createclients(ifp->clientmgr, ifp->nudpdispatch,
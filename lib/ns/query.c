@@ -12,6 +12,7 @@
 
 #include <string.h>
 
+#include <isc/arena.h>
 #include <isc/hex.h>
 #include <isc/mem.h>
 #include <isc/print.h>
@@ -351,6 +352,9 @@ query_recurse(ns_client_t *client, dns_rdatatype_t qtype, dns_name_t *qname,
 static isc_result_t
 query_resume(query_ctx_t *qctx);
 
+static isc_result_t
+query_respcache_find(query_ctx_t *qctx);
+
 static isc_result_t
 query_checkrrl(query_ctx_t *qctx, isc_result_t result);
 
@@ -515,6 +519,11 @@ static void
 query_error(ns_client_t *client, isc_result_t result, int line) {
 	int loglevel = ISC_LOG_DEBUG(3);
 
+	/*
+	 * Never store error responses in the response cache.
+	 */
+	client->query.attributes &= ~NS_QUERYATTR_RESPCACHE;
+
 	switch (result) {
 	case DNS_R_SERVFAIL:
 		loglevel = ISC_LOG_DEBUG(1);
@@ -598,7 +607,6 @@ query_putrdataset(ns_client_t *client, dns_rdataset_t **rdatasetp) {
 
 static inline void
 query_reset(ns_client_t *client, isc_boolean_t everything) {
-	isc_buffer_t *dbuf, *dbuf_next;
 	ns_dbversion_t *dbversion, *dbversion_next;
 
 	CTRACE(ISC_LOG_DEBUG(3), "query_reset");
@@ -636,13 +644,12 @@ query_reset(ns_client_t *client, isc_boolean_t everything) {
 		query_putrdataset(client, &client->query.dns64_aaaa);
 	if (client->query.dns64_sigaaaa != NULL)
 		query_putrdataset(client, &client->query.dns64_sigaaaa);
-	if (client->query.dns64_aaaaok != NULL) {
-		isc_mem_put(client->mctx, client->query.dns64_aaaaok,
-			    client->query.dns64_aaaaoklen *
-			    sizeof(isc_boolean_t));
-		client->query.dns64_aaaaok =  NULL;
-		client->query.dns64_aaaaoklen =  0;
-	}
+	/*
+	 * dns64_aaaaok and the name buffers were allocated from the
+	 * client's arena, which is reset when the request ends.
+	 */
+	client->query.dns64_aaaaok = NULL;
+	client->query.dns64_aaaaoklen = 0;
 
 	query_putrdataset(client, &client->query.redirect.rdataset);
 	query_putrdataset(client, &client->query.redirect.sigrdataset);
@@ -657,15 +664,7 @@ query_reset(ns_client_t *client, isc_boolean_t everything) {
 
 	query_freefreeversions(client, everything);
 
-	for (dbuf = ISC_LIST_HEAD(client->query.namebufs);
-	     dbuf != NULL;
-	     dbuf = dbuf_next) {
-		dbuf_next = ISC_LIST_NEXT(dbuf, link);
-		if (dbuf_next != NULL || everything) {
-			ISC_LIST_UNLINK(client->query.namebufs, dbuf, link);
-			isc_buffer_free(&dbuf);
-		}
-	}
+	ISC_LIST_INIT(client->query.namebufs);
 
 	if (client->query.restarts > 0) {
 		/*
@@ -712,22 +711,22 @@ ns_query_free(ns_client_t *client) {
 }
 
 /*%
- * Allocate a name buffer.
+ * Allocate a name buffer from the client's arena.  It lasts until the
+ * end of the request.
  */
 static inline isc_result_t
 query_newnamebuf(ns_client_t *client) {
 	isc_buffer_t *dbuf;
-	isc_result_t result;
 
 	CTRACE(ISC_LOG_DEBUG(3), "query_newnamebuf");
 
-	dbuf = NULL;
-	result = isc_buffer_allocate(client->mctx, &dbuf, 1024);
-	if (result != ISC_R_SUCCESS) {
+	dbuf = isc_arena_get(client->arena, sizeof(*dbuf) + 1024);
+	if (dbuf == NULL) {
 		CTRACE(ISC_LOG_DEBUG(3),
-		       "query_newnamebuf: isc_buffer_allocate failed: done");
-		return (result);
+		       "query_newnamebuf: isc_arena_get failed: done");
+		return (ISC_R_NOMEMORY);
 	}
+	isc_buffer_init(dbuf, dbuf + 1, 1024);
 	ISC_LIST_APPEND(client->query.namebufs, dbuf, link);
 
 	CTRACE(ISC_LOG_DEBUG(3), "query_newnamebuf: done");
@@ -933,6 +932,8 @@ ns_query_init(ns_client_t *client) {
 	client->query.dns64_sigaaaa = NULL;
 	client->query.dns64_aaaaok = NULL;
 	client->query.dns64_aaaaoklen = 0;
+	client->query.respcachegen = 0;
+	client->query.respcacheflags = 0;
 	client->query.redirect.db = NULL;
 	client->query.redirect.node = NULL;
 	client->query.redirect.zone = NULL;
@@ -947,15 +948,8 @@ ns_query_init(ns_client_t *client) {
 		dns_fixedname_name(&client->query.redirect.fixed);
 	query_reset(client, ISC_FALSE);
 	result = query_newdbversion(client, 3);
-	if (result != ISC_R_SUCCESS) {
-		DESTROYLOCK(&client->query.fetchlock);
-		return (result);
-	}
-	result = query_newnamebuf(client);
-	if (result != ISC_R_SUCCESS) {
-		query_freefreeversions(client, ISC_TRUE);
+	if (result != ISC_R_SUCCESS)
 		DESTROYLOCK(&client->query.fetchlock);
-	}
 
 	return (result);
 }
@@ -4637,7 +4631,7 @@ dns64_aaaaok(ns_client_t *client, dns_rdataset_t *rdataset,
 		flags |= DNS_DNS64_DNSSEC;
 
 	count = dns_rdataset_count(rdataset);
-	aaaaok = isc_mem_get(client->mctx, sizeof(isc_boolean_t) * count);
+	aaaaok = isc_arena_get(client->arena, sizeof(isc_boolean_t) * count);
 
 	isc_netaddr_fromsockaddr(&netaddr, &client->peeraddr);
 	if (dns_dns64_aaaaok(dns64, &netaddr, client->signer,
@@ -4645,19 +4639,13 @@ dns64_aaaaok(ns_client_t *client, dns_rdataset_t *rdataset,
 	{
 		for (i = 0; i < count; i++) {
 			if (aaaaok != NULL && !aaaaok[i]) {
-				SAVE(client->query.dns64_aaaaok, aaaaok);
+				client->query.dns64_aaaaok = aaaaok;
 				client->query.dns64_aaaaoklen = count;
 				break;
 			}
 		}
-		if (aaaaok != NULL)
-			isc_mem_put(client->mctx, aaaaok,
-				    sizeof(isc_boolean_t) * count);
 		return (ISC_TRUE);
 	}
-	if (aaaaok != NULL)
-		isc_mem_put(client->mctx, aaaaok,
-			    sizeof(isc_boolean_t) * count);
 	return (ISC_FALSE);
 }
 
@@ -5303,6 +5291,14 @@ ns__query_start(query_ctx_t *qctx) {
 		} else {
 			inc_stats(qctx->client, ns_statscounter_udp);
 		}
+
+		/*
+		 * Answer from the response cache if we can.
+		 */
+		result = query_respcache_find(qctx);
+		if (result != ISC_R_NOTFOUND) {
+			return (result);
+		}
 	}
 
 	return (query_lookup(qctx));
@@ -5940,6 +5936,214 @@ ns__query_sfcache(query_ctx_t *qctx) {
 	return (ISC_R_COMPLETE);
 }
 
+/*
+ * Response cache key flags; the low 16 bits hold the client's UDP
+ * buffer size.
+ */
+#define RESPCACHE_RD		0x00010000U
+#define RESPCACHE_CD		0x00020000U
+#define RESPCACHE_AD		0x00040000U
+#define RESPCACHE_DO		0x00080000U
+#define RESPCACHE_RA		0x00100000U
+#define RESPCACHE_EDNS		0x00200000U
+#define RESPCACHE_INET6		0x00400000U
+
+/*%
+ * Determine whether the response to the query from 'client' may be
+ * served from, and stored in, the view's response cache.  If so, set
+ * '*flagsp' to the cache key flags describing everything about the
+ * query, other than the question, that the response depends on.
+ *
+ * Only UDP queries answered without recursion, with no EDNS options
+ * and no transaction signature are eligible, and only in views with no
+ * configuration that tailors responses to the individual client.
+ */
+static isc_boolean_t
+query_respcache_ok(ns_client_t *client, isc_uint32_t *flagsp) {
+	dns_view_t *view = client->view;
+	isc_uint32_t flags;
+
+	if (view->respcache == NULL || TCP(client) ||
+	    client->sendcb != NULL || client->sctx->delay != 0)
+	{
+		return (ISC_FALSE);
+	}
+
+	if (view->recursion || view->rpzs != NULL || view->rrl != NULL ||
+	    !ISC_LIST_EMPTY(view->dns64) || view->sortlist != NULL ||
+	    view->nocasecompress != NULL || view->redirect != NULL ||
+	    view->redirectzone != NULL || view->v4_aaaa != dns_aaaa_ok ||
+	    view->v6_aaaa != dns_aaaa_ok)
+	{
+		return (ISC_FALSE);
+	}
+#ifdef HAVE_DNSTAP
+	if (view->dtenv != NULL) {
+		return (ISC_FALSE);
+	}
+#endif /* HAVE_DNSTAP */
+
+	if (client->message->rdclass != view->rdclass ||
+	    client->message->tsigkey != NULL ||
+	    client->message->sig0key != NULL || client->signer != NULL ||
+	    client->keytag != NULL ||
+	    (client->attributes & (NS_CLIENTATTR_WANTNSID |
+				   NS_CLIENTATTR_WANTCOOKIE |
+				   NS_CLIENTATTR_HAVECOOKIE |
+				   NS_CLIENTATTR_WANTEXPIRE |
+				   NS_CLIENTATTR_HAVEECS |
+				   NS_CLIENTATTR_WANTPAD)) != 0)
+	{
+		return (ISC_FALSE);
+	}
+
+	flags = client->udpsize;
+	if ((client->message->flags & DNS_MESSAGEFLAG_RD) != 0)
+		flags |= RESPCACHE_RD;
+	if ((client->message->flags & DNS_MESSAGEFLAG_CD) != 0)
+		flags |= RESPCACHE_CD;
+	if (WANTAD(client))
+		flags |= RESPCACHE_AD;
+	if (WANTDNSSEC(client))
+		flags |= RESPCACHE_DO;
+	if ((client->attributes & NS_CLIENTATTR_RA) != 0)
+		flags |= RESPCACHE_RA;
+	if ((client->attributes & NS_CLIENTATTR_WANTOPT) != 0)
+		flags |= RESPCACHE_EDNS;
+	if (isc_sockaddr_pf(&client->peeraddr) == AF_INET6)
+		flags |= RESPCACHE_INET6;
+
+	*flagsp = flags;
+	return (ISC_TRUE);
+}
+
+/*%
+ * Look for a rendered response to the current query in the view's
+ * response cache, and send it if there is one.
+ *
+ * Called once the authoritative database for the query has been found
+ * (and access to it checked), before any lookups are done in it.  On a
+ * miss, note the database version, so that query_done() can decide
+ * whether to store the response once it has been built.
+ *
+ * Returns ISC_R_NOTFOUND if the query has to be answered normally.
+ */
+static isc_result_t
+query_respcache_find(query_ctx_t *qctx) {
+	ns_client_t *client = qctx->client;
+	isc_uint64_t generation;
+	isc_uint32_t flags;
+	unsigned int attributes = 0;
+	isc_result_t result;
+
+	if (!qctx->is_zone || qctx->zone == NULL ||
+	    qctx->is_staticstub_zone ||
+	    !query_respcache_ok(client, &flags))
+	{
+		return (ISC_R_NOTFOUND);
+	}
+
+	result = dns_db_getgeneration(qctx->db, qctx->version, &generation);
+	if (result != ISC_R_SUCCESS) {
+		return (ISC_R_NOTFOUND);
+	}
+
+	client->query.respcachegen = generation;
+	client->query.respcacheflags = flags;
+	client->query.attributes |= NS_QUERYATTR_RESPCACHE;
+
+	result = ns_client_sendcached(client, &attributes);
+	if (result != ISC_R_SUCCESS) {
+		return (ISC_R_NOTFOUND);
+	}
+
+	CCTRACE(ISC_LOG_DEBUG(3), "query_respcache_find: hit");
+
+	/*
+	 * Update the statistics as query_send() would have.
+	 */
+	inc_stats(client, ns_statscounter_respcachehit);
+	if ((attributes & NS_CLIENT_RESPCACHE_AA) != 0) {
+		inc_stats(client, ns_statscounter_authans);
+	} else {
+		inc_stats(client, ns_statscounter_nonauthans);
+	}
+	if ((attributes & NS_CLIENT_RESPCACHE_NXDOMAIN) != 0) {
+		inc_stats(client, ns_statscounter_nxdomain);
+	} else if ((attributes & NS_CLIENT_RESPCACHE_ANSWER) != 0) {
+		inc_stats(client, ns_statscounter_success);
+	} else if ((attributes & NS_CLIENT_RESPCACHE_REFERRAL) != 0) {
+		inc_stats(client, ns_statscounter_referral);
+	} else {
+		inc_stats(client, ns_statscounter_nxrrset);
+	}
+
+	qctx_clean(qctx);
+	qctx_freedata(qctx);
+	ns_client_detach(&qctx->client);
+	return (ISC_R_SUCCESS);
+}
+
+/*%
+ * Decide, once the response to a query that missed the response cache
+ * is complete, whether it may be stored in the cache when it is
+ * rendered.  It may not if anything other than the zone database
+ * version noted by query_respcache_find() contributed to it, or if it
+ * contains RRsets that are shuffled on each use.
+ */
+static void
+query_respcache_check(query_ctx_t *qctx) {
+	ns_client_t *client = qctx->client;
+	dns_message_t *message = client->message;
+	dns_section_t section;
+	dns_name_t *name;
+	dns_rdataset_t *rdataset;
+	isc_result_t result;
+
+	if ((client->query.attributes & NS_QUERYATTR_RESPCACHE) == 0) {
+		return;
+	}
+
+	if (client->query.restarts != 0 || qctx->resuming ||
+	    qctx->redirected || qctx->rpz || qctx->dns64 ||
+	    qctx->result != ISC_R_SUCCESS ||
+	    (client->query.attributes & NS_QUERYATTR_REDIRECT) != 0 ||
+	    (message->rcode != dns_rcode_noerror &&
+	     message->rcode != dns_rcode_nxdomain))
+	{
+		goto nocache;
+	}
+
+	for (section = DNS_SECTION_ANSWER;
+	     section <= DNS_SECTION_ADDITIONAL;
+	     section++)
+	{
+		for (result = dns_message_firstname(message, section);
+		     result == ISC_R_SUCCESS;
+		     result = dns_message_nextname(message, section))
+		{
+			name = NULL;
+			dns_message_currentname(message, section, &name);
+			for (rdataset = ISC_LIST_HEAD(name->list);
+			     rdataset != NULL;
+			     rdataset = ISC_LIST_NEXT(rdataset, link))
+			{
+				if ((rdataset->attributes &
+				     (DNS_RDATASETATTR_RANDOMIZE |
+				      DNS_RDATASETATTR_CYCLIC)) != 0 &&
+				    dns_rdataset_count(rdataset) > 1)
+				{
+					goto nocache;
+				}
+			}
+		}
+	}
+	return;
+
+ nocache:
+	client->query.attributes &= ~NS_QUERYATTR_RESPCACHE;
+}
+
 /*%
  * Handle response rate limiting (RRL).
  */
@@ -10498,6 +10702,7 @@ query_done(query_ctx_t *qctx) {
 	 */
 	query_setup_sortlist(qctx);
 	query_glueanswer(qctx);
+	query_respcache_check(qctx);
 
 	if (qctx->client->message->rcode == dns_rcode_nxdomain &&
 	    qctx->client->view->auth_nxdomain == ISC_TRUE)
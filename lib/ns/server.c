@@ -19,6 +19,7 @@
 
 #include <ns/server.h>
 #include <ns/stats.h>
+#include <ns/xfrout.h>
 
 #define SCTX_MAGIC		ISC_MAGIC('S','c','t','x')
 #define SCTX_VALID(s)		ISC_MAGIC_VALID(s, SCTX_MAGIC)
@@ -55,38 +56,48 @@ ns_server_create(isc_mem_t *mctx, isc_entropy_t *entropy,
 
 	CHECKFATAL(dns_tkeyctx_create(mctx, entropy, &sctx->tkeyctx));
 	CHECKFATAL(isc_rng_create(mctx, entropy, &sctx->rngctx));
+	CHECKFATAL(ns_xfrcache_create(mctx, &sctx->xfrcache));
 
 	CHECKFATAL(ns_stats_create(mctx, ns_statscounter_max, &sctx->nsstats));
 
-	CHECKFATAL(dns_rdatatypestats_create(mctx, &sctx->rcvquerystats));
+	CHECKFATAL(dns_rdatatypestats_create2(mctx, &sctx->rcvquerystats,
+					      ISC_STATSCREATE_SHARDED));
 
 	CHECKFATAL(dns_opcodestats_create(mctx, &sctx->opcodestats));
 
 	CHECKFATAL(dns_rcodestats_create(mctx, &sctx->rcodestats));
 
-	CHECKFATAL(isc_stats_create(mctx, &sctx->udpinstats4,
-				    dns_sizecounter_in_max));
+	CHECKFATAL(isc_stats_create2(mctx, &sctx->udpinstats4,
+				     dns_sizecounter_in_max,
+				     ISC_STATSCREATE_SHARDED));
 
-	CHECKFATAL(isc_stats_create(mctx, &sctx->udpoutstats4,
-				    dns_sizecounter_out_max));
+	CHECKFATAL(isc_stats_create2(mctx, &sctx->udpoutstats4,
+				     dns_sizecounter_out_max,
+				     ISC_STATSCREATE_SHARDED));
 
-	CHECKFATAL(isc_stats_create(mctx, &sctx->udpinstats6,
-				    dns_sizecounter_in_max));
+	CHECKFATAL(isc_stats_create2(mctx, &sctx->udpinstats6,
+				     dns_sizecounter_in_max,
+				     ISC_STATSCREATE_SHARDED));
 
-	CHECKFATAL(isc_stats_create(mctx, &sctx->udpoutstats6,
-				    dns_sizecounter_out_max));
+	CHECKFATAL(isc_stats_create2(mctx, &sctx->udpoutstats6,
+				     dns_sizecounter_out_max,
+				     ISC_STATSCREATE_SHARDED));
 
-	CHECKFATAL(isc_stats_create(mctx, &sctx->tcpinstats4,
-				    dns_sizecounter_in_max));
+	CHECKFATAL(isc_stats_create2(mctx, &sctx->tcpinstats4,
+				     dns_sizecounter_in_max,
+				     ISC_STATSCREATE_SHARDED));
 
-	CHECKFATAL(isc_stats_create(mctx, &sctx->tcpoutstats4,
-				    dns_sizecounter_out_max));
+	CHECKFATAL(isc_stats_create2(mctx, &sctx->tcpoutstats4,
+				     dns_sizecounter_out_max,
+				     ISC_STATSCREATE_SHARDED));
 
-	CHECKFATAL(isc_stats_create(mctx, &sctx->tcpinstats6,
-				    dns_sizecounter_in_max));
+	CHECKFATAL(isc_stats_create2(mctx, &sctx->tcpinstats6,
+				     dns_sizecounter_in_max,
+				     ISC_STATSCREATE_SHARDED));
 
-	CHECKFATAL(isc_stats_create(mctx, &sctx->tcpoutstats6,
-				    dns_sizecounter_out_max));
+	CHECKFATAL(isc_stats_create2(mctx, &sctx->tcpoutstats6,
+				     dns_sizecounter_out_max,
+				     ISC_STATSCREATE_SHARDED));
 
 	sctx->initialtimo = 300;
 	sctx->idletimo = 300;
@@ -95,6 +106,7 @@ ns_server_create(isc_mem_t *mctx, isc_entropy_t *entropy,
 
 	sctx->udpsize = 4096;
 	sctx->transfer_tcp_message_size = 20480;
+	sctx->tcppipelinelimit = 32;
 
 	sctx->fuzztype = isc_fuzz_none;
 	sctx->fuzznotify = NULL;
@@ -160,6 +172,8 @@ ns_server_detach(ns_server_t **sctxp) {
 			isc_rng_detach(&sctx->rngctx);
 		if (sctx->tkeyctx != NULL)
 			dns_tkeyctx_destroy(&sctx->tkeyctx);
+		if (sctx->xfrcache != NULL)
+			ns_xfrcache_destroy(&sctx->xfrcache);
 
 		if (sctx->nsstats != NULL)
 			ns_stats_detach(&sctx->nsstats);
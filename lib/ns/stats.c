@@ -81,7 +81,8 @@ ns_stats_create(isc_mem_t *mctx, int ncounters, ns_stats_t **statsp) {
 	if (result != ISC_R_SUCCESS)
 		goto clean_stats;
 
-	result = isc_stats_create(mctx, &stats->counters, ncounters);
+	result = isc_stats_create2(mctx, &stats->counters, ncounters,
+				   ISC_STATSCREATE_SHARDED);
 	if (result != ISC_R_SUCCESS)
 		goto clean_mutex;
 
@@ -8,11 +8,14 @@
 
 #include <config.h>
 
+#include <isc/buffer.h>
 #include <isc/formatcheck.h>
 #include <isc/mem.h>
+#include <isc/mutex.h>
 #include <isc/timer.h>
 #include <isc/print.h>
 #include <isc/stats.h>
+#include <isc/stdtime.h>
 #include <isc/util.h>
 
 #include <dns/db.h>
@@ -66,6 +69,13 @@
 
 #define XFROUT_RR_LOGLEVEL	ISC_LOG_DEBUG(8)
 
+/*%
+ * Size of the transmit buffer.  When the transfer is not signed with
+ * TSIG, as many TCP messages as will fit are rendered into it back to
+ * back and sent with a single write; see sendstream_wire().
+ */
+#define XFROUT_TXBUFSIZE	(4 * (2 + 65535))
+
 /*%
  * Fail unconditionally and log as a client error.
  * The test against ISC_R_SUCCESS is there to keep the Solaris compiler
@@ -638,6 +648,213 @@ static rrstream_methods_t compound_rrstream_methods = {
 	compound_rrstream_destroy
 };
 
+/**************************************************************************/
+/*
+ * IXFR response cache.
+ *
+ * When a zone changes, its slaves tend to ask for the same IXFR within
+ * a few seconds of each other.  The TCP messages that follow the first
+ * one of an IXFR that is not signed with TSIG depend only on the zone
+ * and the database it was loaded into, the serial range, where the
+ * first message left off and the message format, so they are kept for
+ * a short while after being rendered and later transfers of the same
+ * change copy them instead, replacing the message ID and flags.  The
+ * first message is always rendered, since it carries the client's
+ * question and EDNS options.
+ *
+ * Entries hold references to their zone and database, so neither can
+ * be replaced by another at the same address while they are cached.
+ * When a transfer finds the zone has a new database, the entries
+ * recorded from the old one are dropped.
+ *
+ * Only one transfer records a given stream at a time; others that
+ * start while it does render their own.
+ */
+
+#define XFRCACHE_LIFETIME	60			/* seconds */
+#define XFRCACHE_MAXSIZE	(32 * 1024 * 1024)	/* total bytes */
+#define XFRCACHE_MAXENTRIES	16
+
+typedef struct xfrcache_entry xfrcache_entry_t;
+
+struct xfrcache_entry {
+	ns_xfrcache_t		*cache;
+	unsigned int		references;	/* Locked by cache->lock */
+	isc_boolean_t		linked;		/* On cache->entries */
+	isc_boolean_t		complete;	/* All messages recorded */
+	isc_stdtime_t		expire;
+	/* Key */
+	dns_zone_t		*zone;
+	dns_db_t		*db;
+	isc_uint32_t		begin_serial;
+	isc_uint32_t		end_serial;
+	unsigned int		first_rrs;	/* RRs in the first message */
+	isc_boolean_t		many_answers;
+	unsigned int		msgsize;	/* transfer-message-size */
+	/* Length-prefixed TCP messages */
+	isc_buffer_t		*data;
+	ISC_LINK(xfrcache_entry_t) link;
+};
+
+struct ns_xfrcache {
+	isc_mem_t		*mctx;
+	isc_mutex_t		lock;
+	isc_boolean_t		shuttingdown;
+	unsigned int		count;
+	unsigned int		size;
+	ISC_LIST(xfrcache_entry_t) entries;
+};
+
+isc_result_t
+ns_xfrcache_create(isc_mem_t *mctx, ns_xfrcache_t **cachep) {
+	ns_xfrcache_t *cache;
+	isc_result_t result;
+
+	REQUIRE(cachep != NULL && *cachep == NULL);
+
+	cache = isc_mem_get(mctx, sizeof(*cache));
+	if (cache == NULL)
+		return (ISC_R_NOMEMORY);
+	result = isc_mutex_init(&cache->lock);
+	if (result != ISC_R_SUCCESS) {
+		isc_mem_put(mctx, cache, sizeof(*cache));
+		return (result);
+	}
+	cache->mctx = NULL;
+	isc_mem_attach(mctx, &cache->mctx);
+	cache->shuttingdown = ISC_FALSE;
+	cache->count = 0;
+	cache->size = 0;
+	ISC_LIST_INIT(cache->entries);
+
+	*cachep = cache;
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Drop a reference to 'entry', freeing it if it was the last.
+ * The cache must be locked.
+ */
+static void
+xfrcache_release(ns_xfrcache_t *cache, xfrcache_entry_t *entry) {
+	INSIST(entry->references > 0);
+	if (--entry->references > 0)
+		return;
+	INSIST(!entry->linked);
+	if (entry->data != NULL)
+		isc_buffer_free(&entry->data);
+	if (entry->db != NULL)
+		dns_db_detach(&entry->db);
+	if (entry->zone != NULL)
+		dns_zone_detach(&entry->zone);
+	isc_mem_put(cache->mctx, entry, sizeof(*entry));
+}
+
+/*
+ * Take 'entry' out of the cache.  The cache must be locked.
+ */
+static void
+xfrcache_unlink(ns_xfrcache_t *cache, xfrcache_entry_t *entry) {
+	INSIST(entry->linked);
+	ISC_LIST_UNLINK(cache->entries, entry, link);
+	entry->linked = ISC_FALSE;
+	cache->count--;
+	cache->size -= isc_buffer_usedlength(entry->data);
+	xfrcache_release(cache, entry);
+}
+
+static void
+xfrcache_detach(xfrcache_entry_t **entryp) {
+	xfrcache_entry_t *entry = *entryp;
+	ns_xfrcache_t *cache = entry->cache;
+
+	*entryp = NULL;
+	LOCK(&cache->lock);
+	xfrcache_release(cache, entry);
+	UNLOCK(&cache->lock);
+}
+
+/*
+ * Remove complete entries that have expired, if 'now' is not 0, and
+ * then the oldest complete entries until there is room for 'count'
+ * more entries and 'size' more bytes.  The cache must be locked.
+ */
+static void
+xfrcache_evict(ns_xfrcache_t *cache, isc_stdtime_t now,
+	       unsigned int count, unsigned int size)
+{
+	xfrcache_entry_t *entry, *next;
+
+	for (entry = ISC_LIST_HEAD(cache->entries);
+	     entry != NULL;
+	     entry = next)
+	{
+		next = ISC_LIST_NEXT(entry, link);
+		if (!entry->complete)
+			continue;
+		if ((now != 0 && entry->expire <= now) ||
+		    cache->count + count > XFRCACHE_MAXENTRIES ||
+		    cache->size + size > XFRCACHE_MAXSIZE)
+			xfrcache_unlink(cache, entry);
+	}
+}
+
+/*
+ * Remove the entries for 'zone', or all entries if 'zone' is NULL.
+ * The cache must be locked.
+ */
+static void
+xfrcache_flush(ns_xfrcache_t *cache, dns_zone_t *zone) {
+	xfrcache_entry_t *entry, *next;
+
+	for (entry = ISC_LIST_HEAD(cache->entries);
+	     entry != NULL;
+	     entry = next)
+	{
+		next = ISC_LIST_NEXT(entry, link);
+		if (zone == NULL || entry->zone == zone)
+			xfrcache_unlink(cache, entry);
+	}
+}
+
+void
+ns_xfrcache_flush(ns_xfrcache_t *cache, dns_zone_t *zone) {
+	REQUIRE(cache != NULL);
+	REQUIRE(zone != NULL);
+
+	LOCK(&cache->lock);
+	xfrcache_flush(cache, zone);
+	UNLOCK(&cache->lock);
+}
+
+void
+ns_xfrcache_shutdown(ns_xfrcache_t *cache) {
+	REQUIRE(cache != NULL);
+
+	LOCK(&cache->lock);
+	cache->shuttingdown = ISC_TRUE;
+	xfrcache_flush(cache, NULL);
+	UNLOCK(&cache->lock);
+}
+
+void
+ns_xfrcache_destroy(ns_xfrcache_t **cachep) {
+	ns_xfrcache_t *cache;
+	xfrcache_entry_t *entry;
+
+	REQUIRE(cachep != NULL && *cachep != NULL);
+
+	cache = *cachep;
+	*cachep = NULL;
+
+	while ((entry = ISC_LIST_HEAD(cache->entries)) != NULL) {
+		INSIST(entry->references == 1);
+		xfrcache_unlink(cache, entry);
+	}
+	DESTROYLOCK(&cache->lock);
+	isc_mem_putanddetach(&cache->mctx, cache, sizeof(*cache));
+}
+
 /**************************************************************************/
 /*
  * An 'xfrout_ctx_t' contains the state of an outgoing AXFR or IXFR
@@ -671,6 +888,13 @@ typedef struct {
 	int			sends;		/* Send in progress */
 	isc_boolean_t		shuttingdown;
 	const char		*mnemonic;	/* Style of transfer */
+	isc_boolean_t		cacheable;	/* IXFR without TSIG */
+	isc_uint32_t		begin_serial;	/* IXFR serial range */
+	isc_uint32_t		end_serial;
+	unsigned int		nrrs;		/* Number of RRs sent */
+	xfrcache_entry_t	*recording;	/* Cache entry being filled */
+	xfrcache_entry_t	*replaying;	/* Cache entry being sent */
+	unsigned int		replayoff;	/* Offset in 'replaying' */
 } xfrout_ctx_t;
 
 static isc_result_t
@@ -689,6 +913,18 @@ xfrout_ctx_create(isc_mem_t *mctx, ns_client_t *client,
 static void
 sendstream(xfrout_ctx_t *xfr);
 
+static void
+sendstream_wire(xfrout_ctx_t *xfr);
+
+static void
+sendstream_replay(xfrout_ctx_t *xfr);
+
+static void
+xfrcache_start(xfrout_ctx_t *xfr);
+
+static void
+xfrcache_record(xfrout_ctx_t *xfr, isc_region_t *r);
+
 static void
 xfrout_senddone(isc_task_t *task, isc_event_t *event);
 
@@ -1055,6 +1291,12 @@ ns_xfr_start(ns_client_t *client, dns_rdatatype_t reqtype) {
 	stream = NULL;
 	quota = NULL;
 
+	if (is_ixfr && xfr->tsigkey == NULL && xfr->zone != NULL) {
+		xfr->cacheable = ISC_TRUE;
+		xfr->begin_serial = begin_serial;
+		xfr->end_serial = current_serial;
+	}
+
 	CHECK(xfr->stream->methods->first(xfr->stream));
 
 	if (xfr->tsigkey != NULL)
@@ -1184,6 +1426,13 @@ xfrout_ctx_create(isc_mem_t *mctx, ns_client_t *client, unsigned int id,
 	xfr->txmemlen = 0;
 	xfr->stream = NULL;
 	xfr->quota = NULL;
+	xfr->cacheable = ISC_FALSE;
+	xfr->begin_serial = 0;
+	xfr->end_serial = 0;
+	xfr->nrrs = 0;
+	xfr->recording = NULL;
+	xfr->replaying = NULL;
+	xfr->replayoff = 0;
 
 	/*
 	 * Allocate a temporary buffer for the uncompressed response
@@ -1205,16 +1454,17 @@ xfrout_ctx_create(isc_mem_t *mctx, ns_client_t *client, unsigned int id,
 
 	/*
 	 * Allocate another temporary buffer for the compressed
-	 * response message and its TCP length prefix.
+	 * response message and its TCP length prefix.  It is
+	 * large enough to hold several messages for sendstream_wire().
 	 */
-	len = 2 + 65535;
+	len = XFROUT_TXBUFSIZE;
 	mem = isc_mem_get(mctx, len);
 	if (mem == NULL) {
 		result = ISC_R_NOMEMORY;
 		goto failure;
 	}
 	isc_buffer_init(&xfr->txlenbuf, mem, 2);
-	isc_buffer_init(&xfr->txbuf, (char *) mem + 2, len - 2);
+	isc_buffer_init(&xfr->txbuf, (char *) mem + 2, 65535);
 	xfr->txmem = mem;
 	xfr->txmemlen = len;
 
@@ -1270,11 +1520,27 @@ sendstream(xfrout_ctx_t *xfr) {
 
 	int n_rrs;
 
+	is_tcp = ISC_TF((xfr->client->attributes & NS_CLIENTATTR_TCP) != 0);
+
+	/*
+	 * Only the first message needs a question section and EDNS
+	 * options.  After that, unless each message must be signed,
+	 * the records can be rendered straight from the database.
+	 */
+	if (is_tcp && xfr->tsigkey == NULL && xfr->nmsg != 0) {
+		if (xfr->cacheable && xfr->nmsg == 1)
+			xfrcache_start(xfr);
+		if (xfr->replaying != NULL)
+			sendstream_replay(xfr);
+		else
+			sendstream_wire(xfr);
+		return;
+	}
+
 	isc_buffer_clear(&xfr->buf);
 	isc_buffer_clear(&xfr->txlenbuf);
 	isc_buffer_clear(&xfr->txbuf);
 
-	is_tcp = ISC_TF((xfr->client->attributes & NS_CLIENTATTR_TCP) != 0);
 	if (!is_tcp) {
 		/*
 		 * In the UDP case, we put the response data directly into
@@ -1468,6 +1734,7 @@ sendstream(xfrout_ctx_t *xfr) {
 
 		dns_message_addname(msg, msgname, DNS_SECTION_ANSWER);
 		msgname = NULL;
+		xfr->nrrs++;
 
 		result = xfr->stream->methods->next(xfr->stream);
 		if (result == ISC_R_NOMORE) {
@@ -1558,6 +1825,367 @@ sendstream(xfrout_ctx_t *xfr) {
 	xfrout_fail(xfr, result, "sending zone data");
 }
 
+/*
+ * Render one RR at the end of 'target', compressing its names with
+ * 'cctx'.  If it does not fit, leave 'target' and 'cctx' as they were.
+ */
+static isc_result_t
+render_rr(dns_compress_t *cctx, isc_buffer_t *target, dns_name_t *name,
+	  isc_uint32_t ttl, dns_rdata_t *rdata)
+{
+	isc_buffer_t rrbuffer, rdlen;
+	isc_region_t r;
+	isc_result_t result;
+
+	rrbuffer = *target;
+	dns_compress_setmethods(cctx, DNS_COMPRESS_GLOBAL14);
+	CHECK(dns_name_towire(name, cctx, target));
+	isc_buffer_availableregion(target, &r);
+	if (r.length < 10) {
+		result = ISC_R_NOSPACE;
+		goto failure;
+	}
+	isc_buffer_putuint16(target, rdata->type);
+	isc_buffer_putuint16(target, rdata->rdclass);
+	isc_buffer_putuint32(target, ttl);
+	rdlen = *target;
+	isc_buffer_add(target, 2);
+	CHECK(dns_rdata_towire(rdata, cctx, target));
+	isc_buffer_putuint16(&rdlen,
+			     (isc_uint16_t)(target->used - rdlen.used - 2));
+	return (ISC_R_SUCCESS);
+
+ failure:
+	dns_compress_rollback(cctx, (isc_uint16_t)rrbuffer.used);
+	*target = rrbuffer;
+	return (result);
+}
+
+/*
+ * Like sendstream(), for TCP messages after the first one of a transfer
+ * that is not signed with TSIG.  Such messages have only a header and
+ * answers, so instead of building a dns_message_t, copying each RR into
+ * it and rendering it, each RR is rendered directly from the stream.
+ * As many messages as will fit in the transmit buffer are rendered
+ * before it is sent.
+ */
+static void
+sendstream_wire(xfrout_ctx_t *xfr) {
+	isc_buffer_t txbuf, msgbuf, countbuf;
+	isc_region_t r;
+	dns_compress_t cctx;
+	isc_boolean_t cleanup_cctx = ISC_FALSE;
+	isc_result_t result;
+	isc_uint16_t flags;
+	unsigned int n_rrs, n_msgs = 0;
+
+	flags = DNS_MESSAGEFLAG_QR | DNS_MESSAGEFLAG_AA;
+	if ((xfr->client->attributes & NS_CLIENTATTR_RA) != 0)
+		flags |= DNS_MESSAGEFLAG_RA;
+
+	isc_buffer_init(&txbuf, xfr->txmem, xfr->txmemlen);
+	while (!xfr->end_of_stream) {
+		isc_buffer_availableregion(&txbuf, &r);
+		if (r.length < 2 + 65535)
+			break;
+
+		/*
+		 * Compression offsets are relative to the start of the
+		 * message, so each message gets a buffer of its own.
+		 */
+		isc_buffer_init(&msgbuf, r.base + 2, 65535);
+		isc_buffer_putuint16(&msgbuf, (isc_uint16_t)xfr->id);
+		isc_buffer_putuint16(&msgbuf, flags);
+		isc_buffer_putuint16(&msgbuf, 0);	/* QDCOUNT */
+		isc_buffer_init(&countbuf, r.base + 2 + 6, 2);
+		isc_buffer_putuint16(&msgbuf, 0);	/* ANCOUNT */
+		isc_buffer_putuint16(&msgbuf, 0);	/* NSCOUNT */
+		isc_buffer_putuint16(&msgbuf, 0);	/* ARCOUNT */
+
+		CHECK(dns_compress_init(&cctx, -1, xfr->mctx));
+		dns_compress_setsensitive(&cctx, ISC_TRUE);
+		cleanup_cctx = ISC_TRUE;
+
+		/*
+		 * Try to fit in as many RRs as possible, unless
+		 * "one-answer" format has been requested.
+		 */
+		for (n_rrs = 0; ; ) {
+			dns_name_t *name = NULL;
+			isc_uint32_t ttl;
+			dns_rdata_t *rdata = NULL;
+
+			xfr->stream->methods->current(xfr->stream,
+						      &name, &ttl, &rdata);
+			result = render_rr(&cctx, &msgbuf, name, ttl, rdata);
+			if (result == ISC_R_NOSPACE && n_rrs != 0)
+				break;
+			if (result == ISC_R_NOSPACE) {
+				xfrout_log(xfr, ISC_LOG_WARNING,
+					   "RR too large for zone transfer "
+					   "(%d bytes)",
+					   name->length + 10 + rdata->length);
+				goto failure;
+			}
+			CHECK(result);
+			n_rrs++;
+			xfr->nrrs++;
+
+			if (isc_log_wouldlog(ns_lctx, XFROUT_RR_LOGLEVEL))
+				log_rr(name, rdata, ttl);
+
+			result = xfr->stream->methods->next(xfr->stream);
+			if (result == ISC_R_NOMORE) {
+				xfr->end_of_stream = ISC_TRUE;
+				break;
+			}
+			CHECK(result);
+
+			if (! xfr->many_answers)
+				break;
+			if (isc_buffer_usedlength(&msgbuf) >=
+			    xfr->client->sctx->transfer_tcp_message_size)
+				break;
+		}
+
+		dns_compress_invalidate(&cctx);
+		cleanup_cctx = ISC_FALSE;
+
+		isc_buffer_putuint16(&countbuf, (isc_uint16_t)n_rrs);
+		isc_buffer_usedregion(&msgbuf, &r);
+		isc_buffer_putuint16(&txbuf, (isc_uint16_t)r.length);
+		isc_buffer_add(&txbuf, r.length);
+		xfr->nmsg++;
+		n_msgs++;
+	}
+
+	isc_buffer_usedregion(&txbuf, &r);
+	if (xfr->recording != NULL)
+		xfrcache_record(xfr, &r);
+	xfrout_log(xfr, ISC_LOG_DEBUG(8),
+		   "sending %u TCP messages in %u bytes", n_msgs, r.length);
+	CHECK(isc_socket_send(xfr->client->tcpsocket, &r,
+			      xfr->client->task, xfrout_senddone, xfr));
+	xfr->sends++;
+
+ failure:
+	if (cleanup_cctx)
+		dns_compress_invalidate(&cctx);
+
+	/*
+	 * Make sure to release any locks held by database
+	 * iterators before returning from the event handler.
+	 */
+	xfr->stream->methods->pause(xfr->stream);
+
+	if (result == ISC_R_SUCCESS)
+		return;
+
+	xfrout_fail(xfr, result, "sending zone data");
+}
+
+/*
+ * Called before the second message of an IXFR that may be cached.  If
+ * the rest of the transfer is in the cache, arrange for it to be sent
+ * by sendstream_replay().  Otherwise, unless another transfer is
+ * already recording it, record it as it is rendered.
+ */
+static void
+xfrcache_start(xfrout_ctx_t *xfr) {
+	ns_xfrcache_t *cache = xfr->client->sctx->xfrcache;
+	unsigned int msgsize = xfr->client->sctx->transfer_tcp_message_size;
+	xfrcache_entry_t *entry, *next;
+	isc_stdtime_t now;
+	isc_result_t result;
+
+	INSIST(xfr->recording == NULL && xfr->replaying == NULL);
+
+	isc_stdtime_get(&now);
+	LOCK(&cache->lock);
+	if (cache->shuttingdown)
+		goto unlock;
+	xfrcache_evict(cache, now, 0, 0);
+	for (entry = ISC_LIST_HEAD(cache->entries);
+	     entry != NULL;
+	     entry = next)
+	{
+		next = ISC_LIST_NEXT(entry, link);
+		if (entry->zone != xfr->zone)
+			continue;
+		/*
+		 * The zone has been reloaded since 'entry' was recorded.
+		 */
+		if (entry->db != xfr->db) {
+			if (entry->complete)
+				xfrcache_unlink(cache, entry);
+			continue;
+		}
+		if (entry->begin_serial == xfr->begin_serial &&
+		    entry->end_serial == xfr->end_serial &&
+		    entry->first_rrs == xfr->nrrs &&
+		    entry->many_answers == xfr->many_answers &&
+		    entry->msgsize == msgsize)
+			break;
+	}
+	if (entry != NULL) {
+		if (entry->complete) {
+			entry->references++;
+			xfr->replaying = entry;
+			xfr->replayoff = 0;
+		}
+		goto unlock;
+	}
+
+	xfrcache_evict(cache, 0, 1, 0);
+	if (cache->count >= XFRCACHE_MAXENTRIES)
+		goto unlock;
+	entry = isc_mem_get(cache->mctx, sizeof(*entry));
+	if (entry == NULL)
+		goto unlock;
+	entry->data = NULL;
+	result = isc_buffer_allocate(cache->mctx, &entry->data,
+				     XFROUT_TXBUFSIZE);
+	if (result != ISC_R_SUCCESS) {
+		isc_mem_put(cache->mctx, entry, sizeof(*entry));
+		goto unlock;
+	}
+	entry->cache = cache;
+	entry->references = 2;		/* the cache and 'xfr' */
+	entry->linked = ISC_TRUE;
+	entry->complete = ISC_FALSE;
+	entry->expire = 0;
+	entry->zone = NULL;
+	dns_zone_attach(xfr->zone, &entry->zone);
+	entry->db = NULL;
+	dns_db_attach(xfr->db, &entry->db);
+	entry->begin_serial = xfr->begin_serial;
+	entry->end_serial = xfr->end_serial;
+	entry->first_rrs = xfr->nrrs;
+	entry->many_answers = xfr->many_answers;
+	entry->msgsize = msgsize;
+	ISC_LINK_INIT(entry, link);
+	ISC_LIST_APPEND(cache->entries, entry, link);
+	cache->count++;
+	xfr->recording = entry;
+
+ unlock:
+	UNLOCK(&cache->lock);
+
+	if (xfr->replaying != NULL)
+		xfrout_log(xfr, ISC_LOG_DEBUG(3),
+			   "sending cached messages after the first");
+}
+
+/*
+ * Append the messages in 'r' to the transfer being recorded, and let
+ * other transfers use it once the last message has been added.  Give
+ * up recording if the cache has no room for it or it has been flushed.
+ */
+static void
+xfrcache_record(xfrout_ctx_t *xfr, isc_region_t *r) {
+	xfrcache_entry_t *entry = xfr->recording;
+	ns_xfrcache_t *cache = entry->cache;
+	isc_result_t result = ISC_R_NOSPACE;
+
+	LOCK(&cache->lock);
+	INSIST(!entry->complete);
+	/*
+	 * Unless the entry has been flushed, make room for 'r'.
+	 */
+	if (entry->linked && cache->size + r->length > XFRCACHE_MAXSIZE)
+		xfrcache_evict(cache, 0, 0, r->length);
+	if (entry->linked && cache->size + r->length <= XFRCACHE_MAXSIZE)
+		result = isc_buffer_reserve(&entry->data, r->length);
+	if (result == ISC_R_SUCCESS) {
+		isc_buffer_putmem(entry->data, r->base, r->length);
+		cache->size += r->length;
+		if (xfr->end_of_stream) {
+			isc_stdtime_get(&entry->expire);
+			entry->expire += XFRCACHE_LIFETIME;
+			entry->complete = ISC_TRUE;
+		}
+	} else if (entry->linked)
+		xfrcache_unlink(cache, entry);
+	if (result != ISC_R_SUCCESS || entry->complete) {
+		xfrcache_release(cache, entry);
+		xfr->recording = NULL;
+	}
+	UNLOCK(&cache->lock);
+}
+
+/*
+ * Stop using the cache, discarding any incomplete recording.
+ */
+static void
+xfrcache_finish(xfrout_ctx_t *xfr) {
+	xfrcache_entry_t *entry = xfr->recording;
+	ns_xfrcache_t *cache;
+
+	if (entry != NULL) {
+		cache = entry->cache;
+		LOCK(&cache->lock);
+		if (entry->linked)
+			xfrcache_unlink(cache, entry);
+		xfrcache_release(cache, entry);
+		UNLOCK(&cache->lock);
+		xfr->recording = NULL;
+	}
+	if (xfr->replaying != NULL)
+		xfrcache_detach(&xfr->replaying);
+}
+
+/*
+ * Like sendstream_wire(), but copy the messages from the cache entry
+ * being replayed, giving each this transfer's message ID and flags.
+ */
+static void
+sendstream_replay(xfrout_ctx_t *xfr) {
+	xfrcache_entry_t *entry = xfr->replaying;
+	isc_buffer_t txbuf;
+	isc_region_t r, data;
+	unsigned char *msg;
+	unsigned int len, n_msgs = 0;
+	isc_uint16_t flags;
+	isc_result_t result;
+
+	flags = DNS_MESSAGEFLAG_QR | DNS_MESSAGEFLAG_AA;
+	if ((xfr->client->attributes & NS_CLIENTATTR_RA) != 0)
+		flags |= DNS_MESSAGEFLAG_RA;
+
+	isc_buffer_usedregion(entry->data, &data);
+	isc_buffer_init(&txbuf, xfr->txmem, xfr->txmemlen);
+	while (xfr->replayoff < data.length) {
+		msg = data.base + xfr->replayoff;
+		len = 2 + ((msg[0] << 8) | msg[1]);
+		INSIST(len >= 2 + 12 && xfr->replayoff + len <= data.length);
+		if (isc_buffer_availablelength(&txbuf) < len)
+			break;
+		msg = isc_buffer_used(&txbuf);
+		isc_buffer_putmem(&txbuf, data.base + xfr->replayoff, len);
+		msg[2] = (xfr->id >> 8) & 0xff;
+		msg[3] = xfr->id & 0xff;
+		msg[4] = (flags >> 8) & 0xff;
+		msg[5] = flags & 0xff;
+		xfr->replayoff += len;
+		xfr->nmsg++;
+		n_msgs++;
+	}
+	if (xfr->replayoff == data.length)
+		xfr->end_of_stream = ISC_TRUE;
+
+	isc_buffer_usedregion(&txbuf, &r);
+	xfrout_log(xfr, ISC_LOG_DEBUG(8),
+		   "sending %u cached TCP messages in %u bytes",
+		   n_msgs, r.length);
+	CHECK(isc_socket_send(xfr->client->tcpsocket, &r,
+			      xfr->client->task, xfrout_senddone, xfr));
+	xfr->sends++;
+	return;
+
+ failure:
+	xfrout_fail(xfr, result, "sending zone data");
+}
+
 static void
 xfrout_ctx_destroy(xfrout_ctx_t **xfrp) {
 	xfrout_ctx_t *xfr = *xfrp;
@@ -1568,6 +2196,7 @@ xfrout_ctx_destroy(xfrout_ctx_t **xfrp) {
 	xfr->client->shutdown = NULL;
 	xfr->client->shutdown_arg = NULL;
 
+	xfrcache_finish(xfr);
 	if (xfr->stream != NULL)
 		xfr->stream->methods->destroy(&xfr->stream);
 	if (xfr->buf.base != NULL)